@@ -20,21 +20,66 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "core/conf.h"
 #include "core/ctx.h"
 #include "core/log.h"
+#include "core/log_bin.h"
+#include "core/upgrade.h"
 
-static void listeners_add(struct irc_ctx *const ctx)
+// clang-format off
+
+/// @brief The size at which a binary log file is rotated.
+#define BIN_LOG_SIZE_MAX        (64 * 1024 * 1024)
+
+/// @brief The number of rotated binary log files to keep.
+#define BIN_LOG_FILES_MAX       (8)
+
+// clang-format on
+
+static struct irc_log_bin bin_log;
+
+/// @brief The context a rehash is requested of on `SIGHUP`, and an upgrade on
+/// `SIGUSR2`.
+static struct irc_ctx *signal_ctx;
+
+static void rehash_signal(const int sig)
 {
-	static const struct irc_conf_listener local_listener = {
-		.host = "localhost", .port = "6667"
-	};
+	(void)sig;
 
-	enum irc_conf_status_code code;
+	irc_rehash_request(signal_ctx);
+}
+
+static void upgrade_signal(const int sig)
+{
+	(void)sig;
+
+	irc_upgrade_request(signal_ctx);
+}
+
+static void signal_handle(const int sig, void (*const handler)(int),
+			  const char *const name)
+{
+	struct sigaction sa = { .sa_handler = handler };
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(sig, &sa, NULL) < 0) {
+		fprintf(stderr, "unable to handle %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void signals_setup(struct irc_ctx *const ctx)
+{
+	signal_ctx = ctx;
 
-	irc_conf_listener_add(&ctx->conf, &local_listener, &code);
+	signal_handle(SIGHUP, &rehash_signal, "SIGHUP");
+	signal_handle(SIGUSR2, &upgrade_signal, "SIGUSR2");
 }
 
 static void log_msg(void *udata, const uint level, char *const str)
@@ -45,19 +90,240 @@ static void log_msg(void *udata, const uint level, char *const str)
 	printf("log msg: %s\n", str);
 }
 
+static void bin_log_setup(struct irc_ctx *const ctx, const char *const path)
+{
+	if (!irc_log_bin_open(&bin_log, path, BIN_LOG_SIZE_MAX,
+			      BIN_LOG_FILES_MAX)) {
+		fprintf(stderr, "unable to open binary log \"%s\"\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	ctx->log.bin = &bin_log;
+}
+
+static void args_parse(struct irc_ctx *const ctx, int argc, char **argv)
+{
+	int opt;
+
+	enum irc_conf_status_code code;
+
+	while ((opt = getopt(argc, argv,
+			     "b:c:C:d:f:F:H:i:I:k:l:L:m:n:p:Q:s:S:w:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bin_log_setup(ctx, optarg);
+			break;
+		case 'c':
+			if (!irc_conf_clones_set(&ctx->conf, optarg, &code)) {
+				fprintf(stderr,
+					"invalid connection limit \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'C':
+			if (!irc_conf_class_add(&ctx->conf, optarg, &code)) {
+				fprintf(stderr, "invalid class \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'd':
+			if (!irc_conf_dline_file_set(&ctx->conf, optarg,
+						     &code)) {
+				fprintf(stderr, "invalid D-line file \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			if (!irc_conf_fanout_budget_set(&ctx->conf, optarg,
+							&code)) {
+				fprintf(stderr, "invalid fanout budget \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'F': {
+			size_t line;
+
+			// What is wrong with the file has been logged.
+			if (!irc_conf_load(&ctx->conf, optarg, &line, &code)) {
+				fprintf(stderr,
+					"invalid configuration file \"%s\" "
+					"(line %zu)\n",
+					optarg, line);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'H':
+			if (!irc_conf_tables_vmem_set(&ctx->conf, optarg,
+						      &code)) {
+				fprintf(stderr, "invalid table memory \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'i':
+			if (!irc_conf_server_id_set(&ctx->conf, optarg,
+						    &code)) {
+				fprintf(stderr, "invalid server ID \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'I':
+			if (!irc_conf_snapshot_interval_set(&ctx->conf, optarg,
+							    &code)) {
+				fprintf(stderr,
+					"invalid snapshot interval \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'k':
+			if (!irc_conf_kline_add(&ctx->conf, optarg, &code)) {
+				fprintf(stderr, "invalid K-line mask \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'l':
+			if (!irc_conf_link_listener_set(&ctx->conf, optarg,
+							&code)) {
+				fprintf(stderr,
+					"invalid link listener address \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'L':
+			if (!irc_conf_link_add(&ctx->conf, optarg, &code)) {
+				fprintf(stderr, "invalid link \"%s\"\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'm':
+			if (!irc_conf_metrics_sock_set(&ctx->conf, optarg,
+						       &code)) {
+				fprintf(stderr,
+					"invalid metrics socket path \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'n':
+			if (!irc_conf_server_name_set(&ctx->conf, optarg,
+						      &code)) {
+				fprintf(stderr, "invalid server name \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'p': {
+			struct irc_conf_listener listener = {
+				.host = IRC_CONF_LISTENER_HOST_DEFAULT
+			};
+
+			const bool fits =
+				strlen(optarg) < sizeof(listener.port);
+
+			if (fits) {
+				strcpy(listener.port, optarg);
+			}
+
+			if (!fits || !irc_conf_listener_add(&ctx->conf,
+							    &listener, &code)) {
+				fprintf(stderr, "invalid client port \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'Q':
+			if (!irc_conf_queue_budget_set(&ctx->conf, optarg,
+						       &code)) {
+				fprintf(stderr, "invalid queue budget \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 's':
+			if (!irc_conf_filter_file_set(&ctx->conf, optarg,
+						      &code)) {
+				fprintf(stderr,
+					"invalid content filter file \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'S':
+			if (!irc_conf_snapshot_file_set(&ctx->conf, optarg,
+							&code)) {
+				fprintf(stderr,
+					"invalid snapshot file \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'w':
+			if (!irc_conf_watchdog_set(&ctx->conf, optarg,
+						   &code)) {
+				fprintf(stderr,
+					"invalid watchdog threshold \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-b binary_log_path] "
+				"[-c clone_limit[/ipv4_len/ipv6_len]] "
+				"[-C name:sendq[:recvq][@network]]... "
+				"[-d dline_file] [-f fanout_budget] "
+				"[-F conf_file] "
+				"[-H heap|pages|thp|hugetlb] [-i server_id] "
+				"[-I snapshot_interval_s] "
+				"[-k kline_mask]... [-l link_host:port] "
+				"[-L name:password[@host:port][,zip]]... "
+				"[-m metrics_socket_path] [-n server_name] "
+				"[-p client_port] [-Q queue_budget] "
+				"[-s content_filter_file] [-S snapshot_file] "
+				"[-w watchdog_threshold_ms]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
 static void ctx_setup(struct irc_ctx *const ctx)
 {
-	ctx->log.cb = &log_msg;
+	// Messages are only formatted as text if they are not being written
+	// to a binary log.
+	if (!ctx->log.bin) {
+		ctx->log.cb = &log_msg;
+	}
 	ctx->log.lvl = IRC_LOG_LVL_TRACE;
 	ctx->log.udata = ctx;
 
 	irc_init(ctx);
-	listeners_add(ctx);
+	signals_setup(ctx);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
 	struct irc_ctx ctx = {};
+
+	// An upgrade starts whatever binary is found at the same path, with the
+	// same arguments.
+	ctx.upgrade.argv = argv;
+
+	if (getenv(IRC_UPGRADE_ENV)) {
+		ctx.upgrade.resume = true;
+		unsetenv(IRC_UPGRADE_ENV);
+	}
+	args_parse(&ctx, argc, argv);
 	ctx_setup(&ctx);
 
 	irc_io_loop(&ctx);
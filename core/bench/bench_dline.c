@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_dline.c Measures loading a quarter of a million D-lines from a
+/// file, and looking up the addresses of a connection flood against them, as
+/// every accepted connection is.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "core/cidr.h"
+#include "core/clock.h"
+
+// clang-format off
+
+#define DLINE_NUM               (250000)
+#define LOOKUP_NUM              (10000000)
+
+// clang-format on
+
+static u32 rand_u32(void)
+{
+	return ((u32)rand() << 16) ^ (u32)rand();
+}
+
+/// @brief Writes networks of typical D-line sizes: mostly single IPv4
+/// addresses and /24s, with some IPv6 /64s and /48s of providers all over
+/// `2000::/4`.
+static void dlines_write(const char *const path)
+{
+	FILE *file = fopen(path, "w");
+
+	if (!file) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+
+	for (u32 i = 0; i < DLINE_NUM; ++i) {
+		const u32 addr = rand_u32();
+
+		switch (i % 4) {
+		case 0:
+		case 1:
+			fprintf(file, "%u.%u.%u.%u\n", addr >> 24,
+				(addr >> 16) & 0xff, (addr >> 8) & 0xff,
+				addr & 0xff);
+			break;
+		case 2:
+			fprintf(file, "%u.%u.%u.0/24\n", addr >> 24,
+				(addr >> 16) & 0xff, (addr >> 8) & 0xff);
+			break;
+		default:
+			fprintf(file, "2%03x:%x:%x:%x::/%d\n", addr >> 20,
+				(addr >> 4) & 0xffff, rand_u32() & 0xffff,
+				rand_u32() & 0xffff, (i % 8 == 3) ? 48 : 64);
+			break;
+		}
+	}
+	fclose(file);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/bench_dline_XXXXXX";
+	const int fd = mkstemp(path);
+
+	if (fd < 0) {
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	srand(38);
+	dlines_write(path);
+
+	struct irc_cidr_tree tree = {};
+	size_t line;
+
+	u64 start = irc_clock_mono_ns();
+	const bool ok = irc_cidr_load(&tree, path, &line);
+	const u64 load_ns = irc_clock_mono_ns() - start;
+
+	unlink(path);
+
+	if (!ok) {
+		fprintf(stderr, "unable to load line %zu\n", line);
+		return EXIT_FAILURE;
+	}
+
+	printf("%zu D-lines loaded in %" PRIu64 " ms\n", tree.num_entries,
+	       load_ns / 1000000);
+
+	// A flood comes from many addresses, about half of them IPv6.
+	static struct irc_cidr_addr addrs[4096];
+
+	for (size_t i = 0; i < sizeof(addrs) / sizeof(*addrs); ++i) {
+		if (i % 2) {
+			addrs[i].hi = (UINT64_C(0x2) << 60) |
+				      ((u64)rand_u32() << 28) | rand_u32();
+			addrs[i].lo = rand_u32();
+		} else {
+			addrs[i].hi = 0;
+			addrs[i].lo = (UINT64_C(0xffff) << 32) | rand_u32();
+		}
+	}
+
+	size_t matches = 0;
+	start = irc_clock_mono_ns();
+
+	for (size_t i = 0; i < LOOKUP_NUM; ++i) {
+		matches += irc_cidr_match(&tree, &addrs[i % 4096], NULL);
+	}
+	const u64 lookup_ns = irc_clock_mono_ns() - start;
+
+	printf("%d lookups in %" PRIu64 " ms, %" PRIu64 " ns each, %zu "
+	       "matched\n",
+	       LOOKUP_NUM, lookup_ns / 1000000, lookup_ns / LOOKUP_NUM,
+	       matches);
+
+	irc_cidr_tree_destroy(&tree);
+	return EXIT_SUCCESS;
+}
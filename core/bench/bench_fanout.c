@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_fanout.c Measures sending one channel message to a growing
+/// number of recipients, serialized once and shared by reference, against
+/// formatting it separately for every recipient.
+///
+/// Only queueing the message and releasing it again are measured; writing
+/// the send queues out costs the same either way.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "core/bcast.h"
+#include "core/chan.h"
+#include "core/ctx.h"
+#include "core/user.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The number of recipients queued to per run, spread over as many
+/// messages as it takes.
+#define SENDS_PER_RUN           (2000000)
+
+/// @brief Every Nth recipient has the `server-time` capability enabled, and
+/// needs the tagged variant.
+#define SERVER_TIME_EVERY       (10)
+
+#define SENDER_NICK             "sender"
+#define SENDER_USERNAME         "snd"
+#define SENDER_HOST             "192.0.2.1"
+#define CHAN_NAME               "#bench"
+
+#define TEXT                    "The quick brown fox jumps over the lazy dog"
+
+// clang-format on
+
+static struct irc_ctx ctx;
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((u64)ts.tv_sec * UINT64_C(1000000000)) + (u64)ts.tv_nsec;
+}
+
+/// @brief Releases everything queued to the members of a channel, as a flush
+/// would, while keeping the storage of their send queues.
+static void drain(const struct irc_chan *const chan)
+{
+	for (u32 i = 0; i < chan->members.num_entries; ++i) {
+		struct irc_user *user = chan->members.entries[i]->user;
+		struct irc_sendq *sendq = &user->sendq;
+
+		for (u32 j = 0; j < sendq->num_entries; ++j) {
+			irc_buf_unref(sendq->entries[(sendq->head + j) &
+						     (sendq->capacity - 1)]);
+		}
+		sendq->head = 0;
+		sendq->num_entries = 0;
+		sendq->head_off = 0;
+		sendq->len = 0;
+
+		user->flush_pending = false;
+	}
+	ctx.flush.num_entries = 0;
+}
+
+static void send_shared(struct irc_chan *const chan)
+{
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s!%s@%s PRIVMSG %s :%s", SENDER_NICK,
+		       SENDER_USERNAME, SENDER_HOST, chan->name, TEXT);
+	irc_bcast_chan(&ctx, &bc, chan, NULL);
+	irc_bcast_done(&bc);
+}
+
+static void send_per_recipient(struct irc_chan *const chan)
+{
+	for (u32 i = 0; i < chan->members.num_entries; ++i) {
+		irc_user_sendf(&ctx, chan->members.entries[i]->user,
+			       ":%s!%s@%s PRIVMSG %s :%s", SENDER_NICK,
+			       SENDER_USERNAME, SENDER_HOST, chan->name, TEXT);
+	}
+}
+
+static void run(const char *const name, struct irc_chan *const chan,
+		void (*const send)(struct irc_chan *))
+{
+	const u32 num_recipients = chan->members.num_entries;
+	const u32 num_msgs = (SENDS_PER_RUN + num_recipients - 1) /
+			     num_recipients;
+
+	// Warm up, which also grows the send queues to their final size.
+	send(chan);
+	drain(chan);
+
+	const u64 start = now_ns();
+
+	for (u32 i = 0; i < num_msgs; ++i) {
+		send(chan);
+		drain(chan);
+	}
+
+	const u64 elapsed = now_ns() - start;
+	const u64 num_sends = (u64)num_msgs * num_recipients;
+
+	printf("%-14s %7" PRIu32 " recipients: %10" PRIu64 " ns/msg %6" PRIu64
+	       " ns/recipient\n",
+	       name, num_recipients, elapsed / num_msgs, elapsed / num_sends);
+}
+
+int main(void)
+{
+	static const u32 recipients[] = { 10, 1000, 100000 };
+	static const size_t num_runs = sizeof(recipients) / sizeof(recipients[0]);
+
+	irc_init(&ctx);
+
+	// Measure delivering in one go, rather than the deferral of large
+	// channels to later I/O loop iterations.
+	ctx.conf.fanout.recipients_per_iter = IRC_CONF_FANOUT_BUDGET_MAX;
+
+	struct irc_user *users =
+		irc_calloc(recipients[num_runs - 1],
+			   sizeof(struct irc_user));
+
+	for (size_t i = 0; i < num_runs; ++i) {
+		struct irc_chan *chan = irc_chan_create(&ctx.chans, CHAN_NAME);
+
+		for (u32 j = 0; j < recipients[i]; ++j) {
+			struct irc_user *user = &users[j];
+
+			user->fd = (int)j;
+			user->caps = ((j % SERVER_TIME_EVERY) == 0)
+					     ? IRC_USER_CAP_SERVER_TIME
+					     : 0;
+
+			irc_chan_join(&ctx.chans, chan, user, 0);
+		}
+
+		run("shared", chan, &send_shared);
+		run("per-recipient", chan, &send_per_recipient);
+
+		// The channel is destroyed along with its last member.
+		for (u32 j = 0; j < recipients[i]; ++j) {
+			irc_chan_part_all(&ctx.chans, &users[j]);
+		}
+	}
+	return EXIT_SUCCESS;
+}
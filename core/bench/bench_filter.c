@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_filter.c Measures scanning message texts for thousands of
+/// spam phrases with the content filter. For comparison, a sample of the
+/// texts is also scanned one phrase at a time, as a filter built on
+/// `strcasestr()` would.
+
+// strcasestr(3) is a GNU extension.
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/clock.h"
+#include "core/filter.h"
+
+// clang-format off
+
+#define PHRASE_NUM              (5000)
+#define TEXT_NUM                (1000000)
+#define TEXT_LEN                (200)
+
+/// @brief The number of texts scanned one phrase at a time.
+#define NAIVE_TEXT_NUM          (2000)
+
+// clang-format on
+
+static char phrases[PHRASE_NUM][32];
+static char texts[64][TEXT_LEN + 1];
+
+/// @brief Fills a string with lower case words of 2 to 8 letters.
+static void words_fill(char *const str, const size_t len)
+{
+	size_t i = 0;
+
+	while (i < len) {
+		const size_t word_len = 2 + ((size_t)rand() % 7);
+
+		for (size_t j = 0; (j < word_len) && (i < len); ++j) {
+			str[i++] = (char)('a' + (rand() % 26));
+		}
+
+		if (i < len) {
+			str[i++] = ' ';
+		}
+	}
+	str[len] = '\0';
+}
+
+int main(void)
+{
+	const char *phrase_ptrs[PHRASE_NUM];
+
+	srand(39);
+
+	for (size_t i = 0; i < PHRASE_NUM; ++i) {
+		words_fill(phrases[i], 8 + ((size_t)rand() % 20));
+		phrase_ptrs[i] = phrases[i];
+	}
+
+	for (size_t i = 0; i < sizeof(texts) / sizeof(*texts); ++i) {
+		words_fill(texts[i], TEXT_LEN);
+	}
+
+	u64 start = irc_clock_mono_ns();
+	struct irc_filter *filter = irc_filter_new(phrase_ptrs, PHRASE_NUM);
+
+	printf("%d phrases compiled in %" PRIu64 " ms: %" PRIu32 " states, "
+	       "%" PRIu32 " classes, %zu KiB\n",
+	       PHRASE_NUM, (irc_clock_mono_ns() - start) / 1000000,
+	       filter->num_states, filter->num_classes,
+	       ((size_t)filter->num_states * (filter->num_classes + 1) * 4) /
+		       1024);
+
+	size_t matches = 0;
+	start = irc_clock_mono_ns();
+
+	for (size_t i = 0; i < TEXT_NUM; ++i) {
+		matches += irc_filter_match(filter, texts[i % 64], TEXT_LEN,
+					    NULL);
+	}
+	u64 elapsed = irc_clock_mono_ns() - start;
+
+	printf("automaton: %d texts in %" PRIu64 " ms, %" PRIu64
+	       " ns each, %zu matched\n",
+	       TEXT_NUM, elapsed / 1000000, elapsed / TEXT_NUM, matches);
+
+	matches = 0;
+	start = irc_clock_mono_ns();
+
+	for (size_t i = 0; i < NAIVE_TEXT_NUM; ++i) {
+		for (size_t j = 0; j < PHRASE_NUM; ++j) {
+			if (strcasestr(texts[i % 64], phrases[j])) {
+				matches++;
+				break;
+			}
+		}
+	}
+	elapsed = irc_clock_mono_ns() - start;
+
+	printf("strcasestr: %d texts in %" PRIu64 " ms, %" PRIu64
+	       " ns each, %zu matched\n",
+	       NAIVE_TEXT_NUM, elapsed / 1000000, elapsed / NAIVE_TEXT_NUM,
+	       matches);
+
+	irc_filter_free(filter);
+	return EXIT_SUCCESS;
+}
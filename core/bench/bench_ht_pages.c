@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_ht_pages.c Measures random lookups in hash tables of 1M and
+/// 10M entries backed by 4 KiB pages, by transparent huge pages and by the
+/// reserved huge page pool.
+///
+/// Keys are hashed with a cheap mixer rather than SipHash, so that the time
+/// left is mostly spent reaching the entries. How much of each table actually
+/// ended up on huge pages is read back from `/proc/self/smaps_rollup`; the
+/// reserved pool is usually empty unless `vm.nr_hugepages` has been raised,
+/// in which case the table falls back to transparent huge pages.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/clock.h"
+#include "core/hash_table.h"
+#include "core/vmem.h"
+
+// clang-format off
+
+#define LOOKUP_NUM              (10000000)
+
+// clang-format on
+
+static size_t key_hash(const void *const key, const u8 *const secret_key)
+{
+	(void)secret_key;
+
+	// The finalizer of MurmurHash3, which spreads every bit of the key
+	// over the low bits the table is indexed by.
+	u64 h = (u64)(uintptr_t)key;
+
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= UINT64_C(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+
+	return (size_t)h;
+}
+
+static u64 rand_next(u64 *const state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+/// @brief Returns the number of bytes of anonymous memory backed by huge
+/// pages.
+static u64 huge_bytes(void)
+{
+	FILE *file = fopen("/proc/self/smaps_rollup", "r");
+	char line[256];
+	u64 kib = 0;
+
+	if (!file) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "AnonHugePages: %" SCNu64, &kib) == 1) {
+			break;
+		}
+	}
+	fclose(file);
+
+	return kib * 1024;
+}
+
+static void bench_run(const size_t num_entries, const enum irc_vmem_mode mode)
+{
+	const struct irc_ht_conf conf = {
+		// clang-format off
+
+		.initial_capacity	= 4096,
+		.load_fact_max		= 75,
+		.hash			= &key_hash,
+		.vmem			= mode
+
+		// clang-format on
+	};
+
+	struct irc_ht ht;
+	irc_ht_init(&ht, &conf);
+
+	const u64 huge_before = huge_bytes();
+	u64 start = irc_clock_mono_ns();
+
+	for (size_t i = 1; i <= num_entries; ++i) {
+		irc_ht_add(&ht, (void *)(uintptr_t)i, (void *)(uintptr_t)i);
+	}
+
+	const u64 fill_ns = irc_clock_mono_ns() - start;
+	const u64 huge = huge_bytes() - huge_before;
+
+	u64 state = 88172645463325252;
+	size_t num_misses = 0;
+
+	start = irc_clock_mono_ns();
+
+	for (size_t i = 0; i < LOOKUP_NUM; ++i) {
+		const u64 id = (rand_next(&state) % num_entries) + 1;
+		void *key = (void *)(uintptr_t)id;
+		const void *val = irc_ht_get(&ht, key);
+
+		num_misses += (val != key);
+	}
+
+	if (num_misses) {
+		fprintf(stderr, "%zu lookups missed\n", num_misses);
+		exit(EXIT_FAILURE);
+	}
+
+	const u64 lookup_ns = irc_clock_mono_ns() - start;
+
+	printf("%8zu entries %-7s (as %-7s) %4zu MiB, %3" PRIu64
+	       "%% on huge pages: filled in %5" PRIu64 " ms, %6.1f ns/lookup\n",
+	       num_entries, irc_vmem_mode_name(mode),
+	       irc_vmem_mode_name(ht.mem.mode),
+	       (ht.capacity * sizeof(*ht.entries)) >> 20,
+	       (huge * 100) / (ht.capacity * sizeof(*ht.entries)),
+	       fill_ns / 1000000, (double)lookup_ns / LOOKUP_NUM);
+
+	irc_ht_destroy(&ht);
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 1000000, 10000000 };
+	static const enum irc_vmem_mode modes[] = { IRC_VMEM_PAGES,
+						    IRC_VMEM_THP,
+						    IRC_VMEM_HUGETLB };
+
+	for (size_t i = 0; i < (sizeof(sizes) / sizeof(*sizes)); ++i) {
+		for (size_t j = 0; j < (sizeof(modes) / sizeof(*modes)); ++j) {
+			bench_run(sizes[i], modes[j]);
+		}
+	}
+	return EXIT_SUCCESS;
+}
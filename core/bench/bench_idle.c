@@ -0,0 +1,339 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// @file bench_idle.c Measures the memory a server holds per idle client.
+///
+/// A server is forked, and this process connects and registers as many
+/// clients as it can, up to 100k or the number given as the only argument. The
+/// growth of the server's resident set, and what its pools report through
+/// STATS z, are then divided by the number of clients: once while every
+/// client is idle, and once while each has sent the start of a line without
+/// its end. Kernel socket buffers are not part of either.
+///
+/// Both processes need a descriptor per client, so the count is capped by the
+/// hard limit on open files.
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/compiler.h"
+#include "core/conf.h"
+#include "core/ctx.h"
+#include "core/pool.h"
+
+// clang-format off
+
+#define CLIENT_NUM              (100000)
+
+/// @brief The number of descriptors kept for anything but clients.
+#define FD_RESERVE              (64)
+
+/// @brief The number of clients connected before any is waited for.
+#define BATCH_NUM               (256)
+
+#define READ_BUF_SIZE           (4096)
+
+#define CONNECT_TRIES           (200)
+
+/// @brief How long the pools are polled for every client to have sent a
+/// partial line, in milliseconds.
+#define PARTIAL_WAIT_MS         (5000)
+
+// clang-format on
+
+static struct irc_ctx ctx;
+
+/// @brief What one STATS z report says the pools hold.
+struct pools {
+	u64 num_bytes[IRC_POOL_SYS_NUM + 1];
+	char names[IRC_POOL_SYS_NUM + 1][16];
+	size_t num_sys;
+};
+
+static int client_connect(const u16 port)
+{
+	const struct sockaddr_in addr = { .sin_family = AF_INET,
+					  .sin_port = htons(port),
+					  .sin_addr.s_addr =
+						  htonl(INADDR_LOOPBACK) };
+
+	// The server may not be listening yet.
+	for (int i = 0; i < CONNECT_TRIES; ++i) {
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd < 0) {
+			perror("socket");
+			exit(EXIT_FAILURE);
+		}
+		if (!connect(fd, (const struct sockaddr *)&addr,
+			     sizeof(addr))) {
+			return fd;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	fprintf(stderr, "unable to connect to port %" PRIu16 "\n", port);
+	exit(EXIT_FAILURE);
+}
+
+static void client_send(const int fd, const char *const data)
+{
+	const size_t len = strlen(data);
+
+	if (write(fd, data, len) != (ssize_t)len) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// @brief Reads until a line containing `needle` has been received, and
+/// returns everything read.
+static const char *client_wait(const int fd, const char *const needle)
+{
+	static char buf[READ_BUF_SIZE];
+	size_t len = 0;
+
+	for (;;) {
+		const ssize_t cnt = read(fd, &buf[len], sizeof(buf) - len - 1);
+
+		if (cnt <= 0) {
+			fprintf(stderr, "connection closed\n");
+			exit(EXIT_FAILURE);
+		}
+		len += (size_t)cnt;
+		buf[len] = '\0';
+
+		const char *found = strstr(buf, needle);
+
+		if (found && strchr(found, '\n')) {
+			return buf;
+		}
+		if (len == (sizeof(buf) - 1)) {
+			len = 0;
+		}
+	}
+}
+
+static void client_register(const int fd, const size_t idx)
+{
+	char line[128];
+
+	snprintf(line, sizeof(line), "NICK idle%zu\r\nUSER idle 0 * :idle\r\n",
+		 idx);
+	client_send(fd, line);
+}
+
+static size_t server_rss(const pid_t pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+
+	FILE *file = fopen(path, "r");
+	unsigned long size = 0;
+	unsigned long resident = 0;
+
+	if (!file || (fscanf(file, "%lu %lu", &size, &resident) != 2)) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(file);
+
+	return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/// @brief Asks for STATS z, and collects the line of every subsystem.
+static void pools_read(const int fd, struct pools *const pools)
+{
+	client_send(fd, "STATS z\r\n");
+
+	// RPL_ENDOFSTATS
+	const char *reply = client_wait(fd, " 219 ");
+
+	pools->num_sys = 0;
+
+	for (const char *line = reply; line && *line;) {
+		const char *text = strstr(line, " z :");
+		const char *eol = strchr(line, '\n');
+		char name[16];
+		u64 num_objs;
+		u64 num_bytes;
+
+		if (text && (!eol || (text < eol)) &&
+		    (pools->num_sys < (sizeof(pools->names) /
+				       sizeof(*pools->names))) &&
+		    (sscanf(text + 4, "%15s %" SCNu64 " objects %" SCNu64,
+			    name, &num_objs, &num_bytes) == 3)) {
+			strcpy(pools->names[pools->num_sys], name);
+			pools->num_bytes[pools->num_sys++] = num_bytes;
+		}
+		line = eol ? (eol + 1) : NULL;
+	}
+}
+
+IRC_ATTRIB_PURE
+static u64 pools_bytes(const struct pools *const pools, const char *const name)
+{
+	for (size_t i = 0; i < pools->num_sys; ++i) {
+		if (!strcmp(pools->names[i], name)) {
+			return pools->num_bytes[i];
+		}
+	}
+	return 0;
+}
+
+static void report(const char *const what, const size_t num_clients,
+		   const size_t rss, const struct pools *const base,
+		   const struct pools *const pools)
+{
+	printf("%-8s %zu clients: %6zu bytes per client resident, pools:",
+	       what, num_clients, rss / num_clients);
+
+	for (size_t i = 0; i < pools->num_sys; ++i) {
+		const u64 grown = pools->num_bytes[i] -
+				  pools_bytes(base, pools->names[i]);
+
+		printf(" %s %" PRIu64, pools->names[i], grown / num_clients);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t num_clients = (argc > 1) ? strtoul(argv[1], NULL, 10)
+					: CLIENT_NUM;
+
+	// Both ends of every connection count against the same limit, which
+	// the server inherits.
+	struct rlimit lim;
+	getrlimit(RLIMIT_NOFILE, &lim);
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+
+	if ((lim.rlim_cur != RLIM_INFINITY) &&
+	    ((num_clients + FD_RESERVE) > lim.rlim_cur)) {
+		num_clients = (size_t)lim.rlim_cur - FD_RESERVE;
+		printf("open files are limited to %zu; using %zu clients\n",
+		       (size_t)lim.rlim_cur, num_clients);
+	}
+
+	// Some room away from the usual ports, and from other runs.
+	const u16 port = (u16)(30000 + (getpid() % 5000));
+
+	char port_str[8];
+	snprintf(port_str, sizeof(port_str), "%" PRIu16, port);
+
+	struct irc_conf_listener listener = { .host = "127.0.0.1" };
+	strcpy(listener.port, port_str);
+
+	enum irc_conf_status_code code;
+
+	if (!irc_conf_server_name_set(&ctx.conf, "idle.bench", &code) ||
+	    !irc_conf_listener_add(&ctx.conf, &listener, &code)) {
+		fprintf(stderr, "invalid configuration\n");
+		return EXIT_FAILURE;
+	}
+
+	const pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (!pid) {
+		irc_init(&ctx);
+		irc_io_loop(&ctx);
+		_exit(EXIT_SUCCESS);
+	}
+
+	// The probe is registered first, so that whatever the first client
+	// costs the server once is not put on the clients.
+	const int probe = client_connect(port);
+	client_register(probe, num_clients);
+	client_wait(probe, " 005 ");
+
+	struct pools base;
+	pools_read(probe, &base);
+
+	const size_t rss_base = server_rss(pid);
+
+	int *fds = calloc(num_clients, sizeof(*fds));
+
+	for (size_t i = 0; i < num_clients; i += BATCH_NUM) {
+		const size_t end = ((i + BATCH_NUM) < num_clients)
+					   ? (i + BATCH_NUM)
+					   : num_clients;
+
+		for (size_t j = i; j < end; ++j) {
+			fds[j] = client_connect(port);
+			client_register(fds[j], j);
+		}
+		for (size_t j = i; j < end; ++j) {
+			client_wait(fds[j], " 005 ");
+		}
+	}
+
+	struct pools idle;
+	pools_read(probe, &idle);
+	report("idle", num_clients, server_rss(pid) - rss_base, &base, &idle);
+
+	for (size_t i = 0; i < num_clients; ++i) {
+		client_send(fds[i], "PRIVMSG #nowhere :the start of a li");
+	}
+
+	// There is no reply to wait for, so the pools are watched until every
+	// partial line has been taken in.
+	struct pools partial;
+
+	for (int waited = 0;; waited += 10) {
+		pools_read(probe, &partial);
+
+		const u64 grown = pools_bytes(&partial, "recvqs") -
+				  pools_bytes(&base, "recvqs");
+
+		if ((grown >= (num_clients * IRC_USER_RECVQ_LEN_MAX)) ||
+		    (waited >= PARTIAL_WAIT_MS)) {
+			break;
+		}
+		usleep(10000);
+	}
+	report("partial", num_clients, server_rss(pid) - rss_base, &base,
+	       &partial);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	for (size_t i = 0; i < num_clients; ++i) {
+		close(fds[i]);
+	}
+	free(fds);
+	close(probe);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,499 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_link.c Measures netbursts between servers linked over
+/// loopback.
+///
+/// Two servers are forked, A and B. This process links to A as a third
+/// server, and bursts 100k users and their channels into it, timing how long
+/// A takes to take them in. B is then started, and links to A; A bursts
+/// everything to B, and the time until B has taken it all in is measured with
+/// a PING routed to B through A, which B only answers once it has processed
+/// everything A sent before. Finally, this process links to B, and times the
+/// burst B sends it, counting its bytes and the reads it takes.
+///
+/// All of it is run twice: with plain links, and then, if the core is built
+/// with zlib, with the links between A, B and this process compressed.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/clock.h"
+#include "core/conf.h"
+#include "core/ctx.h"
+#include "core/link.h"
+#include "core/zip.h"
+
+// clang-format off
+
+#define USER_NUM                (100000)
+#define CHAN_NUM                (1000)
+
+/// @brief The number of users joining each channel.
+#define CHAN_SIZE               (100)
+
+#define PASSWORD                "bench"
+
+#define SEED_SID                "9SD"
+#define PROBE_SID               "8PR"
+
+/// @brief The size of the buffer lines are batched in before being written.
+#define WRITE_BUF_SIZE          (64 * 1024)
+
+#define READ_BUF_SIZE           (64 * 1024)
+
+/// @brief The size of the buffer compressed lines are decompressed into,
+/// which a read of @ref ZIP_READ_SIZE bytes must not overflow.
+#define ZIP_BUF_SIZE            (1024 * 1024)
+#define ZIP_READ_SIZE           (8 * 1024)
+
+/// @brief How often B is pinged until it answers, in milliseconds.
+#define PING_INTERVAL_MS        (5)
+
+#define CONNECT_TRIES           (200)
+
+// clang-format on
+
+static struct irc_ctx ctx;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A connection to a forked server, read a line at a time.
+struct peer {
+	int fd;
+
+	/// @brief The number of bytes and read(2) calls received.
+	size_t num_bytes;
+	size_t num_reads;
+
+	/// @brief Decompresses what is received, once the link is compressed.
+	struct irc_zip *zip;
+
+	size_t len;
+	char buf[ZIP_BUF_SIZE];
+
+	size_t out_len;
+	char out[WRITE_BUF_SIZE];
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Runs a server, never returning.
+static void server_run(const char *const sid, const char *const name,
+		       const char *const listener, const char *const *links,
+		       const size_t num_links)
+{
+	enum irc_conf_status_code code;
+
+	bool ok = irc_conf_server_id_set(&ctx.conf, sid, &code) &&
+		  irc_conf_server_name_set(&ctx.conf, name, &code) &&
+		  irc_conf_link_listener_set(&ctx.conf, listener, &code);
+
+	for (size_t i = 0; ok && (i < num_links); ++i) {
+		ok = irc_conf_link_add(&ctx.conf, links[i], &code);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "%s: invalid configuration\n", name);
+		exit(EXIT_FAILURE);
+	}
+	irc_init(&ctx);
+	irc_io_loop(&ctx);
+}
+
+static pid_t server_fork(const char *const sid, const char *const name,
+			 const char *const listener,
+			 const char *const *const links,
+			 const size_t num_links)
+{
+	const pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!pid) {
+		server_run(sid, name, listener, links, num_links);
+	}
+	return pid;
+}
+
+static void peer_connect(struct peer *const peer, const u16 port)
+{
+	const struct sockaddr_in addr = { .sin_family = AF_INET,
+					  .sin_port = htons(port),
+					  .sin_addr.s_addr =
+						  htonl(INADDR_LOOPBACK) };
+
+	// The server may not be listening yet.
+	for (int i = 0; i < CONNECT_TRIES; ++i) {
+		peer->fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (!connect(peer->fd, (const struct sockaddr *)&addr,
+			     sizeof(addr))) {
+			return;
+		}
+		close(peer->fd);
+		usleep(10000);
+	}
+	fprintf(stderr, "unable to connect to port %" PRIu16 "\n", port);
+	exit(EXIT_FAILURE);
+}
+
+static void peer_flush(struct peer *const peer)
+{
+	for (size_t pos = 0; pos < peer->out_len;) {
+		const ssize_t cnt =
+			write(peer->fd, &peer->out[pos], peer->out_len - pos);
+
+		if (cnt <= 0) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+		pos += (size_t)cnt;
+	}
+	peer->out_len = 0;
+}
+
+IRC_ATTRIB_FMT(printf, 2, 3)
+static void peer_sendf(struct peer *const peer, const char *const fmt, ...)
+{
+	if ((peer->out_len + IRC_LINK_LINE_LEN_MAX) > sizeof(peer->out)) {
+		peer_flush(peer);
+	}
+
+	va_list args;
+	va_start(args, fmt);
+
+	const int len = vsnprintf(&peer->out[peer->out_len],
+				  IRC_LINK_LINE_LEN_MAX - 1, fmt, args);
+
+	va_end(args);
+
+	peer->out_len += (size_t)len;
+	peer->out[peer->out_len++] = '\r';
+	peer->out[peer->out_len++] = '\n';
+}
+
+static void peer_append(void *const udata, const char *const data,
+			const size_t len)
+{
+	struct peer *peer = udata;
+
+	if ((peer->len + len) > sizeof(peer->buf)) {
+		fprintf(stderr, "decompressed data overflows\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(&peer->buf[peer->len], data, len);
+	peer->len += len;
+}
+
+/// @brief Starts decompressing what is received, including whatever is
+/// buffered but not yet read as lines.
+static void peer_zip_start(struct peer *const peer)
+{
+	char rest[READ_BUF_SIZE];
+	const size_t len = peer->len;
+
+	memcpy(rest, peer->buf, len);
+	peer->len = 0;
+	peer->zip = irc_zip_inflater_new();
+
+	if (!irc_zip_inflate(peer->zip, rest, len, &peer_append, peer)) {
+		fprintf(stderr, "corrupt compressed data\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// @brief Reads the next line.
+///
+/// @param timeout_ms How long to wait for it, or -1 to wait for as long as
+/// it takes.
+/// @returns The line, without its terminator, or `NULL` on a timeout.
+static const char *peer_line(struct peer *const peer, const int timeout_ms)
+{
+	static char line[READ_BUF_SIZE];
+
+	for (;;) {
+		char *eol = memchr(peer->buf, '\n', peer->len);
+
+		if (eol) {
+			const size_t len = (size_t)(eol - peer->buf);
+
+			memcpy(line, peer->buf, len);
+			line[(len && (line[len - 1] == '\r')) ? (len - 1)
+							      : len] = '\0';
+
+			peer->len -= len + 1;
+			memmove(peer->buf, eol + 1, peer->len);
+			return line;
+		}
+		struct pollfd pfd = { .fd = peer->fd, .events = POLLIN };
+
+		if (poll(&pfd, 1, timeout_ms) == 0) {
+			return NULL;
+		}
+		char data[READ_BUF_SIZE];
+
+		// Compressed data is read in small pieces, so that it fits
+		// once decompressed.
+		const size_t room = peer->zip ? ZIP_READ_SIZE
+					      : (sizeof(peer->buf) - peer->len);
+		const ssize_t cnt = read(peer->fd, data,
+					 (room < sizeof(data)) ? room
+							       : sizeof(data));
+
+		if (cnt <= 0) {
+			fprintf(stderr, "connection lost\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (!peer->zip) {
+			peer_append(peer, data, (size_t)cnt);
+		} else if (!irc_zip_inflate(peer->zip, data, (size_t)cnt,
+					    &peer_append, peer)) {
+			fprintf(stderr, "corrupt compressed data\n");
+			exit(EXIT_FAILURE);
+		}
+		peer->num_bytes += (size_t)cnt;
+		peer->num_reads++;
+	}
+}
+
+static void handshake_send(struct peer *const peer, const char *const sid,
+			   const char *const name, const bool zip)
+{
+	peer_sendf(peer, "PASS " PASSWORD " TS 6 :%s", sid);
+
+	if (zip) {
+		peer_sendf(peer, "CAPAB :ZIP");
+	}
+	peer_sendf(peer, "SERVER %s 1 :bench", name);
+	peer_flush(peer);
+}
+
+/// @brief Sends the users and channels of the seed server.
+static void seed_burst(struct peer *const peer)
+{
+	const u64 sid = irc_link_sid_decode(SEED_SID);
+	char uid[IRC_USER_UID_LEN + 1];
+
+	for (u32 i = 0; i < USER_NUM; ++i) {
+		irc_link_uid_encode((sid << 32) | i, uid);
+
+		peer_sendf(peer,
+			   ":" SEED_SID " UID user%" PRIu32
+			   " 1 1000 u%" PRIu32 " 10.%" PRIu32 ".%" PRIu32
+			   ".%" PRIu32 " %s :Bench user",
+			   i, i % 1000, (i >> 16) & 0xff, (i >> 8) & 0xff,
+			   i & 0xff, uid);
+	}
+
+	// Each channel is as long as a line allows, or more.
+	for (u32 i = 0; i < CHAN_NUM; ++i) {
+		char members[IRC_LINK_LINE_LEN_MAX];
+		size_t len = 0;
+
+		for (u32 j = 0; j < CHAN_SIZE; ++j) {
+			if ((len + IRC_USER_UID_LEN + 3) > 400) {
+				members[len - 1] = '\0';
+				peer_sendf(peer,
+					   ":" SEED_SID " SJOIN 1000 #chan%" PRIu32
+					   " + :%s",
+					   i, members);
+				len = 0;
+			}
+			const u32 user = ((i * CHAN_SIZE) + j) % USER_NUM;
+			irc_link_uid_encode((sid << 32) | user, uid);
+
+			if (!j) {
+				members[len++] = '@';
+			}
+			memcpy(&members[len], uid, IRC_USER_UID_LEN);
+			len += IRC_USER_UID_LEN;
+			members[len++] = ' ';
+		}
+		members[len - 1] = '\0';
+		peer_sendf(peer, ":" SEED_SID " SJOIN 1000 #chan%" PRIu32 " + :%s",
+			   i, members);
+	}
+	peer_sendf(peer, ":" SEED_SID " EOB");
+}
+
+/// @brief Pings a server through the seed link until it answers.
+static void ping_wait(struct peer *const peer, const char *const sid,
+		      const int interval_ms)
+{
+	char pong[32];
+	snprintf(pong, sizeof(pong), " PONG %s " SEED_SID, sid);
+
+	for (;;) {
+		peer_sendf(peer, ":" SEED_SID " PING " SEED_SID " %s", sid);
+		peer_flush(peer);
+
+		const char *line;
+
+		while ((line = peer_line(peer, interval_ms))) {
+			if (strstr(line, pong)) {
+				return;
+			}
+		}
+	}
+}
+
+static u64 ms_since(const u64 start_ns)
+{
+	return (irc_clock_mono_ns() - start_ns) / 1000000;
+}
+
+/// @brief Runs the benchmark once.
+///
+/// @returns `true` if the probe received every user.
+static bool bench_run(const u16 port_a, const bool zip)
+{
+	const u16 port_b = (u16)(port_a + 1);
+	const char *const opts = zip ? ",zip" : "";
+
+	char listener_a[32];
+	char listener_b[32];
+	char link_a[64];
+	char link_b[64];
+	char link_probe[64];
+
+	snprintf(listener_a, sizeof(listener_a), "127.0.0.1:%" PRIu16, port_a);
+	snprintf(listener_b, sizeof(listener_b), "127.0.0.1:%" PRIu16, port_b);
+	snprintf(link_a, sizeof(link_a), "a.bench:" PASSWORD "@%s%s",
+		 listener_a, opts);
+	snprintf(link_b, sizeof(link_b), "b.bench:" PASSWORD "%s", opts);
+	snprintf(link_probe, sizeof(link_probe), "probe.bench:" PASSWORD "%s",
+		 opts);
+
+	const char *const links_a[] = { "seed.bench:" PASSWORD, link_b };
+	const char *const links_b[] = { link_a, link_probe };
+
+	printf("%s links:\n", zip ? "compressed" : "plain");
+
+	const pid_t pid_a = server_fork("1AA", "a.bench", listener_a, links_a,
+					2);
+
+	static struct peer seed;
+	memset(&seed, 0, sizeof(seed));
+	peer_connect(&seed, port_a);
+
+	u64 start = irc_clock_mono_ns();
+
+	handshake_send(&seed, SEED_SID, "seed.bench", false);
+	seed_burst(&seed);
+	ping_wait(&seed, "1AA", -1);
+
+	printf("  seed -> A: %d users, %d channels taken in %" PRIu64 " ms\n", USER_NUM,
+	       CHAN_NUM, ms_since(start));
+
+	start = irc_clock_mono_ns();
+
+	const pid_t pid_b = server_fork("2BB", "b.bench", listener_b, links_b,
+					2);
+
+	ping_wait(&seed, "2BB", PING_INTERVAL_MS);
+
+	printf("  A -> B: linked and synchronized in %" PRIu64 " ms\n",
+	       ms_since(start));
+
+	static struct peer probe;
+	memset(&probe, 0, sizeof(probe));
+	peer_connect(&probe, port_b);
+
+	start = irc_clock_mono_ns();
+	handshake_send(&probe, PROBE_SID, "probe.bench", zip);
+
+	u32 num_users = 0;
+	u32 num_sjoins = 0;
+
+	for (;;) {
+		const char *line = peer_line(&probe, -1);
+
+		if (strstr(line, " UID ")) {
+			num_users++;
+		} else if (strstr(line, " SJOIN ")) {
+			num_sjoins++;
+		} else if (!strcmp(line, ":2BB EOB")) {
+			break;
+		} else if (zip && !probe.zip && !strncmp(line, "SERVER ", 7)) {
+			peer_zip_start(&probe);
+		}
+	}
+	const u64 burst_ms = ms_since(start);
+
+	printf("  B -> probe: %" PRIu32 " users, %" PRIu32
+	       " SJOIN lines, %zu bytes in %zu reads, %" PRIu64 " ms\n",
+	       num_users, num_sjoins, probe.num_bytes, probe.num_reads,
+	       burst_ms);
+
+	if (probe.zip) {
+		const struct irc_zip_stats *stats = irc_zip_stats(probe.zip);
+
+		printf("  B -> probe: %" PRIu64 " bytes decompressed, "
+		       "%" PRIu64 "%% on the wire, %" PRIu64
+		       " ms of CPU to decompress\n",
+		       stats->plain_bytes,
+		       (stats->wire_bytes * 100) / stats->plain_bytes,
+		       stats->cpu_ns / 1000000);
+
+		irc_zip_free(probe.zip);
+	}
+	close(seed.fd);
+	close(probe.fd);
+
+	kill(pid_a, SIGTERM);
+	kill(pid_b, SIGTERM);
+	waitpid(pid_a, NULL, 0);
+	waitpid(pid_b, NULL, 0);
+
+	return num_users == USER_NUM;
+}
+
+int main(void)
+{
+	// Some room away from the usual ports, and from other runs.
+	const u16 port = (u16)(20000 + ((getpid() % 5000) * 4));
+
+	bool ok = bench_run(port, false);
+
+	if (ok && irc_zip_supported()) {
+		ok = bench_run((u16)(port + 2), true);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
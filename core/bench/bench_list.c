@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_list.c Measures many users listing half a million channels at
+/// once, with the filters clients commonly send.
+///
+/// Replies are streamed a chunk per I/O loop iteration, and every iteration
+/// is timed; the send queues are drained after each, as if the clients kept
+/// up. For comparison, the whole of an unfiltered listing is also formatted
+/// in one go, as a server without streaming would.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/chan.h"
+#include "core/clock.h"
+#include "core/cmd.h"
+#include "core/ctx.h"
+#include "core/irc_parse.h"
+#include "core/user.h"
+#include "core/util.h"
+
+// clang-format off
+
+#define CHAN_NUM                (500000)
+#define USER_NUM                (50000)
+
+/// @brief The size of a channel is one, plus this divided by its rank.
+#define CHAN_SIZE_SCALE         (20000)
+
+/// @brief The number of users listing the channels at once.
+#define LISTER_NUM              (32)
+
+// clang-format on
+
+static struct irc_ctx ctx;
+
+/// @brief Releases everything queued to a user, as a flush would.
+///
+/// @returns The number of bytes that were queued.
+static size_t drain(struct irc_user *const user)
+{
+	struct irc_sendq *sendq = &user->sendq;
+	const size_t len = sendq->len;
+
+	irc_sendq_clear(sendq);
+	user->flush_pending = false;
+
+	return len;
+}
+
+static void list_send(struct irc_user *const user, const char *const line)
+{
+	struct irc_msg msg = {};
+
+	irc_msg_parse(line, strlen(line), &msg);
+	irc_cmd_dispatch(&ctx, user, &msg);
+}
+
+static void populate(struct irc_user *const users)
+{
+	char name[IRC_CHAN_NAME_LEN_MAX + 1];
+
+	for (u32 i = 0; i < CHAN_NUM; ++i) {
+		snprintf(name, sizeof(name), "#chan%" PRIu32, i);
+
+		struct irc_chan *chan = irc_chan_create(&ctx.chans, name);
+		const u32 size = 1 + (CHAN_SIZE_SCALE / (i + 1));
+
+		for (u32 j = 0; j < size; ++j) {
+			irc_chan_join(&ctx.chans, chan,
+				      &users[(i + j) % USER_NUM], 0);
+		}
+	}
+}
+
+/// @brief Lists the channels in one go per user, rather than streaming them.
+static void run_unpaced(struct irc_user *const lister)
+{
+	const u64 start = irc_clock_mono_ns();
+
+	for (const struct irc_chan *chan =
+		     irc_chan_seek_name(&ctx.chans, "", false);
+	     chan; chan = irc_chan_next_name(chan)) {
+		irc_user_sendf(&ctx, lister, ":%s 322 %s %s %" PRIu32 " :",
+			       ctx.conf.server_name, lister->nick, chan->name,
+			       chan->members.num_entries);
+	}
+
+	const u64 elapsed = irc_clock_mono_ns() - start;
+	const size_t len = drain(lister);
+
+	printf("unpaced,   1 user:  %8" PRIu64 " us in 1 iteration, %8zu KiB "
+	       "queued\n",
+	       elapsed / 1000, len / 1024);
+}
+
+static void run_streamed(struct irc_user *const listers)
+{
+	static const char *const lines[] = {
+		"LIST\r\n",          "LIST >100\r\n",        "LIST <2\r\n",
+		"LIST #chan1*\r\n",  "LIST *99*\r\n",        "LIST C<60,>3\r\n",
+		"LIST #chan42*,<5\r\n", "LIST >1000,<5000\r\n"
+	};
+	static const size_t num_lines = sizeof(lines) / sizeof(lines[0]);
+
+	u64 start = irc_clock_mono_ns();
+
+	for (u32 i = 0; i < LISTER_NUM; ++i) {
+		list_send(&listers[i], lines[i % num_lines]);
+	}
+
+	u64 iter_max = irc_clock_mono_ns() - start;
+	u64 total = iter_max;
+	u64 num_iters = 1;
+	size_t queued_max = 0;
+	size_t queued = 0;
+
+	for (;;) {
+		for (u32 i = 0; i < LISTER_NUM; ++i) {
+			const size_t len = drain(&listers[i]);
+
+			queued += len;
+			queued_max = (len > queued_max) ? len : queued_max;
+		}
+		ctx.flush.num_entries = 0;
+
+		if (!ctx.list.num_entries) {
+			break;
+		}
+
+		start = irc_clock_mono_ns();
+		irc_cmd_streams_run(&ctx);
+
+		const u64 elapsed = irc_clock_mono_ns() - start;
+
+		iter_max = (elapsed > iter_max) ? elapsed : iter_max;
+		total += elapsed;
+		num_iters++;
+	}
+
+	printf("streamed, %d users: %8" PRIu64 " us in %" PRIu64
+	       " iterations, %" PRIu64 " us per iteration at most\n",
+	       LISTER_NUM, total / 1000, num_iters, iter_max / 1000);
+	printf("                    %8zu KiB sent, %zu KiB queued per user at "
+	       "most\n",
+	       queued / 1024, queued_max / 1024);
+}
+
+int main(void)
+{
+	irc_init(&ctx);
+
+	struct irc_user *users = irc_calloc(USER_NUM, sizeof(*users));
+	struct irc_user *listers = irc_calloc(LISTER_NUM, sizeof(*listers));
+
+	for (u32 i = 0; i < LISTER_NUM; ++i) {
+		listers[i].fd = -1;
+		listers[i].registered = true;
+		snprintf(listers[i].nick, sizeof(listers[i].nick),
+			 "lister%" PRIu32, i);
+	}
+
+	u64 start = irc_clock_mono_ns();
+
+	populate(users);
+
+	printf("%d channels indexed in %" PRIu64 " ms\n", CHAN_NUM,
+	       (irc_clock_mono_ns() - start) / 1000000);
+
+	run_unpaced(&listers[0]);
+	run_streamed(listers);
+
+	return EXIT_SUCCESS;
+}
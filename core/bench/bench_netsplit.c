@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_netsplit.c Measures telling the users sharing a channel with
+/// each of a few thousand users that it quit, back to back, as happens in a
+/// netsplit.
+///
+/// The channel graph follows a power law: a few channels hold thousands of
+/// users, while most hold a handful. Recipients are deduplicated by epoch
+/// stamps, by a temporary hash set per quit, or not at all, i.e. once per
+/// shared channel. Epoch stamps are measured again with the default fanout
+/// budget, which defers the quits in the largest channels, and delivers them
+/// after each quit as an I/O loop iteration would.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/bcast.h"
+#include "core/chan.h"
+#include "core/ctx.h"
+#include "core/user.h"
+#include "core/util.h"
+
+// clang-format off
+
+#define USER_NUM                (20000)
+#define CHAN_NUM                (2000)
+
+/// @brief The number of users on the side of the split that goes away.
+#define SPLIT_NUM               (5000)
+
+/// @brief The size of a channel is roughly this, divided by its rank.
+#define CHAN_SIZE_SCALE         (8000)
+#define CHAN_SIZE_MIN           (2)
+
+#define SEED                    UINT64_C(0x9e3779b97f4a7c15)
+
+// clang-format on
+
+static struct irc_ctx ctx;
+static struct irc_user *users;
+
+static u64 rng_state;
+
+static u64 rng_next(void)
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+
+	return rng_state * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((u64)ts.tv_sec * UINT64_C(1000000000)) + (u64)ts.tv_nsec;
+}
+
+/// @brief Builds the same channel graph on every call.
+static void graph_build(void)
+{
+	rng_state = SEED;
+
+	for (u32 rank = 1; rank <= CHAN_NUM; ++rank) {
+		char name[IRC_CHAN_NAME_LEN_MAX + 1];
+		snprintf(name, sizeof(name), "#chan%" PRIu32, rank);
+
+		struct irc_chan *chan = irc_chan_create(&ctx.chans, name);
+		const u32 size = CHAN_SIZE_MIN + (CHAN_SIZE_SCALE / rank);
+
+		while (chan->members.num_entries < size) {
+			struct irc_user *user = &users[rng_next() % USER_NUM];
+
+			if (!irc_chan_member_find(&ctx.chans, chan, user)) {
+				irc_chan_join(&ctx.chans, chan, user, 0);
+			}
+		}
+	}
+}
+
+/// @brief Releases everything queued, as a flush would, while keeping the
+/// storage of the send queues.
+///
+/// @returns The number of lines released.
+static u64 drain(void)
+{
+	u64 num_lines = 0;
+
+	for (u32 i = 0; i < ctx.flush.num_entries; ++i) {
+		struct irc_user *user = ctx.flush.entries[i];
+		struct irc_sendq *sendq = &user->sendq;
+
+		for (u32 j = 0; j < sendq->num_entries; ++j) {
+			irc_buf_unref(sendq->entries[(sendq->head + j) &
+						     (sendq->capacity - 1)]);
+		}
+		num_lines += sendq->num_entries;
+
+		sendq->head = 0;
+		sendq->num_entries = 0;
+		sendq->head_off = 0;
+		sendq->len = 0;
+
+		user->flush_pending = false;
+	}
+	ctx.flush.num_entries = 0;
+
+	return num_lines;
+}
+
+static void quit_epoch(struct irc_user *const user, struct irc_bcast *const bc)
+{
+	irc_bcast_common(&ctx, bc, user, 0);
+}
+
+static void quit_per_chan(struct irc_user *const user,
+			  struct irc_bcast *const bc)
+{
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		irc_bcast_chan(&ctx, bc, user->chans.entries[i]->chan, user);
+	}
+}
+
+static void quit_hash_set(struct irc_user *const user,
+			  struct irc_bcast *const bc)
+{
+	static const struct irc_ht_conf cfg = { .initial_capacity = 64,
+						.load_fact_max = 75 };
+
+	struct irc_ht seen;
+	irc_ht_init(&seen, &cfg);
+
+	irc_ht_add(&seen, user, user);
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		const struct irc_chan *chan = user->chans.entries[i]->chan;
+
+		for (u32 j = 0; j < chan->members.num_entries; ++j) {
+			struct irc_user *dst = chan->members.entries[j]->user;
+
+			if (!irc_ht_get(&seen, dst)) {
+				irc_ht_add(&seen, dst, dst);
+				irc_bcast_user(&ctx, bc, dst);
+			}
+		}
+	}
+	irc_ht_destroy(&seen);
+}
+
+static void run(const char *const name,
+		void (*const quit)(struct irc_user *, struct irc_bcast *),
+		const uint budget)
+{
+	ctx.conf.fanout.recipients_per_iter = budget;
+
+	graph_build();
+
+	u64 elapsed = 0;
+	u64 num_lines = 0;
+
+	for (u32 i = 0; i < SPLIT_NUM; ++i) {
+		struct irc_user *user = &users[i];
+		struct irc_bcast bc;
+
+		const u64 start = now_ns();
+
+		irc_bcast_init(&bc, ":user%" PRIu32 "!u@192.0.2.1 QUIT "
+				    ":irc.east.example irc.west.example",
+			       i);
+		quit(user, &bc);
+		irc_bcast_done(&bc);
+
+		irc_chan_part_all(&ctx.chans, user);
+		irc_bcast_backlog_run(&ctx);
+
+		elapsed += now_ns() - start;
+		num_lines += drain();
+	}
+
+	while (ctx.chans.backlog.head) {
+		const u64 start = now_ns();
+
+		irc_bcast_backlog_run(&ctx);
+
+		elapsed += now_ns() - start;
+		num_lines += drain();
+	}
+
+	printf("%-10s %5d quits: %8" PRIu64 " us total %7" PRIu64
+	       " ns/quit %9" PRIu64 " lines\n",
+	       name, SPLIT_NUM, elapsed / 1000, elapsed / SPLIT_NUM, num_lines);
+
+	for (u32 i = 0; i < USER_NUM; ++i) {
+		irc_chan_part_all(&ctx.chans, &users[i]);
+	}
+}
+
+int main(void)
+{
+	irc_init(&ctx);
+
+	users = irc_calloc(USER_NUM, sizeof(struct irc_user));
+
+	// Delivering in one go first, rather than deferring large channels to
+	// later I/O loop iterations.
+	run("epoch", &quit_epoch, IRC_CONF_FANOUT_BUDGET_MAX);
+	run("hash-set", &quit_hash_set, IRC_CONF_FANOUT_BUDGET_MAX);
+	run("per-chan", &quit_per_chan, IRC_CONF_FANOUT_BUDGET_MAX);
+	run("deferred", &quit_epoch, IRC_CONF_FANOUT_BUDGET_DEFAULT);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,477 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_snapshot.c Measures the cold start of a server from a snapshot
+/// of many channels, and the snapshots it takes while it runs.
+///
+/// A snapshot of 200k channels, or the number given as the only argument, each
+/// with two bans and an exception, is written first. What rebuilding every
+/// channel from it up front would cost is measured in process, as a baseline.
+///
+/// A server is then started afresh, once without and once with the snapshot,
+/// and the time from the fork until a client is registered is measured. With
+/// the snapshot, a client matching the bans of a channel must be refused, and
+/// the first one joining it must become its operator.
+///
+/// The server takes a snapshot every second; the longest round trip of a
+/// client in the meantime shows what writing it costs the I/O loop. The next
+/// snapshot must hold every channel again.
+///
+/// The file is read from the page cache; a truly cold disk adds the reads of
+/// the pages a start touches, which is the header and the records joined.
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/chan.h"
+#include "core/clock.h"
+#include "core/conf.h"
+#include "core/ctx.h"
+#include "core/mask.h"
+#include "core/snapshot.h"
+
+// clang-format off
+
+#define CHAN_NUM                (200000)
+
+#define READ_BUF_SIZE           (4096)
+
+#define CONNECT_WAIT_US         (200)
+
+#define CONNECT_TRIES           (25000)
+
+/// @brief How long round trips are measured for while snapshots are taken.
+#define PROBE_MS                (2500)
+
+/// @brief How long the server has to replace the snapshot.
+#define REWRITE_WAIT_MS         (30000)
+
+// clang-format on
+
+/// @brief Runs a server listening on a port, with a snapshot file unless it is
+/// `-`, never returning.
+static void server_run(char **const argv)
+{
+	static struct irc_ctx ctx;
+
+	struct irc_conf_listener listener = { .host = "127.0.0.1" };
+	enum irc_conf_status_code code;
+
+	snprintf(listener.port, sizeof(listener.port), "%s", argv[2]);
+
+	bool ok = irc_conf_server_name_set(&ctx.conf, "snapshot.bench",
+					   &code) &&
+		  irc_conf_listener_add(&ctx.conf, &listener, &code);
+
+	if (ok && strcmp(argv[3], "-")) {
+		ok = irc_conf_snapshot_file_set(&ctx.conf, argv[3], &code) &&
+		     irc_conf_snapshot_interval_set(&ctx.conf, "1", &code);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "invalid configuration\n");
+		exit(EXIT_FAILURE);
+	}
+	irc_init(&ctx);
+	irc_io_loop(&ctx);
+}
+
+/// @brief Starts a server in a process of its own, as a restart would.
+static pid_t server_start(const char *const argv0, const u16 port,
+			  const char *const path)
+{
+	char port_str[8];
+	snprintf(port_str, sizeof(port_str), "%" PRIu16, port);
+
+	fflush(stdout);
+
+	const pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!pid) {
+		// The writers of snapshots are stopped along with the server.
+		setpgid(0, 0);
+
+		execl("/proc/self/exe", argv0, "serve", port_str, path, NULL);
+		perror("execl");
+		_exit(EXIT_FAILURE);
+	}
+	setpgid(pid, pid);
+	return pid;
+}
+
+static void server_stop(const pid_t pid)
+{
+	kill(-pid, SIGKILL);
+
+	while (waitpid(-pid, NULL, 0) > 0) {
+	}
+}
+
+static int client_connect(const u16 port)
+{
+	const struct sockaddr_in addr = { .sin_family = AF_INET,
+					  .sin_port = htons(port),
+					  .sin_addr.s_addr =
+						  htonl(INADDR_LOOPBACK) };
+
+	// The server is not listening yet at first.
+	for (int i = 0; i < CONNECT_TRIES; ++i) {
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd < 0) {
+			perror("socket");
+			exit(EXIT_FAILURE);
+		}
+		if (!connect(fd, (const struct sockaddr *)&addr,
+			     sizeof(addr))) {
+			return fd;
+		}
+		close(fd);
+		usleep(CONNECT_WAIT_US);
+	}
+	fprintf(stderr, "unable to connect to port %" PRIu16 "\n", port);
+	exit(EXIT_FAILURE);
+}
+
+static void client_send(const int fd, const char *const data)
+{
+	const size_t len = strlen(data);
+
+	if (write(fd, data, len) != (ssize_t)len) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// @brief Reads until a line containing `needle` has been received.
+///
+/// @returns `false` if the connection was closed first.
+static bool client_wait(const int fd, const char *const needle)
+{
+	static char buf[READ_BUF_SIZE];
+	size_t len = 0;
+
+	for (;;) {
+		const ssize_t cnt = read(fd, &buf[len], sizeof(buf) - len - 1);
+
+		if (cnt <= 0) {
+			return false;
+		}
+		len += (size_t)cnt;
+		buf[len] = '\0';
+
+		const char *found = strstr(buf, needle);
+
+		if (found && strchr(found, '\n')) {
+			return true;
+		}
+
+		// Keep the end, in case the needle is split across reads.
+		if (len == (sizeof(buf) - 1)) {
+			memmove(buf, &buf[len - 64], 64);
+			len = 64;
+		}
+	}
+}
+
+/// @brief Connects and registers a client as soon as the server lets it.
+static int client_register(const u16 port, const char *const nick)
+{
+	char line[128];
+
+	const int fd = client_connect(port);
+
+	snprintf(line, sizeof(line), "NICK %s\r\nUSER %s 0 * :%s\r\n", nick,
+		 nick, nick);
+	client_send(fd, line);
+
+	if (!client_wait(fd, " 001 ")) {
+		fprintf(stderr, "%s was not registered\n", nick);
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void chans_fill(struct irc_chans *const chans, const size_t num_chans)
+{
+	for (size_t i = 0; i < num_chans; ++i) {
+		char name[32];
+		char mask[64];
+
+		snprintf(name, sizeof(name), "#chan%zu", i);
+
+		struct irc_chan *chan = irc_chan_create(chans, name);
+
+		chan->masks[IRC_CHAN_BANS] = irc_mask_set_new();
+		chan->masks[IRC_CHAN_EXCEPTS] = irc_mask_set_new();
+
+		snprintf(mask, sizeof(mask), "spam%zu!*@*", i);
+		irc_mask_set_add(chan->masks[IRC_CHAN_BANS], mask, "op",
+				 chan->created);
+
+		snprintf(mask, sizeof(mask), "*!*@bot%zu.example", i);
+		irc_mask_set_add(chan->masks[IRC_CHAN_BANS], mask, "op",
+				 chan->created);
+
+		irc_mask_set_add(chan->masks[IRC_CHAN_EXCEPTS],
+				 "*!*@staff.example", "op", chan->created);
+	}
+}
+
+/// @brief Restores every channel of a snapshot, as loading it up front would.
+static void restore_all(const char *const path, const size_t num_chans)
+{
+	struct irc_snapshot snap = {};
+	struct irc_chans chans;
+
+	irc_chans_init(&chans);
+
+	const u64 start = irc_clock_mono_ns();
+
+	if (!irc_snapshot_open(&snap, path)) {
+		perror("irc_snapshot_open");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < num_chans; ++i) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "#chan%zu", i);
+
+		if (!irc_snapshot_restore(&snap, &chans, name)) {
+			fprintf(stderr, "%s was not restored\n", name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	printf("rebuilding every channel up front: %" PRIu64 " ms\n",
+	       (irc_clock_mono_ns() - start) / 1000000);
+
+	irc_snapshot_close(&snap);
+}
+
+/// @brief Starts a server, and returns the time until a client is registered.
+static u64 cold_start(const char *const argv0, const u16 port,
+		      const char *const path, pid_t *const pid, int *const fd)
+{
+	const u64 start = irc_clock_mono_ns();
+
+	*pid = server_start(argv0, port, path);
+	*fd = client_register(port, "first");
+
+	return irc_clock_mono_ns() - start;
+}
+
+/// @brief Checks the channel in the middle comes back with its bans.
+static void restored_check(const u16 port, const size_t num_chans)
+{
+	char line[128];
+	char nick[32];
+
+	const size_t idx = num_chans / 2;
+
+	snprintf(nick, sizeof(nick), "spam%zu", idx);
+
+	const int banned = client_register(port, nick);
+	const int member = client_register(port, "member");
+
+	snprintf(line, sizeof(line), "JOIN #chan%zu\r\n", idx);
+	client_send(banned, line);
+
+	if (!client_wait(banned, " 474 ")) {
+		fprintf(stderr, "%s was let into a restored channel\n", nick);
+		exit(EXIT_FAILURE);
+	}
+
+	const u64 start = irc_clock_mono_ns();
+
+	client_send(member, line);
+
+	if (!client_wait(member, " 366 ")) {
+		fprintf(stderr, "unable to join a restored channel\n");
+		exit(EXIT_FAILURE);
+	}
+	const u64 join_ns = irc_clock_mono_ns() - start;
+
+	// Only an operator may add a ban.
+	snprintf(line, sizeof(line), "MODE #chan%zu +b late!*@*\r\n", idx);
+	client_send(member, line);
+
+	if (!client_wait(member, " MODE #chan")) {
+		fprintf(stderr, "the first member is not an operator\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("first join of a restored channel: %" PRIu64 " us\n",
+	       join_ns / 1000);
+}
+
+static ino_t file_ino(const char *const path)
+{
+	struct stat st;
+
+	return stat(path, &st) ? 0 : st.st_ino;
+}
+
+/// @brief Measures round trips while the server takes snapshots, then checks
+/// the one it wrote holds every channel.
+static void rewrite_check(const int fd, const char *const path,
+			  const size_t num_chans)
+{
+	const ino_t prev = file_ino(path);
+	const u64 start = irc_clock_mono_ns();
+
+	u64 max_ns = 0;
+	u64 num_trips = 0;
+
+	while ((irc_clock_mono_ns() - start) < (PROBE_MS * UINT64_C(1000000))) {
+		const u64 sent = irc_clock_mono_ns();
+
+		client_send(fd, "STATS u\r\n");
+
+		if (!client_wait(fd, " 219 ")) {
+			fprintf(stderr, "disconnected during snapshots\n");
+			exit(EXIT_FAILURE);
+		}
+		const u64 took = irc_clock_mono_ns() - sent;
+
+		max_ns = (took > max_ns) ? took : max_ns;
+		num_trips++;
+	}
+	printf("%" PRIu64 " round trips while snapshotting, longest %" PRIu64
+	       " us\n",
+	       num_trips, max_ns / 1000);
+
+	while (file_ino(path) == prev) {
+		if ((irc_clock_mono_ns() - start) >
+		    (REWRITE_WAIT_MS * UINT64_C(1000000))) {
+			fprintf(stderr, "the snapshot was not replaced\n");
+			exit(EXIT_FAILURE);
+		}
+		usleep(10000);
+	}
+
+	struct irc_snapshot snap = {};
+
+	if (!irc_snapshot_open(&snap, path)) {
+		perror("irc_snapshot_open");
+		exit(EXIT_FAILURE);
+	}
+
+	if (snap.hdr->num_chans != num_chans) {
+		fprintf(stderr,
+			"the next snapshot holds %" PRIu32 " channels\n",
+			snap.hdr->num_chans);
+		exit(EXIT_FAILURE);
+	}
+	printf("next snapshot holds all %zu channels\n", num_chans);
+
+	irc_snapshot_close(&snap);
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc == 4) && !strcmp(argv[1], "serve")) {
+		server_run(argv);
+	}
+
+	const size_t num_chans = (argc > 1) ? strtoul(argv[1], NULL, 10)
+					    : CHAN_NUM;
+
+	if (num_chans < 2) {
+		fprintf(stderr, "at least 2 channels are needed\n");
+		return EXIT_FAILURE;
+	}
+
+	char dir[] = "/tmp/bench_snapshot_XXXXXX";
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "%s/snap", dir);
+
+	struct irc_chans chans;
+	irc_chans_init(&chans);
+
+	chans_fill(&chans, num_chans);
+
+	const struct irc_snapshot none = {};
+	u64 start = irc_clock_mono_ns();
+
+	if (!irc_snapshot_write(&none, &chans, path)) {
+		perror("irc_snapshot_write");
+		return EXIT_FAILURE;
+	}
+	struct stat st;
+	stat(path, &st);
+
+	printf("%zu channels written in %" PRIu64 " ms, %zu KiB\n", num_chans,
+	       (irc_clock_mono_ns() - start) / 1000000,
+	       (size_t)st.st_size / 1024);
+
+	restore_all(path, num_chans);
+
+	// Some room away from the usual ports, and from other runs.
+	const u16 port = (u16)(30000 + (getpid() % 5000));
+
+	pid_t pid;
+	int fd;
+
+	u64 took = cold_start(argv[0], port, "-", &pid, &fd);
+
+	printf("start to first client, without snapshot: %" PRIu64 " us\n",
+	       took / 1000);
+
+	close(fd);
+	server_stop(pid);
+
+	took = cold_start(argv[0], (u16)(port + 1), path, &pid, &fd);
+
+	printf("start to first client, with snapshot: %" PRIu64 " us\n",
+	       took / 1000);
+
+	restored_check((u16)(port + 1), num_chans);
+	rewrite_check(fd, path, num_chans);
+
+	close(fd);
+	server_stop(pid);
+
+	unlink(path);
+	rmdir(dir);
+
+	return EXIT_SUCCESS;
+}
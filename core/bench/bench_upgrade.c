@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bench_upgrade.c Measures the hand over of a server to a new binary
+/// under a swarm of clients.
+///
+/// A server is forked, and this process connects and registers as many
+/// clients as it can, up to 100k or the number given as the only argument,
+/// spread over a few channels. The server is then asked to upgrade, which
+/// starts this very binary again in server mode. The time from the request
+/// until the old process exits, which it only does once the new one has taken
+/// over, is the hand over time; the time until every client has been answered
+/// by the new process follows.
+///
+/// Every client must still be connected, and registered, afterwards; a
+/// message to each channel must reach its members. Any disconnect fails the
+/// run.
+///
+/// Both processes need a descriptor per client, so the count is capped by the
+/// hard limit on open files.
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/clock.h"
+#include "core/conf.h"
+#include "core/ctx.h"
+#include "core/upgrade.h"
+
+// clang-format off
+
+#define CLIENT_NUM              (100000)
+
+#define CHAN_NUM                (64)
+
+/// @brief The number of descriptors kept for anything but clients.
+#define FD_RESERVE              (64)
+
+/// @brief The number of clients sent to before any is waited for.
+#define BATCH_NUM               (256)
+
+#define READ_BUF_SIZE           (4096)
+
+#define CONNECT_TRIES           (200)
+
+// clang-format on
+
+static struct irc_ctx ctx;
+
+static void upgrade_signal(const int sig)
+{
+	(void)sig;
+
+	irc_upgrade_request(&ctx);
+}
+
+/// @brief Runs a server listening on a port, never returning. Upgrading it
+/// starts this binary again with the same arguments.
+static void server_run(char **const argv)
+{
+	struct irc_conf_listener listener = { .host = "127.0.0.1" };
+	enum irc_conf_status_code code;
+
+	snprintf(listener.port, sizeof(listener.port), "%s", argv[2]);
+
+	if (!irc_conf_server_name_set(&ctx.conf, "upgrade.bench", &code) ||
+	    !irc_conf_listener_add(&ctx.conf, &listener, &code)) {
+		fprintf(stderr, "invalid configuration\n");
+		exit(EXIT_FAILURE);
+	}
+	ctx.upgrade.argv = argv;
+	ctx.upgrade.resume = getenv(IRC_UPGRADE_ENV) != NULL;
+
+	struct sigaction sa = { .sa_handler = &upgrade_signal };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR2, &sa, NULL);
+
+	irc_init(&ctx);
+	irc_io_loop(&ctx);
+}
+
+static int client_connect(const u16 port)
+{
+	const struct sockaddr_in addr = { .sin_family = AF_INET,
+					  .sin_port = htons(port),
+					  .sin_addr.s_addr =
+						  htonl(INADDR_LOOPBACK) };
+
+	// The server may not be listening yet.
+	for (int i = 0; i < CONNECT_TRIES; ++i) {
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd < 0) {
+			perror("socket");
+			exit(EXIT_FAILURE);
+		}
+		if (!connect(fd, (const struct sockaddr *)&addr,
+			     sizeof(addr))) {
+			return fd;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	fprintf(stderr, "unable to connect to port %" PRIu16 "\n", port);
+	exit(EXIT_FAILURE);
+}
+
+static bool client_send(const int fd, const char *const data)
+{
+	const size_t len = strlen(data);
+
+	return write(fd, data, len) == (ssize_t)len;
+}
+
+/// @brief Reads until a line containing `needle` has been received.
+///
+/// @returns `false` if the connection was closed first.
+static bool client_wait(const int fd, const char *const needle)
+{
+	static char buf[READ_BUF_SIZE];
+	size_t len = 0;
+
+	for (;;) {
+		const ssize_t cnt = read(fd, &buf[len], sizeof(buf) - len - 1);
+
+		if (cnt <= 0) {
+			return false;
+		}
+		len += (size_t)cnt;
+		buf[len] = '\0';
+
+		const char *found = strstr(buf, needle);
+
+		if (found && strchr(found, '\n')) {
+			return true;
+		}
+
+		// Keep the end, in case the needle is split across reads.
+		if (len == (sizeof(buf) - 1)) {
+			memmove(buf, &buf[len - 64], 64);
+			len = 64;
+		}
+	}
+}
+
+/// @brief Renders what a client sends, given its index.
+typedef void (*line_fmt_cb)(char *line, size_t size, size_t idx);
+
+static void register_fmt(char *const line, const size_t size, const size_t idx)
+{
+	snprintf(line, size,
+		 "NICK up%zu\r\nUSER up 0 * :up\r\nJOIN #chan%zu\r\n", idx,
+		 idx % CHAN_NUM);
+}
+
+static void away_fmt(char *const line, const size_t size, const size_t idx)
+{
+	snprintf(line, size, "AWAY :up%zu\r\n", idx);
+}
+
+/// @brief Sends a line to every client, and waits for each to see a reply.
+///
+/// @returns The number of clients that were disconnected.
+static size_t clients_ask(const int *const fds, const size_t num_clients,
+			  const line_fmt_cb fmt, const char *const reply)
+{
+	size_t num_closed = 0;
+
+	for (size_t i = 0; i < num_clients; i += BATCH_NUM) {
+		const size_t end = ((i + BATCH_NUM) < num_clients)
+					   ? (i + BATCH_NUM)
+					   : num_clients;
+
+		for (size_t j = i; j < end; ++j) {
+			char line[128];
+
+			fmt(line, sizeof(line), j);
+			client_send(fds[j], line);
+		}
+		for (size_t j = i; j < end; ++j) {
+			if (!client_wait(fds[j], reply)) {
+				num_closed++;
+			}
+		}
+	}
+	return num_closed;
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc == 3) && !strcmp(argv[1], "serve")) {
+		server_run(argv);
+	}
+
+	size_t num_clients = (argc > 1) ? strtoul(argv[1], NULL, 10)
+					: CLIENT_NUM;
+
+	// Both ends of every connection count against the same limit, which
+	// the servers inherit.
+	struct rlimit lim;
+	getrlimit(RLIMIT_NOFILE, &lim);
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+
+	if ((lim.rlim_cur != RLIM_INFINITY) &&
+	    ((num_clients + FD_RESERVE) > lim.rlim_cur)) {
+		num_clients = (size_t)lim.rlim_cur - FD_RESERVE;
+		printf("open files are limited to %zu; using %zu clients\n",
+		       (size_t)lim.rlim_cur, num_clients);
+	}
+	if (num_clients < CHAN_NUM * 2) {
+		num_clients = CHAN_NUM * 2;
+	}
+
+	// Some room away from the usual ports, and from other runs.
+	const u16 port = (u16)(30000 + (getpid() % 5000));
+
+	char port_str[8];
+	snprintf(port_str, sizeof(port_str), "%" PRIu16, port);
+
+	char serve[] = "serve";
+	char *serve_argv[] = { argv[0], serve, port_str, NULL };
+
+	// The new server is orphaned once the old one exits, and is to be
+	// adopted by this process rather than by init, to be waited for.
+	prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+	// Whatever is buffered would be written again by the servers.
+	fflush(stdout);
+
+	const pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (!pid) {
+		// Both servers are stopped at once through their group.
+		setpgid(0, 0);
+		server_run(serve_argv);
+	}
+	setpgid(pid, pid);
+
+	int *fds = calloc(num_clients, sizeof(*fds));
+
+	for (size_t i = 0; i < num_clients; ++i) {
+		fds[i] = client_connect(port);
+	}
+
+	size_t num_closed =
+		clients_ask(fds, num_clients, &register_fmt, " 366 ");
+
+	if (num_closed) {
+		fprintf(stderr, "%zu clients failed to register\n", num_closed);
+		return EXIT_FAILURE;
+	}
+	printf("%zu clients registered in %d channels\n", num_clients,
+	       CHAN_NUM);
+
+	const u64 start_ns = irc_clock_mono_ns();
+
+	kill(pid, SIGUSR2);
+
+	int status;
+	waitpid(pid, &status, 0);
+
+	const u64 handover_ns = irc_clock_mono_ns();
+
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+		fprintf(stderr, "the old server did not exit cleanly\n");
+		kill(-pid, SIGKILL);
+		return EXIT_FAILURE;
+	}
+
+	// Every client is answered by the new server as the one it registered
+	// with: its nickname is still its own.
+	num_closed = clients_ask(fds, num_clients, &away_fmt, " 306 ");
+
+	const u64 resume_ns = irc_clock_mono_ns();
+
+	// Every channel still has its members.
+	for (size_t i = 0; i < CHAN_NUM; ++i) {
+		char line[64];
+
+		snprintf(line, sizeof(line), "PRIVMSG #chan%zu :hello\r\n", i);
+		client_send(fds[i], line);
+
+		if (!client_wait(fds[i + CHAN_NUM], " :hello")) {
+			num_closed++;
+		}
+	}
+
+	printf("handover %" PRIu64 " us, all clients answered %" PRIu64
+	       " us later\n",
+	       (handover_ns - start_ns) / 1000,
+	       (resume_ns - handover_ns) / 1000);
+
+	kill(-pid, SIGTERM);
+
+	while (wait(NULL) > 0) {
+	}
+
+	for (size_t i = 0; i < num_clients; ++i) {
+		close(fds[i]);
+	}
+	free(fds);
+
+	if (num_closed) {
+		fprintf(stderr, "%zu clients disconnected\n", num_closed);
+		return EXIT_FAILURE;
+	}
+	printf("no client disconnected\n");
+
+	return EXIT_SUCCESS;
+}
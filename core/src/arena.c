@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/arena.h"
+#include "core/util.h"
+
+struct irc_arena_chunk {
+	/// @brief The chunk allocated before this one, or `NULL`.
+	struct irc_arena_chunk *prev;
+
+	/// @brief The number of bytes following the header.
+	size_t size;
+};
+
+// clang-format off
+
+/// @brief The size of the header of a chunk, which keeps the memory following
+/// it aligned.
+#define CHUNK_HDR_SIZE  (irc_arena_align(sizeof(struct irc_arena_chunk)))
+
+// clang-format on
+
+static void chunk_push(struct irc_arena *const arena, const size_t size)
+{
+	struct irc_arena_chunk *chunk = irc_malloc(CHUNK_HDR_SIZE + size);
+
+	chunk->prev = arena->chunk;
+	chunk->size = size;
+
+	arena->chunk = chunk;
+	arena->base = (char *)chunk + CHUNK_HDR_SIZE;
+	arena->size = size;
+	arena->pos = 0;
+
+	arena->capacity += size;
+	arena->num_chunk_allocs++;
+}
+
+static void chunk_pop(struct irc_arena *const arena)
+{
+	struct irc_arena_chunk *chunk = arena->chunk;
+
+	arena->chunk = chunk->prev;
+	arena->capacity -= chunk->size;
+
+	free(chunk);
+
+	if (arena->chunk) {
+		arena->base = (char *)arena->chunk + CHUNK_HDR_SIZE;
+		arena->size = arena->chunk->size;
+	}
+}
+
+static void high_water_update(struct irc_arena *const arena)
+{
+	const size_t used = irc_arena_used(arena);
+
+	if (used > arena->high_water) {
+		arena->high_water = used;
+	}
+}
+
+void irc_arena_init(struct irc_arena *const arena)
+{
+	memset(arena, 0, sizeof(*arena));
+	chunk_push(arena, IRC_ARENA_CHUNK_SIZE);
+}
+
+void irc_arena_destroy(struct irc_arena *const arena)
+{
+	while (arena->chunk) {
+		chunk_pop(arena);
+	}
+}
+
+void *irc_arena_alloc_slow(struct irc_arena *const arena, const size_t size)
+{
+	// The rest of the current chunk is left unused.
+	arena->used_before += arena->pos;
+
+	size_t chunk_size = arena->size * 2;
+
+	while (chunk_size < size) {
+		chunk_size *= 2;
+	}
+	chunk_push(arena, chunk_size);
+
+	arena->pos = size;
+	return arena->base;
+}
+
+void *irc_arena_grow(struct irc_arena *const arena, void *const ptr,
+		     const size_t size, const size_t new_size)
+{
+	const size_t aligned = irc_arena_align(size);
+
+	// The most recent allocation ends where the next one would start.
+	if (ptr && (aligned <= arena->pos) &&
+	    (((char *)ptr + aligned) == &arena->base[arena->pos])) {
+		const size_t off = arena->pos - aligned;
+		const size_t new_aligned = irc_arena_align(new_size);
+
+		if (new_aligned <= (arena->size - off)) {
+			arena->pos = off + new_aligned;
+			return ptr;
+		}
+	}
+	void *res = irc_arena_alloc(arena, new_size);
+
+	if (ptr) {
+		memcpy(res, ptr, (size < new_size) ? size : new_size);
+	}
+	return res;
+}
+
+void irc_arena_scope_begin(const struct irc_arena *const arena,
+			   struct irc_arena_scope *const scope)
+{
+	scope->chunk = arena->chunk;
+	scope->pos = arena->pos;
+	scope->used_before = arena->used_before;
+}
+
+void irc_arena_scope_end(struct irc_arena *const arena,
+			 const struct irc_arena_scope *const scope)
+{
+	high_water_update(arena);
+
+	while (arena->chunk != scope->chunk) {
+		chunk_pop(arena);
+	}
+	arena->pos = scope->pos;
+	arena->used_before = scope->used_before;
+}
+
+void irc_arena_reset(struct irc_arena *const arena)
+{
+	high_water_update(arena);
+
+	// The chunks are folded into one that would have held everything,
+	// if that is not too large to keep around.
+	if (arena->chunk->prev) {
+		const size_t used = irc_arena_used(arena);
+
+		size_t size = IRC_ARENA_CHUNK_SIZE;
+
+		while ((size < used) && (size < IRC_ARENA_RETAIN_MAX)) {
+			size *= 2;
+		}
+		irc_arena_destroy(arena);
+		chunk_push(arena, size);
+	}
+	arena->pos = 0;
+	arena->used_before = 0;
+}
@@ -0,0 +1,492 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/bcast.h"
+#include "core/chan.h"
+#include "core/ctx.h"
+#include "core/metrics.h"
+#include "core/pool.h"
+#include "core/user.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The length of a `time` tag, including the leading `@` and the
+/// trailing space; e.g. "@time=2011-10-19T16:40:51.620Z ".
+#define TIME_TAG_LEN    (31)
+
+// clang-format on
+
+IRC_ATTRIB_FMT(printf, 2, 3)
+void irc_bcast_init(struct irc_bcast *const bc, const char *const fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	bc->variants[IRC_BCAST_VARIANT_PLAIN] = irc_buf_vfmt(NULL, fmt, args);
+
+	va_end(args);
+
+	for (size_t i = IRC_BCAST_VARIANT_PLAIN + 1; i < IRC_BCAST_VARIANT_NUM;
+	     ++i) {
+		bc->variants[i] = NULL;
+	}
+	clock_gettime(CLOCK_REALTIME, &bc->ts);
+}
+
+/// @brief Builds the variant carrying the `time` tag from the plain one,
+/// without formatting the message again.
+static struct irc_buf *time_variant_build(const struct irc_bcast *const bc)
+{
+	const struct irc_buf *plain = bc->variants[IRC_BCAST_VARIANT_PLAIN];
+	struct irc_buf *buf = irc_buf_new(TIME_TAG_LEN + plain->len);
+
+	struct tm tm;
+	gmtime_r(&bc->ts.tv_sec, &tm);
+
+	char tag[TIME_TAG_LEN + 1];
+
+	const size_t len =
+		strftime(tag, sizeof(tag), "@time=%Y-%m-%dT%H:%M:%S", &tm);
+
+	snprintf(&tag[len], sizeof(tag) - len, ".%03uZ ",
+		 (uint)(bc->ts.tv_nsec / 1000000) % 1000);
+
+	memcpy(buf->data, tag, TIME_TAG_LEN);
+	memcpy(&buf->data[TIME_TAG_LEN], plain->data, plain->len);
+
+	return buf;
+}
+
+static uint variant_of(const struct irc_user *const user)
+{
+	return (user->caps & IRC_USER_CAP_SERVER_TIME)
+		       ? IRC_BCAST_VARIANT_TIME
+		       : IRC_BCAST_VARIANT_PLAIN;
+}
+
+void irc_bcast_user(struct irc_ctx *const ctx, struct irc_bcast *const bc,
+		    struct irc_user *const user)
+{
+	const uint variant = variant_of(user);
+
+	if (IRC_UNLIKELY(!bc->variants[variant])) {
+		bc->variants[variant] = time_variant_build(bc);
+	}
+	irc_user_send(ctx, user, bc->variants[variant]);
+}
+
+static void backlog_link(struct irc_chans *const chans,
+			 struct irc_chan *const chan)
+{
+	chan->backlog.prev = chans->backlog.tail;
+	chan->backlog.next = NULL;
+
+	if (chans->backlog.tail) {
+		chans->backlog.tail->backlog.next = chan;
+	} else {
+		chans->backlog.head = chan;
+	}
+	chans->backlog.tail = chan;
+}
+
+static void backlog_unlink(struct irc_chans *const chans,
+			   struct irc_chan *const chan)
+{
+	if (chan->backlog.prev) {
+		chan->backlog.prev->backlog.next = chan->backlog.next;
+	} else {
+		chans->backlog.head = chan->backlog.next;
+	}
+
+	if (chan->backlog.next) {
+		chan->backlog.next->backlog.prev = chan->backlog.prev;
+	} else {
+		chans->backlog.tail = chan->backlog.prev;
+	}
+}
+
+/// @brief Returns `true` if a broadcast to a channel has to be deferred.
+static bool chan_defers(const struct irc_ctx *const ctx,
+			const struct irc_chan *const chan)
+{
+	return chan->backlog.head ||
+	       (chan->members.num_entries >
+		ctx->conf.fanout.recipients_per_iter);
+}
+
+static int scope_chan_cmp(const void *const a, const void *const b)
+{
+	const uintptr_t chan_a =
+		(uintptr_t)((const struct irc_bcast_scope_chan *)a)->chan;
+	const uintptr_t chan_b =
+		(uintptr_t)((const struct irc_bcast_scope_chan *)b)->chan;
+
+	return (chan_a > chan_b) - (chan_a < chan_b);
+}
+
+static size_t scope_size(const u32 num_chans)
+{
+	return sizeof(struct irc_bcast_scope) +
+	       (num_chans * sizeof(struct irc_bcast_scope_chan));
+}
+
+/// @brief Records the channels of a user a broadcast to its common channels
+/// is sent in, and which of them defer it.
+static struct irc_bcast_scope *scope_new(const struct irc_ctx *const ctx,
+					 const struct irc_user *const user,
+					 const u64 epoch)
+{
+	u32 num_chans = 0;
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		num_chans += (user->chans.entries[i]->chan->num_local != 0);
+	}
+
+	struct irc_bcast_scope *scope =
+		irc_pool_alloc(IRC_POOL_FANOUTS, scope_size(num_chans));
+
+	scope->epoch = epoch;
+	scope->refs = 1;
+	scope->num_chans = 0;
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		const struct irc_chan *chan = user->chans.entries[i]->chan;
+
+		if (chan->num_local) {
+			scope->chans[scope->num_chans++] =
+				(struct irc_bcast_scope_chan){
+					.chan = chan,
+					.deferred = chan_defers(ctx, chan)
+				};
+		}
+	}
+	qsort(scope->chans, scope->num_chans, sizeof(*scope->chans),
+	      &scope_chan_cmp);
+
+	return scope;
+}
+
+static void scope_unref(struct irc_bcast_scope *const scope)
+{
+	if (!--scope->refs) {
+		irc_pool_free(IRC_POOL_FANOUTS, scope,
+			      scope_size(scope->num_chans));
+	}
+}
+
+IRC_ATTRIB_PURE
+static const struct irc_bcast_scope_chan *
+scope_find(const struct irc_bcast_scope *const scope,
+	   const struct irc_chan *const chan)
+{
+	u32 lo = 0;
+	u32 hi = scope->num_chans;
+
+	while (lo < hi) {
+		const u32 mid = lo + ((hi - lo) / 2);
+
+		if ((uintptr_t)scope->chans[mid].chan < (uintptr_t)chan) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return ((lo < scope->num_chans) && (scope->chans[lo].chan == chan))
+		       ? &scope->chans[lo]
+		       : NULL;
+}
+
+/// @brief Returns `true` if a member of a channel a broadcast to common
+/// channels was deferred in is reached through another of them instead: one
+/// it was sent at once in, or one before it in @ref irc_bcast_scope::chans it
+/// was deferred in. Only memberships older than the broadcast count.
+IRC_ATTRIB_PURE
+static bool scope_reached_elsewhere(const struct irc_fanout *const fanout,
+				    const struct irc_member *const member)
+{
+	const struct irc_bcast_scope *scope = fanout->scope;
+	const struct irc_user *user = member->user;
+
+	// Most members share no other channel with the user the broadcast is
+	// about, which their bits tell without walking their channels.
+	if (!(user->chan_bits & fanout->scope_bits)) {
+		return false;
+	}
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		const struct irc_member *other = user->chans.entries[i];
+
+		if ((other == member) ||
+		    (other->joined_epoch >= scope->epoch)) {
+			continue;
+		}
+
+		const struct irc_bcast_scope_chan *ent =
+			scope_find(scope, other->chan);
+
+		if (ent && (!ent->deferred || ((uintptr_t)ent->chan <
+					       (uintptr_t)member->chan))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// @brief Appends a broadcast to the backlog of a channel, taking references
+/// of its own to the buffers built so far.
+static void backlog_push(struct irc_ctx *const ctx,
+			 const struct irc_bcast *const bc,
+			 struct irc_chan *const chan,
+			 const struct irc_user *const except, const u8 cap,
+			 struct irc_bcast_scope *const scope)
+{
+	struct irc_fanout *fanout =
+		irc_pool_alloc(IRC_POOL_FANOUTS, sizeof(*fanout));
+
+	fanout->next = NULL;
+	fanout->bc = *bc;
+	fanout->except = except;
+	fanout->scope = scope;
+	fanout->scope_bits = 0;
+	fanout->num_members = chan->members.num_entries;
+	fanout->cap = cap;
+
+	for (size_t i = 0; i < IRC_BCAST_VARIANT_NUM; ++i) {
+		if (fanout->bc.variants[i]) {
+			irc_buf_ref(fanout->bc.variants[i]);
+		}
+	}
+
+	if (scope) {
+		scope->refs++;
+
+		for (u32 i = 0; i < scope->num_chans; ++i) {
+			if (scope->chans[i].chan != chan) {
+				fanout->scope_bits |=
+					irc_chan_bit(scope->chans[i].chan);
+			}
+		}
+	}
+
+	if (chan->backlog.tail) {
+		chan->backlog.tail->next = fanout;
+	} else {
+		chan->backlog.head = fanout;
+		chan->backlog.remaining = fanout->num_members;
+
+		backlog_link(&ctx->chans, chan);
+	}
+	chan->backlog.tail = fanout;
+	chan->backlog.num_entries++;
+
+	IRC_METRIC_INC(&ctx->metrics, IRC_METRIC_FANOUT_DEFERRED);
+}
+
+/// @brief Removes the oldest broadcast from the backlog of a channel, and
+/// starts the delivery of the next one.
+static void backlog_pop(struct irc_chan *const chan)
+{
+	struct irc_fanout *fanout = chan->backlog.head;
+
+	chan->backlog.head = fanout->next;
+	chan->backlog.num_entries--;
+
+	if (chan->backlog.head) {
+		chan->backlog.remaining = chan->backlog.head->num_members;
+	} else {
+		chan->backlog.tail = NULL;
+		chan->backlog.remaining = 0;
+	}
+
+	if (fanout->scope) {
+		scope_unref(fanout->scope);
+	}
+	irc_bcast_done(&fanout->bc);
+	irc_pool_free(IRC_POOL_FANOUTS, fanout, sizeof(*fanout));
+}
+
+void irc_bcast_chan(struct irc_ctx *const ctx, struct irc_bcast *const bc,
+		    struct irc_chan *const chan,
+		    const struct irc_user *const except)
+{
+	// The members of other servers are told by their server.
+	if (!chan->num_local) {
+		return;
+	}
+
+	if (IRC_UNLIKELY(chan_defers(ctx, chan))) {
+		backlog_push(ctx, bc, chan, except, 0, NULL);
+		return;
+	}
+
+	struct irc_member *const *members = chan->members.entries;
+
+	for (u32 i = 0; i < chan->members.num_entries; ++i) {
+		struct irc_user *user = members[i]->user;
+
+		if (user != except) {
+			irc_bcast_user(ctx, bc, user);
+		}
+	}
+}
+
+void irc_bcast_common(struct irc_ctx *const ctx, struct irc_bcast *const bc,
+		      struct irc_user *const user, const u8 cap)
+{
+	const u64 epoch = ++ctx->chans.bcast_epoch;
+	struct irc_bcast_scope *scope = NULL;
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		const struct irc_chan *chan = user->chans.entries[i]->chan;
+
+		if (chan->num_local && IRC_UNLIKELY(chan_defers(ctx, chan))) {
+			scope = scope_new(ctx, user, epoch);
+			break;
+		}
+	}
+
+	user->bcast_epoch = epoch;
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		struct irc_chan *chan = user->chans.entries[i]->chan;
+		struct irc_member *const *members = chan->members.entries;
+
+		if (!chan->num_local) {
+			continue;
+		}
+
+		if (IRC_UNLIKELY(chan_defers(ctx, chan))) {
+			backlog_push(ctx, bc, chan, user, cap, scope);
+			continue;
+		}
+
+		for (u32 j = 0; j < chan->members.num_entries; ++j) {
+			struct irc_user *dst = members[j]->user;
+
+			if (dst->bcast_epoch == epoch) {
+				continue;
+			}
+			dst->bcast_epoch = epoch;
+
+			if (!cap || (dst->caps & cap)) {
+				irc_bcast_user(ctx, bc, dst);
+			}
+		}
+	}
+
+	if (scope) {
+		scope_unref(scope);
+	}
+}
+
+/// @brief Delivers a deferred broadcast to a member of its channel.
+static void fanout_deliver(struct irc_ctx *const ctx,
+			   struct irc_fanout *const fanout,
+			   const struct irc_member *const member)
+{
+	struct irc_user *user = member->user;
+
+	if (user == fanout->except) {
+		return;
+	}
+
+	if (fanout->scope && scope_reached_elsewhere(fanout, member)) {
+		return;
+	}
+
+	if (!fanout->cap || (user->caps & fanout->cap)) {
+		irc_bcast_user(ctx, &fanout->bc, user);
+	}
+}
+
+void irc_bcast_backlog_run(struct irc_ctx *const ctx)
+{
+	struct irc_chans *chans = &ctx->chans;
+	u32 budget = ctx->conf.fanout.recipients_per_iter;
+
+	while (budget && chans->backlog.head) {
+		struct irc_chan *chan = chans->backlog.head;
+		struct irc_fanout *fanout = chan->backlog.head;
+
+		// Members joining during the delivery are appended past the
+		// ones it still has to reach, so walking down skips them.
+		while (budget && chan->backlog.remaining) {
+			const u32 idx = --chan->backlog.remaining;
+
+			fanout_deliver(ctx, fanout, chan->members.entries[idx]);
+			budget--;
+		}
+
+		if (!chan->backlog.remaining) {
+			backlog_pop(chan);
+		}
+
+		// Every channel with a backlog gets its turn before this one
+		// is served again.
+		backlog_unlink(chans, chan);
+
+		if (chan->backlog.head) {
+			backlog_link(chans, chan);
+		}
+	}
+}
+
+void irc_bcast_backlog_part(struct irc_chan *const chan,
+			    const struct irc_user *const user)
+{
+	for (struct irc_fanout *fanout = chan->backlog.head; fanout;
+	     fanout = fanout->next) {
+		if (fanout->except == user) {
+			fanout->except = NULL;
+		}
+	}
+}
+
+void irc_bcast_backlog_drop(struct irc_chans *const chans,
+			    struct irc_chan *const chan)
+{
+	if (!chan->backlog.head) {
+		return;
+	}
+
+	while (chan->backlog.head) {
+		backlog_pop(chan);
+	}
+	backlog_unlink(chans, chan);
+}
+
+void irc_bcast_done(struct irc_bcast *const bc)
+{
+	for (size_t i = 0; i < IRC_BCAST_VARIANT_NUM; ++i) {
+		if (bc->variants[i]) {
+			irc_buf_unref(bc->variants[i]);
+		}
+	}
+}
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/buf.h"
+#include "core/pool.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The maximum length of the message tags, including the leading `@`
+/// and the trailing space, as allowed for servers by the message tags
+/// specification.
+#define TAGS_LEN_MAX    (4096)
+
+// clang-format on
+
+struct irc_buf *irc_buf_new(const size_t len)
+{
+	struct irc_buf *buf = irc_pool_alloc(IRC_POOL_BUFS, sizeof(*buf) + len);
+
+	buf->refs = 1;
+	buf->len = (u32)len;
+	buf->size = (u32)len;
+
+	return buf;
+}
+
+struct irc_buf *irc_buf_vfmt(const char *const tags, const char *const fmt,
+			     va_list args)
+{
+	size_t tags_len = 0;
+
+	if (tags) {
+		tags_len = strlen(tags) + 2;
+
+		if (tags_len > TAGS_LEN_MAX) {
+			tags_len = TAGS_LEN_MAX;
+		}
+	}
+
+	char line[IRC_BUF_LINE_LEN_MAX + 1];
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+	int len = vsnprintf(line, IRC_BUF_LINE_LEN_MAX - 1, fmt, args);
+#pragma GCC diagnostic pop
+
+	if (IRC_UNLIKELY(len < 0)) {
+		len = 0;
+	}
+
+	// Leave room for the line terminator.
+	if (len > (IRC_BUF_LINE_LEN_MAX - 2)) {
+		len = IRC_BUF_LINE_LEN_MAX - 2;
+	}
+	line[len++] = '\r';
+	line[len++] = '\n';
+
+	struct irc_buf *buf = irc_buf_new(tags_len + (size_t)len);
+
+	if (tags_len) {
+		buf->data[0] = '@';
+		memcpy(&buf->data[1], tags, tags_len - 2);
+		buf->data[tags_len - 1] = ' ';
+	}
+	memcpy(&buf->data[tags_len], line, (size_t)len);
+
+	return buf;
+}
+
+IRC_ATTRIB_FMT(printf, 2, 3)
+struct irc_buf *irc_buf_fmt(const char *const tags, const char *const fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	struct irc_buf *buf = irc_buf_vfmt(tags, fmt, args);
+
+	va_end(args);
+	return buf;
+}
+
+void irc_buf_unref(struct irc_buf *const buf)
+{
+	if (!--buf->refs) {
+		irc_pool_free(IRC_POOL_BUFS, buf, sizeof(*buf) + buf->size);
+	}
+}
+
+struct irc_buf *irc_buf_shrink(struct irc_buf *const buf)
+{
+	if (irc_pool_size(sizeof(*buf) + buf->len) >=
+	    irc_pool_size(sizeof(*buf) + buf->size)) {
+		return buf;
+	}
+	struct irc_buf *res = irc_buf_new(buf->len);
+
+	memcpy(res->data, buf->data, buf->len);
+	irc_buf_unref(buf);
+
+	return res;
+}
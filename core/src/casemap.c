@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "core/casemap.h"
+#include "core/hash_table.h"
+
+/// @brief The longest name hashed in one go. Longer names are hashed in
+/// chunks of this size.
+#define HASH_CHUNK_LEN (64)
+
+#define ROW(x)                                                        \
+	(u8)(x), (u8)((x) + 1), (u8)((x) + 2), (u8)((x) + 3), (u8)((x) + 4), \
+		(u8)((x) + 5), (u8)((x) + 6), (u8)((x) + 7)
+
+// clang-format off
+
+const u8 irc_casemap_lower_tbl[256] = {
+	ROW(0x00), ROW(0x08), ROW(0x10), ROW(0x18),
+	ROW(0x20), ROW(0x28), ROW(0x30), ROW(0x38),
+
+	// '@' followed by 'A' to 'Z', mapped to 'a' to 'z'.
+	0x40, ROW(0x61), ROW(0x69), ROW(0x71), 0x79, 0x7a,
+
+	// '[', '\\' and ']' map to '{', '|' and '}'.
+	0x7b, 0x7c, 0x7d, 0x5e, 0x5f,
+
+	// '~' maps to '^'.
+	ROW(0x60), ROW(0x68), ROW(0x70), 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d,
+	0x5e, 0x7f,
+
+	ROW(0x80), ROW(0x88), ROW(0x90), ROW(0x98),
+	ROW(0xa0), ROW(0xa8), ROW(0xb0), ROW(0xb8),
+	ROW(0xc0), ROW(0xc8), ROW(0xd0), ROW(0xd8),
+	ROW(0xe0), ROW(0xe8), ROW(0xf0), ROW(0xf8)
+};
+
+// clang-format on
+
+#undef ROW
+
+bool irc_casemap_eq(const char *a, const char *b)
+{
+	for (;; ++a, ++b) {
+		if (irc_casemap_lower(*a) != irc_casemap_lower(*b)) {
+			return false;
+		}
+
+		if (*a == '\0') {
+			return true;
+		}
+	}
+}
+
+int irc_casemap_cmp(const char *a, const char *b)
+{
+	for (;; ++a, ++b) {
+		const u8 lower_a = irc_casemap_lower_tbl[(u8)*a];
+		const u8 lower_b = irc_casemap_lower_tbl[(u8)*b];
+
+		if ((lower_a != lower_b) || (*a == '\0')) {
+			return (int)lower_a - (int)lower_b;
+		}
+	}
+}
+
+bool irc_casemap_match(const char *mask, const char *name)
+{
+	// On a mismatch after a '*', the '*' is made to match one more
+	// character and matching starts over from there. Only the last '*'
+	// needs to be returned to, which keeps this linear in practice.
+	const char *star = NULL;
+	const char *star_name = NULL;
+
+	while (*name != '\0') {
+		if (*mask == '*') {
+			star = ++mask;
+			star_name = name;
+		} else if ((*mask == '?') ||
+			   ((*mask != '\0') &&
+			    (irc_casemap_lower(*mask) == irc_casemap_lower(*name)))) {
+			++mask;
+			++name;
+		} else if (star) {
+			mask = star;
+			name = ++star_name;
+		} else {
+			return false;
+		}
+	}
+
+	while (*mask == '*') {
+		++mask;
+	}
+	return *mask == '\0';
+}
+
+size_t irc_casemap_ht_hash(const void *const key, const u8 *const secret_key)
+{
+	const char *name = key;
+
+	char buf[HASH_CHUNK_LEN];
+	size_t len = 0;
+	size_t hash = 0;
+
+	for (; *name != '\0'; ++name) {
+		buf[len++] = irc_casemap_lower(*name);
+
+		if (len == sizeof(buf)) {
+			hash ^= irc_ht_hash_bytes(buf, len, secret_key);
+			len = 0;
+		}
+	}
+	return hash ^ irc_ht_hash_bytes(buf, len, secret_key);
+}
+
+bool irc_casemap_ht_eq(const void *const key_a, const void *const key_b)
+{
+	return irc_casemap_eq(key_a, key_b);
+}
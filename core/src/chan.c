@@ -0,0 +1,740 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/bcast.h"
+#include "core/casemap.h"
+#include "core/chan.h"
+#include "core/compiler.h"
+#include "core/conf.h"
+#include "core/pool.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The number of entries a member list starts out with.
+#define MEMBER_LIST_CAPACITY_MIN        (4)
+
+/// @brief The number of runs the names of a channel start out with.
+#define NAMES_CAPACITY_MIN              (1)
+
+/// @brief The longest possible NAMES reply line header, without the channel
+/// name: ":<server> 353 <nick> = <channel> :".
+#define NAMES_HEAD_LEN_MAX              (1 + IRC_CONF_SERVER_NAME_LEN_MAX + \
+                                         5 + IRC_USER_NICK_LEN_MAX + 3 + 2)
+
+// clang-format on
+
+/// @brief Appends a membership to a list.
+///
+/// @returns The index of the membership in the list.
+static u32 member_list_push(struct irc_member_list *const list,
+			    struct irc_member *const member)
+{
+	if (list->num_entries == list->capacity) {
+		list->capacity = list->capacity ? (list->capacity * 2)
+						: MEMBER_LIST_CAPACITY_MIN;
+
+		list->entries = irc_realloc(
+			list->entries, list->capacity * sizeof(*list->entries));
+	}
+	list->entries[list->num_entries] = member;
+	return list->num_entries++;
+}
+
+/// @brief Removes the entry at an index by moving the last entry into its
+/// place.
+///
+/// @returns The entry that was moved, or `NULL` if the removed entry was the
+/// last.
+static struct irc_member *member_list_remove(struct irc_member_list *const list,
+					     const u32 idx)
+{
+	assert(idx < list->num_entries);
+
+	struct irc_member *last = list->entries[--list->num_entries];
+
+	if (idx == list->num_entries) {
+		return NULL;
+	}
+	list->entries[idx] = last;
+	return last;
+}
+
+static int name_cmp(const void *const key,
+		    const struct irc_treap_node *const node)
+{
+	return irc_casemap_cmp(
+		key, IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_name)->name);
+}
+
+static const void *name_key(const struct irc_treap_node *const node)
+{
+	return IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_name)->name;
+}
+
+static int size_cmp(const void *const key,
+		    const struct irc_treap_node *const node)
+{
+	const struct irc_chan_size_key *a = key;
+	const struct irc_chan_size_key *b =
+		&IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_size)
+			 ->sorted.size_key;
+
+	if (a->num_members != b->num_members) {
+		return (a->num_members < b->num_members) ? -1 : 1;
+	}
+
+	if (a->id != b->id) {
+		return (a->id < b->id) ? -1 : 1;
+	}
+	return 0;
+}
+
+static const void *size_key(const struct irc_treap_node *const node)
+{
+	return &IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_size)
+			->sorted.size_key;
+}
+
+/// @brief Moves a channel to its place in the order by member count after its
+/// members changed.
+static void size_update(struct irc_chans *const chans,
+			struct irc_chan *const chan)
+{
+	irc_treap_remove(&chans->sorted.by_size, &chan->sorted.by_size);
+	chan->sorted.size_key.num_members = chan->members.num_entries;
+	irc_treap_insert(&chans->sorted.by_size, &chan->sorted.by_size);
+}
+
+static void member_list_free(struct irc_member_list *const list)
+{
+	free(list->entries);
+	*list = (struct irc_member_list){};
+}
+
+/// @brief Returns the index of the run holding a member.
+IRC_ATTRIB_PURE
+static u32 names_seg_find(const struct irc_names *const names, const u32 idx)
+{
+	u32 lo = 0;
+	u32 hi = names->num_segs;
+
+	while ((hi - lo) > 1) {
+		const u32 mid = lo + ((hi - lo) / 2);
+
+		if (names->segs[mid].start <= idx) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void names_seg_clear(struct irc_names_seg *const seg)
+{
+	if (seg->buf) {
+		irc_buf_unref(seg->buf);
+		seg->buf = NULL;
+	}
+}
+
+static void names_seg_insert(struct irc_names *const names, const u32 pos,
+			     const u32 start, const u32 end)
+{
+	if (names->num_segs == names->capacity) {
+		names->capacity = names->capacity ? (names->capacity * 2)
+						  : NAMES_CAPACITY_MIN;
+
+		names->segs = irc_realloc(
+			names->segs, names->capacity * sizeof(*names->segs));
+	}
+
+	memmove(&names->segs[pos + 1], &names->segs[pos],
+		(names->num_segs - pos) * sizeof(*names->segs));
+
+	names->segs[pos] =
+		(struct irc_names_seg){ .start = start, .end = end, .buf = NULL };
+	names->num_segs++;
+}
+
+static void names_seg_remove(struct irc_names *const names, const u32 pos)
+{
+	names_seg_clear(&names->segs[pos]);
+	names->num_segs--;
+
+	memmove(&names->segs[pos], &names->segs[pos + 1],
+		(names->num_segs - pos) * sizeof(*names->segs));
+}
+
+/// @brief Has the run holding a member rendered again.
+static void names_touch(struct irc_chan *const chan, const u32 idx)
+{
+	names_seg_clear(&chan->names.segs[names_seg_find(&chan->names, idx)]);
+}
+
+/// @brief Extends the last run over a member appended to a channel.
+static void names_grow(struct irc_chan *const chan)
+{
+	struct irc_names *names = &chan->names;
+	const u32 num_members = chan->members.num_entries;
+
+	if (!names->num_segs) {
+		names_seg_insert(names, 0, num_members - 1, num_members);
+		return;
+	}
+
+	struct irc_names_seg *last = &names->segs[names->num_segs - 1];
+
+	last->end = num_members;
+	names_seg_clear(last);
+}
+
+/// @brief Shrinks the last run after the last member of a channel has been
+/// removed.
+static void names_shrink(struct irc_chan *const chan)
+{
+	struct irc_names *names = &chan->names;
+	struct irc_names_seg *last = &names->segs[names->num_segs - 1];
+
+	last->end--;
+	names_seg_clear(last);
+
+	if (last->start == last->end) {
+		names_seg_remove(names, names->num_segs - 1);
+	}
+}
+
+static void names_free(struct irc_names *const names)
+{
+	for (u32 i = 0; i < names->num_segs; ++i) {
+		names_seg_clear(&names->segs[i]);
+	}
+	free(names->segs);
+	*names = (struct irc_names){};
+}
+
+static size_t member_hash(const void *const key, const u8 *const secret_key)
+{
+	const struct irc_member *member = key;
+	const void *const pair[] = { member->user, member->chan };
+
+	return irc_ht_hash_bytes(pair, sizeof(pair), secret_key);
+}
+
+static bool member_eq(const void *const key_a, const void *const key_b)
+{
+	const struct irc_member *a = key_a;
+	const struct irc_member *b = key_b;
+
+	return (a->user == b->user) && (a->chan == b->chan);
+}
+
+void irc_chans_init(struct irc_chans *const chans)
+{
+	static const struct irc_ht_conf by_name_conf = {
+		// clang-format off
+
+		.initial_capacity	= 1024,
+		.load_fact_max		= 75,
+		.hash			= &irc_casemap_ht_hash,
+		.eq			= &irc_casemap_ht_eq
+
+		// clang-format on
+	};
+
+	static const struct irc_ht_conf members_conf = {
+		// clang-format off
+
+		.initial_capacity	= 4096,
+		.load_fact_max		= 75,
+		.hash			= &member_hash,
+		.eq			= &member_eq
+
+		// clang-format on
+	};
+
+	static const struct irc_treap_conf sorted_by_name_conf = {
+		.cmp = &name_cmp, .key = &name_key
+	};
+
+	static const struct irc_treap_conf sorted_by_size_conf = {
+		.cmp = &size_cmp, .key = &size_key
+	};
+
+	irc_ht_init(&chans->by_name, &by_name_conf);
+	irc_ht_init(&chans->members, &members_conf);
+
+	irc_treap_init(&chans->sorted.by_name, &sorted_by_name_conf);
+	irc_treap_init(&chans->sorted.by_size, &sorted_by_size_conf);
+
+	chans->next_id = 0;
+	chans->bcast_epoch = 0;
+}
+
+void irc_chans_destroy(struct irc_chans *const chans)
+{
+	// Destroying a channel moves another one into its slot, so a slot is
+	// only moved on from once it is empty.
+	for (size_t i = 0; i < chans->by_name.capacity;) {
+		const struct irc_ht_entry *entry = &chans->by_name.entries[i];
+
+		if (!entry->psl) {
+			++i;
+			continue;
+		}
+		struct irc_chan *chan = entry->val;
+
+		if (!chan->members.num_entries) {
+			irc_chan_destroy(chans, chan);
+			continue;
+		}
+
+		// Parting the last member destroys the channel.
+		for (u32 j = chan->members.num_entries; j-- > 0;) {
+			irc_chan_part(chans, chan->members.entries[j]);
+		}
+	}
+	irc_ht_destroy(&chans->by_name);
+	irc_ht_destroy(&chans->members);
+}
+
+bool irc_chan_name_valid(const char *const name)
+{
+	if ((name[0] != '#') && (name[0] != '&')) {
+		return false;
+	}
+
+	size_t len = 1;
+
+	for (; name[len] != '\0'; ++len) {
+		// Forbidden by RFC 2812, along with NUL, CR and LF which can
+		// not appear in a parameter.
+		if ((name[len] == ' ') || (name[len] == ',') ||
+		    (name[len] == '\a') || (name[len] == ':')) {
+			return false;
+		}
+	}
+	return (len > 1) && (len <= IRC_CHAN_NAME_LEN_MAX);
+}
+
+struct irc_chan *irc_chan_find(struct irc_chans *const chans,
+			       const char *const name)
+{
+	return irc_ht_get(&chans->by_name, name);
+}
+
+struct irc_chan *irc_chan_create(struct irc_chans *const chans,
+				 const char *const name)
+{
+	assert(irc_chan_name_valid(name));
+	assert(!irc_chan_find(chans, name));
+
+	struct irc_chan *chan = irc_calloc(1, sizeof(*chan));
+	strcpy(chan->name, name);
+
+	chan->created = (u64)time(NULL);
+	chan->masks_gen = 1;
+	chan->sorted.size_key.id = chans->next_id++;
+
+	irc_ht_add(&chans->by_name, chan->name, chan);
+	irc_treap_insert(&chans->sorted.by_name, &chan->sorted.by_name);
+	irc_treap_insert(&chans->sorted.by_size, &chan->sorted.by_size);
+	return chan;
+}
+
+void irc_chan_destroy(struct irc_chans *const chans,
+		      struct irc_chan *const chan)
+{
+	assert(!chan->members.num_entries);
+
+	irc_bcast_backlog_drop(chans, chan);
+	irc_ht_del(&chans->by_name, chan->name);
+	irc_treap_remove(&chans->sorted.by_name, &chan->sorted.by_name);
+	irc_treap_remove(&chans->sorted.by_size, &chan->sorted.by_size);
+	member_list_free(&chan->members);
+	names_free(&chan->names);
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		if (chan->masks[i]) {
+			irc_mask_set_free(chan->masks[i]);
+		}
+	}
+	free(chan);
+}
+
+struct irc_member *irc_chan_member_find(struct irc_chans *const chans,
+					struct irc_chan *const chan,
+					struct irc_user *const user)
+{
+	const struct irc_member key = { .user = user, .chan = chan };
+	return irc_ht_get(&chans->members, &key);
+}
+
+struct irc_member *irc_chan_join(struct irc_chans *const chans,
+				 struct irc_chan *const chan,
+				 struct irc_user *const user, const u8 prefix)
+{
+	assert(!irc_chan_member_find(chans, chan, user));
+
+	struct irc_member *member =
+		irc_pool_alloc(IRC_POOL_MEMBERS, sizeof(*member));
+
+	member->user = user;
+	member->chan = chan;
+	member->prefix = prefix;
+	member->masks_gen = 0;
+	member->joined_epoch = chans->bcast_epoch;
+	member->chan_idx = member_list_push(&chan->members, member);
+	member->user_idx = member_list_push(&user->chans, member);
+	user->chan_bits |= irc_chan_bit(chan);
+
+	if (!user->server) {
+		chan->num_local++;
+	}
+	names_grow(chan);
+	size_update(chans, chan);
+
+	irc_ht_add(&chans->members, member, member);
+	return member;
+}
+
+/// @brief Moves a leaving member out of the recipients of every deferred
+/// broadcast to its channel, without changing who else they reach.
+///
+/// The recipients of each broadcast are the members before an index; the one
+/// being delivered stops at @ref irc_chan::backlog::remaining, the queued ones
+/// at their member counts, which grow from the head of the backlog on. Going
+/// up these bounds, the member is swapped with the last recipient below each
+/// bound it is under, and the bound is lowered past it. A member swapped down
+/// stays under every bound it was under, so that the member moved into the
+/// hole in the end is one none of them has to reach.
+///
+/// @returns The index the member has ended up at.
+static u32 backlog_part(struct irc_chan *const chan, u32 idx)
+{
+	struct irc_member **entries = chan->members.entries;
+	struct irc_member *member = entries[idx];
+
+	u32 *bound = &chan->backlog.remaining;
+
+	for (struct irc_fanout *fanout = chan->backlog.head; fanout;
+	     fanout = fanout->next) {
+		if (fanout != chan->backlog.head) {
+			bound = &fanout->num_members;
+		}
+
+		if (idx >= *bound) {
+			continue;
+		}
+
+		const u32 last = --*bound;
+
+		if (last != idx) {
+			entries[idx] = entries[last];
+			entries[idx]->chan_idx = idx;
+			entries[last] = member;
+			names_touch(chan, idx);
+			idx = last;
+		}
+	}
+	return idx;
+}
+
+void irc_chan_part(struct irc_chans *const chans,
+		   struct irc_member *const member)
+{
+	struct irc_chan *chan = member->chan;
+	struct irc_user *user = member->user;
+
+	struct irc_member *moved;
+
+	u32 idx = member->chan_idx;
+
+	names_touch(chan, idx);
+
+	if (chan->backlog.head) {
+		irc_bcast_backlog_part(chan, user);
+		idx = backlog_part(chan, idx);
+	}
+
+	moved = member_list_remove(&chan->members, idx);
+
+	if (moved) {
+		moved->chan_idx = idx;
+		names_touch(chan, idx);
+	}
+	names_shrink(chan);
+
+	moved = member_list_remove(&user->chans, member->user_idx);
+
+	if (moved) {
+		moved->user_idx = member->user_idx;
+	}
+
+	// Other channels of the user may share the bit of this one.
+	user->chan_bits = 0;
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		user->chan_bits |= irc_chan_bit(user->chans.entries[i]->chan);
+	}
+
+	if (!user->server) {
+		chan->num_local--;
+	}
+	irc_ht_del(&chans->members, member);
+	irc_pool_free(IRC_POOL_MEMBERS, member, sizeof(*member));
+
+	if (!chan->members.num_entries) {
+		irc_chan_destroy(chans, chan);
+		return;
+	}
+	size_update(chans, chan);
+}
+
+void irc_chan_part_all(struct irc_chans *const chans,
+		       struct irc_user *const user)
+{
+	// Parting from the back never moves an entry.
+	while (user->chans.num_entries) {
+		irc_chan_part(chans,
+			      user->chans.entries[user->chans.num_entries - 1]);
+	}
+	member_list_free(&user->chans);
+}
+
+/// @brief Invalidates the ban state cached by every member of a channel.
+static void masks_changed(struct irc_chan *const chan)
+{
+	// 0 stands for a state that has to be found again.
+	if (!++chan->masks_gen) {
+		chan->masks_gen = 1;
+
+		for (u32 i = 0; i < chan->members.num_entries; ++i) {
+			chan->members.entries[i]->masks_gen = 0;
+		}
+	}
+}
+
+const struct irc_mask_entry *irc_chan_mask_add(struct irc_chan *const chan,
+					       const enum irc_chan_masks list,
+					       const char *const mask,
+					       const char *const setter)
+{
+	if (!chan->masks[list]) {
+		chan->masks[list] = irc_mask_set_new();
+	}
+
+	const struct irc_mask_entry *entry = irc_mask_set_add(
+		chan->masks[list], mask, setter, (u64)time(NULL));
+
+	if (entry) {
+		masks_changed(chan);
+	}
+	return entry;
+}
+
+bool irc_chan_mask_del(struct irc_chan *const chan,
+		       const enum irc_chan_masks list, const char *const mask)
+{
+	struct irc_mask_set *set = chan->masks[list];
+
+	if (!set || !irc_mask_set_del(set, mask)) {
+		return false;
+	}
+
+	if (!set->num_entries) {
+		irc_mask_set_free(set);
+		chan->masks[list] = NULL;
+	}
+	masks_changed(chan);
+	return true;
+}
+
+void irc_chan_masks_clear(struct irc_chan *const chan)
+{
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		if (chan->masks[i]) {
+			irc_mask_set_free(chan->masks[i]);
+			chan->masks[i] = NULL;
+		}
+	}
+	masks_changed(chan);
+}
+
+bool irc_chan_user_banned(struct irc_chan *const chan,
+			  const struct irc_user *const user)
+{
+	if (!chan->masks[IRC_CHAN_BANS]) {
+		return false;
+	}
+
+	const struct irc_mask_subject subject = { .nick = user->nick,
+						  .user = user->username,
+						  .host = user->host };
+
+	return irc_mask_set_match(chan->masks[IRC_CHAN_BANS], &subject) &&
+	       !(chan->masks[IRC_CHAN_EXCEPTS] &&
+		 irc_mask_set_match(chan->masks[IRC_CHAN_EXCEPTS], &subject));
+}
+
+bool irc_member_banned(struct irc_member *const member)
+{
+	struct irc_chan *chan = member->chan;
+
+	if (member->masks_gen != chan->masks_gen) {
+		member->banned = irc_chan_user_banned(chan, member->user);
+		member->masks_gen = chan->masks_gen;
+	}
+	return member->banned;
+}
+
+void irc_member_bans_invalidate(struct irc_member *const member)
+{
+	member->masks_gen = 0;
+}
+
+struct irc_chan *irc_chan_seek_name(const struct irc_chans *const chans,
+				    const char *const name, const bool after)
+{
+	const struct irc_treap_node *node =
+		after ? irc_treap_upper_bound(&chans->sorted.by_name, name)
+		      : irc_treap_lower_bound(&chans->sorted.by_name, name);
+
+	return node ? IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_name)
+		    : NULL;
+}
+
+struct irc_chan *irc_chan_seek_size(const struct irc_chans *const chans,
+				    const struct irc_chan_size_key *const key,
+				    const bool after)
+{
+	const struct irc_treap_node *node =
+		after ? irc_treap_upper_bound(&chans->sorted.by_size, key)
+		      : irc_treap_lower_bound(&chans->sorted.by_size, key);
+
+	return node ? IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_size)
+		    : NULL;
+}
+
+struct irc_chan *irc_chan_next_name(const struct irc_chan *const chan)
+{
+	const struct irc_treap_node *node =
+		irc_treap_next(&chan->sorted.by_name);
+
+	return node ? IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_name)
+		    : NULL;
+}
+
+struct irc_chan *irc_chan_next_size(const struct irc_chan *const chan)
+{
+	const struct irc_treap_node *node =
+		irc_treap_next(&chan->sorted.by_size);
+
+	return node ? IRC_CONTAINER_OF(node, struct irc_chan, sorted.by_size)
+		    : NULL;
+}
+
+const struct irc_names *irc_chan_names(struct irc_chan *const chan)
+{
+	struct irc_names *names = &chan->names;
+	struct irc_member *const *members = chan->members.entries;
+
+	const size_t body_len_max =
+		IRC_BUF_LINE_LEN_MAX - 2 - NAMES_HEAD_LEN_MAX - strlen(chan->name);
+
+	for (u32 i = 0; i < names->num_segs; ++i) {
+		if (names->segs[i].buf) {
+			continue;
+		}
+
+		// Runs rendered again one after the other are merged first, so
+		// that members leaving do not leave many short lines behind.
+		while (((i + 1) < names->num_segs) && !names->segs[i + 1].buf) {
+			names->segs[i].end = names->segs[i + 1].end;
+			names_seg_remove(names, i + 1);
+		}
+
+		char body[IRC_BUF_LINE_LEN_MAX];
+		size_t len = 0;
+		u32 idx = names->segs[i].start;
+
+		for (; idx < names->segs[i].end; ++idx) {
+			const struct irc_member *member = members[idx];
+			const char prefix = irc_member_prefix_char(member->prefix);
+			const size_t nick_len = strlen(member->user->nick);
+
+			if ((len + (len ? 1 : 0) + (prefix ? 1 : 0) + nick_len) >
+			    body_len_max) {
+				break;
+			}
+
+			if (len) {
+				body[len++] = ' ';
+			}
+
+			if (prefix) {
+				body[len++] = prefix;
+			}
+			memcpy(&body[len], member->user->nick, nick_len);
+			len += nick_len;
+		}
+
+		// Whatever does not fit goes into a run of its own, rendered
+		// on the next turn of the loop.
+		if (idx < names->segs[i].end) {
+			names_seg_insert(names, i + 1, idx, names->segs[i].end);
+			names->segs[i].end = idx;
+		}
+
+		struct irc_buf *buf = irc_buf_new(len + 2);
+
+		memcpy(buf->data, body, len);
+		memcpy(&buf->data[len], "\r\n", 2);
+
+		names->segs[i].buf = buf;
+	}
+	return names;
+}
+
+void irc_chan_names_invalidate(struct irc_member *const member)
+{
+	names_touch(member->chan, member->chan_idx);
+}
+
+char irc_member_prefix_char(const u8 prefix)
+{
+	if (prefix & IRC_MEMBER_OP) {
+		return '@';
+	}
+
+	if (prefix & IRC_MEMBER_VOICE) {
+		return '+';
+	}
+	return '\0';
+}
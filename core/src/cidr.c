@@ -0,0 +1,415 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/cidr.h"
+#include "core/compiler.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The number of nodes in a slab.
+#define SLAB_NODES_NUM          (4096)
+
+/// @brief The maximum length of a line of a file of networks.
+#define LINE_LEN_MAX            (256)
+
+// clang-format on
+
+struct irc_cidr_slab {
+	struct irc_cidr_slab *next;
+	struct irc_cidr_node nodes[SLAB_NODES_NUM];
+};
+
+/// @brief Returns bit `i` of an address, counting from the most significant
+/// one.
+static uint addr_bit(const struct irc_cidr_addr *const addr, const uint i)
+{
+	return (i < 64) ? (uint)((addr->hi >> (63 - i)) & 1) :
+			  (uint)((addr->lo >> (127 - i)) & 1);
+}
+
+/// @brief Returns the number of leading bits two addresses have in common, up
+/// to `max`.
+static uint common_len(const struct irc_cidr_addr *const a,
+		       const struct irc_cidr_addr *const b, const uint max)
+{
+	const u64 hi = a->hi ^ b->hi;
+	const u64 lo = a->lo ^ b->lo;
+
+	uint len = 128;
+
+	if (hi) {
+		len = (uint)__builtin_clzll(hi);
+	} else if (lo) {
+		len = 64 + (uint)__builtin_clzll(lo);
+	}
+	return (len < max) ? len : max;
+}
+
+static void addr_from_bytes(struct irc_cidr_addr *const addr,
+			    const u8 *const bytes)
+{
+	addr->hi = 0;
+	addr->lo = 0;
+
+	for (size_t i = 0; i < 8; ++i) {
+		addr->hi = (addr->hi << 8) | bytes[i];
+		addr->lo = (addr->lo << 8) | bytes[i + 8];
+	}
+}
+
+static void addr_from_ipv4(struct irc_cidr_addr *const addr,
+			   const u8 *const bytes)
+{
+	addr->hi = 0;
+	addr->lo = UINT64_C(0xffff) << 32;
+
+	for (size_t i = 0; i < 4; ++i) {
+		addr->lo |= (u64)bytes[i] << (24 - (i * 8));
+	}
+}
+
+bool irc_cidr_is_ipv4(const struct irc_cidr_addr *const addr)
+{
+	return (addr->hi == 0) && ((addr->lo >> 32) == 0xffff);
+}
+
+void irc_cidr_mask(struct irc_cidr_addr *const addr, const uint len)
+{
+	if (len == 0) {
+		addr->hi = 0;
+		addr->lo = 0;
+	} else if (len <= 64) {
+		addr->hi &= UINT64_MAX << (64 - len);
+		addr->lo = 0;
+	} else if (len < 128) {
+		addr->lo &= UINT64_MAX << (128 - len);
+	}
+}
+
+bool irc_cidr_parse(const char *const str, struct irc_cidr_addr *const addr,
+		    uint *const len)
+{
+	char buf[IRC_CIDR_LEN_MAX + 1];
+
+	const size_t str_len = strlen(str);
+
+	if (IRC_UNLIKELY(str_len > IRC_CIDR_LEN_MAX)) {
+		return false;
+	}
+	memcpy(buf, str, str_len + 1);
+
+	char *const slash = strchr(buf, '/');
+
+	if (slash) {
+		*slash = '\0';
+	}
+
+	u8 bytes[16];
+	uint len_max;
+
+	if (inet_pton(AF_INET, buf, bytes) == 1) {
+		addr_from_ipv4(addr, bytes);
+		len_max = 32;
+	} else if (inet_pton(AF_INET6, buf, bytes) == 1) {
+		addr_from_bytes(addr, bytes);
+		len_max = 128;
+	} else {
+		return false;
+	}
+
+	uint val = len_max;
+
+	if (slash) {
+		const char *digits = &slash[1];
+
+		if ((*digits == '\0') || (strlen(digits) > 3)) {
+			return false;
+		}
+		val = 0;
+
+		for (; *digits != '\0'; ++digits) {
+			if (!isdigit(*digits)) {
+				return false;
+			}
+			val = (val * 10) + (uint)(*digits - '0');
+		}
+
+		if (val > len_max) {
+			return false;
+		}
+	}
+
+	// Prefixes of IPv4 networks count the bits they are mapped under.
+	*len = (len_max == 32) ? (IRC_CIDR_IPV4_OFFSET + val) : val;
+	irc_cidr_mask(addr, *len);
+
+	return true;
+}
+
+bool irc_cidr_from_sockaddr(const struct sockaddr *const sa,
+			    struct irc_cidr_addr *const addr)
+{
+	if (sa->sa_family == AF_INET) {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)sa;
+		addr_from_ipv4(addr, (const u8 *)&in->sin_addr.s_addr);
+		return true;
+	}
+
+	if (sa->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 =
+			(const struct sockaddr_in6 *)sa;
+		addr_from_bytes(addr, in6->sin6_addr.s6_addr);
+		return true;
+	}
+	return false;
+}
+
+static size_t ipv4_index(const struct irc_cidr_addr *const addr)
+{
+	return (size_t)(addr->lo >> (32 - IRC_CIDR_STRIDE_BITS)) &
+	       ((1U << IRC_CIDR_STRIDE_BITS) - 1);
+}
+
+static size_t ipv6_index(const struct irc_cidr_addr *const addr)
+{
+	const u64 lead = addr->hi >> (64 - IRC_CIDR_IPV6_INDEX_BITS);
+
+	return (size_t)(lead ^ (lead >> IRC_CIDR_STRIDE_BITS)) &
+	       ((1U << IRC_CIDR_STRIDE_BITS) - 1);
+}
+
+static struct irc_cidr_node *node_new(struct irc_cidr_tree *const tree,
+				      const struct irc_cidr_addr *const addr,
+				      const uint len, const bool present)
+{
+	if (!tree->slabs || (tree->slab_used == SLAB_NODES_NUM)) {
+		struct irc_cidr_slab *slab = irc_malloc(sizeof(*slab));
+
+		slab->next = tree->slabs;
+		tree->slabs = slab;
+		tree->slab_used = 0;
+	}
+
+	struct irc_cidr_node *node = &tree->slabs->nodes[tree->slab_used++];
+
+	node->prefix = *addr;
+	irc_cidr_mask(&node->prefix, len);
+
+	node->child[0] = NULL;
+	node->child[1] = NULL;
+	node->len = (u8)len;
+	node->present = present;
+
+	return node;
+}
+
+/// @brief Returns the link to the root of the subtree a network belongs in.
+static struct irc_cidr_node **root_link(struct irc_cidr_tree *const tree,
+					const struct irc_cidr_addr *const addr,
+					const uint len)
+{
+	const size_t roots_size = sizeof(struct irc_cidr_node *)
+				  << IRC_CIDR_STRIDE_BITS;
+
+	if ((len >= IRC_CIDR_IPV4_OFFSET + IRC_CIDR_STRIDE_BITS) &&
+	    irc_cidr_is_ipv4(addr)) {
+		if (!tree->ipv4_roots) {
+			tree->ipv4_roots = irc_calloc(1, roots_size);
+		}
+		return &tree->ipv4_roots[ipv4_index(addr)];
+	}
+
+	if (len >= IRC_CIDR_IPV6_INDEX_BITS) {
+		if (!tree->ipv6_roots) {
+			tree->ipv6_roots = irc_calloc(1, roots_size);
+		}
+		return &tree->ipv6_roots[ipv6_index(addr)];
+	}
+	return &tree->root;
+}
+
+bool irc_cidr_add(struct irc_cidr_tree *const tree,
+		  const struct irc_cidr_addr *const addr, const uint len)
+{
+	struct irc_cidr_node **link = root_link(tree, addr, len);
+
+	for (struct irc_cidr_node *node; (node = *link);) {
+		const uint common = common_len(&node->prefix, addr,
+					       (node->len < len) ? node->len :
+								   len);
+
+		if (common < node->len) {
+			// The network branches off above the node, which
+			// becomes the child of the network or of the point
+			// they branch at.
+			struct irc_cidr_node *parent =
+				node_new(tree, addr, common, common == len);
+
+			parent->child[addr_bit(&node->prefix, common)] = node;
+
+			if (common < len) {
+				parent->child[addr_bit(addr, common)] =
+					node_new(tree, addr, len, true);
+			}
+			*link = parent;
+
+			tree->num_entries++;
+			return true;
+		}
+
+		if (node->len == len) {
+			if (node->present) {
+				return false;
+			}
+			node->present = true;
+
+			tree->num_entries++;
+			return true;
+		}
+		link = &node->child[addr_bit(addr, node->len)];
+	}
+	*link = node_new(tree, addr, len, true);
+
+	tree->num_entries++;
+	return true;
+}
+
+/// @brief Looks up the longest network of a subtree containing an address.
+static bool subtree_match(const struct irc_cidr_node *node,
+			  const struct irc_cidr_addr *const addr,
+			  uint *const len)
+{
+	bool found = false;
+
+	while (node) {
+		if (common_len(&node->prefix, addr, node->len) < node->len) {
+			break;
+		}
+
+		if (node->present) {
+			found = true;
+			*len = node->len;
+		}
+
+		if (node->len == IRC_CIDR_ADDR_BITS) {
+			break;
+		}
+		node = node->child[addr_bit(addr, node->len)];
+	}
+	return found;
+}
+
+bool irc_cidr_match(const struct irc_cidr_tree *const tree,
+		    const struct irc_cidr_addr *const addr, uint *const len)
+{
+	uint match_len;
+
+	// Every network of a subtree is longer than those of the trees looked
+	// up after it, so the first match is the longest.
+	const bool found =
+		(tree->ipv4_roots && irc_cidr_is_ipv4(addr) &&
+		 subtree_match(tree->ipv4_roots[ipv4_index(addr)], addr,
+			       &match_len)) ||
+		(tree->ipv6_roots &&
+		 subtree_match(tree->ipv6_roots[ipv6_index(addr)], addr,
+			       &match_len)) ||
+		subtree_match(tree->root, addr, &match_len);
+
+	if (found && len) {
+		*len = match_len;
+	}
+	return found;
+}
+
+bool irc_cidr_load(struct irc_cidr_tree *const tree, const char *const path,
+		   size_t *const line)
+{
+	*line = 0;
+
+	FILE *const file = fopen(path, "r");
+
+	if (IRC_UNLIKELY(!file)) {
+		return false;
+	}
+
+	char buf[LINE_LEN_MAX + 2];
+	bool ok = true;
+
+	for (size_t num = 1; fgets(buf, sizeof(buf), file); ++num) {
+		size_t len = strlen(buf);
+
+		if ((len == sizeof(buf) - 1) && (buf[len - 1] != '\n')) {
+			*line = num;
+			ok = false;
+			break;
+		}
+
+		while (len && isspace((unsigned char)buf[len - 1])) {
+			buf[--len] = '\0';
+		}
+
+		const char *entry = buf;
+
+		while (isspace((unsigned char)*entry)) {
+			++entry;
+		}
+
+		if ((*entry == '\0') || (*entry == '#')) {
+			continue;
+		}
+
+		struct irc_cidr_addr addr;
+		uint prefix_len;
+
+		if (IRC_UNLIKELY(!irc_cidr_parse(entry, &addr, &prefix_len))) {
+			*line = num;
+			ok = false;
+			break;
+		}
+		irc_cidr_add(tree, &addr, prefix_len);
+	}
+
+	fclose(file);
+	return ok;
+}
+
+void irc_cidr_tree_destroy(struct irc_cidr_tree *const tree)
+{
+	for (struct irc_cidr_slab *slab = tree->slabs; slab;) {
+		struct irc_cidr_slab *next = slab->next;
+		free(slab);
+		slab = next;
+	}
+	free(tree->ipv4_roots);
+	free(tree->ipv6_roots);
+
+	*tree = (struct irc_cidr_tree){};
+}
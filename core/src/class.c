@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "core/cidr.h"
+#include "core/class.h"
+
+void irc_classes_init(struct irc_classes *const classes,
+		      const struct irc_conf *const conf)
+{
+	memset(classes, 0, sizeof(*classes));
+
+	struct irc_class *fallback = &classes->entries[0];
+
+	strcpy(fallback->conf.name, IRC_CLASS_DEFAULT_NAME);
+	fallback->conf.sendq_max = IRC_CONF_CLASS_SENDQ_DEFAULT;
+	fallback->conf.recvq_max = IRC_CONF_CLASS_RECVQ_MAX;
+	fallback->active = true;
+
+	// There is always room for the classes of a single configuration.
+	irc_classes_apply(classes, conf);
+}
+
+bool irc_classes_apply(struct irc_classes *const classes,
+		       const struct irc_conf *const conf)
+{
+	const size_t num = conf->classes.num_entries;
+
+	// The slot every class goes to is found before anything is changed.
+	bool claimed[IRC_CLASS_SLOT_NUM] = { [0] = true };
+	size_t slots[IRC_CONF_CLASS_NUM_MAX] = {};
+	bool fresh[IRC_CONF_CLASS_NUM_MAX] = {};
+
+	for (size_t i = 0; i < num; ++i) {
+		for (size_t j = 1; j < IRC_CLASS_SLOT_NUM; ++j) {
+			const struct irc_class *cls = &classes->entries[j];
+
+			if (!claimed[j] && (cls->active || cls->num_users) &&
+			    !strcmp(cls->conf.name,
+				    conf->classes.entries[i].name)) {
+				claimed[j] = true;
+				slots[i] = j;
+				break;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < num; ++i) {
+		for (size_t j = 1; !slots[i] && (j < IRC_CLASS_SLOT_NUM); ++j) {
+			if (!claimed[j] && !classes->entries[j].num_users) {
+				claimed[j] = true;
+				slots[i] = j;
+				fresh[i] = true;
+			}
+		}
+
+		if (!slots[i]) {
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < classes->num_order; ++i) {
+		classes->order[i]->active = false;
+	}
+
+	for (size_t i = 0; i < num; ++i) {
+		struct irc_class *cls = &classes->entries[slots[i]];
+
+		// A class new to the slot starts counting afresh.
+		if (fresh[i]) {
+			*cls = (struct irc_class){};
+		}
+		cls->conf = conf->classes.entries[i];
+		cls->active = true;
+
+		classes->order[i] = cls;
+	}
+	classes->num_order = num;
+	classes->budget = conf->classes.budget;
+
+	return true;
+}
+
+struct irc_class *irc_classes_match(struct irc_classes *const classes,
+				    const char *const host)
+{
+	struct irc_cidr_addr addr;
+	uint len;
+
+	const bool parsed = irc_cidr_parse(host, &addr, &len);
+
+	for (size_t i = 0; i < classes->num_order; ++i) {
+		const struct irc_conf_class *conf = &classes->order[i]->conf;
+
+		if (!conf->net_len) {
+			return classes->order[i];
+		}
+
+		if (!parsed || (len < conf->net_len)) {
+			continue;
+		}
+		struct irc_cidr_addr net = addr;
+		irc_cidr_mask(&net, conf->net_len);
+
+		if ((net.hi == conf->net.hi) && (net.lo == conf->net.lo)) {
+			return classes->order[i];
+		}
+	}
+	return &classes->entries[0];
+}
+
+/// @brief Reports a single class.
+static void class_report(const struct irc_class *const cls,
+			 const irc_classes_emit_cb emit, void *const udata)
+{
+	char line[160];
+
+	const int len =
+		snprintf(line, sizeof(line),
+			 "class %s%s users %" PRIu32 " sendq %zu/%" PRIu32
+			 " recvq %zu/%" PRIu32 " evicted %" PRIu64,
+			 cls->conf.name, cls->active ? "" : " (retired)",
+			 cls->num_users, cls->sendq_bytes, cls->conf.sendq_max,
+			 cls->recvq_bytes, cls->conf.recvq_max,
+			 cls->num_evicted);
+	emit(udata, line, (size_t)len);
+}
+
+void irc_classes_report(const struct irc_classes *const classes,
+			const irc_classes_emit_cb emit, void *const udata)
+{
+	for (size_t i = 0; i < classes->num_order; ++i) {
+		class_report(classes->order[i], emit, udata);
+	}
+	class_report(&classes->entries[0], emit, udata);
+
+	for (size_t i = 1; i < IRC_CLASS_SLOT_NUM; ++i) {
+		const struct irc_class *cls = &classes->entries[i];
+
+		if (!cls->active && cls->num_users) {
+			class_report(cls, emit, udata);
+		}
+	}
+
+	char line[64];
+
+	const int len = snprintf(line, sizeof(line),
+				 "classes budget %zu/%" PRIu64, classes->bytes,
+				 classes->budget);
+	emit(udata, line, (size_t)len);
+}
@@ -0,0 +1,1769 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "core/bcast.h"
+#include "core/casemap.h"
+#include "core/chan.h"
+#include "core/cmd.h"
+#include "core/ctx.h"
+#include "core/filter.h"
+#include "core/irc_parse.h"
+#include "core/link.h"
+#include "core/mask.h"
+#include "core/metrics.h"
+#include "core/monitor.h"
+#include "core/pool.h"
+#include "core/snapshot.h"
+#include "core/user.h"
+#include "core/vmem.h"
+
+// clang-format off
+
+#define RPL_WELCOME             "001"
+#define RPL_ISUPPORT            "005"
+#define RPL_ENDOFSTATS          "219"
+#define RPL_UMODEIS             "221"
+#define RPL_STATSDEBUG          "249"
+#define RPL_AWAY                "301"
+#define RPL_UNAWAY              "305"
+#define RPL_NOWAWAY             "306"
+#define RPL_ENDOFWHO            "315"
+#define RPL_LISTSTART           "321"
+#define RPL_LIST                "322"
+#define RPL_LISTEND             "323"
+#define RPL_CHANNELMODEIS       "324"
+#define RPL_EXCEPTLIST          "348"
+#define RPL_ENDOFEXCEPTLIST     "349"
+#define RPL_WHOREPLY            "352"
+#define RPL_NAMREPLY            "353"
+#define RPL_ENDOFNAMES          "366"
+#define RPL_BANLIST             "367"
+#define RPL_ENDOFBANLIST        "368"
+#define ERR_NOSUCHNICK          "401"
+#define ERR_NOSUCHCHANNEL       "403"
+#define ERR_CANNOTSENDTOCHAN    "404"
+#define ERR_TOOMANYCHANNELS     "405"
+#define ERR_INVALIDCAPCMD       "410"
+#define ERR_NORECIPIENT         "411"
+#define ERR_NOTEXTTOSEND        "412"
+#define ERR_UNKNOWNCOMMAND      "421"
+#define ERR_NONICKNAMEGIVEN     "431"
+#define ERR_ERRONEUSNICKNAME    "432"
+#define ERR_NICKNAMEINUSE       "433"
+#define ERR_NOTONCHANNEL        "442"
+#define ERR_NOTREGISTERED       "451"
+#define ERR_NEEDMOREPARAMS      "461"
+#define ERR_ALREADYREGISTRED    "462"
+#define ERR_YOUREBANNEDCREEP    "465"
+#define ERR_UNKNOWNMODE         "472"
+#define ERR_BANNEDFROMCHAN      "474"
+#define ERR_BANLISTFULL         "478"
+#define ERR_CHANOPRIVSNEEDED    "482"
+#define ERR_USERSDONTMATCH      "502"
+#define RPL_MONONLINE           "730"
+#define RPL_MONOFFLINE          "731"
+#define RPL_MONLIST             "732"
+#define RPL_ENDOFMONLIST        "733"
+#define ERR_MONLISTFULL         "734"
+
+/// @brief The STATS letter reporting the contents of the metrics registry.
+#define STATS_METRICS           'M'
+
+/// @brief The STATS letter reporting the links to other servers.
+#define STATS_LINKS             'l'
+
+/// @brief The STATS letter reporting the memory held by the pools, and mapped
+/// for large tables.
+#define STATS_MEMORY            'z'
+
+/// @brief The STATS letter reporting the connection classes.
+#define STATS_CLASSES           'Y'
+
+/// @brief The maximum number of channels a user may be in.
+#define USER_CHANS_NUM_MAX      (100)
+
+/// @brief The maximum number of masks in each list of a channel.
+#define CHAN_MASKS_NUM_MAX      (100)
+
+/// @brief The maximum length of a line sent to a user, excluding the line
+/// terminator.
+#define LINE_LEN_MAX            (510)
+
+/// @brief The number of WHO reply lines queued at a time.
+#define WHO_CHUNK_LINES         (64)
+
+/// @brief The number of LIST reply lines queued at a time.
+#define LIST_CHUNK_LINES        (64)
+
+/// @brief The number of channels looked at, matching or not, for one chunk of
+/// a LIST reply.
+#define LIST_CHUNK_CHANS        (1024)
+
+/// @brief The longest number accepted in a LIST filter.
+#define LIST_NUM_LEN_MAX        (9)
+
+/// @brief The lines of streamed replies are only queued while the send queue
+/// of the user holds fewer bytes than this.
+#define STREAM_SENDQ_LEN_LOW    (8192)
+
+/// @brief The length of the list of nicknames of a MONITOR reply line at
+/// most, which keeps lines within the 512 byte limit.
+#define MONITOR_REPLY_LEN_MAX   (400)
+
+// clang-format on
+
+typedef void (*cmd_cb)(struct irc_ctx *ctx, struct irc_user *user,
+		       const struct irc_msg *msg);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct stats_emit_data {
+	struct irc_ctx *ctx;
+	struct irc_user *user;
+	char letter;
+};
+
+/// @brief A MONITOR reply line being filled with nicknames.
+struct monitor_reply {
+	const char *numeric;
+	size_t len;
+	char buf[MONITOR_REPLY_LEN_MAX + 1];
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Returns the name of a user as used as the target of a reply.
+static const char *user_name(const struct irc_user *const user)
+{
+	return (user->nick[0] != '\0') ? user->nick : "*";
+}
+
+static void need_more_params(struct irc_ctx *const ctx,
+			     struct irc_user *const user,
+			     const char *const cmd)
+{
+	irc_user_sendf(ctx, user,
+		       ":%s " ERR_NEEDMOREPARAMS " %s %s :Not enough parameters",
+		       ctx->conf.server_name, user_name(user), cmd);
+}
+
+static void stats_emit(void *const udata, const char *const line,
+		       const size_t len)
+{
+	const struct stats_emit_data *data = udata;
+
+	irc_user_sendf(data->ctx, data->user,
+		       ":%s " RPL_STATSDEBUG " %s %c :%.*s",
+		       data->ctx->conf.server_name, user_name(data->user),
+		       data->letter, (int)len, line);
+}
+
+static void cmd_stats(struct irc_ctx *const ctx, struct irc_user *const user,
+		      const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		need_more_params(ctx, user, "STATS");
+		return;
+	}
+
+	const char letter = msg->params[0].entry[0];
+
+	if (letter == STATS_METRICS) {
+		struct irc_metrics_snapshot snap;
+		irc_metrics_read(&ctx->metrics, &snap);
+
+		struct stats_emit_data data = { .ctx = ctx,
+						.user = user,
+						.letter = letter };
+
+		irc_metrics_render_text(&snap, &stats_emit, &data);
+	} else if (letter == STATS_LINKS) {
+		struct stats_emit_data data = { .ctx = ctx,
+						.user = user,
+						.letter = letter };
+
+		irc_links_report(&ctx->links, &stats_emit, &data);
+	} else if (letter == STATS_MEMORY) {
+		struct stats_emit_data data = { .ctx = ctx,
+						.user = user,
+						.letter = letter };
+
+		irc_pool_report(&stats_emit, &data);
+		irc_vmem_report(&stats_emit, &data);
+	} else if (letter == STATS_CLASSES) {
+		struct stats_emit_data data = { .ctx = ctx,
+						.user = user,
+						.letter = letter };
+
+		irc_classes_report(&ctx->classes, &stats_emit, &data);
+	}
+
+	irc_user_sendf(ctx, user,
+		       ":%s " RPL_ENDOFSTATS " %s %c :End of /STATS report",
+		       ctx->conf.server_name, user_name(user), letter);
+}
+
+/// @brief Tells the users monitoring the nickname of a user that it has come
+/// online or gone offline.
+static void monitor_notify(struct irc_ctx *const ctx,
+			   const struct irc_user *const user, const bool online)
+{
+	const struct irc_monitor *target =
+		irc_monitor_find(&ctx->monitors, user->nick);
+
+	if (!target) {
+		return;
+	}
+
+	for (u32 i = 0; i < target->num_watchers; ++i) {
+		struct irc_user *watcher = target->watchers[i]->user;
+
+		if (online) {
+			irc_user_sendf(ctx, watcher,
+				       ":%s " RPL_MONONLINE " %s :%s!%s@%s",
+				       ctx->conf.server_name, watcher->nick,
+				       user->nick, user->username, user->host);
+		} else {
+			irc_user_sendf(ctx, watcher,
+				       ":%s " RPL_MONOFFLINE " %s :%s",
+				       ctx->conf.server_name, watcher->nick,
+				       user->nick);
+		}
+	}
+}
+
+static void try_register(struct irc_ctx *const ctx,
+			 struct irc_user *const user)
+{
+	if ((user->nick[0] == '\0') || (user->username[0] == '\0') ||
+	    user->cap_negotiating) {
+		return;
+	}
+	if (ctx->klines) {
+		const struct irc_mask_subject subject = {
+			.nick = user->nick,
+			.user = user->username,
+			.host = user->host
+		};
+
+		if (irc_mask_set_match(ctx->klines, &subject)) {
+			irc_user_sendf(ctx, user,
+				       ":%s " ERR_YOUREBANNEDCREEP
+				       " %s :You are banned from this server",
+				       ctx->conf.server_name, user->nick);
+			irc_user_sendf(ctx, user,
+				       "ERROR :Closing Link: %s (K-lined)",
+				       user->host);
+			user->closing = true;
+			return;
+		}
+	}
+	user->registered = true;
+
+	irc_user_sendf(ctx, user,
+		       ":%s " RPL_WELCOME " %s :Welcome to the Internet Relay "
+		       "Network %s!%s@%s",
+		       ctx->conf.server_name, user->nick, user->nick,
+		       user->username, user->host);
+
+	irc_user_sendf(ctx, user,
+		       ":%s " RPL_ISUPPORT " %s MONITOR=%d :are supported by "
+		       "this server",
+		       ctx->conf.server_name, user->nick, IRC_MONITOR_NUM_MAX);
+
+	user->ts = (u64)time(NULL);
+
+	irc_cmd_user_intro(ctx, user);
+	irc_links_user_intro(ctx, NULL, user);
+}
+
+static void cmd_nick(struct irc_ctx *const ctx, struct irc_user *const user,
+		     const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_NONICKNAMEGIVEN
+			       " %s :No nickname given",
+			       ctx->conf.server_name, user_name(user));
+		return;
+	}
+
+	const char *nick = msg->params[0].entry;
+
+	if (!irc_user_nick_valid(nick)) {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_ERRONEUSNICKNAME
+			       " %s %s :Erroneous nickname",
+			       ctx->conf.server_name, user_name(user), nick);
+		return;
+	}
+
+	const struct irc_user *owner = irc_ht_get(&ctx->nicks, nick);
+
+	if (owner && (owner != user)) {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_NICKNAMEINUSE
+			       " %s %s :Nickname is already in use",
+			       ctx->conf.server_name, user_name(user), nick);
+		return;
+	}
+
+	if (user->registered) {
+		// A change of case keeps the claim on the nickname.
+		const u64 ts = irc_casemap_eq(user->nick, nick)
+				       ? user->ts
+				       : (u64)time(NULL);
+
+		irc_cmd_user_rename(ctx, user, nick, ts);
+		irc_links_sendf(ctx, NULL, ":%s NICK %s %" PRIu64, user->uid,
+				user->nick, user->ts);
+		return;
+	}
+
+	// The table is keyed by the nickname stored in the user itself, so the
+	// entry has to be replaced rather than updated.
+	if (user->nick[0] != '\0') {
+		irc_ht_del(&ctx->nicks, user->nick);
+	}
+	strcpy(user->nick, nick);
+	irc_ht_add(&ctx->nicks, user->nick, user);
+
+	try_register(ctx, user);
+}
+
+static void cmd_user(struct irc_ctx *const ctx, struct irc_user *const user,
+		     const struct irc_msg *const msg)
+{
+	if (user->registered) {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_ALREADYREGISTRED
+			       " %s :You may not reregister",
+			       ctx->conf.server_name, user_name(user));
+		return;
+	}
+
+	if ((msg->num_params < 4) || !msg->params[0].entry_len) {
+		need_more_params(ctx, user, "USER");
+		return;
+	}
+
+	// Overlong usernames are truncated, as is common practice.
+	size_t len = msg->params[0].entry_len;
+
+	if (len > IRC_USER_NAME_LEN_MAX) {
+		len = IRC_USER_NAME_LEN_MAX;
+	}
+	memcpy(user->username, msg->params[0].entry, len);
+	user->username[len] = '\0';
+
+	len = msg->params[3].entry_len;
+
+	if (len > IRC_USER_REALNAME_LEN_MAX) {
+		len = IRC_USER_REALNAME_LEN_MAX;
+	}
+	memcpy(user->realname, msg->params[3].entry, len);
+	user->realname[len] = '\0';
+
+	try_register(ctx, user);
+}
+
+/// @brief Sends the NAMES reply of a channel. Only the header of its lines is
+/// made for the user; the names are the ones cached by the channel.
+static void names_send(struct irc_ctx *const ctx, struct irc_user *const user,
+		       struct irc_chan *const chan)
+{
+	const struct irc_names *names = irc_chan_names(chan);
+
+	char line[LINE_LEN_MAX + 1];
+
+	const int len =
+		snprintf(line, sizeof(line), ":%s " RPL_NAMREPLY " %s = %s :",
+			 ctx->conf.server_name, user->nick, chan->name);
+
+	struct irc_buf *head = irc_buf_new((size_t)len);
+	memcpy(head->data, line, (size_t)len);
+
+	for (u32 i = 0; i < names->num_segs; ++i) {
+		irc_user_send_split(ctx, user, head, names->segs[i].buf);
+	}
+	irc_buf_unref(head);
+}
+
+static void names_end_send(struct irc_ctx *const ctx,
+			   struct irc_user *const user, const char *const name)
+{
+	irc_user_sendf(ctx, user,
+		       ":%s " RPL_ENDOFNAMES " %s %s :End of /NAMES list",
+		       ctx->conf.server_name, user->nick, name);
+}
+
+static void no_such_chan(struct irc_ctx *const ctx, struct irc_user *const user,
+			 const char *const name)
+{
+	irc_user_sendf(ctx, user,
+		       ":%s " ERR_NOSUCHCHANNEL " %s %s :No such channel",
+		       ctx->conf.server_name, user->nick, name);
+}
+
+static void join(struct irc_ctx *const ctx, struct irc_user *const user,
+		 const char *const name)
+{
+	if (!irc_chan_name_valid(name)) {
+		no_such_chan(ctx, user, name);
+		return;
+	}
+
+	struct irc_chan *chan = irc_chan_find(&ctx->chans, name);
+
+	if (chan && irc_chan_member_find(&ctx->chans, chan, user)) {
+		return;
+	}
+
+	if (user->chans.num_entries >= USER_CHANS_NUM_MAX) {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_TOOMANYCHANNELS
+			       " %s %s :You have joined too many channels",
+			       ctx->conf.server_name, user->nick, name);
+		return;
+	}
+
+	// A channel the snapshot holds comes back as it was before the
+	// restart, masks included, which may keep its first member out.
+	struct irc_chan *restored = NULL;
+
+	if (!chan) {
+		chan = irc_snapshot_restore(&ctx->snapshot, &ctx->chans, name);
+		restored = chan;
+	}
+
+	if (chan && irc_chan_user_banned(chan, user)) {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_BANNEDFROMCHAN
+			       " %s %s :Cannot join channel (+b)",
+			       ctx->conf.server_name, user->nick, chan->name);
+
+		if (restored) {
+			irc_snapshot_unrestore(&ctx->snapshot, &ctx->chans,
+					       restored);
+		}
+		return;
+	}
+
+	u8 prefix = 0;
+
+	// Whoever creates a channel is its first operator.
+	if (!chan) {
+		chan = irc_chan_create(&ctx->chans, name);
+		prefix = IRC_MEMBER_OP;
+
+		irc_links_sendf(ctx, NULL, ":%s SJOIN %" PRIu64 " %s + :@%s",
+				ctx->conf.server_id, chan->created, chan->name,
+				user->uid);
+	} else if (restored) {
+		prefix = IRC_MEMBER_OP;
+	} else {
+		irc_links_sendf(ctx, NULL, ":%s JOIN %" PRIu64 " %s +",
+				user->uid, chan->created, chan->name);
+	}
+
+	irc_chan_join(&ctx->chans, chan, user, prefix);
+
+	// The network is told of the masks along with the channel.
+	if (restored) {
+		irc_links_chan_burst(ctx, restored);
+	}
+
+	struct irc_bcast bc;
+
+	// The joining user is told first and directly, since the broadcast to
+	// the others may be deferred.
+	irc_bcast_init(&bc, ":%s!%s@%s JOIN %s", user->nick, user->username,
+		       user->host, chan->name);
+	irc_bcast_user(ctx, &bc, user);
+	irc_bcast_chan(ctx, &bc, chan, user);
+	irc_bcast_done(&bc);
+
+	names_send(ctx, user, chan);
+	names_end_send(ctx, user, chan->name);
+}
+
+/// @brief Calls a function for every entry of a comma separated list.
+static void list_foreach(struct irc_ctx *const ctx, struct irc_user *const user,
+			 const char *const list,
+			 void (*cb)(struct irc_ctx *ctx, struct irc_user *user,
+				    const char *entry))
+{
+	char entry[IRC_MSG_PARAM_LEN_MAX + 1];
+
+	for (const char *pos = list;;) {
+		const char *end = strchr(pos, ',');
+		const size_t len = end ? (size_t)(end - pos) : strlen(pos);
+
+		memcpy(entry, pos, len);
+		entry[len] = '\0';
+
+		if (len) {
+			cb(ctx, user, entry);
+		}
+
+		if (!end) {
+			return;
+		}
+		pos = end + 1;
+	}
+}
+
+static void cmd_join(struct irc_ctx *const ctx, struct irc_user *const user,
+		     const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		need_more_params(ctx, user, "JOIN");
+		return;
+	}
+	list_foreach(ctx, user, msg->params[0].entry, &join);
+}
+
+static void cmd_part(struct irc_ctx *const ctx, struct irc_user *const user,
+		     const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		need_more_params(ctx, user, "PART");
+		return;
+	}
+
+	// Only a single channel is supported, so that the reason does not
+	// have to be passed down.
+	const char *name = msg->params[0].entry;
+	const char *reason = (msg->num_params > 1) ? msg->params[1].entry : "";
+
+	struct irc_chan *chan = irc_chan_find(&ctx->chans, name);
+
+	if (!chan) {
+		no_such_chan(ctx, user, name);
+		return;
+	}
+
+	struct irc_member *member =
+		irc_chan_member_find(&ctx->chans, chan, user);
+
+	if (!member) {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_NOTONCHANNEL
+			       " %s %s :You're not on that channel",
+			       ctx->conf.server_name, user->nick, chan->name);
+		return;
+	}
+
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s!%s@%s PART %s :%s", user->nick,
+		       user->username, user->host, chan->name, reason);
+	irc_bcast_user(ctx, &bc, user);
+	irc_bcast_chan(ctx, &bc, chan, user);
+	irc_bcast_done(&bc);
+
+	irc_links_sendf(ctx, NULL, ":%s PART %s :%s", user->uid, chan->name,
+			reason);
+
+	irc_chan_part(&ctx->chans, member);
+}
+
+static void names(struct irc_ctx *const ctx, struct irc_user *const user,
+		  const char *const name)
+{
+	struct irc_chan *chan = irc_chan_find(&ctx->chans, name);
+
+	if (chan) {
+		names_send(ctx, user, chan);
+	}
+	names_end_send(ctx, user, name);
+}
+
+static void cmd_names(struct irc_ctx *const ctx, struct irc_user *const user,
+		      const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		names_end_send(ctx, user, "*");
+		return;
+	}
+	list_foreach(ctx, user, msg->params[0].entry, &names);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief The supported capabilities.
+static const struct {
+	const char *name;
+	u8 cap;
+} caps[] = {
+	// clang-format off
+
+	{ "server-time",        IRC_USER_CAP_SERVER_TIME        },
+	{ "away-notify",        IRC_USER_CAP_AWAY_NOTIFY        }
+
+	// clang-format on
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Returns the capability with the given name, or 0 if it is not
+/// supported.
+static u8 cap_find(const char *const name, const size_t len)
+{
+	for (size_t i = 0; i < (sizeof(caps) / sizeof(*caps)); ++i) {
+		if ((strlen(caps[i].name) == len) &&
+		    !strncmp(caps[i].name, name, len)) {
+			return caps[i].cap;
+		}
+	}
+	return 0;
+}
+
+/// @brief Sends the names of the capabilities in a mask, space separated.
+static void cap_list_send(struct irc_ctx *const ctx,
+			  struct irc_user *const user, const char *const sub,
+			  const u8 mask)
+{
+	char list[64] = "";
+	size_t len = 0;
+
+	for (size_t i = 0; i < (sizeof(caps) / sizeof(*caps)); ++i) {
+		if (mask & caps[i].cap) {
+			len += (size_t)snprintf(&list[len], sizeof(list) - len,
+						"%s%s", len ? " " : "",
+						caps[i].name);
+		}
+	}
+	irc_user_sendf(ctx, user, ":%s CAP %s %s :%s", ctx->conf.server_name,
+		       user_name(user), sub, list);
+}
+
+/// @brief Enables or disables every capability in a space separated list.
+/// Nothing is changed unless every capability is supported.
+///
+/// @returns `false` if any of the capabilities is not supported.
+static bool cap_req(struct irc_user *const user, const char *list)
+{
+	u8 enable = 0;
+	u8 disable = 0;
+
+	while (*list != '\0') {
+		const bool neg = (*list == '-');
+
+		if (neg) {
+			list++;
+		}
+
+		const size_t len = strcspn(list, " ");
+		const u8 cap = cap_find(list, len);
+
+		if (!cap) {
+			return false;
+		}
+
+		if (neg) {
+			disable |= cap;
+		} else {
+			enable |= cap;
+		}
+
+		list += len;
+		list += strspn(list, " ");
+	}
+
+	user->caps = (u8)((user->caps | enable) & ~disable);
+	return true;
+}
+
+static void cmd_cap(struct irc_ctx *const ctx, struct irc_user *const user,
+		    const struct irc_msg *const msg)
+{
+	if (!msg->num_params) {
+		need_more_params(ctx, user, "CAP");
+		return;
+	}
+
+	const char *sub = msg->params[0].entry;
+
+	if (!strcasecmp(sub, "LS")) {
+		if (!user->registered) {
+			user->cap_negotiating = true;
+		}
+		cap_list_send(ctx, user, "LS", UINT8_MAX);
+	} else if (!strcasecmp(sub, "LIST")) {
+		cap_list_send(ctx, user, "LIST", user->caps);
+	} else if (!strcasecmp(sub, "REQ") && (msg->num_params > 1)) {
+		if (!user->registered) {
+			user->cap_negotiating = true;
+		}
+
+		const char *list = msg->params[1].entry;
+		const bool ok = cap_req(user, list);
+
+		irc_user_sendf(ctx, user, ":%s CAP %s %s :%s",
+			       ctx->conf.server_name, user_name(user),
+			       ok ? "ACK" : "NAK", list);
+	} else if (!strcasecmp(sub, "END")) {
+		if (user->cap_negotiating) {
+			user->cap_negotiating = false;
+			try_register(ctx, user);
+		}
+	} else {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_INVALIDCAPCMD
+			       " %s %s :Invalid CAP command",
+			       ctx->conf.server_name, user_name(user), sub);
+	}
+}
+
+/// @brief Relays a PRIVMSG or NOTICE. Replies are only sent for PRIVMSG, as
+/// NOTICE must never trigger automatic replies.
+static void msg_relay(struct irc_ctx *const ctx, struct irc_user *const user,
+		      const struct irc_msg *const msg, const char *const cmd,
+		      const bool replies)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		if (replies) {
+			irc_user_sendf(ctx, user,
+				       ":%s " ERR_NORECIPIENT
+				       " %s :No recipient given (%s)",
+				       ctx->conf.server_name, user->nick, cmd);
+		}
+		return;
+	}
+
+	if ((msg->num_params < 2) || !msg->params[1].entry_len) {
+		if (replies) {
+			irc_user_sendf(ctx, user,
+				       ":%s " ERR_NOTEXTTOSEND
+				       " %s :No text to send",
+				       ctx->conf.server_name, user->nick);
+		}
+		return;
+	}
+
+	const char *target = msg->params[0].entry;
+	const char *text = msg->params[1].entry;
+
+	struct irc_chan *chan = NULL;
+	struct irc_user *dst = NULL;
+
+	if (irc_chan_name_valid(target)) {
+		chan = irc_chan_find(&ctx->chans, target);
+
+		if (!chan) {
+			if (replies) {
+				no_such_chan(ctx, user, target);
+			}
+			return;
+		}
+
+		struct irc_member *member =
+			irc_chan_member_find(&ctx->chans, chan, user);
+
+		// Channels are +n: only members may send to them. Banned
+		// members may not either, unless they have a prefix mode.
+		if (!member || (!member->prefix && irc_member_banned(member))) {
+			if (replies) {
+				irc_user_sendf(ctx, user,
+					       ":%s " ERR_CANNOTSENDTOCHAN
+					       " %s %s :Cannot send to channel",
+					       ctx->conf.server_name,
+					       user->nick, chan->name);
+			}
+			return;
+		}
+	} else {
+		dst = irc_ht_get(&ctx->nicks, target);
+
+		if (!dst) {
+			if (replies) {
+				irc_user_sendf(ctx, user,
+					       ":%s " ERR_NOSUCHNICK
+					       " %s %s :No such nick/channel",
+					       ctx->conf.server_name,
+					       user->nick, target);
+			}
+			return;
+		}
+	}
+
+	// Blocked messages are dropped silently, so that senders cannot probe
+	// the filter for the phrases it holds.
+	const struct irc_filter *filter =
+		atomic_load_explicit(&ctx->filter, memory_order_acquire);
+
+	if (filter && irc_filter_match(filter, text, msg->params[1].entry_len,
+				       NULL)) {
+		IRC_METRIC_INC(&ctx->metrics, IRC_METRIC_MSGS_FILTERED);
+		return;
+	}
+
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s!%s@%s %s %s :%s", user->nick, user->username,
+		       user->host, cmd, chan ? chan->name : dst->nick, text);
+
+	if (chan) {
+		irc_bcast_chan(ctx, &bc, chan, user);
+		irc_links_sendf(ctx, NULL, ":%s %s %s :%s", user->uid, cmd,
+				chan->name, text);
+	} else {
+		// Users of other servers are reached through the link towards
+		// their server.
+		if (dst->server) {
+			irc_link_sendf(irc_user_link(dst), ":%s %s %s :%s",
+				       user->uid, cmd, dst->uid, text);
+		} else {
+			irc_bcast_user(ctx, &bc, dst);
+		}
+
+		if (replies && dst->away) {
+			irc_user_sendf(ctx, user, ":%s " RPL_AWAY " %s %s :%s",
+				       ctx->conf.server_name, user->nick,
+				       dst->nick, dst->away);
+		}
+	}
+	irc_bcast_done(&bc);
+}
+
+static void who_reply_send(struct irc_ctx *const ctx,
+			   struct irc_user *const user, const char *const chan,
+			   const struct irc_user *const dst, const u8 prefix)
+{
+	const char prefix_str[] = { irc_member_prefix_char(prefix), '\0' };
+
+	irc_user_sendf(ctx, user,
+		       ":%s " RPL_WHOREPLY " %s %s %s %s %s %s %c%s :0 %s",
+		       ctx->conf.server_name, user->nick, chan, dst->username,
+		       dst->host,
+		       dst->server ? dst->server->name : ctx->conf.server_name,
+		       dst->nick, dst->away ? 'G' : 'H', prefix_str,
+		       dst->realname);
+}
+
+static void who_end_send(struct irc_ctx *const ctx,
+			 struct irc_user *const user, const char *const mask)
+{
+	irc_user_sendf(ctx, user,
+		       ":%s " RPL_ENDOFWHO " %s %s :End of WHO list",
+		       ctx->conf.server_name, user->nick, mask);
+}
+
+static void who_stream_end(struct irc_ctx *const ctx,
+			   struct irc_user *const user)
+{
+	who_end_send(ctx, user, user->who->chan);
+
+	irc_pool_free(IRC_POOL_USERS, user->who, sizeof(*user->who));
+	user->who = NULL;
+
+	struct irc_user *moved = irc_user_list_remove(&ctx->who, user->who_idx);
+
+	if (moved) {
+		moved->who_idx = user->who_idx;
+	}
+}
+
+/// @brief Queues the next chunk of a WHO reply being streamed to a user.
+///
+/// The channel is looked up again every time, as it may be gone by now.
+/// Members joining or leaving meanwhile may be listed twice or not at all.
+static void who_stream(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	struct irc_who_walk *const walk = user->who;
+
+	const struct irc_chan *chan = irc_chan_find(&ctx->chans, walk->chan);
+	const u32 num_members = chan ? chan->members.num_entries : 0;
+
+	for (u32 i = 0; (i < WHO_CHUNK_LINES) && (walk->next_idx < num_members);
+	     ++i) {
+		const struct irc_member *member =
+			chan->members.entries[walk->next_idx++];
+
+		who_reply_send(ctx, user, chan->name, member->user,
+			       member->prefix);
+	}
+
+	if (walk->next_idx >= num_members) {
+		who_stream_end(ctx, user);
+	}
+}
+
+static void cmd_who(struct irc_ctx *const ctx, struct irc_user *const user,
+		    const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		who_end_send(ctx, user, "*");
+		return;
+	}
+
+	const char *mask = msg->params[0].entry;
+
+	// A stream still in progress is cut short; clients do not overlap
+	// their WHO requests in practice.
+	if (user->who) {
+		who_stream_end(ctx, user);
+	}
+
+	if (!irc_chan_name_valid(mask)) {
+		const struct irc_user *dst = irc_ht_get(&ctx->nicks, mask);
+
+		if (dst) {
+			who_reply_send(ctx, user, "*", dst, 0);
+		}
+		who_end_send(ctx, user, mask);
+		return;
+	}
+
+	// Large channels are listed a chunk at a time, as the user's send
+	// queue drains, rather than all at once.
+	user->who = irc_pool_alloc(IRC_POOL_USERS, sizeof(*user->who));
+	strcpy(user->who->chan, mask);
+	user->who->next_idx = 0;
+	user->who_idx = irc_user_list_push(&ctx->who, user);
+
+	who_stream(ctx, user);
+}
+
+static void list_stream_end(struct irc_ctx *const ctx,
+			    struct irc_user *const user)
+{
+	irc_user_sendf(ctx, user, ":%s " RPL_LISTEND " %s :End of /LIST",
+		       ctx->conf.server_name, user->nick);
+
+	irc_pool_free(IRC_POOL_USERS, user->list, sizeof(*user->list));
+	user->list = NULL;
+
+	struct irc_user *moved =
+		irc_user_list_remove(&ctx->list, user->list_idx);
+
+	if (moved) {
+		moved->list_idx = user->list_idx;
+	}
+}
+
+static void list_reply_send(struct irc_ctx *const ctx,
+			    struct irc_user *const user,
+			    const struct irc_chan *const chan)
+{
+	// Topics are not kept, so they are always empty.
+	irc_user_sendf(ctx, user, ":%s " RPL_LIST " %s %s %" PRIu32 " :",
+		       ctx->conf.server_name, user->nick, chan->name,
+		       chan->members.num_entries);
+}
+
+/// @brief Returns `true` if a channel passes the filters of a LIST reply.
+static bool list_match(const struct irc_list_walk *const walk,
+		       const struct irc_chan *const chan)
+{
+	const u32 num_members = chan->members.num_entries;
+
+	return (num_members >= walk->members_min) &&
+	       (num_members <= walk->members_max) &&
+	       (chan->created >= walk->created_min) &&
+	       (chan->created <= walk->created_max) &&
+	       ((walk->mask[0] == '\0') ||
+		irc_casemap_match(walk->mask, chan->name));
+}
+
+/// @brief Returns `true` if a channel, and every channel after it, is past the
+/// range the walk of a LIST reply is limited to.
+static bool list_past_end(const struct irc_list_walk *const walk,
+			  const struct irc_chan *const chan)
+{
+	if (walk->by_size) {
+		return chan->members.num_entries > walk->members_max;
+	}
+
+	for (u32 i = 0; i < walk->prefix_len; ++i) {
+		if (irc_casemap_lower(chan->name[i]) !=
+		    irc_casemap_lower(walk->mask[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// @brief Queues the next chunk of a LIST reply being streamed to a user.
+///
+/// The walk carries on from the key of the last channel it reached, as that
+/// channel may be gone by now. Channels whose member count changes meanwhile
+/// may be listed twice or not at all when walking by member count.
+static void list_stream(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	struct irc_list_walk *walk = user->list;
+	const bool after = walk->started;
+
+	struct irc_chan *chan;
+
+	if (walk->by_size) {
+		const struct irc_chan_size_key key = {
+			.num_members = walk->size_members,
+			.id = walk->size_id
+		};
+		chan = irc_chan_seek_size(&ctx->chans, &key, after);
+	} else {
+		chan = irc_chan_seek_name(&ctx->chans, walk->name, after);
+	}
+
+	const struct irc_chan *last = NULL;
+	u32 num_lines = 0;
+
+	// Both the lines queued and the channels looked at are bounded, so
+	// that a filter few channels pass does not walk them all in one go.
+	for (u32 i = 0; chan && (i < LIST_CHUNK_CHANS) &&
+			(num_lines < LIST_CHUNK_LINES);
+	     ++i) {
+		if (list_past_end(walk, chan)) {
+			chan = NULL;
+			break;
+		}
+
+		if (list_match(walk, chan)) {
+			list_reply_send(ctx, user, chan);
+			num_lines++;
+		}
+
+		last = chan;
+		chan = walk->by_size ? irc_chan_next_size(chan)
+					  : irc_chan_next_name(chan);
+	}
+
+	if (!chan) {
+		list_stream_end(ctx, user);
+		return;
+	}
+
+	if (last) {
+		walk->started = true;
+		walk->size_members = last->sorted.size_key.num_members;
+		walk->size_id = last->sorted.size_key.id;
+		strcpy(walk->name, last->name);
+	}
+}
+
+/// @brief Parses the number of a LIST filter.
+static bool list_num_parse(const char *const str, u32 *const num)
+{
+	const size_t len = strlen(str);
+
+	if (!len || (len > LIST_NUM_LEN_MAX) ||
+	    (strspn(str, "0123456789") != len)) {
+		return false;
+	}
+	*num = (u32)strtoul(str, NULL, 10);
+	return true;
+}
+
+/// @brief Applies one of the comma separated parameters of LIST to a reply: a
+/// member count or creation time filter, or a channel name mask.
+static void list_filter_add(struct irc_list_walk *const walk,
+			    const char *const tok, const u64 now)
+{
+	u32 num;
+
+	if (((tok[0] == '>') || (tok[0] == '<')) &&
+	    list_num_parse(&tok[1], &num)) {
+		if (tok[0] == '>') {
+			walk->members_min = num + 1;
+		} else {
+			walk->members_max = num ? (num - 1) : 0;
+		}
+		return;
+	}
+
+	if ((irc_casemap_lower(tok[0]) == 'c') &&
+	    ((tok[1] == '>') || (tok[1] == '<')) &&
+	    list_num_parse(&tok[2], &num)) {
+		const u64 secs = (u64)num * 60;
+		const u64 then = (now > secs) ? (now - secs) : 0;
+
+		if (tok[1] == '<') {
+			walk->created_min = then;
+		} else {
+			walk->created_max = then;
+		}
+		return;
+	}
+
+	// Topics are not kept, so there is nothing to filter their age by.
+	if ((irc_casemap_lower(tok[0]) == 't') &&
+	    ((tok[1] == '>') || (tok[1] == '<'))) {
+		return;
+	}
+
+	if (strlen(tok) <= IRC_USER_LIST_MASK_LEN_MAX) {
+		strcpy(walk->mask, tok);
+	}
+}
+
+static void cmd_list(struct irc_ctx *const ctx, struct irc_user *const user,
+		     const struct irc_msg *const msg)
+{
+	// A stream still in progress is cut short, like WHO.
+	if (user->list) {
+		list_stream_end(ctx, user);
+	}
+
+	struct irc_list_walk walk = { .members_max = UINT32_MAX,
+				      .created_max = UINT64_MAX };
+
+	if (msg->num_params) {
+		const u64 now = (u64)time(NULL);
+
+		char params[IRC_MSG_PARAM_LEN_MAX + 1];
+		char *save = NULL;
+
+		strcpy(params, msg->params[0].entry);
+
+		for (const char *tok = strtok_r(params, ",", &save); tok;
+		     tok = strtok_r(NULL, ",", &save)) {
+			list_filter_add(&walk, tok, now);
+		}
+	}
+
+	irc_user_sendf(ctx, user, ":%s " RPL_LISTSTART " %s Channel :Users Name",
+		       ctx->conf.server_name, user->nick);
+
+	const u32 prefix_len = (u32)strcspn(walk.mask, "*?");
+
+	// A name without wildcards is looked up directly.
+	if (prefix_len && (walk.mask[prefix_len] == '\0')) {
+		const struct irc_chan *chan =
+			irc_chan_find(&ctx->chans, walk.mask);
+
+		if (chan && list_match(&walk, chan)) {
+			list_reply_send(ctx, user, chan);
+		}
+		irc_user_sendf(ctx, user, ":%s " RPL_LISTEND " %s :End of /LIST",
+			       ctx->conf.server_name, user->nick);
+		return;
+	}
+
+	// A mask starting with more than the channel prefix limits the walk
+	// to the names starting the same; failing that, a member count filter
+	// limits the walk to the counts in range.
+	if (prefix_len > 1) {
+		walk.prefix_len = prefix_len;
+		memcpy(walk.name, walk.mask, prefix_len);
+		walk.name[prefix_len] = '\0';
+	} else {
+		walk.prefix_len = 0;
+		walk.by_size = walk.members_min ||
+			       (walk.members_max != UINT32_MAX);
+		walk.size_members = walk.members_min;
+	}
+
+	// The walk is only allocated for a reply that is streamed, and only
+	// for as long as it is.
+	user->list = irc_pool_alloc(IRC_POOL_USERS, sizeof(*user->list));
+	*user->list = walk;
+	user->list_idx = irc_user_list_push(&ctx->list, user);
+
+	list_stream(ctx, user);
+}
+
+void irc_cmd_streams_run(struct irc_ctx *const ctx)
+{
+	// Walking down, since finished streams are removed by moving the last
+	// one into their place.
+	for (u32 i = ctx->who.num_entries; i--;) {
+		struct irc_user *user = ctx->who.entries[i];
+
+		if (user->sendq.len < STREAM_SENDQ_LEN_LOW) {
+			who_stream(ctx, user);
+		}
+	}
+
+	for (u32 i = ctx->list.num_entries; i--;) {
+		struct irc_user *user = ctx->list.entries[i];
+
+		if (user->sendq.len < STREAM_SENDQ_LEN_LOW) {
+			list_stream(ctx, user);
+		}
+	}
+}
+
+bool irc_cmd_streams_ready(const struct irc_ctx *const ctx)
+{
+	for (u32 i = 0; i < ctx->who.num_entries; ++i) {
+		if (ctx->who.entries[i]->sendq.len < STREAM_SENDQ_LEN_LOW) {
+			return true;
+		}
+	}
+
+	for (u32 i = 0; i < ctx->list.num_entries; ++i) {
+		if (ctx->list.entries[i]->sendq.len < STREAM_SENDQ_LEN_LOW) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void mask_list_send(struct irc_ctx *const ctx,
+			   struct irc_user *const user,
+			   const struct irc_chan *const chan,
+			   const enum irc_chan_masks list)
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+	static const struct {
+		const char *entry;
+		const char *end;
+		const char *end_text;
+	} numerics[] = {
+		[IRC_CHAN_BANS] = { RPL_BANLIST, RPL_ENDOFBANLIST,
+				    "End of channel ban list" },
+		[IRC_CHAN_EXCEPTS] = { RPL_EXCEPTLIST, RPL_ENDOFEXCEPTLIST,
+				       "End of channel exception list" }
+	};
+
+#pragma GCC diagnostic pop
+
+	const struct irc_mask_set *set = chan->masks[list];
+	const u32 num_entries = set ? set->num_entries : 0;
+
+	for (u32 i = 0; i < num_entries; ++i) {
+		const struct irc_mask_entry *entry = set->entries[i];
+
+		irc_user_sendf(ctx, user, ":%s %s %s %s %s %s %" PRIu64,
+			       ctx->conf.server_name, numerics[list].entry,
+			       user->nick, chan->name, entry->text,
+			       entry->setter, entry->set_at);
+	}
+
+	irc_user_sendf(ctx, user, ":%s %s %s %s :%s", ctx->conf.server_name,
+		       numerics[list].end, user->nick, chan->name,
+		       numerics[list].end_text);
+}
+
+/// @brief Handles MODE on a channel. The lists of masks are the only modes
+/// that can be changed; channels are always +n.
+static void chan_mode(struct irc_ctx *const ctx, struct irc_user *const user,
+		      struct irc_chan *const chan,
+		      const struct irc_msg *const msg)
+{
+	if (msg->num_params < 2) {
+		irc_user_sendf(ctx, user, ":%s " RPL_CHANNELMODEIS " %s %s +n",
+			       ctx->conf.server_name, user->nick, chan->name);
+		return;
+	}
+
+	const struct irc_member *member =
+		irc_chan_member_find(&ctx->chans, chan, user);
+	const bool op = member && (member->prefix & IRC_MEMBER_OP);
+
+	// The changes that were made, echoed to the channel as one line.
+	char modes[(2 * IRC_MSG_PARAM_NUM_MAX) + 1];
+	char args[(IRC_MSG_PARAM_NUM_MAX * (IRC_MASK_LEN_MAX + 1)) + 1];
+
+	size_t modes_len = 0;
+	size_t args_len = 0;
+
+	char sign = '+';
+	char sign_echoed = '\0';
+	bool denied = false;
+	size_t param = 2;
+
+	for (const char *c = msg->params[1].entry; *c != '\0'; ++c) {
+		if ((*c == '+') || (*c == '-')) {
+			sign = *c;
+			continue;
+		}
+
+		enum irc_chan_masks list;
+
+		if (*c == 'b') {
+			list = IRC_CHAN_BANS;
+		} else if (*c == 'e') {
+			list = IRC_CHAN_EXCEPTS;
+		} else {
+			irc_user_sendf(ctx, user,
+				       ":%s " ERR_UNKNOWNMODE
+				       " %s %c :is unknown mode char to me",
+				       ctx->conf.server_name, user->nick, *c);
+			continue;
+		}
+
+		// Without a mask, the list is shown instead.
+		if (param >= msg->num_params) {
+			mask_list_send(ctx, user, chan, list);
+			continue;
+		}
+
+		const char *arg = msg->params[param++].entry;
+
+		if (!op) {
+			if (!denied) {
+				irc_user_sendf(ctx, user,
+					       ":%s " ERR_CHANOPRIVSNEEDED
+					       " %s %s :You're not channel "
+					       "operator",
+					       ctx->conf.server_name, user->nick,
+					       chan->name);
+				denied = true;
+			}
+			continue;
+		}
+
+		char mask[IRC_MASK_LEN_MAX + 1];
+
+		if (!irc_mask_normalize(arg, mask)) {
+			continue;
+		}
+
+		if (sign == '+') {
+			const struct irc_mask_set *set = chan->masks[list];
+
+			if (set && (set->num_entries >= CHAN_MASKS_NUM_MAX)) {
+				irc_user_sendf(ctx, user,
+					       ":%s " ERR_BANLISTFULL
+					       " %s %s %s :Channel list is full",
+					       ctx->conf.server_name,
+					       user->nick, chan->name, mask);
+				continue;
+			}
+
+			if (!irc_chan_mask_add(chan, list, mask, user->nick)) {
+				continue;
+			}
+		} else if (!irc_chan_mask_del(chan, list, mask)) {
+			continue;
+		}
+
+		if (sign != sign_echoed) {
+			modes[modes_len++] = sign;
+			sign_echoed = sign;
+		}
+		modes[modes_len++] = *c;
+
+		args[args_len++] = ' ';
+		strcpy(&args[args_len], mask);
+		args_len += strlen(mask);
+	}
+
+	if (!modes_len) {
+		return;
+	}
+	modes[modes_len] = '\0';
+	args[args_len] = '\0';
+
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s!%s@%s MODE %s %s%s", user->nick,
+		       user->username, user->host, chan->name, modes, args);
+	irc_bcast_user(ctx, &bc, user);
+	irc_bcast_chan(ctx, &bc, chan, user);
+	irc_bcast_done(&bc);
+
+	irc_links_sendf(ctx, NULL, ":%s TMODE %" PRIu64 " %s %s%s", user->uid,
+			chan->created, chan->name, modes, args);
+}
+
+static void cmd_mode(struct irc_ctx *const ctx, struct irc_user *const user,
+		     const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		need_more_params(ctx, user, "MODE");
+		return;
+	}
+
+	const char *target = msg->params[0].entry;
+
+	if (irc_chan_name_valid(target)) {
+		struct irc_chan *chan = irc_chan_find(&ctx->chans, target);
+
+		if (!chan) {
+			no_such_chan(ctx, user, target);
+			return;
+		}
+		chan_mode(ctx, user, chan, msg);
+		return;
+	}
+
+	// There are no user modes to change.
+	if (irc_casemap_eq(target, user->nick)) {
+		irc_user_sendf(ctx, user, ":%s " RPL_UMODEIS " %s +",
+			       ctx->conf.server_name, user->nick);
+	} else {
+		irc_user_sendf(ctx, user,
+			       ":%s " ERR_USERSDONTMATCH
+			       " %s :Can't change mode for other users",
+			       ctx->conf.server_name, user->nick);
+	}
+}
+
+static void cmd_away(struct irc_ctx *const ctx, struct irc_user *const user,
+		     const struct irc_msg *const msg)
+{
+	const bool away = msg->num_params && msg->params[0].entry_len;
+
+	struct irc_bcast bc;
+
+	if (away) {
+		irc_user_away_set(user, msg->params[0].entry,
+				  msg->params[0].entry_len);
+
+		irc_user_sendf(ctx, user,
+			       ":%s " RPL_NOWAWAY
+			       " %s :You have been marked as being away",
+			       ctx->conf.server_name, user->nick);
+
+		irc_bcast_init(&bc, ":%s!%s@%s AWAY :%s", user->nick,
+			       user->username, user->host, user->away);
+	} else {
+		irc_user_away_set(user, NULL, 0);
+
+		irc_user_sendf(ctx, user,
+			       ":%s " RPL_UNAWAY
+			       " %s :You are no longer marked as being away",
+			       ctx->conf.server_name, user->nick);
+
+		irc_bcast_init(&bc, ":%s!%s@%s AWAY", user->nick,
+			       user->username, user->host);
+	}
+
+	irc_bcast_common(ctx, &bc, user, IRC_USER_CAP_AWAY_NOTIFY);
+	irc_bcast_done(&bc);
+
+	irc_links_sendf(ctx, NULL, ":%s AWAY :%s", user->uid,
+			away ? user->away : "");
+}
+
+static void cmd_privmsg(struct irc_ctx *const ctx, struct irc_user *const user,
+			const struct irc_msg *const msg)
+{
+	msg_relay(ctx, user, msg, "PRIVMSG", true);
+}
+
+static void cmd_notice(struct irc_ctx *const ctx, struct irc_user *const user,
+		       const struct irc_msg *const msg)
+{
+	msg_relay(ctx, user, msg, "NOTICE", false);
+}
+
+static void monitor_reply_flush(struct irc_ctx *const ctx,
+				struct irc_user *const user,
+				struct monitor_reply *const reply)
+{
+	if (!reply->len) {
+		return;
+	}
+	irc_user_sendf(ctx, user, ":%s %s %s :%s", ctx->conf.server_name,
+		       reply->numeric, user->nick, reply->buf);
+
+	reply->len = 0;
+}
+
+/// @brief Appends an entry to a MONITOR reply line, sending the line first if
+/// it would grow too long.
+static void monitor_reply_add(struct irc_ctx *const ctx,
+			      struct irc_user *const user,
+			      struct monitor_reply *const reply,
+			      const char *const entry)
+{
+	const size_t len = strlen(entry);
+
+	if (reply->len && ((reply->len + 1 + len) > MONITOR_REPLY_LEN_MAX)) {
+		monitor_reply_flush(ctx, user, reply);
+	}
+
+	if (reply->len) {
+		reply->buf[reply->len++] = ',';
+	}
+	memcpy(&reply->buf[reply->len], entry, len + 1);
+	reply->len += len;
+}
+
+/// @brief Appends the status of a nickname to either of two MONITOR reply
+/// lines.
+static void monitor_status_add(struct irc_ctx *const ctx,
+			       struct irc_user *const user,
+			       struct monitor_reply *const online,
+			       struct monitor_reply *const offline,
+			       const char *const nick)
+{
+	const struct irc_user *dst = irc_ht_get(&ctx->nicks, nick);
+
+	if (!dst || !dst->registered) {
+		monitor_reply_add(ctx, user, offline, nick);
+		return;
+	}
+
+	char mask[IRC_MASK_LEN_MAX + 1];
+
+	snprintf(mask, sizeof(mask), "%s!%s@%s", dst->nick, dst->username,
+		 dst->host);
+	monitor_reply_add(ctx, user, online, mask);
+}
+
+static void monitor_add(struct irc_ctx *const ctx, struct irc_user *const user,
+			const char *const list)
+{
+	struct monitor_reply online = { .numeric = RPL_MONONLINE };
+	struct monitor_reply offline = { .numeric = RPL_MONOFFLINE };
+
+	char entry[IRC_MSG_PARAM_LEN_MAX + 1];
+
+	for (const char *pos = list;;) {
+		const char *end = strchr(pos, ',');
+		const size_t len = end ? (size_t)(end - pos) : strlen(pos);
+
+		memcpy(entry, pos, len);
+		entry[len] = '\0';
+
+		if (irc_user_nick_valid(entry)) {
+			const enum irc_monitor_add_result res =
+				irc_monitor_add(&ctx->monitors, user, entry);
+
+			if (res == IRC_MONITOR_FULL) {
+				monitor_reply_flush(ctx, user, &online);
+				monitor_reply_flush(ctx, user, &offline);
+
+				irc_user_sendf(ctx, user,
+					       ":%s " ERR_MONLISTFULL
+					       " %s %d %s :Monitor list is "
+					       "full",
+					       ctx->conf.server_name, user->nick,
+					       IRC_MONITOR_NUM_MAX, pos);
+				return;
+			}
+
+			if (res == IRC_MONITOR_ADDED) {
+				monitor_status_add(ctx, user, &online,
+						   &offline, entry);
+			}
+		}
+
+		if (!end) {
+			break;
+		}
+		pos = end + 1;
+	}
+	monitor_reply_flush(ctx, user, &online);
+	monitor_reply_flush(ctx, user, &offline);
+}
+
+static void monitor_del(struct irc_ctx *const ctx, struct irc_user *const user,
+			const char *const entry)
+{
+	irc_monitor_del(&ctx->monitors, user, entry);
+}
+
+static void cmd_monitor(struct irc_ctx *const ctx, struct irc_user *const user,
+			const struct irc_msg *const msg)
+{
+	if (!msg->num_params || !msg->params[0].entry_len) {
+		need_more_params(ctx, user, "MONITOR");
+		return;
+	}
+
+	const char op = msg->params[0].entry[0];
+
+	if ((op == '+') || (op == '-')) {
+		if ((msg->num_params < 2) || !msg->params[1].entry_len) {
+			need_more_params(ctx, user, "MONITOR");
+		} else if (op == '+') {
+			monitor_add(ctx, user, msg->params[1].entry);
+		} else {
+			list_foreach(ctx, user, msg->params[1].entry,
+				     &monitor_del);
+		}
+		return;
+	}
+
+	struct monitor_reply online = { .numeric = RPL_MONONLINE };
+	struct monitor_reply offline = { .numeric = RPL_MONOFFLINE };
+	struct monitor_reply list = { .numeric = RPL_MONLIST };
+
+	switch (op) {
+	case 'C':
+	case 'c':
+		irc_monitor_clear(&ctx->monitors, user);
+		break;
+	case 'L':
+	case 'l':
+		for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+			monitor_reply_add(ctx, user, &list,
+					  user->monitor.entries[i].target->nick);
+		}
+		monitor_reply_flush(ctx, user, &list);
+
+		irc_user_sendf(ctx, user,
+			       ":%s " RPL_ENDOFMONLIST
+			       " %s :End of MONITOR list",
+			       ctx->conf.server_name, user->nick);
+		break;
+	case 'S':
+	case 's':
+		for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+			monitor_status_add(
+				ctx, user, &online, &offline,
+				user->monitor.entries[i].target->nick);
+		}
+		monitor_reply_flush(ctx, user, &online);
+		monitor_reply_flush(ctx, user, &offline);
+		break;
+	default:
+		break;
+	}
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+static const struct {
+	const char *name;
+	cmd_cb cb;
+
+	/// @brief Whether the command is refused before registration.
+	bool reg_required;
+} cmds[] = {
+	// clang-format off
+
+	// The table is searched linearly, so the most frequent commands come
+	// first.
+	{ "PRIVMSG",    &cmd_privmsg,   true    },
+	{ "NOTICE",     &cmd_notice,    true    },
+	{ "CAP",        &cmd_cap,       false   },
+	{ "JOIN",       &cmd_join,      true    },
+	{ "NAMES",      &cmd_names,     true    },
+	{ "WHO",        &cmd_who,       true    },
+	{ "LIST",       &cmd_list,      true    },
+	{ "MODE",       &cmd_mode,      true    },
+	{ "NICK",       &cmd_nick,      false   },
+	{ "PART",       &cmd_part,      true    },
+	{ "AWAY",       &cmd_away,      true    },
+	{ "MONITOR",    &cmd_monitor,   true    },
+	{ "STATS",      &cmd_stats,     false   },
+	{ "USER",       &cmd_user,      false   }
+
+	// clang-format on
+};
+
+#pragma GCC diagnostic pop
+
+void irc_cmd_dispatch(struct irc_ctx *const ctx, struct irc_user *const user,
+		      const struct irc_msg *const msg)
+{
+	for (size_t i = 0; i < (sizeof(cmds) / sizeof(*cmds)); ++i) {
+		if (strcasecmp(msg->cmd, cmds[i].name)) {
+			continue;
+		}
+
+		if (cmds[i].reg_required && !user->registered) {
+			irc_user_sendf(ctx, user,
+				       ":%s " ERR_NOTREGISTERED
+				       " %s :You have not registered",
+				       ctx->conf.server_name, user_name(user));
+			return;
+		}
+		cmds[i].cb(ctx, user, msg);
+		return;
+	}
+
+	irc_user_sendf(ctx, user,
+		       ":%s " ERR_UNKNOWNCOMMAND " %s %s :Unknown command",
+		       ctx->conf.server_name, user_name(user), msg->cmd);
+}
+
+void irc_cmd_user_quit(struct irc_ctx *const ctx, struct irc_user *const user,
+		       const char *const reason)
+{
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s!%s@%s QUIT :%s", user->nick, user->username,
+		       user->host, reason);
+	irc_bcast_common(ctx, &bc, user, 0);
+	irc_bcast_done(&bc);
+
+	irc_chan_part_all(&ctx->chans, user);
+
+	if (user->registered) {
+		monitor_notify(ctx, user, false);
+		irc_links_user_del(ctx, user);
+
+		if (!user->server) {
+			irc_links_sendf(ctx, NULL, ":%s QUIT :%s", user->uid,
+					reason);
+		}
+	}
+
+	if (user->nick[0] != '\0') {
+		irc_ht_del(&ctx->nicks, user->nick);
+	}
+}
+
+void irc_cmd_user_intro(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	irc_links_user_add(ctx, user);
+	monitor_notify(ctx, user, true);
+}
+
+void irc_cmd_user_rename(struct irc_ctx *const ctx, struct irc_user *const user,
+			 const char *const nick, const u64 ts)
+{
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s!%s@%s NICK :%s", user->nick, user->username,
+		       user->host, nick);
+	irc_bcast_user(ctx, &bc, user);
+	irc_bcast_common(ctx, &bc, user, 0);
+	irc_bcast_done(&bc);
+
+	// A change of case only leaves watchers with nothing to learn.
+	const bool renamed = !irc_casemap_eq(user->nick, nick);
+
+	if (renamed) {
+		monitor_notify(ctx, user, false);
+	}
+
+	// The table is keyed by the nickname stored in the user itself, so the
+	// entry has to be replaced rather than updated.
+	irc_ht_del(&ctx->nicks, user->nick);
+	strcpy(user->nick, nick);
+	irc_ht_add(&ctx->nicks, user->nick, user);
+
+	user->ts = ts;
+
+	if (renamed) {
+		monitor_notify(ctx, user, true);
+	}
+
+	for (u32 i = 0; i < user->chans.num_entries; ++i) {
+		irc_chan_names_invalidate(user->chans.entries[i]);
+		irc_member_bans_invalidate(user->chans.entries[i]);
+	}
+}
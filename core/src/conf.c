@@ -23,16 +23,25 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "core/compiler.h"
 #include "core/conf.h"
 #include "core/log.h"
+#include "core/util.h"
 
 // clang-format off
 
 #define LISTENER_PORT_MIN	(0)
 #define LISTENER_PORT_MAX       (65535)
 
+/// @brief The option of a link that makes it compressed.
+#define LINK_OPT_ZIP            ",zip"
+
+/// @brief The maximum length of a line of a configuration file.
+#define CONF_LINE_LEN_MAX       (512)
+
 // clang-format on
 
 static bool to_int(const char *const str, int *const res)
@@ -89,3 +98,689 @@ irc_conf_listener_add(struct irc_conf *const conf,
 	*code = IRC_CONF_STATUS_OK;
 	return true;
 }
+
+/// @brief Splits `host:port` into a listener. The port is the part after the
+/// last colon, so that IPv6 addresses can be given as they are.
+static bool addr_parse(const char *const str,
+		       struct irc_conf_listener *const addr)
+{
+	const char *sep = strrchr(str, ':');
+
+	if (!sep || (sep == str)) {
+		return false;
+	}
+
+	const size_t host_len = (size_t)(sep - str);
+	const size_t port_len = strlen(sep + 1);
+
+	if ((host_len > IRC_CONF_LISTENER_HOST_LEN_MAX) || !port_len ||
+	    (port_len > IRC_CONF_LISTENER_PORT_LEN_MAX)) {
+		return false;
+	}
+	memcpy(addr->host, str, host_len);
+	addr->host[host_len] = '\0';
+	strcpy(addr->port, sep + 1);
+
+	int port = 0;
+
+	return to_int(addr->port, &port) && (port > LISTENER_PORT_MIN) &&
+	       (port <= LISTENER_PORT_MAX);
+}
+
+IRC_NODISCARD bool
+irc_conf_listener_addr_add(struct irc_conf *const conf, const char *const addr,
+			   enum irc_conf_status_code *const code)
+{
+	struct irc_conf_listener listener;
+
+	if (IRC_UNLIKELY(!addr_parse(addr, &listener))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to add \"%s\" as a listener - addresses "
+			    "are host:port",
+			    addr);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+	return irc_conf_listener_add(conf, &listener, code);
+}
+
+/// @brief Copies a string setting into its fixed size buffer.
+static bool str_set(struct irc_conf *const conf, char *const dst,
+		    const size_t len_max, const char *const setting,
+		    const char *const val, enum irc_conf_status_code *const code)
+{
+	const size_t len = strlen(val);
+
+	if (IRC_UNLIKELY(len > len_max)) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set %s to \"%s\" - too long (max %zu)",
+			    setting, val, len_max);
+
+		*code = IRC_CONF_TOO_LONG;
+		return false;
+	}
+	memcpy(dst, val, len + 1);
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool irc_conf_server_name_set(struct irc_conf *const conf,
+					    const char *const name,
+					    enum irc_conf_status_code *const code)
+{
+	return str_set(conf, conf->server_name, IRC_CONF_SERVER_NAME_LEN_MAX,
+		       "server name", name, code);
+}
+
+IRC_NODISCARD bool irc_conf_server_id_set(struct irc_conf *const conf,
+					  const char *const sid,
+					  enum irc_conf_status_code *const code)
+{
+	bool valid = (strlen(sid) == IRC_CONF_SERVER_ID_LEN) &&
+		     isdigit((u8)sid[0]);
+
+	for (size_t i = 1; valid && (i < IRC_CONF_SERVER_ID_LEN); ++i) {
+		valid = isdigit((u8)sid[i]) || isupper((u8)sid[i]);
+	}
+
+	if (IRC_UNLIKELY(!valid)) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set the server identifier to \"%s\" - "
+			    "identifiers are a digit, followed by two digits "
+			    "or uppercase letters",
+			    sid);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+	strcpy(conf->server_id, sid);
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool irc_conf_link_add(struct irc_conf *const conf,
+				     const char *const link,
+				     enum irc_conf_status_code *const code)
+{
+	if (IRC_UNLIKELY(conf->links.num_entries >= IRC_CONF_LINK_NUM_MAX)) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to add the link \"%s\" - too many links "
+			    "(max %d)",
+			    link, IRC_CONF_LINK_NUM_MAX);
+
+		*code = IRC_CONF_OUT_OF_RANGE;
+		return false;
+	}
+
+	struct irc_conf_link entry = {};
+
+	// Options follow the last comma, which host:port cannot contain.
+	char spec[IRC_CONF_SERVER_NAME_LEN_MAX + IRC_CONF_LINK_PASSWORD_LEN_MAX +
+		  IRC_CONF_LISTENER_HOST_LEN_MAX +
+		  IRC_CONF_LISTENER_PORT_LEN_MAX + 4];
+	const char *opts = strrchr(link, ',');
+
+	if (opts && !strcmp(opts, LINK_OPT_ZIP)) {
+		entry.zip = true;
+	} else {
+		opts = link + strlen(link);
+	}
+	size_t spec_len = (size_t)(opts - link);
+
+	// Too long to be valid; left empty, it is refused below.
+	if (spec_len >= sizeof(spec)) {
+		spec_len = 0;
+	}
+	memcpy(spec, link, spec_len);
+	spec[spec_len] = '\0';
+
+	const size_t name_len = strcspn(spec, ":");
+	const char *password = &spec[name_len];
+	const char *addr = strchr(password, '@');
+
+	const size_t password_len =
+		addr ? (size_t)(addr - password) : strlen(password);
+
+	bool valid = name_len && (name_len <= IRC_CONF_SERVER_NAME_LEN_MAX) &&
+		     (*password == ':') && (password_len > 1) &&
+		     (password_len <= (IRC_CONF_LINK_PASSWORD_LEN_MAX + 1)) &&
+		     !memchr(spec, ' ', name_len + password_len);
+
+	if (valid) {
+		memcpy(entry.name, spec, name_len);
+		memcpy(entry.password, password + 1, password_len - 1);
+
+		valid = !addr || addr_parse(addr + 1, &entry.addr);
+	}
+
+	if (IRC_UNLIKELY(!valid)) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to add the link \"%s\" - links are "
+			    "name:password, optionally followed by @host:port "
+			    "and ,zip",
+			    link);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+	conf->links.entries[conf->links.num_entries++] = entry;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool
+irc_conf_link_listener_set(struct irc_conf *const conf, const char *const addr,
+			   enum irc_conf_status_code *const code)
+{
+	struct irc_conf_listener listener;
+
+	if (IRC_UNLIKELY(!addr_parse(addr, &listener))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to accept links on \"%s\" - addresses are "
+			    "host:port",
+			    addr);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+	conf->links.listener = listener;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool
+irc_conf_metrics_sock_set(struct irc_conf *const conf, const char *const path,
+			  enum irc_conf_status_code *const code)
+{
+	return str_set(conf, conf->metrics.sock_path,
+		       IRC_CONF_SOCK_PATH_LEN_MAX, "metrics socket path", path,
+		       code);
+}
+
+IRC_NODISCARD bool irc_conf_watchdog_set(struct irc_conf *const conf,
+					 const char *const threshold_ms,
+					 enum irc_conf_status_code *const code)
+{
+	int val = 0;
+
+	// Anything longer cannot be in range, and could overflow.
+	const bool conv_good = (strlen(threshold_ms) <= 5) &&
+			       to_int(threshold_ms, &val);
+
+	if (IRC_UNLIKELY(!conv_good ||
+			 (val > IRC_CONF_WATCHDOG_STALL_MS_MAX))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set the watchdog threshold to \"%s\" - "
+			    "valid values are integers between 0 and %d",
+			    threshold_ms, IRC_CONF_WATCHDOG_STALL_MS_MAX);
+
+		*code = IRC_CONF_OUT_OF_RANGE;
+		return false;
+	}
+	conf->watchdog.stall_threshold_ms = (uint)val;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool
+irc_conf_fanout_budget_set(struct irc_conf *const conf, const char *const budget,
+			   enum irc_conf_status_code *const code)
+{
+	int val = 0;
+
+	// Anything longer cannot be in range, and could overflow.
+	const bool conv_good = (strlen(budget) <= 7) && to_int(budget, &val);
+
+	if (IRC_UNLIKELY(!conv_good || (val < 1) ||
+			 (val > IRC_CONF_FANOUT_BUDGET_MAX))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set the fanout budget to \"%s\" - "
+			    "valid values are integers between 1 and %d",
+			    budget, IRC_CONF_FANOUT_BUDGET_MAX);
+
+		*code = IRC_CONF_OUT_OF_RANGE;
+		return false;
+	}
+	conf->fanout.recipients_per_iter = (uint)val;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool irc_conf_kline_add(struct irc_conf *const conf,
+				      const char *const mask,
+				      enum irc_conf_status_code *const code)
+{
+	char normalized[IRC_MASK_LEN_MAX + 1];
+
+	if (IRC_UNLIKELY(!irc_mask_normalize(mask, normalized))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to add the K-line \"%s\" - masks are "
+			    "nick!user@host, user@host or a host, without "
+			    "spaces or commas",
+			    mask);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+
+	conf->klines.entries =
+		irc_realloc(conf->klines.entries,
+			    (conf->klines.num_entries + 1) *
+				    sizeof(*conf->klines.entries));
+
+	strcpy(conf->klines.entries[conf->klines.num_entries++], normalized);
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool
+irc_conf_dline_file_set(struct irc_conf *const conf, const char *const path,
+			enum irc_conf_status_code *const code)
+{
+	return str_set(conf, conf->dlines.path, IRC_CONF_FILE_PATH_LEN_MAX,
+		       "D-line file", path, code);
+}
+
+IRC_NODISCARD bool
+irc_conf_filter_file_set(struct irc_conf *const conf, const char *const path,
+			 enum irc_conf_status_code *const code)
+{
+	return str_set(conf, conf->filter.path, IRC_CONF_FILE_PATH_LEN_MAX,
+		       "content filter file", path, code);
+}
+
+/// @brief Parses the next `/` separated field of a setting as an integer no
+/// greater than `max`.
+static bool field_to_uint(const char **const str, const uint max,
+			  uint *const res)
+{
+	char field[8];
+
+	const size_t len = strcspn(*str, "/");
+	int val = 0;
+
+	// Anything longer cannot be in range, and could overflow.
+	if ((len == 0) || (len >= sizeof(field))) {
+		return false;
+	}
+	memcpy(field, *str, len);
+	field[len] = '\0';
+
+	if (!to_int(field, &val) || ((uint)val > max)) {
+		return false;
+	}
+	*res = (uint)val;
+
+	*str += len;
+	*str += (**str == '/');
+
+	return true;
+}
+
+IRC_NODISCARD bool irc_conf_clones_set(struct irc_conf *const conf,
+				       const char *const limit,
+				       enum irc_conf_status_code *const code)
+{
+	const char *str = limit;
+
+	uint max = 0;
+	uint ipv4_len = IRC_CONF_CLONES_IPV4_LEN_DEFAULT;
+	uint ipv6_len = IRC_CONF_CLONES_IPV6_LEN_DEFAULT;
+
+	bool conv_good = field_to_uint(&str, IRC_CONF_CLONES_MAX, &max) &&
+			 (max > 0);
+
+	if (conv_good && (*str != '\0')) {
+		conv_good = field_to_uint(&str, 32, &ipv4_len) &&
+			    field_to_uint(&str, 128, &ipv6_len) &&
+			    (*str == '\0') && (ipv4_len > 0) && (ipv6_len > 0);
+	}
+
+	if (IRC_UNLIKELY(!conv_good)) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set the connection limit to \"%s\" - "
+			    "valid values are integers between 1 and %d, "
+			    "optionally followed by IPv4 and IPv6 subnet prefix "
+			    "lengths, as in 3/24/64",
+			    limit, IRC_CONF_CLONES_MAX);
+
+		*code = IRC_CONF_OUT_OF_RANGE;
+		return false;
+	}
+	conf->clones.max = max;
+	conf->clones.ipv4_len = ipv4_len;
+	conf->clones.ipv6_len = ipv6_len;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool
+irc_conf_tables_vmem_set(struct irc_conf *const conf, const char *const mode,
+			 enum irc_conf_status_code *const code)
+{
+	if (IRC_UNLIKELY(!irc_vmem_mode_parse(mode, &conf->tables.vmem))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set the table memory to \"%s\" - "
+			    "valid values are heap, pages, thp and hugetlb",
+			    mode);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+/// @brief Parses a number of bytes, optionally followed by a `K`, `M` or `G`
+/// suffix.
+static bool size_parse(const char *const str, const size_t len, const u64 max,
+		       u64 *const res)
+{
+	static const char suffixes[] = "KMG";
+
+	size_t num_digits = 0;
+	u64 val = 0;
+
+	// Anything longer could overflow.
+	for (; (num_digits < len) && isdigit(str[num_digits]); ++num_digits) {
+		if (num_digits == 12) {
+			return false;
+		}
+		val = (val * 10) + (u64)(str[num_digits] - '0');
+	}
+
+	if (!num_digits || (len > (num_digits + 1))) {
+		return false;
+	}
+
+	if (len > num_digits) {
+		const char *suffix = strchr(suffixes, str[num_digits]);
+
+		if (!suffix || (*suffix == '\0')) {
+			return false;
+		}
+
+		const long shift = 10 * ((suffix - suffixes) + 1);
+
+		if (val > (max >> shift)) {
+			return false;
+		}
+		val <<= shift;
+	}
+
+	if (val > max) {
+		return false;
+	}
+	*res = val;
+	return true;
+}
+
+IRC_NODISCARD bool irc_conf_class_add(struct irc_conf *const conf,
+				      const char *const spec,
+				      enum irc_conf_status_code *const code)
+{
+	if (IRC_UNLIKELY(conf->classes.num_entries >= IRC_CONF_CLASS_NUM_MAX)) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to add the class \"%s\" - too many classes "
+			    "(max %d)",
+			    spec, IRC_CONF_CLASS_NUM_MAX);
+
+		*code = IRC_CONF_OUT_OF_RANGE;
+		return false;
+	}
+
+	struct irc_conf_class entry = { .recvq_max = IRC_CONF_CLASS_RECVQ_MAX };
+
+	const size_t name_len = strcspn(spec, ":");
+	const char *sendq = &spec[name_len];
+	const char *net = strchr(sendq, '@');
+	const size_t limits_len = net ? (size_t)(net - sendq) : strlen(sendq);
+
+	bool valid = name_len && (name_len <= IRC_CONF_CLASS_NAME_LEN_MAX) &&
+		     (*sendq == ':') && !memchr(spec, ' ', name_len);
+
+	if (valid) {
+		memcpy(entry.name, spec, name_len);
+
+		const char *recvq = memchr(sendq + 1, ':', limits_len - 1);
+		const size_t sendq_len = recvq ? (size_t)(recvq - sendq - 1)
+					       : (limits_len - 1);
+		u64 val = 0;
+
+		valid = size_parse(sendq + 1, sendq_len,
+				   IRC_CONF_CLASS_SENDQ_MAX, &val) &&
+			val;
+		entry.sendq_max = (u32)val;
+
+		if (valid && recvq) {
+			valid = size_parse(recvq + 1,
+					   limits_len - sendq_len - 2,
+					   IRC_CONF_CLASS_RECVQ_MAX, &val) &&
+				val;
+			entry.recvq_max = (u32)val;
+		}
+	}
+
+	if (valid && net) {
+		valid = irc_cidr_parse(net + 1, &entry.net, &entry.net_len);
+	}
+
+	if (IRC_UNLIKELY(!valid)) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to add the class \"%s\" - classes are "
+			    "name:sendq, optionally followed by :recvq and "
+			    "@network, with sizes of at most %d and %d bytes",
+			    spec, IRC_CONF_CLASS_SENDQ_MAX,
+			    IRC_CONF_CLASS_RECVQ_MAX);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+	conf->classes.entries[conf->classes.num_entries++] = entry;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool
+irc_conf_queue_budget_set(struct irc_conf *const conf, const char *const budget,
+			  enum irc_conf_status_code *const code)
+{
+	u64 val = 0;
+
+	if (IRC_UNLIKELY(!size_parse(budget, strlen(budget),
+				     IRC_CONF_QUEUE_BUDGET_MAX, &val))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set the queue budget to \"%s\" - "
+			    "valid values are sizes of at most 1T, or 0 for "
+			    "no budget",
+			    budget);
+
+		*code = IRC_CONF_OUT_OF_RANGE;
+		return false;
+	}
+	conf->classes.budget = val;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+IRC_NODISCARD bool
+irc_conf_snapshot_file_set(struct irc_conf *const conf, const char *const path,
+			   enum irc_conf_status_code *const code)
+{
+	return str_set(conf, conf->snapshot.path, IRC_CONF_FILE_PATH_LEN_MAX,
+		       "snapshot file", path, code);
+}
+
+IRC_NODISCARD bool
+irc_conf_snapshot_interval_set(struct irc_conf *const conf,
+			       const char *const interval_s,
+			       enum irc_conf_status_code *const code)
+{
+	int val = 0;
+
+	// Anything longer cannot be in range, and could overflow.
+	const bool conv_good = (strlen(interval_s) <= 5) &&
+			       to_int(interval_s, &val);
+
+	if (IRC_UNLIKELY(!conv_good || (val < 1) ||
+			 (val > IRC_CONF_SNAPSHOT_INTERVAL_MAX))) {
+		IRC_LOG_ERR(conf->log,
+			    "unable to set the snapshot interval to \"%s\" - "
+			    "valid values are integers between 1 and %d",
+			    interval_s, IRC_CONF_SNAPSHOT_INTERVAL_MAX);
+
+		*code = IRC_CONF_OUT_OF_RANGE;
+		return false;
+	}
+	conf->snapshot.interval_s = (uint)val;
+
+	*code = IRC_CONF_STATUS_OK;
+	return true;
+}
+
+/// @brief A setting of a configuration file, and its setter.
+struct conf_setting {
+	const char *name;
+	bool (*set)(struct irc_conf *conf, const char *val,
+		    enum irc_conf_status_code *code);
+};
+
+IRC_NODISCARD bool irc_conf_load(struct irc_conf *const conf,
+				 const char *const path, size_t *const line,
+				 enum irc_conf_status_code *const code)
+{
+	static const struct conf_setting settings[] = {
+		// clang-format off
+
+		{ "listen",		&irc_conf_listener_addr_add },
+		{ "server_name",	&irc_conf_server_name_set },
+		{ "server_id",		&irc_conf_server_id_set },
+		{ "link",		&irc_conf_link_add },
+		{ "link_listen",	&irc_conf_link_listener_set },
+		{ "metrics_sock",	&irc_conf_metrics_sock_set },
+		{ "watchdog",		&irc_conf_watchdog_set },
+		{ "fanout_budget",	&irc_conf_fanout_budget_set },
+		{ "kline",		&irc_conf_kline_add },
+		{ "dline_file",		&irc_conf_dline_file_set },
+		{ "filter_file",	&irc_conf_filter_file_set },
+		{ "clones",		&irc_conf_clones_set },
+		{ "class",		&irc_conf_class_add },
+		{ "queue_budget",	&irc_conf_queue_budget_set },
+		{ "tables",		&irc_conf_tables_vmem_set },
+		{ "snapshot_file",	&irc_conf_snapshot_file_set },
+		{ "snapshot_interval",	&irc_conf_snapshot_interval_set }
+
+		// clang-format on
+	};
+
+	*line = 0;
+
+	if (!str_set(conf, conf->path, IRC_CONF_FILE_PATH_LEN_MAX,
+		     "configuration file", path, code)) {
+		return false;
+	}
+
+	FILE *const file = fopen(path, "r");
+
+	if (IRC_UNLIKELY(!file)) {
+		IRC_LOG_ERR(conf->log, "unable to read configuration file %s",
+			    path);
+
+		*code = IRC_CONF_MALFORMED;
+		return false;
+	}
+
+	char buf[CONF_LINE_LEN_MAX + 2];
+	bool ok = true;
+
+	*code = IRC_CONF_STATUS_OK;
+
+	for (size_t num = 1; ok && fgets(buf, sizeof(buf), file); ++num) {
+		size_t len = strlen(buf);
+
+		*line = num;
+
+		if ((len == sizeof(buf) - 1) && (buf[len - 1] != '\n')) {
+			IRC_LOG_ERR(conf->log,
+				    "configuration file %s: line %zu is longer "
+				    "than %d characters",
+				    path, num, CONF_LINE_LEN_MAX);
+
+			*code = IRC_CONF_MALFORMED;
+			ok = false;
+			break;
+		}
+
+		while (len && isspace((u8)buf[len - 1])) {
+			buf[--len] = '\0';
+		}
+
+		char *name = buf;
+
+		while (isspace((u8)*name)) {
+			++name;
+		}
+
+		if ((*name == '\0') || (*name == '#')) {
+			continue;
+		}
+
+		char *val = name + strcspn(name, " \t");
+
+		if (*val != '\0') {
+			*val++ = '\0';
+
+			while (isspace((u8)*val)) {
+				++val;
+			}
+		}
+
+		const struct conf_setting *setting = NULL;
+
+		for (size_t i = 0; i < (sizeof(settings) / sizeof(*settings));
+		     ++i) {
+			if (!strcmp(settings[i].name, name)) {
+				setting = &settings[i];
+				break;
+			}
+		}
+
+		if (IRC_UNLIKELY(!setting)) {
+			IRC_LOG_ERR(conf->log,
+				    "configuration file %s: line %zu sets "
+				    "\"%s\", which is not a setting",
+				    path, num, name);
+
+			*code = IRC_CONF_MALFORMED;
+			ok = false;
+		} else {
+			ok = setting->set(conf, val, code);
+		}
+	}
+
+	if (ok) {
+		*line = 0;
+	}
+	fclose(file);
+	return ok;
+}
+
+void irc_conf_release(struct irc_conf *const conf)
+{
+	free(conf->klines.entries);
+
+	conf->klines.entries = NULL;
+	conf->klines.num_entries = 0;
+}
@@ -21,28 +21,171 @@
 // SOFTWARE.
 
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "core/bcast.h"
+#include "core/casemap.h"
+#include "core/cmd.h"
 #include "core/ctx.h"
+#include "core/filter.h"
 #include "core/hash_table.h"
 #include "core/irc_parse.h"
+#include "core/link.h"
 #include "core/log.h"
+#include "core/mask.h"
+#include "core/metrics.h"
+#include "core/monitor.h"
 #include "core/net.h"
+#include "core/pool.h"
+#include "core/prof.h"
+#include "core/snapshot.h"
+#include "core/upgrade.h"
 #include "core/user.h"
 #include "core/util.h"
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief Accumulates the rendered metrics served on the metrics socket.
+struct prom_buf {
+	struct irc_arena *arena;
+	char *data;
+	size_t len;
+	size_t capacity;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Processes a single line received from a user.
+///
+/// @param line The line, including its terminator.
+/// @param len The length of the line.
+static void line_process(struct irc_ctx *const ctx, struct irc_user *const user,
+			 const char *const line, size_t len)
+{
+	// Strip the line terminator; a lone LF is accepted as well.
+	while (len && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) {
+		len--;
+	}
+
+	if (!len) {
+		return;
+	}
+
+	IRC_METRIC_INC(&ctx->metrics, IRC_METRIC_LINES_IN);
+
+	// The parser expects the length to include a two character line
+	// terminator, but never reads it.
+	struct irc_msg msg = {};
+
+	const enum irc_prof_phase prev =
+		irc_prof_enter(&ctx->prof, IRC_PROF_PHASE_PARSE);
+
+	irc_msg_parse(line, len + 2, &msg);
+	irc_prof_leave(&ctx->prof, prev);
+
+	IRC_LOG_TRACE(&ctx->log, "fd %d: parsed command \"%s\" (%zu params)",
+		      user->fd, msg.cmd, msg.num_params);
+
+	if (IRC_UNLIKELY(!msg.cmd_len)) {
+		IRC_METRIC_INC(&ctx->metrics, IRC_METRIC_PARSE_FAILURES);
+		return;
+	}
+	irc_cmd_dispatch(ctx, user, &msg);
+}
+
+/// @brief Lends a user a buffer for the start of a line split across reads.
+static void recvq_borrow(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	if (!user->recvq) {
+		user->recvq =
+			irc_pool_alloc(IRC_POOL_RECVQS, IRC_USER_RECVQ_LEN_MAX);
+
+		irc_class_recvq_add(&ctx->classes, user->cls,
+				    IRC_USER_RECVQ_LEN_MAX);
+	}
+}
+
+/// @brief Empties the receive queue of a user, and hands its buffer back.
+static void recvq_drop(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	user->recvq_len = 0;
+
+	if (user->recvq) {
+		irc_pool_free(IRC_POOL_RECVQS, user->recvq,
+			      IRC_USER_RECVQ_LEN_MAX);
+		user->recvq = NULL;
+
+		irc_class_recvq_sub(&ctx->classes, user->cls,
+				    IRC_USER_RECVQ_LEN_MAX);
+	}
+}
+
 static void net_client_recv(void *const ctx, void *const ev_data)
 {
 	struct irc_ctx *m_ctx = (struct irc_ctx *)ctx;
 	struct irc_event_net_data_recv *ev =
 		(struct irc_event_net_data_recv *)ev_data;
 
-	struct irc_msg msg = {};
-	irc_msg_parse(ev->data, ev->size, &msg);
-
 	struct irc_user *user =
 		irc_ht_get(&m_ctx->users, (void *)(uintptr_t)ev->fd);
 
-	assert(user != NULL);
+	// Anything else is a link to another server.
+	if (IRC_UNLIKELY(!user)) {
+		struct irc_link *link = irc_link_find(&m_ctx->links, ev->fd);
+
+		if (link) {
+			irc_link_recv(m_ctx, link, ev->data, ev->size);
+		}
+		return;
+	}
+
+	const char *data = ev->data;
+	size_t size = ev->size;
+
+	const size_t len_max = user->cls->conf.recvq_max;
+
+	// Whatever a user that is being disconnected still sends is ignored.
+	while (size && !user->closing) {
+		const char *eol = memchr(data, '\n', size);
+		const size_t chunk = eol ? (size_t)(eol - data + 1) : size;
+
+		if (IRC_UNLIKELY(user->recvq_discard)) {
+			// Skip the rest of a line that was too long.
+			user->recvq_discard = !eol;
+		} else if ((user->recvq_len + chunk) > len_max) {
+			IRC_METRIC_INC(&m_ctx->metrics,
+				       IRC_METRIC_PARSE_FAILURES);
+
+			recvq_drop(m_ctx, user);
+			user->recvq_discard = !eol;
+		} else if (eol && !user->recvq_len) {
+			// Common case: a complete line with nothing buffered;
+			// parse it in place.
+			line_process(m_ctx, user, data, chunk);
+		} else {
+			// Only a line split across reads needs a buffer, and
+			// only until its end arrives.
+			recvq_borrow(m_ctx, user);
+			memcpy(&user->recvq[user->recvq_len], data, chunk);
+			user->recvq_len += chunk;
+
+			if (eol) {
+				line_process(m_ctx, user, user->recvq,
+					     user->recvq_len);
+				recvq_drop(m_ctx, user);
+			}
+		}
+		data += chunk;
+		size -= chunk;
+	}
 }
 
 static void net_client_conn(void *const ctx, void *const ev_data)
@@ -52,14 +195,171 @@ static void net_client_conn(void *const ctx, void *const ev_data)
 	struct irc_event_net_client_conn *ev =
 		(struct irc_event_net_client_conn *)ev_data;
 
-	struct irc_user *user = irc_calloc(1, sizeof(struct irc_user));
+	struct irc_user *user =
+		irc_pool_calloc(IRC_POOL_USERS, sizeof(struct irc_user));
 	user->fd = ev->fd;
 
+	snprintf(user->host, sizeof(user->host), "%s", ev->host);
+
+	user->cls = irc_classes_match(&m_ctx->classes, ev->host);
+	user->cls->num_users++;
+
 	irc_ht_add(&m_ctx->users, (void *)(uintptr_t)ev->fd, user);
+	IRC_METRIC_GAUGE_ADD(&m_ctx->metrics, IRC_METRIC_CLIENTS, 1);
 
 	IRC_LOG_INFO(&m_ctx->log, "client connected");
 }
 
+static void net_client_disconn(void *const ctx, void *const ev_data)
+{
+	struct irc_ctx *m_ctx = (struct irc_ctx *)ctx;
+
+	struct irc_event_net_client_disconn *ev =
+		(struct irc_event_net_client_disconn *)ev_data;
+
+	struct irc_user *user =
+		irc_ht_del(&m_ctx->users, (void *)(uintptr_t)ev->fd);
+
+	if (!user) {
+		struct irc_link *link = irc_link_find(&m_ctx->links, ev->fd);
+
+		if (link) {
+			irc_link_closed(m_ctx, link);
+		}
+		return;
+	}
+	irc_cmd_user_quit(m_ctx, user,
+			  user->evicted ? IRC_USER_EVICT_REASON
+					: "Connection closed");
+	irc_user_release(m_ctx, user);
+	irc_pool_free(IRC_POOL_USERS, user, sizeof(*user));
+
+	IRC_METRIC_GAUGE_ADD(&m_ctx->metrics, IRC_METRIC_CLIENTS, -1);
+	IRC_LOG_INFO(&m_ctx->log, "client disconnected");
+}
+
+static void net_client_writable(void *const ctx, void *const ev_data)
+{
+	struct irc_ctx *m_ctx = (struct irc_ctx *)ctx;
+
+	struct irc_event_net_client_writable *ev =
+		(struct irc_event_net_client_writable *)ev_data;
+
+	struct irc_user *user =
+		irc_ht_get(&m_ctx->users, (void *)(uintptr_t)ev->fd);
+
+	if (user) {
+		irc_user_flush_schedule(m_ctx, user);
+		return;
+	}
+	struct irc_link *link = irc_link_find(&m_ctx->links, ev->fd);
+
+	if (link) {
+		irc_link_writable(m_ctx, link);
+	}
+}
+
+static void net_server_conn(void *const ctx, void *const ev_data)
+{
+	struct irc_event_net_server_conn *ev =
+		(struct irc_event_net_server_conn *)ev_data;
+
+	irc_link_accept((struct irc_ctx *)ctx, ev->fd, ev->host);
+}
+
+static void prom_emit(void *const udata, const char *const line,
+		      const size_t len)
+{
+	struct prom_buf *buf = udata;
+
+	if ((buf->len + len + 1) > buf->capacity) {
+		const size_t capacity = (buf->capacity + len + 1) * 2;
+
+		buf->data = irc_arena_grow(buf->arena, buf->data, buf->capacity,
+					   capacity);
+		buf->capacity = capacity;
+	}
+	memcpy(&buf->data[buf->len], line, len);
+	buf->len += len;
+	buf->data[buf->len++] = '\n';
+}
+
+static void net_stats_conn(void *const ctx, void *const ev_data)
+{
+	struct irc_ctx *m_ctx = (struct irc_ctx *)ctx;
+
+	struct irc_event_net_stats_conn *ev =
+		(struct irc_event_net_stats_conn *)ev_data;
+
+	struct irc_metrics_snapshot snap;
+	irc_metrics_read(&m_ctx->metrics, &snap);
+
+	struct prom_buf buf = { .arena = &m_ctx->arena };
+	irc_metrics_render_prom(&snap, &prom_emit, &buf);
+
+	// The scrape is answered in one go and the connection closed, like an
+	// HTTP/1.0 response body. The socket is non-blocking; whatever does
+	// not fit in its buffer right away is given up on, rather than waited
+	// for on the I/O thread.
+	for (size_t pos = 0; pos < buf.len;) {
+		const ssize_t cnt = write(ev->fd, &buf.data[pos], buf.len - pos);
+
+		if (cnt <= 0) {
+			if ((cnt < 0) && (errno == EINTR)) {
+				continue;
+			}
+
+			if (cnt < 0) {
+				IRC_LOG_WARN_RATELIMIT(
+					&m_ctx->log, 1,
+					"stats: reply cut short at %zu of %zu "
+					"bytes: %s",
+					pos, buf.len, strerror(errno));
+			}
+			break;
+		}
+		pos += (size_t)cnt;
+	}
+
+	close(ev->fd);
+}
+
+static void metrics_collect(void *const udata,
+			    struct irc_metrics_snapshot *const snap)
+{
+	const struct irc_ctx *ctx = udata;
+
+	snap->gauges[IRC_METRIC_USERS_HT_ENTRIES] =
+		(i64)ctx->users.num_entries;
+
+	snap->gauges[IRC_METRIC_USERS_HT_LOAD] =
+		(i64)((ctx->users.num_entries * 1000) / ctx->users.capacity);
+
+	i64 backlog = 0;
+	i64 rcpts = 0;
+
+	for (const struct irc_chan *chan = ctx->chans.backlog.head; chan;
+	     chan = chan->backlog.next) {
+		backlog += chan->backlog.num_entries;
+		rcpts += chan->backlog.remaining;
+
+		for (const struct irc_fanout *fanout =
+			     chan->backlog.head->next;
+		     fanout; fanout = fanout->next) {
+			rcpts += fanout->num_members;
+		}
+	}
+	snap->gauges[IRC_METRIC_FANOUT_BACKLOG] = backlog;
+	snap->gauges[IRC_METRIC_FANOUT_BACKLOG_RCPTS] = rcpts;
+
+	const size_t used = irc_arena_used(&ctx->arena);
+
+	snap->gauges[IRC_METRIC_ARENA_HIGH_WATER] =
+		(i64)((used > ctx->arena.high_water) ? used
+						     : ctx->arena.high_water);
+	snap->gauges[IRC_METRIC_ARENA_CAPACITY] = (i64)ctx->arena.capacity;
+}
+
 static void setup_ctx_ptrs(struct irc_ctx *const ctx)
 {
 	ctx->event.ctx = ctx;
@@ -67,19 +367,51 @@ static void setup_ctx_ptrs(struct irc_ctx *const ctx)
 	ctx->net.conf = &ctx->conf;
 	ctx->net.log = &ctx->log;
 	ctx->net.event = &ctx->event;
+	ctx->net.metrics = &ctx->metrics;
+
+	ctx->net.prof = &ctx->prof;
+
+	ctx->event.metrics = &ctx->metrics;
+	ctx->event.prof = &ctx->prof;
+
+	ctx->prof.metrics = &ctx->metrics;
+
+	ctx->metrics.collect = &metrics_collect;
+	ctx->metrics.udata = ctx;
 
 	ctx->conf.log = &ctx->log;
 }
 
-static void users_table_init(struct irc_ht *const ht)
+static void users_table_init(struct irc_ht *const ht,
+			     const enum irc_vmem_mode vmem)
+{
+	assert(ht != NULL);
+
+	const struct irc_ht_conf cfg = {
+		// clang-format off
+
+		.initial_capacity	= 4096,
+		.load_fact_max		= 75,
+		.vmem			= vmem
+
+		// clang-format on
+	};
+	irc_ht_init(ht, &cfg);
+}
+
+static void nicks_table_init(struct irc_ht *const ht,
+			     const enum irc_vmem_mode vmem)
 {
 	assert(ht != NULL);
 
-	static const struct irc_ht_conf cfg = {
+	const struct irc_ht_conf cfg = {
 		// clang-format off
 
 		.initial_capacity	= 4096,
-		.load_fact_max		= 75
+		.load_fact_max		= 75,
+		.hash			= &irc_casemap_ht_hash,
+		.eq			= &irc_casemap_ht_eq,
+		.vmem			= vmem
 
 		// clang-format on
 	};
@@ -90,7 +422,10 @@ static void init_tables(struct irc_ctx *const ctx)
 {
 	assert(ctx != NULL);
 
-	users_table_init(&ctx->users);
+	users_table_init(&ctx->users, ctx->conf.tables.vmem);
+	nicks_table_init(&ctx->nicks, ctx->conf.tables.vmem);
+	irc_chans_init(&ctx->chans);
+	irc_monitors_init(&ctx->monitors);
 }
 
 static void hook_events(struct irc_ctx *const ctx)
@@ -100,22 +435,443 @@ static void hook_events(struct irc_ctx *const ctx)
 
 	irc_event_sub(&ctx->event, IRC_EVENT_TYPE_NET_DATA_RECV,
 		      &net_client_recv);
+
+	irc_event_sub(&ctx->event, IRC_EVENT_TYPE_NET_CLIENT_DISCONN,
+		      &net_client_disconn);
+
+	irc_event_sub(&ctx->event, IRC_EVENT_TYPE_NET_STATS_CONN,
+		      &net_stats_conn);
+
+	irc_event_sub(&ctx->event, IRC_EVENT_TYPE_NET_CLIENT_WRITABLE,
+		      &net_client_writable);
+
+	irc_event_sub(&ctx->event, IRC_EVENT_TYPE_NET_SERVER_CONN,
+		      &net_server_conn);
+}
+
+/// @brief Fills in the settings left unset with their defaults.
+static void conf_defaults(struct irc_conf *const conf)
+{
+	if (conf->server_name[0] == '\0') {
+		strcpy(conf->server_name, IRC_CONF_SERVER_NAME_DEFAULT);
+	}
+
+	if (conf->server_id[0] == '\0') {
+		strcpy(conf->server_id, IRC_CONF_SERVER_ID_DEFAULT);
+	}
+
+	if (!conf->listeners.num_entries) {
+		static const struct irc_conf_listener listener = {
+			.host = IRC_CONF_LISTENER_HOST_DEFAULT,
+			.port = IRC_CONF_LISTENER_PORT_DEFAULT
+		};
+		enum irc_conf_status_code code;
+
+		(void)irc_conf_listener_add(conf, &listener, &code);
+	}
+
+	if (!conf->fanout.recipients_per_iter) {
+		conf->fanout.recipients_per_iter =
+			IRC_CONF_FANOUT_BUDGET_DEFAULT;
+	}
+
+	if (conf->clones.max) {
+		if (!conf->clones.ipv4_len) {
+			conf->clones.ipv4_len =
+				IRC_CONF_CLONES_IPV4_LEN_DEFAULT;
+		}
+
+		if (!conf->clones.ipv6_len) {
+			conf->clones.ipv6_len =
+				IRC_CONF_CLONES_IPV6_LEN_DEFAULT;
+		}
+	}
+
+	if (!conf->snapshot.interval_s) {
+		conf->snapshot.interval_s = IRC_CONF_SNAPSHOT_INTERVAL_DEFAULT;
+	}
+}
+
+/// @brief Compiles the K-lines of the configuration, replacing the ones in
+/// use.
+static void klines_compile(struct irc_ctx *const ctx)
+{
+	if (ctx->klines) {
+		irc_mask_set_free(ctx->klines);
+		ctx->klines = NULL;
+	}
+
+	if (!ctx->conf.klines.num_entries) {
+		return;
+	}
+	ctx->klines = irc_mask_set_new();
+
+	for (size_t i = 0; i < ctx->conf.klines.num_entries; ++i) {
+		irc_mask_set_add(ctx->klines, ctx->conf.klines.entries[i],
+				 ctx->conf.server_name, (u64)time(NULL));
+	}
+}
+
+/// @brief Loads the D-lines of the configuration, replacing the ones in use.
+static void dlines_load(struct irc_ctx *const ctx)
+{
+	size_t line;
+
+	ctx->net.dlines = NULL;
+	irc_cidr_tree_destroy(&ctx->dlines);
+
+	if (ctx->conf.dlines.path[0] == '\0') {
+		return;
+	}
+
+	if (!irc_cidr_load(&ctx->dlines, ctx->conf.dlines.path, &line)) {
+		if (line) {
+			IRC_LOG_ERR(&ctx->log,
+				    "D-line file %s: line %zu is not a network, "
+				    "ignoring it and the lines after it",
+				    ctx->conf.dlines.path, line);
+		} else {
+			IRC_LOG_ERR(&ctx->log, "unable to read D-line file %s",
+				    ctx->conf.dlines.path);
+		}
+	}
+
+	if (ctx->dlines.num_entries) {
+		ctx->net.dlines = &ctx->dlines;
+	}
+
+	IRC_LOG_INFO(&ctx->log, "loaded %zu D-lines from %s",
+		     ctx->dlines.num_entries, ctx->conf.dlines.path);
+}
+
+bool irc_filter_reload(struct irc_ctx *const ctx)
+{
+	size_t line;
+
+	struct irc_filter *filter =
+		irc_filter_load(ctx->conf.filter.path, &line);
+
+	if (!filter) {
+		if (line) {
+			IRC_LOG_ERR(&ctx->log,
+				    "content filter file %s: line %zu is longer "
+				    "than %d characters",
+				    ctx->conf.filter.path, line,
+				    IRC_FILTER_PHRASE_LEN_MAX);
+		} else {
+			IRC_LOG_ERR(&ctx->log,
+				    "unable to load content filter file %s",
+				    ctx->conf.filter.path);
+		}
+		return false;
+	}
+
+	IRC_LOG_INFO(&ctx->log,
+		     "loaded %zu content filter phrases from %s (%" PRIu32
+		     " states)",
+		     filter->num_phrases, ctx->conf.filter.path,
+		     filter->num_states);
+
+	irc_filter_swap(&ctx->filter, filter);
+	return true;
+}
+
+/// @brief Maps the snapshot file of the configuration. Nothing is restored
+/// until channels are joined.
+static void snapshot_open(struct irc_ctx *const ctx)
+{
+	const char *path = ctx->conf.snapshot.path;
+
+	if (!irc_snapshot_open(&ctx->snapshot, path)) {
+		if (errno == ENOENT) {
+			IRC_LOG_INFO(&ctx->log, "no snapshot at %s yet", path);
+		} else {
+			IRC_LOG_ERR(&ctx->log,
+				    "unable to map snapshot %s: %s - the next "
+				    "snapshot replaces it",
+				    path, strerror(errno));
+		}
+		return;
+	}
+	const struct irc_snapshot_hdr *hdr = ctx->snapshot.hdr;
+
+	IRC_LOG_INFO(&ctx->log,
+		     "mapped snapshot %s: %" PRIu32
+		     " channels, taken at %" PRIu64,
+		     path, hdr->num_chans, hdr->taken_at);
 }
 
 void irc_init(struct irc_ctx *const ctx)
 {
+	irc_log_init(&ctx->log);
 	setup_ctx_ptrs(ctx);
 	init_tables(ctx);
+	irc_arena_init(&ctx->arena);
+
+	conf_defaults(&ctx->conf);
+
+	irc_links_init(&ctx->links, ctx->conf.server_id,
+		       ctx->conf.tables.vmem);
+	irc_classes_init(&ctx->classes, &ctx->conf);
+
+	klines_compile(ctx);
+
+	if (ctx->conf.dlines.path[0] != '\0') {
+		dlines_load(ctx);
+	}
+
+	if (ctx->conf.filter.path[0] != '\0') {
+		irc_filter_reload(ctx);
+	}
+
+	if (ctx->conf.snapshot.path[0] != '\0') {
+		snapshot_open(ctx);
+	}
 	hook_events(ctx);
 
 	IRC_LOG_INFO(&ctx->log, "initialized");
 }
 
+void irc_destroy(struct irc_ctx *const ctx)
+{
+	// Takes the users of the other servers along.
+	while (ctx->links.num_entries) {
+		irc_link_closed(ctx,
+				ctx->links.entries[ctx->links.num_entries - 1]);
+	}
+
+	for (size_t i = 0; i < ctx->users.capacity; ++i) {
+		const struct irc_ht_entry *entry = &ctx->users.entries[i];
+
+		if (entry->psl) {
+			struct irc_user *user = entry->val;
+
+			irc_chan_part_all(&ctx->chans, user);
+			irc_user_release(ctx, user);
+			irc_pool_free(IRC_POOL_USERS, user, sizeof(*user));
+		}
+	}
+	irc_chans_destroy(&ctx->chans);
+
+	irc_ht_destroy(&ctx->users);
+	irc_ht_destroy(&ctx->nicks);
+	irc_ht_destroy(&ctx->monitors);
+
+	irc_user_list_free(&ctx->flush);
+	irc_user_list_free(&ctx->who);
+	irc_user_list_free(&ctx->list);
+
+	irc_links_destroy(&ctx->links);
+
+	if (ctx->klines) {
+		irc_mask_set_free(ctx->klines);
+		ctx->klines = NULL;
+	}
+	ctx->net.dlines = NULL;
+	irc_cidr_tree_destroy(&ctx->dlines);
+	irc_filter_swap(&ctx->filter, NULL);
+
+	irc_snapshot_close(&ctx->snapshot);
+	irc_arena_destroy(&ctx->arena);
+	irc_conf_release(&ctx->conf);
+}
+
+/// @brief Returns `true` if two server links are configured alike.
+static bool link_eq(const struct irc_conf_link *const a,
+		    const struct irc_conf_link *const b)
+{
+	return !strcmp(a->name, b->name) && !strcmp(a->password, b->password) &&
+	       !strcmp(a->addr.host, b->addr.host) &&
+	       !strcmp(a->addr.port, b->addr.port) && (a->zip == b->zip);
+}
+
+/// @brief Keeps the settings of a new configuration that only take effect on
+/// a restart as they are, warning about the ones that were changed.
+static void restart_only_keep(struct irc_ctx *const ctx,
+			      struct irc_conf *const next)
+{
+	const struct irc_conf *cur = &ctx->conf;
+
+	// Every user and server of the network knows this one by them.
+	if (strcmp(cur->server_name, next->server_name) ||
+	    strcmp(cur->server_id, next->server_id)) {
+		IRC_LOG_WARN(&ctx->log,
+			     "rehash: the server name and identifier only "
+			     "change on restart");
+	}
+	strcpy(next->server_name, cur->server_name);
+	strcpy(next->server_id, cur->server_id);
+
+	// Established links refer to their settings.
+	bool links_eq = cur->links.num_entries == next->links.num_entries;
+
+	for (size_t i = 0; links_eq && (i < cur->links.num_entries); ++i) {
+		links_eq = link_eq(&cur->links.entries[i],
+				   &next->links.entries[i]);
+	}
+
+	if (!links_eq) {
+		IRC_LOG_WARN(&ctx->log,
+			     "rehash: the servers linked to only change on "
+			     "restart");
+	}
+	memcpy(next->links.entries, cur->links.entries,
+	       sizeof(next->links.entries));
+	next->links.num_entries = cur->links.num_entries;
+
+	if (cur->watchdog.stall_threshold_ms !=
+	    next->watchdog.stall_threshold_ms) {
+		IRC_LOG_WARN(&ctx->log,
+			     "rehash: the watchdog threshold only changes on "
+			     "restart");
+	}
+	next->watchdog = cur->watchdog;
+
+	// The tables are already allocated.
+	if (cur->tables.vmem != next->tables.vmem) {
+		IRC_LOG_WARN(&ctx->log,
+			     "rehash: the table memory only changes on "
+			     "restart");
+	}
+	next->tables = cur->tables;
+}
+
+bool irc_rehash(struct irc_ctx *const ctx)
+{
+	if (ctx->conf.path[0] == '\0') {
+		IRC_LOG_ERR(&ctx->log,
+			    "rehash: the configuration was not loaded from a "
+			    "file");
+		return false;
+	}
+
+	struct irc_conf next = { .log = ctx->conf.log };
+
+	size_t line;
+	enum irc_conf_status_code code;
+
+	// What is wrong with the file has been logged by the loader.
+	if (!irc_conf_load(&next, ctx->conf.path, &line, &code)) {
+		IRC_LOG_ERR(&ctx->log,
+			    "rehash: keeping the configuration in use");
+
+		irc_conf_release(&next);
+		return false;
+	}
+	conf_defaults(&next);
+	restart_only_keep(ctx, &next);
+
+	if (!irc_classes_apply(&ctx->classes, &next)) {
+		IRC_LOG_ERR(&ctx->log,
+			    "rehash: too many classes no longer configured "
+			    "still have clients, keeping the classes in use");
+
+		next.classes = ctx->conf.classes;
+	}
+	irc_net_listeners_apply(&ctx->net, &next);
+
+	irc_conf_release(&ctx->conf);
+	ctx->conf = next;
+
+	// Only affect who is let in from now on.
+	klines_compile(ctx);
+	dlines_load(ctx);
+
+	if (ctx->conf.filter.path[0] != '\0') {
+		irc_filter_reload(ctx);
+	} else {
+		irc_filter_swap(&ctx->filter, NULL);
+	}
+
+	IRC_LOG_INFO(&ctx->log, "rehashed %s", ctx->conf.path);
+	return true;
+}
+
+void irc_rehash_request(struct irc_ctx *const ctx)
+{
+	atomic_store_explicit(&ctx->rehash_pending, true,
+			      memory_order_relaxed);
+}
+
 IRC_NORETURN void irc_io_loop(struct irc_ctx *const ctx)
 {
 	irc_net_init(&ctx->net);
 
+	// What the previous process listened on is taken over first, so that
+	// only the listeners it did not have are opened.
+	if (ctx->upgrade.resume && !irc_upgrade_resume(ctx)) {
+		exit(EXIT_FAILURE);
+	}
+	irc_net_listeners_apply(&ctx->net, &ctx->conf);
+
+	if (ctx->conf.watchdog.stall_threshold_ms) {
+		irc_watchdog_start(&ctx->watchdog, &ctx->prof, &ctx->log,
+				   ctx->conf.watchdog.stall_threshold_ms);
+	}
+
+	bool more = false;
+
 	for (;;) {
-		irc_net_platform_poll(&ctx->net);
+		irc_prof_iter_begin(&ctx->prof);
+
+		// Links that are down are retried, and snapshots taken, while
+		// waiting for events.
+		irc_prof_enter(&ctx->prof, IRC_PROF_PHASE_TIMERS);
+
+		int wait_ms = irc_links_connect(ctx);
+
+		const int snapshot_ms = irc_snapshot_tick(ctx);
+
+		if ((snapshot_ms >= 0) &&
+		    ((wait_ms < 0) || (snapshot_ms < wait_ms))) {
+			wait_ms = snapshot_ms;
+		}
+
+		// A signal asking for a rehash or an upgrade interrupts the
+		// wait; one that came while the loop was busy skips it.
+		const bool requested =
+			atomic_load_explicit(&ctx->rehash_pending,
+					     memory_order_relaxed) ||
+			atomic_load_explicit(&ctx->upgrade.pending,
+					     memory_order_relaxed);
+
+		irc_prof_enter(&ctx->prof, IRC_PROF_PHASE_POLL);
+		irc_net_platform_poll(&ctx->net,
+				      (more || requested) ? 0 : wait_ms);
+
+		if (IRC_UNLIKELY(atomic_exchange_explicit(
+			    &ctx->rehash_pending, false,
+			    memory_order_relaxed))) {
+			irc_prof_enter(&ctx->prof, IRC_PROF_PHASE_TIMERS);
+			irc_rehash(ctx);
+		}
+
+		// Only returns if the upgrade failed; the server carries on.
+		if (IRC_UNLIKELY(atomic_exchange_explicit(
+			    &ctx->upgrade.pending, false,
+			    memory_order_relaxed))) {
+			irc_prof_enter(&ctx->prof, IRC_PROF_PHASE_TIMERS);
+			irc_upgrade(ctx);
+		}
+
+		irc_prof_enter(&ctx->prof, IRC_PROF_PHASE_FANOUT);
+		irc_bcast_backlog_run(ctx);
+		irc_cmd_streams_run(ctx);
+
+		// Everything sent during the iteration is written out in one
+		// go per user.
+		irc_prof_enter(&ctx->prof, IRC_PROF_PHASE_FLUSH);
+		irc_users_flush(ctx);
+		irc_links_flush(ctx);
+
+		// Nothing allocated from the arena outlives the iteration.
+		irc_arena_reset(&ctx->arena);
+
+		// Deferred broadcasts and streamed replies continue on the
+		// next iteration, whether or not anything happens in the
+		// meantime.
+		more = ctx->chans.backlog.head || irc_cmd_streams_ready(ctx);
+
+		irc_prof_iter_end(&ctx->prof);
 	}
 }
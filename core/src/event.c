@@ -20,7 +20,11 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include "core/clock.h"
 #include "core/event.h"
+#include "core/metrics.h"
+#include "core/prof.h"
+#include "core/trace.h"
 
 void irc_event_pub(struct irc_event *const ev, const enum irc_event_type type,
 		   void *const ptr)
@@ -31,9 +35,24 @@ void irc_event_pub(struct irc_event *const ev, const enum irc_event_type type,
 		return;
 	}
 
+	IRC_TRACE(event_pub_start, type);
+
+	const enum irc_prof_phase prev =
+		irc_prof_enter(ev->prof, IRC_PROF_PHASE_DISPATCH);
+
+	const u64 start = irc_clock_mono_ns();
+
 	for (size_t i = 0; i < ev_data->num_subs; ++i) {
 		ev_data->sub_cb[i](ev->ctx, ptr);
 	}
+
+	irc_prof_leave(ev->prof, prev);
+
+	irc_metrics_hist_record(ev->metrics,
+				IRC_METRIC_HIST_EVENT_DISPATCH + type,
+				irc_clock_mono_ns() - start);
+
+	IRC_TRACE(event_pub_done, type);
 }
 
 void irc_event_sub(struct irc_event *const ev, const enum irc_event_type type,
@@ -46,3 +65,24 @@ void irc_event_sub(struct irc_event *const ev, const enum irc_event_type type,
 	}
 	ev_data->sub_cb[ev_data->num_subs++] = cb;
 }
+
+const char *irc_event_type_name(const enum irc_event_type type)
+{
+	switch (type) {
+	case IRC_EVENT_TYPE_NET_DATA_RECV:
+		return "net_data_recv";
+	case IRC_EVENT_TYPE_NET_CLIENT_CONN:
+		return "net_client_conn";
+	case IRC_EVENT_TYPE_NET_CLIENT_DISCONN:
+		return "net_client_disconn";
+	case IRC_EVENT_TYPE_NET_STATS_CONN:
+		return "net_stats_conn";
+	case IRC_EVENT_TYPE_NET_CLIENT_WRITABLE:
+		return "net_client_writable";
+	case IRC_EVENT_TYPE_NET_SERVER_CONN:
+		return "net_server_conn";
+	case IRC_EVENT_TYPE_NUM:
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/compiler.h"
+#include "core/filter.h"
+#include "core/util.h"
+
+/// @brief Returns the character a character is matched as.
+static u8 fold(const u8 c)
+{
+	return ((c >= 'A') && (c <= 'Z')) ? (u8)(c - 'A' + 'a') : c;
+}
+
+/// @brief Assigns a class to every character appearing in a phrase, and to
+/// its other case.
+static void classes_assign(struct irc_filter *const filter,
+			   const char *const *const phrases,
+			   const size_t num_phrases)
+{
+	u8 folded[256] = {};
+
+	filter->num_classes = 1;
+
+	for (size_t i = 0; i < num_phrases; ++i) {
+		for (const char *c = phrases[i]; *c != '\0'; ++c) {
+			const u8 f = fold((u8)*c);
+
+			if (!folded[f]) {
+				folded[f] = (u8)filter->num_classes++;
+			}
+		}
+	}
+
+	for (size_t c = 0; c < 256; ++c) {
+		filter->classes[c] = folded[fold((u8)c)];
+	}
+}
+
+/// @brief Adds a phrase to the trie the automaton is built from.
+static void trie_insert(struct irc_filter *const filter, const char *phrase,
+			const u32 idx)
+{
+	u32 state = 0;
+
+	for (; *phrase != '\0'; ++phrase) {
+		u32 *const next = &filter->delta[(state * filter->num_classes) +
+						 filter->classes[(u8)*phrase]];
+
+		if (!*next) {
+			*next = filter->num_states++;
+		}
+		state = *next;
+	}
+
+	// Of duplicate phrases, the first one is reported.
+	if (!filter->out[state]) {
+		filter->out[state] = idx + 1;
+	}
+}
+
+/// @brief Turns the trie into the automaton, in breadth-first order so that
+/// the failure state of every state is complete before the state itself.
+///
+/// @param filter The filter holding the trie.
+/// @param order Set to the states in breadth-first order.
+static void automaton_build(struct irc_filter *const filter, u32 *const order)
+{
+	const u32 num_classes = filter->num_classes;
+
+	u32 *const fail = irc_calloc(filter->num_states, sizeof(*fail));
+
+	size_t head = 0;
+	size_t tail = 0;
+
+	// The children of the initial state fail to it. Transitions the
+	// initial state lacks already loop back to it, as state 0.
+	order[tail++] = 0;
+
+	for (u32 c = 0; c < num_classes; ++c) {
+		const u32 next = filter->delta[c];
+
+		if (next) {
+			order[tail++] = next;
+		}
+	}
+	head = 1;
+
+	while (head < tail) {
+		const u32 state = order[head++];
+
+		u32 *const row = &filter->delta[state * num_classes];
+		const u32 *const fail_row = &filter->delta[fail[state] *
+							   num_classes];
+
+		// A phrase ending at the failure state is a suffix of what
+		// has been read, so it ends here too.
+		if (!filter->out[state]) {
+			filter->out[state] = filter->out[fail[state]];
+		}
+
+		for (u32 c = 0; c < num_classes; ++c) {
+			if (row[c]) {
+				fail[row[c]] = fail_row[c];
+				order[tail++] = row[c];
+			} else {
+				row[c] = fail_row[c];
+			}
+		}
+	}
+	free(fail);
+}
+
+/// @brief Renumbers the states in breadth-first order, and turns the
+/// transitions into flagged row offsets.
+static void automaton_pack(struct irc_filter *const filter,
+			   const u32 *const order)
+{
+	const u32 num_classes = filter->num_classes;
+	const u32 num_states = filter->num_states;
+
+	u32 *const renum = irc_malloc(num_states * sizeof(*renum));
+
+	for (u32 i = 0; i < num_states; ++i) {
+		renum[order[i]] = i;
+	}
+
+	u32 *const delta = irc_malloc((size_t)num_states * num_classes *
+				      sizeof(*delta));
+	u32 *const out = irc_malloc(num_states * sizeof(*out));
+
+	for (u32 i = 0; i < num_states; ++i) {
+		const u32 *const src = &filter->delta[order[i] * num_classes];
+		u32 *const dst = &delta[i * num_classes];
+
+		for (u32 c = 0; c < num_classes; ++c) {
+			dst[c] = renum[src[c]] * num_classes;
+
+			if (filter->out[src[c]]) {
+				dst[c] |= IRC_FILTER_MATCH;
+			}
+		}
+		out[i] = filter->out[order[i]];
+	}
+
+	free(filter->delta);
+	free(filter->out);
+	free(renum);
+
+	filter->delta = delta;
+	filter->out = out;
+}
+
+struct irc_filter *irc_filter_new(const char *const *const phrases,
+				  const size_t num_phrases)
+{
+	struct irc_filter *filter = irc_calloc(1, sizeof(*filter));
+
+	classes_assign(filter, phrases, num_phrases);
+
+	// Every character of every phrase adds a state at most.
+	size_t states_max = 1;
+
+	for (size_t i = 0; i < num_phrases; ++i) {
+		states_max += strlen(phrases[i]);
+	}
+
+	if (IRC_UNLIKELY((states_max * filter->num_classes) >=
+			 IRC_FILTER_MATCH)) {
+		free(filter);
+		return NULL;
+	}
+
+	filter->delta = irc_calloc(states_max * filter->num_classes,
+				   sizeof(*filter->delta));
+	filter->out = irc_calloc(states_max, sizeof(*filter->out));
+	filter->num_states = 1;
+	filter->num_phrases = num_phrases;
+
+	for (size_t i = 0; i < num_phrases; ++i) {
+		if (phrases[i][0] != '\0') {
+			trie_insert(filter, phrases[i], (u32)i);
+		}
+	}
+
+	u32 *const order = irc_malloc(filter->num_states * sizeof(*order));
+
+	automaton_build(filter, order);
+
+	// Packing also drops the tail of the tables that phrases sharing
+	// prefixes left unused.
+	automaton_pack(filter, order);
+	free(order);
+
+	return filter;
+}
+
+struct irc_filter *irc_filter_load(const char *const path, size_t *const line)
+{
+	*line = 0;
+
+	FILE *const file = fopen(path, "r");
+
+	if (IRC_UNLIKELY(!file)) {
+		return NULL;
+	}
+
+	char buf[IRC_FILTER_PHRASE_LEN_MAX + 2];
+
+	char **phrases = NULL;
+	size_t num_phrases = 0;
+	bool ok = true;
+
+	for (size_t num = 1; fgets(buf, sizeof(buf), file); ++num) {
+		size_t len = strlen(buf);
+
+		if ((len == sizeof(buf) - 1) && (buf[len - 1] != '\n')) {
+			*line = num;
+			ok = false;
+			break;
+		}
+
+		// Only the line ending is stripped: spaces around a phrase
+		// are part of it, which is how whole words are matched.
+		while (len && ((buf[len - 1] == '\n') || (buf[len - 1] == '\r'))) {
+			buf[--len] = '\0';
+		}
+
+		if ((len == 0) || (buf[0] == '#')) {
+			continue;
+		}
+
+		phrases = irc_realloc(phrases,
+				      (num_phrases + 1) * sizeof(*phrases));
+		phrases[num_phrases] = irc_malloc(len + 1);
+		memcpy(phrases[num_phrases++], buf, len + 1);
+	}
+	fclose(file);
+
+	struct irc_filter *filter = NULL;
+
+	if (ok) {
+		filter = irc_filter_new((const char *const *)phrases,
+					num_phrases);
+	}
+
+	for (size_t i = 0; i < num_phrases; ++i) {
+		free(phrases[i]);
+	}
+	free(phrases);
+
+	return filter;
+}
+
+void irc_filter_free(struct irc_filter *const filter)
+{
+	if (!filter) {
+		return;
+	}
+	free(filter->delta);
+	free(filter->out);
+	free(filter);
+}
+
+void irc_filter_swap(_Atomic(struct irc_filter *) *const cur,
+		     struct irc_filter *const filter)
+{
+	irc_filter_free(atomic_exchange_explicit(cur, filter,
+						 memory_order_acq_rel));
+}
@@ -57,6 +57,7 @@
 #include <string.h>
 
 #include "core/hash_table.h"
+#include "core/trace.h"
 #include "core/types.h"
 #include "core/util.h"
 
@@ -73,11 +74,12 @@ static void secret_key_gen(u8 *const buf)
 #endif
 }
 
-static size_t hash_key(struct irc_ht *const ht, void *key)
+size_t irc_ht_hash_bytes(const void *const data, const size_t len,
+			 const u8 *const secret_key)
 {
 	u8 res[SIPHASH_OUT_LEN] = {};
 
-	siphash(key, 0, ht->secret_key, res, SIPHASH_OUT_LEN);
+	siphash(data, len, secret_key, res, SIPHASH_OUT_LEN);
 
 	size_t val = 0;
 	memcpy(&val, res, SIPHASH_OUT_LEN);
@@ -85,44 +87,188 @@ static size_t hash_key(struct irc_ht *const ht, void *key)
 	return val;
 }
 
+static size_t hash_key(const struct irc_ht *const ht, const void *const key)
+{
+	if (ht->conf.hash) {
+		return ht->conf.hash(key, ht->secret_key);
+	}
+	return irc_ht_hash_bytes(&key, sizeof(key), ht->secret_key);
+}
+
+static bool key_eq(const struct irc_ht *const ht, const void *const key_a,
+		   const void *const key_b)
+{
+	if (ht->conf.eq) {
+		return ht->conf.eq(key_a, key_b);
+	}
+	return key_a == key_b;
+}
+
+/// @brief Places an entry known not to be present in the table, displacing
+/// richer entries along the way.
+static void entry_place(struct irc_ht *const ht, struct irc_ht_entry ent)
+{
+	const size_t mask = ht->capacity - 1;
+	size_t pos = hash_key(ht, ent.key) & mask;
+
+	ent.psl = 1;
+
+	for (;; pos = (pos + 1) & mask) {
+		struct irc_ht_entry *slot = &ht->entries[pos];
+
+		if (!slot->psl) {
+			*slot = ent;
+			return;
+		}
+
+		// Robin hood: the entry that is further away from its home
+		// slot keeps the spot.
+		if (slot->psl < ent.psl) {
+			IRC_SWAP(*slot, ent);
+		}
+		ent.psl++;
+	}
+}
+
+/// @brief Allocates empty entries.
+static void entries_alloc(struct irc_ht *const ht, const size_t capacity)
+{
+	irc_vmem_alloc(&ht->mem, capacity * sizeof(struct irc_ht_entry),
+		       ht->conf.vmem);
+
+	ht->entries = ht->mem.ptr;
+	ht->capacity = capacity;
+}
+
+static void resize(struct irc_ht *const ht, const size_t capacity)
+{
+	struct irc_ht_entry *old = ht->entries;
+	struct irc_vmem old_mem = ht->mem;
+	const size_t old_capacity = ht->capacity;
+
+	IRC_TRACE(ht_resize, ht, old_capacity, capacity);
+
+	entries_alloc(ht, capacity);
+
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old[i].psl) {
+			entry_place(ht, old[i]);
+		}
+	}
+	irc_vmem_free(&old_mem);
+}
+
+/// @brief Finds the slot holding a key.
+///
+/// @returns The index of the slot, or `capacity` if the key is not present.
+static size_t slot_find(const struct irc_ht *const ht, const void *const key)
+{
+	const size_t mask = ht->capacity - 1;
+	size_t pos = hash_key(ht, key) & mask;
+
+	for (uint psl = 1;; ++psl, pos = (pos + 1) & mask) {
+		const struct irc_ht_entry *slot = &ht->entries[pos];
+
+		// Had the key been present, it would have displaced this
+		// entry.
+		if (slot->psl < psl) {
+			return ht->capacity;
+		}
+
+		if (key_eq(ht, slot->key, key)) {
+			return pos;
+		}
+	}
+}
+
 void irc_ht_init(struct irc_ht *const ht, const struct irc_ht_conf *const conf)
 {
 	assert(ht != NULL);
 	assert(conf != NULL);
 	assert(IRC_IS_POW2(conf->initial_capacity));
 
-	ht->entries =
-		irc_calloc(conf->initial_capacity, sizeof(struct irc_ht_entry));
-
-	ht->capacity = conf->initial_capacity;
 	ht->conf = *conf;
+	entries_alloc(ht, conf->initial_capacity);
 
 	ht->num_entries = 0;
 
 	secret_key_gen(ht->secret_key);
 }
 
+void irc_ht_destroy(struct irc_ht *const ht)
+{
+	irc_vmem_free(&ht->mem);
+	ht->entries = NULL;
+	ht->capacity = 0;
+	ht->num_entries = 0;
+}
+
 void irc_ht_add(struct irc_ht *const ht, void *const key, void *const val)
 {
-	const size_t hash = hash_key(ht, key) & (ht->capacity - 1);
-
-	if (!ht->entries[hash].key) {
-		ht->entries[hash].key = key;
-		ht->entries[hash].val = val;
-		ht->entries[hash].psl = 0;
-	} else {
-		// Handle collision here.
-		;
+	const size_t pos = slot_find(ht, key);
+
+	if (pos != ht->capacity) {
+		ht->entries[pos].val = val;
+		return;
+	}
+
+	if (((ht->num_entries + 1) * 100) >
+	    (ht->capacity * ht->conf.load_fact_max)) {
+		resize(ht, ht->capacity * 2);
 	}
+
+	entry_place(ht, (struct irc_ht_entry){ .key = key, .val = val });
 	ht->num_entries++;
 }
 
-void *irc_ht_get(struct irc_ht *const ht, void *const key)
+void irc_ht_reserve(struct irc_ht *const ht, const size_t num_entries)
 {
-	const size_t hash = hash_key(ht, key) & (ht->capacity - 1);
+	size_t capacity = ht->capacity;
+
+	while ((num_entries * 100) > (capacity * ht->conf.load_fact_max)) {
+		capacity *= 2;
+	}
 
-	if (ht->entries[hash].key) {
-		return ht->entries[hash].val;
+	if (capacity != ht->capacity) {
+		resize(ht, capacity);
+	}
+}
+
+void *irc_ht_get(struct irc_ht *const ht, const void *const key)
+{
+	const size_t pos = slot_find(ht, key);
+
+	if (pos != ht->capacity) {
+		return ht->entries[pos].val;
 	}
 	return NULL;
 }
+
+void *irc_ht_del(struct irc_ht *const ht, const void *const key)
+{
+	size_t pos = slot_find(ht, key);
+
+	if (pos == ht->capacity) {
+		return NULL;
+	}
+
+	void *val = ht->entries[pos].val;
+	const size_t mask = ht->capacity - 1;
+
+	// Backward shift deletion: pull the following entries one slot closer
+	// to home until one is already there, so no tombstones are needed.
+	for (;;) {
+		const size_t next = (pos + 1) & mask;
+
+		if (ht->entries[next].psl <= 1) {
+			ht->entries[pos] = (struct irc_ht_entry){};
+			break;
+		}
+		ht->entries[pos] = ht->entries[next];
+		ht->entries[pos].psl--;
+		pos = next;
+	}
+	ht->num_entries--;
+
+	return val;
+}
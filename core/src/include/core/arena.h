@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file arena.h Defines a bump pointer allocator for the temporaries of an
+/// I/O loop iteration.
+///
+/// * Memory is carved out of large chunks by moving an offset along the
+///   current one. Allocations are never freed one by one: the whole arena is
+///   reset at the end of every iteration, and everything allocated during it
+///   is gone at once.
+///
+/// * A chunk that runs out is followed by a new one, at least twice as large.
+///   On reset, the chunks are folded back into a single one big enough for
+///   what the iteration used, up to @ref IRC_ARENA_RETAIN_MAX, so that steady
+///   state allocation never touches the system allocator.
+///
+/// * Scopes mark a point in the arena that can be returned to before the end
+///   of the iteration, freeing everything allocated since, for temporaries
+///   of a loop that would otherwise pile up.
+///
+/// * The arena keeps the most it has held at once (the high-water mark), and
+///   the number of chunks it has had to allocate, which should stay flat.
+///
+/// An arena belongs to a single thread.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stddef.h>
+
+#include "compiler.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The alignment of every allocation.
+#define IRC_ARENA_ALIGN         (_Alignof(max_align_t))
+
+/// @brief The size of the first chunk of an arena.
+#define IRC_ARENA_CHUNK_SIZE    (64 * 1024)
+
+/// @brief The largest chunk kept across resets. Iterations that need more
+/// allocate the rest anew.
+#define IRC_ARENA_RETAIN_MAX    (4 * 1024 * 1024)
+
+// clang-format on
+
+struct irc_arena_chunk;
+
+/// @brief A bump pointer allocator.
+struct irc_arena {
+	/// @brief The chunk being allocated from.
+	struct irc_arena_chunk *chunk;
+
+	/// @brief The memory of @ref chunk, its size, and the offset of the
+	/// next allocation in it.
+	char *base;
+	size_t size;
+	size_t pos;
+
+	/// @brief The number of bytes allocated from the chunks before
+	/// @ref chunk since the last reset.
+	size_t used_before;
+
+	/// @brief The most bytes allocated between two resets.
+	size_t high_water;
+
+	/// @brief The total size of the chunks.
+	size_t capacity;
+
+	/// @brief The number of chunks allocated so far.
+	u64 num_chunk_allocs;
+};
+
+/// @brief A point in an arena to return to; see @ref irc_arena_scope_begin().
+struct irc_arena_scope {
+	struct irc_arena_chunk *chunk;
+	size_t pos;
+	size_t used_before;
+};
+
+/// @brief Initializes an empty arena, with a chunk of
+/// @ref IRC_ARENA_CHUNK_SIZE bytes.
+void irc_arena_init(struct irc_arena *arena);
+
+/// @brief Frees the chunks of an arena.
+void irc_arena_destroy(struct irc_arena *arena);
+
+/// @brief Allocates from a new chunk; see @ref irc_arena_alloc().
+///
+/// @param size The size of the allocation, aligned.
+void *irc_arena_alloc_slow(struct irc_arena *arena, size_t size);
+
+/// @brief Rounds a size up to the alignment of allocations.
+static inline size_t irc_arena_align(const size_t size)
+{
+	return (size + (IRC_ARENA_ALIGN - 1)) & ~(IRC_ARENA_ALIGN - 1);
+}
+
+/// @brief Returns the number of bytes allocated since the last reset.
+static inline size_t irc_arena_used(const struct irc_arena *const arena)
+{
+	return arena->used_before + arena->pos;
+}
+
+/// @brief Allocates memory that lasts until the arena is reset, or the scope
+/// it is allocated in ends. Never fails.
+static inline void *irc_arena_alloc(struct irc_arena *const arena,
+				    const size_t size)
+{
+	const size_t aligned = irc_arena_align(size);
+
+	if (IRC_UNLIKELY(aligned > (arena->size - arena->pos))) {
+		return irc_arena_alloc_slow(arena, aligned);
+	}
+	void *ptr = &arena->base[arena->pos];
+
+	arena->pos += aligned;
+	return ptr;
+}
+
+/// @brief Resizes the most recent allocation of an arena, in place if the
+/// chunk has room; any other allocation is copied to a new one.
+///
+/// @param ptr The allocation, or `NULL` to make a new one.
+/// @param size The size it was allocated with.
+void *irc_arena_grow(struct irc_arena *arena, void *ptr, size_t size,
+		     size_t new_size);
+
+/// @brief Marks the point in an arena that @ref irc_arena_scope_end() returns
+/// to.
+void irc_arena_scope_begin(const struct irc_arena *arena,
+			   struct irc_arena_scope *scope);
+
+/// @brief Frees everything allocated from an arena since a scope began.
+/// Scopes nest, and must end in the reverse order they began in.
+void irc_arena_scope_end(struct irc_arena *arena,
+			 const struct irc_arena_scope *scope);
+
+/// @brief Frees everything allocated from an arena.
+void irc_arena_reset(struct irc_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file bcast.h Defines the broadcast of a message to many users.
+///
+/// A broadcast serializes its message once per variant, rather than once per
+/// recipient, and queues the same buffer by reference to every recipient
+/// needing that variant. Recipients only need different variants where they
+/// differ in what they can parse, i.e. in their enabled capabilities.
+///
+///     struct irc_bcast bc;
+///
+///     irc_bcast_init(&bc, ":%s PRIVMSG %s :%s", src, target, text);
+///     irc_bcast_chan(ctx, &bc, chan, sender);
+///     irc_bcast_done(&bc);
+///
+/// A broadcast to a channel with more members than the fanout budget of an
+/// I/O loop iteration is not delivered at once. It is deferred to the backlog
+/// of the channel instead, and delivered in chunks of at most the budget at
+/// the end of this and later iterations, so that a huge channel can not stall
+/// every other user. Broadcasts to a channel with a backlog are deferred
+/// behind it, which keeps the messages of a channel in order.
+///
+/// A deferred broadcast reaches the members of the channel at the time it was
+/// deferred, minus the ones that leave before it reaches them.
+///
+/// Broadcasts about a user to everyone sharing a channel with it, like QUIT
+/// and NICK, have to reach every such user exactly once. Rather than building
+/// a set of recipients, every such broadcast takes a new epoch, and stamps
+/// each user it reaches at once with it; a user already carrying the epoch has
+/// been reached through another channel. In the channels that defer it, such a
+/// broadcast is queued like any other, so that it stays in order with the
+/// messages of the channel. As the epochs of the users move on meanwhile, its
+/// deferred parts share the channels it was sent in instead, and reach each
+/// user through one of them only: a channel it was sent at once in, if any, or
+/// else the first of them in the order of their addresses. Memberships
+/// remember the epoch they started at, so that channels joined since do not
+/// count. A user that leaves that channel before the broadcast reaches it
+/// there is not reached through another.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "buf.h"
+#include "compiler.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief Without message tags.
+#define IRC_BCAST_VARIANT_PLAIN         (0)
+
+/// @brief With the `time` tag of the `server-time` capability.
+#define IRC_BCAST_VARIANT_TIME          (1)
+
+#define IRC_BCAST_VARIANT_NUM           (2)
+
+// clang-format on
+
+struct irc_chan;
+struct irc_ctx;
+struct irc_user;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_bcast {
+	/// @brief The buffer of each variant, built when first needed.
+	struct irc_buf *variants[IRC_BCAST_VARIANT_NUM];
+
+	/// @brief The time the message was sent, for the `time` tag.
+	struct timespec ts;
+};
+
+/// @brief A channel a broadcast to the common channels of a user was sent in.
+struct irc_bcast_scope_chan {
+	/// @brief The channel, which may be gone by now. It is only ever
+	/// compared with the channels of memberships older than the broadcast,
+	/// which were around when it was sent.
+	const struct irc_chan *chan;
+
+	/// @brief Set if the broadcast was deferred in the channel, rather
+	/// than sent at once.
+	bool deferred;
+};
+
+/// @brief The channels a broadcast to the common channels of a user was sent
+/// in, shared by the parts of it deferred to several channels.
+struct irc_bcast_scope {
+	/// @brief The epoch of the broadcast.
+	u64 epoch;
+
+	/// @brief The number of deferred parts still holding the scope.
+	u32 refs;
+
+	u32 num_chans;
+
+	/// @brief The channels, ordered by address.
+	struct irc_bcast_scope_chan chans[];
+};
+
+/// @brief A broadcast deferred to the backlog of a channel.
+struct irc_fanout {
+	struct irc_fanout *next;
+	struct irc_bcast bc;
+
+	/// @brief The member not to deliver to, or `NULL`.
+	const struct irc_user *except;
+
+	/// @brief The channels a broadcast to the common channels of a user
+	/// was sent in, or `NULL` for a broadcast to the channel only.
+	struct irc_bcast_scope *scope;
+
+	/// @brief The bits of the channels of @ref scope other than this one,
+	/// by `irc_chan_bit()`.
+	u64 scope_bits;
+
+	/// @brief The number of members to deliver to, i.e. the members
+	/// before this index. Members joining later are appended past it.
+	u32 num_members;
+
+	/// @brief If not 0, only members with this @ref irc_user_cap enabled
+	/// are delivered to.
+	u8 cap;
+};
+
+#pragma GCC diagnostic pop
+
+struct irc_chans;
+
+/// @brief Starts a broadcast, formatting its message once.
+void irc_bcast_init(struct irc_bcast *bc, const char *fmt, ...)
+	IRC_ATTRIB_FMT(printf, 2, 3);
+
+/// @brief Sends the message to a single user.
+void irc_bcast_user(struct irc_ctx *ctx, struct irc_bcast *bc,
+		    struct irc_user *user);
+
+/// @brief Sends the message to every member of a channel, deferring it if the
+/// channel is too large or already has a backlog.
+///
+/// @param except A member not to send the message to, or `NULL`.
+void irc_bcast_chan(struct irc_ctx *ctx, struct irc_bcast *bc,
+		    struct irc_chan *chan, const struct irc_user *except);
+
+/// @brief Sends the message to every user sharing at least one channel with a
+/// user, once each, deferring it in the channels that would defer a channel
+/// broadcast. The user itself is not sent to.
+///
+/// @param cap If not 0, only users with this @ref irc_user_cap enabled are
+/// sent to.
+void irc_bcast_common(struct irc_ctx *ctx, struct irc_bcast *bc,
+		      struct irc_user *user, u8 cap);
+
+/// @brief Ends a broadcast, dropping its references to the buffers. The
+/// buffers live on in the send queues of the recipients.
+void irc_bcast_done(struct irc_bcast *bc);
+
+/// @brief Delivers deferred broadcasts to at most the fanout budget of
+/// recipients, serving the channels with a backlog in turn.
+void irc_bcast_backlog_run(struct irc_ctx *ctx);
+
+/// @brief Lets the backlog of a channel know that a user is leaving it.
+void irc_bcast_backlog_part(struct irc_chan *chan,
+			    const struct irc_user *user);
+
+/// @brief Drops the backlog of a channel that is being destroyed.
+void irc_bcast_backlog_drop(struct irc_chans *chans, struct irc_chan *chan);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file buf.h Defines immutable, reference counted output buffers.
+///
+/// A line sent to many users is serialized once into a buffer, and the same
+/// buffer is queued by reference to every recipient. The buffer is freed once
+/// the last recipient has written it out. Buffers are only ever touched by the
+/// I/O thread, so the reference count is not atomic.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include "compiler.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The maximum length of a line, including its terminator, excluding
+/// any message tags.
+#define IRC_BUF_LINE_LEN_MAX    (512)
+
+// clang-format on
+
+struct irc_buf {
+	/// @brief The number of references to this buffer.
+	u32 refs;
+
+	/// @brief The number of bytes in @ref data.
+	u32 len;
+
+	/// @brief The number of bytes allocated for @ref data.
+	u32 size;
+
+	char data[];
+};
+
+/// @brief Allocates a buffer with a single reference.
+///
+/// @param len The number of bytes the buffer holds. The caller fills in
+/// @ref irc_buf::data.
+struct irc_buf *irc_buf_new(size_t len);
+
+/// @brief Formats a single line into a new buffer with a single reference.
+/// The line terminator is appended, and the line is truncated if it is too
+/// long.
+///
+/// @param tags The message tags to prefix the line with, without the leading
+/// `@`, or `NULL`.
+struct irc_buf *irc_buf_fmt(const char *tags, const char *fmt, ...)
+	IRC_ATTRIB_FMT(printf, 2, 3);
+
+/// @brief Like @ref irc_buf_fmt(), but takes a `va_list`.
+struct irc_buf *irc_buf_vfmt(const char *tags, const char *fmt, va_list args)
+	IRC_ATTRIB_FMT(printf, 2, 0);
+
+/// @brief Takes another reference to a buffer.
+static inline struct irc_buf *irc_buf_ref(struct irc_buf *const buf)
+{
+	buf->refs++;
+	return buf;
+}
+
+/// @brief Drops a reference to a buffer, freeing it if it was the last one.
+void irc_buf_unref(struct irc_buf *buf);
+
+/// @brief Moves the contents of a buffer with a single reference into a new
+/// one no larger than they are, if that saves memory.
+///
+/// @returns The buffer holding the contents, which replaces the one given.
+struct irc_buf *irc_buf_shrink(struct irc_buf *buf);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file casemap.h Defines the case mapping of nicknames and channel names.
+///
+/// Names are compared with the `rfc1459` case mapping, under which `[]\~` are
+/// the upper case equivalents of `{}|^`, in addition to ASCII letters.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "compiler.h"
+#include "types.h"
+
+/// @brief Maps every character to its lower case equivalent.
+extern const u8 irc_casemap_lower_tbl[256];
+
+/// @brief Returns the lower case equivalent of a character.
+static inline char irc_casemap_lower(const char c)
+{
+	return (char)irc_casemap_lower_tbl[(u8)c];
+}
+
+/// @brief Returns `true` if two names are equal under the case mapping.
+bool irc_casemap_eq(const char *a, const char *b) IRC_ATTRIB_PURE;
+
+/// @brief Compares two names under the case mapping, like `strcmp()`.
+int irc_casemap_cmp(const char *a, const char *b) IRC_ATTRIB_PURE;
+
+/// @brief Returns `true` if a name matches a mask under the case mapping. In
+/// the mask, `*` matches any run of characters and `?` any one character.
+bool irc_casemap_match(const char *mask, const char *name) IRC_ATTRIB_PURE;
+
+/// @brief Hashes a name such that names equal under the case mapping hash to
+/// the same value; for use as an @ref irc_ht_hash_cb.
+size_t irc_casemap_ht_hash(const void *key, const u8 *secret_key);
+
+/// @brief Compares two names under the case mapping; for use as an
+/// @ref irc_ht_eq_cb.
+bool irc_casemap_ht_eq(const void *key_a, const void *key_b) IRC_ATTRIB_PURE;
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,370 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file chan.h Defines channels and their memberships.
+///
+/// * Channels are found by their case mapped name through a hash table.
+///
+/// * A membership is a record shared by a channel and a user. The channel
+///   holds its members, and the user holds its channels, in dense arrays of
+///   pointers to these records. Every record knows its index in both arrays,
+///   so that it can be removed from either by moving the last entry into its
+///   place, in constant time.
+///
+/// * Whether a user is in a channel is answered by a hash table keyed by the
+///   (user, channel) pair, rather than by searching either array.
+///
+/// * Prefix modes are stored in the membership record itself.
+///
+/// * Ban and ban exception masks are kept in compiled sets; see mask.h.
+///   Whether a member is banned is cached in its membership record, along
+///   with a generation of the channel's masks that any change to them bumps.
+///
+/// * The names listed by NAMES replies are cached per channel, rendered once
+///   into buffers shared by every reply. The members are split into runs of
+///   consecutive members, each rendered into the body of one reply line. A
+///   change to the members only renders the runs it touches again, the next
+///   time the names are needed.
+///
+/// * Channels are also kept ordered by name, and by member count, in two
+///   treaps that LIST replies are served from. A listing remembers the key
+///   of the last channel it reached, rather than the channel, and carries on
+///   from the next key; channels may come and go in the meantime.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+
+#include "buf.h"
+#include "hash_table.h"
+#include "mask.h"
+#include "treap.h"
+#include "types.h"
+#include "user.h"
+
+// clang-format off
+
+/// @brief The maximum length of a channel name, including its prefix.
+#define IRC_CHAN_NAME_LEN_MAX   (50)
+
+// clang-format on
+
+/// @brief The prefix modes of a channel member.
+enum irc_member_prefix {
+	// clang-format off
+
+	/// @brief The member may speak in a moderated channel.
+	IRC_MEMBER_VOICE	= 1 << 0,
+
+	/// @brief The member is a channel operator.
+	IRC_MEMBER_OP		= 1 << 1
+
+	// clang-format on
+};
+
+/// @brief The lists of masks of a channel.
+enum irc_chan_masks {
+	// clang-format off
+
+	/// @brief Users matching a ban may not join or speak.
+	IRC_CHAN_BANS		= 0,
+
+	/// @brief Users matching an exception are not banned.
+	IRC_CHAN_EXCEPTS	= 1,
+
+	IRC_CHAN_MASKS_NUM	= 2
+
+	// clang-format on
+};
+
+struct irc_chan;
+struct irc_fanout;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_member {
+	struct irc_user *user;
+	struct irc_chan *chan;
+
+	/// @brief The index of this record in the members of @ref chan.
+	u32 chan_idx;
+
+	/// @brief The index of this record in the channels of @ref user.
+	u32 user_idx;
+
+	/// @brief The value of @ref irc_chan::masks_gen @ref banned was found
+	/// for, or 0 if it has to be found again.
+	u32 masks_gen;
+
+	/// @brief Whether the member is banned; see @ref irc_member_banned().
+	bool banned;
+
+	/// @brief A bit mask of @ref irc_member_prefix values.
+	u8 prefix;
+
+	/// @brief The value of @ref irc_chans::bcast_epoch when the user
+	/// joined. Broadcasts to common channels of an older epoch do not
+	/// count the membership; see bcast.h.
+	u64 joined_epoch;
+};
+
+/// @brief The key of a channel in the order by member count. Channels with as
+/// many members are ordered by when they were created.
+struct irc_chan_size_key {
+	u32 num_members;
+	u64 id;
+};
+
+/// @brief A run of consecutive members of a channel, rendered as the body of a
+/// NAMES reply line.
+struct irc_names_seg {
+	/// @brief The index of the first member of the run.
+	u32 start;
+
+	/// @brief The index past the last member of the run.
+	u32 end;
+
+	/// @brief The prefixed nicknames of the members, space separated and
+	/// followed by the line terminator; or `NULL` if they have to be
+	/// rendered again.
+	struct irc_buf *buf;
+};
+
+/// @brief The runs covering every member of a channel, in order.
+struct irc_names {
+	struct irc_names_seg *segs;
+	u32 num_segs;
+	u32 capacity;
+};
+
+struct irc_chan {
+	char name[IRC_CHAN_NAME_LEN_MAX + 1];
+
+	/// @brief The members of the channel.
+	struct irc_member_list members;
+
+	/// @brief The number of members connected to this server. Channels
+	/// without any are only known to keep the network in sync, and
+	/// nothing has to be delivered in them.
+	u32 num_local;
+
+	/// @brief The cached names of the members; see @ref irc_chan_names().
+	struct irc_names names;
+
+	/// @brief When the channel was created, in seconds since the epoch.
+	u64 created;
+
+	/// @brief The lists of masks, by @ref irc_chan_masks; `NULL` while
+	/// empty.
+	struct irc_mask_set *masks[IRC_CHAN_MASKS_NUM];
+
+	/// @brief Bumped whenever @ref masks change, which invalidates the ban
+	/// state cached by the members. Never 0.
+	u32 masks_gen;
+
+	/// @brief The nodes of the channel in the orders of @ref irc_chans.
+	struct {
+		struct irc_treap_node by_name;
+		struct irc_treap_node by_size;
+
+		/// @brief The key of @ref by_size, updated as members join
+		/// and leave.
+		struct irc_chan_size_key size_key;
+	} sorted;
+
+	/// @brief Broadcasts to the channel deferred to later I/O loop
+	/// iterations; see bcast.h.
+	struct {
+		/// @brief The oldest broadcast, which is being delivered.
+		struct irc_fanout *head;
+
+		/// @brief The newest broadcast.
+		struct irc_fanout *tail;
+
+		/// @brief The number of broadcasts.
+		u32 num_entries;
+
+		/// @brief The number of members @ref head is still to be
+		/// delivered to. They are the members before this index;
+		/// delivery walks down to 0.
+		u32 remaining;
+
+		/// @brief Links the channel into the channels with a backlog.
+		struct irc_chan *prev;
+		struct irc_chan *next;
+	} backlog;
+};
+
+/// @brief The channels of an IRC server context.
+struct irc_chans {
+	/// @brief Maps case mapped names to channels.
+	struct irc_ht by_name;
+
+	/// @brief Holds every membership, keyed by its (user, channel) pair.
+	struct irc_ht members;
+
+	/// @brief The channels in order, for LIST replies.
+	struct {
+		/// @brief Ordered by name, under the case mapping.
+		struct irc_treap by_name;
+
+		/// @brief Ordered by @ref irc_chan_size_key.
+		struct irc_treap by_size;
+	} sorted;
+
+	/// @brief The identifier given to the next channel created.
+	u64 next_id;
+
+	/// @brief The epoch of the last broadcast to common channels; see
+	/// @ref irc_bcast_common().
+	u64 bcast_epoch;
+
+	/// @brief The channels with deferred broadcasts, in the order they are
+	/// served in.
+	struct {
+		struct irc_chan *head;
+		struct irc_chan *tail;
+	} backlog;
+};
+
+#pragma GCC diagnostic pop
+
+void irc_chans_init(struct irc_chans *chans);
+
+/// @brief Parts every member of every channel, which destroys them, and frees
+/// the tables. The users are left alone, but for their memberships.
+void irc_chans_destroy(struct irc_chans *chans);
+
+/// @brief Returns `true` if a channel name is well formed.
+bool irc_chan_name_valid(const char *name) IRC_ATTRIB_PURE;
+
+/// @brief Returns the channel with the given name, or `NULL` if it does not
+/// exist.
+struct irc_chan *irc_chan_find(struct irc_chans *chans, const char *name);
+
+/// @brief Creates an empty channel. The name must be valid, and not in use.
+struct irc_chan *irc_chan_create(struct irc_chans *chans, const char *name);
+
+/// @brief Destroys a channel without members, such as one created for a user
+/// who turned out not to be allowed in.
+void irc_chan_destroy(struct irc_chans *chans, struct irc_chan *chan);
+
+/// @brief Returns the membership of a user in a channel, or `NULL` if the user
+/// is not in the channel.
+struct irc_member *irc_chan_member_find(struct irc_chans *chans,
+					struct irc_chan *chan,
+					struct irc_user *user);
+
+/// @brief Adds a user to a channel. The user must not be in the channel.
+///
+/// @param prefix The prefix modes the user joins with.
+struct irc_member *irc_chan_join(struct irc_chans *chans, struct irc_chan *chan,
+				 struct irc_user *user, u8 prefix);
+
+/// @brief Removes a user from a channel. The channel is destroyed once its
+/// last member leaves.
+void irc_chan_part(struct irc_chans *chans, struct irc_member *member);
+
+/// @brief Removes a user from every channel it is in.
+void irc_chan_part_all(struct irc_chans *chans, struct irc_user *user);
+
+/// @brief Adds a normalized mask to a list of a channel.
+///
+/// @param setter The nickname of whoever added it.
+///
+/// @returns The entry of the mask, or `NULL` if it was already in the list.
+const struct irc_mask_entry *irc_chan_mask_add(struct irc_chan *chan,
+					       enum irc_chan_masks list,
+					       const char *mask,
+					       const char *setter);
+
+/// @brief Removes a normalized mask from a list of a channel.
+///
+/// @returns `false` if the mask was not in the list.
+bool irc_chan_mask_del(struct irc_chan *chan, enum irc_chan_masks list,
+		       const char *mask);
+
+/// @brief Empties every list of masks of a channel.
+void irc_chan_masks_clear(struct irc_chan *chan);
+
+/// @brief Returns `true` if a user matches a ban of a channel, and none of its
+/// exceptions.
+bool irc_chan_user_banned(struct irc_chan *chan, const struct irc_user *user);
+
+/// @brief Like @ref irc_chan_user_banned() for a member, answered from the
+/// member's cached state while the masks of the channel do not change.
+bool irc_member_banned(struct irc_member *member);
+
+/// @brief Has whether a member is banned found again, e.g. after its nickname
+/// changes.
+void irc_member_bans_invalidate(struct irc_member *member);
+
+/// @brief Returns the first channel, in the order by name, whose name is not
+/// before a name; or after it, if @p after is set. Returns `NULL` if there is
+/// none.
+struct irc_chan *irc_chan_seek_name(const struct irc_chans *chans,
+				    const char *name, bool after);
+
+/// @brief Like @ref irc_chan_seek_name(), in the order by member count.
+struct irc_chan *irc_chan_seek_size(const struct irc_chans *chans,
+				    const struct irc_chan_size_key *key,
+				    bool after);
+
+/// @brief Returns the channel following a channel in the order by name, or
+/// `NULL` if it is the last.
+struct irc_chan *irc_chan_next_name(const struct irc_chan *chan)
+	IRC_ATTRIB_PURE;
+
+/// @brief Returns the channel following a channel in the order by member
+/// count, or `NULL` if it is the last.
+struct irc_chan *irc_chan_next_size(const struct irc_chan *chan)
+	IRC_ATTRIB_PURE;
+
+/// @brief Returns the names of the members of a channel for NAMES replies,
+/// rendering whatever changed since they were last needed. The buffers of
+/// the runs can be queued by reference; they are never modified.
+const struct irc_names *irc_chan_names(struct irc_chan *chan);
+
+/// @brief Has the name of a member rendered again, e.g. after its nickname or
+/// prefix modes change.
+void irc_chan_names_invalidate(struct irc_member *member);
+
+/// @brief Returns the character shown in front of a member's nickname for its
+/// highest prefix mode, or `'\0'` if it has none.
+char irc_member_prefix_char(u8 prefix) IRC_ATTRIB_CONST;
+
+/// @brief Returns the bit standing for a channel in a set of channels too
+/// large to hold exactly, e.g. in @ref irc_user::chan_bits.
+static inline u64 irc_chan_bit(const struct irc_chan *const chan)
+{
+	return UINT64_C(1) << (chan->sorted.size_key.id & 63);
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file cidr.h Defines a longest prefix match tree of IPv4 and IPv6 networks,
+/// as used by D-lines.
+///
+/// * IPv4 addresses are mapped into the IPv6 address space as
+///   `::ffff:0:0/96`, so a single tree holds networks of both families.
+///
+/// * The tree is a binary trie with path compression: every node holds a
+///   whole prefix and branches on the bit that follows it, so a lookup visits
+///   at most one node per bit of the longest prefix it could match, and far
+///   fewer in practice.
+///
+/// * The first @ref IRC_CIDR_STRIDE_BITS bits of IPv4 addresses, and the first
+///   @ref IRC_CIDR_IPV6_INDEX_BITS bits of IPv6 addresses folded to the same
+///   width, index tables of subtrees directly, so the upper levels of a large
+///   tree, which would cost a cache miss each, are skipped. Only networks
+///   shorter than that live in a tree of their own, and are looked up last.
+///
+/// * Nodes are carved out of large slabs and only freed with the tree, which
+///   keeps loading hundreds of thousands of networks cheap.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "compiler.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The number of bits of an address.
+#define IRC_CIDR_ADDR_BITS      (128)
+
+/// @brief The number of bits of the prefix IPv4 addresses are mapped under.
+#define IRC_CIDR_IPV4_OFFSET    (96)
+
+/// @brief The maximum length of a network in text form, such as
+/// `ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255/128`.
+#define IRC_CIDR_LEN_MAX        (49)
+
+/// @brief The number of leading bits of an address indexing the tables of
+/// subtrees.
+#define IRC_CIDR_STRIDE_BITS    (16)
+
+/// @brief The number of leading bits of IPv6 addresses folded into an index.
+/// This is the smallest allocation usually made to a provider, so that the
+/// networks of different providers are spread over the table.
+#define IRC_CIDR_IPV6_INDEX_BITS        (32)
+
+// clang-format on
+
+/// @brief An IPv6 address, or an IPv4 address mapped into IPv6, as two
+/// integers in host byte order.
+struct irc_cidr_addr {
+	/// @brief The most significant 64 bits.
+	u64 hi;
+
+	/// @brief The least significant 64 bits.
+	u64 lo;
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_cidr_node {
+	/// @brief The prefix of every address below the node, with the bits
+	/// past @ref len cleared.
+	struct irc_cidr_addr prefix;
+
+	/// @brief The subtrees whose next bit after the prefix is 0 and 1.
+	struct irc_cidr_node *child[2];
+
+	/// @brief The length of the prefix, in bits.
+	u8 len;
+
+	/// @brief Whether the prefix is a network of the set, rather than
+	/// only the point two networks branch at.
+	bool present;
+};
+
+#pragma GCC diagnostic pop
+
+struct irc_cidr_slab;
+
+struct irc_cidr_tree {
+	/// @brief The networks too short to be indexed.
+	struct irc_cidr_node *root;
+
+	/// @brief The subtrees of IPv4 networks at least
+	/// @ref IRC_CIDR_STRIDE_BITS long and IPv6 networks at least
+	/// @ref IRC_CIDR_IPV6_INDEX_BITS long, indexed by their leading bits,
+	/// or `NULL` until there is one.
+	struct irc_cidr_node **ipv4_roots;
+	struct irc_cidr_node **ipv6_roots;
+
+	/// @brief The slabs nodes are allocated from, the newest first.
+	struct irc_cidr_slab *slabs;
+
+	/// @brief The number of nodes used in the newest slab.
+	size_t slab_used;
+
+	/// @brief The number of networks in the tree.
+	size_t num_entries;
+};
+
+/// @brief Parses an address with an optional prefix length, such as
+/// `192.0.2.0/24`, `2001:db8::/32` or `198.51.100.7`.
+///
+/// @param str The text to parse.
+/// @param addr Set to the address, with the bits past the prefix cleared.
+/// @param len Set to the prefix length, counted from the start of the mapped
+/// address for IPv4.
+///
+/// @returns `false` if the text is malformed, or `true` otherwise.
+bool irc_cidr_parse(const char *str, struct irc_cidr_addr *addr, uint *len);
+
+/// @brief Converts a socket address.
+/// @returns `false` if it is neither an IPv4 nor an IPv6 address, or `true`
+/// otherwise.
+bool irc_cidr_from_sockaddr(const struct sockaddr *sa,
+			    struct irc_cidr_addr *addr);
+
+/// @brief Checks whether an address is an IPv4 address mapped into IPv6.
+bool irc_cidr_is_ipv4(const struct irc_cidr_addr *addr) IRC_ATTRIB_PURE;
+
+/// @brief Clears the bits of an address past a prefix length.
+void irc_cidr_mask(struct irc_cidr_addr *addr, uint len);
+
+/// @brief Adds a network to a tree.
+/// @returns `false` if it was already present, or `true` otherwise.
+bool irc_cidr_add(struct irc_cidr_tree *tree, const struct irc_cidr_addr *addr,
+		  uint len);
+
+/// @brief Looks up the longest network of a tree containing an address.
+///
+/// @param tree The tree.
+/// @param addr The address.
+/// @param len If not `NULL`, set to the prefix length of the network found.
+///
+/// @returns `true` if a network contains the address, or `false` otherwise.
+bool irc_cidr_match(const struct irc_cidr_tree *tree,
+		    const struct irc_cidr_addr *addr, uint *len);
+
+/// @brief Adds the networks listed in a file to a tree, one per line. Blank
+/// lines and lines starting with `#` are skipped.
+///
+/// @param tree The tree.
+/// @param path The path of the file.
+/// @param line Set to the number of the first malformed line, or 0 if the file
+/// could not be read.
+///
+/// @returns `true` if every line was loaded, or `false` otherwise; lines
+/// before the malformed one are kept.
+bool irc_cidr_load(struct irc_cidr_tree *tree, const char *path, size_t *line);
+
+/// @brief Frees every node of a tree, leaving it empty.
+void irc_cidr_tree_destroy(struct irc_cidr_tree *tree);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// @file class.h Defines connection classes, which bound the memory clients
+/// can hold on the server.
+///
+/// Every client connection is put in the first configured class its address
+/// is in, or in a default class if there is none. A class limits the bytes
+/// that may be queued to each of its clients; a client whose send queue would
+/// grow past the limit is disconnected with "SendQ exceeded", which is what a
+/// client that stopped reading turns into once enough is sent its way.
+///
+/// The send and receive queues of all clients together may also be given a
+/// budget. Past it, clients that have fallen more than
+/// @ref IRC_CLASS_BACKLOG_MIN bytes behind are disconnected as soon as
+/// anything more is sent to them, whatever their class allows, so that a few
+/// slow consumers cannot run the server out of memory while everyone else
+/// keeps being served.
+///
+/// Queued buffers are shared between recipients and reference counted, so
+/// dropping the queue of a client frees only what no one else still holds.
+///
+/// Classes can be reconfigured while clients are connected. A class that is
+/// configured again under the same name takes the new limits, and keeps its
+/// clients and counters; a class that is no longer configured keeps its
+/// clients under its old limits until they disconnect, but takes no new ones.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "conf.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The number of bytes a client may have queued before it counts as
+/// falling behind, once the queue budget is exhausted.
+#define IRC_CLASS_BACKLOG_MIN   (64 * 1024)
+
+/// @brief The name of the class of clients no configured class applies to.
+#define IRC_CLASS_DEFAULT_NAME  "default"
+
+/// @brief The number of classes that can be held at once: the default class,
+/// the configured classes, and as many classes no longer configured that still
+/// have clients.
+#define IRC_CLASS_SLOT_NUM      ((2 * IRC_CONF_CLASS_NUM_MAX) + 1)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_class {
+	/// @brief The limits of the class, copied from the configuration.
+	struct irc_conf_class conf;
+
+	/// @brief Set while the class is configured, and new clients may be
+	/// put in it.
+	bool active;
+
+	/// @brief The number of clients in the class.
+	u32 num_users;
+
+	/// @brief The number of bytes queued to the clients of the class.
+	size_t sendq_bytes;
+
+	/// @brief The number of bytes held by receive queues of the clients of
+	/// the class.
+	size_t recvq_bytes;
+
+	/// @brief The number of clients disconnected for exceeding a limit.
+	u64 num_evicted;
+};
+
+struct irc_classes {
+	/// @brief The default class, followed by the other classes held; a
+	/// class that is neither active nor has clients is unused.
+	struct irc_class entries[IRC_CLASS_SLOT_NUM];
+
+	/// @brief The configured classes, in the order clients are matched
+	/// against them.
+	struct irc_class *order[IRC_CONF_CLASS_NUM_MAX];
+
+	size_t num_order;
+
+	/// @brief The number of bytes the queues of all clients may hold, or
+	/// 0 if there is no budget.
+	u64 budget;
+
+	/// @brief The number of bytes the queues of all clients hold.
+	size_t bytes;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Receives a single line of a report, without a line terminator.
+typedef void (*irc_classes_emit_cb)(void *udata, const char *line, size_t len);
+
+/// @brief Sets up the classes of a configuration, and the default class.
+void irc_classes_init(struct irc_classes *classes, const struct irc_conf *conf);
+
+/// @brief Reconfigures the classes, and the budget, leaving their clients
+/// where they are.
+///
+/// @returns `false` if there is no room for the classes, in which case nothing
+/// is changed, or `true` otherwise.
+bool irc_classes_apply(struct irc_classes *classes,
+		       const struct irc_conf *conf);
+
+/// @brief Returns the class of a client connecting from a numeric address.
+/// Never fails; clients no configured class applies to, and clients whose
+/// address cannot be parsed, are put in the default class.
+struct irc_class *irc_classes_match(struct irc_classes *classes,
+				    const char *host);
+
+/// @brief Returns `true` if the queues of all clients hold more than the
+/// budget allows.
+static inline bool irc_classes_over_budget(const struct irc_classes *classes)
+{
+	return classes->budget && (classes->bytes > classes->budget);
+}
+
+/// @brief Counts bytes added to or removed from the send queue of a client of
+/// a class.
+static inline void irc_class_sendq_add(struct irc_classes *const classes,
+				       struct irc_class *const cls,
+				       const size_t len)
+{
+	cls->sendq_bytes += len;
+	classes->bytes += len;
+}
+
+static inline void irc_class_sendq_sub(struct irc_classes *const classes,
+				       struct irc_class *const cls,
+				       const size_t len)
+{
+	cls->sendq_bytes -= len;
+	classes->bytes -= len;
+}
+
+/// @brief Counts bytes added to or removed from the receive queue of a client
+/// of a class.
+static inline void irc_class_recvq_add(struct irc_classes *const classes,
+				       struct irc_class *const cls,
+				       const size_t len)
+{
+	cls->recvq_bytes += len;
+	classes->bytes += len;
+}
+
+static inline void irc_class_recvq_sub(struct irc_classes *const classes,
+				       struct irc_class *const cls,
+				       const size_t len)
+{
+	cls->recvq_bytes -= len;
+	classes->bytes -= len;
+}
+
+/// @brief Reports every class, one line each: its clients, the bytes queued
+/// to and from them against its limits, and how many were disconnected;
+/// followed by the use of the budget. Classes no longer configured are
+/// reported while they have clients.
+void irc_classes_report(const struct irc_classes *classes,
+			irc_classes_emit_cb emit, void *udata);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
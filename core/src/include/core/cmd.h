@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// @file cmd.h Defines the dispatcher of commands received from users.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+
+#include "compiler.h"
+#include "types.h"
+
+struct irc_ctx;
+struct irc_msg;
+struct irc_user;
+
+/// @brief Runs the handler of a command received from a user.
+///
+/// @param ctx The IRC server context.
+/// @param user The user that sent the command.
+/// @param msg The parsed command.
+void irc_cmd_dispatch(struct irc_ctx *ctx, struct irc_user *user,
+		      const struct irc_msg *msg);
+
+/// @brief Removes a user that is going away from its channels and from the
+/// nickname table, telling the other members of its channels.
+///
+/// @param reason The reason shown to the other members.
+void irc_cmd_user_quit(struct irc_ctx *ctx, struct irc_user *user,
+		       const char *reason);
+
+/// @brief Makes a newly registered user known: files it under its UID, and
+/// tells the users monitoring its nickname. Servers are not told.
+void irc_cmd_user_intro(struct irc_ctx *ctx, struct irc_user *user);
+
+/// @brief Changes the nickname of a registered user, telling the users sharing
+/// a channel with it and the users monitoring either nickname. Servers are not
+/// told.
+///
+/// @param ts The time the nickname was claimed at, in seconds since the
+/// epoch.
+void irc_cmd_user_rename(struct irc_ctx *ctx, struct irc_user *user,
+			 const char *nick, u64 ts);
+
+/// @brief Continues the WHO and LIST replies being streamed to users whose
+/// send queue has drained enough.
+void irc_cmd_streams_run(struct irc_ctx *ctx);
+
+/// @brief Returns `true` if any WHO or LIST reply being streamed can continue
+/// without waiting for its user to read.
+bool irc_cmd_streams_ready(const struct irc_ctx *ctx) IRC_ATTRIB_PURE;
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
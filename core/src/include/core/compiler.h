@@ -53,6 +53,18 @@ extern "C" {
 
 #define IRC_FALLTHROUGH __attribute__((fallthrough))
 
+/// @brief The function has no effects other than its return value, which only
+/// depends on its arguments.
+#define IRC_ATTRIB_CONST        __attribute__((const))
+
+/// @brief The function has no effects other than its return value, which only
+/// depends on its arguments and global memory.
+#define IRC_ATTRIB_PURE         __attribute__((pure))
+
+/// @brief The function returns a pointer that does not alias any other valid
+/// pointer, like `malloc(3)`.
+#define IRC_ATTRIB_MALLOC       __attribute__((malloc))
+
 // clang-format on
 
 #ifdef __cplusplus
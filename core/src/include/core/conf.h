@@ -31,7 +31,10 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "cidr.h"
 #include "log.h"
+#include "mask.h"
+#include "vmem.h"
 
 // clang-format off
 
@@ -48,6 +51,85 @@ extern "C" {
 /// @brief The maximum number of listeners allowed.
 #define IRC_CONF_LISTENER_NUM_MAX       (16)
 
+/// @brief The listener used if none is configured.
+#define IRC_CONF_LISTENER_HOST_DEFAULT  "localhost"
+#define IRC_CONF_LISTENER_PORT_DEFAULT  "6667"
+
+/// @brief The maximum length of the server name.
+#define IRC_CONF_SERVER_NAME_LEN_MAX    (63)
+
+/// @brief The server name used if none is configured.
+#define IRC_CONF_SERVER_NAME_DEFAULT    "maven-ircd"
+
+/// @brief The length of the identifier of the server across the network: a
+/// digit, followed by two digits or uppercase letters.
+#define IRC_CONF_SERVER_ID_LEN          (3)
+
+/// @brief The server identifier used if none is configured.
+#define IRC_CONF_SERVER_ID_DEFAULT      "0AA"
+
+/// @brief The maximum number of servers that can be linked to directly.
+#define IRC_CONF_LINK_NUM_MAX           (16)
+
+/// @brief The maximum length of the password of a server link.
+#define IRC_CONF_LINK_PASSWORD_LEN_MAX  (63)
+
+/// @brief The maximum length of the metrics socket path, as bounded by the
+/// size of `sockaddr_un::sun_path`.
+#define IRC_CONF_SOCK_PATH_LEN_MAX      (107)
+
+/// @brief The maximum stall threshold of the watchdog, in milliseconds.
+#define IRC_CONF_WATCHDOG_STALL_MS_MAX  (60000)
+
+/// @brief The number of recipients broadcasts are delivered to per I/O loop
+/// iteration if none is configured.
+#define IRC_CONF_FANOUT_BUDGET_DEFAULT  (4096)
+
+/// @brief The maximum number of recipients broadcasts are delivered to per
+/// I/O loop iteration.
+#define IRC_CONF_FANOUT_BUDGET_MAX      (1000000)
+
+/// @brief The maximum length of the path of a file the configuration refers
+/// to.
+#define IRC_CONF_FILE_PATH_LEN_MAX      (255)
+
+/// @brief The maximum number of connections allowed from one subnet.
+#define IRC_CONF_CLONES_MAX             (100000)
+
+/// @brief The prefix length of the IPv4 subnets connections are counted by if
+/// none is configured. Every address is a subnet of its own.
+#define IRC_CONF_CLONES_IPV4_LEN_DEFAULT        (32)
+
+/// @brief The prefix length of the IPv6 subnets connections are counted by if
+/// none is configured, which is the size usually handed to a single site.
+#define IRC_CONF_CLONES_IPV6_LEN_DEFAULT        (64)
+
+/// @brief The maximum number of connection classes.
+#define IRC_CONF_CLASS_NUM_MAX          (16)
+
+/// @brief The maximum length of the name of a connection class.
+#define IRC_CONF_CLASS_NAME_LEN_MAX     (15)
+
+/// @brief The send queue limit of clients no class is configured for, in
+/// bytes.
+#define IRC_CONF_CLASS_SENDQ_DEFAULT    (2 * 1024 * 1024)
+
+/// @brief The maximum send queue limit of a class, in bytes.
+#define IRC_CONF_CLASS_SENDQ_MAX        (1024 * 1024 * 1024)
+
+/// @brief The maximum receive queue limit of a class, in bytes; the same as
+/// `IRC_USER_RECVQ_LEN_MAX`.
+#define IRC_CONF_CLASS_RECVQ_MAX        (512)
+
+/// @brief The maximum memory budget of all queues together, in bytes.
+#define IRC_CONF_QUEUE_BUDGET_MAX       (UINT64_C(1) << 40)
+
+/// @brief The time between two snapshots if none is configured, in seconds.
+#define IRC_CONF_SNAPSHOT_INTERVAL_DEFAULT      (300)
+
+/// @brief The maximum time between two snapshots, in seconds.
+#define IRC_CONF_SNAPSHOT_INTERVAL_MAX          (86400)
+
 // clang-format on
 
 enum irc_conf_status_code {
@@ -64,6 +146,15 @@ enum irc_conf_status_code {
 	/// allowed.
 	IRC_CONF_TOO_MANY_LISTENERS	= 2,
 
+	/// @brief The given value is longer than allowed.
+	IRC_CONF_TOO_LONG		= 3,
+
+	/// @brief The given value is not a number within the allowed range.
+	IRC_CONF_OUT_OF_RANGE		= 4,
+
+	/// @brief The given value is malformed.
+	IRC_CONF_MALFORMED		= 5,
+
 	// clang-format on
 };
 
@@ -77,8 +168,52 @@ struct irc_conf_listener {
 	char port[IRC_CONF_LISTENER_PORT_LEN_MAX + 1];
 };
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief Defines a connection class: the limits of the clients connecting
+/// from a network.
+struct irc_conf_class {
+	char name[IRC_CONF_CLASS_NAME_LEN_MAX + 1];
+
+	/// @brief The network the clients of the class connect from, and the
+	/// length of its prefix; see @ref irc_cidr_parse(). If the length is 0,
+	/// every client is in the class.
+	struct irc_cidr_addr net;
+	uint net_len;
+
+	/// @brief The number of bytes that may be queued to a client before it
+	/// is disconnected.
+	u32 sendq_max;
+
+	/// @brief The length of the longest line accepted from a client,
+	/// including its terminator; longer lines are dropped.
+	u32 recvq_max;
+};
+
+/// @brief Defines a server that may be linked to.
+struct irc_conf_link {
+	/// @brief The name of the server.
+	char name[IRC_CONF_SERVER_NAME_LEN_MAX + 1];
+
+	/// @brief The password both ends of the link send each other.
+	char password[IRC_CONF_LINK_PASSWORD_LEN_MAX + 1];
+
+	/// @brief Where the server is connected to. If the host is empty, the
+	/// server is not connected to, but it may connect.
+	struct irc_conf_listener addr;
+
+	/// @brief Set if the link is compressed, provided the server offers
+	/// it too.
+	bool zip;
+};
+
 /// @brief Defines the full configuration scheme of an IRC server context.
 struct irc_conf {
+	/// @brief The file the configuration was loaded from, which is what
+	/// a rehash reloads; see @ref irc_conf_load(). If empty, the
+	/// configuration was only set up programmatically.
+	char path[IRC_CONF_FILE_PATH_LEN_MAX + 1];
 	/// @brief Holds the listener entries.
 	struct {
 		/// @brief The list of listener entries.
@@ -89,10 +224,134 @@ struct irc_conf {
 		size_t num_entries;
 	} listeners;
 
+	/// @brief The name of the server, used as the source of its replies.
+	/// If empty, @ref IRC_CONF_SERVER_NAME_DEFAULT is used.
+	char server_name[IRC_CONF_SERVER_NAME_LEN_MAX + 1];
+
+	/// @brief The identifier of the server across the network, which
+	/// prefixes the identifiers of its users. If empty,
+	/// @ref IRC_CONF_SERVER_ID_DEFAULT is used.
+	char server_id[IRC_CONF_SERVER_ID_LEN + 1];
+
+	/// @brief Holds the server links; see link.h.
+	struct {
+		/// @brief The servers that may be linked to.
+		struct irc_conf_link entries[IRC_CONF_LINK_NUM_MAX];
+
+		size_t num_entries;
+
+		/// @brief Where connections from other servers are accepted.
+		/// If the host is empty, they are not.
+		struct irc_conf_listener listener;
+	} links;
+
+	/// @brief Holds the metrics settings.
+	struct {
+		/// @brief The path of the UNIX domain socket serving the
+		/// metrics in the Prometheus text format. If empty, the
+		/// socket is disabled.
+		char sock_path[IRC_CONF_SOCK_PATH_LEN_MAX + 1];
+	} metrics;
+
+	/// @brief Holds the watchdog settings.
+	struct {
+		/// @brief The time an I/O loop iteration may be busy for before
+		/// the watchdog reports it as stalled, in milliseconds. If 0,
+		/// the watchdog is disabled.
+		uint stall_threshold_ms;
+	} watchdog;
+
+	/// @brief Holds the broadcast settings.
+	struct {
+		/// @brief The number of recipients broadcasts are delivered to
+		/// per I/O loop iteration; larger channels have their
+		/// broadcasts spread over several iterations. If 0,
+		/// @ref IRC_CONF_FANOUT_BUDGET_DEFAULT is used.
+		uint recipients_per_iter;
+	} fanout;
+
+	/// @brief Holds the K-lines, which refuse users matching a mask at
+	/// registration.
+	struct {
+		/// @brief The normalized masks; see mask.h.
+		char (*entries)[IRC_MASK_LEN_MAX + 1];
+
+		size_t num_entries;
+	} klines;
+
+	/// @brief Holds the D-lines, which refuse connections from networks as
+	/// soon as they are accepted.
+	struct {
+		/// @brief The path of the file listing the networks; see
+		/// @ref irc_cidr_load(). If empty, there are none.
+		char path[IRC_CONF_FILE_PATH_LEN_MAX + 1];
+	} dlines;
+
+	/// @brief Holds the content filter settings.
+	struct {
+		/// @brief The path of the file listing the phrases messages are
+		/// dropped for; see @ref irc_filter_load(). If empty, messages
+		/// are not filtered.
+		char path[IRC_CONF_FILE_PATH_LEN_MAX + 1];
+	} filter;
+
+	/// @brief Holds the per-subnet connection limits, which refuse
+	/// connections as soon as they are accepted.
+	struct {
+		/// @brief The number of connections allowed from one subnet.
+		/// If 0, there is no limit.
+		uint max;
+
+		/// @brief The prefix length of IPv4 subnets. If 0,
+		/// @ref IRC_CONF_CLONES_IPV4_LEN_DEFAULT is used.
+		uint ipv4_len;
+
+		/// @brief The prefix length of IPv6 subnets. If 0,
+		/// @ref IRC_CONF_CLONES_IPV6_LEN_DEFAULT is used.
+		uint ipv6_len;
+	} clones;
+
+	/// @brief Holds the connection classes, which bound the memory a client
+	/// can hold; see class.h.
+	struct {
+		/// @brief The classes, of which the first the address of a
+		/// client is in applies.
+		struct irc_conf_class entries[IRC_CONF_CLASS_NUM_MAX];
+
+		size_t num_entries;
+
+		/// @brief The number of bytes that may be queued to and from
+		/// all clients together, beyond which clients falling behind
+		/// are disconnected. If 0, there is no budget.
+		u64 budget;
+	} classes;
+
+	/// @brief Holds the settings of the tables that grow with the number of
+	/// users: connections, nicknames and UIDs.
+	struct {
+		/// @brief How the tables are backed once they are large
+		/// enough; see vmem.h.
+		enum irc_vmem_mode vmem;
+	} tables;
+
+	/// @brief Holds the snapshot settings; see snapshot.h.
+	struct {
+		/// @brief The path of the snapshot file, which is mapped at
+		/// startup and written again periodically. If empty, there
+		/// is no snapshot.
+		char path[IRC_CONF_FILE_PATH_LEN_MAX + 1];
+
+		/// @brief The time between two snapshots, in seconds. If 0,
+		/// @ref IRC_CONF_SNAPSHOT_INTERVAL_DEFAULT is used.
+		uint interval_s;
+	} snapshot;
+
 	/// @brief The IRC context's @ref irc_log instance.
 	struct irc_log *log;
 };
 
+#pragma GCC diagnostic pop
+
 /// @brief Adds a listener for incoming client connections.
 ///
 /// @param conf The configuration instance to associate the listener entry with.
@@ -109,6 +368,236 @@ bool irc_conf_listener_add(struct irc_conf *conf,
 			   const struct irc_conf_listener *listener,
 			   enum irc_conf_status_code *code);
 
+/// @brief Adds a listener for incoming client connections, given as text.
+///
+/// @param conf The configuration instance.
+/// @param addr Where connections are accepted, as `host:port`.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_listener_addr_add(struct irc_conf *conf, const char *addr,
+				enum irc_conf_status_code *code);
+
+/// @brief Sets the name of the server.
+///
+/// @param conf The configuration instance.
+/// @param name The name of the server.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_server_name_set(struct irc_conf *conf, const char *name,
+			      enum irc_conf_status_code *code);
+
+/// @brief Sets the identifier of the server across the network.
+///
+/// @param conf The configuration instance.
+/// @param sid The identifier: a digit, followed by two digits or uppercase
+/// letters.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_server_id_set(struct irc_conf *conf, const char *sid,
+			    enum irc_conf_status_code *code);
+
+/// @brief Adds a server that may be linked to.
+///
+/// @param conf The configuration instance.
+/// @param link The server, as `name:password`, optionally followed by
+/// `@host:port` to connect to it, and then by `,zip` to compress the link.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_link_add(struct irc_conf *conf, const char *link,
+		       enum irc_conf_status_code *code);
+
+/// @brief Accepts connections from other servers.
+///
+/// @param conf The configuration instance.
+/// @param addr Where connections are accepted, as `host:port`.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_link_listener_set(struct irc_conf *conf, const char *addr,
+				enum irc_conf_status_code *code);
+
+/// @brief Enables the metrics socket.
+///
+/// @param conf The configuration instance.
+/// @param path The path of the UNIX domain socket to serve metrics on.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_metrics_sock_set(struct irc_conf *conf, const char *path,
+			       enum irc_conf_status_code *code);
+
+/// @brief Enables the I/O loop stall watchdog.
+///
+/// @param conf The configuration instance.
+/// @param threshold_ms The stall threshold in milliseconds, between 0 and
+/// @ref IRC_CONF_WATCHDOG_STALL_MS_MAX. 0 disables the watchdog.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_watchdog_set(struct irc_conf *conf, const char *threshold_ms,
+			   enum irc_conf_status_code *code);
+
+/// @brief Sets the number of recipients broadcasts are delivered to per I/O
+/// loop iteration.
+///
+/// @param conf The configuration instance.
+/// @param budget The number of recipients, between 1 and
+/// @ref IRC_CONF_FANOUT_BUDGET_MAX.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_fanout_budget_set(struct irc_conf *conf, const char *budget,
+				enum irc_conf_status_code *code);
+
+/// @brief Adds a K-line, refusing users matching a mask at registration.
+///
+/// @param conf The configuration instance.
+/// @param mask The mask, usually `user@host`; see @ref irc_mask_normalize().
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_kline_add(struct irc_conf *conf, const char *mask,
+			enum irc_conf_status_code *code);
+
+/// @brief Sets the file D-lines are loaded from when the context is
+/// initialized.
+///
+/// @param conf The configuration instance.
+/// @param path The path of the file, listing one network per line.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_dline_file_set(struct irc_conf *conf, const char *path,
+			     enum irc_conf_status_code *code);
+
+/// @brief Sets the file the phrases of the content filter are loaded from.
+///
+/// @param conf The configuration instance.
+/// @param path The path of the file, listing one phrase per line.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_filter_file_set(struct irc_conf *conf, const char *path,
+			      enum irc_conf_status_code *code);
+
+/// @brief Limits the number of connections allowed from one subnet.
+///
+/// @param conf The configuration instance.
+/// @param limit The number of connections, between 1 and
+/// @ref IRC_CONF_CLONES_MAX, optionally followed by the prefix lengths of IPv4
+/// and IPv6 subnets, as in `3/24/64`.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_clones_set(struct irc_conf *conf, const char *limit,
+			 enum irc_conf_status_code *code);
+
+/// @brief Adds a connection class.
+///
+/// @param conf The configuration instance.
+/// @param spec The class, as `name:sendq[:recvq][@network]`. Sizes are in
+/// bytes, or in KiB, MiB or GiB if followed by `K`, `M` or `G`; the receive
+/// queue limit is at most @ref IRC_CONF_CLASS_RECVQ_MAX, which is also its
+/// default. Without a network, the class applies to every client.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_class_add(struct irc_conf *conf, const char *spec,
+			enum irc_conf_status_code *code);
+
+/// @brief Sets the memory budget of the queues of all clients together.
+///
+/// @param conf The configuration instance.
+/// @param budget The number of bytes, with the same suffixes as in
+/// @ref irc_conf_class_add(), at most @ref IRC_CONF_QUEUE_BUDGET_MAX.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_queue_budget_set(struct irc_conf *conf, const char *budget,
+			       enum irc_conf_status_code *code);
+
+/// @brief Sets how the tables that grow with the number of users are backed.
+///
+/// @param conf The configuration instance.
+/// @param mode One of `heap`, `pages`, `thp` or `hugetlb`; see vmem.h.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_tables_vmem_set(struct irc_conf *conf, const char *mode,
+			      enum irc_conf_status_code *code);
+
+/// @brief Sets the file the state of the channels is snapshotted to, and
+/// restored from after a restart; see snapshot.h.
+///
+/// @param conf The configuration instance.
+/// @param path The path of the file.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_snapshot_file_set(struct irc_conf *conf, const char *path,
+				enum irc_conf_status_code *code);
+
+/// @brief Sets the time between two snapshots.
+///
+/// @param conf The configuration instance.
+/// @param interval_s The number of seconds, between 1 and
+/// @ref IRC_CONF_SNAPSHOT_INTERVAL_MAX.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_conf_snapshot_interval_set(struct irc_conf *conf,
+				    const char *interval_s,
+				    enum irc_conf_status_code *code);
+
+/// @brief Loads settings from a file, and remembers it as the file the
+/// configuration comes from.
+///
+/// Every line is a setting followed by its value, such as `listen
+/// 0.0.0.0:6667`; blank lines and lines starting with `#` are skipped. The
+/// settings are named after their setters, and take the same values:
+///
+/// | Setting             | Setter                                |
+/// |---------------------|---------------------------------------|
+/// | `listen`            | @ref irc_conf_listener_addr_add()     |
+/// | `server_name`       | @ref irc_conf_server_name_set()       |
+/// | `server_id`         | @ref irc_conf_server_id_set()         |
+/// | `link`              | @ref irc_conf_link_add()              |
+/// | `link_listen`       | @ref irc_conf_link_listener_set()     |
+/// | `metrics_sock`      | @ref irc_conf_metrics_sock_set()      |
+/// | `watchdog`          | @ref irc_conf_watchdog_set()          |
+/// | `fanout_budget`     | @ref irc_conf_fanout_budget_set()     |
+/// | `kline`             | @ref irc_conf_kline_add()             |
+/// | `dline_file`        | @ref irc_conf_dline_file_set()        |
+/// | `filter_file`       | @ref irc_conf_filter_file_set()       |
+/// | `clones`            | @ref irc_conf_clones_set()            |
+/// | `class`             | @ref irc_conf_class_add()             |
+/// | `queue_budget`      | @ref irc_conf_queue_budget_set()      |
+/// | `tables`            | @ref irc_conf_tables_vmem_set()       |
+/// | `snapshot_file`     | @ref irc_conf_snapshot_file_set()     |
+/// | `snapshot_interval` | @ref irc_conf_snapshot_interval_set() |
+///
+/// Settings that hold a list, like `listen`, may be given several times.
+///
+/// @param conf The configuration instance.
+/// @param path The path of the file.
+/// @param line Set to the number of the first line in error, or 0 if the file
+/// could not be read at all.
+/// @param code The detailed return code; see @ref irc_conf_listener_add().
+/// Lines that are too long, or set something that is not a setting, are
+/// @ref IRC_CONF_MALFORMED.
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise. The
+/// settings before the line in error have been applied.
+bool irc_conf_load(struct irc_conf *conf, const char *path, size_t *line,
+		   enum irc_conf_status_code *code);
+
+/// @brief Frees the memory held by a configuration.
+void irc_conf_release(struct irc_conf *conf);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
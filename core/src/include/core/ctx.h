@@ -26,10 +26,24 @@
 extern "C" {
 #endif // __cplusplus
 
+#include "arena.h"
+#include "chan.h"
+#include "cidr.h"
+#include "class.h"
 #include "conf.h"
 #include "event.h"
+#include "filter.h"
 #include "hash_table.h"
+#include "link.h"
+#include "metrics.h"
 #include "net.h"
+#include "prof.h"
+#include "snapshot.h"
+#include "user.h"
+#include "watchdog.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
 
 struct irc_ctx {
 	struct irc_conf conf;
@@ -37,14 +51,112 @@ struct irc_ctx {
 	struct irc_log log;
 	struct irc_net net;
 	struct irc_ht users;
+
+	/// @brief Maps case mapped nicknames to users.
+	struct irc_ht nicks;
+
+	struct irc_chans chans;
+
+	/// @brief Maps case mapped nicknames to the users monitoring them; see
+	/// monitor.h.
+	struct irc_ht monitors;
+
+	/// @brief The users to flush at the end of the I/O loop iteration.
+	struct irc_user_list flush;
+
+	/// @brief The users a WHO reply is being streamed to.
+	struct irc_user_list who;
+
+	/// @brief The users a LIST reply is being streamed to.
+	struct irc_user_list list;
+
+	/// @brief The connection classes of @ref conf, and the bytes queued to
+	/// and from their clients.
+	struct irc_classes classes;
+
+	/// @brief The other servers of the network, and the links to them.
+	struct irc_links links;
+
+	/// @brief The compiled K-lines of @ref conf, or `NULL` if there are
+	/// none.
+	struct irc_mask_set *klines;
+
+	/// @brief The D-lines loaded from the file of @ref conf, which
+	/// @ref net refuses connections from.
+	struct irc_cidr_tree dlines;
+
+	/// @brief The content filter compiled from the file of @ref conf, or
+	/// `NULL` if there is none. It is only read by the I/O thread, but
+	/// may be compiled elsewhere and swapped in.
+	_Atomic(struct irc_filter *) filter;
+
+	/// @brief Set by @ref irc_rehash_request() for the I/O loop to rehash
+	/// once it is done waiting for events.
+	_Atomic bool rehash_pending;
+
+	/// @brief The hand over of the server to a new binary; see upgrade.h.
+	struct {
+		/// @brief The command line the new binary is started with, or
+		/// `NULL` if the server cannot be upgraded.
+		char *const *argv;
+
+		/// @brief Set if the process was started by an upgrade, and
+		/// takes over the state of the previous one before it polls
+		/// for the first time.
+		bool resume;
+
+		/// @brief Set by @ref irc_upgrade_request() for the I/O loop
+		/// to upgrade once it is done waiting for events.
+		_Atomic bool pending;
+	} upgrade;
+
+	/// @brief The snapshot of the channels, restored from as they are
+	/// joined and written periodically; see snapshot.h.
+	struct irc_snapshot snapshot;
+
+	/// @brief Holds the temporaries of the I/O loop iteration, and is
+	/// reset at its end; see arena.h.
+	struct irc_arena arena;
+
+	struct irc_metrics metrics;
+	struct irc_prof prof;
+	struct irc_watchdog watchdog;
 };
 
+#pragma GCC diagnostic pop
+
 /// @brief Initializes an IRC server context.
 /// @param ctx The IRC server context to initialize.
 void irc_init(struct irc_ctx *ctx);
 
+/// @brief Frees what @ref irc_init() set up, along with the clients and links
+/// left. No connection is closed; the descriptors are left to the caller.
+/// @param ctx The IRC server context to destroy.
+void irc_destroy(struct irc_ctx *ctx);
+
 void irc_io_loop(struct irc_ctx *ctx);
 
+/// @brief Recompiles the content filter from the file of @ref irc_ctx::conf,
+/// and swaps it in. If that fails, the filter in use is kept.
+/// @returns `false` if an error was encountered, or `true` otherwise.
+bool irc_filter_reload(struct irc_ctx *ctx);
+
+/// @brief Reloads the configuration file of @ref irc_ctx::conf, and applies
+/// what changed without touching established connections: listeners that are
+/// no longer configured are closed and new ones opened, classes take their new
+/// limits, and the K-lines, D-lines and content filter are reloaded. The
+/// server name and identifier, the links, the watchdog and the table memory
+/// only change on restart. Snapshots are written to the new snapshot file, but
+/// the one mapped at startup is kept.
+///
+/// @returns `false` if the file could not be loaded, in which case the
+/// configuration in use is kept, or `true` otherwise.
+bool irc_rehash(struct irc_ctx *ctx);
+
+/// @brief Has the I/O loop rehash once it is done waiting for events. Safe to
+/// call from a signal handler.
+void irc_rehash_request(struct irc_ctx *ctx);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -28,6 +28,8 @@ extern "C" {
 
 #include <stddef.h>
 
+#include "compiler.h"
+
 // clang-format off
 
 #define IRC_EVENT_NUM_MAX       (256)
@@ -48,8 +50,40 @@ struct irc_event_net_data_recv {
 
 #pragma GCC diagnostic pop
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
 struct irc_event_net_client_conn {
 	int fd;
+
+	/// @brief The numeric address of the client.
+	const char *host;
+};
+
+#pragma GCC diagnostic pop
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_event_net_server_conn {
+	int fd;
+
+	/// @brief The numeric address of the server.
+	const char *host;
+};
+
+#pragma GCC diagnostic pop
+
+struct irc_event_net_client_disconn {
+	int fd;
+};
+
+struct irc_event_net_stats_conn {
+	int fd;
+};
+
+struct irc_event_net_client_writable {
+	int fd;
 };
 
 enum irc_event_type {
@@ -61,6 +95,24 @@ enum irc_event_type {
 	/// @brief A connection to the server has been established.
         IRC_EVENT_TYPE_NET_CLIENT_CONN  = 1,
 
+	/// @brief A client connection is about to be closed.
+	IRC_EVENT_TYPE_NET_CLIENT_DISCONN = 2,
+
+	/// @brief A connection to the metrics socket has been established.
+	IRC_EVENT_TYPE_NET_STATS_CONN   = 3,
+
+	/// @brief A client connection can be written to again after its
+	/// socket buffer was full.
+	IRC_EVENT_TYPE_NET_CLIENT_WRITABLE = 4,
+
+	/// @brief A connection from another server has been accepted; see
+	/// link.h. Its data, writability and closing are published as the
+	/// same events as for clients.
+	IRC_EVENT_TYPE_NET_SERVER_CONN  = 5,
+
+	/// @brief The number of event types.
+	IRC_EVENT_TYPE_NUM              = 6
+
 	// clang-format on
 };
 
@@ -74,15 +126,26 @@ struct irc_event_data {
 
 #pragma GCC diagnostic pop
 
+struct irc_metrics;
+
 struct irc_event {
 	struct irc_event_data event_list[IRC_EVENT_NUM_MAX];
 	void *ctx;
+
+	/// @brief Receives the time spent dispatching each event type.
+	struct irc_metrics *metrics;
+
+	/// @brief Accounts the time spent in handlers to the dispatch phase.
+	struct irc_prof *prof;
 };
 
 void irc_event_pub(struct irc_event *ev, enum irc_event_type type, void *ptr);
 void irc_event_sub(struct irc_event *ev, enum irc_event_type type,
 		   irc_event_cb cb);
 
+/// @brief Returns the name of an event type, for use in metrics and logs.
+const char *irc_event_type_name(enum irc_event_type type) IRC_ATTRIB_CONST;
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file filter.h Defines the content filter, which matches a set of literal
+/// phrases against the text of messages, as used against spam.
+///
+/// * The phrases are compiled into an Aho-Corasick automaton, turned into a
+///   deterministic one: every state has a transition for every character,
+///   failure links having been followed at compile time. Scanning a text
+///   takes one table lookup per character, however many phrases there are.
+///
+/// * Matching ignores ASCII case. Characters are mapped to classes first,
+///   letters of either case to the same one and every character appearing in
+///   no phrase to class 0, which keeps the rows of the table short.
+///
+/// * States are numbered in breadth-first order, so that the shallow states
+///   most characters lead to share cache lines. Transitions hold the offset of
+///   the row of their target, flagged if a phrase ends there, so scanning
+///   reads nothing but the transitions until a phrase is found.
+///
+/// * A compiled filter is never modified. Reloading compiles a new one and
+///   swaps it in with @ref irc_filter_swap().
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The maximum length of a phrase.
+#define IRC_FILTER_PHRASE_LEN_MAX       (255)
+
+/// @brief Flags the transitions to states a phrase ends at.
+#define IRC_FILTER_MATCH                (UINT32_C(1) << 31)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_filter {
+	/// @brief The class of every character.
+	u8 classes[256];
+
+	/// @brief The number of character classes, including class 0.
+	u32 num_classes;
+
+	u32 num_states;
+
+	/// @brief The transitions, @ref num_classes per state. Each is the
+	/// offset of the row of the target state, which may be flagged with
+	/// @ref IRC_FILTER_MATCH. State 0 is the initial state.
+	u32 *delta;
+
+	/// @brief For every state, 1 plus the index of a phrase that ends
+	/// there, or 0 if none does.
+	u32 *out;
+
+	size_t num_phrases;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Compiles a set of phrases. Empty phrases are skipped.
+/// @returns The filter, or `NULL` if the phrases are too many for the
+/// transitions to be addressed.
+struct irc_filter *irc_filter_new(const char *const *phrases,
+				  size_t num_phrases);
+
+/// @brief Compiles the phrases listed in a file, one per line. Blank lines
+/// and lines starting with `#` are skipped.
+///
+/// @param path The path of the file.
+/// @param line Set to the number of the first line longer than
+/// @ref IRC_FILTER_PHRASE_LEN_MAX, or 0 if the file could not be read or
+/// compiled.
+///
+/// @returns The filter, or `NULL` on error.
+struct irc_filter *irc_filter_load(const char *path, size_t *line);
+
+void irc_filter_free(struct irc_filter *filter);
+
+/// @brief Scans a text for the phrases of a filter.
+///
+/// @param filter The filter.
+/// @param text The text, which need not be terminated.
+/// @param len The length of the text.
+/// @param phrase If not `NULL`, set to the index of the phrase found.
+///
+/// @returns `true` if the text contains a phrase, or `false` otherwise.
+static inline bool irc_filter_match(const struct irc_filter *const filter,
+				    const char *const text, const size_t len,
+				    size_t *const phrase)
+{
+	const u32 *const delta = filter->delta;
+
+	u32 row = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		row = delta[row + filter->classes[(u8)text[i]]];
+
+		if (IRC_UNLIKELY(row & IRC_FILTER_MATCH)) {
+			if (phrase) {
+				row &= ~IRC_FILTER_MATCH;
+				*phrase = filter->out[row / filter->num_classes] -
+					  1;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+/// @brief Replaces the filter in use, which may be `NULL`, and frees the one
+/// it replaces. The previous filter must not be in use by another thread.
+void irc_filter_swap(_Atomic(struct irc_filter *) *cur,
+		     struct irc_filter *filter);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -26,11 +26,24 @@
 extern "C" {
 #endif // __cplusplus
 
+#include <stdbool.h>
 #include <stddef.h>
+
 #include "types.h"
+#include "vmem.h"
 
 #define IRC_SIPHASH_SECRET_KEY_LEN (16)
 
+/// @brief Computes the hash of a key.
+///
+/// @param key The key to hash.
+/// @param secret_key The secret key of the hash table, which should be mixed
+/// into the hash; see @ref irc_ht_hash_bytes().
+typedef size_t (*irc_ht_hash_cb)(const void *key, const u8 *secret_key);
+
+/// @brief Compares two keys for equality.
+typedef bool (*irc_ht_eq_cb)(const void *key_a, const void *key_b);
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
 
@@ -41,7 +54,8 @@ struct irc_ht_entry {
 	/// @brief The value associated with the key.
 	void *val;
 
-	/// @brief The number of probes required to find this key during lookup.
+	/// @brief One more than the number of probes required to find this key
+	/// during lookup, or 0 if the entry is empty.
 	uint psl;
 };
 
@@ -52,6 +66,19 @@ struct irc_ht_conf {
 
 	/// @brief The maximum load factor, in percent.
 	uint load_fact_max;
+
+	/// @brief The hash function of the keys. If `NULL`, the key pointers
+	/// themselves are hashed.
+	irc_ht_hash_cb hash;
+
+	/// @brief The equality function of the keys. If `NULL`, the key
+	/// pointers themselves are compared.
+	irc_ht_eq_cb eq;
+
+	/// @brief How the entries are backed once they outgrow
+	/// @ref IRC_VMEM_MAP_MIN; tables of millions of entries are probed
+	/// faster from huge pages.
+	enum irc_vmem_mode vmem;
 };
 
 #pragma GCC diagnostic pop
@@ -63,6 +90,9 @@ struct irc_ht {
 	/// @brief The list of entries within the hash table.
 	struct irc_ht_entry *entries;
 
+	/// @brief The storage of @ref entries.
+	struct irc_vmem mem;
+
 	/// @brief The maximum number of entries in the hash table allowed.
 	size_t capacity;
 
@@ -74,9 +104,30 @@ struct irc_ht {
 
 void irc_ht_init(struct irc_ht *ht, const struct irc_ht_conf *conf);
 
+/// @brief Frees the memory of the hash table itself. The keys and values are
+/// left untouched.
+void irc_ht_destroy(struct irc_ht *ht);
+
+/// @brief Associates a value with a key, replacing any previous value.
 void irc_ht_add(struct irc_ht *ht, void *key, void *val);
 
-void *irc_ht_get(struct irc_ht *ht, void *key);
+/// @brief Grows the hash table ahead of time, so that it takes a number of
+/// entries in all without being resized along the way.
+void irc_ht_reserve(struct irc_ht *ht, size_t num_entries);
+
+/// @brief Returns the value associated with a key, or `NULL` if the key is not
+/// present.
+void *irc_ht_get(struct irc_ht *ht, const void *key);
+
+/// @brief Removes a key from the hash table.
+///
+/// @returns The value that was associated with the key, or `NULL` if the key
+/// was not present.
+void *irc_ht_del(struct irc_ht *ht, const void *key);
+
+/// @brief Hashes an arbitrary byte string with SipHash 2-4. Intended for use
+/// by @ref irc_ht_hash_cb implementations.
+size_t irc_ht_hash_bytes(const void *data, size_t len, const u8 *secret_key);
 
 #ifdef __cplusplus
 }
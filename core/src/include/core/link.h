@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file link.h Defines the links to other servers, and the protocol spoken
+/// over them.
+///
+/// * The protocol follows TS6. Every server has a three character identifier
+///   (SID), and every user a nine character one (UID) made of the SID of its
+///   server and six more characters. Messages between servers are sourced
+///   and addressed by these identifiers rather than by name, and both decode
+///   arithmetically into integers: SIDs index a flat table of servers, and
+///   UIDs key a hash table of users by integer. Routing a message never hashes
+///   or case maps a string.
+///
+/// * Conflicts are settled by timestamps (TS). Of two users with the same
+///   nickname, the one that took it first keeps it, and the other is renamed
+///   to its UID, which can never be in use as a nickname. Of two channels with
+///   the same name, the older one keeps its modes, and the younger one loses
+///   its operators and lists of masks.
+///
+/// * Once both ends of a link have authenticated each other, each sends the
+///   other its view of the network in a burst: the servers behind it, then
+///   every user, then every channel with its members packed into as few lines
+///   as fit, followed by its lists of masks. Everything sent on a link, burst
+///   or not, is appended to large buffers that are queued whole, so that a
+///   burst of 100k users takes a few hundred writes rather than one per line.
+///
+/// * The network is a tree. Whatever a server learns from a link it passes on
+///   to its other links, verbatim where it can. A link that goes away takes
+///   the servers behind it, and their users, along with it.
+///
+/// * A link configured for it is compressed if the other end offers it too,
+///   with CAPAB during the handshake. Each end compresses what it sends from
+///   right after its SERVER line on, and decompresses what it receives from
+///   right after the SERVER line of the other end on; see zip.h.
+///
+/// The messages are:
+///
+///     PASS <password> TS 6 :<sid>
+///     CAPAB :<capability> ...
+///     SERVER <name> <hops> :<description>
+///     :<sid> SID <name> <hops> <sid> :<description>
+///     :<sid> UID <nick> <hops> <ts> <username> <host> <uid> :<realname>
+///     :<sid> SJOIN <ts> <channel> + :[@+]<uid> ...
+///     :<sid> BMASK <ts> <channel> <b|e> :<mask> ...
+///     :<sid> EOB
+///     :<sid> SAVE <uid> <ts>
+///     :<sid> SQUIT <sid> :<reason>
+///     :<sid> PING <sid> [<sid>]
+///     :<sid> PONG <sid> <sid>
+///     :<uid> NICK <nick> <ts>
+///     :<uid> QUIT :<reason>
+///     :<uid> JOIN <ts> <channel> +
+///     :<uid> PART <channel> :<reason>
+///     :<uid> PRIVMSG|NOTICE <uid|channel> :<text>
+///     :<uid> TMODE <ts> <channel> <modes> <masks>...
+///     :<uid> AWAY [:<message>]
+///     ERROR :<reason>
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+
+#include "buf.h"
+#include "compiler.h"
+#include "conf.h"
+#include "hash_table.h"
+#include "sendq.h"
+#include "types.h"
+#include "user.h"
+#include "vmem.h"
+#include "zip.h"
+
+// clang-format off
+
+/// @brief The number of distinct server identifiers.
+#define IRC_LINK_SID_NUM        (10 * 36 * 36)
+
+/// @brief The maximum number of servers in the network, besides this one.
+#define IRC_LINK_SERVER_NUM_MAX (64)
+
+/// @brief The maximum length of the description of a server.
+#define IRC_LINK_DESC_LEN_MAX   (50)
+
+/// @brief The maximum length of a line received from a server, including the
+/// line terminator.
+#define IRC_LINK_LINE_LEN_MAX   (512)
+
+/// @brief The maximum number of parameters of a message between servers.
+#define IRC_LINK_PARAM_NUM_MAX  (15)
+
+/// @brief The size of the buffers output to a server is appended to.
+#define IRC_LINK_OUT_BUF_SIZE   (16384)
+
+/// @brief The time between attempts to connect to a server, in milliseconds.
+#define IRC_LINK_RETRY_MS       (1000)
+
+// clang-format on
+
+/// @brief The state of a link.
+enum irc_link_state {
+	// clang-format off
+
+	/// @brief The connection to the server is being established.
+	IRC_LINK_CONNECTING     = 0,
+
+	/// @brief Waiting for the server to authenticate.
+	IRC_LINK_HANDSHAKE      = 1,
+
+	/// @brief Both ends have authenticated, and exchange their state.
+	IRC_LINK_ESTABLISHED    = 2
+
+	// clang-format on
+};
+
+struct irc_chan;
+struct irc_ctx;
+struct irc_link;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief Another server of the network.
+struct irc_server {
+	char name[IRC_CONF_SERVER_NAME_LEN_MAX + 1];
+	char sid[IRC_CONF_SERVER_ID_LEN + 1];
+	char desc[IRC_LINK_DESC_LEN_MAX + 1];
+
+	/// @brief The decoded @ref sid.
+	u32 id;
+
+	/// @brief The number of links between this server and the server.
+	u32 hops;
+
+	/// @brief The link the server is reached through.
+	struct irc_link *link;
+
+	/// @brief The server the server is linked to, or `NULL` if it is
+	/// linked to this one.
+	struct irc_server *uplink;
+
+	/// @brief The users connected to the server.
+	struct irc_user_list users;
+
+	/// @brief Set while the server is being removed from the network.
+	bool split;
+};
+
+/// @brief A connection to another server.
+struct irc_link {
+	int fd;
+	enum irc_link_state state;
+
+	/// @brief The configuration of the server, once it is known.
+	const struct irc_conf_link *conf;
+
+	/// @brief The server at the other end, once it has authenticated.
+	struct irc_server *server;
+
+	/// @brief The numeric address of the server.
+	char host[IRC_USER_HOST_LEN_MAX + 1];
+
+	/// @brief The password and identifier the server has sent, or empty
+	/// if it has not sent PASS yet.
+	char password[IRC_CONF_LINK_PASSWORD_LEN_MAX + 1];
+	char sid[IRC_CONF_SERVER_ID_LEN + 1];
+
+	/// @brief Set once the link is to be closed, as soon as its send
+	/// queue has been written out.
+	bool closing;
+
+	/// @brief Set if the server has offered to compress the link.
+	bool zip_offered;
+
+	/// @brief The compression of what is sent to and received from the
+	/// server respectively, or `NULL` if the link is not compressed.
+	struct irc_zip *zip_out;
+	struct irc_zip *zip_in;
+
+	/// @brief The buffer output is being appended to, or `NULL`. It is
+	/// queued once full, or at the end of the I/O loop iteration.
+	struct irc_buf *out;
+
+	/// @brief The buffers waiting to be sent.
+	struct irc_sendq sendq;
+
+	/// @brief The burst being received.
+	struct {
+		/// @brief When the link was established, in nanoseconds.
+		u64 start_ns;
+
+		u32 num_users;
+		u32 num_chans;
+	} burst;
+
+	/// @brief Set if the line being received is too long; the rest of it
+	/// is discarded.
+	bool recvq_discard;
+
+	/// @brief The number of bytes in @ref recvq.
+	size_t recvq_len;
+
+	/// @brief Holds the start of a line whose end has not been received
+	/// yet.
+	char recvq[IRC_LINK_LINE_LEN_MAX];
+};
+
+/// @brief The links and servers of an IRC server context.
+struct irc_links {
+	/// @brief The open links, in any state.
+	struct irc_link *entries[IRC_CONF_LINK_NUM_MAX * 2];
+	u32 num_entries;
+
+	/// @brief The other servers of the network; every server comes after
+	/// the server it is linked to.
+	struct irc_server *servers[IRC_LINK_SERVER_NUM_MAX];
+	u32 num_servers;
+
+	/// @brief The servers by decoded SID, @ref IRC_LINK_SID_NUM of them.
+	struct irc_server **by_sid;
+
+	/// @brief Maps decoded UIDs to every registered user of the network.
+	struct irc_ht users;
+
+	/// @brief The number the UID of the next local user is made from.
+	u32 next_uid;
+
+	/// @brief The decoded SID of this server.
+	u32 sid;
+
+	/// @brief The state of the outbound links, by the index of their
+	/// configuration.
+	struct {
+		/// @brief The link, or `NULL` if there is none.
+		struct irc_link *link;
+
+		/// @brief When to try connecting next, in milliseconds of
+		/// the monotonic clock.
+		u64 retry_at_ms;
+	} outbound[IRC_CONF_LINK_NUM_MAX];
+};
+
+/// @brief A message received from a server, split in place.
+struct irc_link_msg {
+	/// @brief The source, without the leading colon, or `NULL` if there
+	/// is none.
+	const char *src;
+
+	const char *cmd;
+	const char *params[IRC_LINK_PARAM_NUM_MAX];
+	u32 num_params;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Returns `true` if a server identifier is well formed.
+bool irc_link_sid_valid(const char *sid) IRC_ATTRIB_PURE;
+
+/// @brief Decodes a well formed server identifier into a number below
+/// @ref IRC_LINK_SID_NUM.
+u32 irc_link_sid_decode(const char *sid) IRC_ATTRIB_PURE;
+
+/// @brief Decodes a user identifier into a number that is unique across the
+/// network.
+///
+/// @returns `false` if the identifier is malformed.
+bool irc_link_uid_decode(const char *uid, u64 *id);
+
+/// @brief Encodes the number of a user identifier, as decoded by
+/// @ref irc_link_uid_decode().
+///
+/// @param uid Receives the identifier, of @ref IRC_USER_UID_LEN characters
+/// and a terminator.
+void irc_link_uid_encode(u64 id, char *uid);
+
+/// @brief Splits a line received from a server, without its terminator, in
+/// place. Words past @ref IRC_LINK_PARAM_NUM_MAX parameters are dropped.
+///
+/// @returns `false` if the line has no command.
+bool irc_link_msg_parse(char *line, struct irc_link_msg *msg);
+
+/// @brief Initializes the links of an IRC server context.
+///
+/// @param vmem How the table of remote users is backed; see vmem.h.
+void irc_links_init(struct irc_links *links, const char *sid,
+		    enum irc_vmem_mode vmem);
+
+/// @brief Frees the tables of the links, which have all been closed.
+void irc_links_destroy(struct irc_links *links);
+
+/// @brief Receives a single line of a report, without a line terminator.
+typedef void (*irc_links_emit_cb)(void *udata, const char *line, size_t len);
+
+/// @brief Returns the link a file descriptor belongs to, or `NULL` if it is
+/// not a link.
+struct irc_link *irc_link_find(struct irc_links *links, int fd)
+	IRC_ATTRIB_PURE;
+
+/// @brief Returns the link a user is reached through, or `NULL` if it is
+/// connected to this server.
+static inline struct irc_link *irc_user_link(const struct irc_user *const user)
+{
+	return user->server ? user->server->link : NULL;
+}
+
+/// @brief Handles a connection from another server.
+void irc_link_accept(struct irc_ctx *ctx, int fd, const char *host);
+
+/// @brief Handles data received from a server.
+void irc_link_recv(struct irc_ctx *ctx, struct irc_link *link,
+		   const char *data, size_t size);
+
+/// @brief Handles a link becoming writable, which completes a connection to a
+/// server.
+void irc_link_writable(struct irc_ctx *ctx, struct irc_link *link);
+
+/// @brief Handles a link being closed, removing the servers behind it from
+/// the network, and frees it.
+void irc_link_closed(struct irc_ctx *ctx, struct irc_link *link);
+
+/// @brief Connects to the configured servers that are not linked, if their
+/// next attempt is due.
+///
+/// @returns The time until the next attempt, in milliseconds, or -1 if there
+/// is none.
+int irc_links_connect(struct irc_ctx *ctx);
+
+/// @brief Writes out as much of the output of every link as possible.
+void irc_links_flush(struct irc_ctx *ctx);
+
+/// @brief Reports the established links, one line each: the server, its send
+/// queue, and for compressed links the bytes before and after compression and
+/// the CPU time spent in each direction.
+void irc_links_report(const struct irc_links *links, irc_links_emit_cb emit,
+		      void *udata);
+
+/// @brief Files a newly registered user under its UID. Users of this server
+/// are given one, unless they kept theirs across an upgrade; see upgrade.h.
+void irc_links_user_add(struct irc_ctx *ctx, struct irc_user *user);
+
+/// @brief Removes a user from the users of the network.
+void irc_links_user_del(struct irc_ctx *ctx, struct irc_user *user);
+
+/// @brief Returns the registered user with a UID, or `NULL` if there is none.
+struct irc_user *irc_links_user_find(struct irc_links *links, const char *uid);
+
+/// @brief Introduces a user to every server but the ones behind a link.
+///
+/// @param except The link not to send to, or `NULL`.
+void irc_links_user_intro(struct irc_ctx *ctx, const struct irc_link *except,
+			  const struct irc_user *user);
+
+/// @brief Sends a channel to every server as it would be in a burst: its
+/// members, then its lists of masks. Meant for channels that come with masks
+/// the network has not been told about, such as restored ones; see snapshot.h.
+void irc_links_chan_burst(struct irc_ctx *ctx, struct irc_chan *chan);
+
+/// @brief Formats a message and sends it to every established link but one.
+/// The line terminator is appended.
+///
+/// @param except The link not to send to, or `NULL`.
+void irc_links_sendf(struct irc_ctx *ctx, const struct irc_link *except,
+		     const char *fmt, ...) IRC_ATTRIB_FMT(printf, 3, 4);
+
+/// @brief Formats a message and sends it to a link. The line terminator is
+/// appended.
+void irc_link_sendf(struct irc_link *link, const char *fmt, ...)
+	IRC_ATTRIB_FMT(printf, 2, 3);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
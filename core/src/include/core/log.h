@@ -26,6 +26,10 @@
 extern "C" {
 #endif // __cplusplus
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "compiler.h"
 #include "types.h"
 
@@ -42,49 +46,228 @@ enum irc_log_lvl {
 	// clang-format on
 };
 
+/// @brief Describes a single logging call site.
+///
+/// One of these is emitted by the compiler for every `IRC_LOG_*` macro
+/// invocation, and all of them are gathered by the linker into the
+/// `irc_log_sites` section. The index of a call site within that section is
+/// its ID, which is what the binary log sink records instead of the formatted
+/// message; see @ref irc_log_bin.
+struct irc_log_site {
+	/// @brief The source file containing the call site.
+	const char *file;
+
+	/// @brief The printf-style format string of the call site.
+	const char *fmt;
+
+	/// @brief The line number of the call site.
+	uint line;
+
+	/// @brief The log level of the call site.
+	uint lvl;
+};
+
+struct irc_log_bin;
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
 
 struct irc_log {
 	void *udata;
 	void (*cb)(void *udata, const uint lvl, char *str);
+
+	/// @brief The binary log sink, or `NULL` if binary logging is
+	/// disabled. When set, every message is additionally recorded in its
+	/// unformatted form; see @ref irc_log_bin_open().
+	struct irc_log_bin *bin;
+
+	/// @brief Serializes messages logged from threads other than the I/O
+	/// thread, such as the watchdog. Held only to append to the sinks.
+	pthread_mutex_t lock;
+
 	uint lvl;
 };
 
 #pragma GCC diagnostic pop
 
-void irc_log_dispatch(struct irc_log *log, uint lvl, const char *msg, ...)
-	IRC_ATTRIB_FMT(printf, 3, 4);
+/// @brief Returns the ID of a call site, i.e. its index within the
+/// `irc_log_sites` section.
+uint irc_log_site_id(const struct irc_log_site *site) IRC_ATTRIB_CONST;
+
+/// @brief Returns the call site table of the running binary.
+///
+/// @param num_sites Set to the number of entries in the table.
+const struct irc_log_site *irc_log_sites(size_t *num_sites);
+
+/// @brief Initializes the lock of a log. Until then, a zeroed log works with
+/// glibc, whose default mutex is all zeros.
+void irc_log_init(struct irc_log *log);
 
-#define IRC_LOG_MSG(logger, level, args...)                      \
-	({                                                       \
-		struct irc_log *log = (logger);                  \
-                                                                 \
-		if ((log) && (log->lvl >= (level)) && log->cb) { \
-			irc_log_dispatch(log, (level), args);    \
-		}                                                \
+/// @brief Makes the calling thread give up on the lock of a log rather than
+/// wait for it, writing its messages to the standard error instead.
+///
+/// This is for threads reporting on the I/O thread, which may well be stuck
+/// holding the lock.
+void irc_log_thread_nowait(void);
+
+void irc_log_dispatch(struct irc_log *log, const struct irc_log_site *site,
+		      const char *msg, ...) IRC_ATTRIB_FMT(printf, 3, 4);
+
+#define IRC_LOG_SITE_ATTRIB \
+	__attribute__((used, section("irc_log_sites"), aligned(8)))
+
+#define IRC_LOG_MSG(logger, level, fmt, args...)                          \
+	({                                                                \
+		static const struct irc_log_site site_ IRC_LOG_SITE_ATTRIB = { \
+			__FILE__, (fmt), __LINE__, (level)                \
+		};                                                        \
+		struct irc_log *log = (logger);                           \
+                                                                          \
+		if ((log) && (log->lvl >= (level)) && (log->cb || log->bin)) { \
+			irc_log_dispatch(log, &site_, (fmt), ##args);     \
+		}                                                         \
 	})
 
+/// @brief Checks the arguments of a call site that was compiled out, so that
+/// they stay valid and count as used. Never called.
+static inline IRC_ATTRIB_FMT(printf, 1, 2) void irc_log_nop(const char *fmt,
+							     ...)
+{
+	(void)fmt;
+}
+
+#define IRC_LOG_NOP(logger, args...)    \
+	({                              \
+		if (0) {                \
+			(void)(logger); \
+			irc_log_nop(args); \
+		}                       \
+	})
+
+/// @brief The state of a rate-limited call site.
+struct irc_log_ratelimit {
+	/// @brief The second the current window started at.
+	u64 window;
+
+	/// @brief The number of messages logged in the current window.
+	uint num_logged;
+
+	/// @brief The number of messages suppressed since the last one that
+	/// was logged.
+	uint num_suppressed;
+};
+
+/// @brief Decides whether a rate-limited call site may log.
+///
+/// @param rl The state of the call site.
+/// @param per_sec The maximum number of messages per second.
+/// @param suppressed Set to the number of messages suppressed since the last
+/// one that was logged, if this function returns `true`.
+///
+/// @returns `true` if the message should be logged, or `false` otherwise.
+bool irc_log_ratelimit_allow(struct irc_log_ratelimit *rl, uint per_sec,
+			     uint *suppressed);
+
+/// @brief Logs a message, at most `per_sec` times per second for this call
+/// site. The number of messages suppressed in between is logged before the
+/// next message that gets through.
+#define IRC_LOG_MSG_RATELIMIT(logger, level, per_sec, args...)                \
+	({                                                                    \
+		static struct irc_log_ratelimit rl_;                          \
+		struct irc_log *rl_log_ = (logger);                           \
+		uint suppressed_;                                             \
+                                                                              \
+		if ((rl_log_) && (rl_log_->lvl >= (level)) &&                 \
+		    irc_log_ratelimit_allow(&rl_, (per_sec), &suppressed_)) { \
+			if (suppressed_) {                                    \
+				IRC_LOG_MSG(rl_log_, (level),                 \
+					    "%u similar messages suppressed", \
+					    suppressed_);                     \
+			}                                                     \
+			IRC_LOG_MSG(rl_log_, (level), args);                  \
+		}                                                             \
+	})
+
+/// @brief The least severe level of messages compiled into the binary, as
+/// set by the `MAVEN_IRCD_LOG_LVL_MIN` CMake option.
+///
+/// Call sites below this level compile to nothing, not even the runtime level
+/// check. Fatal messages are always compiled in.
+///
+/// * 0: Trace
+/// * 1: Debug
+/// * 2: Info
+/// * 3: Warning
+/// * 4: Error
+#ifndef IRC_LOG_SEVERITY_MIN
+#define IRC_LOG_SEVERITY_MIN (0)
+#endif
+
 // clang-format off
 
+#if IRC_LOG_SEVERITY_MIN <= 2
 #define IRC_LOG_INFO(log, args...) \
 	(IRC_LOG_MSG((log), IRC_LOG_LVL_INFO, args))
 
+#define IRC_LOG_INFO_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_MSG_RATELIMIT((log), IRC_LOG_LVL_INFO, (per_sec), args))
+#else
+#define IRC_LOG_INFO(log, args...) (IRC_LOG_NOP((log), args))
+#define IRC_LOG_INFO_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_NOP((log), args))
+#endif
+
+#if IRC_LOG_SEVERITY_MIN <= 3
 #define IRC_LOG_WARN(log, args...) \
 	(IRC_LOG_MSG((log), IRC_LOG_LVL_WARN, args))
 
+#define IRC_LOG_WARN_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_MSG_RATELIMIT((log), IRC_LOG_LVL_WARN, (per_sec), args))
+#else
+#define IRC_LOG_WARN(log, args...) (IRC_LOG_NOP((log), args))
+#define IRC_LOG_WARN_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_NOP((log), args))
+#endif
+
+#if IRC_LOG_SEVERITY_MIN <= 4
 #define IRC_LOG_ERR(log, args...) \
 	(IRC_LOG_MSG((log), IRC_LOG_LVL_ERR, args))
 
+#define IRC_LOG_ERR_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_MSG_RATELIMIT((log), IRC_LOG_LVL_ERR, (per_sec), args))
+#else
+#define IRC_LOG_ERR(log, args...) (IRC_LOG_NOP((log), args))
+#define IRC_LOG_ERR_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_NOP((log), args))
+#endif
+
 #define IRC_LOG_FATAL(log, args...) \
 	(IRC_LOG_MSG((log), IRC_LOG_LVL_FATAL, args))
 
+#if IRC_LOG_SEVERITY_MIN <= 1
 #define IRC_LOG_DBG(log, args...) \
 	(IRC_LOG_MSG((log), IRC_LOG_LVL_DBG, args))
 
+#define IRC_LOG_DBG_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_MSG_RATELIMIT((log), IRC_LOG_LVL_DBG, (per_sec), args))
+#else
+#define IRC_LOG_DBG(log, args...) (IRC_LOG_NOP((log), args))
+#define IRC_LOG_DBG_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_NOP((log), args))
+#endif
+
+#if IRC_LOG_SEVERITY_MIN <= 0
 #define IRC_LOG_TRACE(log, args...) \
 	(IRC_LOG_MSG((log), IRC_LOG_LVL_TRACE, args))
 
+#define IRC_LOG_TRACE_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_MSG_RATELIMIT((log), IRC_LOG_LVL_TRACE, (per_sec), args))
+#else
+#define IRC_LOG_TRACE(log, args...) (IRC_LOG_NOP((log), args))
+#define IRC_LOG_TRACE_RATELIMIT(log, per_sec, args...) \
+	(IRC_LOG_NOP((log), args))
+#endif
+
 // clang-format on
 
 #ifdef __cplusplus
@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// @file log_bin.h Defines the binary log sink and its on-disk format.
+///
+/// Instead of formatting a message, the binary sink records the ID of the
+/// call site that produced it, a timestamp and the packed arguments. The text
+/// is only reconstructed offline by the `irc-logdecode` tool, which makes
+/// leaving trace-level logging on in production affordable.
+///
+/// Log files are memory-mapped and rotated once they reach their configured
+/// size. Each file is self-describing: it begins with a header followed by a
+/// copy of the call site table of the binary that wrote it.
+///
+/// All integers are stored in host byte order; logs are expected to be
+/// decoded on a machine with the same endianness as the one that wrote them.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "log.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The magic value at the start of every binary log file.
+#define IRC_LOG_BIN_MAGIC               "IRCLOGB"
+
+/// @brief The current version of the binary log format.
+#define IRC_LOG_BIN_VERSION             (1)
+
+/// @brief The maximum length of a path to a binary log file.
+#define IRC_LOG_BIN_PATH_LEN_MAX        (255)
+
+/// @brief The maximum number of bytes of a single string argument stored in a
+/// record. Longer strings are truncated.
+#define IRC_LOG_BIN_STR_LEN_MAX         (256)
+
+/// @brief The maximum number of bytes of packed arguments in a record. Any
+/// arguments that do not fit are dropped.
+#define IRC_LOG_BIN_PAYLOAD_SIZE_MAX    (2048)
+
+// clang-format on
+
+/// @brief The header at the start of every binary log file.
+struct irc_log_bin_hdr {
+	/// @brief Always @ref IRC_LOG_BIN_MAGIC, including the NUL terminator.
+	char magic[8];
+
+	/// @brief The version of the format; see @ref IRC_LOG_BIN_VERSION.
+	u32 version;
+
+	/// @brief The number of entries in the call site table.
+	u32 num_sites;
+
+	/// @brief The size of the call site table in bytes. The first record
+	/// starts immediately after it.
+	u64 site_tbl_size;
+};
+
+/// @brief Precedes each entry of the call site table in a log file. The file
+/// name and format string follow, without NUL terminators.
+struct irc_log_bin_site {
+	u32 line;
+	u32 lvl;
+	u32 file_len;
+	u32 fmt_len;
+};
+
+/// @brief The header of a single record. The packed arguments follow.
+///
+/// Arguments are packed in the order they appear in the format string:
+/// integers, pointers and floating point values occupy 8 bytes each, and
+/// strings are stored as a 4 byte length followed by their bytes.
+struct irc_log_bin_rec {
+	/// @brief The size of the record including this header, or 0 if this
+	/// is the end of the log.
+	u32 size;
+
+	/// @brief The ID of the call site that produced this record.
+	u32 site_id;
+
+	/// @brief The time the record was written, in nanoseconds since the
+	/// UNIX epoch.
+	u64 ts;
+};
+
+/// @brief The classes of printf arguments as far as packing is concerned.
+enum irc_log_bin_arg {
+	// clang-format off
+
+	IRC_LOG_BIN_ARG_NONE	= 0,
+	IRC_LOG_BIN_ARG_INT	= 1,
+	IRC_LOG_BIN_ARG_UINT	= 2,
+	IRC_LOG_BIN_ARG_DBL	= 3,
+	IRC_LOG_BIN_ARG_STR	= 4,
+	IRC_LOG_BIN_ARG_PTR	= 5
+
+	// clang-format on
+};
+
+/// @brief The integer width given by the length modifier of a conversion.
+enum irc_log_bin_width {
+	// clang-format off
+
+	IRC_LOG_BIN_WIDTH_INT		= 0,
+	IRC_LOG_BIN_WIDTH_LONG		= 1,
+	IRC_LOG_BIN_WIDTH_LLONG		= 2,
+	IRC_LOG_BIN_WIDTH_SIZE		= 3,
+	IRC_LOG_BIN_WIDTH_INTMAX	= 4,
+	IRC_LOG_BIN_WIDTH_PTRDIFF	= 5
+
+	// clang-format on
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief Describes a single conversion specification of a format string.
+struct irc_log_bin_spec {
+	/// @brief The start of the specification, i.e. the `%` character.
+	const char *start;
+
+	/// @brief The length of the specification in characters.
+	size_t len;
+
+	/// @brief The number of `*` width or precision arguments consumed
+	/// before the argument itself.
+	uint num_stars;
+
+	/// @brief The class of the argument.
+	enum irc_log_bin_arg arg;
+
+	/// @brief The width of the argument, for integer classes.
+	enum irc_log_bin_width width;
+};
+
+/// @brief A binary log sink.
+///
+/// A sink is not thread-safe; it is meant to be driven by the thread that owns
+/// the @ref irc_log instance it is attached to.
+struct irc_log_bin {
+	/// @brief The path of the active log file. Rotated files get a `.1`,
+	/// `.2`, ... suffix, with `.1` being the most recent.
+	char path[IRC_LOG_BIN_PATH_LEN_MAX + 1];
+
+	/// @brief The start of the mapping of the active log file.
+	u8 *map;
+
+	/// @brief The size of a log file before it is rotated.
+	size_t size_max;
+
+	/// @brief The write offset within the active log file.
+	size_t pos;
+
+	/// @brief The monotonic time before which mapping the active file is
+	/// not retried, after failing to.
+	u64 retry_at;
+
+	/// @brief The number of rotated files to keep.
+	uint files_max;
+
+	/// @brief The file descriptor of the active log file.
+	int fd;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Opens a binary log sink.
+///
+/// Any existing file at `path` is rotated out of the way first.
+///
+/// @param bin The sink to open.
+/// @param path The path of the active log file.
+/// @param size_max The size at which the active log file is rotated.
+/// @param files_max The number of rotated files to keep.
+///
+/// @returns `true` if no errors were encountered, or `false` otherwise.
+bool irc_log_bin_open(struct irc_log_bin *bin, const char *path,
+		      size_t size_max, uint files_max);
+
+/// @brief Flushes and closes a binary log sink.
+void irc_log_bin_close(struct irc_log_bin *bin);
+
+/// @brief Appends a record for the given call site to the sink.
+///
+/// @param bin The sink to write to.
+/// @param site The call site that produced the message.
+/// @param args The arguments of the message, matching the call site's format
+/// string.
+void irc_log_bin_write(struct irc_log_bin *bin,
+		       const struct irc_log_site *site, va_list args);
+
+/// @brief Finds the next conversion specification in a format string.
+///
+/// Used both to pack arguments when writing and to render records back to
+/// text when decoding.
+///
+/// @param fmt The position in the format string to search from.
+/// @param spec Filled in with the details of the specification found.
+///
+/// @returns The position just past the specification, or `NULL` if there are
+/// no more specifications.
+const char *irc_log_bin_fmt_next(const char *fmt,
+				 struct irc_log_bin_spec *spec);
+
+/// @brief Renders the message of a record back to text.
+///
+/// Arguments missing from a truncated or corrupt payload are rendered as
+/// `<?>`.
+///
+/// @param out The stream to write the message to.
+/// @param fmt The format string of the call site of the record.
+/// @param payload The packed arguments of the record.
+/// @param size The size of `payload` in bytes.
+void irc_log_bin_render(FILE *out, const char *fmt, const u8 *payload,
+			size_t size);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
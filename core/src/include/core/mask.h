@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file mask.h Defines compiled sets of `nick!user@host` masks, as used by
+/// channel ban lists and K-lines.
+///
+/// * Masks are normalized to `nick!user@host`, missing parts being `*`, and
+///   kept split into their three parts.
+///
+/// * Every mask is filed by the form of its most selective part:
+///
+///   - a host without wildcards, in a hash table keyed by the host;
+///   - a host made of `*` and a literal suffix, in a trie of reversed hosts;
+///   - a host made of a literal prefix and `*`, in a trie of hosts;
+///   - failing those, a nickname without wildcards, in a hash table keyed by
+///     the nickname;
+///   - anything else, in a list that is matched one mask at a time.
+///
+///   The other parts of a mask are only matched once its filed part has
+///   matched, and are usually `*`.
+///
+/// * A small bloom filter over the keys of both hash tables answers most
+///   lookups of users no mask names without hashing anything, which is the
+///   common case.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+
+#include "compiler.h"
+#include "hash_table.h"
+#include "types.h"
+#include "user.h"
+
+// clang-format off
+
+/// @brief The maximum length of a normalized mask.
+#define IRC_MASK_LEN_MAX        (IRC_USER_NICK_LEN_MAX + 1 + \
+                                 IRC_USER_NAME_LEN_MAX + 1 + \
+                                 IRC_USER_HOST_LEN_MAX)
+
+/// @brief The number of 64-bit words of the bloom filter of a set.
+#define IRC_MASK_BLOOM_WORDS    (4)
+
+// clang-format on
+
+/// @brief How a mask is filed in a set.
+enum irc_mask_kind {
+	// clang-format off
+
+	IRC_MASK_HOST           = 0,
+	IRC_MASK_HOST_SUFFIX    = 1,
+	IRC_MASK_HOST_PREFIX    = 2,
+	IRC_MASK_NICK           = 3,
+	IRC_MASK_OTHER          = 4
+
+	// clang-format on
+};
+
+struct irc_mask_trie;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief The user a set of masks is matched against.
+struct irc_mask_subject {
+	const char *nick;
+	const char *user;
+	const char *host;
+};
+
+struct irc_mask_entry {
+	/// @brief The normalized mask.
+	char text[IRC_MASK_LEN_MAX + 1];
+
+	char nick[IRC_USER_NICK_LEN_MAX + 1];
+	char user[IRC_USER_NAME_LEN_MAX + 1];
+	char host[IRC_USER_HOST_LEN_MAX + 1];
+
+	/// @brief Who added the mask.
+	char setter[IRC_USER_NICK_LEN_MAX + 1];
+
+	/// @brief When the mask was added, in seconds since the epoch.
+	u64 set_at;
+
+	enum irc_mask_kind kind;
+
+	/// @brief The index of the entry in the entries of its set.
+	u32 idx;
+
+	/// @brief The next mask filed under the same key, trie node or list.
+	struct irc_mask_entry *next;
+};
+
+struct irc_mask_set {
+	/// @brief The masks, in no particular order.
+	struct irc_mask_entry **entries;
+	u32 num_entries;
+	u32 capacity;
+
+	/// @brief Maps normalized masks to their entries.
+	struct irc_ht by_text;
+
+	/// @brief Map literal hosts and nicknames to the masks filed under
+	/// them.
+	struct irc_ht hosts;
+	struct irc_ht nicks;
+
+	/// @brief The tries of host suffixes and prefixes.
+	struct irc_mask_trie *suffixes;
+	struct irc_mask_trie *prefixes;
+
+	/// @brief The masks matched one at a time.
+	struct irc_mask_entry *others;
+
+	/// @brief The number of masks in @ref hosts and @ref nicks.
+	u32 num_hashed;
+
+	/// @brief Has a bit set for every key of @ref hosts and @ref nicks.
+	u64 bloom[IRC_MASK_BLOOM_WORDS];
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Normalizes a mask to `nick!user@host`. A mask without `!` and `@`
+/// is taken as a host if it contains a `.` or a `:`, and as a nickname
+/// otherwise.
+///
+/// @returns `false` if the mask is malformed, or one of its parts too long.
+bool irc_mask_normalize(const char *mask, char *out);
+
+/// @brief Returns an empty set of masks.
+struct irc_mask_set *irc_mask_set_new(void);
+
+void irc_mask_set_free(struct irc_mask_set *set);
+
+/// @brief Adds a normalized mask to a set.
+///
+/// @param setter The nickname of whoever added it.
+/// @param set_at When it was added, in seconds since the epoch.
+///
+/// @returns The entry of the mask, or `NULL` if it was already in the set.
+const struct irc_mask_entry *irc_mask_set_add(struct irc_mask_set *set,
+					      const char *mask,
+					      const char *setter, u64 set_at);
+
+/// @brief Removes a normalized mask from a set.
+///
+/// @returns `false` if the mask was not in the set.
+bool irc_mask_set_del(struct irc_mask_set *set, const char *mask);
+
+/// @brief Returns `true` if any mask of a set matches a user.
+bool irc_mask_set_match(struct irc_mask_set *set,
+			const struct irc_mask_subject *subject);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
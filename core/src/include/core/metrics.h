@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// @file metrics.h Defines the metrics registry of an IRC server context.
+///
+/// * Every metric is known at compile time and addressed by its enumerator,
+///   so recording a value is an indexed store with no lookups.
+///
+/// * Each thread records into its own shard, which is aligned to a cache
+///   line so that threads never contend on the same line. Recording is a
+///   plain, non-atomic increment.
+///
+/// * Shards are only merged when the metrics are read, which is rare
+///   compared to how often they are recorded. Reads may observe a shard in
+///   the middle of an update; this is acceptable for monitoring purposes.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stddef.h>
+
+#include "event.h"
+#include "prof.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The maximum number of threads with their own shard. Threads beyond
+/// this share shards, and may lose updates.
+#define IRC_METRICS_SHARD_NUM_MAX       (16)
+
+/// @brief The number of buckets in a histogram. Bucket `i` counts values
+/// between `2^(i - 1)` and `2^i - 1`, and bucket 0 counts zeroes.
+#define IRC_METRICS_HIST_BUCKET_NUM     (64)
+
+/// @brief The size of a cache line, which shards are aligned to.
+#define IRC_METRICS_CACHE_LINE_SIZE     (64)
+
+// clang-format on
+
+/// @brief Monotonically increasing counters.
+enum irc_metric_counter {
+	// clang-format off
+
+	/// @brief Bytes read from client connections.
+	IRC_METRIC_BYTES_IN		= 0,
+
+	/// @brief Bytes written to client connections.
+	IRC_METRIC_BYTES_OUT		= 1,
+
+	/// @brief Lines received from clients.
+	IRC_METRIC_LINES_IN		= 2,
+
+	/// @brief Lines sent to clients.
+	IRC_METRIC_LINES_OUT		= 3,
+
+	/// @brief Client connections accepted.
+	IRC_METRIC_ACCEPTS		= 4,
+
+	/// @brief Lines from clients that could not be parsed.
+	IRC_METRIC_PARSE_FAILURES	= 5,
+
+	/// @brief Broadcasts deferred to later I/O loop iterations.
+	IRC_METRIC_FANOUT_DEFERRED	= 6,
+
+	/// @brief Client connections refused right after being accepted, by a
+	/// D-line or a per-subnet connection limit.
+	IRC_METRIC_ACCEPTS_REFUSED	= 7,
+
+	/// @brief Messages dropped by the content filter.
+	IRC_METRIC_MSGS_FILTERED	= 8,
+
+	IRC_METRIC_COUNTER_NUM		= 9
+
+	// clang-format on
+};
+
+/// @brief Values that can go up and down.
+enum irc_metric_gauge {
+	// clang-format off
+
+	/// @brief Client connections currently open.
+	IRC_METRIC_CLIENTS		= 0,
+
+	/// @brief Entries in the users table. Computed on read.
+	IRC_METRIC_USERS_HT_ENTRIES	= 1,
+
+	/// @brief Load of the users table, in permille. Computed on read.
+	IRC_METRIC_USERS_HT_LOAD	= 2,
+
+	/// @brief Deferred broadcasts not fully delivered yet. Computed on
+	/// read.
+	IRC_METRIC_FANOUT_BACKLOG	= 3,
+
+	/// @brief Recipients deferred broadcasts are still to be delivered
+	/// to. Computed on read.
+	IRC_METRIC_FANOUT_BACKLOG_RCPTS	= 4,
+
+	/// @brief The most bytes the I/O loop arena has held in one
+	/// iteration. Computed on read.
+	IRC_METRIC_ARENA_HIGH_WATER	= 5,
+
+	/// @brief The bytes of memory the I/O loop arena holds. Computed on
+	/// read.
+	IRC_METRIC_ARENA_CAPACITY	= 6,
+
+	IRC_METRIC_GAUGE_NUM		= 7
+
+	// clang-format on
+};
+
+/// @brief Distributions of values.
+enum irc_metric_hist {
+	// clang-format off
+
+	/// @brief The number of ready file descriptors returned per poll.
+	IRC_METRIC_HIST_POLL_BATCH	= 0,
+
+	/// @brief The time spent dispatching an event, in nanoseconds. There is
+	/// one histogram per event type, starting at this one.
+	IRC_METRIC_HIST_EVENT_DISPATCH	= 1,
+
+	/// @brief The time spent in each phase of an I/O loop iteration, in
+	/// nanoseconds. There is one histogram per phase, starting at this
+	/// one.
+	IRC_METRIC_HIST_LOOP_PHASE	= IRC_METRIC_HIST_EVENT_DISPATCH +
+					  IRC_EVENT_TYPE_NUM,
+
+	/// @brief The time an I/O loop iteration spent doing work, i.e. not
+	/// polling, in nanoseconds.
+	IRC_METRIC_HIST_LOOP_BUSY	= IRC_METRIC_HIST_LOOP_PHASE +
+					  IRC_PROF_PHASE_NUM,
+
+	IRC_METRIC_HIST_NUM		= IRC_METRIC_HIST_LOOP_BUSY + 1
+
+	// clang-format on
+};
+
+struct irc_metrics_hist {
+	u64 buckets[IRC_METRICS_HIST_BUCKET_NUM];
+
+	/// @brief The number of values recorded.
+	u64 count;
+
+	/// @brief The sum of the values recorded.
+	u64 sum;
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief The metrics recorded by a single thread. Padded to a whole number of
+/// cache lines.
+struct irc_metrics_shard {
+	u64 counters[IRC_METRIC_COUNTER_NUM];
+	i64 gauges[IRC_METRIC_GAUGE_NUM];
+	struct irc_metrics_hist hists[IRC_METRIC_HIST_NUM];
+} __attribute__((aligned(IRC_METRICS_CACHE_LINE_SIZE)));
+
+#pragma GCC diagnostic pop
+
+/// @brief The merged metrics of every shard.
+struct irc_metrics_snapshot {
+	u64 counters[IRC_METRIC_COUNTER_NUM];
+	i64 gauges[IRC_METRIC_GAUGE_NUM];
+	struct irc_metrics_hist hists[IRC_METRIC_HIST_NUM];
+};
+
+/// @brief Fills in the metrics that are computed on read rather than
+/// recorded.
+typedef void (*irc_metrics_collect_cb)(void *udata,
+				       struct irc_metrics_snapshot *snap);
+
+/// @brief Receives a single line of rendered output, without a line
+/// terminator.
+typedef void (*irc_metrics_emit_cb)(void *udata, const char *line,
+				    size_t len);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_metrics {
+	struct irc_metrics_shard shards[IRC_METRICS_SHARD_NUM_MAX];
+
+	/// @brief Called on every read; may be `NULL`.
+	irc_metrics_collect_cb collect;
+
+	/// @brief Passed to @ref collect.
+	void *udata;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief The shard of the calling thread. The first thread to record uses
+/// shard 0; any other thread must call @ref irc_metrics_thread_init() first.
+extern _Thread_local uint irc_metrics_shard_idx;
+
+/// @brief Assigns the calling thread a shard of its own.
+void irc_metrics_thread_init(void);
+
+/// @brief Merges the shards into a snapshot, and fills in the computed
+/// metrics.
+void irc_metrics_read(const struct irc_metrics *m,
+		      struct irc_metrics_snapshot *snap);
+
+/// @brief Renders a snapshot in the Prometheus text exposition format.
+void irc_metrics_render_prom(const struct irc_metrics_snapshot *snap,
+			     irc_metrics_emit_cb emit, void *udata);
+
+/// @brief Renders a snapshot as human readable `name value` lines, with
+/// histograms summarized by their count, mean and approximate quantiles.
+void irc_metrics_render_text(const struct irc_metrics_snapshot *snap,
+			     irc_metrics_emit_cb emit, void *udata);
+
+// clang-format off
+
+#define IRC_METRICS_SHARD(m) (&(m)->shards[irc_metrics_shard_idx])
+
+#define IRC_METRIC_ADD(m, id, n) \
+	(IRC_METRICS_SHARD(m)->counters[(id)] += (n))
+
+#define IRC_METRIC_INC(m, id) (IRC_METRIC_ADD((m), (id), 1))
+
+#define IRC_METRIC_GAUGE_ADD(m, id, n) \
+	(IRC_METRICS_SHARD(m)->gauges[(id)] += (n))
+
+// clang-format on
+
+/// @brief Returns the bucket a value falls into.
+static inline uint irc_metrics_hist_bucket(const u64 val)
+{
+	if (!val) {
+		return 0;
+	}
+
+	const uint bucket = 64 - (uint)__builtin_clzll(val);
+
+	return (bucket < IRC_METRICS_HIST_BUCKET_NUM) ?
+		       bucket :
+		       (IRC_METRICS_HIST_BUCKET_NUM - 1);
+}
+
+/// @brief Records a value in a histogram.
+static inline void irc_metrics_hist_record(struct irc_metrics *const m,
+					   const uint id, const u64 val)
+{
+	struct irc_metrics_hist *hist = &IRC_METRICS_SHARD(m)->hists[id];
+
+	hist->buckets[irc_metrics_hist_bucket(val)]++;
+	hist->count++;
+	hist->sum += val;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file monitor.h Defines the reverse index of MONITOR lists, from the
+/// nicknames being monitored to the users monitoring them.
+///
+/// * Nicknames are filed in a hash table under the case mapping, so that a
+///   user connecting, quitting or changing nickname costs one lookup and a
+///   walk of its watchers, however many users monitor however many names.
+///
+/// * A nickname stays filed for as long as someone monitors it, whether it is
+///   in use or not. Its entry is a single allocation holding the nickname and
+///   a vector of watchers, and is freed along with its last watcher.
+///
+/// * The links between users and nicknames live in an array in each user,
+///   which the entries point into. Either side knows the index of a link in
+///   the other, so removing one takes constant time from both.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+
+#include "hash_table.h"
+#include "types.h"
+#include "user.h"
+
+// clang-format off
+
+/// @brief The number of nicknames a user may monitor at most.
+#define IRC_MONITOR_NUM_MAX     (100)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_monitor;
+
+/// @brief Links a user to a nickname it monitors.
+struct irc_monitor_link {
+	struct irc_monitor *target;
+	struct irc_user *user;
+
+	/// @brief The index of the link among the watchers of @ref target.
+	u32 target_idx;
+};
+
+/// @brief A nickname monitored by at least one user.
+struct irc_monitor {
+	/// @brief The users monitoring the nickname.
+	struct irc_monitor_link **watchers;
+	u32 num_watchers;
+	u32 capacity;
+
+	/// @brief The nickname, as first monitored. This is the key of the
+	/// table the entry is filed in.
+	char nick[];
+};
+
+#pragma GCC diagnostic pop
+
+enum irc_monitor_add_result {
+	// clang-format off
+
+	IRC_MONITOR_ADDED       = 0,
+
+	/// @brief The user already monitors the nickname.
+	IRC_MONITOR_PRESENT     = 1,
+
+	/// @brief The user monitors @ref IRC_MONITOR_NUM_MAX nicknames.
+	IRC_MONITOR_FULL        = 2
+
+	// clang-format on
+};
+
+/// @brief Initializes the table of monitored nicknames.
+void irc_monitors_init(struct irc_ht *monitors);
+
+/// @brief Adds a nickname to the MONITOR list of a user.
+enum irc_monitor_add_result irc_monitor_add(struct irc_ht *monitors,
+					    struct irc_user *user,
+					    const char *nick);
+
+/// @brief Removes a nickname from the MONITOR list of a user.
+/// @returns `false` if the user did not monitor it, or `true` otherwise.
+bool irc_monitor_del(struct irc_ht *monitors, struct irc_user *user,
+		     const char *nick);
+
+/// @brief Empties the MONITOR list of a user.
+void irc_monitor_clear(struct irc_ht *monitors, struct irc_user *user);
+
+/// @brief Returns the entry of a nickname, or `NULL` if nobody monitors it.
+static inline struct irc_monitor *irc_monitor_find(struct irc_ht *monitors,
+						   const char *nick)
+{
+	return irc_ht_get(monitors, nick);
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -26,22 +26,104 @@
 extern "C" {
 #endif // __cplusplus
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "cidr.h"
+#include "compiler.h"
 #include "conf.h"
 #include "event.h"
+#include "hash_table.h"
 #include "log.h"
 
+// clang-format off
+
+/// @brief Returned by @ref irc_net_writev() if nothing could be written
+/// without blocking.
+#define IRC_NET_WOULD_BLOCK     (-2)
+
+// clang-format on
+
+enum irc_net_listener_type {
+	// clang-format off
+
+	/// @brief Accepts IRC client connections.
+	IRC_NET_LISTENER_CLIENT = 0,
+
+	/// @brief Accepts connections to the local metrics socket.
+	IRC_NET_LISTENER_STATS  = 1,
+
+	/// @brief Accepts connections from other servers; see link.h.
+	IRC_NET_LISTENER_SERVER = 2
+
+	// clang-format on
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_net_listener {
+	int fd;
+	enum irc_net_listener_type type;
+
+	/// @brief Where the listener was asked to listen, if it listens for
+	/// TCP connections; matched against the configuration on a rehash.
+	struct irc_conf_listener addr;
+};
+
+#pragma GCC diagnostic pop
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A subnet client connections are open from, counted against
+/// @ref irc_conf::clones.
+struct irc_net_subnet {
+	/// @brief The address of the subnet, with the bits past its prefix
+	/// cleared. This is the key of @ref irc_net::subnets.
+	struct irc_cidr_addr addr;
+
+	uint num_conns;
+};
+
+#pragma GCC diagnostic pop
+
+struct irc_metrics;
+struct irc_prof;
+
 struct irc_net {
 	struct {
-		int entries[IRC_CONF_LISTENER_NUM_MAX];
+		/// @brief The client listeners, plus the metrics socket and
+		/// the server listener.
+		struct irc_net_listener entries[IRC_CONF_LISTENER_NUM_MAX + 2];
 		size_t num_entries;
 	} listeners;
 
+	/// @brief The networks client connections are refused from, or `NULL`
+	/// if there are none.
+	const struct irc_cidr_tree *dlines;
+
+	/// @brief Holds the subnets client connections are open from, if
+	/// their number is limited.
+	struct {
+		/// @brief The subnets, keyed by their address.
+		struct irc_ht by_addr;
+
+		/// @brief The subnet of every client connection, indexed by
+		/// its file descriptor.
+		struct irc_net_subnet **by_fd;
+		size_t num_fds;
+	} subnets;
+
 	struct irc_conf *conf;
 	struct irc_log *log;
 	struct irc_event *event;
+	struct irc_metrics *metrics;
+	struct irc_prof *prof;
 };
 
-/// @brief Initializes the network module.
+/// @brief Initializes the network module. Nothing is listened on until
+/// @ref irc_net_listeners_apply() is called.
 /// @param net The network instance to initialize.
 void irc_net_init(struct irc_net *net);
 
@@ -66,15 +148,83 @@ bool irc_net_platform_client_add(struct irc_net *net, int fd);
 /// interest.
 ///
 /// @param net The network instance associated with the multiplexer.
-void irc_net_platform_poll(struct irc_net *net);
+/// @param timeout_ms The time to wait for a change at most, in milliseconds;
+/// -1 waits indefinitely, and 0 returns immediately.
+void irc_net_platform_poll(struct irc_net *net, int timeout_ms);
 
-void irc_net_accept(struct irc_net *net, const int fd);
+/// @brief Accepts every pending connection on a listener.
+/// @param net The network instance associated with the listener.
+/// @param listener The listener with pending connections.
+void irc_net_accept(struct irc_net *net,
+		    const struct irc_net_listener *listener);
 
+/// @brief Reads everything available on a client connection, publishing it as
+/// @ref IRC_EVENT_TYPE_NET_DATA_RECV events. The connection is closed if the
+/// peer has closed it, or on error.
 void irc_net_read(struct irc_net *const net, const int fd);
 
+/// @brief Writes data to a client connection, without blocking.
+///
+/// @returns The number of bytes written, which may be less than requested;
+/// @ref IRC_NET_WOULD_BLOCK if the socket buffer is full; or -1 if the
+/// connection is broken.
+ssize_t irc_net_writev(struct irc_net *net, int fd, const struct iovec *iov,
+		       int iov_cnt);
+
+/// @brief Closes a client connection, publishing
+/// @ref IRC_EVENT_TYPE_NET_CLIENT_DISCONN beforehand.
+void irc_net_close(struct irc_net *net, int fd);
+
+/// @brief Returns the listener associated with a file descriptor, or `NULL`
+/// if it is not a listener.
+struct irc_net_listener *irc_net_listener_get(struct irc_net *net, int fd)
+	IRC_ATTRIB_PURE;
+
 bool irc_net_listen(struct irc_net *const net, const char *host,
 		    const char *port);
 
+/// @brief Listens for connections from other servers, published as
+/// @ref IRC_EVENT_TYPE_NET_SERVER_CONN events.
+/// @returns `false` if an error was encountered, or `true` otherwise.
+bool irc_net_listen_servers(struct irc_net *net, const char *host,
+			    const char *port);
+
+/// @brief Starts connecting to another server, without blocking. Once the
+/// attempt is over, the connection is reported writable; see
+/// @ref irc_net_connected(). It is closed like any other connection.
+///
+/// @returns The file descriptor of the connection, or -1 if the attempt failed
+/// right away.
+int irc_net_connect(struct irc_net *net, const char *host, const char *port);
+
+/// @brief Returns `true` if a connection started by @ref irc_net_connect() has
+/// been established, or `false` if the attempt failed.
+bool irc_net_connected(struct irc_net *net, int fd);
+
+/// @brief Listens for connections to the metrics socket, a UNIX domain socket
+/// that serves the metrics in the Prometheus text format.
+/// @returns `false` if an error was encountered, or `true` otherwise.
+bool irc_net_listen_stats(struct irc_net *net, const char *path);
+
+/// @brief Brings the listeners in line with a new configuration, before it
+/// replaces the current one: the listeners that are no longer configured are
+/// closed, and the ones that are new are opened. The others, and every
+/// connection they accepted, are left alone.
+void irc_net_listeners_apply(struct irc_net *net, const struct irc_conf *next);
+
+/// @brief Takes over a listener opened by another process; see upgrade.h.
+///
+/// @param addr Where the listener listens, if it listens for TCP connections.
+/// @returns `false` if an error was encountered, or `true` otherwise.
+bool irc_net_listener_adopt(struct irc_net *net, int fd,
+			    enum irc_net_listener_type type,
+			    const struct irc_conf_listener *addr);
+
+/// @brief Takes over a client connection accepted by another process, counting
+/// it against its subnet; see upgrade.h. Nothing is published.
+/// @returns `false` if an error was encountered, or `true` otherwise.
+bool irc_net_client_adopt(struct irc_net *net, int fd);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
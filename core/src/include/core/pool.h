@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file pool.h Defines pools of fixed size objects for the structures that
+/// are allocated and freed at a high rate: users, channel memberships, output
+/// buffers, send queues, deferred broadcasts and partial input lines.
+///
+/// * Sizes are rounded up to one of a set of classes, four per power of two,
+///   which wastes at most a fifth of an object. Objects of a class are carved
+///   out of slabs that are never returned to the system, so that bursts of
+///   connections and disconnections reuse the same memory rather than
+///   fragmenting the heap.
+///
+/// * Each thread keeps a cache of free objects per class. It is refilled from
+///   the shared free list of the class, and drained back to it, a batch at a
+///   time, so that the lock of the class is taken once per batch rather than
+///   once per object.
+///
+/// * Every allocation is charged to a subsystem, which counts the objects and
+///   bytes it holds. STATS z reports them, along with the memory held by each
+///   class.
+///
+/// Objects larger than @ref IRC_POOL_SIZE_MAX are left to the system
+/// allocator, but are still accounted for. So is everything if the core is
+/// built with sanitizers, which could not see through a pool.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stddef.h>
+
+#include "compiler.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The size of the largest objects allocated from pools.
+#define IRC_POOL_SIZE_MAX       (4096)
+
+/// @brief The number of size classes.
+#define IRC_POOL_CLASS_NUM      (28)
+
+// clang-format on
+
+/// @brief What an allocation is for.
+enum irc_pool_sys {
+	// clang-format off
+
+	IRC_POOL_USERS          = 0,
+	IRC_POOL_MEMBERS        = 1,
+	IRC_POOL_BUFS           = 2,
+	IRC_POOL_SENDQS         = 3,
+	IRC_POOL_FANOUTS        = 4,
+	IRC_POOL_RECVQS         = 5,
+
+	IRC_POOL_SYS_NUM        = 6
+
+	// clang-format on
+};
+
+/// @brief What a subsystem holds.
+struct irc_pool_sys_stats {
+	u64 num_objs;
+
+	/// @brief The number of bytes of the objects, as rounded up to their
+	/// class.
+	u64 num_bytes;
+};
+
+/// @brief Receives a single line of a report, without a line terminator.
+typedef void (*irc_pool_emit_cb)(void *udata, const char *line, size_t len);
+
+/// @brief Allocates an object. Never fails.
+void *irc_pool_alloc(enum irc_pool_sys sys, size_t size);
+
+/// @brief Allocates an object filled with zeros. Never fails.
+void *irc_pool_calloc(enum irc_pool_sys sys, size_t size);
+
+/// @brief Frees an object.
+///
+/// @param sys The subsystem it was allocated for.
+/// @param size The size it was allocated with.
+void irc_pool_free(enum irc_pool_sys sys, void *ptr, size_t size);
+
+/// @brief Returns the size an allocation is rounded up to, which is its own
+/// size if it is not allocated from a pool.
+size_t irc_pool_size(size_t size) IRC_ATTRIB_CONST;
+
+/// @brief Returns the objects cached by the calling thread to their pools.
+/// Threads that allocate from pools call this before exiting.
+void irc_pool_thread_exit(void);
+
+/// @brief Reads what a subsystem holds.
+void irc_pool_sys_stats(enum irc_pool_sys sys,
+			struct irc_pool_sys_stats *stats);
+
+/// @brief Reports what each subsystem holds, one line each, followed by the
+/// memory held by each class in use.
+void irc_pool_report(irc_pool_emit_cb emit, void *udata);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
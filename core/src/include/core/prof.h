@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file prof.h Defines the phase profiler of the I/O loop.
+///
+/// Every iteration of the I/O loop is split into phases, and the time spent
+/// in each phase is recorded into a histogram of the metrics registry when
+/// the iteration ends. The time of a phase entered from within another
+/// phase is only accounted to the inner phase.
+///
+/// The current phase and the start of the busy part of the iteration are
+/// also published for the watchdog; see watchdog.h. An iteration may poll in
+/// the middle, after running its timers; the busy part then starts over once
+/// polling is done.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdatomic.h>
+
+#include "clock.h"
+#include "compiler.h"
+#include "types.h"
+
+/// @brief The phases of an I/O loop iteration.
+enum irc_prof_phase {
+	// clang-format off
+
+	/// @brief Waiting for the multiplexer to report ready file
+	/// descriptors.
+	IRC_PROF_PHASE_POLL	= 0,
+
+	/// @brief Accepting connections and reading from sockets.
+	IRC_PROF_PHASE_READ	= 1,
+
+	/// @brief Parsing received lines.
+	IRC_PROF_PHASE_PARSE	= 2,
+
+	/// @brief Running event handlers and commands.
+	IRC_PROF_PHASE_DISPATCH	= 3,
+
+	/// @brief Writing to sockets.
+	IRC_PROF_PHASE_FLUSH	= 4,
+
+	/// @brief Running expired timers, such as link retries and periodic
+	/// snapshots, and the rehashes and upgrades requested by signals.
+	IRC_PROF_PHASE_TIMERS	= 5,
+
+	/// @brief Delivering deferred broadcasts and streamed replies.
+	IRC_PROF_PHASE_FANOUT	= 6,
+
+	IRC_PROF_PHASE_NUM	= 7
+
+	// clang-format on
+};
+
+struct irc_metrics;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_prof {
+	/// @brief Receives the phase timings of every iteration.
+	struct irc_metrics *metrics;
+
+	/// @brief The time spent in each phase so far in this iteration.
+	u64 phase_ns[IRC_PROF_PHASE_NUM];
+
+	/// @brief The time of the last phase change.
+	u64 mark;
+
+	/// @brief A bit mask of the phases entered in this iteration.
+	uint entered;
+
+	/// @brief The current phase. Written by the I/O thread only.
+	_Atomic uint phase;
+
+	/// @brief The time at which the iteration last stopped polling, or 0
+	/// while it is polling. Written by the I/O thread only.
+	_Atomic u64 busy_since;
+
+	/// @brief The number of iterations completed.
+	_Atomic u64 num_iters;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Starts an iteration of the I/O loop in the poll phase.
+void irc_prof_iter_begin(struct irc_prof *prof);
+
+/// @brief Ends an iteration of the I/O loop, and records the time spent in
+/// every phase entered.
+void irc_prof_iter_end(struct irc_prof *prof);
+
+/// @brief Returns the name of a phase, for use in metrics and logs.
+const char *irc_prof_phase_name(enum irc_prof_phase phase) IRC_ATTRIB_CONST;
+
+/// @brief Switches to another phase.
+///
+/// @returns The previous phase, to be passed to @ref irc_prof_leave().
+static inline enum irc_prof_phase irc_prof_enter(struct irc_prof *const prof,
+						 const enum irc_prof_phase phase)
+{
+	const u64 now = irc_clock_mono_ns();
+
+	const enum irc_prof_phase prev = (enum irc_prof_phase)
+		atomic_load_explicit(&prof->phase, memory_order_relaxed);
+
+	prof->phase_ns[prev] += now - prof->mark;
+	prof->mark = now;
+	prof->entered |= 1U << phase;
+
+	// Leaving the poll phase starts the busy part of the iteration, which
+	// is what the watchdog measures, and going back to it ends it.
+	if (phase == IRC_PROF_PHASE_POLL) {
+		atomic_store_explicit(&prof->busy_since, 0,
+				      memory_order_relaxed);
+	} else if (prev == IRC_PROF_PHASE_POLL) {
+		atomic_store_explicit(&prof->busy_since, now,
+				      memory_order_relaxed);
+	}
+	atomic_store_explicit(&prof->phase, phase, memory_order_relaxed);
+	return prev;
+}
+
+/// @brief Returns to the phase that was current before the matching
+/// @ref irc_prof_enter().
+static inline void irc_prof_leave(struct irc_prof *const prof,
+				  const enum irc_prof_phase prev)
+{
+	irc_prof_enter(prof, prev);
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file sendq.h Defines the send queue of a connection.
+///
+/// A send queue is a ring of references to output buffers, written out with
+/// as few `writev()` calls as possible. Only the first buffer may have been
+/// partially written.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stddef.h>
+
+#include "buf.h"
+#include "types.h"
+
+struct irc_net;
+
+/// @brief The outcome of flushing a send queue.
+enum irc_sendq_status {
+	// clang-format off
+
+	/// @brief The send queue has been written out entirely.
+	IRC_SENDQ_EMPTY		= 0,
+
+	/// @brief The socket buffer is full; the rest has to wait until the
+	/// socket is writable again.
+	IRC_SENDQ_BLOCKED	= 1,
+
+	/// @brief The connection is broken.
+	IRC_SENDQ_ERR		= 2
+
+	// clang-format on
+};
+
+struct irc_sendq {
+	/// @brief The queued buffers, of which there are @ref num_entries
+	/// starting at @ref head.
+	struct irc_buf **entries;
+
+	/// @brief The index of the oldest buffer.
+	u32 head;
+
+	u32 num_entries;
+
+	/// @brief The size of @ref entries; always a power of two, or 0.
+	u32 capacity;
+
+	/// @brief The number of bytes of the oldest buffer already written.
+	u32 head_off;
+
+	/// @brief The number of bytes waiting to be written.
+	size_t len;
+};
+
+/// @brief Appends a reference to a buffer. The send queue takes ownership of
+/// the reference.
+void irc_sendq_push(struct irc_sendq *sendq, struct irc_buf *buf);
+
+/// @brief Writes out as much of the send queue as the socket takes. Once it
+/// has all been written out, the storage of the send queue is freed.
+enum irc_sendq_status irc_sendq_flush(struct irc_sendq *sendq,
+				      struct irc_net *net, int fd);
+
+/// @brief Drops every queued buffer, and frees the send queue's memory.
+void irc_sendq_clear(struct irc_sendq *sendq);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
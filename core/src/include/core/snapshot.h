@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file snapshot.h Defines the snapshot of the channels, which outlives the
+/// process, and its on-disk format.
+///
+/// The snapshot holds what a channel would otherwise lose when the server
+/// stops: its name, when it was created, and its lists of masks. It is
+/// written periodically by a forked child, which sees the channels as they
+/// were at the time of the fork and writes them out while the I/O loop
+/// carries on; the file is replaced as a whole, once it has been synced.
+///
+/// At startup the file is mapped, and only its header is checked; nothing is
+/// rebuilt before the first client is accepted. The file is laid out so that
+/// it can be looked up as it is mapped:
+///
+/// * The header is followed by an open addressing hash table of
+///   @ref irc_snapshot_slot entries, probed linearly, keyed by the case mapped
+///   name of a channel hashed with the secret key stored in the header. The
+///   table is at most half full.
+///
+/// * Slots refer to channel records by their offset in the file, rather than
+///   by pointer, so that the mapping needs no fixups wherever it lands.
+///
+/// * Every @ref irc_snapshot_chan record is followed by the records of its
+///   masks; the bans first, then the exceptions.
+///
+/// A channel is only restored once a local user joins it and it does not
+/// exist, from its record in the mapping. From then on it lives, and dies,
+/// like any other channel; the next snapshot writes it out as it is then.
+/// Channels of the mapping nobody joined are carried over to the next
+/// snapshot as they were.
+///
+/// Records are checked as they are restored, and dropped if they do not make
+/// sense. All integers are stored in host byte order.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chan.h"
+#include "hash_table.h"
+#include "mask.h"
+#include "types.h"
+#include "user.h"
+
+// clang-format off
+
+/// @brief The magic value at the start of every snapshot file.
+#define IRC_SNAPSHOT_MAGIC      "IRCSNAP"
+
+/// @brief The current version of the snapshot format.
+#define IRC_SNAPSHOT_VERSION    (1)
+
+// clang-format on
+
+struct irc_ctx;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief The header at the start of every snapshot file. The slots of the
+/// table follow immediately.
+struct irc_snapshot_hdr {
+	/// @brief Always @ref IRC_SNAPSHOT_MAGIC, including the NUL terminator.
+	char magic[8];
+
+	/// @brief The version of the format; see @ref IRC_SNAPSHOT_VERSION.
+	u32 version;
+
+	/// @brief The number of slots of the table; a power of two.
+	u32 num_slots;
+
+	/// @brief The number of channels.
+	u32 num_chans;
+
+	/// @brief The key the names are hashed with; see
+	/// @ref irc_casemap_ht_hash().
+	u8 secret_key[IRC_SIPHASH_SECRET_KEY_LEN];
+
+	/// @brief The size of the file in bytes, which offsets are below.
+	u64 size;
+
+	/// @brief When the snapshot was taken, in seconds since the epoch.
+	u64 taken_at;
+};
+
+/// @brief A slot of the table of a snapshot file.
+struct irc_snapshot_slot {
+	/// @brief The offset of the channel record in the file, or 0 if the
+	/// slot is empty.
+	u32 off;
+
+	/// @brief The low bits of the hash of the name of the channel, which
+	/// most names that are not it differ in.
+	u32 hash;
+};
+
+/// @brief The record of a channel. The records of its masks follow.
+struct irc_snapshot_chan {
+	char name[IRC_CHAN_NAME_LEN_MAX + 1];
+
+	/// @brief When the channel was created, in seconds since the epoch.
+	u64 created;
+
+	/// @brief The number of masks in each list, by @ref irc_chan_masks.
+	u32 num_masks[IRC_CHAN_MASKS_NUM];
+};
+
+/// @brief The record of a mask of a channel.
+struct irc_snapshot_mask {
+	/// @brief The normalized mask.
+	char text[IRC_MASK_LEN_MAX + 1];
+
+	/// @brief Who added the mask.
+	char setter[IRC_USER_NICK_LEN_MAX + 1];
+
+	/// @brief When the mask was added, in seconds since the epoch.
+	u64 set_at;
+};
+
+/// @brief The snapshot of an IRC server context.
+struct irc_snapshot {
+	/// @brief The file mapped at startup, or `NULL` if there was none.
+	const struct irc_snapshot_hdr *hdr;
+
+	/// @brief The slots of the table of @ref hdr.
+	const struct irc_snapshot_slot *slots;
+
+	/// @brief A bit per slot, set once its channel has been restored.
+	u64 *restored;
+
+	/// @brief The child writing the next snapshot.
+	struct {
+		/// @brief Its process ID, or 0 if no snapshot is being
+		/// written.
+		int pid;
+
+		/// @brief When it was started, on the monotonic clock.
+		u64 start_ns;
+	} writer;
+
+	/// @brief When the next snapshot is due, on the monotonic clock in
+	/// milliseconds; or 0 if it has not been scheduled yet.
+	u64 next_ms;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Maps a snapshot file, and checks its header.
+///
+/// @returns `false` if the file could not be mapped, with `errno` set; it is
+/// `EINVAL` if the file is not a snapshot of this version.
+bool irc_snapshot_open(struct irc_snapshot *snap, const char *path);
+
+/// @brief Unmaps the snapshot file, if any.
+void irc_snapshot_close(struct irc_snapshot *snap);
+
+/// @brief Returns the record of a channel that is yet to be restored, or
+/// `NULL` if there is none.
+const struct irc_snapshot_chan *
+irc_snapshot_find(const struct irc_snapshot *snap, const char *name);
+
+/// @brief Creates a channel from its record in the snapshot, with the time it
+/// was created and its lists of masks. The channel must not exist.
+///
+/// @returns The channel, which is empty; or `NULL` if the snapshot does not
+/// hold it, or it was restored already.
+struct irc_chan *irc_snapshot_restore(struct irc_snapshot *snap,
+				      struct irc_chans *chans,
+				      const char *name);
+
+/// @brief Destroys a channel that was just restored, before anyone joined it,
+/// and leaves its record to be restored again; e.g. when whoever it was
+/// restored for is banned from it.
+void irc_snapshot_unrestore(struct irc_snapshot *snap, struct irc_chans *chans,
+			    struct irc_chan *chan);
+
+/// @brief Writes the channels, along with the channels of the mapping that are
+/// yet to be restored, to a snapshot file. The file is replaced as a whole.
+///
+/// @returns `false` if the file could not be written, with `errno` set.
+bool irc_snapshot_write(const struct irc_snapshot *snap,
+			struct irc_chans *chans, const char *path);
+
+/// @brief Starts writing a snapshot in the background once one is due, and
+/// collects the child that wrote the previous one. Called by the I/O loop
+/// before it waits for events.
+///
+/// @returns The number of milliseconds until it has to be called again, or
+/// -1 if there is no snapshot file.
+int irc_snapshot_tick(struct irc_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
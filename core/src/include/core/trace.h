@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file trace.h Defines the static tracepoints of the core.
+///
+/// When built with `MAVEN_IRCD_ENABLE_USDT`, every tracepoint is a USDT probe
+/// of the `maven_ircd` provider, which compiles to a single NOP and a note
+/// describing where its arguments live. Tools such as bpftrace and SystemTap
+/// can attach to them at runtime, e.g.:
+///
+///     bpftrace -e 'usdt:./maven-ircd:maven_ircd:net_read
+///                  { @bytes[arg0] = sum(arg1); }'
+///
+/// Otherwise, tracepoints compile to nothing at all. Arguments must be cheap
+/// to compute, as they are evaluated even if nothing is attached.
+///
+/// The table below is checked against the probes of the server by
+/// `test_core_trace`, which is built along with them.
+///
+/// | Probe               | Arguments                                    |
+/// |---------------------|----------------------------------------------|
+/// | `net_accept`        | client fd, listener fd                       |
+/// | `net_read`          | fd, bytes read                               |
+/// | `net_send`          | fd, buffers, bytes sent or -1                |
+/// | `msg_parse_start`   | line, line length                            |
+/// | `msg_parse_done`    | command, number of parameters                |
+/// | `event_pub_start`   | event type                                   |
+/// | `event_pub_done`    | event type                                   |
+/// | `ht_resize`         | table, old capacity, new capacity            |
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifdef IRC_HAVE_USDT
+
+#include <sys/sdt.h>
+
+#define IRC_TRACE(name, args...) STAP_PROBEV(maven_ircd, name, ##args)
+
+#else
+
+static inline void irc_trace_nop(const int unused, ...)
+{
+	(void)unused;
+}
+
+/// Keeps the arguments type checked, and referenced, without evaluating
+/// them.
+#define IRC_TRACE(name, args...)                  \
+	({                                        \
+		if (0) {                          \
+			irc_trace_nop(0, ##args); \
+		}                                 \
+	})
+
+#endif // IRC_HAVE_USDT
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file treap.h Defines an ordered set of intrusive nodes, kept balanced by
+/// random priorities.
+///
+/// * Nodes are embedded in the structures they order, which are found again
+///   from a node with @ref IRC_CONTAINER_OF.
+///
+/// * Every node is given a random priority when inserted, and the tree is
+///   kept a heap of priorities by rotations. Its expected depth is then
+///   logarithmic whatever order the keys arrive in; the priorities are drawn
+///   from a generator seeded at random, so that it can not be predicted.
+///
+/// * Nodes link to their parent, so that walking on to the next node never
+///   has to search from the root again.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include "compiler.h"
+#include "types.h"
+
+struct irc_treap_node;
+
+/// @brief Compares a key with the key of a node, like `strcmp()`.
+typedef int (*irc_treap_cmp_cb)(const void *key,
+				const struct irc_treap_node *node);
+
+/// @brief Returns the key of a node, as passed to @ref irc_treap_cmp_cb.
+typedef const void *(*irc_treap_key_cb)(const struct irc_treap_node *node);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_treap_node {
+	struct irc_treap_node *parent;
+	struct irc_treap_node *left;
+	struct irc_treap_node *right;
+	u32 prio;
+};
+
+struct irc_treap_conf {
+	irc_treap_cmp_cb cmp;
+	irc_treap_key_cb key;
+};
+
+struct irc_treap {
+	/// @brief The configuration parameters of the treap.
+	struct irc_treap_conf conf;
+
+	struct irc_treap_node *root;
+
+	/// @brief The state of the generator priorities are drawn from.
+	u64 prio_state;
+
+	/// @brief The number of nodes in the treap.
+	size_t num_nodes;
+};
+
+#pragma GCC diagnostic pop
+
+void irc_treap_init(struct irc_treap *treap, const struct irc_treap_conf *conf);
+
+/// @brief Inserts a node. Nodes with equal keys are kept in the order they
+/// were inserted in.
+void irc_treap_insert(struct irc_treap *treap, struct irc_treap_node *node);
+
+/// @brief Removes a node, which must be in the treap.
+void irc_treap_remove(struct irc_treap *treap, struct irc_treap_node *node);
+
+/// @brief Returns the node with the lowest key, or `NULL` if the treap is
+/// empty.
+struct irc_treap_node *irc_treap_first(const struct irc_treap *treap)
+	IRC_ATTRIB_PURE;
+
+/// @brief Returns the node following a node, or `NULL` if it is the last.
+struct irc_treap_node *irc_treap_next(const struct irc_treap_node *node)
+	IRC_ATTRIB_PURE;
+
+/// @brief Returns the first node whose key is not less than a key, or `NULL`
+/// if there is none.
+struct irc_treap_node *irc_treap_lower_bound(const struct irc_treap *treap,
+					     const void *key);
+
+/// @brief Returns the first node whose key is greater than a key, or `NULL`
+/// if there is none.
+struct irc_treap_node *irc_treap_upper_bound(const struct irc_treap *treap,
+					     const void *key);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -29,9 +29,13 @@ extern "C" {
 #include <stdint.h>
 
 typedef unsigned int uint;
+typedef uint64_t u64;
 typedef uint32_t u32;
+typedef uint16_t u16;
 typedef uint8_t u8;
 
+typedef int64_t i64;
+
 #ifdef __cplusplus
 }
 #endif // cplusplus
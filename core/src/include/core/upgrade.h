@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file upgrade.h Defines the hand over of a running server to a new binary,
+/// without dropping any client.
+///
+/// On request, the I/O loop finishes delivering its deferred broadcasts, and
+/// closes its links to other servers; the new process links up again on its
+/// own, and local users see a netsplit in between. The clients, channels and
+/// memberships are then serialized into a snapshot, along with whatever is
+/// queued to and from each client and the WHO and LIST replies being streamed.
+///
+/// The new binary is started with one end of a UNIX socket pair as
+/// @ref IRC_UPGRADE_FD, and @ref IRC_UPGRADE_ENV set. It is sent the snapshot,
+/// followed by the file descriptors of the listeners and clients, passed with
+/// `SCM_RIGHTS`. It rebuilds its tables from the snapshot before it polls for
+/// the first time, and acknowledges; the old process only exits then. If
+/// anything goes wrong before that, the new process is killed, and the old
+/// one carries on as if nothing happened.
+///
+/// Connections are never closed in between: they are shared by both processes
+/// for as long as the hand over lasts, and only the old process stops reading
+/// from them. Whatever clients send in the meantime waits in the kernel.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+
+// clang-format off
+
+/// @brief The file descriptor the new process receives the snapshot on.
+#define IRC_UPGRADE_FD          (3)
+
+/// @brief The environment variable set for the new process.
+#define IRC_UPGRADE_ENV         "MAVEN_IRCD_UPGRADE"
+
+// clang-format on
+
+struct irc_ctx;
+
+/// @brief Hands the server over to a new binary, started with the command line
+/// of @ref irc_ctx::upgrade, and exits once the new process has taken over.
+/// Only returns if the upgrade failed, in which case the server carries on;
+/// the links to other servers are established again.
+void irc_upgrade(struct irc_ctx *ctx);
+
+/// @brief Sends the state of the server over a socket to the process taking it
+/// over, and waits for it to acknowledge. This is the part of
+/// @ref irc_upgrade() after the new binary is started on the other end.
+///
+/// @returns `false` if the other process did not take over.
+bool irc_upgrade_send(struct irc_ctx *ctx, int sock);
+
+/// @brief Has the I/O loop upgrade once it is done waiting for events. Safe to
+/// call from a signal handler.
+void irc_upgrade_request(struct irc_ctx *ctx);
+
+/// @brief Takes over the state of the process that started this one, received
+/// on @ref IRC_UPGRADE_FD. Called by the I/O loop before it listens or polls,
+/// if @ref irc_ctx::upgrade says so.
+///
+/// @returns `false` if the state could not be taken over, in which case the
+/// previous process carries on; this one has to exit.
+bool irc_upgrade_resume(struct irc_ctx *ctx);
+
+/// @brief Takes over the state sent by @ref irc_upgrade_send() on a socket,
+/// and acknowledges it; @ref irc_upgrade_resume() does so on
+/// @ref IRC_UPGRADE_FD. What was rebuilt of a snapshot that does not load in
+/// full is not unwound.
+///
+/// @returns `false` if the state could not be taken over.
+bool irc_upgrade_recv(struct irc_ctx *ctx, int sock);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -27,12 +27,306 @@ extern "C" {
 #endif // cplusplus
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "buf.h"
+#include "compiler.h"
+#include "sendq.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The maximum length of a line received from a user, including the
+/// line terminator.
+#define IRC_USER_RECVQ_LEN_MAX  (512)
+
+/// @brief The maximum length of a nickname.
+#define IRC_USER_NICK_LEN_MAX   (30)
+
+/// @brief The maximum length of a username.
+#define IRC_USER_NAME_LEN_MAX   (10)
+
+/// @brief The maximum length of a hostname.
+#define IRC_USER_HOST_LEN_MAX   (63)
+
+/// @brief The maximum length of an away message.
+#define IRC_USER_AWAY_LEN_MAX   (200)
+
+/// @brief The maximum length of the real name given by USER.
+#define IRC_USER_REALNAME_LEN_MAX (50)
+
+/// @brief The maximum length of the channel name a WHO reply is streamed
+/// for; the same as `IRC_CHAN_NAME_LEN_MAX`.
+#define IRC_USER_WHO_CHAN_LEN_MAX (50)
+
+/// @brief The maximum length of the channel name mask a LIST reply is
+/// filtered with; the same as `IRC_CHAN_NAME_LEN_MAX`.
+#define IRC_USER_LIST_MASK_LEN_MAX (50)
+
+/// @brief The reason given to a user disconnected for exceeding the limits of
+/// its class.
+#define IRC_USER_EVICT_REASON   "SendQ exceeded"
+
+/// @brief The length of the identifier of a user across the network: the
+/// identifier of its server, followed by six characters; see link.h.
+#define IRC_USER_UID_LEN        (9)
+
+// clang-format on
+
+/// @brief The IRCv3 capabilities a user can enable.
+enum irc_user_cap {
+	// clang-format off
+
+	/// @brief Messages from other users carry the time they were sent.
+	IRC_USER_CAP_SERVER_TIME	= 1 << 0,
+
+	/// @brief Users sharing a channel announce it when they go away or
+	/// come back.
+	IRC_USER_CAP_AWAY_NOTIFY	= 1 << 1
+
+	// clang-format on
+};
+
+struct irc_class;
+struct irc_ctx;
+struct irc_member;
+struct irc_monitor_link;
+struct irc_server;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A dense array of channel memberships, removed from by swapping the
+/// last entry into the hole; see chan.h.
+struct irc_member_list {
+	struct irc_member **entries;
+	u32 num_entries;
+	u32 capacity;
+};
+
+/// @brief A dense array of users.
+struct irc_user_list {
+	struct irc_user **entries;
+	u32 num_entries;
+	u32 capacity;
+};
+
+/// @brief Where a WHO reply being streamed to a user is.
+struct irc_who_walk {
+	/// @brief The channel whose members are listed.
+	char chan[IRC_USER_WHO_CHAN_LEN_MAX + 1];
+
+	/// @brief The index of the next member to list.
+	u32 next_idx;
+};
+
+/// @brief Where a LIST reply being streamed to a user is, and what it lists.
+struct irc_list_walk {
+	/// @brief Set if the channels are walked in the order by member
+	/// count, rather than by name.
+	bool by_size;
+
+	/// @brief Set once the walk has reached a channel. It then
+	/// carries on after @ref name or @ref size, rather than from
+	/// them.
+	bool started;
+
+	/// @brief The mask channel names must match, or empty if any
+	/// name will do.
+	char mask[IRC_USER_LIST_MASK_LEN_MAX + 1];
+
+	/// @brief The length of the start of @ref mask without
+	/// wildcards, which the walk by name is limited to.
+	u32 prefix_len;
+
+	/// @brief The range of member counts listed, inclusive.
+	u32 members_min;
+	u32 members_max;
+
+	/// @brief The range of creation times listed, inclusive, in
+	/// seconds since the epoch.
+	u64 created_min;
+	u64 created_max;
+
+	/// @brief Where the walk by name is.
+	char name[IRC_USER_LIST_MASK_LEN_MAX + 1];
+
+	/// @brief Where the walk by member count is.
+	u32 size_members;
+	u64 size_id;
+};
 
 struct irc_user {
+	/// @brief The connection of the user, or -1 if it is connected to
+	/// another server.
 	int fd;
 	bool registered;
+
+	/// @brief The server the user is connected to, or `NULL` if it is
+	/// connected to this one; see link.h.
+	struct irc_server *server;
+
+	/// @brief The index of the user in the users of @ref server.
+	u32 server_idx;
+
+	/// @brief The identifier of the user across the network, given once
+	/// it has registered; empty until then.
+	char uid[IRC_USER_UID_LEN + 1];
+
+	/// @brief When the nickname was taken, in seconds since the epoch. Of
+	/// two users found to have the same nickname, the one that took it
+	/// first keeps it.
+	u64 ts;
+
+	/// @brief The nickname, or empty if none has been set yet.
+	char nick[IRC_USER_NICK_LEN_MAX + 1];
+
+	/// @brief The username given by USER, or empty if none has been
+	/// given yet.
+	char username[IRC_USER_NAME_LEN_MAX + 1];
+
+	/// @brief The numeric address the user connected from.
+	char host[IRC_USER_HOST_LEN_MAX + 1];
+
+	/// @brief The real name given by USER.
+	char realname[IRC_USER_REALNAME_LEN_MAX + 1];
+
+	/// @brief The channels the user is in.
+	struct irc_member_list chans;
+
+	/// @brief The away message, or `NULL` if the user is not away.
+	/// Allocated for as long as it is set; see @ref irc_user_away_set().
+	char *away;
+
+	/// @brief The epoch of the last broadcast to common channels that
+	/// reached the user; see @ref irc_bcast_common().
+	u64 bcast_epoch;
+
+	/// @brief The bits of the channels the user is in, by
+	/// `irc_chan_bit()`. Channels whose bits are not set are known not to
+	/// be among @ref chans without walking them.
+	u64 chan_bits;
+
+	/// @brief A bit mask of the enabled @ref irc_user_cap values.
+	u8 caps;
+
+	/// @brief Set while capabilities are being negotiated, which holds
+	/// off registration.
+	bool cap_negotiating;
+
+	/// @brief Set once the user is to be disconnected, as soon as its send
+	/// queue has been written out.
+	bool closing;
+
+	/// @brief Set once the user is to be disconnected for exceeding the
+	/// limits of its class. Nothing more is queued to it, and it is only
+	/// given one chance to take what already is.
+	bool evicted;
+
+	/// @brief The connection class of the user, or `NULL` if its queues
+	/// are not limited, as for users of other servers; see class.h.
+	struct irc_class *cls;
+
+	/// @brief Set while the user is in the list of users to flush at the
+	/// end of the I/O loop iteration.
+	bool flush_pending;
+
+	/// @brief The index of the user in the list of users to flush.
+	u32 flush_idx;
+
+	/// @brief The lines waiting to be sent to the user.
+	struct irc_sendq sendq;
+
+	/// @brief The WHO reply being streamed to the user, or `NULL` if no
+	/// reply is being streamed. Allocated for as long as the reply lasts.
+	struct irc_who_walk *who;
+
+	/// @brief The index of the user in the list of users a WHO reply is
+	/// streamed to.
+	u32 who_idx;
+
+	/// @brief The LIST reply being streamed to the user, or `NULL` if no
+	/// reply is being streamed. Allocated for as long as the reply lasts.
+	struct irc_list_walk *list;
+
+	/// @brief The index of the user in the list of users a LIST reply is
+	/// streamed to.
+	u32 list_idx;
+
+	/// @brief The nicknames the user monitors; see monitor.h.
+	struct {
+		struct irc_monitor_link *entries;
+		u32 num_entries;
+		u32 capacity;
+	} monitor;
+
+	/// @brief Set if the line being received is too long; the rest of it
+	/// is discarded.
+	bool recvq_discard;
+
+	/// @brief The number of bytes in @ref recvq.
+	size_t recvq_len;
+
+	/// @brief Holds the start of a line whose end has not been received
+	/// yet. Borrowed from a pool while there is one, and `NULL` otherwise,
+	/// so that idle users hold no input buffer.
+	char *recvq;
 };
 
+#pragma GCC diagnostic pop
+
+/// @brief Returns `true` if a nickname is well formed.
+bool irc_user_nick_valid(const char *nick) IRC_ATTRIB_PURE;
+
+/// @brief Appends a user to a list, growing it as needed.
+///
+/// @returns The index of the user in the list.
+u32 irc_user_list_push(struct irc_user_list *list, struct irc_user *user);
+
+/// @brief Removes the entry at an index by moving the last entry into its
+/// place.
+///
+/// @returns The entry that was moved, or `NULL` if the removed entry was the
+/// last.
+struct irc_user *irc_user_list_remove(struct irc_user_list *list, u32 idx);
+
+/// @brief Frees the entries of a list, leaving it empty.
+void irc_user_list_free(struct irc_user_list *list);
+
+/// @brief Queues a buffer to be sent to a user at the end of the I/O loop
+/// iteration. The user takes a reference of its own. Nothing is sent to users
+/// of other servers.
+///
+/// A user whose send queue would exceed the limits of its class is
+/// disconnected instead, and its queue dropped; see class.h.
+void irc_user_send(struct irc_ctx *ctx, struct irc_user *user,
+		   struct irc_buf *buf);
+
+/// @brief Like @ref irc_user_send(), but sends a line made of two buffers;
+/// e.g. a header made for the user, followed by a body shared with others.
+void irc_user_send_split(struct irc_ctx *ctx, struct irc_user *user,
+			 struct irc_buf *head, struct irc_buf *body);
+
+/// @brief Formats a single line and sends it to a user. The line terminator is
+/// appended, and the line is truncated if it is too long.
+void irc_user_sendf(struct irc_ctx *ctx, struct irc_user *user,
+		    const char *fmt, ...) IRC_ATTRIB_FMT(printf, 3, 4);
+
+/// @brief Has a user's send queue written out at the end of the I/O loop
+/// iteration, if it is not empty.
+void irc_user_flush_schedule(struct irc_ctx *ctx, struct irc_user *user);
+
+/// @brief Writes out as much of the send queue of every scheduled user as
+/// possible. Users whose connection is broken are disconnected, and freed.
+void irc_users_flush(struct irc_ctx *ctx);
+
+/// @brief Sets the away message of a user, truncated to
+/// `IRC_USER_AWAY_LEN_MAX`; or clears it if @p len is 0.
+void irc_user_away_set(struct irc_user *user, const char *text, size_t len);
+
+/// @brief Releases everything a user holds on to before it is freed.
+void irc_user_release(struct irc_ctx *ctx, struct irc_user *user);
+
 #ifdef __cplusplus
 }
 #endif // cplusplus
@@ -27,6 +27,9 @@ extern "C" {
 #endif // cplusplus
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "compiler.h"
 
 /// @brief Swaps two variables.
 ///
@@ -34,14 +37,19 @@ extern "C" {
 /// @param y The second variable to swap.
 #define IRC_SWAP(x, y)                  \
 	({                              \
-		typeof(x) x_ = (x);     \
-		typeof(y) y_ = (y);     \
-                                        \
-		typeof(x) temp_ = (x_); \
-		x_ = y_;                \
-		y_ = temp_;             \
+		typeof(x) temp_ = (x);  \
+		(x) = (y);              \
+		(y) = temp_;            \
 	})
 
+/// @brief Returns the structure a member is embedded in.
+///
+/// @param ptr A pointer to the member.
+/// @param type The type of the structure.
+/// @param member The name of the member within the structure.
+#define IRC_CONTAINER_OF(ptr, type, member) \
+	((type *)((uintptr_t)(ptr) - offsetof(type, member)))
+
 /// @brief Checks to see if the given integer is a power of two.
 ///
 /// 0 is not considered a power of two.
@@ -49,8 +57,9 @@ extern "C" {
 /// @param x The integer to check.
 #define IRC_IS_POW2(x) ((x) && !((x) & ((x) - 1)))
 
-void *irc_malloc(size_t size);
-void *irc_calloc(size_t nmemb, size_t size);
+void *irc_malloc(size_t size) IRC_ATTRIB_MALLOC;
+void *irc_calloc(size_t nmemb, size_t size) IRC_ATTRIB_MALLOC;
+void *irc_realloc(void *ptr, size_t size);
 
 #ifdef __cplusplus
 }
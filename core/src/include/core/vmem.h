@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file vmem.h Defines storage for large arrays mapped straight from the
+/// kernel, optionally backed by huge pages.
+///
+/// Random probes into a table of millions of entries miss the TLB on nearly
+/// every access with 4 KiB pages, as the entries span far more pages than the
+/// TLB covers. A 2 MiB page covers as much as 512 of them. Huge pages come in
+/// two flavours on Linux:
+///
+/// * Transparent huge pages are handed out by the kernel as it sees fit; an
+///   array can only ask for them, with `madvise()`. They need no setup, but
+///   may be split or never assembled when memory is fragmented.
+///
+/// * `hugetlbfs` pages come from a pool reserved up front, through
+///   `vm.nr_hugepages`. They are guaranteed once mapped, but mapping fails
+///   once the pool runs dry, in which case transparent huge pages are asked
+///   for instead.
+///
+/// Arrays smaller than @ref IRC_VMEM_MAP_MIN stay on the heap whatever the
+/// mode, as they could not fill a huge page.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "compiler.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The size of a huge page.
+#define IRC_VMEM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/// @brief The size of the smallest arrays that are mapped.
+#define IRC_VMEM_MAP_MIN        IRC_VMEM_HUGE_PAGE_SIZE
+
+// clang-format on
+
+/// @brief How an array is backed.
+enum irc_vmem_mode {
+	// clang-format off
+
+	/// @brief Allocated from the heap, like everything else.
+	IRC_VMEM_HEAP           = 0,
+
+	/// @brief Mapped, and kept to base pages even if the system would
+	/// hand out transparent huge pages unasked; mostly useful to compare
+	/// against.
+	IRC_VMEM_PAGES          = 1,
+
+	/// @brief Mapped, aligned to a huge page, and marked as wanting
+	/// transparent huge pages.
+	IRC_VMEM_THP            = 2,
+
+	/// @brief Mapped from the reserved huge page pool, falling back to
+	/// @ref IRC_VMEM_THP if it runs dry.
+	IRC_VMEM_HUGETLB        = 3,
+
+	IRC_VMEM_MODE_NUM       = 4
+
+	// clang-format on
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief An array allocated by @ref irc_vmem_alloc().
+struct irc_vmem {
+	void *ptr;
+
+	/// @brief The number of bytes mapped, or 0 if @ref ptr is on the
+	/// heap.
+	size_t len;
+
+	/// @brief How the array ended up backed, which may be a fallback from
+	/// the mode asked for.
+	enum irc_vmem_mode mode;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Receives a single line of a report, without a line terminator.
+typedef void (*irc_vmem_emit_cb)(void *udata, const char *line, size_t len);
+
+/// @brief Allocates an array filled with zeros. Never fails.
+void irc_vmem_alloc(struct irc_vmem *vm, size_t size, enum irc_vmem_mode mode);
+
+/// @brief Frees an array, which may be empty.
+void irc_vmem_free(struct irc_vmem *vm);
+
+/// @brief Parses the name of a mode: `heap`, `pages`, `thp` or `hugetlb`.
+///
+/// @returns `true` if the name is known, or `false` otherwise.
+bool irc_vmem_mode_parse(const char *name, enum irc_vmem_mode *mode);
+
+/// @brief Returns the name of a mode, as parsed by @ref irc_vmem_mode_parse().
+const char *irc_vmem_mode_name(enum irc_vmem_mode mode) IRC_ATTRIB_CONST;
+
+/// @brief Reports the bytes mapped in each mode, one line each, followed by
+/// the number of times the huge page pool ran dry.
+void irc_vmem_report(irc_vmem_emit_cb emit, void *udata);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file watchdog.h Defines the I/O loop stall watchdog.
+///
+/// The watchdog is a thread that periodically checks how long the current
+/// I/O loop iteration has been busy for, as published by the phase profiler.
+/// Once an iteration exceeds the stall threshold, the watchdog logs the phase
+/// it is stuck in, and a backtrace of the I/O thread taken by interrupting it
+/// with @ref IRC_WATCHDOG_SIGNAL. Every stalled iteration is reported once.
+/// Should the I/O thread be stuck holding the lock of the log, the report goes
+/// to the standard error instead; see @ref irc_log_thread_nowait().
+///
+/// Only one watchdog may run per process, as the signal handler has to find
+/// it through a global.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "log.h"
+#include "prof.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The maximum number of frames captured in a backtrace.
+#define IRC_WATCHDOG_BT_DEPTH_MAX       (32)
+
+/// @brief The signal used to capture a backtrace of the I/O thread.
+#define IRC_WATCHDOG_SIGNAL             (SIGRTMIN)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_watchdog {
+	struct irc_prof *prof;
+	struct irc_log *log;
+
+	/// @brief The time an iteration may be busy for before it is
+	/// considered stalled.
+	u64 threshold_ns;
+
+	/// @brief The number of iterations completed at the time of the last
+	/// report, so that a stall is reported only once.
+	u64 reported_iter;
+
+	/// @brief The thread running the I/O loop.
+	pthread_t io_thread;
+
+	/// @brief The watchdog thread.
+	pthread_t thread;
+
+	/// @brief The backtrace captured by the signal handler.
+	void *bt[IRC_WATCHDOG_BT_DEPTH_MAX];
+
+	/// @brief The number of frames in @ref bt, or -1 while a capture is
+	/// pending.
+	_Atomic int bt_len;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Starts watching the I/O loop run by the calling thread.
+///
+/// @param threshold_ms The time an iteration may be busy for before it is
+/// reported as stalled.
+/// @returns `false` if the watchdog could not be started, or `true`
+/// otherwise.
+bool irc_watchdog_start(struct irc_watchdog *wd, struct irc_prof *prof,
+			struct irc_log *logger, uint threshold_ms);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
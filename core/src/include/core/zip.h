@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+/// @file zip.h Defines the streaming compression of server links.
+///
+/// * Each direction of a link is a single zlib stream for as long as the link
+///   lasts, so the history of the stream serves as its dictionary: the lines
+///   of a burst, which differ in little but their identifiers, compress
+///   against everything sent before them rather than against the few lines
+///   of the same buffer.
+///
+/// * Output is compressed into buffers that are queued once full. Flushing
+///   ends what has been compressed so far on a byte boundary, so that the
+///   other end can decompress all of it; it is done once per I/O loop
+///   iteration, which keeps the latency compression adds within that of the
+///   loop itself.
+///
+/// * Both directions count the bytes before and after compression, and the
+///   CPU time spent on them.
+///
+/// Compression is only supported if the core is built with zlib.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "compiler.h"
+#include "sendq.h"
+#include "types.h"
+
+// clang-format off
+
+/// @brief The size of the buffers compressed output is written to.
+#define IRC_ZIP_BUF_SIZE        (16384)
+
+/// @brief The compression level, from 1 (fastest) to 9 (smallest). A burst
+/// shrinks to about a quarter at level 1, and to a fifth at the default level
+/// 6 for twice the CPU time, which the I/O loop can less afford than the link
+/// can the bytes.
+#define IRC_ZIP_LEVEL           (1)
+
+// clang-format on
+
+/// @brief The work done by a compression stream.
+struct irc_zip_stats {
+	/// @brief The number of bytes before compression.
+	u64 plain_bytes;
+
+	/// @brief The number of bytes after compression.
+	u64 wire_bytes;
+
+	/// @brief The CPU time spent compressing or decompressing, in
+	/// nanoseconds.
+	u64 cpu_ns;
+};
+
+/// @brief A compression or decompression stream.
+struct irc_zip;
+
+/// @brief Receives decompressed data.
+typedef void (*irc_zip_out_cb)(void *udata, const char *data, size_t len);
+
+/// @brief Returns `true` if the core is built with support for compression.
+bool irc_zip_supported(void) IRC_ATTRIB_CONST;
+
+/// @brief Creates a compression stream.
+///
+/// @returns `NULL` if compression is not supported.
+struct irc_zip *irc_zip_deflater_new(void);
+
+/// @brief Creates a decompression stream.
+///
+/// @returns `NULL` if compression is not supported.
+struct irc_zip *irc_zip_inflater_new(void);
+
+/// @brief Frees a stream, which may be `NULL`.
+void irc_zip_free(struct irc_zip *zip);
+
+/// @brief Compresses data, queueing the compressed buffers as they fill up.
+///
+/// @param flush If `true`, everything compressed so far is queued, ending on
+/// a byte boundary.
+void irc_zip_deflate(struct irc_zip *zip, const char *data, size_t len,
+		     bool flush, struct irc_sendq *sendq);
+
+/// @brief Decompresses data, passing on the result in chunks of at most
+/// @ref IRC_ZIP_BUF_SIZE bytes.
+///
+/// @returns `false` if the data is not part of a valid stream.
+IRC_NODISCARD bool irc_zip_inflate(struct irc_zip *zip, const char *data,
+				   size_t len, irc_zip_out_cb out, void *udata);
+
+/// @brief Returns the work done by a stream so far.
+const struct irc_zip_stats *irc_zip_stats(const struct irc_zip *zip)
+	IRC_ATTRIB_CONST;
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -22,6 +22,7 @@
 
 #include <string.h>
 #include "core/irc_parse.h"
+#include "core/trace.h"
 
 static void process_cmd(const char *const str, ptrdiff_t len,
 			struct irc_msg *const msg)
@@ -62,6 +63,8 @@ void irc_msg_parse(const char *const str, const size_t str_len,
 {
 	const size_t len = str_len - (sizeof("\r\n") - 1);
 
+	IRC_TRACE(msg_parse_start, str, len);
+
 	for (size_t pos = 0; pos < len;) {
 		const size_t off = len - pos;
 
@@ -89,4 +92,5 @@ void irc_msg_parse(const char *const str, const size_t str_len,
 			break;
 		}
 	}
+	IRC_TRACE(msg_parse_done, msg->cmd, msg->num_params);
 }
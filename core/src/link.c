@@ -0,0 +1,2101 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "core/bcast.h"
+#include "core/chan.h"
+#include "core/clock.h"
+#include "core/cmd.h"
+#include "core/ctx.h"
+#include "core/link.h"
+#include "core/log.h"
+#include "core/mask.h"
+#include "core/net.h"
+#include "core/pool.h"
+#include "core/user.h"
+#include "core/util.h"
+
+// clang-format off
+
+#define ERR_NICKNAMEINUSE       "433"
+
+/// @brief The description this server introduces itself with.
+#define SERVER_DESC             "maven-ircd"
+
+/// @brief The number of UIDs a server can give out, 36 to the power of 6.
+#define UID_SEQ_NUM             (UINT64_C(2176782336))
+
+/// @brief The TS of a nickname changed to the UID of its user, as in TS6.
+#define SAVE_TS                 (100)
+
+/// @brief The capability of compressing the link, sent with CAPAB.
+#define CAPAB_ZIP               "ZIP"
+
+// clang-format on
+
+/// @brief The digits of SIDs and UIDs past their first character.
+static const char b36_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A message received from an established link.
+struct link_in {
+	struct irc_link *link;
+	struct irc_link_msg msg;
+
+	/// @brief The line as received, without its terminator, for passing it
+	/// on as it is.
+	const char *line;
+	size_t len;
+
+	/// @brief The source of the message, if it is a server or a user
+	/// respectively.
+	struct irc_server *server;
+	struct irc_user *user;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief The kind of source a message must have.
+enum link_src {
+	// clang-format off
+
+	SRC_SERVER      = 0,
+	SRC_USER        = 1
+
+	// clang-format on
+};
+
+typedef void (*link_cmd_cb)(struct irc_ctx *ctx, const struct link_in *in);
+
+static int b36_val(const char c)
+{
+	if ((c >= 'A') && (c <= 'Z')) {
+		return c - 'A';
+	}
+
+	if ((c >= '0') && (c <= '9')) {
+		return c - '0' + 26;
+	}
+	return -1;
+}
+
+bool irc_link_sid_valid(const char *const sid)
+{
+	return (sid[0] >= '0') && (sid[0] <= '9') && (b36_val(sid[1]) >= 0) &&
+	       (b36_val(sid[2]) >= 0) && (sid[3] == '\0');
+}
+
+u32 irc_link_sid_decode(const char *const sid)
+{
+	return ((u32)(sid[0] - '0') * 36 * 36) + ((u32)b36_val(sid[1]) * 36) +
+	       (u32)b36_val(sid[2]);
+}
+
+bool irc_link_uid_decode(const char *const uid, u64 *const id)
+{
+	if ((uid[0] < '0') || (uid[0] > '9')) {
+		return false;
+	}
+	u64 sid = (u64)(uid[0] - '0');
+	u64 seq = 0;
+
+	for (size_t i = 1; i < IRC_USER_UID_LEN; ++i) {
+		const int val = b36_val(uid[i]);
+
+		if (val < 0) {
+			return false;
+		}
+
+		if (i < IRC_CONF_SERVER_ID_LEN) {
+			sid = (sid * 36) + (u64)val;
+		} else {
+			seq = (seq * 36) + (u64)val;
+		}
+	}
+
+	if (uid[IRC_USER_UID_LEN] != '\0') {
+		return false;
+	}
+	*id = (sid << 32) | seq;
+	return true;
+}
+
+void irc_link_uid_encode(const u64 id, char *const uid)
+{
+	const u32 sid = (u32)(id >> 32);
+	u32 seq = (u32)id;
+
+	uid[0] = (char)('0' + (sid / (36 * 36)));
+	uid[1] = b36_digits[(sid / 36) % 36];
+	uid[2] = b36_digits[sid % 36];
+
+	for (size_t i = IRC_USER_UID_LEN; i-- > IRC_CONF_SERVER_ID_LEN;) {
+		uid[i] = b36_digits[seq % 36];
+		seq /= 36;
+	}
+	uid[IRC_USER_UID_LEN] = '\0';
+}
+
+bool irc_link_msg_parse(char *const line, struct irc_link_msg *const msg)
+{
+	char *pos = line;
+
+	msg->src = NULL;
+	msg->num_params = 0;
+
+	if (*pos == ':') {
+		msg->src = pos + 1;
+		pos = strchr(pos, ' ');
+
+		if (!pos) {
+			return false;
+		}
+		*pos++ = '\0';
+	}
+
+	while (*pos == ' ') {
+		pos++;
+	}
+	msg->cmd = pos;
+	pos = strchr(pos, ' ');
+
+	if (pos) {
+		*pos++ = '\0';
+	}
+
+	while (pos && (*pos != '\0') &&
+	       (msg->num_params < IRC_LINK_PARAM_NUM_MAX)) {
+		if (*pos == ' ') {
+			pos++;
+			continue;
+		}
+
+		if (*pos == ':') {
+			msg->params[msg->num_params++] = pos + 1;
+			break;
+		}
+		msg->params[msg->num_params++] = pos;
+		pos = strchr(pos, ' ');
+
+		if (pos) {
+			*pos++ = '\0';
+		}
+	}
+	return *msg->cmd != '\0';
+}
+
+static void *uid_key(const u64 id)
+{
+	return (void *)(uintptr_t)id;
+}
+
+void irc_links_init(struct irc_links *const links, const char *const sid,
+		    const enum irc_vmem_mode vmem)
+{
+	const struct irc_ht_conf cfg = {
+		// clang-format off
+
+		.initial_capacity	= 4096,
+		.load_fact_max		= 75,
+		.vmem			= vmem
+
+		// clang-format on
+	};
+	irc_ht_init(&links->users, &cfg);
+
+	links->by_sid = irc_calloc(IRC_LINK_SID_NUM, sizeof(*links->by_sid));
+	links->sid = irc_link_sid_decode(sid);
+}
+
+void irc_links_destroy(struct irc_links *const links)
+{
+	irc_ht_destroy(&links->users);
+
+	free(links->by_sid);
+	links->by_sid = NULL;
+}
+
+struct irc_link *irc_link_find(struct irc_links *const links, const int fd)
+{
+	for (u32 i = 0; i < links->num_entries; ++i) {
+		if (links->entries[i]->fd == fd) {
+			return links->entries[i];
+		}
+	}
+	return NULL;
+}
+
+void irc_links_user_add(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	struct irc_links *links = &ctx->links;
+	u64 id;
+
+	if (user->server || (user->uid[0] != '\0')) {
+		// A user is only filed under a UID that decodes, which is what
+		// removing it goes by; see irc_links_user_del().
+		if (!irc_link_uid_decode(user->uid, &id)) {
+			IRC_LOG_ERR(&ctx->log, "bad UID %s of %s", user->uid,
+				    user->nick);
+			return;
+		}
+
+		if (user->server) {
+			user->server_idx =
+				irc_user_list_push(&user->server->users, user);
+		}
+	} else {
+		// Numbers are only reused once every other one has been given
+		// out, and never while in use.
+		do {
+			id = ((u64)links->sid << 32) | links->next_uid;
+			links->next_uid =
+				(u32)((links->next_uid + 1) % UID_SEQ_NUM);
+		} while (irc_ht_get(&links->users, uid_key(id)));
+
+		irc_link_uid_encode(id, user->uid);
+	}
+	irc_ht_add(&links->users, uid_key(id), user);
+}
+
+void irc_links_user_del(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	u64 id;
+
+	if ((user->uid[0] == '\0') || !irc_link_uid_decode(user->uid, &id)) {
+		return;
+	}
+	irc_ht_del(&ctx->links.users, uid_key(id));
+
+	if (user->server) {
+		struct irc_user *moved = irc_user_list_remove(
+			&user->server->users, user->server_idx);
+
+		if (moved) {
+			moved->server_idx = user->server_idx;
+		}
+	}
+}
+
+struct irc_user *irc_links_user_find(struct irc_links *const links,
+				     const char *const uid)
+{
+	u64 id;
+
+	if (!irc_link_uid_decode(uid, &id)) {
+		return NULL;
+	}
+	return irc_ht_get(&links->users, uid_key(id));
+}
+
+/// @brief Queues the buffer output is being appended to. Compressed links
+/// queue its compressed form instead, and keep the buffer for reuse.
+///
+/// @param flush If `true`, the output of a compressed link is queued as far as
+/// it has been compressed, rather than once the compressed buffer is full.
+static void out_seal(struct irc_link *const link, const bool flush)
+{
+	struct irc_buf *buf = link->out;
+
+	if (link->zip_out) {
+		irc_zip_deflate(link->zip_out, buf ? buf->data : NULL,
+				buf ? buf->len : 0, flush, &link->sendq);
+		if (buf) {
+			buf->len = 0;
+		}
+		return;
+	}
+
+	link->out = NULL;
+
+	// Whatever is sealed early, at the end of an I/O loop iteration, is
+	// usually small; it is not worth holding on to a whole buffer for.
+	if (buf->len < (IRC_LINK_OUT_BUF_SIZE / 2)) {
+		buf = irc_buf_shrink(buf);
+	}
+	irc_sendq_push(&link->sendq, buf);
+}
+
+/// @brief Appends a line to the output of a link.
+///
+/// @param line The line, without its terminator.
+static void link_write_line(struct irc_link *const link, const char *const line,
+			    const size_t len)
+{
+	if (link->out && ((link->out->len + len + 2) > IRC_LINK_OUT_BUF_SIZE)) {
+		out_seal(link, false);
+	}
+
+	if (!link->out) {
+		link->out = irc_buf_new(IRC_LINK_OUT_BUF_SIZE);
+		link->out->len = 0;
+	}
+	char *dst = &link->out->data[link->out->len];
+
+	memcpy(dst, line, len);
+	dst[len] = '\r';
+	dst[len + 1] = '\n';
+
+	link->out->len += (u32)(len + 2);
+}
+
+/// @brief Formats a line, truncating it if it is too long.
+///
+/// @param line Receives the line, without its terminator.
+/// @returns The length of the line.
+IRC_ATTRIB_FMT(printf, 2, 0)
+static size_t line_vfmt(char *const line, const char *const fmt, va_list args)
+{
+	const int len = vsnprintf(line, IRC_LINK_LINE_LEN_MAX - 1, fmt, args);
+
+	if (len < 0) {
+		return 0;
+	}
+	return ((size_t)len < (IRC_LINK_LINE_LEN_MAX - 2))
+		       ? (size_t)len
+		       : (IRC_LINK_LINE_LEN_MAX - 2);
+}
+
+static bool link_open(const struct irc_link *const link)
+{
+	return (link->state == IRC_LINK_ESTABLISHED) && !link->closing;
+}
+
+/// @brief Passes a line on to every established link but one.
+static void links_write_line(struct irc_links *const links,
+			     const struct irc_link *const except,
+			     const char *const line, const size_t len)
+{
+	for (u32 i = 0; i < links->num_entries; ++i) {
+		struct irc_link *link = links->entries[i];
+
+		if ((link != except) && link_open(link)) {
+			link_write_line(link, line, len);
+		}
+	}
+}
+
+IRC_ATTRIB_FMT(printf, 3, 4)
+void irc_links_sendf(struct irc_ctx *const ctx,
+		     const struct irc_link *const except, const char *const fmt,
+		     ...)
+{
+	if (!ctx->links.num_entries) {
+		return;
+	}
+	char line[IRC_LINK_LINE_LEN_MAX];
+
+	va_list args;
+	va_start(args, fmt);
+
+	const size_t len = line_vfmt(line, fmt, args);
+
+	va_end(args);
+
+	links_write_line(&ctx->links, except, line, len);
+}
+
+IRC_ATTRIB_FMT(printf, 2, 3)
+void irc_link_sendf(struct irc_link *const link, const char *const fmt, ...)
+{
+	char line[IRC_LINK_LINE_LEN_MAX];
+
+	va_list args;
+	va_start(args, fmt);
+
+	const size_t len = line_vfmt(line, fmt, args);
+
+	va_end(args);
+
+	link_write_line(link, line, len);
+}
+
+/// @brief Passes a message on to every established link but the one it came
+/// from.
+static void forward(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	links_write_line(&ctx->links, in->link, in->line, in->len);
+}
+
+/// @brief Closes a link once the error sent to it has been written out.
+static void link_abort(struct irc_ctx *const ctx, struct irc_link *const link,
+		       const char *const reason)
+{
+	IRC_LOG_ERR(&ctx->log, "link %s (%s): %s",
+		    link->server ? link->server->name : "*", link->host, reason);
+
+	irc_link_sendf(link, "ERROR :Closing Link: %s (%s)", link->host,
+		       reason);
+	link->closing = true;
+}
+
+/// @brief Formats the work done by one direction of a compressed link.
+static int zip_dir_fmt(char *const buf, const size_t size,
+		       const char *const dir, const struct irc_zip_stats *const st)
+{
+	// Per mille, so that a ratio is printed without floating point.
+	const u64 ratio = st->plain_bytes
+				  ? ((st->wire_bytes * 1000) / st->plain_bytes)
+				  : 0;
+
+	return snprintf(buf, size,
+			"%s %" PRIu64 "->%" PRIu64 " bytes (%" PRIu64
+			".%" PRIu64 "%%) %" PRIu64 " us",
+			dir, st->plain_bytes, st->wire_bytes, ratio / 10,
+			ratio % 10, st->cpu_ns / 1000);
+}
+
+/// @brief Formats the compression statistics of a link.
+///
+/// @returns The length of the text, at most `size - 1`.
+static size_t zip_stats_fmt(const struct irc_link *const link,
+			    char *const buf, const size_t size)
+{
+	int len = zip_dir_fmt(buf, size, "zip out",
+			      irc_zip_stats(link->zip_out));
+
+	if ((len > 0) && ((size_t)len < size)) {
+		len += zip_dir_fmt(&buf[len], size - (size_t)len, ", in",
+				   irc_zip_stats(link->zip_in));
+	}
+	if (len < 0) {
+		return 0;
+	}
+	return ((size_t)len < size) ? (size_t)len : (size - 1);
+}
+
+static const char *user_sid(const struct irc_ctx *const ctx,
+			    const struct irc_user *const user)
+{
+	return user->server ? user->server->sid : ctx->conf.server_id;
+}
+
+/// @brief Formats the UID message introducing a user.
+static size_t user_intro_fmt(const struct irc_ctx *const ctx,
+			     const struct irc_user *const user,
+			     char *const line)
+{
+	return (size_t)snprintf(line, IRC_LINK_LINE_LEN_MAX - 1,
+				":%s UID %s %" PRIu32 " %" PRIu64
+				" %s %s %s :%s",
+				user_sid(ctx, user), user->nick,
+				user->server ? (user->server->hops + 1) : 1,
+				user->ts, user->username, user->host, user->uid,
+				user->realname);
+}
+
+void irc_links_user_intro(struct irc_ctx *const ctx,
+			  const struct irc_link *const except,
+			  const struct irc_user *const user)
+{
+	if (!ctx->links.num_entries) {
+		return;
+	}
+	char line[IRC_LINK_LINE_LEN_MAX];
+
+	const size_t len = user_intro_fmt(ctx, user, line);
+
+	links_write_line(&ctx->links, except, line, len);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief Appends the members of a channel, or one of its lists of masks, to
+/// as few lines as they fit in.
+struct line_packer {
+	struct irc_link *link;
+	char line[IRC_LINK_LINE_LEN_MAX];
+
+	/// @brief The length of the part every line starts with.
+	size_t head_len;
+
+	size_t len;
+};
+
+#pragma GCC diagnostic pop
+
+static void packer_flush(struct line_packer *const packer)
+{
+	if (packer->len > packer->head_len) {
+		// Drop the trailing space.
+		link_write_line(packer->link, packer->line, packer->len - 1);
+	}
+	packer->len = packer->head_len;
+}
+
+static void packer_add(struct line_packer *const packer, const char *const pfx,
+		       const size_t pfx_len, const char *const word,
+		       const size_t word_len)
+{
+	if ((packer->len + pfx_len + word_len + 1) >
+	    (IRC_LINK_LINE_LEN_MAX - 2)) {
+		packer_flush(packer);
+	}
+	memcpy(&packer->line[packer->len], pfx, pfx_len);
+	packer->len += pfx_len;
+
+	memcpy(&packer->line[packer->len], word, word_len);
+	packer->len += word_len;
+
+	packer->line[packer->len++] = ' ';
+}
+
+/// @brief Sends a channel in a burst, leaving out the members behind the link
+/// itself.
+static void chan_burst(struct irc_ctx *const ctx, struct irc_link *const link,
+		       struct irc_chan *const chan)
+{
+	static const char list_chars[IRC_CHAN_MASKS_NUM] = {
+		[IRC_CHAN_BANS] = 'b', [IRC_CHAN_EXCEPTS] = 'e'
+	};
+
+	struct line_packer packer = { .link = link };
+
+	packer.head_len = (size_t)snprintf(packer.line, sizeof(packer.line),
+					   ":%s SJOIN %" PRIu64 " %s + :",
+					   ctx->conf.server_id, chan->created,
+					   chan->name);
+	packer.len = packer.head_len;
+
+	bool sent = false;
+
+	for (u32 i = 0; i < chan->members.num_entries; ++i) {
+		const struct irc_member *member = chan->members.entries[i];
+
+		if (irc_user_link(member->user) == link) {
+			continue;
+		}
+		char pfx[2];
+		size_t pfx_len = 0;
+
+		if (member->prefix & IRC_MEMBER_OP) {
+			pfx[pfx_len++] = '@';
+		}
+
+		if (member->prefix & IRC_MEMBER_VOICE) {
+			pfx[pfx_len++] = '+';
+		}
+		packer_add(&packer, pfx, pfx_len, member->user->uid,
+			   IRC_USER_UID_LEN);
+		sent = true;
+	}
+	packer_flush(&packer);
+
+	// The server knows everyone in the channel already.
+	if (!sent) {
+		return;
+	}
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		const struct irc_mask_set *set = chan->masks[i];
+
+		if (!set) {
+			continue;
+		}
+		packer.head_len = (size_t)snprintf(
+			packer.line, sizeof(packer.line),
+			":%s BMASK %" PRIu64 " %s %c :", ctx->conf.server_id,
+			chan->created, chan->name, list_chars[i]);
+		packer.len = packer.head_len;
+
+		for (u32 j = 0; j < set->num_entries; ++j) {
+			const char *text = set->entries[j]->text;
+			packer_add(&packer, NULL, 0, text, strlen(text));
+		}
+		packer_flush(&packer);
+	}
+}
+
+void irc_links_chan_burst(struct irc_ctx *const ctx,
+			  struct irc_chan *const chan)
+{
+	struct irc_links *links = &ctx->links;
+
+	for (u32 i = 0; i < links->num_entries; ++i) {
+		struct irc_link *link = links->entries[i];
+
+		if (link_open(link)) {
+			chan_burst(ctx, link, chan);
+		}
+	}
+}
+
+/// @brief Sends the view of the network of this server to a newly
+/// established link.
+static void burst_send(struct irc_ctx *const ctx, struct irc_link *const link)
+{
+	struct irc_links *links = &ctx->links;
+	char line[IRC_LINK_LINE_LEN_MAX];
+
+	const u64 start = irc_clock_mono_ns();
+
+	// Every server comes after the server it is linked to.
+	for (u32 i = 0; i < links->num_servers; ++i) {
+		const struct irc_server *server = links->servers[i];
+
+		if (server->link == link) {
+			continue;
+		}
+		irc_link_sendf(link, ":%s SID %s %" PRIu32 " %s :%s",
+			       server->uplink ? server->uplink->sid
+					      : ctx->conf.server_id,
+			       server->name, server->hops + 1, server->sid,
+			       server->desc);
+	}
+
+	u32 num_users = 0;
+
+	for (size_t i = 0; i < links->users.capacity; ++i) {
+		const struct irc_ht_entry *entry = &links->users.entries[i];
+
+		if (!entry->psl) {
+			continue;
+		}
+		const struct irc_user *user = entry->val;
+
+		if (irc_user_link(user) == link) {
+			continue;
+		}
+		link_write_line(link, line, user_intro_fmt(ctx, user, line));
+		num_users++;
+	}
+
+	u32 num_chans = 0;
+
+	for (size_t i = 0; i < ctx->chans.by_name.capacity; ++i) {
+		const struct irc_ht_entry *entry = &ctx->chans.by_name.entries[i];
+
+		if (entry->psl) {
+			chan_burst(ctx, link, entry->val);
+			num_chans++;
+		}
+	}
+	irc_link_sendf(link, ":%s EOB", ctx->conf.server_id);
+
+	IRC_LOG_INFO(&ctx->log,
+		     "burst to %s: %" PRIu32 " users, %" PRIu32
+		     " channels in %" PRIu64 " us",
+		     link->server->name, num_users, num_chans,
+		     (irc_clock_mono_ns() - start) / 1000);
+}
+
+static struct irc_server *server_find_name(struct irc_links *const links,
+					   const char *const name)
+{
+	for (u32 i = 0; i < links->num_servers; ++i) {
+		if (!strcasecmp(links->servers[i]->name, name)) {
+			return links->servers[i];
+		}
+	}
+	return NULL;
+}
+
+/// @brief Checks that a server being introduced is not known already, which
+/// would make the network a loop.
+///
+/// @returns The reason the server is refused, or `NULL` if it is not.
+static const char *server_check(struct irc_ctx *const ctx,
+				const char *const name, const char *const sid)
+{
+	struct irc_links *links = &ctx->links;
+
+	if (!irc_link_sid_valid(sid)) {
+		return "Invalid SID";
+	}
+
+	if ((irc_link_sid_decode(sid) == links->sid) ||
+	    links->by_sid[irc_link_sid_decode(sid)]) {
+		return "SID exists";
+	}
+
+	if (!strcasecmp(name, ctx->conf.server_name) ||
+	    server_find_name(links, name)) {
+		return "Server exists";
+	}
+
+	if (links->num_servers >= IRC_LINK_SERVER_NUM_MAX) {
+		return "Too many servers";
+	}
+	return NULL;
+}
+
+static struct irc_server *server_add(struct irc_links *const links,
+				     const char *const name,
+				     const char *const sid,
+				     const char *const desc, const u32 hops,
+				     struct irc_link *const link,
+				     struct irc_server *const uplink)
+{
+	struct irc_server *server = irc_calloc(1, sizeof(*server));
+
+	snprintf(server->name, sizeof(server->name), "%s", name);
+	snprintf(server->desc, sizeof(server->desc), "%s", desc);
+	strcpy(server->sid, sid);
+
+	server->id = irc_link_sid_decode(sid);
+	server->hops = hops;
+	server->link = link;
+	server->uplink = uplink;
+
+	links->by_sid[server->id] = server;
+	links->servers[links->num_servers++] = server;
+	return server;
+}
+
+/// @brief Removes a server, the servers linked to it, and all of their users
+/// from the network. The other servers are not told.
+static void server_split(struct irc_ctx *const ctx,
+			 struct irc_server *const server)
+{
+	struct irc_links *links = &ctx->links;
+
+	char name[IRC_CONF_SERVER_NAME_LEN_MAX + 1];
+	strcpy(name, server->name);
+
+	// Servers come after the server they are linked to, so one pass
+	// finds every server behind this one.
+	server->split = true;
+
+	for (u32 i = 0; i < links->num_servers; ++i) {
+		struct irc_server *entry = links->servers[i];
+
+		if (entry->uplink && entry->uplink->split) {
+			entry->split = true;
+		}
+	}
+
+	u32 num_kept = 0;
+	u32 num_users = 0;
+
+	for (u32 i = 0; i < links->num_servers; ++i) {
+		struct irc_server *entry = links->servers[i];
+
+		if (!entry->split) {
+			links->servers[num_kept++] = entry;
+			continue;
+		}
+
+		// As is customary, the quit message names the two servers
+		// that split.
+		char reason[(2 * IRC_CONF_SERVER_NAME_LEN_MAX) + 2];
+
+		snprintf(reason, sizeof(reason), "%s %s",
+			 entry->uplink ? entry->uplink->name
+				       : ctx->conf.server_name,
+			 entry->name);
+
+		num_users += entry->users.num_entries;
+
+		while (entry->users.num_entries) {
+			struct irc_user *user =
+				entry->users
+					.entries[entry->users.num_entries - 1];
+
+			irc_cmd_user_quit(ctx, user, reason);
+			irc_user_release(ctx, user);
+			irc_pool_free(IRC_POOL_USERS, user, sizeof(*user));
+		}
+		links->by_sid[entry->id] = NULL;
+
+		if (entry->link->server == entry) {
+			entry->link->server = NULL;
+		}
+		free(entry->users.entries);
+		free(entry);
+	}
+
+	IRC_LOG_INFO(&ctx->log, "split from %s: %" PRIu32 " servers, %" PRIu32
+				" users",
+		     name, links->num_servers - num_kept, num_users);
+
+	links->num_servers = num_kept;
+}
+
+/// @brief Returns `true` if this server offers to compress a link.
+static bool zip_offer(const struct irc_link *const link)
+{
+	return link->conf->zip && irc_zip_supported();
+}
+
+/// @brief Sends PASS, CAPAB and SERVER.
+static void handshake_send(struct irc_ctx *const ctx,
+			   struct irc_link *const link)
+{
+	irc_link_sendf(link, "PASS %s TS 6 :%s", link->conf->password,
+		       ctx->conf.server_id);
+
+	if (zip_offer(link)) {
+		irc_link_sendf(link, "CAPAB :" CAPAB_ZIP);
+	}
+	irc_link_sendf(link, "SERVER %s 1 :%s", ctx->conf.server_name,
+		       SERVER_DESC);
+}
+
+/// @brief Handles SERVER, which completes the authentication of a server.
+static void server_auth(struct irc_ctx *const ctx, struct irc_link *const link,
+			const struct irc_link_msg *const msg)
+{
+	if ((msg->num_params < 3) || (link->password[0] == '\0')) {
+		link_abort(ctx, link, "No password");
+		return;
+	}
+	const char *name = msg->params[0];
+	const struct irc_conf_link *conf = link->conf;
+
+	// Links made by this server already know who they are made to.
+	if (!conf) {
+		for (size_t i = 0; i < ctx->conf.links.num_entries; ++i) {
+			if (!strcasecmp(ctx->conf.links.entries[i].name, name)) {
+				conf = &ctx->conf.links.entries[i];
+				break;
+			}
+		}
+	}
+
+	if (!conf || strcasecmp(conf->name, name)) {
+		link_abort(ctx, link, "No link configured");
+		return;
+	}
+
+	if (strcmp(conf->password, link->password)) {
+		link_abort(ctx, link, "Bad password");
+		return;
+	}
+	const char *refusal = server_check(ctx, name, link->sid);
+
+	if (refusal) {
+		link_abort(ctx, link, refusal);
+		return;
+	}
+
+	if (!link->conf) {
+		link->conf = conf;
+		handshake_send(ctx, link);
+	}
+
+	// Both ends have sent all they send uncompressed.
+	if (link->zip_offered && zip_offer(link)) {
+		if (link->out && link->out->len) {
+			out_seal(link, false);
+		}
+		link->zip_out = irc_zip_deflater_new();
+		link->zip_in = irc_zip_inflater_new();
+
+		if (IRC_UNLIKELY(!link->zip_out || !link->zip_in)) {
+			irc_zip_free(link->zip_out);
+			link->zip_out = NULL;
+
+			link_abort(ctx, link, "Compression unavailable");
+			return;
+		}
+	}
+	link->server = server_add(&ctx->links, name, link->sid,
+				  msg->params[2], 1, link, NULL);
+	link->state = IRC_LINK_ESTABLISHED;
+	link->burst.start_ns = irc_clock_mono_ns();
+
+	IRC_LOG_INFO(&ctx->log, "linked to %s (%s) at %s%s", name, link->sid,
+		     link->host, link->zip_out ? ", compressed" : "");
+
+	burst_send(ctx, link);
+
+	irc_links_sendf(ctx, link, ":%s SID %s 2 %s :%s", ctx->conf.server_id,
+			name, link->sid, link->server->desc);
+}
+
+/// @brief Handles a message received before the link is established.
+static void handshake(struct irc_ctx *const ctx, struct irc_link *const link,
+		      const struct irc_link_msg *const msg)
+{
+	if (!strcmp(msg->cmd, "PASS")) {
+		if ((msg->num_params < 4) || strcmp(msg->params[1], "TS") ||
+		    strcmp(msg->params[2], "6")) {
+			link_abort(ctx, link, "Unsupported protocol");
+			return;
+		}
+		snprintf(link->password, sizeof(link->password), "%s",
+			 msg->params[0]);
+		snprintf(link->sid, sizeof(link->sid), "%s", msg->params[3]);
+	} else if (!strcmp(msg->cmd, "CAPAB")) {
+		// The capabilities are a single space separated parameter.
+		char caps[IRC_LINK_LINE_LEN_MAX];
+		char *save = NULL;
+
+		snprintf(caps, sizeof(caps), "%s",
+			 msg->num_params ? msg->params[msg->num_params - 1]
+					 : "");
+
+		for (const char *cap = strtok_r(caps, " ", &save); cap;
+		     cap = strtok_r(NULL, " ", &save)) {
+			if (!strcmp(cap, CAPAB_ZIP)) {
+				link->zip_offered = true;
+			}
+		}
+	} else if (!strcmp(msg->cmd, "SERVER")) {
+		server_auth(ctx, link, msg);
+	} else if (!strcmp(msg->cmd, "ERROR")) {
+		IRC_LOG_ERR(&ctx->log, "link at %s: %s", link->host,
+			    msg->num_params ? msg->params[0] : "");
+		link->closing = true;
+	}
+}
+
+/// @brief Parses a TS.
+static u64 ts_parse(const char *const str)
+{
+	return strtoull(str, NULL, 10);
+}
+
+/// @brief Gives up the nickname of a local user that has not registered yet.
+static void nick_unreserve(struct irc_ctx *const ctx,
+			   struct irc_user *const user)
+{
+	irc_user_sendf(ctx, user,
+		       ":%s " ERR_NICKNAMEINUSE
+		       " * %s :Nickname is already in use",
+		       ctx->conf.server_name, user->nick);
+
+	irc_ht_del(&ctx->nicks, user->nick);
+	user->nick[0] = '\0';
+}
+
+/// @brief Renames a user to its UID to settle a collision, and tells every
+/// server.
+static void user_save(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	irc_cmd_user_rename(ctx, user, user->uid, SAVE_TS);
+	irc_links_sendf(ctx, NULL, ":%s SAVE %s %d", ctx->conf.server_id,
+			user->uid, SAVE_TS);
+}
+
+/// @brief Settles a nickname being claimed by a user of another server.
+///
+/// @param claimer The user, or `NULL` if it is being introduced.
+/// @returns `true` if the claim wins, and the nickname is free for it; or
+/// `false` if the claiming user has to be saved.
+static bool nick_claim(struct irc_ctx *const ctx, const char *const nick,
+		       const u64 ts, const struct irc_user *const claimer)
+{
+	struct irc_user *owner = irc_ht_get(&ctx->nicks, nick);
+
+	if (!owner || (owner == claimer)) {
+		return true;
+	}
+
+	if (!owner->registered) {
+		nick_unreserve(ctx, owner);
+		return true;
+	}
+
+	// The older nickname wins, and both lose on a tie.
+	const bool won = ts < owner->ts;
+
+	if (ts <= owner->ts) {
+		user_save(ctx, owner);
+	}
+	return won;
+}
+
+static void m_sid(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 4) {
+		return;
+	}
+	const char *refusal = server_check(ctx, msg->params[0], msg->params[2]);
+
+	if (refusal) {
+		link_abort(ctx, in->link, refusal);
+		return;
+	}
+	server_add(&ctx->links, msg->params[0], msg->params[2], msg->params[3],
+		   (u32)strtoul(msg->params[1], NULL, 10), in->link, in->server);
+
+	forward(ctx, in);
+}
+
+static void m_uid(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 7) {
+		return;
+	}
+	const char *nick = msg->params[0];
+	const char *uid = msg->params[5];
+	const u64 ts = ts_parse(msg->params[2]);
+
+	u64 id;
+
+	// The UID has to be one given out by its server.
+	if (!irc_link_uid_decode(uid, &id) ||
+	    ((id >> 32) != in->server->id) ||
+	    irc_ht_get(&ctx->links.users, uid_key(id))) {
+		IRC_LOG_ERR(&ctx->log, "link %s: bad UID %s",
+			    in->link->server->name, uid);
+		return;
+	}
+
+	const bool kept = irc_user_nick_valid(nick) &&
+			  nick_claim(ctx, nick, ts, NULL);
+
+	struct irc_user *user = irc_pool_calloc(IRC_POOL_USERS, sizeof(*user));
+
+	user->fd = -1;
+	user->registered = true;
+	user->server = in->server;
+	user->ts = kept ? ts : SAVE_TS;
+
+	strcpy(user->uid, uid);
+	strcpy(user->nick, kept ? nick : uid);
+
+	snprintf(user->username, sizeof(user->username), "%s", msg->params[3]);
+	snprintf(user->host, sizeof(user->host), "%s", msg->params[4]);
+	snprintf(user->realname, sizeof(user->realname), "%s", msg->params[6]);
+
+	irc_ht_add(&ctx->nicks, user->nick, user);
+	irc_cmd_user_intro(ctx, user);
+
+	forward(ctx, in);
+
+	if (!kept) {
+		irc_links_sendf(ctx, NULL, ":%s SAVE %s %d",
+				ctx->conf.server_id, user->uid, SAVE_TS);
+	}
+	in->link->burst.num_users++;
+}
+
+/// @brief Tells the local members of a channel that the modes of a channel
+/// changed, as if a server changed them.
+static void chan_mode_echo(struct irc_ctx *const ctx,
+			   const struct irc_server *const server,
+			   struct irc_chan *const chan, const char *const modes,
+			   const char *const arg)
+{
+	if (!chan->num_local) {
+		return;
+	}
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s MODE %s %s %s",
+		       server ? server->name : ctx->conf.server_name,
+		       chan->name, modes, arg);
+	irc_bcast_chan(ctx, &bc, chan, NULL);
+	irc_bcast_done(&bc);
+}
+
+/// @brief Lowers the TS of a channel to that of an older one on another
+/// server, which takes its modes away.
+static void chan_ts_lower(struct irc_ctx *const ctx,
+			  struct irc_chan *const chan, const u64 ts)
+{
+	static const char *const list_modes[IRC_CHAN_MASKS_NUM] = {
+		[IRC_CHAN_BANS] = "-b", [IRC_CHAN_EXCEPTS] = "-e"
+	};
+
+	for (u32 i = 0; i < chan->members.num_entries; ++i) {
+		struct irc_member *member = chan->members.entries[i];
+
+		if (member->prefix & IRC_MEMBER_OP) {
+			chan_mode_echo(ctx, NULL, chan, "-o",
+				       member->user->nick);
+		}
+
+		if (member->prefix & IRC_MEMBER_VOICE) {
+			chan_mode_echo(ctx, NULL, chan, "-v",
+				       member->user->nick);
+		}
+
+		if (member->prefix) {
+			member->prefix = 0;
+			irc_chan_names_invalidate(member);
+		}
+	}
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		const struct irc_mask_set *set = chan->masks[i];
+
+		for (u32 j = 0; set && (j < set->num_entries); ++j) {
+			chan_mode_echo(ctx, NULL, chan, list_modes[i],
+				       set->entries[j]->text);
+		}
+	}
+	irc_chan_masks_clear(chan);
+
+	IRC_LOG_INFO(&ctx->log,
+		     "%s: TS lowered from %" PRIu64 " to %" PRIu64
+		     ", modes cleared",
+		     chan->name, chan->created, ts);
+
+	chan->created = ts;
+}
+
+/// @brief Finds or creates a channel a user of another server joins, and
+/// settles its TS.
+///
+/// @returns The channel, or `NULL` if the name is not valid; and whether the
+/// modes sent along with the join have to be dropped.
+static struct irc_chan *chan_sync(struct irc_ctx *const ctx,
+				  const char *const name, const u64 ts,
+				  bool *const theirs_lost)
+{
+	*theirs_lost = false;
+
+	if (!irc_chan_name_valid(name)) {
+		return NULL;
+	}
+	struct irc_chan *chan = irc_chan_find(&ctx->chans, name);
+
+	if (!chan) {
+		chan = irc_chan_create(&ctx->chans, name);
+		chan->created = ts;
+	} else if (ts < chan->created) {
+		chan_ts_lower(ctx, chan, ts);
+	} else if (ts > chan->created) {
+		*theirs_lost = true;
+	}
+	return chan;
+}
+
+/// @brief Adds a user of another server to a channel, telling the local
+/// members.
+static void remote_join(struct irc_ctx *const ctx, struct irc_chan *const chan,
+			struct irc_user *const user, const u8 prefix)
+{
+	if (irc_chan_member_find(&ctx->chans, chan, user)) {
+		return;
+	}
+	irc_chan_join(&ctx->chans, chan, user, prefix);
+
+	if (!chan->num_local) {
+		return;
+	}
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, ":%s!%s@%s JOIN %s", user->nick, user->username,
+		       user->host, chan->name);
+	irc_bcast_chan(ctx, &bc, chan, user);
+	irc_bcast_done(&bc);
+
+	if (prefix & IRC_MEMBER_OP) {
+		chan_mode_echo(ctx, user->server, chan, "+o", user->nick);
+	}
+
+	if (prefix & IRC_MEMBER_VOICE) {
+		chan_mode_echo(ctx, user->server, chan, "+v", user->nick);
+	}
+}
+
+static void m_sjoin(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 4) {
+		return;
+	}
+	struct irc_user *joins[IRC_LINK_LINE_LEN_MAX / (IRC_USER_UID_LEN + 1)];
+	u8 prefixes[IRC_LINK_LINE_LEN_MAX / (IRC_USER_UID_LEN + 1)];
+
+	u32 num_joins = 0;
+
+	const char *pos = msg->params[msg->num_params - 1];
+
+	while (num_joins < (sizeof(joins) / sizeof(*joins))) {
+		while (*pos == ' ') {
+			pos++;
+		}
+
+		if (*pos == '\0') {
+			break;
+		}
+		u8 prefix = 0;
+
+		for (;; ++pos) {
+			if (*pos == '@') {
+				prefix |= IRC_MEMBER_OP;
+			} else if (*pos == '+') {
+				prefix |= IRC_MEMBER_VOICE;
+			} else {
+				break;
+			}
+		}
+		const size_t len = strcspn(pos, " ");
+
+		if (len == IRC_USER_UID_LEN) {
+			char uid[IRC_USER_UID_LEN + 1];
+
+			memcpy(uid, pos, len);
+			uid[len] = '\0';
+
+			struct irc_user *user =
+				irc_links_user_find(&ctx->links, uid);
+
+			if (user && (irc_user_link(user) == in->link)) {
+				joins[num_joins] = user;
+				prefixes[num_joins] = prefix;
+				num_joins++;
+			}
+		}
+		pos += len;
+	}
+
+	// An empty channel would never be destroyed.
+	if (!num_joins) {
+		return;
+	}
+	bool theirs_lost;
+
+	struct irc_chan *chan = chan_sync(ctx, msg->params[1],
+					  ts_parse(msg->params[0]),
+					  &theirs_lost);
+
+	if (!chan) {
+		return;
+	}
+
+	for (u32 i = 0; i < num_joins; ++i) {
+		remote_join(ctx, chan, joins[i], theirs_lost ? 0 : prefixes[i]);
+	}
+	forward(ctx, in);
+	in->link->burst.num_chans++;
+}
+
+/// @brief Applies a change of a list of masks of a channel, telling the local
+/// members.
+static void chan_mask_apply(struct irc_ctx *const ctx,
+			    const struct link_in *const in,
+			    struct irc_chan *const chan, const bool add,
+			    const char list, const char *const mask)
+{
+	const enum irc_chan_masks idx = (list == 'b') ? IRC_CHAN_BANS
+						      : IRC_CHAN_EXCEPTS;
+
+	const char *setter = in->user ? in->user->nick : in->server->name;
+
+	const bool changed = add ? (irc_chan_mask_add(chan, idx, mask,
+						      setter) != NULL)
+				 : irc_chan_mask_del(chan, idx, mask);
+
+	if (!changed || !chan->num_local) {
+		return;
+	}
+	struct irc_bcast bc;
+
+	if (in->user) {
+		irc_bcast_init(&bc, ":%s!%s@%s MODE %s %c%c %s", setter,
+			       in->user->username, in->user->host, chan->name,
+			       add ? '+' : '-', list, mask);
+	} else {
+		irc_bcast_init(&bc, ":%s MODE %s %c%c %s", setter, chan->name,
+			       add ? '+' : '-', list, mask);
+	}
+	irc_bcast_chan(ctx, &bc, chan, NULL);
+	irc_bcast_done(&bc);
+}
+
+/// @brief Looks up the channel a message with a TS is about, which is ignored
+/// if its TS is newer than ours.
+static struct irc_chan *chan_ts_find(struct irc_ctx *const ctx,
+				     const char *const ts,
+				     const char *const name)
+{
+	struct irc_chan *chan = irc_chan_find(&ctx->chans, name);
+
+	if (!chan || (ts_parse(ts) > chan->created)) {
+		return NULL;
+	}
+	return chan;
+}
+
+static void m_bmask(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if ((msg->num_params < 4) ||
+	    ((msg->params[2][0] != 'b') && (msg->params[2][0] != 'e'))) {
+		return;
+	}
+	struct irc_chan *chan = chan_ts_find(ctx, msg->params[0],
+					     msg->params[1]);
+
+	if (!chan) {
+		return;
+	}
+	char masks[IRC_LINK_LINE_LEN_MAX];
+	snprintf(masks, sizeof(masks), "%s", msg->params[3]);
+
+	char *save;
+
+	for (char *mask = strtok_r(masks, " ", &save); mask;
+	     mask = strtok_r(NULL, " ", &save)) {
+		if (strlen(mask) <= IRC_MASK_LEN_MAX) {
+			chan_mask_apply(ctx, in, chan, true, msg->params[2][0],
+					mask);
+		}
+	}
+	forward(ctx, in);
+}
+
+static void m_tmode(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 3) {
+		return;
+	}
+	struct irc_chan *chan = chan_ts_find(ctx, msg->params[0],
+					     msg->params[1]);
+
+	if (!chan) {
+		return;
+	}
+	bool add = true;
+	u32 arg = 3;
+
+	for (const char *mode = msg->params[2]; *mode != '\0'; ++mode) {
+		if ((*mode == '+') || (*mode == '-')) {
+			add = (*mode == '+');
+			continue;
+		}
+
+		// Only lists of masks are channel modes so far.
+		if (((*mode != 'b') && (*mode != 'e')) ||
+		    (arg >= msg->num_params)) {
+			continue;
+		}
+		const char *mask = msg->params[arg++];
+
+		if (strlen(mask) <= IRC_MASK_LEN_MAX) {
+			chan_mask_apply(ctx, in, chan, add, *mode, mask);
+		}
+	}
+	forward(ctx, in);
+}
+
+static void m_eob(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	struct irc_link *link = in->link;
+
+	if (in->server == link->server) {
+		IRC_LOG_INFO(&ctx->log,
+			     "burst from %s: %" PRIu32 " users, %" PRIu32
+			     " channels in %" PRIu64 " ms",
+			     link->server->name, link->burst.num_users,
+			     link->burst.num_chans,
+			     (irc_clock_mono_ns() - link->burst.start_ns) /
+				     1000000);
+	}
+	forward(ctx, in);
+}
+
+static void m_nick(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if ((msg->num_params < 2) || !irc_user_nick_valid(msg->params[0])) {
+		return;
+	}
+	struct irc_user *user = in->user;
+	const u64 ts = ts_parse(msg->params[1]);
+
+	if (nick_claim(ctx, msg->params[0], ts, user)) {
+		irc_cmd_user_rename(ctx, user, msg->params[0], ts);
+		forward(ctx, in);
+		return;
+	}
+
+	// The change is passed on so that every server settles the collision
+	// alike.
+	forward(ctx, in);
+	user_save(ctx, user);
+}
+
+static void m_save(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 2) {
+		return;
+	}
+	struct irc_user *user = irc_links_user_find(&ctx->links,
+						    msg->params[0]);
+
+	if (!user) {
+		return;
+	}
+
+	if (strcmp(user->nick, user->uid)) {
+		irc_cmd_user_rename(ctx, user, user->uid, SAVE_TS);
+	}
+	forward(ctx, in);
+}
+
+static void m_quit(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	struct irc_user *user = in->user;
+
+	forward(ctx, in);
+
+	irc_cmd_user_quit(ctx, user,
+			  in->msg.num_params ? in->msg.params[0] : "");
+	irc_user_release(ctx, user);
+	irc_pool_free(IRC_POOL_USERS, user, sizeof(*user));
+}
+
+static void m_join(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 2) {
+		return;
+	}
+	bool theirs_lost;
+
+	struct irc_chan *chan = chan_sync(ctx, msg->params[1],
+					  ts_parse(msg->params[0]),
+					  &theirs_lost);
+
+	if (chan) {
+		remote_join(ctx, chan, in->user, 0);
+		forward(ctx, in);
+	}
+}
+
+static void m_part(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (!msg->num_params) {
+		return;
+	}
+	struct irc_user *user = in->user;
+	struct irc_chan *chan = irc_chan_find(&ctx->chans, msg->params[0]);
+	struct irc_member *member =
+		chan ? irc_chan_member_find(&ctx->chans, chan, user) : NULL;
+
+	if (!member) {
+		return;
+	}
+
+	if (chan->num_local) {
+		struct irc_bcast bc;
+
+		irc_bcast_init(&bc, ":%s!%s@%s PART %s :%s", user->nick,
+			       user->username, user->host, chan->name,
+			       (msg->num_params > 1) ? msg->params[1] : "");
+		irc_bcast_chan(ctx, &bc, chan, user);
+		irc_bcast_done(&bc);
+	}
+	forward(ctx, in);
+	irc_chan_part(&ctx->chans, member);
+}
+
+static void m_privmsg(struct irc_ctx *const ctx,
+		      const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 2) {
+		return;
+	}
+	struct irc_user *user = in->user;
+	const char *target = msg->params[0];
+
+	if (irc_chan_name_valid(target)) {
+		struct irc_chan *chan = irc_chan_find(&ctx->chans, target);
+
+		if (!chan) {
+			return;
+		}
+
+		if (chan->num_local) {
+			struct irc_bcast bc;
+
+			irc_bcast_init(&bc, ":%s!%s@%s %s %s :%s", user->nick,
+				       user->username, user->host, msg->cmd,
+				       chan->name, msg->params[1]);
+			irc_bcast_chan(ctx, &bc, chan, user);
+			irc_bcast_done(&bc);
+		}
+		forward(ctx, in);
+		return;
+	}
+	struct irc_user *dst = irc_links_user_find(&ctx->links, target);
+
+	if (!dst) {
+		return;
+	}
+
+	// A message to a user of another server is passed on towards it only.
+	if (dst->server) {
+		if (irc_user_link(dst) != in->link) {
+			link_write_line(irc_user_link(dst), in->line, in->len);
+		}
+		return;
+	}
+	irc_user_sendf(ctx, dst, ":%s!%s@%s %s %s :%s", user->nick,
+		       user->username, user->host, msg->cmd, dst->nick,
+		       msg->params[1]);
+}
+
+static void m_away(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	struct irc_user *user = in->user;
+	const char *text = in->msg.num_params ? in->msg.params[0] : "";
+
+	irc_user_away_set(user, text, strlen(text));
+
+	struct irc_bcast bc;
+
+	if (user->away) {
+		irc_bcast_init(&bc, ":%s!%s@%s AWAY :%s", user->nick,
+			       user->username, user->host, user->away);
+	} else {
+		irc_bcast_init(&bc, ":%s!%s@%s AWAY", user->nick,
+			       user->username, user->host);
+	}
+	irc_bcast_common(ctx, &bc, user, IRC_USER_CAP_AWAY_NOTIFY);
+	irc_bcast_done(&bc);
+
+	forward(ctx, in);
+}
+
+static void m_squit(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (!msg->num_params || !irc_link_sid_valid(msg->params[0])) {
+		return;
+	}
+	struct irc_server *server =
+		ctx->links.by_sid[irc_link_sid_decode(msg->params[0])];
+
+	// The server linked directly is split by closing its link.
+	if (!server || (server->link != in->link) ||
+	    (server == in->link->server)) {
+		return;
+	}
+	forward(ctx, in);
+	server_split(ctx, server);
+}
+
+/// @brief Returns the link a message to a server has to be sent on, or `NULL`
+/// if it is addressed to this server or to no known server.
+static struct irc_link *route(struct irc_ctx *const ctx, const char *const dst,
+			      bool *const ours)
+{
+	*ours = !strcmp(dst, ctx->conf.server_id) ||
+		!strcasecmp(dst, ctx->conf.server_name);
+
+	if (*ours || !irc_link_sid_valid(dst)) {
+		return NULL;
+	}
+	struct irc_server *server =
+		ctx->links.by_sid[irc_link_sid_decode(dst)];
+
+	return server ? server->link : NULL;
+}
+
+static void m_ping(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (!msg->num_params) {
+		return;
+	}
+	bool ours = true;
+
+	if (msg->num_params > 1) {
+		struct irc_link *link = route(ctx, msg->params[1], &ours);
+
+		if (link && (link != in->link)) {
+			link_write_line(link, in->line, in->len);
+			return;
+		}
+	}
+
+	if (ours) {
+		irc_link_sendf(in->link, ":%s PONG %s %s", ctx->conf.server_id,
+			       ctx->conf.server_id,
+			       in->server ? in->server->sid : msg->params[0]);
+	}
+}
+
+static void m_pong(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	const struct irc_link_msg *msg = &in->msg;
+
+	if (msg->num_params < 2) {
+		return;
+	}
+	bool ours;
+	struct irc_link *link = route(ctx, msg->params[1], &ours);
+
+	if (link && (link != in->link)) {
+		link_write_line(link, in->line, in->len);
+	}
+}
+
+static void m_error(struct irc_ctx *const ctx, const struct link_in *const in)
+{
+	IRC_LOG_ERR(&ctx->log, "link %s: %s", in->link->server->name,
+		    in->msg.num_params ? in->msg.params[0] : "");
+
+	in->link->closing = true;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+static const struct {
+	const char *name;
+	link_cmd_cb cb;
+
+	/// @brief The kind of source the message must have.
+	enum link_src src;
+} cmds[] = {
+	// clang-format off
+
+	// The table is searched linearly, so the most frequent messages, in a
+	// burst and after, come first.
+	{ "PRIVMSG",    &m_privmsg,     SRC_USER        },
+	{ "UID",        &m_uid,         SRC_SERVER      },
+	{ "SJOIN",      &m_sjoin,       SRC_SERVER      },
+	{ "JOIN",       &m_join,        SRC_USER        },
+	{ "PART",       &m_part,        SRC_USER        },
+	{ "QUIT",       &m_quit,        SRC_USER        },
+	{ "NOTICE",     &m_privmsg,     SRC_USER        },
+	{ "NICK",       &m_nick,        SRC_USER        },
+	{ "AWAY",       &m_away,        SRC_USER        },
+	{ "TMODE",      &m_tmode,       SRC_USER        },
+	{ "BMASK",      &m_bmask,       SRC_SERVER      },
+	{ "PING",       &m_ping,        SRC_SERVER      },
+	{ "PONG",       &m_pong,        SRC_SERVER      },
+	{ "SAVE",       &m_save,        SRC_SERVER      },
+	{ "SID",        &m_sid,         SRC_SERVER      },
+	{ "EOB",        &m_eob,         SRC_SERVER      },
+	{ "SQUIT",      &m_squit,       SRC_SERVER      },
+	{ "ERROR",      &m_error,       SRC_SERVER      }
+
+	// clang-format on
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Runs the handler of a message received from an established link.
+static void dispatch(struct irc_ctx *const ctx, struct link_in *const in)
+{
+
+	const char *src = in->msg.src;
+	const size_t src_len = src ? strlen(src) : 0;
+
+	// Messages without a source come from the server at the other end.
+	if (!src) {
+		in->server = in->link->server;
+	} else if ((src_len == IRC_CONF_SERVER_ID_LEN) &&
+		   irc_link_sid_valid(src)) {
+		in->server = ctx->links.by_sid[irc_link_sid_decode(src)];
+	} else if (src_len == IRC_USER_UID_LEN) {
+		in->user = irc_links_user_find(&ctx->links, src);
+	}
+
+	// A source has to be behind the link it came from; anything else is
+	// about a server or user that is gone, and is dropped.
+	if (in->user && (irc_user_link(in->user) != in->link)) {
+		in->user = NULL;
+	}
+
+	if (in->server && (in->server->link != in->link)) {
+		in->server = NULL;
+	}
+
+	for (size_t i = 0; i < (sizeof(cmds) / sizeof(*cmds)); ++i) {
+		if (strcmp(cmds[i].name, in->msg.cmd)) {
+			continue;
+		}
+
+		// Messages from a user of a server are fine where a server
+		// is expected.
+		if (!in->server && in->user && (cmds[i].src == SRC_SERVER)) {
+			in->server = in->user->server;
+		}
+
+		if ((cmds[i].src == SRC_USER) ? (in->user != NULL)
+					      : (in->server != NULL)) {
+			cmds[i].cb(ctx, in);
+		}
+		return;
+	}
+	IRC_LOG_DBG(&ctx->log, "link %s: unknown message %s",
+		    in->link->server->name, in->msg.cmd);
+}
+
+/// @brief Handles a complete line received from a link.
+static void link_line(struct irc_ctx *const ctx, struct irc_link *const link,
+		      const char *const line, const size_t len)
+{
+	// The line is split up in place, but may also have to be passed on as
+	// it is.
+	char buf[IRC_LINK_LINE_LEN_MAX];
+
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	struct link_in in = { .link = link, .line = line, .len = len };
+
+	if (!irc_link_msg_parse(buf, &in.msg)) {
+		return;
+	}
+
+	if (link->state != IRC_LINK_ESTABLISHED) {
+		handshake(ctx, link, &in.msg);
+		return;
+	}
+	dispatch(ctx, &in);
+}
+
+/// @brief Handles lines received from a link.
+///
+/// @param plain If `true`, the data is received as it is, and stops being
+/// taken once the link turns compressed.
+/// @returns The number of bytes taken.
+static size_t lines_recv(struct irc_ctx *const ctx,
+			 struct irc_link *const link, const char *const data,
+			 const size_t size, const bool plain)
+{
+	size_t start = 0;
+
+	for (size_t i = 0; i < size; ++i) {
+		if ((data[i] != '\n') && (data[i] != '\r')) {
+			continue;
+		}
+		const char *line = &data[start];
+		size_t len = i - start;
+
+		start = i + 1;
+
+		// The start of the line is buffered from an earlier read.
+		if (link->recvq_len) {
+			if (!link->recvq_discard &&
+			    ((link->recvq_len + len) < sizeof(link->recvq))) {
+				memcpy(&link->recvq[link->recvq_len], line,
+				       len);
+				line = link->recvq;
+				len += link->recvq_len;
+			} else {
+				len = 0;
+			}
+			link->recvq_len = 0;
+			link->recvq_discard = false;
+		}
+
+		if (len && (len < IRC_LINK_LINE_LEN_MAX) && !link->closing) {
+			link_line(ctx, link, line, len);
+
+			// Whatever follows SERVER is compressed.
+			if (plain && link->zip_in) {
+				return start;
+			}
+		}
+	}
+	const size_t rest = size - start;
+
+	if (!rest) {
+		return size;
+	}
+
+	if ((link->recvq_len + rest) < sizeof(link->recvq)) {
+		memcpy(&link->recvq[link->recvq_len], &data[start], rest);
+		link->recvq_len += rest;
+	} else {
+		// Still buffered, so that the end of the line is recognized;
+		// the line is dropped.
+		link->recvq_len = 1;
+		link->recvq_discard = true;
+	}
+	return size;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct zip_recv_data {
+	struct irc_ctx *ctx;
+	struct irc_link *link;
+};
+
+#pragma GCC diagnostic pop
+
+static void zip_recv_lines(void *const udata, const char *const data,
+			   const size_t len)
+{
+	const struct zip_recv_data *zrd = udata;
+
+	(void)lines_recv(zrd->ctx, zrd->link, data, len, false);
+}
+
+void irc_link_recv(struct irc_ctx *const ctx, struct irc_link *const link,
+		   const char *const data, const size_t size)
+{
+	size_t taken = 0;
+
+	if (!link->zip_in) {
+		taken = lines_recv(ctx, link, data, size, true);
+
+		// A zlib stream starts with its header, never with a line
+		// feed: one left over from the terminator of SERVER is not
+		// part of it.
+		if ((taken < size) && (data[taken] == '\n')) {
+			taken++;
+		}
+	} else if (!irc_zip_stats(link->zip_in)->wire_bytes &&
+		   (data[0] == '\n')) {
+		taken = 1;
+	}
+
+	if ((taken == size) || link->closing) {
+		return;
+	}
+	struct zip_recv_data zrd = { .ctx = ctx, .link = link };
+
+	if (IRC_UNLIKELY(!irc_zip_inflate(link->zip_in, &data[taken],
+					  size - taken, &zip_recv_lines,
+					  &zrd))) {
+		link_abort(ctx, link, "Corrupt compressed data");
+	}
+}
+
+static struct irc_link *link_new(struct irc_links *const links, const int fd,
+				 const char *const host)
+{
+	struct irc_link *link = irc_calloc(1, sizeof(*link));
+
+	link->fd = fd;
+	snprintf(link->host, sizeof(link->host), "%s", host);
+
+	links->entries[links->num_entries++] = link;
+	return link;
+}
+
+void irc_link_accept(struct irc_ctx *const ctx, const int fd,
+		     const char *const host)
+{
+	struct irc_links *links = &ctx->links;
+
+	if (links->num_entries >= (sizeof(links->entries) / sizeof(*links->entries))) {
+		IRC_LOG_ERR(&ctx->log, "link from %s refused: too many links",
+			    host);
+		irc_net_close(&ctx->net, fd);
+		return;
+	}
+	struct irc_link *link = link_new(links, fd, host);
+
+	link->state = IRC_LINK_HANDSHAKE;
+
+	IRC_LOG_INFO(&ctx->log, "link from %s", host);
+}
+
+void irc_link_writable(struct irc_ctx *const ctx, struct irc_link *const link)
+{
+	if (link->state == IRC_LINK_CONNECTING) {
+		// A failed connection is closed once the error is read.
+		if (!irc_net_connected(&ctx->net, link->fd)) {
+			return;
+		}
+		link->state = IRC_LINK_HANDSHAKE;
+		handshake_send(ctx, link);
+	}
+	// Whatever is queued is written out at the end of the I/O loop
+	// iteration, like the output of users.
+}
+
+void irc_link_closed(struct irc_ctx *const ctx, struct irc_link *const link)
+{
+	struct irc_links *links = &ctx->links;
+
+	if (link->server) {
+		irc_links_sendf(ctx, link, ":%s SQUIT %s :%s",
+				ctx->conf.server_id, link->server->sid,
+				"Connection closed");
+		server_split(ctx, link->server);
+	}
+
+	for (size_t i = 0; i < (sizeof(links->outbound) / sizeof(*links->outbound)); ++i) {
+		if (links->outbound[i].link == link) {
+			links->outbound[i].link = NULL;
+			links->outbound[i].retry_at_ms =
+				irc_clock_mono_ns() / 1000000 +
+				IRC_LINK_RETRY_MS;
+		}
+	}
+
+	for (u32 i = 0; i < links->num_entries; ++i) {
+		if (links->entries[i] == link) {
+			links->entries[i] =
+				links->entries[--links->num_entries];
+			break;
+		}
+	}
+	IRC_LOG_INFO(&ctx->log, "link at %s closed", link->host);
+
+	if (link->zip_out) {
+		char line[IRC_LINK_LINE_LEN_MAX];
+
+		IRC_LOG_INFO(&ctx->log, "link at %s: %.*s", link->host,
+			     (int)zip_stats_fmt(link, line, sizeof(line)),
+			     line);
+	}
+	irc_zip_free(link->zip_out);
+	irc_zip_free(link->zip_in);
+
+	irc_sendq_clear(&link->sendq);
+
+	if (link->out) {
+		irc_buf_unref(link->out);
+	}
+	free(link);
+}
+
+int irc_links_connect(struct irc_ctx *const ctx)
+{
+	struct irc_links *links = &ctx->links;
+	const struct irc_conf *conf = &ctx->conf;
+
+	const u64 now = irc_clock_mono_ns() / 1000000;
+	int wait = -1;
+
+	for (size_t i = 0; i < conf->links.num_entries; ++i) {
+		const struct irc_conf_link *entry = &conf->links.entries[i];
+
+		if ((entry->addr.host[0] == '\0') || links->outbound[i].link) {
+			continue;
+		}
+
+		if (links->outbound[i].retry_at_ms > now) {
+			const u64 left = links->outbound[i].retry_at_ms - now;
+
+			if ((wait < 0) || (left < (u64)wait)) {
+				wait = (int)left;
+			}
+			continue;
+		}
+		links->outbound[i].retry_at_ms = now + IRC_LINK_RETRY_MS;
+
+		// Linked through another server already.
+		if (server_find_name(links, entry->name) ||
+		    (links->num_entries >= (sizeof(links->entries) / sizeof(*links->entries)))) {
+			continue;
+		}
+		const int fd = irc_net_connect(&ctx->net, entry->addr.host,
+					       entry->addr.port);
+
+		if (fd < 0) {
+			IRC_LOG_ERR(&ctx->log, "link to %s at %s:%s failed",
+				    entry->name, entry->addr.host,
+				    entry->addr.port);
+			continue;
+		}
+		struct irc_link *link = link_new(links, fd, entry->addr.host);
+
+		link->state = IRC_LINK_CONNECTING;
+		link->conf = entry;
+		links->outbound[i].link = link;
+
+		IRC_LOG_INFO(&ctx->log, "linking to %s at %s:%s", entry->name,
+			     entry->addr.host, entry->addr.port);
+	}
+
+	// Retries that are due have been made; check again in a while.
+	for (size_t i = 0; i < conf->links.num_entries; ++i) {
+		if ((conf->links.entries[i].addr.host[0] != '\0') &&
+		    !links->outbound[i].link && (wait < 0)) {
+			wait = IRC_LINK_RETRY_MS;
+		}
+	}
+	return wait;
+}
+
+void irc_links_flush(struct irc_ctx *const ctx)
+{
+	struct irc_links *links = &ctx->links;
+
+	// Closing a link removes it from the entries, moving the last one
+	// into its place.
+	for (u32 i = links->num_entries; i-- > 0;) {
+		struct irc_link *link = links->entries[i];
+
+		if (link->state == IRC_LINK_CONNECTING) {
+			continue;
+		}
+
+		// Compressed output is flushed once per iteration, however
+		// little of it there is, so that it never waits for more.
+		if ((link->out && link->out->len) || link->zip_out) {
+			out_seal(link, true);
+		}
+		const enum irc_sendq_status status =
+			irc_sendq_flush(&link->sendq, &ctx->net, link->fd);
+
+		if ((status == IRC_SENDQ_ERR) ||
+		    (link->closing && (status == IRC_SENDQ_EMPTY))) {
+			irc_net_close(&ctx->net, link->fd);
+		}
+	}
+}
+
+void irc_links_report(const struct irc_links *const links,
+		      const irc_links_emit_cb emit, void *const udata)
+{
+	for (u32 i = 0; i < links->num_entries; ++i) {
+		const struct irc_link *link = links->entries[i];
+
+		if (link->state != IRC_LINK_ESTABLISHED) {
+			continue;
+		}
+		char zip[IRC_LINK_LINE_LEN_MAX / 2] = "uncompressed";
+
+		if (link->zip_out) {
+			(void)zip_stats_fmt(link, zip, sizeof(zip));
+		}
+		char line[IRC_LINK_LINE_LEN_MAX];
+
+		const int len = snprintf(line, sizeof(line), "%s sendq=%zu %s",
+					 link->server->name, link->sendq.len,
+					 zip);
+
+		if (len > 0) {
+			emit(udata, line,
+			     ((size_t)len < sizeof(line)) ? (size_t)len
+							  : (sizeof(line) - 1));
+		}
+	}
+}
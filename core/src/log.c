@@ -22,14 +22,92 @@
 
 #define LOG_MSG_MAX (512)
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "core/log.h"
+#include "core/log_bin.h"
+
+// These are provided by the linker, and delimit the section that every call
+// site is placed in. They are weak so that a binary without any call sites
+// still links.
+extern const struct irc_log_site __start_irc_log_sites[]
+	__attribute__((weak));
+extern const struct irc_log_site __stop_irc_log_sites[] __attribute__((weak));
+
+uint irc_log_site_id(const struct irc_log_site *const site)
+{
+	return (uint)(site - __start_irc_log_sites);
+}
+
+const struct irc_log_site *irc_log_sites(size_t *const num_sites)
+{
+	*num_sites = (size_t)(__stop_irc_log_sites - __start_irc_log_sites);
+	return __start_irc_log_sites;
+}
+
+bool irc_log_ratelimit_allow(struct irc_log_ratelimit *const rl,
+			     const uint per_sec, uint *const suppressed)
+{
+	// Second granularity is all we need, so the coarse clock is good
+	// enough and cheaper to read.
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	const u64 now = (u64)ts.tv_sec;
+
+	if (now != rl->window) {
+		rl->window = now;
+		rl->num_logged = 0;
+	}
+
+	if (rl->num_logged >= per_sec) {
+		rl->num_suppressed++;
+		return false;
+	}
+	rl->num_logged++;
+
+	*suppressed = rl->num_suppressed;
+	rl->num_suppressed = 0;
+
+	return true;
+}
+
+/// @brief Set on threads that must not wait for the lock of a log; see
+/// @ref irc_log_thread_nowait().
+static _Thread_local bool nowait;
+
+void irc_log_thread_nowait(void)
+{
+	nowait = true;
+}
+
+void irc_log_init(struct irc_log *const log)
+{
+	pthread_mutex_init(&log->lock, NULL);
+}
+
+/// @brief Writes a message straight to the standard error, bypassing the
+/// sinks of the log.
+static void stderr_write(char *const str, size_t len)
+{
+	str[len++] = '\n';
+
+	while (write(STDERR_FILENO, str, len) < 0) {
+		if (errno != EINTR) {
+			return;
+		}
+	}
+}
 
 IRC_ATTRIB_FMT(printf, 3, 4)
-void irc_log_dispatch(struct irc_log *const log, const uint lvl,
+void irc_log_dispatch(struct irc_log *const log,
+		      const struct irc_log_site *const site,
 		      const char *const msg, ...)
 {
 #define LVL_DEF(str) { str, sizeof(str) }
@@ -44,23 +122,62 @@ void irc_log_dispatch(struct irc_log *const log, const uint lvl,
 		[IRC_LOG_LVL_WARN]      = LVL_DEF("[warn] "),
 		[IRC_LOG_LVL_ERR]       = LVL_DEF("[error] "),
 		[IRC_LOG_LVL_DBG]       = LVL_DEF("[debug] "),
-                [IRC_LOG_LVL_TRACE]     = LVL_DEF("[trace] ")
+                [IRC_LOG_LVL_TRACE]     = LVL_DEF("[trace] "),
+		[IRC_LOG_LVL_FATAL]     = LVL_DEF("[fatal] ")
 	};
 
 	// clang-format on
 
-	char str[LOG_MSG_MAX];
-	memcpy(str, lvl_data[lvl].str, lvl_data[lvl].len);
-
 	va_list args;
-	va_start(args, msg);
+
+	const uint lvl = site->lvl;
+
+	// One byte is kept spare for the line feed of stderr_write().
+	char str[LOG_MSG_MAX + 1];
+	size_t len = 0;
+
+	// The message is formatted before the lock is taken, so that the lock
+	// is only held to append it.
+	if (log->cb || nowait) {
+		len = lvl_data[lvl].len - 1;
+		memcpy(str, lvl_data[lvl].str, len);
+
+		va_start(args, msg);
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-nonliteral"
-	vsprintf(&str[lvl_data[lvl].len - 1], msg, args);
+		const int ret =
+			vsnprintf(&str[len], LOG_MSG_MAX - len, msg, args);
 #pragma GCC diagnostic pop
 
-	va_end(args);
+		va_end(args);
+
+		if (ret > 0) {
+			len += ((size_t)ret < (LOG_MSG_MAX - len))
+				       ? (size_t)ret
+				       : (LOG_MSG_MAX - len - 1);
+		}
+	}
+
+	if (IRC_UNLIKELY(nowait)) {
+		// Whoever holds the lock may be the very thread being reported
+		// on, stuck in a sink.
+		if (pthread_mutex_trylock(&log->lock)) {
+			stderr_write(str, len);
+			return;
+		}
+	} else {
+		pthread_mutex_lock(&log->lock);
+	}
+
+	if (log->bin) {
+		va_start(args, msg);
+		irc_log_bin_write(log->bin, site, args);
+		va_end(args);
+	}
 
-	log->cb(log->udata, lvl, str);
+	if (log->cb) {
+		log->cb(log->udata, lvl, str);
+	}
+	pthread_mutex_unlock(&log->lock);
 }
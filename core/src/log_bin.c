@@ -0,0 +1,653 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// @file log_bin.c Defines the implementation of the binary log sink.
+///
+/// * Log files are pre-sized to their maximum size and memory-mapped, so
+///   appending a record is a handful of stores into the page cache and never
+///   a system call. The kernel writes the pages back on its own schedule.
+///
+/// * The space left in the active file is checked against the worst case size
+///   of a record before packing it, so records are packed directly into the
+///   mapping without an intermediate copy.
+///
+/// * When a file is rotated it is truncated to the size actually written. A
+///   file that was not closed cleanly keeps its zero-filled tail, which the
+///   decoder recognizes as the end of the log.
+///
+/// * If mapping a new file fails, e.g. on a full disk, records are dropped and
+///   the mapping is retried at most once a second. The file is not rotated
+///   again meanwhile, which would throw away the oldest one every time.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/clock.h"
+#include "core/compiler.h"
+#include "core/log_bin.h"
+
+// clang-format off
+
+/// @brief The worst case size of a record.
+#define REC_SIZE_MAX \
+	(sizeof(struct irc_log_bin_rec) + IRC_LOG_BIN_PAYLOAD_SIZE_MAX)
+
+/// @brief The largest argument that can be packed: a string of maximum length
+/// and its length prefix.
+#define ARG_SIZE_MAX            (sizeof(u32) + IRC_LOG_BIN_STR_LEN_MAX)
+
+/// @brief How long to wait before mapping a file again after failing to.
+#define MAP_RETRY_NS            (1000 * 1000 * 1000)
+
+// clang-format on
+
+const char *irc_log_bin_fmt_next(const char *fmt,
+				 struct irc_log_bin_spec *const spec)
+{
+	fmt = strchr(fmt, '%');
+
+	if (!fmt) {
+		return NULL;
+	}
+
+	*spec = (struct irc_log_bin_spec){ .start = fmt };
+	++fmt;
+
+	while (strchr("-+ #0'", *fmt) && (*fmt != '\0')) {
+		++fmt;
+	}
+
+	// Field width, then precision.
+	for (uint i = 0; i < 2; ++i) {
+		if (*fmt == '*') {
+			spec->num_stars++;
+			++fmt;
+		} else {
+			while ((*fmt >= '0') && (*fmt <= '9')) {
+				++fmt;
+			}
+		}
+
+		if ((i == 0) && (*fmt == '.')) {
+			++fmt;
+		} else {
+			break;
+		}
+	}
+
+	switch (*fmt) {
+	case 'h':
+		fmt += (fmt[1] == 'h') ? 2 : 1;
+		break;
+	case 'l':
+		if (fmt[1] == 'l') {
+			spec->width = IRC_LOG_BIN_WIDTH_LLONG;
+			fmt += 2;
+		} else {
+			spec->width = IRC_LOG_BIN_WIDTH_LONG;
+			++fmt;
+		}
+		break;
+	case 'z':
+		spec->width = IRC_LOG_BIN_WIDTH_SIZE;
+		++fmt;
+		break;
+	case 'j':
+		spec->width = IRC_LOG_BIN_WIDTH_INTMAX;
+		++fmt;
+		break;
+	case 't':
+		spec->width = IRC_LOG_BIN_WIDTH_PTRDIFF;
+		++fmt;
+		break;
+	default:
+		break;
+	}
+
+	switch (*fmt) {
+	case 'd':
+	case 'i':
+	case 'c':
+		spec->arg = IRC_LOG_BIN_ARG_INT;
+		break;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		spec->arg = IRC_LOG_BIN_ARG_UINT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec->arg = IRC_LOG_BIN_ARG_DBL;
+		break;
+	case 's':
+		spec->arg = IRC_LOG_BIN_ARG_STR;
+		break;
+	case 'p':
+		spec->arg = IRC_LOG_BIN_ARG_PTR;
+		break;
+	case '\0':
+		// Truncated specification; treat it as literal text.
+		spec->len = (size_t)(fmt - spec->start);
+		return fmt;
+	default:
+		// "%%", or a conversion we do not support.
+		spec->arg = IRC_LOG_BIN_ARG_NONE;
+		break;
+	}
+	++fmt;
+
+	spec->len = (size_t)(fmt - spec->start);
+	return fmt;
+}
+
+// The "ll" length modifier has to be honoured even though the project itself
+// does not use "long long".
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlong-long"
+
+static i64 arg_int(const enum irc_log_bin_width width, va_list *const args)
+{
+	switch (width) {
+	case IRC_LOG_BIN_WIDTH_INT:
+		return va_arg(*args, int);
+	case IRC_LOG_BIN_WIDTH_LONG:
+		return va_arg(*args, long);
+	case IRC_LOG_BIN_WIDTH_LLONG:
+		return va_arg(*args, long long);
+	case IRC_LOG_BIN_WIDTH_SIZE:
+		return va_arg(*args, ssize_t);
+	case IRC_LOG_BIN_WIDTH_INTMAX:
+		return va_arg(*args, intmax_t);
+	case IRC_LOG_BIN_WIDTH_PTRDIFF:
+		return va_arg(*args, ptrdiff_t);
+	default:
+		return 0;
+	}
+}
+
+static u64 arg_uint(const enum irc_log_bin_width width, va_list *const args)
+{
+	switch (width) {
+	case IRC_LOG_BIN_WIDTH_INT:
+		return va_arg(*args, uint);
+	case IRC_LOG_BIN_WIDTH_LONG:
+		return va_arg(*args, unsigned long);
+	case IRC_LOG_BIN_WIDTH_LLONG:
+		return va_arg(*args, unsigned long long);
+	case IRC_LOG_BIN_WIDTH_SIZE:
+		return va_arg(*args, size_t);
+	case IRC_LOG_BIN_WIDTH_INTMAX:
+		return va_arg(*args, uintmax_t);
+	case IRC_LOG_BIN_WIDTH_PTRDIFF:
+		return (u64)va_arg(*args, ptrdiff_t);
+	default:
+		return 0;
+	}
+}
+
+#pragma GCC diagnostic pop
+
+/// @brief Packs the arguments of a message into `dst`.
+///
+/// @returns The number of bytes written.
+static size_t args_pack(u8 *const dst, const char *fmt, va_list *const args)
+{
+	struct irc_log_bin_spec spec;
+	size_t pos = 0;
+
+	while ((fmt = irc_log_bin_fmt_next(fmt, &spec)) != NULL) {
+		if ((pos + (spec.num_stars * sizeof(i64)) + ARG_SIZE_MAX) >
+		    IRC_LOG_BIN_PAYLOAD_SIZE_MAX) {
+			break;
+		}
+
+		for (uint i = 0; i < spec.num_stars; ++i) {
+			const i64 val = va_arg(*args, int);
+
+			memcpy(&dst[pos], &val, sizeof(val));
+			pos += sizeof(val);
+		}
+
+		switch (spec.arg) {
+		case IRC_LOG_BIN_ARG_INT: {
+			const i64 val = arg_int(spec.width, args);
+
+			memcpy(&dst[pos], &val, sizeof(val));
+			pos += sizeof(val);
+			break;
+		}
+		case IRC_LOG_BIN_ARG_UINT: {
+			const u64 val = arg_uint(spec.width, args);
+
+			memcpy(&dst[pos], &val, sizeof(val));
+			pos += sizeof(val);
+			break;
+		}
+		case IRC_LOG_BIN_ARG_DBL: {
+			const double val = va_arg(*args, double);
+
+			memcpy(&dst[pos], &val, sizeof(val));
+			pos += sizeof(val);
+			break;
+		}
+		case IRC_LOG_BIN_ARG_PTR: {
+			const u64 val = (u64)(uintptr_t)va_arg(*args, void *);
+
+			memcpy(&dst[pos], &val, sizeof(val));
+			pos += sizeof(val);
+			break;
+		}
+		case IRC_LOG_BIN_ARG_STR: {
+			const char *str = va_arg(*args, const char *);
+
+			if (!str) {
+				str = "(null)";
+			}
+
+			const u32 len =
+				(u32)strnlen(str, IRC_LOG_BIN_STR_LEN_MAX);
+
+			memcpy(&dst[pos], &len, sizeof(len));
+			memcpy(&dst[pos + sizeof(len)], str, len);
+			pos += sizeof(len) + len;
+			break;
+		}
+		case IRC_LOG_BIN_ARG_NONE:
+		default:
+			break;
+		}
+	}
+	return pos;
+}
+
+/// @brief A read cursor over the packed arguments of a record.
+struct payload {
+	const u8 *data;
+	size_t size;
+	size_t pos;
+};
+
+static bool payload_u64(struct payload *const p, u64 *const val)
+{
+	if ((p->pos + sizeof(*val)) > p->size) {
+		return false;
+	}
+	memcpy(val, &p->data[p->pos], sizeof(*val));
+	p->pos += sizeof(*val);
+
+	return true;
+}
+
+/// @brief Renders a single conversion specification with its packed argument.
+static void spec_render(FILE *const out,
+			const struct irc_log_bin_spec *const spec,
+			struct payload *const p)
+{
+	// The specification is rebuilt with any "*" replaced by the packed
+	// value, and the length modifier replaced by one matching the type the
+	// argument was widened to.
+	char fmt[64];
+	size_t len = 0;
+
+	const char conv = spec->start[spec->len - 1];
+
+	for (size_t i = 0; i < (spec->len - 1); ++i) {
+		const char c = spec->start[i];
+
+		if (c == '*') {
+			u64 val = 0;
+			char num[16];
+
+			payload_u64(p, &val);
+
+			const int num_len =
+				snprintf(num, sizeof(num), "%d", (int)val);
+
+			// Room is kept for the conversion; see below.
+			for (int j = 0;
+			     (j < num_len) && (len < (sizeof(fmt) - 3)); ++j) {
+				fmt[len++] = num[j];
+			}
+		} else if (!strchr("hlzjtL", c) && (len < (sizeof(fmt) - 3))) {
+			fmt[len++] = c;
+		}
+	}
+
+	if ((spec->arg == IRC_LOG_BIN_ARG_INT) ||
+	    (spec->arg == IRC_LOG_BIN_ARG_UINT)) {
+		if (conv != 'c') {
+			fmt[len++] = 'j';
+		}
+	}
+	fmt[len++] = conv;
+	fmt[len] = '\0';
+
+	u64 val = 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+	switch (spec->arg) {
+	case IRC_LOG_BIN_ARG_INT:
+		if (!payload_u64(p, &val)) {
+			fputs("<?>", out);
+		} else if (conv == 'c') {
+			fprintf(out, fmt, (int)val);
+		} else {
+			fprintf(out, fmt, (intmax_t)val);
+		}
+		break;
+	case IRC_LOG_BIN_ARG_UINT:
+		if (payload_u64(p, &val)) {
+			fprintf(out, fmt, (uintmax_t)val);
+		} else {
+			fputs("<?>", out);
+		}
+		break;
+	case IRC_LOG_BIN_ARG_DBL:
+		if (payload_u64(p, &val)) {
+			double dbl;
+
+			memcpy(&dbl, &val, sizeof(dbl));
+			fprintf(out, fmt, dbl);
+		} else {
+			fputs("<?>", out);
+		}
+		break;
+	case IRC_LOG_BIN_ARG_PTR:
+		if (payload_u64(p, &val)) {
+			fprintf(out, fmt, (void *)(uintptr_t)val);
+		} else {
+			fputs("<?>", out);
+		}
+		break;
+	case IRC_LOG_BIN_ARG_STR: {
+		u32 str_len;
+
+		if (((p->pos + sizeof(str_len)) > p->size)) {
+			fputs("<?>", out);
+			break;
+		}
+		memcpy(&str_len, &p->data[p->pos], sizeof(str_len));
+		p->pos += sizeof(str_len);
+
+		if ((p->pos + str_len) > p->size) {
+			fputs("<?>", out);
+			break;
+		}
+
+		// Strings are never packed any longer, so the record is
+		// corrupt; the string is skipped rather than copied.
+		if (str_len > IRC_LOG_BIN_STR_LEN_MAX) {
+			fputs("<?>", out);
+			p->pos += str_len;
+			break;
+		}
+
+		char str[IRC_LOG_BIN_STR_LEN_MAX + 1];
+
+		memcpy(str, &p->data[p->pos], str_len);
+		str[str_len] = '\0';
+		p->pos += str_len;
+
+		fprintf(out, fmt, str);
+		break;
+	}
+	case IRC_LOG_BIN_ARG_NONE:
+	default:
+		if (conv == '%') {
+			fputc('%', out);
+		} else {
+			fwrite(spec->start, 1, spec->len, out);
+		}
+		break;
+	}
+
+#pragma GCC diagnostic pop
+}
+
+void irc_log_bin_render(FILE *const out, const char *const fmt,
+			const u8 *const payload, const size_t size)
+{
+	struct payload p = { .data = payload, .size = size };
+
+	const char *pos = fmt;
+	const char *next;
+	struct irc_log_bin_spec spec;
+
+	while ((next = irc_log_bin_fmt_next(pos, &spec)) != NULL) {
+		fwrite(pos, 1, (size_t)(spec.start - pos), out);
+		spec_render(out, &spec, &p);
+		pos = next;
+	}
+	fputs(pos, out);
+}
+
+/// @brief Writes the file header and call site table to the start of a newly
+/// mapped log file.
+///
+/// @returns `false` if the table does not fit in the file, or `true`
+/// otherwise.
+static bool hdr_write(struct irc_log_bin *const bin)
+{
+	size_t num_sites;
+	const struct irc_log_site *sites = irc_log_sites(&num_sites);
+
+	struct irc_log_bin_hdr hdr = { .magic = IRC_LOG_BIN_MAGIC,
+				       .version = IRC_LOG_BIN_VERSION,
+				       .num_sites = (u32)num_sites };
+
+	size_t pos = sizeof(hdr);
+
+	for (size_t i = 0; i < num_sites; ++i) {
+		const struct irc_log_bin_site ent = {
+			.line = sites[i].line,
+			.lvl = sites[i].lvl,
+			.file_len = (u32)strlen(sites[i].file),
+			.fmt_len = (u32)strlen(sites[i].fmt)
+		};
+
+		const size_t ent_size = sizeof(ent) + ent.file_len + ent.fmt_len;
+
+		if ((pos + ent_size + REC_SIZE_MAX) > bin->size_max) {
+			return false;
+		}
+
+		memcpy(&bin->map[pos], &ent, sizeof(ent));
+		pos += sizeof(ent);
+
+		memcpy(&bin->map[pos], sites[i].file, ent.file_len);
+		pos += ent.file_len;
+
+		memcpy(&bin->map[pos], sites[i].fmt, ent.fmt_len);
+		pos += ent.fmt_len;
+	}
+
+	hdr.site_tbl_size = pos - sizeof(hdr);
+	memcpy(bin->map, &hdr, sizeof(hdr));
+
+	bin->pos = pos;
+	return true;
+}
+
+static void file_unmap(struct irc_log_bin *const bin)
+{
+	if (!bin->map) {
+		return;
+	}
+
+	munmap(bin->map, bin->size_max);
+	bin->map = NULL;
+
+	// Drop the unused tail so rotated files only take up the space they
+	// need.
+	(void)ftruncate(bin->fd, (off_t)bin->pos);
+	close(bin->fd);
+	bin->fd = -1;
+}
+
+static bool file_map(struct irc_log_bin *const bin)
+{
+	bin->fd = open(bin->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+
+	if (IRC_UNLIKELY(bin->fd < 0)) {
+		return false;
+	}
+
+	if (IRC_UNLIKELY(ftruncate(bin->fd, (off_t)bin->size_max) < 0)) {
+		close(bin->fd);
+		bin->fd = -1;
+		return false;
+	}
+
+	void *map = mmap(NULL, bin->size_max, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, bin->fd, 0);
+
+	if (IRC_UNLIKELY(map == MAP_FAILED)) {
+		close(bin->fd);
+		bin->fd = -1;
+		return false;
+	}
+	bin->map = map;
+
+	if (IRC_UNLIKELY(!hdr_write(bin))) {
+		bin->pos = 0;
+		file_unmap(bin);
+		return false;
+	}
+	return true;
+}
+
+/// @brief Shifts the rotated files by one, and moves the active file to the
+/// `.1` slot.
+static void files_rotate(const struct irc_log_bin *const bin)
+{
+	char from[IRC_LOG_BIN_PATH_LEN_MAX + 16];
+	char to[IRC_LOG_BIN_PATH_LEN_MAX + 16];
+
+	if (!bin->files_max) {
+		unlink(bin->path);
+		return;
+	}
+
+	for (uint i = bin->files_max; i > 1; --i) {
+		snprintf(from, sizeof(from), "%s.%u", bin->path, i - 1);
+		snprintf(to, sizeof(to), "%s.%u", bin->path, i);
+		rename(from, to);
+	}
+	snprintf(to, sizeof(to), "%s.1", bin->path);
+	rename(bin->path, to);
+}
+
+bool irc_log_bin_open(struct irc_log_bin *const bin, const char *const path,
+		      const size_t size_max, const uint files_max)
+{
+	if (IRC_UNLIKELY(strlen(path) > IRC_LOG_BIN_PATH_LEN_MAX)) {
+		return false;
+	}
+
+	*bin = (struct irc_log_bin){ .size_max = size_max,
+				     .files_max = files_max,
+				     .fd = -1 };
+	strcpy(bin->path, path);
+
+	if (access(bin->path, F_OK) == 0) {
+		files_rotate(bin);
+	}
+	return file_map(bin);
+}
+
+void irc_log_bin_close(struct irc_log_bin *const bin)
+{
+	file_unmap(bin);
+}
+
+/// @brief Maps the active file, or backs off for a while if that fails.
+static bool file_remap(struct irc_log_bin *const bin)
+{
+	const u64 now = irc_clock_mono_ns();
+
+	if (now < bin->retry_at) {
+		return false;
+	}
+
+	if (IRC_UNLIKELY(!file_map(bin))) {
+		bin->pos = 0;
+		bin->retry_at = now + MAP_RETRY_NS;
+		return false;
+	}
+	return true;
+}
+
+void irc_log_bin_write(struct irc_log_bin *const bin,
+		       const struct irc_log_site *const site, va_list args)
+{
+	if (IRC_UNLIKELY(!bin->map)) {
+		// Mapping the file failed; there is nowhere to write to until
+		// it is retried. The file has been rotated out of the way
+		// already, and is not rotated again, which would only throw
+		// away the oldest file for every message meanwhile.
+		if (!file_remap(bin)) {
+			return;
+		}
+	} else if (IRC_UNLIKELY((bin->pos + REC_SIZE_MAX) > bin->size_max)) {
+		file_unmap(bin);
+		files_rotate(bin);
+
+		if (!file_remap(bin)) {
+			return;
+		}
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	va_list args_copy;
+	va_copy(args_copy, args);
+
+	const size_t payload_size =
+		args_pack(&bin->map[bin->pos + sizeof(struct irc_log_bin_rec)],
+			  site->fmt, &args_copy);
+
+	va_end(args_copy);
+
+	const struct irc_log_bin_rec rec = {
+		.size = (u32)(sizeof(rec) + payload_size),
+		.site_id = irc_log_site_id(site),
+		.ts = ((u64)ts.tv_sec * 1000000000) + (u64)ts.tv_nsec
+	};
+
+	memcpy(&bin->map[bin->pos], &rec, sizeof(rec));
+	bin->pos += rec.size;
+}
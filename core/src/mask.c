@@ -0,0 +1,625 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/casemap.h"
+#include "core/compiler.h"
+#include "core/mask.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The number of entries a set starts out with.
+#define ENTRIES_CAPACITY_MIN    (4)
+
+/// @brief The number of bits of the bloom filter.
+#define BLOOM_BITS              (IRC_MASK_BLOOM_WORDS * 64)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct trie_edge {
+	struct irc_mask_trie *node;
+	u8 label;
+};
+
+struct irc_mask_trie {
+	/// @brief The children of the node, by the next character of the key.
+	struct trie_edge *edges;
+	u32 num_edges;
+
+	/// @brief The masks whose key ends at this node.
+	struct irc_mask_entry *entries;
+};
+
+#pragma GCC diagnostic pop
+
+/// @brief Copies a part of a mask, which must not be longer than a maximum;
+/// an empty part stands for `*`.
+static bool part_copy(char *const out, const char *const part,
+		      const size_t len, const size_t len_max)
+{
+	if (!len) {
+		strcpy(out, "*");
+		return true;
+	}
+
+	if (len > len_max) {
+		return false;
+	}
+	memcpy(out, part, len);
+	out[len] = '\0';
+	return true;
+}
+
+bool irc_mask_normalize(const char *const mask, char *const out)
+{
+	if ((mask[0] == '\0') || strpbrk(mask, " ,")) {
+		return false;
+	}
+
+	const char *bang = strchr(mask, '!');
+	const char *at = strchr(bang ? bang : mask, '@');
+
+	const char *nick = mask;
+	const char *user = "";
+	const char *host = "";
+
+	size_t nick_len = strlen(mask);
+	size_t user_len = 0;
+	size_t host_len = 0;
+
+	if (!bang && !at && strpbrk(mask, ".:")) {
+		host = mask;
+		host_len = nick_len;
+		nick_len = 0;
+	} else {
+		if (at) {
+			host = at + 1;
+			host_len = strlen(host);
+			nick_len = (size_t)(at - mask);
+		}
+
+		if (bang) {
+			user = bang + 1;
+			user_len = nick_len - (size_t)(user - mask);
+			nick_len = (size_t)(bang - mask);
+		} else if (at) {
+			// "user@host"
+			user = mask;
+			user_len = nick_len;
+			nick_len = 0;
+		}
+	}
+
+	char nick_part[IRC_USER_NICK_LEN_MAX + 1];
+	char user_part[IRC_USER_NAME_LEN_MAX + 1];
+	char host_part[IRC_USER_HOST_LEN_MAX + 1];
+
+	if (!part_copy(nick_part, nick, nick_len, IRC_USER_NICK_LEN_MAX) ||
+	    !part_copy(user_part, user, user_len, IRC_USER_NAME_LEN_MAX) ||
+	    !part_copy(host_part, host, host_len, IRC_USER_HOST_LEN_MAX)) {
+		return false;
+	}
+
+	strcpy(out, nick_part);
+	strcat(out, "!");
+	strcat(out, user_part);
+	strcat(out, "@");
+	strcat(out, host_part);
+	return true;
+}
+
+/// @brief Returns `true` if a part of a user matches the same part of a mask.
+static bool part_match(const char *const pat, const char *const str)
+{
+	if ((pat[0] == '*') && (pat[1] == '\0')) {
+		return true;
+	}
+	return irc_casemap_match(pat, str);
+}
+
+/// @brief Returns `true` if the parts of a mask other than the one it is filed
+/// by match a user.
+static bool entry_match_rest(const struct irc_mask_entry *const entry,
+			     const struct irc_mask_subject *const subject)
+{
+	switch (entry->kind) {
+	case IRC_MASK_HOST:
+	case IRC_MASK_HOST_SUFFIX:
+	case IRC_MASK_HOST_PREFIX:
+		return part_match(entry->nick, subject->nick) &&
+		       part_match(entry->user, subject->user);
+	case IRC_MASK_NICK:
+		return part_match(entry->user, subject->user) &&
+		       part_match(entry->host, subject->host);
+	case IRC_MASK_OTHER:
+	default:
+		return part_match(entry->nick, subject->nick) &&
+		       part_match(entry->user, subject->user) &&
+		       part_match(entry->host, subject->host);
+	}
+}
+
+/// @brief Hashes a name under the case mapping for the bloom filter. FNV-1a
+/// is good enough here, and much cheaper than the hash of the tables.
+IRC_ATTRIB_PURE
+static u32 bloom_hash(const char *str)
+{
+	u32 hash = 2166136261U;
+
+	for (; *str != '\0'; ++str) {
+		hash ^= irc_casemap_lower_tbl[(u8)*str];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void bloom_add(struct irc_mask_set *const set, const char *const key)
+{
+	const u32 hash = bloom_hash(key);
+
+	for (u32 i = 0; i < 2; ++i) {
+		const u32 bit = (hash >> (i * 16)) % BLOOM_BITS;
+		set->bloom[bit / 64] |= UINT64_C(1) << (bit % 64);
+	}
+}
+
+IRC_ATTRIB_PURE
+static bool bloom_test(const struct irc_mask_set *const set,
+		       const char *const key)
+{
+	const u32 hash = bloom_hash(key);
+
+	for (u32 i = 0; i < 2; ++i) {
+		const u32 bit = (hash >> (i * 16)) % BLOOM_BITS;
+
+		if (!(set->bloom[bit / 64] & (UINT64_C(1) << (bit % 64)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// @brief Returns the key a mask is filed under in the tries: the literal
+/// part of its host, reversed for suffixes, under the case mapping.
+static size_t trie_key(const struct irc_mask_entry *const entry,
+		       char *const key)
+{
+	const char *host = entry->host;
+	size_t len = strlen(host);
+
+	if (entry->kind == IRC_MASK_HOST_SUFFIX) {
+		host++;
+		len--;
+
+		for (size_t i = 0; i < len; ++i) {
+			key[i] = irc_casemap_lower(host[len - 1 - i]);
+		}
+	} else {
+		len--;
+
+		for (size_t i = 0; i < len; ++i) {
+			key[i] = irc_casemap_lower(host[i]);
+		}
+	}
+	return len;
+}
+
+IRC_ATTRIB_PURE
+static struct irc_mask_trie *trie_child(const struct irc_mask_trie *const node,
+					const char c)
+{
+	for (u32 i = 0; i < node->num_edges; ++i) {
+		if (node->edges[i].label == (u8)c) {
+			return node->edges[i].node;
+		}
+	}
+	return NULL;
+}
+
+static void trie_insert(struct irc_mask_trie **const root,
+			struct irc_mask_entry *const entry)
+{
+	char key[IRC_USER_HOST_LEN_MAX];
+	const size_t len = trie_key(entry, key);
+
+	if (!*root) {
+		*root = irc_calloc(1, sizeof(**root));
+	}
+
+	struct irc_mask_trie *node = *root;
+
+	for (size_t i = 0; i < len; ++i) {
+		struct irc_mask_trie *child = trie_child(node, key[i]);
+
+		if (!child) {
+			child = irc_calloc(1, sizeof(*child));
+
+			node->edges = irc_realloc(node->edges,
+						  (node->num_edges + 1) *
+							  sizeof(*node->edges));
+			node->edges[node->num_edges++] = (struct trie_edge){
+				.node = child, .label = (u8)key[i]
+			};
+		}
+		node = child;
+	}
+
+	entry->next = node->entries;
+	node->entries = entry;
+}
+
+/// @brief Unlinks an entry from a chain of entries.
+static void chain_remove(struct irc_mask_entry **link,
+			 const struct irc_mask_entry *const entry)
+{
+	while (*link != entry) {
+		link = &(*link)->next;
+	}
+	*link = entry->next;
+}
+
+/// @brief Removes an entry from the subtrie under a node, freeing the nodes
+/// left empty.
+///
+/// @returns `true` if the node itself is left empty, and was freed.
+static bool trie_remove(struct irc_mask_trie *const node, const char *const key,
+			const size_t len,
+			const struct irc_mask_entry *const entry)
+{
+	if (!len) {
+		chain_remove(&node->entries, entry);
+	} else {
+		for (u32 i = 0; i < node->num_edges; ++i) {
+			if (node->edges[i].label != (u8)key[0]) {
+				continue;
+			}
+
+			if (trie_remove(node->edges[i].node, &key[1], len - 1,
+					entry)) {
+				node->edges[i] = node->edges[--node->num_edges];
+			}
+			break;
+		}
+	}
+
+	if (node->entries || node->num_edges) {
+		return false;
+	}
+	free(node->edges);
+	free(node);
+	return true;
+}
+
+static void trie_free(struct irc_mask_trie *const node)
+{
+	if (!node) {
+		return;
+	}
+
+	for (u32 i = 0; i < node->num_edges; ++i) {
+		trie_free(node->edges[i].node);
+	}
+	free(node->edges);
+	free(node);
+}
+
+/// @brief Walks a host down a trie, matching the masks of every node reached.
+IRC_ATTRIB_PURE
+static bool trie_match(const struct irc_mask_trie *node,
+		       const struct irc_mask_subject *const subject,
+		       const bool reverse)
+{
+	const char *host = subject->host;
+	const size_t len = strlen(host);
+
+	for (size_t i = 0; node; ++i) {
+		for (const struct irc_mask_entry *entry = node->entries; entry;
+		     entry = entry->next) {
+			if (entry_match_rest(entry, subject)) {
+				return true;
+			}
+		}
+
+		if (i == len) {
+			break;
+		}
+		node = trie_child(node, irc_casemap_lower(
+						reverse ? host[len - 1 - i]
+							: host[i]));
+	}
+	return false;
+}
+
+/// @brief Returns how a mask is filed, by the form of its parts.
+static enum irc_mask_kind entry_kind(const struct irc_mask_entry *const entry)
+{
+	const char *host = entry->host;
+	const size_t host_len = strlen(host);
+	const size_t host_lit_len = strcspn(host, "*?");
+
+	if (host_lit_len == host_len) {
+		return IRC_MASK_HOST;
+	}
+
+	if ((host_len > 1) && (host[0] == '*') &&
+	    (strcspn(&host[1], "*?") == (host_len - 1))) {
+		return IRC_MASK_HOST_SUFFIX;
+	}
+
+	if ((host_lit_len == (host_len - 1)) && (host_lit_len > 0) &&
+	    (host[host_lit_len] == '*')) {
+		return IRC_MASK_HOST_PREFIX;
+	}
+
+	if (entry->nick[strcspn(entry->nick, "*?")] == '\0') {
+		return IRC_MASK_NICK;
+	}
+	return IRC_MASK_OTHER;
+}
+
+/// @brief Files an entry under a key of a hash table, at the head of the
+/// chain of the entries filed under the same key.
+static void hash_insert(struct irc_ht *const ht, char *const key,
+			struct irc_mask_entry *const entry)
+{
+	entry->next = irc_ht_del(ht, key);
+	irc_ht_add(ht, key, entry);
+}
+
+static void hash_remove(struct irc_ht *const ht, const char *const key,
+			const struct irc_mask_entry *const entry)
+{
+	struct irc_mask_entry *head = irc_ht_get(ht, key);
+
+	if (head != entry) {
+		chain_remove(&head->next, entry);
+		return;
+	}
+
+	// The table is keyed by a string of the head entry, which is about to
+	// go away.
+	irc_ht_del(ht, key);
+
+	if (entry->next) {
+		irc_ht_add(ht,
+			   (entry->kind == IRC_MASK_HOST) ? entry->next->host
+							  : entry->next->nick,
+			   entry->next);
+	}
+}
+
+struct irc_mask_set *irc_mask_set_new(void)
+{
+	static const struct irc_ht_conf ht_conf = {
+		// clang-format off
+
+		.initial_capacity	= 8,
+		.load_fact_max		= 75,
+		.hash			= &irc_casemap_ht_hash,
+		.eq			= &irc_casemap_ht_eq
+
+		// clang-format on
+	};
+
+	struct irc_mask_set *set = irc_calloc(1, sizeof(*set));
+
+	irc_ht_init(&set->by_text, &ht_conf);
+	irc_ht_init(&set->hosts, &ht_conf);
+	irc_ht_init(&set->nicks, &ht_conf);
+
+	return set;
+}
+
+void irc_mask_set_free(struct irc_mask_set *const set)
+{
+	for (u32 i = 0; i < set->num_entries; ++i) {
+		free(set->entries[i]);
+	}
+	free(set->entries);
+
+	irc_ht_destroy(&set->by_text);
+	irc_ht_destroy(&set->hosts);
+	irc_ht_destroy(&set->nicks);
+
+	trie_free(set->suffixes);
+	trie_free(set->prefixes);
+
+	free(set);
+}
+
+const struct irc_mask_entry *irc_mask_set_add(struct irc_mask_set *const set,
+					      const char *const mask,
+					      const char *const setter,
+					      const u64 set_at)
+{
+	if (irc_ht_get(&set->by_text, mask)) {
+		return NULL;
+	}
+
+	struct irc_mask_entry *entry = irc_calloc(1, sizeof(*entry));
+
+	strcpy(entry->text, mask);
+	strcpy(entry->setter, setter);
+	entry->set_at = set_at;
+
+	// The mask is normalized, so it has both separators, and its parts fit.
+	const char *bang = strchr(mask, '!');
+	const char *at = strchr(bang, '@');
+
+	memcpy(entry->nick, mask, (size_t)(bang - mask));
+	memcpy(entry->user, bang + 1, (size_t)(at - bang - 1));
+	strcpy(entry->host, at + 1);
+
+	entry->kind = entry_kind(entry);
+
+	switch (entry->kind) {
+	case IRC_MASK_HOST:
+		hash_insert(&set->hosts, entry->host, entry);
+		bloom_add(set, entry->host);
+		set->num_hashed++;
+		break;
+	case IRC_MASK_NICK:
+		hash_insert(&set->nicks, entry->nick, entry);
+		bloom_add(set, entry->nick);
+		set->num_hashed++;
+		break;
+	case IRC_MASK_HOST_SUFFIX:
+		trie_insert(&set->suffixes, entry);
+		break;
+	case IRC_MASK_HOST_PREFIX:
+		trie_insert(&set->prefixes, entry);
+		break;
+	case IRC_MASK_OTHER:
+	default:
+		entry->next = set->others;
+		set->others = entry;
+		break;
+	}
+
+	if (set->num_entries == set->capacity) {
+		set->capacity = set->capacity ? (set->capacity * 2)
+					      : ENTRIES_CAPACITY_MIN;
+
+		set->entries = irc_realloc(
+			set->entries, set->capacity * sizeof(*set->entries));
+	}
+	entry->idx = set->num_entries;
+	set->entries[set->num_entries++] = entry;
+
+	irc_ht_add(&set->by_text, entry->text, entry);
+	return entry;
+}
+
+bool irc_mask_set_del(struct irc_mask_set *const set, const char *const mask)
+{
+	struct irc_mask_entry *entry = irc_ht_del(&set->by_text, mask);
+
+	if (!entry) {
+		return false;
+	}
+
+	char key[IRC_USER_HOST_LEN_MAX];
+	size_t len;
+
+	switch (entry->kind) {
+	case IRC_MASK_HOST:
+		hash_remove(&set->hosts, entry->host, entry);
+		set->num_hashed--;
+		break;
+	case IRC_MASK_NICK:
+		hash_remove(&set->nicks, entry->nick, entry);
+		set->num_hashed--;
+		break;
+	case IRC_MASK_HOST_SUFFIX:
+		len = trie_key(entry, key);
+
+		if (trie_remove(set->suffixes, key, len, entry)) {
+			set->suffixes = NULL;
+		}
+		break;
+	case IRC_MASK_HOST_PREFIX:
+		len = trie_key(entry, key);
+
+		if (trie_remove(set->prefixes, key, len, entry)) {
+			set->prefixes = NULL;
+		}
+		break;
+	case IRC_MASK_OTHER:
+	default:
+		chain_remove(&set->others, entry);
+		break;
+	}
+
+	struct irc_mask_entry *moved = set->entries[--set->num_entries];
+
+	set->entries[entry->idx] = moved;
+	moved->idx = entry->idx;
+
+	// Bits can not be taken out of a bloom filter; it is built again from
+	// the masks that are left instead.
+	if (entry->kind == IRC_MASK_HOST || entry->kind == IRC_MASK_NICK) {
+		memset(set->bloom, 0, sizeof(set->bloom));
+
+		for (u32 i = 0; i < set->num_entries; ++i) {
+			const struct irc_mask_entry *e = set->entries[i];
+
+			if (e->kind == IRC_MASK_HOST) {
+				bloom_add(set, e->host);
+			} else if (e->kind == IRC_MASK_NICK) {
+				bloom_add(set, e->nick);
+			}
+		}
+	}
+
+	free(entry);
+	return true;
+}
+
+/// @brief Matches the masks filed under a key of a hash table.
+static bool hash_match(struct irc_ht *const ht, const char *const key,
+		       const struct irc_mask_subject *const subject)
+{
+	for (const struct irc_mask_entry *entry = irc_ht_get(ht, key); entry;
+	     entry = entry->next) {
+		if (entry_match_rest(entry, subject)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool irc_mask_set_match(struct irc_mask_set *const set,
+			const struct irc_mask_subject *const subject)
+{
+	if (set->num_hashed) {
+		if (bloom_test(set, subject->host) &&
+		    hash_match(&set->hosts, subject->host, subject)) {
+			return true;
+		}
+
+		if (bloom_test(set, subject->nick) &&
+		    hash_match(&set->nicks, subject->nick, subject)) {
+			return true;
+		}
+	}
+
+	if (trie_match(set->suffixes, subject, true) ||
+	    trie_match(set->prefixes, subject, false)) {
+		return true;
+	}
+
+	for (const struct irc_mask_entry *entry = set->others; entry;
+	     entry = entry->next) {
+		if (entry_match_rest(entry, subject)) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "core/metrics.h"
+
+// clang-format off
+
+/// @brief The prefix of every metric name in the Prometheus output.
+#define PROM_PREFIX     "maven_ircd_"
+
+/// @brief The maximum length of a single rendered line.
+#define LINE_LEN_MAX    (256)
+
+// clang-format on
+
+struct metric_desc {
+	const char *name;
+	const char *help;
+};
+
+static const struct metric_desc counter_desc[IRC_METRIC_COUNTER_NUM] = {
+	// clang-format off
+
+	[IRC_METRIC_BYTES_IN]		= { "bytes_in_total",
+					    "Bytes read from clients" },
+	[IRC_METRIC_BYTES_OUT]		= { "bytes_out_total",
+					    "Bytes written to clients" },
+	[IRC_METRIC_LINES_IN]		= { "lines_in_total",
+					    "Lines received from clients" },
+	[IRC_METRIC_LINES_OUT]		= { "lines_out_total",
+					    "Lines sent to clients" },
+	[IRC_METRIC_ACCEPTS]		= { "accepts_total",
+					    "Client connections accepted" },
+	[IRC_METRIC_PARSE_FAILURES]	= { "parse_failures_total",
+					    "Lines that could not be parsed" },
+	[IRC_METRIC_FANOUT_DEFERRED]	= { "fanout_deferred_total",
+					    "Broadcasts deferred to later "
+					    "loop iterations" },
+	[IRC_METRIC_ACCEPTS_REFUSED]	= { "accepts_refused_total",
+					    "Client connections refused by "
+					    "D-lines or subnet limits" },
+	[IRC_METRIC_MSGS_FILTERED]	= { "msgs_filtered_total",
+					    "Messages dropped by the content "
+					    "filter" }
+
+	// clang-format on
+};
+
+static const struct metric_desc gauge_desc[IRC_METRIC_GAUGE_NUM] = {
+	// clang-format off
+
+	[IRC_METRIC_CLIENTS]		= { "clients",
+					    "Client connections open" },
+	[IRC_METRIC_USERS_HT_ENTRIES]	= { "users_table_entries",
+					    "Entries in the users table" },
+	[IRC_METRIC_USERS_HT_LOAD]	= { "users_table_load_permille",
+					    "Load of the users table" },
+	[IRC_METRIC_FANOUT_BACKLOG]	= { "fanout_backlog",
+					    "Deferred broadcasts pending" },
+	[IRC_METRIC_FANOUT_BACKLOG_RCPTS] = { "fanout_backlog_recipients",
+					      "Recipients deferred broadcasts "
+					      "are pending for" },
+	[IRC_METRIC_ARENA_HIGH_WATER]	= { "arena_high_water_bytes",
+					    "Most bytes of temporaries held in "
+					    "one loop iteration" },
+	[IRC_METRIC_ARENA_CAPACITY]	= { "arena_capacity_bytes",
+					    "Memory held for loop iteration "
+					    "temporaries" }
+
+	// clang-format on
+};
+
+_Thread_local uint irc_metrics_shard_idx;
+
+void irc_metrics_thread_init(void)
+{
+	// Shard 0 belongs to the first thread to record.
+	static uint next_idx = 1;
+
+	const uint idx = __atomic_fetch_add(&next_idx, 1, __ATOMIC_RELAXED);
+
+	irc_metrics_shard_idx = idx % IRC_METRICS_SHARD_NUM_MAX;
+}
+
+static void hist_merge(struct irc_metrics_hist *const dst,
+		       const struct irc_metrics_hist *const src)
+{
+	for (size_t i = 0; i < IRC_METRICS_HIST_BUCKET_NUM; ++i) {
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->count += src->count;
+	dst->sum += src->sum;
+}
+
+void irc_metrics_read(const struct irc_metrics *const m,
+		      struct irc_metrics_snapshot *const snap)
+{
+	memset(snap, 0, sizeof(*snap));
+
+	for (size_t s = 0; s < IRC_METRICS_SHARD_NUM_MAX; ++s) {
+		const struct irc_metrics_shard *shard = &m->shards[s];
+
+		for (size_t i = 0; i < IRC_METRIC_COUNTER_NUM; ++i) {
+			snap->counters[i] += shard->counters[i];
+		}
+
+		for (size_t i = 0; i < IRC_METRIC_GAUGE_NUM; ++i) {
+			snap->gauges[i] += shard->gauges[i];
+		}
+
+		for (size_t i = 0; i < IRC_METRIC_HIST_NUM; ++i) {
+			hist_merge(&snap->hists[i], &shard->hists[i]);
+		}
+	}
+
+	if (m->collect) {
+		m->collect(m->udata, snap);
+	}
+}
+
+/// @brief Returns the name and label of a histogram.
+static const char *hist_name(const uint id, const char **const label_key,
+			     const char **const label_val)
+{
+	if (id == IRC_METRIC_HIST_LOOP_BUSY) {
+		*label_key = NULL;
+		*label_val = NULL;
+		return "loop_busy_ns";
+	}
+
+	if (id >= IRC_METRIC_HIST_LOOP_PHASE) {
+		*label_key = "phase";
+		*label_val = irc_prof_phase_name(
+			(enum irc_prof_phase)(id - IRC_METRIC_HIST_LOOP_PHASE));
+		return "loop_phase_ns";
+	}
+
+	if (id >= IRC_METRIC_HIST_EVENT_DISPATCH) {
+		*label_key = "event";
+		*label_val = irc_event_type_name(
+			(enum irc_event_type)(id - IRC_METRIC_HIST_EVENT_DISPATCH));
+		return "event_dispatch_ns";
+	}
+
+	*label_key = NULL;
+	*label_val = NULL;
+	return "poll_batch_size";
+}
+
+IRC_ATTRIB_FMT(printf, 3, 4)
+static void emitf(const irc_metrics_emit_cb emit, void *const udata,
+		  const char *const fmt, ...)
+{
+	char line[LINE_LEN_MAX];
+
+	va_list args;
+	va_start(args, fmt);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+	int len = vsnprintf(line, sizeof(line), fmt, args);
+#pragma GCC diagnostic pop
+
+	va_end(args);
+
+	if (len < 0) {
+		return;
+	}
+
+	if ((size_t)len >= sizeof(line)) {
+		len = sizeof(line) - 1;
+	}
+	emit(udata, line, (size_t)len);
+}
+
+/// @brief Returns the inclusive upper bound of a histogram bucket.
+static u64 bucket_bound(const uint bucket)
+{
+	return bucket ? ((UINT64_C(1) << bucket) - 1) : 0;
+}
+
+/// @brief Approximates a quantile of a histogram by the upper bound of the
+/// bucket it falls into.
+static u64 hist_quantile(const struct irc_metrics_hist *const hist,
+			 const uint permille)
+{
+	const u64 rank = ((hist->count * permille) + 999) / 1000;
+	u64 seen = 0;
+
+	for (uint i = 0; i < IRC_METRICS_HIST_BUCKET_NUM; ++i) {
+		seen += hist->buckets[i];
+
+		if (seen >= rank) {
+			return bucket_bound(i);
+		}
+	}
+	return bucket_bound(IRC_METRICS_HIST_BUCKET_NUM - 1);
+}
+
+static void prom_hist(const struct irc_metrics_snapshot *const snap,
+		      const uint id, const irc_metrics_emit_cb emit,
+		      void *const udata)
+{
+	const struct irc_metrics_hist *hist = &snap->hists[id];
+	const char *label_key;
+	const char *label_val;
+	const char *name = hist_name(id, &label_key, &label_val);
+
+	char labels[64] = "";
+
+	if (label_key) {
+		snprintf(labels, sizeof(labels), "%s=\"%s\",", label_key,
+			 label_val);
+	}
+
+	// Buckets past the last non-empty one add nothing over "+Inf".
+	uint last = 0;
+
+	for (uint i = 0; i < (IRC_METRICS_HIST_BUCKET_NUM - 1); ++i) {
+		if (hist->buckets[i]) {
+			last = i;
+		}
+	}
+
+	u64 cumulative = 0;
+
+	for (uint i = 0; i <= last; ++i) {
+		cumulative += hist->buckets[i];
+
+		emitf(emit, udata,
+		      PROM_PREFIX "%s_bucket{%sle=\"%" PRIu64 "\"} %" PRIu64,
+		      name, labels, bucket_bound(i), cumulative);
+	}
+
+	// Drop the trailing comma for the label-only lines.
+	const size_t labels_len = strlen(labels);
+
+	if (labels_len) {
+		labels[labels_len - 1] = '\0';
+	}
+
+	emitf(emit, udata, PROM_PREFIX "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64,
+	      name, labels, labels_len ? "," : "", hist->count);
+
+	emitf(emit, udata, PROM_PREFIX "%s_sum%s%s%s %" PRIu64, name,
+	      labels_len ? "{" : "", labels, labels_len ? "}" : "", hist->sum);
+
+	emitf(emit, udata, PROM_PREFIX "%s_count%s%s%s %" PRIu64, name,
+	      labels_len ? "{" : "", labels, labels_len ? "}" : "",
+	      hist->count);
+}
+
+void irc_metrics_render_prom(const struct irc_metrics_snapshot *const snap,
+			     const irc_metrics_emit_cb emit, void *const udata)
+{
+	for (uint i = 0; i < IRC_METRIC_COUNTER_NUM; ++i) {
+		emitf(emit, udata, "# HELP " PROM_PREFIX "%s %s",
+		      counter_desc[i].name, counter_desc[i].help);
+		emitf(emit, udata, "# TYPE " PROM_PREFIX "%s counter",
+		      counter_desc[i].name);
+		emitf(emit, udata, PROM_PREFIX "%s %" PRIu64,
+		      counter_desc[i].name, snap->counters[i]);
+	}
+
+	for (uint i = 0; i < IRC_METRIC_GAUGE_NUM; ++i) {
+		emitf(emit, udata, "# HELP " PROM_PREFIX "%s %s",
+		      gauge_desc[i].name, gauge_desc[i].help);
+		emitf(emit, udata, "# TYPE " PROM_PREFIX "%s gauge",
+		      gauge_desc[i].name);
+		emitf(emit, udata, PROM_PREFIX "%s %" PRId64,
+		      gauge_desc[i].name, snap->gauges[i]);
+	}
+
+	// Histograms sharing a name must be grouped under a single TYPE line.
+	const char *prev_name = NULL;
+
+	for (uint i = 0; i < IRC_METRIC_HIST_NUM; ++i) {
+		const char *label_key;
+		const char *label_val;
+		const char *name = hist_name(i, &label_key, &label_val);
+
+		if (name != prev_name) {
+			emitf(emit, udata, "# TYPE " PROM_PREFIX "%s histogram",
+			      name);
+			prev_name = name;
+		}
+		prom_hist(snap, i, emit, udata);
+	}
+}
+
+void irc_metrics_render_text(const struct irc_metrics_snapshot *const snap,
+			     const irc_metrics_emit_cb emit, void *const udata)
+{
+	for (uint i = 0; i < IRC_METRIC_COUNTER_NUM; ++i) {
+		emitf(emit, udata, "%s %" PRIu64, counter_desc[i].name,
+		      snap->counters[i]);
+	}
+
+	for (uint i = 0; i < IRC_METRIC_GAUGE_NUM; ++i) {
+		emitf(emit, udata, "%s %" PRId64, gauge_desc[i].name,
+		      snap->gauges[i]);
+	}
+
+	for (uint i = 0; i < IRC_METRIC_HIST_NUM; ++i) {
+		const struct irc_metrics_hist *hist = &snap->hists[i];
+		const char *label_key;
+		const char *label_val;
+		const char *name = hist_name(i, &label_key, &label_val);
+
+		emitf(emit, udata,
+		      "%s%s%s count=%" PRIu64 " mean=%" PRIu64 " p50<=%" PRIu64
+		      " p99<=%" PRIu64 " max<=%" PRIu64,
+		      name, label_val ? ":" : "", label_val ? label_val : "",
+		      hist->count, hist->count ? (hist->sum / hist->count) : 0,
+		      hist_quantile(hist, 500), hist_quantile(hist, 990),
+		      hist_quantile(hist, 1000));
+	}
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/casemap.h"
+#include "core/monitor.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The number of links a user's MONITOR list starts out with.
+#define LINKS_CAPACITY_MIN      (8)
+
+/// @brief The number of watchers an entry starts out with.
+#define WATCHERS_CAPACITY_MIN   (2)
+
+// clang-format on
+
+void irc_monitors_init(struct irc_ht *const monitors)
+{
+	static const struct irc_ht_conf cfg = {
+		// clang-format off
+
+		.initial_capacity	= 256,
+		.load_fact_max		= 75,
+		.hash			= &irc_casemap_ht_hash,
+		.eq			= &irc_casemap_ht_eq
+
+		// clang-format on
+	};
+	irc_ht_init(monitors, &cfg);
+}
+
+/// @brief Removes a link from the watchers of its nickname, freeing the entry
+/// if that was the last one.
+static void watcher_remove(struct irc_ht *const monitors,
+			   const struct irc_monitor_link *const link)
+{
+	struct irc_monitor *target = link->target;
+	struct irc_monitor_link *last = target->watchers[--target->num_watchers];
+
+	target->watchers[link->target_idx] = last;
+	last->target_idx = link->target_idx;
+
+	if (!target->num_watchers) {
+		irc_ht_del(monitors, target->nick);
+		free(target->watchers);
+		free(target);
+	}
+}
+
+/// @brief Points the entries at the links of a user again, after they have
+/// moved.
+static void links_repoint(struct irc_user *const user)
+{
+	struct irc_monitor_link *links = user->monitor.entries;
+
+	for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+		links[i].target->watchers[links[i].target_idx] = &links[i];
+	}
+}
+
+enum irc_monitor_add_result irc_monitor_add(struct irc_ht *const monitors,
+					    struct irc_user *const user,
+					    const char *const nick)
+{
+	struct irc_monitor *target = irc_ht_get(monitors, nick);
+
+	// Lists are short, so they are searched rather than the watchers of a
+	// nickname, which may be many.
+	if (target) {
+		for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+			if (user->monitor.entries[i].target == target) {
+				return IRC_MONITOR_PRESENT;
+			}
+		}
+	}
+
+	if (user->monitor.num_entries >= IRC_MONITOR_NUM_MAX) {
+		return IRC_MONITOR_FULL;
+	}
+
+	if (user->monitor.num_entries == user->monitor.capacity) {
+		u32 capacity = user->monitor.capacity * 2;
+
+		if (capacity < LINKS_CAPACITY_MIN) {
+			capacity = LINKS_CAPACITY_MIN;
+		} else if (capacity > IRC_MONITOR_NUM_MAX) {
+			capacity = IRC_MONITOR_NUM_MAX;
+		}
+
+		user->monitor.entries = irc_realloc(
+			user->monitor.entries,
+			capacity * sizeof(*user->monitor.entries));
+		user->monitor.capacity = capacity;
+
+		links_repoint(user);
+	}
+
+	if (!target) {
+		const size_t len = strlen(nick);
+
+		target = irc_calloc(1, sizeof(*target) + len + 1);
+		memcpy(target->nick, nick, len + 1);
+
+		irc_ht_add(monitors, target->nick, target);
+	}
+
+	if (target->num_watchers == target->capacity) {
+		target->capacity = target->capacity ? (target->capacity * 2) :
+						      WATCHERS_CAPACITY_MIN;
+
+		target->watchers =
+			irc_realloc(target->watchers,
+				    target->capacity * sizeof(*target->watchers));
+	}
+
+	struct irc_monitor_link *link =
+		&user->monitor.entries[user->monitor.num_entries++];
+
+	link->target = target;
+	link->user = user;
+	link->target_idx = target->num_watchers;
+
+	target->watchers[target->num_watchers++] = link;
+
+	return IRC_MONITOR_ADDED;
+}
+
+bool irc_monitor_del(struct irc_ht *const monitors, struct irc_user *const user,
+		     const char *const nick)
+{
+	const struct irc_monitor *target = irc_ht_get(monitors, nick);
+
+	if (!target) {
+		return false;
+	}
+
+	struct irc_monitor_link *links = user->monitor.entries;
+
+	for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+		if (links[i].target != target) {
+			continue;
+		}
+		watcher_remove(monitors, &links[i]);
+
+		const u32 last = --user->monitor.num_entries;
+
+		if (i != last) {
+			links[i] = links[last];
+			links[i].target->watchers[links[i].target_idx] =
+				&links[i];
+		}
+		return true;
+	}
+	return false;
+}
+
+void irc_monitor_clear(struct irc_ht *const monitors,
+		       struct irc_user *const user)
+{
+	for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+		watcher_remove(monitors, &user->monitor.entries[i]);
+	}
+
+	free(user->monitor.entries);
+
+	user->monitor.entries = NULL;
+	user->monitor.num_entries = 0;
+	user->monitor.capacity = 0;
+}
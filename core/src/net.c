@@ -20,33 +20,160 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+// accept4(2) is a GNU extension.
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "core/cidr.h"
 #include "core/compiler.h"
 #include "core/event.h"
 #include "core/log.h"
+#include "core/metrics.h"
 #include "core/net.h"
+#include "core/prof.h"
+#include "core/trace.h"
+#include "core/util.h"
+
+/// @brief The maximum number of accept errors logged per second. A connection
+/// flood can make every accept fail, and logging each one would stall the
+/// event loop.
+#define ACCEPT_ERR_LOG_PER_SEC (10)
+
+/// @brief The size of the buffer data is read into.
+#define READ_BUF_SIZE (4096)
+
+/// @brief Checks if the last failed call only failed because it would have
+/// blocked.
+static bool errno_would_block(void)
+{
+#if EAGAIN == EWOULDBLOCK
+	return errno == EAGAIN;
+#else
+	return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+#endif
+}
 
 void irc_net_read(struct irc_net *const net, const int fd)
 {
-	char buf[512];
+	char buf[READ_BUF_SIZE];
 
-	ssize_t cnt = read(fd, buf, sizeof(buf));
+	for (;;) {
+		const ssize_t cnt = read(fd, buf, sizeof(buf));
 
-	if (cnt < 0) {
-		// error
+		if (IRC_LIKELY(cnt > 0)) {
+			IRC_TRACE(net_read, fd, cnt);
+
+			IRC_METRIC_ADD(net->metrics, IRC_METRIC_BYTES_IN,
+				       (u64)cnt);
+
+			struct irc_event_net_data_recv ev = {
+				.fd = fd, .data = buf, .size = (size_t)cnt
+			};
+
+			irc_event_pub(net->event, IRC_EVENT_TYPE_NET_DATA_RECV,
+				      &ev);
+
+			// A short read means the socket buffer has been
+			// drained, which saves the read(2) call that would
+			// only return EAGAIN.
+			if ((size_t)cnt < sizeof(buf)) {
+				return;
+			}
+			continue;
+		}
+
+		if (cnt < 0) {
+			if (errno_would_block()) {
+				return;
+			}
+
+			if (errno == EINTR) {
+				continue;
+			}
+		}
+
+		// The peer has closed the connection, or it is broken.
+		irc_net_close(net, fd);
+		return;
 	}
+}
+
+ssize_t irc_net_writev(struct irc_net *const net, const int fd,
+		       const struct iovec *const iov, const int iov_cnt)
+{
+	const enum irc_prof_phase prev =
+		irc_prof_enter(net->prof, IRC_PROF_PHASE_FLUSH);
+
+	// writev() can't be told not to raise SIGPIPE, sendmsg() can.
+	const struct msghdr msg = { .msg_iov = (struct iovec *)(uintptr_t)iov,
+				    .msg_iovlen = (size_t)iov_cnt };
 
-	struct irc_event_net_data_recv ev = { .fd = fd,
-					      .data = buf,
-					      .size = (size_t)cnt };
+	ssize_t cnt;
 
-	irc_event_pub(net->event, IRC_EVENT_TYPE_NET_DATA_RECV, &ev);
+	do {
+		cnt = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while ((cnt < 0) && (errno == EINTR));
+
+	irc_prof_leave(net->prof, prev);
+
+	IRC_TRACE(net_send, fd, iov_cnt, cnt);
+
+	if (IRC_UNLIKELY(cnt < 0)) {
+		return errno_would_block() ? IRC_NET_WOULD_BLOCK : -1;
+	}
+
+	IRC_METRIC_ADD(net->metrics, IRC_METRIC_BYTES_OUT, (u64)cnt);
+	return cnt;
+}
+
+/// @brief Stops counting a client connection against its subnet.
+static void subnet_release(struct irc_net *const net, const int fd)
+{
+	if ((size_t)fd >= net->subnets.num_fds) {
+		return;
+	}
+	struct irc_net_subnet *subnet = net->subnets.by_fd[fd];
+
+	if (!subnet) {
+		return;
+	}
+	net->subnets.by_fd[fd] = NULL;
+
+	if (--subnet->num_conns == 0) {
+		irc_ht_del(&net->subnets.by_addr, &subnet->addr);
+		free(subnet);
+	}
+}
+
+void irc_net_close(struct irc_net *const net, const int fd)
+{
+	struct irc_event_net_client_disconn ev = { .fd = fd };
+	irc_event_pub(net->event, IRC_EVENT_TYPE_NET_CLIENT_DISCONN, &ev);
+
+	subnet_release(net, fd);
+
+	// Closing the file descriptor also removes it from the multiplexer.
+	close(fd);
+}
+
+struct irc_net_listener *irc_net_listener_get(struct irc_net *const net,
+					      const int fd)
+{
+	for (size_t i = 0; i < net->listeners.num_entries; ++i) {
+		if (net->listeners.entries[i].fd == fd) {
+			return &net->listeners.entries[i];
+		}
+	}
+	return NULL;
 }
 
 /// @brief Sets the given socket to be non-blocking.
@@ -67,21 +194,15 @@ static void set_sock_nonblock(const int fd)
 	}
 }
 
-static void listener_setup(struct irc_net *const net)
-{
-	for (size_t i = 0; i < net->conf->listeners.num_entries; ++i) {
-		const char *host = net->conf->listeners.entries[i].host;
-		const char *port = net->conf->listeners.entries[i].port;
-
-		irc_net_listen(net, host, port);
-	}
-}
-
-bool irc_net_listen(struct irc_net *const net, const char *const host,
-		    const char *const port)
+/// @brief Listens for TCP connections of a kind.
+static bool listen_tcp(struct irc_net *const net, const char *const host,
+		       const char *const port,
+		       const enum irc_net_listener_type type)
 {
-	if (IRC_UNLIKELY(net->listeners.num_entries >=
-			 IRC_CONF_LISTENER_NUM_MAX)) {
+	// The metrics socket and the server listener have slots of their own.
+	if (IRC_UNLIKELY((type == IRC_NET_LISTENER_CLIENT) &&
+			 (net->listeners.num_entries >=
+			  IRC_CONF_LISTENER_NUM_MAX))) {
 		IRC_LOG_ERR(net->log,
 			    "platform_net_listen(): too many listeners");
 		return false;
@@ -151,7 +272,23 @@ bool irc_net_listen(struct irc_net *const net, const char *const host,
 		return false;
 	}
 
-	net->listeners.entries[net->listeners.num_entries++] = fd;
+	struct irc_net_listener *listener =
+		&net->listeners.entries[net->listeners.num_entries++];
+
+	*listener = (struct irc_net_listener){ .fd = fd, .type = type };
+
+	snprintf(listener->addr.host, sizeof(listener->addr.host), "%s", host);
+	snprintf(listener->addr.port, sizeof(listener->addr.port), "%s", port);
+
+	return true;
+}
+
+bool irc_net_listen(struct irc_net *const net, const char *const host,
+		    const char *const port)
+{
+	if (!listen_tcp(net, host, port, IRC_NET_LISTENER_CLIENT)) {
+		return false;
+	}
 
 	IRC_LOG_INFO(net->log,
 		     "listening for incoming client connections on %s:%s", host,
@@ -160,27 +297,439 @@ bool irc_net_listen(struct irc_net *const net, const char *const host,
 	return true;
 }
 
-void irc_net_accept(struct irc_net *const net, const int fd)
+bool irc_net_listen_servers(struct irc_net *const net, const char *const host,
+			    const char *const port)
+{
+	if (!listen_tcp(net, host, port, IRC_NET_LISTENER_SERVER)) {
+		IRC_LOG_ERR(net->log, "unable to accept links on %s:%s", host,
+			    port);
+		return false;
+	}
+
+	IRC_LOG_INFO(net->log, "listening for incoming links on %s:%s", host,
+		     port);
+
+	return true;
+}
+
+int irc_net_connect(struct irc_net *const net, const char *const host,
+		    const char *const port)
+{
+	const struct addrinfo hints = { .ai_family = AF_UNSPEC,
+					.ai_socktype = SOCK_STREAM };
+
+	struct addrinfo *res = NULL;
+
+	if (IRC_UNLIKELY(getaddrinfo(host, port, &hints, &res) != 0)) {
+		IRC_LOG_ERR(net->log, "unable to resolve %s:%s", host, port);
+		return -1;
+	}
+
+	// Only the first address is tried; the next attempt starts over.
+	const int fd = socket(res->ai_family,
+			      res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			      res->ai_protocol);
+
+	if (IRC_UNLIKELY(fd < 0)) {
+		freeaddrinfo(res);
+		return -1;
+	}
+
+	const int ret = connect(fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+
+	if (IRC_UNLIKELY(((ret < 0) && (errno != EINPROGRESS)) ||
+			 !irc_net_platform_client_add(net, fd))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool irc_net_connected(struct irc_net *const net, const int fd)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (IRC_UNLIKELY(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) <
+			 0)) {
+		err = errno;
+	}
+
+	if (err) {
+		IRC_LOG_DBG(net->log, "fd %d: unable to connect: %s", fd,
+			    strerror(err));
+		return false;
+	}
+	return true;
+}
+
+bool irc_net_listen_stats(struct irc_net *const net, const char *const path)
 {
-	struct sockaddr user_in;
-	socklen_t socklen;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
 
-	const int user_sock = accept(fd, &user_in, &socklen);
+	if (IRC_UNLIKELY(strlen(path) >= sizeof(addr.sun_path))) {
+		IRC_LOG_ERR(net->log, "metrics socket path too long: %s", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
 
-	if (IRC_UNLIKELY(user_sock < 0)) {
-		IRC_LOG_ERR(net->log, "unable to accept connection: %s",
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (IRC_UNLIKELY(fd < 0)) {
+		IRC_LOG_ERR(net->log, "unable to create metrics socket: %s",
 			    strerror(errno));
-		return;
+		return false;
 	}
 	set_sock_nonblock(fd);
-	irc_net_platform_client_add(net, user_sock);
 
-	struct irc_event_net_client_conn ev = { .fd = user_sock };
-	irc_event_pub(net->event, IRC_EVENT_TYPE_NET_CLIENT_CONN, &ev);
+	// A stale socket left behind by a previous instance would make bind(2)
+	// fail.
+	unlink(path);
+
+	if (IRC_UNLIKELY(
+		    (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+		    (listen(fd, SOMAXCONN) < 0) ||
+		    !irc_net_platform_listener_add(net, fd))) {
+		IRC_LOG_ERR(net->log, "unable to listen on metrics socket %s",
+			    path);
+		close(fd);
+		return false;
+	}
+
+	net->listeners.entries[net->listeners.num_entries++] =
+		(struct irc_net_listener){ .fd = fd,
+					   .type = IRC_NET_LISTENER_STATS };
+
+	IRC_LOG_INFO(net->log, "serving metrics on %s", path);
+	return true;
+}
+
+/// @brief Returns `true` if two listener addresses are the same.
+static bool addr_eq(const struct irc_conf_listener *const a,
+		    const struct irc_conf_listener *const b)
+{
+	return !strcmp(a->host, b->host) && !strcmp(a->port, b->port);
+}
+
+/// @brief Returns `true` if a listener is still configured in a new
+/// configuration.
+IRC_ATTRIB_PURE
+static bool listener_kept(const struct irc_net *const net,
+			  const struct irc_net_listener *const listener,
+			  const struct irc_conf *const next)
+{
+	switch (listener->type) {
+	case IRC_NET_LISTENER_CLIENT:
+		for (size_t i = 0; i < next->listeners.num_entries; ++i) {
+			if (addr_eq(&listener->addr,
+				    &next->listeners.entries[i])) {
+				return true;
+			}
+		}
+		return false;
+	case IRC_NET_LISTENER_STATS:
+		return !strcmp(net->conf->metrics.sock_path,
+			       next->metrics.sock_path);
+	case IRC_NET_LISTENER_SERVER:
+	default:
+		return addr_eq(&listener->addr, &next->links.listener);
+	}
+}
+
+/// @brief Returns the first listener of a type, listening where asked if it
+/// listens for TCP connections, or `NULL` if there is none.
+static const struct irc_net_listener *
+listener_find(const struct irc_net *const net,
+	      const enum irc_net_listener_type type,
+	      const struct irc_conf_listener *const addr)
+{
+	for (size_t i = 0; i < net->listeners.num_entries; ++i) {
+		const struct irc_net_listener *listener =
+			&net->listeners.entries[i];
+
+		if ((listener->type == type) &&
+		    (!addr || addr_eq(&listener->addr, addr))) {
+			return listener;
+		}
+	}
+	return NULL;
+}
+
+void irc_net_listeners_apply(struct irc_net *const net,
+			     const struct irc_conf *const next)
+{
+	// Listeners are closed first, so that an address that moves from one
+	// listener to another is free to be bound again.
+	for (size_t i = net->listeners.num_entries; i-- > 0;) {
+		struct irc_net_listener *listener = &net->listeners.entries[i];
+
+		if (listener_kept(net, listener, next)) {
+			continue;
+		}
+
+		if (listener->type == IRC_NET_LISTENER_STATS) {
+			IRC_LOG_INFO(net->log, "closing metrics socket %s",
+				     net->conf->metrics.sock_path);
+
+			unlink(net->conf->metrics.sock_path);
+		} else {
+			IRC_LOG_INFO(net->log, "closing listener on %s:%s",
+				     listener->addr.host, listener->addr.port);
+		}
+
+		// Closing the file descriptor also removes it from the
+		// multiplexer.
+		close(listener->fd);
+
+		*listener =
+			net->listeners.entries[--net->listeners.num_entries];
+	}
+
+	for (size_t i = 0; i < next->listeners.num_entries; ++i) {
+		const struct irc_conf_listener *addr =
+			&next->listeners.entries[i];
+
+		if (!listener_find(net, IRC_NET_LISTENER_CLIENT, addr)) {
+			irc_net_listen(net, addr->host, addr->port);
+		}
+	}
+
+	if ((next->metrics.sock_path[0] != '\0') &&
+	    !listener_find(net, IRC_NET_LISTENER_STATS, NULL)) {
+		irc_net_listen_stats(net, next->metrics.sock_path);
+	}
+
+	if ((next->links.listener.host[0] != '\0') &&
+	    !listener_find(net, IRC_NET_LISTENER_SERVER, NULL)) {
+		irc_net_listen_servers(net, next->links.listener.host,
+				       next->links.listener.port);
+	}
+}
+
+bool irc_net_listener_adopt(struct irc_net *const net, const int fd,
+			    const enum irc_net_listener_type type,
+			    const struct irc_conf_listener *const addr)
+{
+	if (IRC_UNLIKELY(net->listeners.num_entries >=
+			 (sizeof(net->listeners.entries) /
+			  sizeof(*net->listeners.entries)))) {
+		IRC_LOG_ERR(net->log, "unable to adopt listener: too many");
+		return false;
+	}
+
+	if (!irc_net_platform_listener_add(net, fd)) {
+		return false;
+	}
+	net->listeners.entries[net->listeners.num_entries++] =
+		(struct irc_net_listener){ .fd = fd,
+					   .type = type,
+					   .addr = *addr };
+	return true;
+}
+
+/// @brief Counts a client connection against its subnet.
+///
+/// @returns `false` if the subnet has reached its limit, or `true` otherwise.
+static bool subnet_admit(struct irc_net *const net, const int fd,
+			 const struct irc_cidr_addr *const addr)
+{
+	struct irc_cidr_addr key = *addr;
+
+	if (irc_cidr_is_ipv4(&key)) {
+		irc_cidr_mask(&key, IRC_CIDR_IPV4_OFFSET +
+					    net->conf->clones.ipv4_len);
+	} else {
+		irc_cidr_mask(&key, net->conf->clones.ipv6_len);
+	}
+
+	struct irc_net_subnet *subnet = irc_ht_get(&net->subnets.by_addr, &key);
+
+	if (!subnet) {
+		subnet = irc_calloc(1, sizeof(*subnet));
+		subnet->addr = key;
+
+		irc_ht_add(&net->subnets.by_addr, &subnet->addr, subnet);
+	} else if (subnet->num_conns >= net->conf->clones.max) {
+		return false;
+	}
+
+	if ((size_t)fd >= net->subnets.num_fds) {
+		size_t num_fds = net->subnets.num_fds ? net->subnets.num_fds :
+							64;
+
+		while (num_fds <= (size_t)fd) {
+			num_fds *= 2;
+		}
+		net->subnets.by_fd =
+			irc_realloc(net->subnets.by_fd,
+				    num_fds * sizeof(*net->subnets.by_fd));
+
+		memset(&net->subnets.by_fd[net->subnets.num_fds], 0,
+		       (num_fds - net->subnets.num_fds) *
+			       sizeof(*net->subnets.by_fd));
+
+		net->subnets.num_fds = num_fds;
+	}
+	net->subnets.by_fd[fd] = subnet;
+	subnet->num_conns++;
+
+	return true;
+}
+
+/// @brief Decides whether a client connection is kept, before anything is
+/// spent on it. Refusals are the common case under a connection flood, so
+/// this only reads the peer address accept(2) already returned.
+///
+/// @returns `false` if the connection has to be closed, or `true` otherwise.
+static bool conn_admit(struct irc_net *const net, const int fd,
+		       const struct sockaddr_storage *const peer)
+{
+	struct irc_cidr_addr addr;
+
+	if (!irc_cidr_from_sockaddr((const struct sockaddr *)peer, &addr)) {
+		return true;
+	}
+
+	if (net->dlines && irc_cidr_match(net->dlines, &addr, NULL)) {
+		return false;
+	}
+	return !net->conf->clones.max || subnet_admit(net, fd, &addr);
+}
+
+bool irc_net_client_adopt(struct irc_net *const net, const int fd)
+{
+	if (!irc_net_platform_client_add(net, fd)) {
+		return false;
+	}
+
+	if (!net->conf->clones.max) {
+		return true;
+	}
+	struct sockaddr_storage peer;
+	socklen_t socklen = sizeof(peer);
+	struct irc_cidr_addr addr;
+
+	// The connection was admitted once already; a subnet that is now over
+	// its limit only refuses the connections that come next.
+	if (!getpeername(fd, (struct sockaddr *)&peer, &socklen) &&
+	    irc_cidr_from_sockaddr((const struct sockaddr *)&peer, &addr)) {
+		subnet_admit(net, fd, &addr);
+	}
+	return true;
+}
+
+/// @brief Renders the numeric address of a peer.
+static void host_of(const struct sockaddr_storage *const peer,
+		    const socklen_t socklen, char *const host)
+{
+	if (getnameinfo((const struct sockaddr *)peer, socklen, host,
+			NI_MAXHOST, NULL, 0, NI_NUMERICHOST)) {
+		strcpy(host, "unknown");
+	}
+}
+
+void irc_net_accept(struct irc_net *const net,
+		    const struct irc_net_listener *const listener)
+{
+	// Sockets are made non-blocking by accept4(2) itself, saving two
+	// fcntl(2) calls per connection. That includes the stats listener: a
+	// scraper that does not read must not block the I/O loop.
+	const int flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+
+	// Listeners are edge-triggered, so every pending connection has to be
+	// accepted now.
+	for (;;) {
+		struct sockaddr_storage user_in;
+		socklen_t socklen = sizeof(user_in);
+
+		const int user_sock =
+			accept4(listener->fd, (struct sockaddr *)&user_in,
+				&socklen, flags);
+
+		if (IRC_UNLIKELY(user_sock < 0)) {
+			if (errno_would_block()) {
+				return;
+			}
+
+			if ((errno == EINTR) || (errno == ECONNABORTED)) {
+				continue;
+			}
+
+			IRC_LOG_ERR_RATELIMIT(net->log, ACCEPT_ERR_LOG_PER_SEC,
+					      "unable to accept connection: %s",
+					      strerror(errno));
+			return;
+		}
+
+		IRC_TRACE(net_accept, user_sock, listener->fd);
+
+		if (listener->type == IRC_NET_LISTENER_STATS) {
+			struct irc_event_net_stats_conn ev = { .fd = user_sock };
+			irc_event_pub(net->event, IRC_EVENT_TYPE_NET_STATS_CONN,
+				      &ev);
+			continue;
+		}
+
+		char host[NI_MAXHOST];
+
+		if (listener->type == IRC_NET_LISTENER_SERVER) {
+			// Servers are authenticated by the link handshake
+			// rather than by their address.
+			irc_net_platform_client_add(net, user_sock);
+			host_of(&user_in, socklen, host);
+
+			struct irc_event_net_server_conn ev = {
+				.fd = user_sock, .host = host
+			};
+			irc_event_pub(net->event,
+				      IRC_EVENT_TYPE_NET_SERVER_CONN, &ev);
+			continue;
+		}
+
+		if (IRC_UNLIKELY(!conn_admit(net, user_sock, &user_in))) {
+			IRC_METRIC_INC(net->metrics, IRC_METRIC_ACCEPTS_REFUSED);
+			close(user_sock);
+			continue;
+		}
+		irc_net_platform_client_add(net, user_sock);
+
+		IRC_METRIC_INC(net->metrics, IRC_METRIC_ACCEPTS);
+		host_of(&user_in, socklen, host);
+
+		struct irc_event_net_client_conn ev = { .fd = user_sock,
+							.host = host };
+		irc_event_pub(net->event, IRC_EVENT_TYPE_NET_CLIENT_CONN, &ev);
+	}
+}
+
+static size_t subnet_hash(const void *const key, const u8 *const secret_key)
+{
+	return irc_ht_hash_bytes(key, sizeof(struct irc_cidr_addr), secret_key);
+}
+
+static bool subnet_eq(const void *const key_a, const void *const key_b)
+{
+	const struct irc_cidr_addr *a = key_a;
+	const struct irc_cidr_addr *b = key_b;
+
+	return (a->hi == b->hi) && (a->lo == b->lo);
 }
 
 void irc_net_init(struct irc_net *const net)
 {
+	static const struct irc_ht_conf subnets_conf = {
+		// clang-format off
+
+		.initial_capacity	= 64,
+		.load_fact_max		= 75,
+		.hash			= &subnet_hash,
+		.eq			= &subnet_eq
+
+		// clang-format on
+	};
+
+	irc_ht_init(&net->subnets.by_addr, &subnets_conf);
+
 	irc_net_platform_init(net);
-	listener_setup(net);
 }
@@ -26,21 +26,34 @@
 
 #include "core/compiler.h"
 #include "core/log.h"
+#include "core/metrics.h"
 #include "core/net.h"
+#include "core/prof.h"
 
 #define MAX_EVENTS (32)
 
 static struct epoll_event ev[MAX_EVENTS];
 static int epfd = 0;
 
-static void process_fd(struct irc_net *const net, const int idx,
-		       const int listen_sock)
+static void process_fd(struct irc_net *const net, const int idx)
 {
-	if (ev[idx].data.fd == listen_sock) {
-		// New connection from client.
-		irc_net_accept(net, listen_sock);
-	} else if (ev[idx].events & EPOLLIN) {
-		irc_net_read(net, ev[idx].data.fd);
+	const int fd = ev[idx].data.fd;
+	const struct irc_net_listener *listener = irc_net_listener_get(net, fd);
+
+	if (listener) {
+		// New connection(s) from clients.
+		irc_net_accept(net, listener);
+		return;
+	}
+
+	if (ev[idx].events & EPOLLOUT) {
+		struct irc_event_net_client_writable wr_ev = { .fd = fd };
+		irc_event_pub(net->event, IRC_EVENT_TYPE_NET_CLIENT_WRITABLE,
+			      &wr_ev);
+	}
+
+	if (ev[idx].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		irc_net_read(net, fd);
 	}
 }
 
@@ -75,7 +88,10 @@ bool irc_net_platform_init(struct irc_net *const net)
 
 bool irc_net_platform_client_add(struct irc_net *const net, const int fd)
 {
-	return fd_add(net, fd, EPOLLIN | EPOLLET);
+	// Being edge-triggered, EPOLLOUT is only reported when a full socket
+	// buffer drains, which is exactly when a blocked send queue has to be
+	// flushed.
+	return fd_add(net, fd, EPOLLIN | EPOLLOUT | EPOLLET);
 }
 
 bool irc_net_platform_listener_add(struct irc_net *const net, const int fd)
@@ -83,17 +99,22 @@ bool irc_net_platform_listener_add(struct irc_net *const net, const int fd)
 	return fd_add(net, fd, EPOLLIN | EPOLLOUT | EPOLLET);
 }
 
-void irc_net_platform_poll(struct irc_net *const net)
+void irc_net_platform_poll(struct irc_net *const net, const int timeout_ms)
 {
-	const int num_fds = epoll_wait(epfd, ev, MAX_EVENTS, -1);
+	const int num_fds = epoll_wait(epfd, ev, MAX_EVENTS, timeout_ms);
 
 	if (IRC_UNLIKELY(num_fds < 0)) {
-		// error
+		// Most likely interrupted by a signal; try again on the next
+		// call.
+		return;
 	}
 
-	for (int fd = 0; fd < num_fds; ++fd) {
-		for (size_t i = 0; i < net->listeners.num_entries; ++i) {
-			process_fd(net, fd, net->listeners.entries[i]);
-		}
+	irc_prof_enter(net->prof, IRC_PROF_PHASE_READ);
+
+	irc_metrics_hist_record(net->metrics, IRC_METRIC_HIST_POLL_BATCH,
+				(u64)num_fds);
+
+	for (int i = 0; i < num_fds; ++i) {
+		process_fd(net, i);
 	}
 }
@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/compiler.h"
+#include "core/pool.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The size of the slabs objects are carved out of.
+#define SLAB_SIZE               (64 * 1024)
+
+/// @brief The number of objects moved between a thread cache and the shared
+/// free list of its class at a time.
+#define BATCH_NUM               (32)
+
+/// @brief The number of objects a thread caches per class at most.
+#define CACHE_NUM_MAX           (2 * BATCH_NUM)
+
+// Sanitizers are given every allocation to watch over.
+#ifdef IRC_POOL_PASSTHROUGH
+#define POOL_SIZE_MAX           (0)
+#else
+#define POOL_SIZE_MAX           IRC_POOL_SIZE_MAX
+#endif
+
+// clang-format on
+
+/// @brief The sizes of the classes: multiples of 16 up to 128, then four per
+/// power of two.
+static const u32 class_sizes[IRC_POOL_CLASS_NUM] = {
+	16,   32,   48,   64,   80,   96,   112,  128,  160,  192,
+	224,  256,  320,  384,  448,  512,  640,  768,  896,  1024,
+	1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096
+};
+
+static const char *const sys_names[IRC_POOL_SYS_NUM] = {
+	// clang-format off
+
+	[IRC_POOL_USERS]        = "users",
+	[IRC_POOL_MEMBERS]      = "members",
+	[IRC_POOL_BUFS]         = "buffers",
+	[IRC_POOL_SENDQS]       = "sendqs",
+	[IRC_POOL_FANOUTS]      = "fanouts",
+	[IRC_POOL_RECVQS]       = "recvqs"
+
+	// clang-format on
+};
+
+/// @brief A free object, which links to the next one.
+struct free_obj {
+	struct free_obj *next;
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief The objects of a size class shared by all threads.
+struct pool_class {
+	pthread_mutex_t lock;
+
+	struct free_obj *free;
+	u64 num_free;
+
+	/// @brief The part of the newest slab not handed out yet.
+	char *slab_pos;
+	size_t slab_left;
+
+	/// @brief The memory of all the slabs of the class.
+	u64 slab_bytes;
+};
+
+/// @brief The free objects of a size class cached by a thread.
+struct cache {
+	struct free_obj *head;
+	u32 num;
+};
+
+#pragma GCC diagnostic pop
+
+static struct pool_class classes[IRC_POOL_CLASS_NUM] = {
+	[0 ... IRC_POOL_CLASS_NUM - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static _Thread_local struct cache caches[IRC_POOL_CLASS_NUM];
+
+/// @brief What each subsystem holds; only ever updated atomically.
+static struct irc_pool_sys_stats sys_stats[IRC_POOL_SYS_NUM];
+
+static u32 class_of(const size_t size)
+{
+	if (size <= 128) {
+		return (size > 16) ? ((u32)((size + 15) / 16) - 1) : 0;
+	}
+
+	// The size is above 2^lg and at most 2^(lg + 1), a range split into
+	// four classes.
+	const u32 lg = 63 - (u32)__builtin_clzl(size - 1);
+	const u32 quarter = (u32)((size - 1) >> (lg - 2)) - 4;
+
+	return 8 + ((lg - 7) * 4) + quarter;
+}
+
+static void account(const enum irc_pool_sys sys, const u64 num_objs,
+		    const u64 num_bytes)
+{
+	struct irc_pool_sys_stats *stats = &sys_stats[sys];
+
+	// Frees add the two's complement.
+	__atomic_fetch_add(&stats->num_objs, num_objs, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->num_bytes, num_bytes, __ATOMIC_RELAXED);
+}
+
+/// @brief Fills an empty cache with a batch of objects, from the free list of
+/// the class if it has any, or from its slabs.
+static void refill(const u32 cls, struct cache *const cache)
+{
+	struct pool_class *pc = &classes[cls];
+	const size_t obj_size = class_sizes[cls];
+
+	u32 num = 0;
+
+	pthread_mutex_lock(&pc->lock);
+
+	while (pc->free && (num < BATCH_NUM)) {
+		struct free_obj *obj = pc->free;
+
+		pc->free = obj->next;
+		obj->next = cache->head;
+		cache->head = obj;
+		num++;
+	}
+	pc->num_free -= num;
+
+	for (; num < BATCH_NUM; ++num) {
+		if (pc->slab_left < obj_size) {
+			pc->slab_pos = irc_malloc(SLAB_SIZE);
+			pc->slab_left = SLAB_SIZE;
+			pc->slab_bytes += SLAB_SIZE;
+		}
+		struct free_obj *obj = (void *)pc->slab_pos;
+
+		pc->slab_pos += obj_size;
+		pc->slab_left -= obj_size;
+
+		obj->next = cache->head;
+		cache->head = obj;
+	}
+
+	pthread_mutex_unlock(&pc->lock);
+
+	cache->num += num;
+}
+
+/// @brief Returns the first objects of a cache to the free list of the class.
+static void drain(const u32 cls, struct cache *const cache, const u32 num)
+{
+	if (!num) {
+		return;
+	}
+	struct free_obj *head = cache->head;
+	struct free_obj *tail = head;
+
+	for (u32 i = 1; i < num; ++i) {
+		tail = tail->next;
+	}
+	cache->head = tail->next;
+	cache->num -= num;
+
+	struct pool_class *pc = &classes[cls];
+
+	pthread_mutex_lock(&pc->lock);
+
+	tail->next = pc->free;
+	pc->free = head;
+	pc->num_free += num;
+
+	pthread_mutex_unlock(&pc->lock);
+}
+
+void *irc_pool_alloc(const enum irc_pool_sys sys, const size_t size)
+{
+	if (IRC_UNLIKELY(size > POOL_SIZE_MAX)) {
+		account(sys, 1, size);
+		return irc_malloc(size);
+	}
+	const u32 cls = class_of(size);
+	struct cache *cache = &caches[cls];
+
+	if (IRC_UNLIKELY(!cache->head)) {
+		refill(cls, cache);
+	}
+	struct free_obj *obj = cache->head;
+
+	cache->head = obj->next;
+	cache->num--;
+
+	account(sys, 1, class_sizes[cls]);
+	return obj;
+}
+
+void *irc_pool_calloc(const enum irc_pool_sys sys, const size_t size)
+{
+	void *ptr = irc_pool_alloc(sys, size);
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+void irc_pool_free(const enum irc_pool_sys sys, void *const ptr,
+		   const size_t size)
+{
+	if (!ptr) {
+		return;
+	}
+
+	if (IRC_UNLIKELY(size > POOL_SIZE_MAX)) {
+		account(sys, (u64)-1, -(u64)size);
+		free(ptr);
+		return;
+	}
+	const u32 cls = class_of(size);
+	struct cache *cache = &caches[cls];
+	struct free_obj *obj = ptr;
+
+	obj->next = cache->head;
+	cache->head = obj;
+
+	if (IRC_UNLIKELY(++cache->num > CACHE_NUM_MAX)) {
+		drain(cls, cache, BATCH_NUM);
+	}
+	account(sys, (u64)-1, -(u64)class_sizes[cls]);
+}
+
+size_t irc_pool_size(const size_t size)
+{
+	return (size > POOL_SIZE_MAX) ? size : class_sizes[class_of(size)];
+}
+
+void irc_pool_thread_exit(void)
+{
+	for (u32 i = 0; i < IRC_POOL_CLASS_NUM; ++i) {
+		drain(i, &caches[i], caches[i].num);
+	}
+}
+
+void irc_pool_sys_stats(const enum irc_pool_sys sys,
+			struct irc_pool_sys_stats *const stats)
+{
+	stats->num_objs =
+		__atomic_load_n(&sys_stats[sys].num_objs, __ATOMIC_RELAXED);
+	stats->num_bytes =
+		__atomic_load_n(&sys_stats[sys].num_bytes, __ATOMIC_RELAXED);
+}
+
+void irc_pool_report(const irc_pool_emit_cb emit, void *const udata)
+{
+	char line[128];
+
+	for (u32 i = 0; i < IRC_POOL_SYS_NUM; ++i) {
+		struct irc_pool_sys_stats stats;
+		irc_pool_sys_stats(i, &stats);
+
+		const int len = snprintf(line, sizeof(line),
+					 "%s %" PRIu64 " objects %" PRIu64
+					 " bytes",
+					 sys_names[i], stats.num_objs,
+					 stats.num_bytes);
+		emit(udata, line, (size_t)len);
+	}
+
+	for (u32 i = 0; i < IRC_POOL_CLASS_NUM; ++i) {
+		struct pool_class *pc = &classes[i];
+
+		pthread_mutex_lock(&pc->lock);
+
+		const u64 slab_bytes = pc->slab_bytes;
+		const u64 num_free = pc->num_free;
+
+		pthread_mutex_unlock(&pc->lock);
+
+		if (!slab_bytes) {
+			continue;
+		}
+		const int len = snprintf(line, sizeof(line),
+					 "class %" PRIu32 " %" PRIu64
+					 " slab bytes %" PRIu64 " shared free",
+					 class_sizes[i], slab_bytes, num_free);
+		emit(udata, line, (size_t)len);
+	}
+}
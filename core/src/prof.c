@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <string.h>
+
+#include "core/metrics.h"
+#include "core/prof.h"
+
+void irc_prof_iter_begin(struct irc_prof *const prof)
+{
+	prof->mark = irc_clock_mono_ns();
+	prof->entered = 1U << IRC_PROF_PHASE_POLL;
+
+	atomic_store_explicit(&prof->phase, IRC_PROF_PHASE_POLL,
+			      memory_order_relaxed);
+}
+
+void irc_prof_iter_end(struct irc_prof *const prof)
+{
+	const u64 now = irc_clock_mono_ns();
+
+	const uint phase =
+		atomic_load_explicit(&prof->phase, memory_order_relaxed);
+
+	prof->phase_ns[phase] += now - prof->mark;
+
+	for (uint i = 0; i < IRC_PROF_PHASE_NUM; ++i) {
+		if (prof->entered & (1U << i)) {
+			irc_metrics_hist_record(prof->metrics,
+						IRC_METRIC_HIST_LOOP_PHASE + i,
+						prof->phase_ns[i]);
+		}
+	}
+
+	// Every phase but polling is busy.
+	if (prof->entered & ~(1U << IRC_PROF_PHASE_POLL)) {
+		u64 busy_ns = 0;
+
+		for (uint i = 0; i < IRC_PROF_PHASE_NUM; ++i) {
+			if (i != IRC_PROF_PHASE_POLL) {
+				busy_ns += prof->phase_ns[i];
+			}
+		}
+		irc_metrics_hist_record(prof->metrics,
+					IRC_METRIC_HIST_LOOP_BUSY, busy_ns);
+	}
+
+	memset(prof->phase_ns, 0, sizeof(prof->phase_ns));
+
+	atomic_store_explicit(&prof->busy_since, 0, memory_order_relaxed);
+	atomic_fetch_add_explicit(&prof->num_iters, 1, memory_order_release);
+}
+
+const char *irc_prof_phase_name(const enum irc_prof_phase phase)
+{
+	switch (phase) {
+	case IRC_PROF_PHASE_POLL:
+		return "poll";
+	case IRC_PROF_PHASE_READ:
+		return "read";
+	case IRC_PROF_PHASE_PARSE:
+		return "parse";
+	case IRC_PROF_PHASE_DISPATCH:
+		return "dispatch";
+	case IRC_PROF_PHASE_FLUSH:
+		return "flush";
+	case IRC_PROF_PHASE_TIMERS:
+		return "timers";
+	case IRC_PROF_PHASE_FANOUT:
+		return "fanout";
+	case IRC_PROF_PHASE_NUM:
+	default:
+		return "unknown";
+	}
+}
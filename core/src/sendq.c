@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include "core/net.h"
+#include "core/pool.h"
+#include "core/sendq.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The number of entries a send queue starts out with.
+#define CAPACITY_MIN    (8)
+
+/// @brief The maximum number of buffers written by a single `writev()` call.
+#define IOV_NUM_MAX     (64)
+
+// clang-format on
+
+static void grow(struct irc_sendq *const sendq)
+{
+	const u32 capacity = sendq->capacity ? (sendq->capacity * 2)
+					     : CAPACITY_MIN;
+
+	struct irc_buf **entries =
+		irc_pool_alloc(IRC_POOL_SENDQS, capacity * sizeof(*entries));
+
+	// Unwrap the ring while copying.
+	for (u32 i = 0; i < sendq->num_entries; ++i) {
+		entries[i] = sendq->entries[(sendq->head + i) &
+					    (sendq->capacity - 1)];
+	}
+
+	irc_pool_free(IRC_POOL_SENDQS, sendq->entries,
+		      sendq->capacity * sizeof(*entries));
+
+	sendq->entries = entries;
+	sendq->capacity = capacity;
+	sendq->head = 0;
+}
+
+void irc_sendq_push(struct irc_sendq *const sendq, struct irc_buf *const buf)
+{
+	if (sendq->num_entries == sendq->capacity) {
+		grow(sendq);
+	}
+
+	const u32 tail = (sendq->head + sendq->num_entries) &
+			 (sendq->capacity - 1);
+
+	sendq->entries[tail] = buf;
+	sendq->num_entries++;
+	sendq->len += buf->len;
+}
+
+/// @brief Releases the buffers fully covered by a write.
+static void consume(struct irc_sendq *const sendq, size_t cnt)
+{
+	sendq->len -= cnt;
+
+	while (cnt) {
+		struct irc_buf *buf = sendq->entries[sendq->head];
+		const size_t left = buf->len - sendq->head_off;
+
+		if (cnt < left) {
+			sendq->head_off += (u32)cnt;
+			return;
+		}
+
+		cnt -= left;
+		irc_buf_unref(buf);
+
+		sendq->head = (sendq->head + 1) & (sendq->capacity - 1);
+		sendq->head_off = 0;
+		sendq->num_entries--;
+	}
+}
+
+enum irc_sendq_status irc_sendq_flush(struct irc_sendq *const sendq,
+				      struct irc_net *const net, const int fd)
+{
+	struct iovec iov[IOV_NUM_MAX];
+
+	while (sendq->num_entries) {
+		const u32 num_iov = (sendq->num_entries < IOV_NUM_MAX)
+					    ? sendq->num_entries
+					    : IOV_NUM_MAX;
+		size_t iov_len = 0;
+
+		for (u32 i = 0; i < num_iov; ++i) {
+			struct irc_buf *buf =
+				sendq->entries[(sendq->head + i) &
+					       (sendq->capacity - 1)];
+			const u32 off = i ? 0 : sendq->head_off;
+
+			iov[i].iov_base = &buf->data[off];
+			iov[i].iov_len = buf->len - off;
+			iov_len += iov[i].iov_len;
+		}
+
+		const ssize_t cnt = irc_net_writev(net, fd, iov, (int)num_iov);
+
+		if (cnt < 0) {
+			return (cnt == IRC_NET_WOULD_BLOCK) ? IRC_SENDQ_BLOCKED
+							    : IRC_SENDQ_ERR;
+		}
+		consume(sendq, (size_t)cnt);
+
+		// A short write means the socket buffer is full.
+		if ((size_t)cnt < iov_len) {
+			return IRC_SENDQ_BLOCKED;
+		}
+	}
+
+	// Most connections are idle most of the time, and an empty send queue
+	// needs no storage; the pools make getting it back cheap.
+	irc_pool_free(IRC_POOL_SENDQS, sendq->entries,
+		      sendq->capacity * sizeof(*sendq->entries));
+	sendq->entries = NULL;
+	sendq->capacity = 0;
+	sendq->head = 0;
+
+	return IRC_SENDQ_EMPTY;
+}
+
+void irc_sendq_clear(struct irc_sendq *const sendq)
+{
+	for (u32 i = 0; i < sendq->num_entries; ++i) {
+		irc_buf_unref(sendq->entries[(sendq->head + i) &
+					     (sendq->capacity - 1)]);
+	}
+	irc_pool_free(IRC_POOL_SENDQS, sendq->entries,
+		      sendq->capacity * sizeof(*sendq->entries));
+	*sendq = (struct irc_sendq){};
+}
@@ -0,0 +1,642 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// close_range(2) is a GNU extension.
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/casemap.h"
+#include "core/chan.h"
+#include "core/clock.h"
+#include "core/conf.h"
+#include "core/ctx.h"
+#include "core/hash_table.h"
+#include "core/log.h"
+#include "core/mask.h"
+#include "core/snapshot.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief The number of slots of the smallest table written.
+#define SLOTS_NUM_MIN           (16)
+
+/// @brief How often a child writing a snapshot is checked on, in
+/// milliseconds.
+#define WRITER_POLL_MS          (100)
+
+/// @brief The niceness of a child writing a snapshot, so that it yields to
+/// the I/O loop when they share a CPU.
+#define WRITER_NICE             (10)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A snapshot file being put together in memory.
+struct image {
+	u8 *data;
+	struct irc_snapshot_hdr *hdr;
+	struct irc_snapshot_slot *slots;
+
+	/// @brief The offset the next record goes at.
+	size_t len;
+};
+
+#pragma GCC diagnostic pop
+
+static size_t bits_words(const size_t num_bits)
+{
+	return (num_bits + 63) / 64;
+}
+
+static bool bit_test(const u64 *const bits, const size_t idx)
+{
+	return (bits[idx / 64] >> (idx % 64)) & 1;
+}
+
+/// @brief Returns the size of a channel record, along with its masks.
+static size_t record_size(const u32 *const num_masks)
+{
+	size_t num = 0;
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		num += num_masks[i];
+	}
+	return sizeof(struct irc_snapshot_chan) +
+	       (num * sizeof(struct irc_snapshot_mask));
+}
+
+static bool hdr_valid(const struct irc_snapshot_hdr *const hdr,
+		      const size_t size)
+{
+	return !memcmp(hdr->magic, IRC_SNAPSHOT_MAGIC, sizeof(hdr->magic)) &&
+	       (hdr->version == IRC_SNAPSHOT_VERSION) && (hdr->size == size) &&
+	       (size <= UINT32_MAX) && IRC_IS_POW2(hdr->num_slots) &&
+	       (hdr->num_slots <= ((size - sizeof(*hdr)) /
+				   sizeof(struct irc_snapshot_slot)));
+}
+
+/// @brief Returns the channel record at an offset of the mapping, or `NULL` if
+/// it does not fit in the file.
+static const struct irc_snapshot_chan *
+record_get(const struct irc_snapshot *const snap, const u32 off)
+{
+	const struct irc_snapshot_hdr *hdr = snap->hdr;
+
+	const size_t table_end =
+		sizeof(*hdr) + (hdr->num_slots * sizeof(*snap->slots));
+
+	if ((off < table_end) || (off % sizeof(u64)) ||
+	    ((off + sizeof(struct irc_snapshot_chan)) > hdr->size)) {
+		return NULL;
+	}
+	const struct irc_snapshot_chan *rec =
+		(const void *)((const u8 *)hdr + off);
+
+	if (!memchr(rec->name, '\0', sizeof(rec->name))) {
+		return NULL;
+	}
+
+	// The counts are bounded before they are summed up, so that they cannot
+	// overflow.
+	const size_t masks_max = (hdr->size - off - sizeof(*rec)) /
+				 sizeof(struct irc_snapshot_mask);
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		if (rec->num_masks[i] > masks_max) {
+			return NULL;
+		}
+	}
+	return (record_size(rec->num_masks) <= (hdr->size - off)) ? rec : NULL;
+}
+
+/// @brief Returns the record of a channel in the mapping, whether or not it
+/// was restored, and the index of its slot.
+static const struct irc_snapshot_chan *
+chan_find(const struct irc_snapshot *const snap, const char *const name,
+	  size_t *const idx)
+{
+	const struct irc_snapshot_hdr *hdr = snap->hdr;
+
+	if (!hdr) {
+		return NULL;
+	}
+	const size_t mask = hdr->num_slots - 1;
+	const size_t hash = irc_casemap_ht_hash(name, hdr->secret_key);
+
+	// A damaged table may have no empty slot to stop at.
+	for (size_t i = 0, pos = hash & mask; i <= mask;
+	     ++i, pos = (pos + 1) & mask) {
+		const struct irc_snapshot_slot *slot = &snap->slots[pos];
+
+		if (!slot->off) {
+			return NULL;
+		}
+
+		if (slot->hash != (u32)hash) {
+			continue;
+		}
+		const struct irc_snapshot_chan *rec =
+			record_get(snap, slot->off);
+
+		if (rec && irc_casemap_eq(rec->name, name)) {
+			*idx = pos;
+			return rec;
+		}
+	}
+	return NULL;
+}
+
+static bool mask_valid(const struct irc_snapshot_mask *const mask)
+{
+	char normalized[IRC_MASK_LEN_MAX + 1];
+
+	return memchr(mask->text, '\0', sizeof(mask->text)) &&
+	       memchr(mask->setter, '\0', sizeof(mask->setter)) &&
+	       irc_mask_normalize(mask->text, normalized) &&
+	       !strcmp(normalized, mask->text);
+}
+
+bool irc_snapshot_open(struct irc_snapshot *const snap, const char *const path)
+{
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		const int err = errno;
+
+		close(fd);
+		errno = err;
+		return false;
+	}
+	const size_t size = (size_t)st.st_size;
+
+	if (size < sizeof(struct irc_snapshot_hdr)) {
+		close(fd);
+		errno = EINVAL;
+		return false;
+	}
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	const int err = errno;
+
+	// The mapping outlives the descriptor.
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		errno = err;
+		return false;
+	}
+
+	if (!hdr_valid(data, size)) {
+		munmap(data, size);
+		errno = EINVAL;
+		return false;
+	}
+
+	// Channels are looked up one at a time, as they are joined; reading
+	// ahead would only fault in records nobody asked for.
+	madvise(data, size, MADV_RANDOM);
+
+	snap->hdr = data;
+	snap->slots = (const void *)(snap->hdr + 1);
+	snap->restored = irc_calloc(bits_words(snap->hdr->num_slots),
+				    sizeof(*snap->restored));
+	return true;
+}
+
+void irc_snapshot_close(struct irc_snapshot *const snap)
+{
+	if (!snap->hdr) {
+		return;
+	}
+	// Nothing is written through the pointer; munmap() just wants it so.
+	munmap((void *)(uintptr_t)snap->hdr, snap->hdr->size);
+	free(snap->restored);
+
+	snap->hdr = NULL;
+	snap->slots = NULL;
+	snap->restored = NULL;
+}
+
+const struct irc_snapshot_chan *
+irc_snapshot_find(const struct irc_snapshot *const snap, const char *const name)
+{
+	size_t idx;
+
+	const struct irc_snapshot_chan *rec = chan_find(snap, name, &idx);
+
+	return (rec && !bit_test(snap->restored, idx)) ? rec : NULL;
+}
+
+struct irc_chan *irc_snapshot_restore(struct irc_snapshot *const snap,
+				      struct irc_chans *const chans,
+				      const char *const name)
+{
+	size_t idx;
+
+	const struct irc_snapshot_chan *rec = chan_find(snap, name, &idx);
+
+	if (!rec || bit_test(snap->restored, idx)) {
+		return NULL;
+	}
+
+	// The name matched one that is valid, which makes it valid too; it
+	// keeps the case it was created with.
+	struct irc_chan *chan = irc_chan_create(chans, rec->name);
+
+	chan->created = rec->created;
+
+	const struct irc_snapshot_mask *mask = (const void *)(rec + 1);
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		for (u32 j = 0; j < rec->num_masks[i]; ++j, ++mask) {
+			if (!mask_valid(mask)) {
+				continue;
+			}
+
+			if (!chan->masks[i]) {
+				chan->masks[i] = irc_mask_set_new();
+			}
+			irc_mask_set_add(chan->masks[i], mask->text,
+					 mask->setter, mask->set_at);
+		}
+	}
+	snap->restored[idx / 64] |= (u64)1 << (idx % 64);
+	return chan;
+}
+
+void irc_snapshot_unrestore(struct irc_snapshot *const snap,
+			    struct irc_chans *const chans,
+			    struct irc_chan *const chan)
+{
+	size_t idx;
+
+	if (chan_find(snap, chan->name, &idx)) {
+		snap->restored[idx / 64] &= ~((u64)1 << (idx % 64));
+	}
+	irc_chan_destroy(chans, chan);
+}
+
+/// @brief Returns the record of the slot of the mapping if it is carried over
+/// to the next snapshot: it was not restored, and no channel of that name was
+/// created since.
+static const struct irc_snapshot_chan *
+carried_get(const struct irc_snapshot *const snap,
+	    struct irc_chans *const chans, const size_t idx)
+{
+	const struct irc_snapshot_slot *slot = &snap->slots[idx];
+
+	if (!slot->off || bit_test(snap->restored, idx)) {
+		return NULL;
+	}
+	const struct irc_snapshot_chan *rec = record_get(snap, slot->off);
+
+	if (!rec || !irc_chan_name_valid(rec->name) ||
+	    irc_chan_find(chans, rec->name)) {
+		return NULL;
+	}
+	return rec;
+}
+
+static void masks_count(const struct irc_chan *const chan, u32 *const num_masks)
+{
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		num_masks[i] = chan->masks[i] ? chan->masks[i]->num_entries : 0;
+	}
+}
+
+/// @brief Files a channel record of a given size, along with its masks, in the
+/// table of an image, and returns where it goes.
+static void *image_chan_add(struct image *const img, const char *const name,
+			    const size_t size)
+{
+	const size_t mask = img->hdr->num_slots - 1;
+	const size_t hash = irc_casemap_ht_hash(name, img->hdr->secret_key);
+
+	size_t pos = hash & mask;
+
+	while (img->slots[pos].off) {
+		pos = (pos + 1) & mask;
+	}
+	img->slots[pos].off = (u32)img->len;
+	img->slots[pos].hash = (u32)hash;
+
+	void *rec = &img->data[img->len];
+
+	img->len += size;
+	img->hdr->num_chans++;
+	return rec;
+}
+
+static void image_live_add(struct image *const img,
+			   const struct irc_chan *const chan)
+{
+	u32 num_masks[IRC_CHAN_MASKS_NUM];
+
+	masks_count(chan, num_masks);
+
+	struct irc_snapshot_chan *rec =
+		image_chan_add(img, chan->name, record_size(num_masks));
+
+	strcpy(rec->name, chan->name);
+	rec->created = chan->created;
+
+	struct irc_snapshot_mask *out = (void *)(rec + 1);
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		rec->num_masks[i] = num_masks[i];
+
+		for (u32 j = 0; j < num_masks[i]; ++j, ++out) {
+			const struct irc_mask_entry *entry =
+				chan->masks[i]->entries[j];
+
+			strcpy(out->text, entry->text);
+			strcpy(out->setter, entry->setter);
+			out->set_at = entry->set_at;
+		}
+	}
+}
+
+/// @brief Writes a file under a temporary name, syncs it, and renames it over
+/// the file; whatever happens, the file is either the old or the new one.
+static bool file_replace(const char *const path, const u8 *const data,
+			 const size_t len)
+{
+	char tmp[IRC_CONF_FILE_PATH_LEN_MAX + 16];
+
+	const int tmp_len =
+		snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+
+	if ((size_t)tmp_len >= sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	const int fd =
+		open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = true;
+
+	for (size_t off = 0; ok && (off < len);) {
+		const ssize_t num = write(fd, &data[off], len - off);
+
+		if (num < 0) {
+			ok = (errno == EINTR);
+			continue;
+		}
+		off += (size_t)num;
+	}
+	ok = ok && !fsync(fd);
+	ok = !close(fd) && ok;
+	ok = ok && !rename(tmp, path);
+
+	if (!ok) {
+		const int err = errno;
+
+		unlink(tmp);
+		errno = err;
+	}
+	return ok;
+}
+
+bool irc_snapshot_write(const struct irc_snapshot *const snap,
+			struct irc_chans *const chans, const char *const path)
+{
+	const struct irc_ht *by_name = &chans->by_name;
+	const u32 num_slots_mapped = snap->hdr ? snap->hdr->num_slots : 0;
+
+	size_t num_chans = 0;
+	size_t records_len = 0;
+
+	// The table is sized first, so that records can be written out as
+	// they are filed.
+	for (size_t i = 0; i < by_name->capacity; ++i) {
+		if (!by_name->entries[i].psl) {
+			continue;
+		}
+		u32 num_masks[IRC_CHAN_MASKS_NUM];
+
+		masks_count(by_name->entries[i].val, num_masks);
+
+		num_chans++;
+		records_len += record_size(num_masks);
+	}
+
+	for (size_t i = 0; i < num_slots_mapped; ++i) {
+		const struct irc_snapshot_chan *rec =
+			carried_get(snap, chans, i);
+
+		if (rec) {
+			num_chans++;
+			records_len += record_size(rec->num_masks);
+		}
+	}
+
+	size_t num_slots = SLOTS_NUM_MIN;
+
+	while (num_slots < (num_chans * 2)) {
+		num_slots *= 2;
+	}
+	const size_t table_end = sizeof(struct irc_snapshot_hdr) +
+				 (num_slots * sizeof(struct irc_snapshot_slot));
+	const size_t size = table_end + records_len;
+
+	// Offsets are 32 bits wide.
+	if (size > UINT32_MAX) {
+		errno = EFBIG;
+		return false;
+	}
+	struct image img = { .data = irc_calloc(1, size), .len = table_end };
+
+	img.hdr = (void *)img.data;
+	img.slots = (void *)(img.hdr + 1);
+
+	memcpy(img.hdr->magic, IRC_SNAPSHOT_MAGIC, sizeof(img.hdr->magic));
+	img.hdr->version = IRC_SNAPSHOT_VERSION;
+	img.hdr->num_slots = (u32)num_slots;
+	memcpy(img.hdr->secret_key, by_name->secret_key,
+	       sizeof(img.hdr->secret_key));
+	img.hdr->size = size;
+	img.hdr->taken_at = (u64)time(NULL);
+
+	for (size_t i = 0; i < by_name->capacity; ++i) {
+		if (by_name->entries[i].psl) {
+			image_live_add(&img, by_name->entries[i].val);
+		}
+	}
+
+	for (size_t i = 0; i < num_slots_mapped; ++i) {
+		const struct irc_snapshot_chan *rec =
+			carried_get(snap, chans, i);
+
+		if (rec) {
+			const size_t rec_size = record_size(rec->num_masks);
+
+			memcpy(image_chan_add(&img, rec->name, rec_size), rec,
+			       rec_size);
+		}
+	}
+	assert(img.len == size);
+
+	const bool ok = file_replace(path, img.data, size);
+	const int err = errno;
+
+	free(img.data);
+
+	errno = err;
+	return ok;
+}
+
+/// @brief Forks a child writing a snapshot of the channels as they are now,
+/// which the I/O loop is free to change from then on.
+static void writer_start(struct irc_ctx *const ctx)
+{
+	struct irc_snapshot *snap = &ctx->snapshot;
+
+	const u64 start = irc_clock_mono_ns();
+	const pid_t pid = fork();
+
+	if (pid < 0) {
+		IRC_LOG_ERR(&ctx->log, "snapshot: fork() failed: %s",
+			    strerror(errno));
+		return;
+	}
+
+	if (!pid) {
+		// Listeners held past a crash of the server would keep it from
+		// starting again until the snapshot is written.
+		close_range(STDERR_FILENO + 1, ~0U, 0);
+		setpriority(PRIO_PROCESS, 0, WRITER_NICE);
+
+		if (irc_snapshot_write(snap, &ctx->chans,
+				       ctx->conf.snapshot.path)) {
+			_exit(EXIT_SUCCESS);
+		}
+
+		// Why it failed is passed on as the exit status.
+		_exit(((errno > 0) && (errno < 256)) ? errno : EIO);
+	}
+	snap->writer.pid = pid;
+	snap->writer.start_ns = start;
+
+	IRC_LOG_DBG(&ctx->log,
+		    "snapshot: writing %s from process %d, forked in %" PRIu64
+		    " us",
+		    ctx->conf.snapshot.path, (int)pid,
+		    (irc_clock_mono_ns() - start) / 1000);
+}
+
+/// @brief Collects the child writing a snapshot if it is done.
+static void writer_collect(struct irc_ctx *const ctx)
+{
+	struct irc_snapshot *snap = &ctx->snapshot;
+
+	int status;
+	const pid_t pid = waitpid(snap->writer.pid, &status, WNOHANG);
+
+	if (!pid) {
+		return;
+	}
+	snap->writer.pid = 0;
+
+	const u64 took_ms =
+		(irc_clock_mono_ns() - snap->writer.start_ns) / 1000000;
+
+	if (pid < 0) {
+		IRC_LOG_ERR(&ctx->log, "snapshot: lost the writer: %s",
+			    strerror(errno));
+	} else if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+		IRC_LOG_INFO(&ctx->log, "snapshot: wrote %s in %" PRIu64 " ms",
+			     ctx->conf.snapshot.path, took_ms);
+	} else if (WIFEXITED(status)) {
+		IRC_LOG_ERR(&ctx->log, "snapshot: unable to write %s: %s",
+			    ctx->conf.snapshot.path,
+			    strerror(WEXITSTATUS(status)));
+	} else {
+		IRC_LOG_ERR(&ctx->log,
+			    "snapshot: the writer of %s died of signal %d",
+			    ctx->conf.snapshot.path, WTERMSIG(status));
+	}
+}
+
+int irc_snapshot_tick(struct irc_ctx *const ctx)
+{
+	struct irc_snapshot *snap = &ctx->snapshot;
+	const struct irc_conf *conf = &ctx->conf;
+
+	if (snap->writer.pid) {
+		writer_collect(ctx);
+	}
+
+	if (conf->snapshot.path[0] == '\0') {
+		return snap->writer.pid ? WRITER_POLL_MS : -1;
+	}
+	const u64 now = irc_clock_mono_ns() / 1000000;
+	const u64 interval_ms = (u64)conf->snapshot.interval_s * 1000;
+
+	// The first snapshot is taken an interval after startup, until which
+	// the file mapped is as good. A rehash may shorten the interval.
+	if (!snap->next_ms || (snap->next_ms > (now + interval_ms))) {
+		snap->next_ms = now + interval_ms;
+	}
+
+	if (now >= snap->next_ms) {
+		snap->next_ms = now + interval_ms;
+
+		if (snap->writer.pid) {
+			IRC_LOG_WARN(&ctx->log,
+				     "snapshot: still writing the previous "
+				     "one, skipping this one");
+		} else {
+			writer_start(ctx);
+		}
+	}
+	u64 wait = snap->next_ms - now;
+
+	if (snap->writer.pid && (wait > WRITER_POLL_MS)) {
+		wait = WRITER_POLL_MS;
+	}
+	return (int)wait;
+}
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "core/treap.h"
+
+/// @brief Draws the priority of a node from a xorshift64* generator.
+static u32 prio_next(struct irc_treap *const treap)
+{
+	u64 x = treap->prio_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	treap->prio_state = x;
+
+	return (u32)((x * UINT64_C(0x2545f4914f6cdd1d)) >> 32);
+}
+
+/// @brief Points the link to a subtree, from its parent or the root, at
+/// another node.
+static void link_replace(struct irc_treap *const treap,
+			 struct irc_treap_node *const parent,
+			 const struct irc_treap_node *const old,
+			 struct irc_treap_node *const node)
+{
+	if (!parent) {
+		treap->root = node;
+	} else if (parent->left == old) {
+		parent->left = node;
+	} else {
+		parent->right = node;
+	}
+
+	if (node) {
+		node->parent = parent;
+	}
+}
+
+/// @brief Moves a child above its parent, keeping the order of the nodes.
+static void rotate_up(struct irc_treap *const treap,
+		      struct irc_treap_node *const node)
+{
+	struct irc_treap_node *parent = node->parent;
+
+	link_replace(treap, parent->parent, parent, node);
+
+	if (parent->left == node) {
+		parent->left = node->right;
+
+		if (node->right) {
+			node->right->parent = parent;
+		}
+		node->right = parent;
+	} else {
+		parent->right = node->left;
+
+		if (node->left) {
+			node->left->parent = parent;
+		}
+		node->left = parent;
+	}
+	parent->parent = node;
+}
+
+void irc_treap_init(struct irc_treap *const treap,
+		    const struct irc_treap_conf *const conf)
+{
+	treap->conf = *conf;
+	treap->root = NULL;
+	treap->num_nodes = 0;
+
+	// xorshift needs a state other than 0.
+	do {
+		arc4random_buf(&treap->prio_state, sizeof(treap->prio_state));
+	} while (!treap->prio_state);
+}
+
+void irc_treap_insert(struct irc_treap *const treap,
+		      struct irc_treap_node *const node)
+{
+	const void *key = treap->conf.key(node);
+
+	struct irc_treap_node *parent = NULL;
+	struct irc_treap_node **link = &treap->root;
+
+	while (*link) {
+		parent = *link;
+		link = (treap->conf.cmp(key, parent) < 0) ? &parent->left
+							  : &parent->right;
+	}
+
+	node->parent = parent;
+	node->left = NULL;
+	node->right = NULL;
+	node->prio = prio_next(treap);
+	*link = node;
+
+	while (node->parent && (node->prio > node->parent->prio)) {
+		rotate_up(treap, node);
+	}
+	treap->num_nodes++;
+}
+
+void irc_treap_remove(struct irc_treap *const treap,
+		      struct irc_treap_node *const node)
+{
+	// The node is rotated down until it has a single child to take its
+	// place, always lifting the child with the higher priority.
+	while (node->left && node->right) {
+		rotate_up(treap, (node->left->prio > node->right->prio)
+					 ? node->left
+					 : node->right);
+	}
+
+	link_replace(treap, node->parent, node,
+		     node->left ? node->left : node->right);
+
+	assert(treap->num_nodes);
+	treap->num_nodes--;
+}
+
+struct irc_treap_node *irc_treap_first(const struct irc_treap *const treap)
+{
+	struct irc_treap_node *node = treap->root;
+
+	while (node && node->left) {
+		node = node->left;
+	}
+	return node;
+}
+
+struct irc_treap_node *irc_treap_next(const struct irc_treap_node *node)
+{
+	struct irc_treap_node *next = node->right;
+
+	if (next) {
+		while (next->left) {
+			next = next->left;
+		}
+		return next;
+	}
+
+	while (node->parent && (node->parent->right == node)) {
+		node = node->parent;
+	}
+	return node->parent;
+}
+
+struct irc_treap_node *irc_treap_lower_bound(const struct irc_treap *const treap,
+					     const void *const key)
+{
+	struct irc_treap_node *node = treap->root;
+	struct irc_treap_node *res = NULL;
+
+	while (node) {
+		if (treap->conf.cmp(key, node) <= 0) {
+			res = node;
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+	return res;
+}
+
+struct irc_treap_node *irc_treap_upper_bound(const struct irc_treap *const treap,
+					     const void *const key)
+{
+	struct irc_treap_node *node = treap->root;
+	struct irc_treap_node *res = NULL;
+
+	while (node) {
+		if (treap->conf.cmp(key, node) < 0) {
+			res = node;
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+	return res;
+}
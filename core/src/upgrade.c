@@ -0,0 +1,957 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// close_range(2) is a GNU extension.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/bcast.h"
+#include "core/chan.h"
+#include "core/clock.h"
+#include "core/ctx.h"
+#include "core/hash_table.h"
+#include "core/link.h"
+#include "core/log.h"
+#include "core/mask.h"
+#include "core/metrics.h"
+#include "core/monitor.h"
+#include "core/net.h"
+#include "core/pool.h"
+#include "core/upgrade.h"
+#include "core/user.h"
+#include "core/util.h"
+
+// clang-format off
+
+/// @brief Starts every snapshot.
+#define SNAP_MAGIC              (0x5055564dU)
+
+/// @brief Bumped whenever the layout of snapshots changes. A binary only takes
+/// over from one that writes the same version.
+#define SNAP_VERSION            (1)
+
+/// @brief The size of the largest snapshot taken over.
+#define SNAP_LEN_MAX            ((u64)1 << 34)
+
+/// @brief The initial capacity of a snapshot being written.
+#define SNAP_CAPACITY_MIN       (64 * 1024)
+
+/// @brief The number of file descriptors passed per message at most; the
+/// kernel takes no more than 253.
+#define FDS_PER_MSG             (250)
+
+/// @brief How long either process waits for the other at most, in
+/// milliseconds.
+#define PEER_TIMEOUT_MS         (10000)
+
+// clang-format on
+
+/// @brief A snapshot being written.
+struct snap_out {
+	u8 *data;
+	size_t len;
+	size_t capacity;
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A snapshot being read. Reading past its end clears @ref ok, and
+/// yields zeroes from then on, so that only the outcome has to be checked.
+struct snap_in {
+	const u8 *pos;
+	const u8 *end;
+	bool ok;
+};
+
+#pragma GCC diagnostic pop
+
+static void put(struct snap_out *const out, const void *const data,
+		const size_t len)
+{
+	if ((out->len + len) > out->capacity) {
+		size_t capacity = out->capacity ? out->capacity
+						: SNAP_CAPACITY_MIN;
+
+		while (capacity < (out->len + len)) {
+			capacity *= 2;
+		}
+		out->data = irc_realloc(out->data, capacity);
+		out->capacity = capacity;
+	}
+	memcpy(&out->data[out->len], data, len);
+	out->len += len;
+}
+
+static void put_u8(struct snap_out *const out, const u8 val)
+{
+	put(out, &val, sizeof(val));
+}
+
+static void put_u32(struct snap_out *const out, const u32 val)
+{
+	put(out, &val, sizeof(val));
+}
+
+static void put_u64(struct snap_out *const out, const u64 val)
+{
+	put(out, &val, sizeof(val));
+}
+
+static void put_str(struct snap_out *const out, const char *const str)
+{
+	const size_t len = strlen(str);
+
+	put_u32(out, (u32)len);
+	put(out, str, len);
+}
+
+static void get(struct snap_in *const in, void *const data, const size_t len)
+{
+	if (IRC_UNLIKELY(!in->ok || ((size_t)(in->end - in->pos) < len))) {
+		in->ok = false;
+		memset(data, 0, len);
+		return;
+	}
+	memcpy(data, in->pos, len);
+	in->pos += len;
+}
+
+static u8 get_u8(struct snap_in *const in)
+{
+	u8 val;
+	get(in, &val, sizeof(val));
+
+	return val;
+}
+
+static u32 get_u32(struct snap_in *const in)
+{
+	u32 val;
+	get(in, &val, sizeof(val));
+
+	return val;
+}
+
+static u64 get_u64(struct snap_in *const in)
+{
+	u64 val;
+	get(in, &val, sizeof(val));
+
+	return val;
+}
+
+/// @brief Reads a string into a buffer of a given size, which it has to fit
+/// in along with its terminator.
+static void get_str(struct snap_in *const in, char *const str,
+		    const size_t size)
+{
+	u32 len = get_u32(in);
+
+	if (IRC_UNLIKELY(len >= size)) {
+		in->ok = false;
+		len = 0;
+	}
+	get(in, str, len);
+	str[len] = '\0';
+}
+
+/// @brief Writes the bytes of a send queue still to be written.
+static void sendq_save(struct snap_out *const out,
+		       const struct irc_sendq *const sendq)
+{
+	put_u32(out, (u32)sendq->len);
+
+	for (u32 i = 0; i < sendq->num_entries; ++i) {
+		const struct irc_buf *buf =
+			sendq->entries[(sendq->head + i) &
+				       (sendq->capacity - 1)];
+		const u32 off = i ? 0 : sendq->head_off;
+
+		put(out, &buf->data[off], buf->len - off);
+	}
+}
+
+static void list_save(struct snap_out *const out,
+		      const struct irc_list_walk *const walk)
+{
+	put_u8(out, walk->by_size);
+	put_u8(out, walk->started);
+	put_str(out, walk->mask);
+	put_u32(out, walk->prefix_len);
+	put_u32(out, walk->members_min);
+	put_u32(out, walk->members_max);
+	put_u64(out, walk->created_min);
+	put_u64(out, walk->created_max);
+	put_str(out, walk->name);
+	put_u32(out, walk->size_members);
+	put_u64(out, walk->size_id);
+}
+
+static void user_save(struct snap_out *const out,
+		      const struct irc_user *const user)
+{
+	// Members refer to users by the descriptor they had here.
+	put_u32(out, (u32)user->fd);
+
+	put_u8(out, user->registered);
+	put_u8(out, user->cap_negotiating);
+	put_u8(out, user->closing);
+	put_u8(out, user->evicted);
+	put_u8(out, user->caps);
+	put_u64(out, user->ts);
+
+	put_str(out, user->uid);
+	put_str(out, user->nick);
+	put_str(out, user->username);
+	put_str(out, user->host);
+	put_str(out, user->realname);
+	put_str(out, user->away ? user->away : "");
+
+	put_u8(out, user->recvq_discard);
+	put_u32(out, (u32)user->recvq_len);
+
+	if (user->recvq_len) {
+		put(out, user->recvq, user->recvq_len);
+	}
+
+	sendq_save(out, &user->sendq);
+
+	put_str(out, user->who ? user->who->chan : "");
+	put_u32(out, user->who ? user->who->next_idx : 0);
+
+	put_u8(out, user->list != NULL);
+
+	if (user->list) {
+		list_save(out, user->list);
+	}
+
+	put_u32(out, user->monitor.num_entries);
+
+	for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+		put_str(out, user->monitor.entries[i].target->nick);
+	}
+}
+
+static void chan_save(struct snap_out *const out,
+		      const struct irc_chan *const chan)
+{
+	put_str(out, chan->name);
+	put_u64(out, chan->created);
+
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		const struct irc_mask_set *set = chan->masks[i];
+		const u32 num_masks = set ? set->num_entries : 0;
+
+		put_u32(out, num_masks);
+
+		for (u32 j = 0; j < num_masks; ++j) {
+			put_str(out, set->entries[j]->text);
+			put_str(out, set->entries[j]->setter);
+			put_u64(out, set->entries[j]->set_at);
+		}
+	}
+
+	put_u32(out, chan->members.num_entries);
+
+	for (u32 i = 0; i < chan->members.num_entries; ++i) {
+		const struct irc_member *member = chan->members.entries[i];
+
+		put_u32(out, (u32)member->user->fd);
+		put_u8(out, member->prefix);
+	}
+}
+
+/// @brief Serializes the state of a server, and collects the file descriptors
+/// to pass along with it: the listeners first, then the clients, in the order
+/// they are serialized in.
+///
+/// @param fds Receives the file descriptors, which the caller frees.
+static void snapshot_save(const struct irc_ctx *const ctx,
+			  struct snap_out *const out, int **const fds,
+			  size_t *const num_fds)
+{
+	const struct irc_net *net = &ctx->net;
+
+	*num_fds = 0;
+	*fds = irc_calloc(net->listeners.num_entries + ctx->users.num_entries,
+			  sizeof(**fds));
+
+	put_u32(out, SNAP_MAGIC);
+	put_u32(out, SNAP_VERSION);
+	put_u32(out,
+		(u32)(net->listeners.num_entries + ctx->users.num_entries));
+	put_u32(out, ctx->links.next_uid);
+
+	put_u32(out, (u32)net->listeners.num_entries);
+
+	for (size_t i = 0; i < net->listeners.num_entries; ++i) {
+		const struct irc_net_listener *listener =
+			&net->listeners.entries[i];
+
+		put_u8(out, (u8)listener->type);
+		put_str(out, listener->addr.host);
+		put_str(out, listener->addr.port);
+
+		(*fds)[(*num_fds)++] = listener->fd;
+	}
+
+	put_u32(out, (u32)ctx->users.num_entries);
+
+	for (size_t i = 0; i < ctx->users.capacity; ++i) {
+		const struct irc_ht_entry *entry = &ctx->users.entries[i];
+
+		if (entry->psl) {
+			const struct irc_user *user = entry->val;
+
+			user_save(out, user);
+			(*fds)[(*num_fds)++] = user->fd;
+		}
+	}
+
+	put_u32(out, (u32)ctx->chans.by_name.num_entries);
+
+	for (size_t i = 0; i < ctx->chans.by_name.capacity; ++i) {
+		const struct irc_ht_entry *entry =
+			&ctx->chans.by_name.entries[i];
+
+		if (entry->psl) {
+			chan_save(out, entry->val);
+		}
+	}
+}
+
+static void list_load(struct snap_in *const in,
+		      struct irc_list_walk *const walk)
+{
+	walk->by_size = get_u8(in);
+	walk->started = get_u8(in);
+	get_str(in, walk->mask, sizeof(walk->mask));
+	walk->prefix_len = get_u32(in);
+	walk->members_min = get_u32(in);
+	walk->members_max = get_u32(in);
+	walk->created_min = get_u64(in);
+	walk->created_max = get_u64(in);
+	get_str(in, walk->name, sizeof(walk->name));
+	walk->size_members = get_u32(in);
+	walk->size_id = get_u64(in);
+}
+
+/// @brief Rebuilds a user, connected on a descriptor passed by the previous
+/// process, and files it where the connection of a client would be.
+///
+/// @param by_fd Maps the descriptors the users had in the previous process to
+/// the users.
+static bool user_load(struct irc_ctx *const ctx, struct snap_in *const in,
+		      struct irc_ht *const by_fd, const int fd)
+{
+	struct irc_user *user =
+		irc_pool_calloc(IRC_POOL_USERS, sizeof(struct irc_user));
+	user->fd = fd;
+
+	const u32 prev_fd = get_u32(in);
+
+	user->registered = get_u8(in);
+	user->cap_negotiating = get_u8(in);
+	user->closing = get_u8(in);
+	user->evicted = get_u8(in);
+	user->caps = get_u8(in);
+	user->ts = get_u64(in);
+
+	get_str(in, user->uid, sizeof(user->uid));
+	get_str(in, user->nick, sizeof(user->nick));
+	get_str(in, user->username, sizeof(user->username));
+	get_str(in, user->host, sizeof(user->host));
+	get_str(in, user->realname, sizeof(user->realname));
+
+	// The away message is only allocated once the user is known to be
+	// kept.
+	char away[IRC_USER_AWAY_LEN_MAX + 1];
+
+	get_str(in, away, sizeof(away));
+
+	// A UID kept across the upgrade has to be well formed, and not taken.
+	u64 id;
+
+	if (!in->ok || irc_ht_get(by_fd, (void *)(uintptr_t)prev_fd) ||
+	    ((user->nick[0] != '\0') && irc_ht_get(&ctx->nicks, user->nick)) ||
+	    ((user->uid[0] != '\0') &&
+	     (!irc_link_uid_decode(user->uid, &id) ||
+	      irc_links_user_find(&ctx->links, user->uid)))) {
+		irc_pool_free(IRC_POOL_USERS, user, sizeof(*user));
+		return false;
+	}
+
+	irc_user_away_set(user, away, strlen(away));
+
+	user->cls = irc_classes_match(&ctx->classes, user->host);
+	user->cls->num_users++;
+
+	irc_ht_add(&ctx->users, (void *)(uintptr_t)fd, user);
+	irc_ht_add(by_fd, (void *)(uintptr_t)prev_fd, user);
+
+	if (user->nick[0] != '\0') {
+		irc_ht_add(&ctx->nicks, user->nick, user);
+	}
+
+	if (user->registered) {
+		irc_links_user_add(ctx, user);
+	}
+
+	user->recvq_discard = get_u8(in);
+	user->recvq_len = get_u32(in);
+
+	if (user->recvq_len > IRC_USER_RECVQ_LEN_MAX) {
+		user->recvq_len = 0;
+		return false;
+	}
+
+	if (user->recvq_len) {
+		user->recvq =
+			irc_pool_alloc(IRC_POOL_RECVQS, IRC_USER_RECVQ_LEN_MAX);
+
+		irc_class_recvq_add(&ctx->classes, user->cls,
+				    IRC_USER_RECVQ_LEN_MAX);
+
+		get(in, user->recvq, user->recvq_len);
+	}
+
+	const u32 sendq_len = get_u32(in);
+
+	if (sendq_len > (size_t)(in->end - in->pos)) {
+		return false;
+	}
+
+	if (sendq_len) {
+		struct irc_buf *buf = irc_buf_new(sendq_len);
+
+		get(in, buf->data, sendq_len);
+		irc_sendq_push(&user->sendq, buf);
+
+		irc_class_sendq_add(&ctx->classes, user->cls, sendq_len);
+		irc_user_flush_schedule(ctx, user);
+	}
+
+	char who_chan[IRC_USER_WHO_CHAN_LEN_MAX + 1];
+
+	get_str(in, who_chan, sizeof(who_chan));
+	const u32 who_next_idx = get_u32(in);
+
+	if (who_chan[0] != '\0') {
+		user->who = irc_pool_alloc(IRC_POOL_USERS, sizeof(*user->who));
+		strcpy(user->who->chan, who_chan);
+		user->who->next_idx = who_next_idx;
+
+		user->who_idx = irc_user_list_push(&ctx->who, user);
+	}
+
+	if (get_u8(in)) {
+		user->list =
+			irc_pool_alloc(IRC_POOL_USERS, sizeof(*user->list));
+		list_load(in, user->list);
+
+		user->list_idx = irc_user_list_push(&ctx->list, user);
+	}
+
+	const u32 num_monitors = get_u32(in);
+
+	for (u32 i = 0; in->ok && (i < num_monitors); ++i) {
+		char nick[IRC_USER_NICK_LEN_MAX + 1];
+
+		get_str(in, nick, sizeof(nick));
+
+		if (in->ok &&
+		    (irc_monitor_add(&ctx->monitors, user, nick) !=
+		     IRC_MONITOR_ADDED)) {
+			return false;
+		}
+	}
+	return in->ok;
+}
+
+static bool chan_load(struct irc_ctx *const ctx, struct snap_in *const in,
+		      struct irc_ht *const by_fd)
+{
+	char name[IRC_CHAN_NAME_LEN_MAX + 1];
+
+	get_str(in, name, sizeof(name));
+
+	if (!in->ok || !irc_chan_name_valid(name) ||
+	    irc_chan_find(&ctx->chans, name)) {
+		return false;
+	}
+	struct irc_chan *chan = irc_chan_create(&ctx->chans, name);
+
+	chan->created = get_u64(in);
+
+	// The masks are loaded before anyone joins, so that whether members
+	// are banned is found when it is first needed.
+	for (size_t i = 0; i < IRC_CHAN_MASKS_NUM; ++i) {
+		const u32 num_masks = get_u32(in);
+
+		for (u32 j = 0; in->ok && (j < num_masks); ++j) {
+			char mask[IRC_MASK_LEN_MAX + 1];
+			char setter[IRC_USER_NICK_LEN_MAX + 1];
+
+			get_str(in, mask, sizeof(mask));
+			get_str(in, setter, sizeof(setter));
+
+			const u64 set_at = get_u64(in);
+
+			if (!in->ok) {
+				break;
+			}
+
+			if (!chan->masks[i]) {
+				chan->masks[i] = irc_mask_set_new();
+			}
+			irc_mask_set_add(chan->masks[i], mask, setter, set_at);
+		}
+	}
+
+	const u32 num_members = get_u32(in);
+
+	// A channel is destroyed along with its last member, so there is no
+	// such thing as an empty one.
+	if (!num_members) {
+		return false;
+	}
+
+	for (u32 i = 0; in->ok && (i < num_members); ++i) {
+		const u32 prev_fd = get_u32(in);
+		const u8 prefix = get_u8(in);
+
+		struct irc_user *user =
+			irc_ht_get(by_fd, (void *)(uintptr_t)prev_fd);
+
+		if (!user || irc_chan_member_find(&ctx->chans, chan, user)) {
+			return false;
+		}
+		irc_chan_join(&ctx->chans, chan, user, prefix);
+	}
+	return in->ok;
+}
+
+/// @brief Rebuilds the state of the previous process from its snapshot. What
+/// has been rebuilt of a snapshot that does not load in full is not unwound;
+/// the process exits anyway.
+///
+/// @param fds The descriptors passed along with the snapshot.
+static bool snapshot_load(struct irc_ctx *const ctx, struct snap_in *const in,
+			  const int *const fds, const size_t num_fds)
+{
+	ctx->links.next_uid = get_u32(in);
+
+	const u32 num_listeners = get_u32(in);
+
+	if (!in->ok || (num_listeners > num_fds)) {
+		return false;
+	}
+
+	for (u32 i = 0; i < num_listeners; ++i) {
+		const u8 type = get_u8(in);
+		struct irc_conf_listener addr;
+
+		get_str(in, addr.host, sizeof(addr.host));
+		get_str(in, addr.port, sizeof(addr.port));
+
+		if (!in->ok || (type > IRC_NET_LISTENER_SERVER) ||
+		    !irc_net_listener_adopt(&ctx->net, fds[i],
+					    (enum irc_net_listener_type)type,
+					    &addr)) {
+			return false;
+		}
+	}
+
+	const u32 num_users = get_u32(in);
+
+	if (!in->ok || (num_users != (num_fds - num_listeners))) {
+		return false;
+	}
+
+	// Maps the descriptors users had in the previous process to them, for
+	// the channels to find their members.
+	struct irc_ht by_fd;
+	irc_ht_init(&by_fd, &(struct irc_ht_conf){ .initial_capacity = 4096,
+						    .load_fact_max = 75 });
+
+	// Every table is grown once, rather than as users are filed.
+	irc_ht_reserve(&by_fd, num_users);
+	irc_ht_reserve(&ctx->users, ctx->users.num_entries + num_users);
+	irc_ht_reserve(&ctx->nicks, ctx->nicks.num_entries + num_users);
+	irc_ht_reserve(&ctx->links.users,
+		       ctx->links.users.num_entries + num_users);
+
+	bool ok = true;
+
+	for (u32 i = 0; ok && (i < num_users); ++i) {
+		const int fd = fds[num_listeners + i];
+
+		ok = user_load(ctx, in, &by_fd, fd) &&
+		     irc_net_client_adopt(&ctx->net, fd);
+	}
+
+	const u32 num_chans = ok ? get_u32(in) : 0;
+
+	for (u32 i = 0; ok && (i < num_chans); ++i) {
+		ok = chan_load(ctx, in, &by_fd);
+	}
+	irc_ht_destroy(&by_fd);
+
+	if (!ok || !in->ok || (in->pos != in->end)) {
+		return false;
+	}
+	IRC_METRIC_GAUGE_ADD(&ctx->metrics, IRC_METRIC_CLIENTS, (i64)num_users);
+
+	return true;
+}
+
+/// @brief Has blocking operations on a socket to the other process give up if
+/// it stops responding.
+static void sock_timeout_set(const int sock)
+{
+	const struct timeval tv = {
+		.tv_sec = PEER_TIMEOUT_MS / 1000,
+		.tv_usec = (PEER_TIMEOUT_MS % 1000) * 1000
+	};
+
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static bool send_all(const int sock, const void *const data, const size_t len)
+{
+	for (size_t done = 0; done < len;) {
+		const ssize_t cnt = send(sock, (const u8 *)data + done,
+					 len - done, MSG_NOSIGNAL);
+
+		if (cnt < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		done += (size_t)cnt;
+	}
+	return true;
+}
+
+static bool recv_all(const int sock, void *const data, const size_t len)
+{
+	for (size_t done = 0; done < len;) {
+		const ssize_t cnt =
+			recv(sock, (u8 *)data + done, len - done, 0);
+
+		if (cnt <= 0) {
+			if ((cnt < 0) && (errno == EINTR)) {
+				continue;
+			}
+			return false;
+		}
+		done += (size_t)cnt;
+	}
+	return true;
+}
+
+/// @brief The control message passing a batch of file descriptors.
+union fds_ctl {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(FDS_PER_MSG * sizeof(int))];
+};
+
+/// @brief Passes file descriptors in batches, each carried by a single byte
+/// holding the number of descriptors in the batch.
+static bool fds_send(const int sock, const int *const fds, const size_t num)
+{
+	for (size_t i = 0; i < num; i += FDS_PER_MSG) {
+		const size_t batch =
+			((num - i) < FDS_PER_MSG) ? (num - i) : FDS_PER_MSG;
+
+		u8 cnt = (u8)batch;
+		struct iovec iov = { .iov_base = &cnt, .iov_len = sizeof(cnt) };
+		union fds_ctl ctl = {};
+
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = ctl.buf,
+			.msg_controllen = CMSG_SPACE(batch * sizeof(int))
+		};
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(batch * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fds[i], batch * sizeof(int));
+
+		if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(cnt)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool fds_recv(const int sock, int *const fds, const size_t num)
+{
+	for (size_t i = 0; i < num;) {
+		u8 cnt = 0;
+		struct iovec iov = { .iov_base = &cnt, .iov_len = sizeof(cnt) };
+		union fds_ctl ctl;
+
+		struct msghdr msg = { .msg_iov = &iov,
+				      .msg_iovlen = 1,
+				      .msg_control = ctl.buf,
+				      .msg_controllen = sizeof(ctl.buf) };
+
+		// Descriptors that do not fit in the control message, e.g. for
+		// lack of room in the table of open files, are dropped by the
+		// kernel, which flags the message as truncated.
+		if ((recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(cnt)) ||
+		    (msg.msg_flags & MSG_CTRUNC)) {
+			return false;
+		}
+		const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+		if (!cmsg || (cmsg->cmsg_level != SOL_SOCKET) ||
+		    (cmsg->cmsg_type != SCM_RIGHTS) ||
+		    (cmsg->cmsg_len != CMSG_LEN(cnt * sizeof(int))) ||
+		    (cnt > (num - i))) {
+			return false;
+		}
+		memcpy(&fds[i], CMSG_DATA(cmsg), cnt * sizeof(int));
+		i += cnt;
+	}
+	return true;
+}
+
+/// @brief Closes every link to another server. Their state is not carried
+/// over; the new process links up again on its own.
+static void links_close(struct irc_ctx *const ctx)
+{
+	// A closed link is removed by moving the last one into its place.
+	while (ctx->links.num_entries) {
+		const struct irc_link *link =
+			ctx->links.entries[ctx->links.num_entries - 1];
+
+		irc_net_close(&ctx->net, link->fd);
+	}
+}
+
+/// @brief Starts the new binary, with one end of a socket pair as
+/// @ref IRC_UPGRADE_FD.
+///
+/// @returns The process of the new binary, or -1 if it could not be started.
+static pid_t child_start(struct irc_ctx *const ctx, const int sock)
+{
+	char *const *argv = ctx->upgrade.argv;
+
+	// Only async-signal-safe functions may be called in the child of a
+	// multithreaded process, which setenv(3) is not.
+	if (setenv(IRC_UPGRADE_ENV, "1", 1) < 0) {
+		IRC_LOG_ERR(&ctx->log, "upgrade: setenv() failed: %s",
+			    strerror(errno));
+		return -1;
+	}
+	const pid_t pid = fork();
+
+	if (!pid) {
+		// dup2(2) clears the close-on-exec flag of the copy, but
+		// leaves a descriptor copied onto itself alone.
+		const int err = (sock == IRC_UPGRADE_FD)
+					? fcntl(sock, F_SETFD, 0)
+					: dup2(sock, IRC_UPGRADE_FD);
+
+		// The listeners and clients are passed explicitly, and nothing
+		// else is inherited.
+		if (err >= 0) {
+			close_range(IRC_UPGRADE_FD + 1, ~0U, 0);
+			execvp(argv[0], argv);
+		}
+		_exit(EXIT_FAILURE);
+	}
+	unsetenv(IRC_UPGRADE_ENV);
+
+	if (pid < 0) {
+		IRC_LOG_ERR(&ctx->log, "upgrade: fork() failed: %s",
+			    strerror(errno));
+	}
+	return pid;
+}
+
+/// @brief Sends a snapshot and the descriptors that go with it, and waits for
+/// the new process to acknowledge that it took over.
+static bool handover(const int sock, const struct snap_out *const out,
+		     const int *const fds, const size_t num_fds)
+{
+	const u64 len = out->len;
+	u8 ack = 0;
+
+	return send_all(sock, &len, sizeof(len)) &&
+	       send_all(sock, out->data, out->len) &&
+	       fds_send(sock, fds, num_fds) &&
+	       recv_all(sock, &ack, sizeof(ack));
+}
+
+bool irc_upgrade_send(struct irc_ctx *const ctx, const int sock)
+{
+	struct snap_out out = {};
+	int *fds;
+	size_t num_fds;
+
+	snapshot_save(ctx, &out, &fds, &num_fds);
+	sock_timeout_set(sock);
+
+	const bool ok = handover(sock, &out, fds, num_fds);
+
+	free(out.data);
+	free(fds);
+
+	return ok;
+}
+
+void irc_upgrade(struct irc_ctx *const ctx)
+{
+	if (!ctx->upgrade.argv) {
+		IRC_LOG_ERR(&ctx->log, "upgrade: no binary to upgrade to");
+		return;
+	}
+	const u64 start_ns = irc_clock_mono_ns();
+
+	IRC_LOG_INFO(&ctx->log, "upgrade: starting %s", ctx->upgrade.argv[0]);
+
+	links_close(ctx);
+
+	// Deferred broadcasts are delivered rather than carried over. Whatever
+	// clients do not take in right away is carried over in their send
+	// queues.
+	while (ctx->chans.backlog.head) {
+		irc_bcast_backlog_run(ctx);
+		irc_users_flush(ctx);
+	}
+	irc_users_flush(ctx);
+
+	int socks[2] = { -1, -1 };
+	pid_t pid = -1;
+	bool ok = !socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks);
+
+	if (ok) {
+		pid = child_start(ctx, socks[1]);
+		close(socks[1]);
+
+		ok = (pid > 0) && irc_upgrade_send(ctx, socks[0]);
+	}
+
+	if (ok) {
+		IRC_LOG_INFO(&ctx->log,
+			     "upgrade: handed %zu clients over to process %d "
+			     "in %" PRIu64 " us",
+			     ctx->users.num_entries, (int)pid,
+			     (irc_clock_mono_ns() - start_ns) / 1000);
+		exit(EXIT_SUCCESS);
+	}
+	IRC_LOG_ERR(&ctx->log, "upgrade: the new binary did not take over");
+
+	if (pid > 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+
+	if (socks[0] >= 0) {
+		close(socks[0]);
+	}
+}
+
+void irc_upgrade_request(struct irc_ctx *const ctx)
+{
+	atomic_store_explicit(&ctx->upgrade.pending, true,
+			      memory_order_relaxed);
+}
+
+bool irc_upgrade_recv(struct irc_ctx *const ctx, const int sock)
+{
+	const u64 start_ns = irc_clock_mono_ns();
+
+	sock_timeout_set(sock);
+
+	u64 len = 0;
+
+	if (!recv_all(sock, &len, sizeof(len)) || (len > SNAP_LEN_MAX)) {
+		IRC_LOG_ERR(&ctx->log, "upgrade: no snapshot received");
+		return false;
+	}
+	u8 *data = irc_malloc((size_t)len);
+
+	struct snap_in in = { .pos = data,
+			      .end = data + len,
+			      .ok = recv_all(sock, data, (size_t)len) };
+
+	const u32 magic = get_u32(&in);
+	const u32 version = get_u32(&in);
+	const u32 num_fds = get_u32(&in);
+
+	if (!in.ok || (magic != SNAP_MAGIC) || (version != SNAP_VERSION)) {
+		IRC_LOG_ERR(&ctx->log, "upgrade: unknown snapshot version");
+		free(data);
+		return false;
+	}
+	int *fds = irc_calloc(num_fds, sizeof(*fds));
+
+	const bool ok = fds_recv(sock, fds, num_fds) &&
+			snapshot_load(ctx, &in, fds, num_fds);
+
+	free(fds);
+	free(data);
+
+	const u8 ack = 1;
+
+	if (!ok || !send_all(sock, &ack, sizeof(ack))) {
+		IRC_LOG_ERR(&ctx->log, "upgrade: unable to take over");
+		return false;
+	}
+
+	IRC_LOG_INFO(&ctx->log, "upgrade: took over %zu clients in %" PRIu64
+		     " us", ctx->users.num_entries,
+		     (irc_clock_mono_ns() - start_ns) / 1000);
+	return true;
+}
+
+bool irc_upgrade_resume(struct irc_ctx *const ctx)
+{
+	if (!irc_upgrade_recv(ctx, IRC_UPGRADE_FD)) {
+		return false;
+	}
+	close(IRC_UPGRADE_FD);
+	return true;
+}
@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/class.h"
+#include "core/ctx.h"
+#include "core/metrics.h"
+#include "core/monitor.h"
+#include "core/net.h"
+#include "core/pool.h"
+#include "core/user.h"
+#include "core/util.h"
+
+/// @brief The number of entries a user list starts out with.
+#define USER_LIST_CAPACITY_MIN (64)
+
+bool irc_user_nick_valid(const char *const nick)
+{
+	// Letters, digits and "[]\`_^{|}-", not starting with a digit or "-".
+	static const char special[] = "[]\\`_^{|}";
+
+	if ((nick[0] == '\0') ||
+	    (!isalpha((u8)nick[0]) && !strchr(special, nick[0]))) {
+		return false;
+	}
+
+	size_t len = 1;
+
+	for (; nick[len] != '\0'; ++len) {
+		if (!isalnum((u8)nick[len]) && !strchr(special, nick[len]) &&
+		    (nick[len] != '-')) {
+			return false;
+		}
+	}
+	return len <= IRC_USER_NICK_LEN_MAX;
+}
+
+u32 irc_user_list_push(struct irc_user_list *const list,
+		       struct irc_user *const user)
+{
+	if (list->num_entries == list->capacity) {
+		list->capacity = list->capacity ? (list->capacity * 2)
+						: USER_LIST_CAPACITY_MIN;
+
+		list->entries = irc_realloc(
+			list->entries, list->capacity * sizeof(*list->entries));
+	}
+	list->entries[list->num_entries] = user;
+	return list->num_entries++;
+}
+
+struct irc_user *irc_user_list_remove(struct irc_user_list *const list,
+				      const u32 idx)
+{
+	struct irc_user *last = list->entries[--list->num_entries];
+
+	if (idx == list->num_entries) {
+		return NULL;
+	}
+	list->entries[idx] = last;
+	return last;
+}
+
+void irc_user_list_free(struct irc_user_list *const list)
+{
+	free(list->entries);
+	*list = (struct irc_user_list){};
+}
+
+/// @brief Disconnects a user that exceeded the limits of its class. Its send
+/// queue is dropped on the spot, which only costs as much as queueing it did,
+/// and the connection is closed once the error has been given a chance to be
+/// written out.
+static void user_evict(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	struct irc_class *cls = user->cls;
+
+	cls->num_evicted++;
+
+	user->evicted = true;
+	user->closing = true;
+
+	// The error is only legible at the start of a line, which is not where
+	// a partly written line leaves the connection.
+	const bool partial = user->sendq.head_off;
+
+	irc_class_sendq_sub(&ctx->classes, cls, user->sendq.len);
+	irc_sendq_clear(&user->sendq);
+
+	if (!partial) {
+		struct irc_buf *buf =
+			irc_buf_fmt(NULL, "ERROR :Closing Link: %s (%s)",
+				    user->host, IRC_USER_EVICT_REASON);
+
+		irc_class_sendq_add(&ctx->classes, cls, buf->len);
+		irc_sendq_push(&user->sendq, buf);
+	}
+
+	// Even with nothing left to say, the connection is closed by the
+	// flush.
+	if (!user->flush_pending) {
+		user->flush_pending = true;
+		user->flush_idx = irc_user_list_push(&ctx->flush, user);
+	}
+}
+
+/// @brief Checks that a user may be queued another `len` bytes, and evicts it
+/// if not.
+///
+/// @returns `true` if the bytes may be queued, or `false` otherwise.
+static bool sendq_admit(struct irc_ctx *const ctx, struct irc_user *const user,
+			const size_t len)
+{
+	const struct irc_class *cls = user->cls;
+
+	if (!cls) {
+		return true;
+	}
+
+	if (IRC_UNLIKELY(user->evicted)) {
+		return false;
+	}
+	const size_t queued = user->sendq.len + len;
+
+	// Past the budget, only users that are keeping up are sent more.
+	if (IRC_LIKELY((queued <= cls->conf.sendq_max) &&
+		       ((queued <= IRC_CLASS_BACKLOG_MIN) ||
+			!irc_classes_over_budget(&ctx->classes)))) {
+		irc_class_sendq_add(&ctx->classes, user->cls, len);
+		return true;
+	}
+	user_evict(ctx, user);
+	return false;
+}
+
+void irc_user_send(struct irc_ctx *const ctx, struct irc_user *const user,
+		   struct irc_buf *const buf)
+{
+	// Users of other servers are reached through their server, by the
+	// server protocol; see link.h.
+	if (IRC_UNLIKELY(user->server || !sendq_admit(ctx, user, buf->len))) {
+		return;
+	}
+	IRC_METRIC_INC(&ctx->metrics, IRC_METRIC_LINES_OUT);
+
+	irc_sendq_push(&user->sendq, irc_buf_ref(buf));
+	irc_user_flush_schedule(ctx, user);
+}
+
+void irc_user_send_split(struct irc_ctx *const ctx, struct irc_user *const user,
+			 struct irc_buf *const head, struct irc_buf *const body)
+{
+	if (IRC_UNLIKELY(user->server ||
+			 !sendq_admit(ctx, user, head->len + body->len))) {
+		return;
+	}
+	IRC_METRIC_INC(&ctx->metrics, IRC_METRIC_LINES_OUT);
+
+	irc_sendq_push(&user->sendq, irc_buf_ref(head));
+	irc_sendq_push(&user->sendq, irc_buf_ref(body));
+	irc_user_flush_schedule(ctx, user);
+}
+
+void irc_user_flush_schedule(struct irc_ctx *const ctx,
+			     struct irc_user *const user)
+{
+	if (!user->flush_pending && user->sendq.num_entries) {
+		user->flush_pending = true;
+		user->flush_idx = irc_user_list_push(&ctx->flush, user);
+	}
+}
+
+IRC_ATTRIB_FMT(printf, 3, 4)
+void irc_user_sendf(struct irc_ctx *const ctx, struct irc_user *const user,
+		    const char *const fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	struct irc_buf *buf = irc_buf_vfmt(NULL, fmt, args);
+
+	va_end(args);
+
+	irc_user_send(ctx, user, buf);
+	irc_buf_unref(buf);
+}
+
+static void user_flush(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	const size_t prev = user->sendq.len;
+	const enum irc_sendq_status status =
+		irc_sendq_flush(&user->sendq, &ctx->net, user->fd);
+
+	if (user->cls) {
+		irc_class_sendq_sub(&ctx->classes, user->cls,
+				    prev - user->sendq.len);
+	}
+
+	switch (status) {
+	case IRC_SENDQ_EMPTY:
+		if (user->closing) {
+			irc_net_close(&ctx->net, user->fd);
+		}
+		return;
+	case IRC_SENDQ_BLOCKED:
+		// The rest is written once the socket becomes writable, unless
+		// the user has been evicted; it would hardly read it now.
+		if (IRC_UNLIKELY(user->evicted)) {
+			irc_net_close(&ctx->net, user->fd);
+		}
+		return;
+	case IRC_SENDQ_ERR:
+	default:
+		irc_net_close(&ctx->net, user->fd);
+		return;
+	}
+}
+
+void irc_users_flush(struct irc_ctx *const ctx)
+{
+	// Users are taken off the list before being flushed, so that a user
+	// disconnected by the flush is no longer on it. Users sent to while
+	// flushing are appended, and flushed in the same pass.
+	while (ctx->flush.num_entries) {
+		struct irc_user *user =
+			ctx->flush.entries[--ctx->flush.num_entries];
+
+		user->flush_pending = false;
+		user_flush(ctx, user);
+	}
+}
+
+void irc_user_away_set(struct irc_user *const user, const char *const text,
+		       size_t len)
+{
+	if (user->away) {
+		irc_pool_free(IRC_POOL_USERS, user->away, strlen(user->away) + 1);
+		user->away = NULL;
+	}
+
+	if (len) {
+		// Overlong messages are truncated, like usernames.
+		if (len > IRC_USER_AWAY_LEN_MAX) {
+			len = IRC_USER_AWAY_LEN_MAX;
+		}
+		user->away = irc_pool_alloc(IRC_POOL_USERS, len + 1);
+		memcpy(user->away, text, len);
+		user->away[len] = '\0';
+	}
+}
+
+void irc_user_release(struct irc_ctx *const ctx, struct irc_user *const user)
+{
+	struct irc_user *moved;
+
+	if (user->flush_pending) {
+		moved = irc_user_list_remove(&ctx->flush, user->flush_idx);
+
+		if (moved) {
+			moved->flush_idx = user->flush_idx;
+		}
+	}
+
+	if (user->who) {
+		moved = irc_user_list_remove(&ctx->who, user->who_idx);
+
+		if (moved) {
+			moved->who_idx = user->who_idx;
+		}
+		irc_pool_free(IRC_POOL_USERS, user->who, sizeof(*user->who));
+		user->who = NULL;
+	}
+
+	if (user->list) {
+		moved = irc_user_list_remove(&ctx->list, user->list_idx);
+
+		if (moved) {
+			moved->list_idx = user->list_idx;
+		}
+		irc_pool_free(IRC_POOL_USERS, user->list, sizeof(*user->list));
+		user->list = NULL;
+	}
+	irc_user_away_set(user, NULL, 0);
+	irc_monitor_clear(&ctx->monitors, user);
+
+	if (user->cls) {
+		irc_class_sendq_sub(&ctx->classes, user->cls, user->sendq.len);
+
+		if (user->recvq) {
+			irc_class_recvq_sub(&ctx->classes, user->cls,
+					    IRC_USER_RECVQ_LEN_MAX);
+		}
+		user->cls->num_users--;
+		user->cls = NULL;
+	}
+	irc_sendq_clear(&user->sendq);
+
+	if (user->recvq) {
+		irc_pool_free(IRC_POOL_RECVQS, user->recvq,
+			      IRC_USER_RECVQ_LEN_MAX);
+		user->recvq = NULL;
+	}
+}
@@ -44,3 +44,13 @@ void *irc_calloc(const size_t nmemb, const size_t size)
 	}
 	return ptr;
 }
+
+void *irc_realloc(void *const ptr, const size_t size)
+{
+	void *new_ptr = realloc(ptr, size);
+
+	if (IRC_UNLIKELY(!new_ptr)) {
+		abort();
+	}
+	return new_ptr;
+}
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "core/compiler.h"
+#include "core/util.h"
+#include "core/vmem.h"
+
+static const char *const mode_names[IRC_VMEM_MODE_NUM] = {
+	// clang-format off
+
+	[IRC_VMEM_HEAP]         = "heap",
+	[IRC_VMEM_PAGES]        = "pages",
+	[IRC_VMEM_THP]          = "thp",
+	[IRC_VMEM_HUGETLB]      = "hugetlb"
+
+	// clang-format on
+};
+
+/// @brief The number of bytes currently backed in each mode.
+static u64 mode_bytes[IRC_VMEM_MODE_NUM];
+
+/// @brief The number of times the huge page pool could not back an array.
+static u64 num_fallbacks;
+
+static void account(const enum irc_vmem_mode mode, const u64 num_bytes)
+{
+	// Frees add the two's complement.
+	__atomic_fetch_add(&mode_bytes[mode], num_bytes, __ATOMIC_RELAXED);
+}
+
+static size_t round_up(const size_t size, const size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+static void *map(const size_t len, const int flags)
+{
+	void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+	return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+/// @brief Maps a region starting on a huge page boundary, which the kernel
+/// can only back with huge pages from there on.
+static void *map_aligned(const size_t len)
+{
+	u8 *raw = map(len + IRC_VMEM_HUGE_PAGE_SIZE, 0);
+
+	if (IRC_UNLIKELY(!raw)) {
+		abort();
+	}
+
+	const uintptr_t addr = (uintptr_t)raw;
+	const size_t head = round_up(addr, IRC_VMEM_HUGE_PAGE_SIZE) - addr;
+	u8 *start = raw + head;
+
+	// Gives back what lies outside of the aligned region.
+	if (head) {
+		munmap(raw, head);
+	}
+	munmap(start + len, IRC_VMEM_HUGE_PAGE_SIZE - head);
+
+	return start;
+}
+
+void irc_vmem_alloc(struct irc_vmem *const vm, const size_t size,
+		    enum irc_vmem_mode mode)
+{
+	if ((mode == IRC_VMEM_HEAP) || (size < IRC_VMEM_MAP_MIN)) {
+		vm->ptr = irc_calloc(1, size);
+		vm->len = 0;
+		vm->mode = IRC_VMEM_HEAP;
+		return;
+	}
+
+	void *ptr = NULL;
+	size_t len = round_up(size, IRC_VMEM_HUGE_PAGE_SIZE);
+
+	if (mode == IRC_VMEM_HUGETLB) {
+#ifdef MAP_HUGETLB
+		ptr = map(len, MAP_HUGETLB);
+#endif
+		if (!ptr) {
+			__atomic_fetch_add(&num_fallbacks, 1, __ATOMIC_RELAXED);
+			mode = IRC_VMEM_THP;
+		}
+	}
+
+	if (mode == IRC_VMEM_THP) {
+		ptr = map_aligned(len);
+#ifdef MADV_HUGEPAGE
+		madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+	} else if (mode == IRC_VMEM_PAGES) {
+		len = round_up(size, (size_t)sysconf(_SC_PAGESIZE));
+		ptr = map(len, 0);
+
+		if (IRC_UNLIKELY(!ptr)) {
+			abort();
+		}
+#ifdef MADV_NOHUGEPAGE
+		madvise(ptr, len, MADV_NOHUGEPAGE);
+#endif
+	}
+
+	vm->ptr = ptr;
+	vm->len = len;
+	vm->mode = mode;
+
+	account(mode, len);
+}
+
+void irc_vmem_free(struct irc_vmem *const vm)
+{
+	if (vm->len) {
+		munmap(vm->ptr, vm->len);
+		account(vm->mode, -(u64)vm->len);
+	} else {
+		free(vm->ptr);
+	}
+	*vm = (struct irc_vmem){};
+}
+
+bool irc_vmem_mode_parse(const char *const name,
+			 enum irc_vmem_mode *const mode)
+{
+	for (u32 i = 0; i < IRC_VMEM_MODE_NUM; ++i) {
+		if (!strcmp(name, mode_names[i])) {
+			*mode = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *irc_vmem_mode_name(const enum irc_vmem_mode mode)
+{
+	return mode_names[mode];
+}
+
+void irc_vmem_report(const irc_vmem_emit_cb emit, void *const udata)
+{
+	char line[128];
+	int len;
+
+	// Heap arrays are not counted; the allocator owns them.
+	for (u32 i = IRC_VMEM_PAGES; i < IRC_VMEM_MODE_NUM; ++i) {
+		len = snprintf(line, sizeof(line), "vmem %s %" PRIu64 " bytes",
+			       mode_names[i],
+			       __atomic_load_n(&mode_bytes[i],
+					       __ATOMIC_RELAXED));
+		emit(udata, line, (size_t)len);
+	}
+
+	len = snprintf(line, sizeof(line), "vmem hugetlb %" PRIu64 " fallbacks",
+		       __atomic_load_n(&num_fallbacks, __ATOMIC_RELAXED));
+	emit(udata, line, (size_t)len);
+}
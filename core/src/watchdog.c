@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef IRC_HAVE_EXECINFO
+#include <execinfo.h>
+#endif // IRC_HAVE_EXECINFO
+
+#include "core/clock.h"
+#include "core/watchdog.h"
+
+// clang-format off
+
+/// @brief How long to wait for the I/O thread to capture its backtrace.
+#define BT_WAIT_NS              (100 * 1000 * 1000)
+
+/// @brief The shortest interval between two checks.
+#define CHECK_INTERVAL_NS_MIN   (1000 * 1000)
+
+// clang-format on
+
+static struct irc_watchdog *active_wd;
+
+static void bt_capture(const int sig)
+{
+	(void)sig;
+
+	struct irc_watchdog *const wd = active_wd;
+
+	const int saved_errno = errno;
+
+#ifdef IRC_HAVE_EXECINFO
+	const int len = backtrace(wd->bt, IRC_WATCHDOG_BT_DEPTH_MAX);
+#else
+	const int len = 0;
+#endif // IRC_HAVE_EXECINFO
+
+	atomic_store_explicit(&wd->bt_len, len, memory_order_release);
+	errno = saved_errno;
+}
+
+static void sleep_ns(const u64 ns)
+{
+	struct timespec ts = {
+		.tv_sec = (time_t)(ns / 1000000000),
+		.tv_nsec = (long)(ns % 1000000000)
+	};
+
+	while (nanosleep(&ts, &ts) && (errno == EINTR)) {
+	}
+}
+
+static void bt_report(struct irc_watchdog *const wd)
+{
+	atomic_store_explicit(&wd->bt_len, -1, memory_order_relaxed);
+
+	if (pthread_kill(wd->io_thread, IRC_WATCHDOG_SIGNAL)) {
+		return;
+	}
+
+	int len = -1;
+
+	for (u64 waited = 0; waited < BT_WAIT_NS;
+	     waited += CHECK_INTERVAL_NS_MIN) {
+		len = atomic_load_explicit(&wd->bt_len, memory_order_acquire);
+
+		if (len >= 0) {
+			break;
+		}
+		sleep_ns(CHECK_INTERVAL_NS_MIN);
+	}
+
+	if (len <= 0) {
+		IRC_LOG_WARN(wd->log, "watchdog: no backtrace captured");
+		return;
+	}
+
+#ifdef IRC_HAVE_EXECINFO
+	// Symbolizing allocates, which is why it is done here rather than in
+	// the signal handler.
+	char **syms = backtrace_symbols(wd->bt, len);
+
+	for (int i = 0; i < len; ++i) {
+		IRC_LOG_WARN(wd->log, "watchdog:   #%d %s", i,
+			     syms ? syms[i] : "?");
+	}
+	free(syms);
+#endif // IRC_HAVE_EXECINFO
+}
+
+static void check(struct irc_watchdog *const wd)
+{
+	const u64 busy_since = atomic_load_explicit(&wd->prof->busy_since,
+						    memory_order_relaxed);
+	const u64 iter = atomic_load_explicit(&wd->prof->num_iters,
+					      memory_order_acquire);
+
+	if (!busy_since || (iter == wd->reported_iter)) {
+		return;
+	}
+
+	const u64 busy_ns = irc_clock_mono_ns() - busy_since;
+
+	if (busy_ns < wd->threshold_ns) {
+		return;
+	}
+
+	const enum irc_prof_phase phase = (enum irc_prof_phase)
+		atomic_load_explicit(&wd->prof->phase, memory_order_relaxed);
+
+	wd->reported_iter = iter;
+
+	IRC_LOG_WARN(wd->log,
+		     "watchdog: I/O loop stalled for %" PRIu64
+		     " ms in phase %s",
+		     busy_ns / 1000000,
+		     irc_prof_phase_name(phase));
+
+	bt_report(wd);
+}
+
+static void *watchdog_main(void *const arg)
+{
+	struct irc_watchdog *const wd = arg;
+
+	irc_log_thread_nowait();
+
+	// Check often enough that a stall is reported within one and a half
+	// times the threshold.
+	u64 interval = wd->threshold_ns / 2;
+
+	if (interval < CHECK_INTERVAL_NS_MIN) {
+		interval = CHECK_INTERVAL_NS_MIN;
+	}
+
+	for (;;) {
+		sleep_ns(interval);
+		check(wd);
+	}
+	return NULL;
+}
+
+bool irc_watchdog_start(struct irc_watchdog *const wd,
+			struct irc_prof *const prof,
+			struct irc_log *const logger, const uint threshold_ms)
+{
+	wd->prof = prof;
+	wd->log = logger;
+	wd->threshold_ns = (u64)threshold_ms * 1000000;
+	wd->reported_iter = UINT64_MAX;
+	wd->io_thread = pthread_self();
+
+	active_wd = wd;
+
+#ifdef IRC_HAVE_EXECINFO
+	// The first call to backtrace() loads the unwinder, which is not safe
+	// to do from a signal handler.
+	backtrace(wd->bt, 1);
+#endif // IRC_HAVE_EXECINFO
+
+	struct sigaction sa = {};
+
+	sa.sa_handler = &bt_capture;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	if (IRC_UNLIKELY(sigaction(IRC_WATCHDOG_SIGNAL, &sa, NULL) < 0)) {
+		IRC_LOG_ERR(logger, "watchdog: sigaction() failed: %s",
+			    strerror(errno));
+		return false;
+	}
+
+	const int err = pthread_create(&wd->thread, NULL, &watchdog_main, wd);
+
+	if (IRC_UNLIKELY(err)) {
+		IRC_LOG_ERR(logger, "watchdog: pthread_create() failed: %s",
+			    strerror(err));
+		return false;
+	}
+
+	IRC_LOG_INFO(logger, "watchdog: started with a threshold of %u ms",
+		     threshold_ms);
+	return true;
+}
@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdlib.h>
+
+#ifdef IRC_HAVE_ZLIB
+#include <zlib.h>
+#endif // IRC_HAVE_ZLIB
+
+#include "core/buf.h"
+#include "core/clock.h"
+#include "core/util.h"
+#include "core/zip.h"
+
+#ifdef IRC_HAVE_ZLIB
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+struct irc_zip {
+	z_stream strm;
+
+	/// @brief The buffer compressed output is being written to, or
+	/// `NULL`.
+	struct irc_buf *out;
+
+	/// @brief Set if the stream decompresses.
+	bool inflater;
+
+	/// @brief Set if data has been compressed since the last flush.
+	bool pending;
+
+	struct irc_zip_stats stats;
+};
+
+#pragma GCC diagnostic pop
+
+bool irc_zip_supported(void)
+{
+	return true;
+}
+
+struct irc_zip *irc_zip_deflater_new(void)
+{
+	struct irc_zip *zip = irc_calloc(1, sizeof(*zip));
+
+	if (IRC_UNLIKELY(deflateInit(&zip->strm, IRC_ZIP_LEVEL) != Z_OK)) {
+		free(zip);
+		return NULL;
+	}
+	return zip;
+}
+
+struct irc_zip *irc_zip_inflater_new(void)
+{
+	struct irc_zip *zip = irc_calloc(1, sizeof(*zip));
+
+	zip->inflater = true;
+
+	if (IRC_UNLIKELY(inflateInit(&zip->strm) != Z_OK)) {
+		free(zip);
+		return NULL;
+	}
+	return zip;
+}
+
+void irc_zip_free(struct irc_zip *const zip)
+{
+	if (!zip) {
+		return;
+	}
+
+	if (zip->inflater) {
+		inflateEnd(&zip->strm);
+	} else {
+		deflateEnd(&zip->strm);
+	}
+	if (zip->out) {
+		irc_buf_unref(zip->out);
+	}
+	free(zip);
+}
+
+/// @brief Queues the buffer compressed output is being written to.
+static void out_queue(struct irc_zip *const zip, struct irc_sendq *const sendq)
+{
+	struct irc_buf *buf = zip->out;
+
+	zip->out = NULL;
+
+	// Flushed output is usually small; it is not worth holding on to a
+	// whole buffer for.
+	if (buf->len < (IRC_ZIP_BUF_SIZE / 2)) {
+		buf = irc_buf_shrink(buf);
+	}
+	irc_sendq_push(sendq, buf);
+}
+
+void irc_zip_deflate(struct irc_zip *const zip, const char *const data,
+		     const size_t len, const bool flush,
+		     struct irc_sendq *const sendq)
+{
+	if (!len && (!flush || !zip->pending)) {
+		return;
+	}
+	const u64 start = irc_clock_thread_cpu_ns();
+
+	zip->strm.next_in = (Bytef *)(uintptr_t)data;
+	zip->strm.avail_in = (uInt)len;
+
+	// Whatever input is left once the output stops filling up its buffer
+	// has been taken in.
+	do {
+		if (!zip->out) {
+			zip->out = irc_buf_new(IRC_ZIP_BUF_SIZE);
+			zip->out->len = 0;
+		}
+		const uInt avail = IRC_ZIP_BUF_SIZE - zip->out->len;
+
+		zip->strm.next_out = (Bytef *)&zip->out->data[zip->out->len];
+		zip->strm.avail_out = avail;
+
+		// Only fails on a corrupt stream, or with no progress to make.
+		(void)deflate(&zip->strm, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+
+		const uInt produced = avail - zip->strm.avail_out;
+
+		zip->out->len += produced;
+		zip->stats.wire_bytes += produced;
+
+		if (zip->out->len == IRC_ZIP_BUF_SIZE) {
+			out_queue(zip, sendq);
+		}
+	} while (!zip->strm.avail_out);
+
+	if (flush && zip->out && zip->out->len) {
+		out_queue(zip, sendq);
+	}
+	zip->pending = !flush;
+	zip->stats.plain_bytes += len;
+	zip->stats.cpu_ns += irc_clock_thread_cpu_ns() - start;
+}
+
+IRC_NODISCARD bool irc_zip_inflate(struct irc_zip *const zip,
+				   const char *const data, const size_t len,
+				   const irc_zip_out_cb out, void *const udata)
+{
+	char buf[IRC_ZIP_BUF_SIZE];
+
+	zip->strm.next_in = (Bytef *)(uintptr_t)data;
+	zip->strm.avail_in = (uInt)len;
+	zip->stats.wire_bytes += len;
+
+	do {
+		zip->strm.next_out = (Bytef *)buf;
+		zip->strm.avail_out = sizeof(buf);
+
+		// The time spent on the output is not the decompressor's.
+		const u64 start = irc_clock_thread_cpu_ns();
+		const int ret = inflate(&zip->strm, Z_NO_FLUSH);
+
+		zip->stats.cpu_ns += irc_clock_thread_cpu_ns() - start;
+
+		// A stream is never ended by the other end; it is only ever
+		// flushed.
+		if (IRC_UNLIKELY((ret != Z_OK) && (ret != Z_BUF_ERROR))) {
+			return false;
+		}
+		const size_t produced = sizeof(buf) - zip->strm.avail_out;
+
+		if (!produced) {
+			break;
+		}
+		zip->stats.plain_bytes += produced;
+		out(udata, buf, produced);
+	} while (zip->strm.avail_in || !zip->strm.avail_out);
+
+	return true;
+}
+
+#else
+
+struct irc_zip {
+	struct irc_zip_stats stats;
+};
+
+bool irc_zip_supported(void)
+{
+	return false;
+}
+
+struct irc_zip *irc_zip_deflater_new(void)
+{
+	return NULL;
+}
+
+struct irc_zip *irc_zip_inflater_new(void)
+{
+	return NULL;
+}
+
+void irc_zip_free(struct irc_zip *const zip)
+{
+	free(zip);
+}
+
+void irc_zip_deflate(struct irc_zip *const zip, const char *const data,
+		     const size_t len, const bool flush,
+		     struct irc_sendq *const sendq)
+{
+	(void)zip;
+	(void)data;
+	(void)len;
+	(void)flush;
+	(void)sendq;
+}
+
+IRC_NODISCARD bool irc_zip_inflate(struct irc_zip *const zip,
+				   const char *const data, const size_t len,
+				   const irc_zip_out_cb out, void *const udata)
+{
+	(void)zip;
+	(void)data;
+	(void)len;
+	(void)out;
+	(void)udata;
+
+	return false;
+}
+
+#endif // IRC_HAVE_ZLIB
+
+const struct irc_zip_stats *irc_zip_stats(const struct irc_zip *const zip)
+{
+	return &zip->stats;
+}
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/arena.h"
+
+static void allocs_are_aligned_and_reused(void **state)
+{
+	(void)state;
+
+	struct irc_arena arena;
+	irc_arena_init(&arena);
+
+	char *first = irc_arena_alloc(&arena, 3);
+	char *second = irc_arena_alloc(&arena, 1);
+
+	assert_int_equal((uintptr_t)first % IRC_ARENA_ALIGN, 0);
+	assert_int_equal((uintptr_t)second % IRC_ARENA_ALIGN, 0);
+	assert_ptr_equal(second, first + IRC_ARENA_ALIGN);
+	assert_int_equal(irc_arena_used(&arena), 2 * IRC_ARENA_ALIGN);
+
+	memset(first, 'x', 3);
+	irc_arena_reset(&arena);
+
+	// The same memory is handed out again, without a chunk allocation.
+	assert_int_equal(irc_arena_used(&arena), 0);
+	assert_ptr_equal(irc_arena_alloc(&arena, 8), first);
+	assert_int_equal(arena.num_chunk_allocs, 1);
+	assert_int_equal(arena.high_water, 2 * IRC_ARENA_ALIGN);
+
+	irc_arena_destroy(&arena);
+}
+
+static void chunks_fold_on_reset(void **state)
+{
+	(void)state;
+
+	struct irc_arena arena;
+	irc_arena_init(&arena);
+
+	// Overflows the first chunk twice, once with an allocation larger
+	// than twice its size.
+	for (size_t i = 0; i < 3; ++i) {
+		char *ptr = irc_arena_alloc(&arena, IRC_ARENA_CHUNK_SIZE / 2);
+		memset(ptr, (int)i, IRC_ARENA_CHUNK_SIZE / 2);
+	}
+	char *big = irc_arena_alloc(&arena, IRC_ARENA_CHUNK_SIZE * 3);
+	memset(big, 'b', IRC_ARENA_CHUNK_SIZE * 3);
+
+	assert_int_equal(arena.num_chunk_allocs, 3);
+
+	const size_t used = irc_arena_used(&arena);
+	assert_int_equal(used, (IRC_ARENA_CHUNK_SIZE * 3) +
+				       (IRC_ARENA_CHUNK_SIZE * 3 / 2));
+
+	irc_arena_reset(&arena);
+
+	// A single chunk now holds as much as the iteration used.
+	assert_int_equal(arena.high_water, used);
+	assert_true(arena.capacity >= used);
+	assert_int_equal(arena.num_chunk_allocs, 4);
+
+	irc_arena_alloc(&arena, used);
+	irc_arena_reset(&arena);
+
+	assert_int_equal(arena.num_chunk_allocs, 4);
+
+	irc_arena_destroy(&arena);
+}
+
+static void scopes_roll_back(void **state)
+{
+	(void)state;
+
+	struct irc_arena arena;
+	irc_arena_init(&arena);
+
+	char *kept = irc_arena_alloc(&arena, 100);
+	memset(kept, 'k', 100);
+
+	struct irc_arena_scope outer;
+	irc_arena_scope_begin(&arena, &outer);
+
+	char *tmp = irc_arena_alloc(&arena, 100);
+
+	struct irc_arena_scope inner;
+	irc_arena_scope_begin(&arena, &inner);
+
+	// Spills into a new chunk, which goes when the scope ends.
+	irc_arena_alloc(&arena, IRC_ARENA_CHUNK_SIZE);
+	assert_int_equal(arena.num_chunk_allocs, 2);
+
+	irc_arena_scope_end(&arena, &inner);
+
+	assert_int_equal(arena.capacity, IRC_ARENA_CHUNK_SIZE);
+	assert_ptr_equal(irc_arena_alloc(&arena, 1), tmp + 112);
+
+	irc_arena_scope_end(&arena, &outer);
+
+	assert_ptr_equal(irc_arena_alloc(&arena, 1), tmp);
+	assert_int_equal(irc_arena_used(&arena), 112 + IRC_ARENA_ALIGN);
+
+	for (size_t i = 0; i < 100; ++i) {
+		assert_int_equal(kept[i], 'k');
+	}
+	assert_true(arena.high_water > IRC_ARENA_CHUNK_SIZE);
+
+	irc_arena_destroy(&arena);
+}
+
+static void last_alloc_grows_in_place(void **state)
+{
+	(void)state;
+
+	struct irc_arena arena;
+	irc_arena_init(&arena);
+
+	char *buf = irc_arena_grow(&arena, NULL, 0, 10);
+	memcpy(buf, "0123456789", 10);
+
+	char *grown = irc_arena_grow(&arena, buf, 10, 1000);
+	assert_ptr_equal(grown, buf);
+	assert_int_equal(irc_arena_used(&arena), irc_arena_align(1000));
+
+	// Once something else is allocated, growing copies.
+	irc_arena_alloc(&arena, 1);
+
+	char *moved = irc_arena_grow(&arena, grown, 1000, 2000);
+	assert_ptr_not_equal(moved, grown);
+	assert_memory_equal(moved, "0123456789", 10);
+
+	// So does growing past the end of the chunk.
+	char *spilled = irc_arena_grow(&arena, moved, 2000,
+				       IRC_ARENA_CHUNK_SIZE);
+	assert_ptr_not_equal(spilled, moved);
+	assert_memory_equal(spilled, "0123456789", 10);
+
+	irc_arena_destroy(&arena);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(allocs_are_aligned_and_reused),
+		[1] = cmocka_unit_test(chunks_fold_on_reset),
+		[2] = cmocka_unit_test(scopes_roll_back),
+		[3] = cmocka_unit_test(last_alloc_grows_in_place)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
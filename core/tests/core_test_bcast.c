@@ -0,0 +1,431 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/bcast.h"
+#include "core/chan.h"
+#include "core/ctx.h"
+
+#define USER_NUM (12)
+
+static struct irc_ctx ctx;
+static struct irc_user users[USER_NUM];
+
+static int setup(void **state)
+{
+	(void)state;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(users, 0, sizeof(users));
+
+	irc_init(&ctx);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	for (size_t i = 0; i < USER_NUM; ++i) {
+		irc_chan_part_all(&ctx.chans, &users[i]);
+		irc_user_release(&ctx, &users[i]);
+	}
+	irc_destroy(&ctx);
+	return 0;
+}
+
+/// @brief Creates a channel of the first `num` users.
+static struct irc_chan *chan_fill(const u32 num)
+{
+	struct irc_chan *chan = irc_chan_create(&ctx.chans, "#test");
+
+	for (u32 i = 0; i < num; ++i) {
+		irc_chan_join(&ctx.chans, chan, &users[i], 0);
+	}
+	return chan;
+}
+
+static void chan_send(struct irc_chan *const chan, const char *const text)
+{
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, "%s", text);
+	irc_bcast_chan(&ctx, &bc, chan, NULL);
+	irc_bcast_done(&bc);
+}
+
+/// @brief Checks that a user has been queued exactly the given lines, in
+/// order.
+static void assert_queued(const struct irc_user *const user,
+			  const char *const *const lines, const u32 num)
+{
+	const struct irc_sendq *sendq = &user->sendq;
+
+	assert_int_equal(sendq->num_entries, num);
+
+	for (u32 i = 0; i < num; ++i) {
+		const struct irc_buf *buf =
+			sendq->entries[(sendq->head + i) & (sendq->capacity - 1)];
+
+		assert_int_equal(buf->len, strlen(lines[i]) + 2);
+		assert_memory_equal(buf->data, lines[i], strlen(lines[i]));
+	}
+}
+
+static void small_chan_is_sent_at_once(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 4;
+
+	struct irc_chan *chan = chan_fill(4);
+	chan_send(chan, "a");
+
+	assert_null(ctx.chans.backlog.head);
+
+	for (size_t i = 0; i < 4; ++i) {
+		assert_queued(&users[i], (const char *[]){ "a" }, 1);
+	}
+}
+
+static void large_chan_is_sent_in_chunks(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 4;
+
+	struct irc_chan *chan = chan_fill(10);
+	chan_send(chan, "a");
+
+	assert_ptr_equal(ctx.chans.backlog.head, chan);
+
+	static const u32 sent_after[] = { 4, 8, 10 };
+
+	for (size_t run = 0; run < 3; ++run) {
+		irc_bcast_backlog_run(&ctx);
+
+		u32 num_sent = 0;
+
+		for (size_t i = 0; i < 10; ++i) {
+			num_sent += users[i].sendq.num_entries;
+		}
+		assert_int_equal(num_sent, sent_after[run]);
+	}
+	assert_null(ctx.chans.backlog.head);
+}
+
+static void chan_order_is_kept(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 4;
+
+	struct irc_chan *chan = chan_fill(6);
+
+	chan_send(chan, "a");
+	irc_bcast_backlog_run(&ctx);
+
+	// Small enough to be sent at once, but queued behind the backlog.
+	chan_send(chan, "b");
+	assert_int_equal(chan->backlog.num_entries, 2);
+
+	irc_bcast_backlog_run(&ctx);
+	irc_bcast_backlog_run(&ctx);
+
+	assert_null(ctx.chans.backlog.head);
+
+	for (size_t i = 0; i < 6; ++i) {
+		assert_queued(&users[i], (const char *[]){ "a", "b" }, 2);
+	}
+}
+
+static void membership_changes_during_delivery(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 3;
+
+	struct irc_chan *chan = chan_fill(10);
+	chan_send(chan, "a");
+
+	// Reaches the last three members.
+	irc_bcast_backlog_run(&ctx);
+
+	// One member it has reached leaves, as does one it has not. A new
+	// member joins.
+	irc_chan_part(&ctx.chans,
+		      irc_chan_member_find(&ctx.chans, chan, &users[8]));
+	irc_chan_part(&ctx.chans,
+		      irc_chan_member_find(&ctx.chans, chan, &users[1]));
+	irc_chan_join(&ctx.chans, chan, &users[10], 0);
+
+	while (ctx.chans.backlog.head) {
+		irc_bcast_backlog_run(&ctx);
+	}
+
+	for (size_t i = 0; i < 10; ++i) {
+		if (i != 1) {
+			assert_queued(&users[i], (const char *[]){ "a" }, 1);
+		}
+	}
+	assert_int_equal(users[1].sendq.num_entries, 0);
+	assert_int_equal(users[10].sendq.num_entries, 0);
+}
+
+static void common_reaches_each_user_once(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 3;
+
+	// User 0 shares two channels with users 1 and 2, one of them large
+	// enough to be deferred.
+	struct irc_chan *a = irc_chan_create(&ctx.chans, "#a");
+	struct irc_chan *b = irc_chan_create(&ctx.chans, "#b");
+
+	for (size_t i = 0; i < 3; ++i) {
+		irc_chan_join(&ctx.chans, a, &users[i], 0);
+		irc_chan_join(&ctx.chans, b, &users[i], 0);
+	}
+	irc_chan_join(&ctx.chans, b, &users[3], 0);
+	irc_chan_join(&ctx.chans, b, &users[4], 0);
+	irc_chan_join(&ctx.chans, irc_chan_create(&ctx.chans, "#c"), &users[5],
+		      0);
+
+	users[4].caps = IRC_USER_CAP_AWAY_NOTIFY;
+
+	for (u8 cap = 0; cap <= IRC_USER_CAP_AWAY_NOTIFY;
+	     cap += IRC_USER_CAP_AWAY_NOTIFY) {
+		struct irc_bcast bc;
+
+		irc_bcast_init(&bc, "%s", cap ? "b" : "a");
+		irc_bcast_common(&ctx, &bc, &users[0], cap);
+		irc_bcast_done(&bc);
+	}
+
+	assert_ptr_equal(ctx.chans.backlog.head, b);
+
+	while (ctx.chans.backlog.head) {
+		irc_bcast_backlog_run(&ctx);
+	}
+
+	assert_int_equal(users[0].sendq.num_entries, 0);
+	assert_queued(&users[1], (const char *[]){ "a" }, 1);
+	assert_queued(&users[2], (const char *[]){ "a" }, 1);
+	assert_queued(&users[3], (const char *[]){ "a" }, 1);
+	assert_queued(&users[4], (const char *[]){ "a", "b" }, 2);
+	assert_int_equal(users[5].sendq.num_entries, 0);
+}
+
+static void late_member_skips_queued(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 3;
+
+	struct irc_chan *chan = chan_fill(6);
+
+	chan_send(chan, "a");
+	chan_send(chan, "b");
+
+	// Joins while both are queued, then a member they are both still to
+	// reach leaves, as does one the first has already reached.
+	irc_bcast_backlog_run(&ctx);
+	irc_chan_join(&ctx.chans, chan, &users[6], 0);
+	chan_send(chan, "c");
+	irc_chan_part(&ctx.chans,
+		      irc_chan_member_find(&ctx.chans, chan, &users[0]));
+	irc_chan_part(&ctx.chans,
+		      irc_chan_member_find(&ctx.chans, chan, &users[5]));
+
+	while (ctx.chans.backlog.head) {
+		irc_bcast_backlog_run(&ctx);
+	}
+
+	for (size_t i = 1; i < 5; ++i) {
+		assert_queued(&users[i], (const char *[]){ "a", "b", "c" }, 3);
+	}
+	assert_queued(&users[5], (const char *[]){ "a" }, 1);
+	assert_queued(&users[6], (const char *[]){ "c" }, 1);
+	assert_int_equal(users[0].sendq.num_entries, 0);
+}
+
+static void common_is_queued_behind_chan(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 3;
+
+	struct irc_chan *chan = chan_fill(6);
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, "%s", "PRIVMSG");
+	irc_bcast_chan(&ctx, &bc, chan, &users[0]);
+	irc_bcast_done(&bc);
+
+	irc_bcast_init(&bc, "%s", "NICK");
+	irc_bcast_common(&ctx, &bc, &users[0], 0);
+	irc_bcast_done(&bc);
+
+	assert_int_equal(chan->backlog.num_entries, 2);
+
+	while (ctx.chans.backlog.head) {
+		irc_bcast_backlog_run(&ctx);
+	}
+
+	assert_int_equal(users[0].sendq.num_entries, 0);
+
+	for (size_t i = 1; i < 6; ++i) {
+		assert_queued(&users[i], (const char *[]){ "PRIVMSG", "NICK" },
+			      2);
+	}
+}
+
+static void common_interleaved_reach_once(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 3;
+
+	// Users 0 and 1 both share two deferring channels with the others,
+	// whose deliveries take turns.
+	struct irc_chan *a = irc_chan_create(&ctx.chans, "#a");
+	struct irc_chan *b = irc_chan_create(&ctx.chans, "#b");
+
+	for (size_t i = 0; i < 5; ++i) {
+		irc_chan_join(&ctx.chans, a, &users[i], 0);
+		irc_chan_join(&ctx.chans, b, &users[i], 0);
+	}
+
+	for (size_t i = 0; i < 2; ++i) {
+		struct irc_bcast bc;
+
+		irc_bcast_init(&bc, "%s", i ? "NICK 1" : "NICK 0");
+		irc_bcast_common(&ctx, &bc, &users[i], 0);
+		irc_bcast_done(&bc);
+	}
+
+	while (ctx.chans.backlog.head) {
+		irc_bcast_backlog_run(&ctx);
+	}
+
+	assert_queued(&users[0], (const char *[]){ "NICK 1" }, 1);
+	assert_queued(&users[1], (const char *[]){ "NICK 0" }, 1);
+
+	for (size_t i = 2; i < 5; ++i) {
+		assert_queued(&users[i], (const char *[]){ "NICK 0", "NICK 1" },
+			      2);
+	}
+}
+
+static void common_skips_joined_since(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 3;
+
+	// User 2 is reached through the small channel at once, and not again
+	// through the deferring one. User 1 joins the small channel too, but
+	// only once the broadcast has been sent in it.
+	struct irc_chan *small = irc_chan_create(&ctx.chans, "#small");
+	struct irc_chan *large = chan_fill(5);
+
+	irc_chan_join(&ctx.chans, small, &users[0], 0);
+	irc_chan_join(&ctx.chans, small, &users[2], 0);
+
+	struct irc_bcast bc;
+
+	irc_bcast_init(&bc, "%s", "QUIT");
+	irc_bcast_common(&ctx, &bc, &users[0], 0);
+	irc_bcast_done(&bc);
+
+	assert_queued(&users[2], (const char *[]){ "QUIT" }, 1);
+
+	irc_chan_join(&ctx.chans, small, &users[1], 0);
+	assert_ptr_equal(ctx.chans.backlog.head, large);
+
+	while (ctx.chans.backlog.head) {
+		irc_bcast_backlog_run(&ctx);
+	}
+
+	assert_int_equal(users[0].sendq.num_entries, 0);
+
+	for (size_t i = 1; i < 5; ++i) {
+		assert_queued(&users[i], (const char *[]){ "QUIT" }, 1);
+	}
+}
+
+static void destroyed_chan_drops_backlog(void **state)
+{
+	(void)state;
+
+	ctx.conf.fanout.recipients_per_iter = 2;
+
+	struct irc_chan *chan = chan_fill(5);
+	chan_send(chan, "a");
+	chan_send(chan, "b");
+
+	for (size_t i = 0; i < 5; ++i) {
+		irc_chan_part_all(&ctx.chans, &users[i]);
+	}
+	assert_null(ctx.chans.backlog.head);
+	assert_null(ctx.chans.backlog.tail);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test_setup_teardown(small_chan_is_sent_at_once,
+						      setup, teardown),
+		[1] = cmocka_unit_test_setup_teardown(
+			large_chan_is_sent_in_chunks, setup, teardown),
+		[2] = cmocka_unit_test_setup_teardown(chan_order_is_kept,
+						      setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(
+			membership_changes_during_delivery, setup, teardown),
+		[4] = cmocka_unit_test_setup_teardown(
+			common_reaches_each_user_once, setup, teardown),
+		[5] = cmocka_unit_test_setup_teardown(
+			late_member_skips_queued, setup, teardown),
+		[6] = cmocka_unit_test_setup_teardown(
+			common_is_queued_behind_chan, setup, teardown),
+		[7] = cmocka_unit_test_setup_teardown(
+			common_interleaved_reach_once, setup, teardown),
+		[8] = cmocka_unit_test_setup_teardown(
+			common_skips_joined_since, setup, teardown),
+		[9] = cmocka_unit_test_setup_teardown(
+			destroyed_chan_drops_backlog, setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,360 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/casemap.h"
+#include "core/chan.h"
+
+#define USER_NUM (8)
+
+/// @brief The number of members of the channel the cached names are checked
+/// with; enough for several lines.
+#define NAMES_USER_NUM (200)
+
+/// @brief The number of channels the orders of channels are checked with.
+#define SORTED_CHAN_NUM (256)
+
+/// @brief The channels of a test.
+static struct irc_chans chans;
+
+static int setup(void **state)
+{
+	(void)state;
+
+	irc_chans_init(&chans);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	irc_chans_destroy(&chans);
+	return 0;
+}
+
+/// @brief Checks that every membership agrees with its position in both of
+/// the lists it is in.
+static void assert_indices_consistent(const struct irc_chan *const chan)
+{
+	for (u32 i = 0; i < chan->members.num_entries; ++i) {
+		const struct irc_member *member = chan->members.entries[i];
+
+		assert_int_equal(member->chan_idx, i);
+		assert_ptr_equal(member->chan, chan);
+		assert_ptr_equal(member->user->chans.entries[member->user_idx],
+				 member);
+	}
+}
+
+static void casemap_folds_rfc1459(void **state)
+{
+	(void)state;
+
+	assert_true(irc_casemap_eq("#Foo[\\]~", "#fOO{|}^"));
+	assert_false(irc_casemap_eq("#foo", "#fo"));
+	assert_false(irc_casemap_eq("#foo_", "#foo-"));
+
+	static const u8 secret[IRC_SIPHASH_SECRET_KEY_LEN] = { 1, 2, 3 };
+
+	assert_int_equal(irc_casemap_ht_hash("NICK[A]", secret),
+			 irc_casemap_ht_hash("nick{a}", secret));
+}
+
+static void casemap_matches_masks(void **state)
+{
+	(void)state;
+
+	assert_true(irc_casemap_match("#foo*", "#FOObar"));
+	assert_true(irc_casemap_match("*[a]*", "#x{A}y"));
+	assert_true(irc_casemap_match("#?o*o", "#foo-o"));
+	assert_true(irc_casemap_match("*", ""));
+	assert_true(irc_casemap_match("#a*b*c", "#aXbYbZc"));
+	assert_false(irc_casemap_match("#a*b*c", "#aXbYbZ"));
+	assert_false(irc_casemap_match("#foo", "#foobar"));
+	assert_false(irc_casemap_match("#foo?", "#foo"));
+
+	assert_true(irc_casemap_cmp("#ABC", "#abd") < 0);
+	assert_true(irc_casemap_cmp("#ab", "#AB") == 0);
+	assert_true(irc_casemap_cmp("#ab[", "#AB{") == 0);
+	assert_true(irc_casemap_cmp("#ab", "#a") > 0);
+}
+
+static void find_is_case_insensitive(void **state)
+{
+	(void)state;
+
+	struct irc_chan *chan = irc_chan_create(&chans, "#Test");
+
+	assert_ptr_equal(irc_chan_find(&chans, "#tEST"), chan);
+	assert_null(irc_chan_find(&chans, "#other"));
+}
+
+static void join_and_part_keep_indices(void **state)
+{
+	(void)state;
+
+	struct irc_user users[USER_NUM] = {};
+	struct irc_chan *a = irc_chan_create(&chans, "#a");
+	struct irc_chan *b = irc_chan_create(&chans, "#b");
+
+	for (size_t i = 0; i < USER_NUM; ++i) {
+		irc_chan_join(&chans, a, &users[i], 0);
+		irc_chan_join(&chans, b, &users[i], IRC_MEMBER_VOICE);
+	}
+
+	assert_int_equal(a->members.num_entries, USER_NUM);
+	assert_non_null(irc_chan_member_find(&chans, b, &users[3]));
+
+	// Part from the middle, the front and the back.
+	irc_chan_part(&chans, irc_chan_member_find(&chans, a, &users[3]));
+	irc_chan_part(&chans, irc_chan_member_find(&chans, a, &users[0]));
+	irc_chan_part(&chans,
+		      irc_chan_member_find(&chans, a, &users[USER_NUM - 1]));
+
+	assert_int_equal(a->members.num_entries, USER_NUM - 3);
+	assert_null(irc_chan_member_find(&chans, a, &users[3]));
+	assert_non_null(irc_chan_member_find(&chans, b, &users[3]));
+	assert_int_equal(users[3].chans.num_entries, 1);
+
+	assert_indices_consistent(a);
+	assert_indices_consistent(b);
+
+	for (size_t i = 0; i < USER_NUM; ++i) {
+		irc_chan_part_all(&chans, &users[i]);
+	}
+}
+
+static void last_part_destroys_chan(void **state)
+{
+	(void)state;
+
+	struct irc_user users[2] = {};
+	struct irc_chan *chan = irc_chan_create(&chans, "#gone");
+
+	irc_chan_join(&chans, chan, &users[0], IRC_MEMBER_OP);
+	irc_chan_join(&chans, chan, &users[1], 0);
+
+	irc_chan_part_all(&chans, &users[0]);
+	assert_non_null(irc_chan_find(&chans, "#gone"));
+
+	irc_chan_part_all(&chans, &users[1]);
+	assert_null(irc_chan_find(&chans, "#gone"));
+	assert_int_equal(chans.members.num_entries, 0);
+}
+
+/// @brief Checks that the cached names list every member exactly once, in
+/// runs that cover the members in order.
+static void assert_names_match(struct irc_chan *const chan)
+{
+	const struct irc_names *names = irc_chan_names(chan);
+	u32 next = 0;
+
+	for (u32 i = 0; i < names->num_segs; ++i) {
+		const struct irc_names_seg *seg = &names->segs[i];
+
+		assert_int_equal(seg->start, next);
+		assert_true(seg->end > seg->start);
+		assert_true(seg->buf->len <= IRC_BUF_LINE_LEN_MAX);
+
+		char body[IRC_BUF_LINE_LEN_MAX];
+		size_t len = 0;
+
+		for (u32 idx = seg->start; idx < seg->end; ++idx) {
+			const struct irc_member *member =
+				chan->members.entries[idx];
+			const char prefix = irc_member_prefix_char(member->prefix);
+
+			len += (size_t)snprintf(&body[len], sizeof(body) - len,
+						"%s%.1s%s", len ? " " : "",
+						prefix ? &prefix : "",
+						member->user->nick);
+		}
+		memcpy(&body[len], "\r\n", 2);
+
+		assert_int_equal(seg->buf->len, len + 2);
+		assert_memory_equal(seg->buf->data, body, len + 2);
+
+		next = seg->end;
+	}
+	assert_int_equal(next, chan->members.num_entries);
+}
+
+static void names_follow_membership(void **state)
+{
+	(void)state;
+
+	static struct irc_user users[NAMES_USER_NUM];
+	struct irc_chan *chan = irc_chan_create(&chans, "#names");
+
+	for (size_t i = 0; i < NAMES_USER_NUM; ++i) {
+		snprintf(users[i].nick, sizeof(users[i].nick), "user%03zu", i);
+		irc_chan_join(&chans, chan, &users[i],
+			      (i % 7) ? 0 : IRC_MEMBER_OP);
+	}
+	assert_names_match(chan);
+
+	const struct irc_names *names = irc_chan_names(chan);
+	assert_true(names->num_segs > 2);
+
+	const struct irc_buf *first = names->segs[0].buf;
+
+	// Changes at the back leave the front alone.
+	irc_chan_part(&chans, irc_chan_member_find(&chans, chan,
+						   &users[NAMES_USER_NUM - 1]));
+	strcpy(users[NAMES_USER_NUM - 2].nick, "a_much_longer_nickname");
+	irc_chan_names_invalidate(irc_chan_member_find(
+		&chans, chan, &users[NAMES_USER_NUM - 2]));
+
+	assert_names_match(chan);
+	assert_ptr_equal(irc_chan_names(chan)->segs[0].buf, first);
+
+	// A member leaving from the front has the last one moved there.
+	irc_chan_part(&chans, irc_chan_member_find(&chans, chan, &users[0]));
+	irc_chan_join(&chans, chan, &users[NAMES_USER_NUM - 1], 0);
+
+	assert_names_match(chan);
+
+	for (size_t i = 1; i < NAMES_USER_NUM; ++i) {
+		irc_chan_part_all(&chans, &users[i]);
+	}
+	assert_null(irc_chan_find(&chans, "#names"));
+}
+
+/// @brief Checks that walking both orders visits every channel once, in
+/// order.
+static void assert_sorted(const u32 num_chans)
+{
+	u32 num = 0;
+
+	for (const struct irc_chan *chan = irc_chan_seek_name(&chans, "", false),
+				   *prev = NULL;
+	     chan; prev = chan, chan = irc_chan_next_name(chan), ++num) {
+		assert_true(!prev || (irc_casemap_cmp(prev->name, chan->name) < 0));
+	}
+	assert_int_equal(num, num_chans);
+
+	const struct irc_chan_size_key first = {};
+
+	num = 0;
+
+	for (const struct irc_chan *chan = irc_chan_seek_size(&chans, &first,
+							      false),
+				   *prev = NULL;
+	     chan; prev = chan, chan = irc_chan_next_size(chan), ++num) {
+		assert_int_equal(chan->sorted.size_key.num_members,
+				 chan->members.num_entries);
+		assert_true(!prev || (prev->members.num_entries <=
+				      chan->members.num_entries));
+	}
+	assert_int_equal(num, num_chans);
+}
+
+static void sorted_follow_membership(void **state)
+{
+	(void)state;
+
+	struct irc_user users[USER_NUM] = {};
+	char name[IRC_CHAN_NAME_LEN_MAX + 1];
+
+	// Channel i has i % USER_NUM + 1 members, and names out of order.
+	for (u32 i = 0; i < SORTED_CHAN_NUM; ++i) {
+		snprintf(name, sizeof(name), "#C%03" PRIu32,
+			 (i * 37) % SORTED_CHAN_NUM);
+
+		struct irc_chan *chan = irc_chan_create(&chans, name);
+
+		for (u32 j = 0; j <= (i % USER_NUM); ++j) {
+			irc_chan_join(&chans, chan, &users[j], 0);
+		}
+	}
+	assert_sorted(SORTED_CHAN_NUM);
+
+	const struct irc_chan *chan = irc_chan_seek_name(&chans, "#c1", false);
+	assert_string_equal(chan->name, "#C100");
+
+	chan = irc_chan_seek_name(&chans, "#c100", true);
+	assert_string_equal(chan->name, "#C101");
+
+	const struct irc_chan_size_key key = { .num_members = USER_NUM };
+
+	chan = irc_chan_seek_size(&chans, &key, false);
+	assert_int_equal(chan->members.num_entries, USER_NUM);
+
+	// The last user leaving shrinks half the channels, and destroys those
+	// it was the only member of.
+	irc_chan_part_all(&chans, &users[0]);
+	assert_sorted(SORTED_CHAN_NUM - (SORTED_CHAN_NUM / USER_NUM));
+
+	for (u32 i = 1; i < USER_NUM; ++i) {
+		irc_chan_part_all(&chans, &users[i]);
+	}
+	assert_null(irc_chan_seek_name(&chans, "", false));
+	assert_null(irc_chan_seek_size(&chans, &key, false));
+}
+
+static void reject_malformed_chan_names(void **state)
+{
+	(void)state;
+
+	assert_true(irc_chan_name_valid("#ok"));
+	assert_true(irc_chan_name_valid("&local"));
+	assert_false(irc_chan_name_valid("#"));
+	assert_false(irc_chan_name_valid("nohash"));
+	assert_false(irc_chan_name_valid("#a,b"));
+	assert_false(irc_chan_name_valid(
+		"#123456789012345678901234567890123456789012345678901"));
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(casemap_folds_rfc1459),
+		[1] = cmocka_unit_test(casemap_matches_masks),
+		[2] = cmocka_unit_test_setup_teardown(find_is_case_insensitive,
+						      setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(
+			join_and_part_keep_indices, setup, teardown),
+		[4] = cmocka_unit_test_setup_teardown(last_part_destroys_chan,
+						      setup, teardown),
+		[5] = cmocka_unit_test_setup_teardown(names_follow_membership,
+						      setup, teardown),
+		[6] = cmocka_unit_test_setup_teardown(sorted_follow_membership,
+						      setup, teardown),
+		[7] = cmocka_unit_test(reject_malformed_chan_names)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
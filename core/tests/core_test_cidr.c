@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/cidr.h"
+
+// clang-format off
+
+#define RANDOM_NETS_NUM         (2000)
+#define RANDOM_LOOKUPS_NUM      (20000)
+
+// clang-format on
+
+static void parse(const char *const str, struct irc_cidr_addr *const addr,
+		  uint *const len)
+{
+	const bool ok = irc_cidr_parse(str, addr, len);
+	assert_true(ok);
+}
+
+/// @brief Returns the length of the network of a tree an address matches, or
+/// -1.
+static int match_len(const struct irc_cidr_tree *const tree, const char *str)
+{
+	struct irc_cidr_addr addr;
+	uint len;
+	parse(str, &addr, &len);
+
+	uint match;
+	return irc_cidr_match(tree, &addr, &match) ? (int)match : -1;
+}
+
+static void parse_accepts_networks(void **state)
+{
+	(void)state;
+
+	struct irc_cidr_addr addr;
+	uint len;
+
+	parse("192.0.2.77/24", &addr, &len);
+	assert_int_equal(len, 96 + 24);
+	assert_true(irc_cidr_is_ipv4(&addr));
+	assert_int_equal(addr.lo, UINT64_C(0xffffc0000200));
+
+	parse("198.51.100.7", &addr, &len);
+	assert_int_equal(len, 128);
+
+	parse("2001:db8:ffff::/32", &addr, &len);
+	assert_int_equal(len, 32);
+	assert_false(irc_cidr_is_ipv4(&addr));
+	assert_int_equal(addr.hi, UINT64_C(0x20010db800000000));
+	assert_int_equal(addr.lo, 0);
+
+	// IPv4 addresses written as mapped IPv6 addresses are the same.
+	struct irc_cidr_addr mapped;
+	parse("::ffff:192.0.2.0/120", &mapped, &len);
+	parse("192.0.2.0/24", &addr, &len);
+	assert_int_equal(mapped.hi, addr.hi);
+	assert_int_equal(mapped.lo, addr.lo);
+
+	static const char *const malformed[] = {
+		"", "192.0.2.0/33", "192.0.2.0/", "::/129", "192.0.2.0/2x",
+		"host.example", "192.0.2.0/24/8", "2001:db8::/0032"
+	};
+
+	for (size_t i = 0; i < sizeof(malformed) / sizeof(*malformed); ++i) {
+		const bool ok = irc_cidr_parse(malformed[i], &addr, &len);
+		assert_false(ok);
+	}
+}
+
+static void match_finds_longest_prefix(void **state)
+{
+	(void)state;
+
+	static const char *const nets[] = {
+		"10.1.2.3", "10.0.0.0/8", "10.1.0.0/16", "10.1.2.0/24",
+		"2001:db8::/32", "2001:db8:1::/48", "0.0.0.0/1"
+	};
+
+	struct irc_cidr_tree tree = {};
+
+	for (size_t i = 0; i < sizeof(nets) / sizeof(*nets); ++i) {
+		struct irc_cidr_addr addr;
+		uint len;
+		parse(nets[i], &addr, &len);
+
+		const bool added = irc_cidr_add(&tree, &addr, len);
+		assert_true(added);
+	}
+	assert_int_equal(tree.num_entries, sizeof(nets) / sizeof(*nets));
+
+	struct irc_cidr_addr dup;
+	uint len;
+	parse("10.1.0.0/16", &dup, &len);
+	const bool added = irc_cidr_add(&tree, &dup, len);
+	assert_false(added);
+
+	assert_int_equal(match_len(&tree, "10.1.2.3"), 128);
+	assert_int_equal(match_len(&tree, "10.1.2.4"), 96 + 24);
+	assert_int_equal(match_len(&tree, "10.1.3.4"), 96 + 16);
+	assert_int_equal(match_len(&tree, "10.2.3.4"), 96 + 8);
+	assert_int_equal(match_len(&tree, "11.2.3.4"), 96 + 1);
+	assert_int_equal(match_len(&tree, "192.0.2.1"), -1);
+	assert_int_equal(match_len(&tree, "2001:db8:1::1"), 48);
+	assert_int_equal(match_len(&tree, "2001:db8:2::1"), 32);
+	assert_int_equal(match_len(&tree, "2001:db9::1"), -1);
+	assert_int_equal(match_len(&tree, "::1"), -1);
+
+	irc_cidr_tree_destroy(&tree);
+	assert_null(tree.root);
+}
+
+static void random_addr(struct irc_cidr_addr *const addr)
+{
+	// Only a few bits vary, so that networks nest and share prefixes
+	// often. Some addresses are IPv4, which are indexed differently.
+	if (rand() % 4 == 0) {
+		addr->hi = 0;
+		addr->lo = (UINT64_C(0xffff) << 32) |
+			   ((u64)(rand() & 0x3) << 30) | (u64)(rand() & 0xffff);
+	} else {
+		addr->hi = ((u64)(rand() & 0xff) << 56) | (u64)(rand() & 0xf);
+		addr->lo = (u64)rand();
+	}
+}
+
+static void match_agrees_with_scan(void **state)
+{
+	(void)state;
+
+	static struct irc_cidr_addr nets[RANDOM_NETS_NUM];
+	static uint lens[RANDOM_NETS_NUM];
+
+	struct irc_cidr_tree tree = {};
+
+	srand(38);
+
+	for (size_t i = 0; i < RANDOM_NETS_NUM; ++i) {
+		random_addr(&nets[i]);
+		lens[i] = (uint)rand() % (IRC_CIDR_ADDR_BITS + 1);
+		irc_cidr_mask(&nets[i], lens[i]);
+
+		irc_cidr_add(&tree, &nets[i], lens[i]);
+	}
+
+	for (size_t i = 0; i < RANDOM_LOOKUPS_NUM; ++i) {
+		struct irc_cidr_addr addr;
+		random_addr(&addr);
+
+		int expected = -1;
+
+		for (size_t j = 0; j < RANDOM_NETS_NUM; ++j) {
+			struct irc_cidr_addr masked = addr;
+			irc_cidr_mask(&masked, lens[j]);
+
+			if ((masked.hi == nets[j].hi) &&
+			    (masked.lo == nets[j].lo) && ((int)lens[j] > expected)) {
+				expected = (int)lens[j];
+			}
+		}
+
+		uint len;
+		const int found = irc_cidr_match(&tree, &addr, &len) ? (int)len :
+								       -1;
+		assert_int_equal(found, expected);
+	}
+	irc_cidr_tree_destroy(&tree);
+}
+
+static void load_stops_at_malformed_line(void **state)
+{
+	(void)state;
+
+	char path[] = "/tmp/core_test_cidr_XXXXXX";
+	const int fd = mkstemp(path);
+	assert_true(fd >= 0);
+
+	FILE *file = fdopen(fd, "w");
+	fputs("# D-lines\n"
+	      "192.0.2.0/24\n"
+	      "\n"
+	      "  2001:db8::/32  \r\n"
+	      "not-a-network\n"
+	      "198.51.100.0/24\n",
+	      file);
+	fclose(file);
+
+	struct irc_cidr_tree tree = {};
+	size_t line;
+
+	bool ok = irc_cidr_load(&tree, path, &line);
+	assert_false(ok);
+	assert_int_equal(line, 5);
+	assert_int_equal(tree.num_entries, 2);
+	assert_int_equal(match_len(&tree, "2001:db8::7"), 32);
+	assert_int_equal(match_len(&tree, "198.51.100.1"), -1);
+
+	unlink(path);
+
+	ok = irc_cidr_load(&tree, path, &line);
+	assert_false(ok);
+	assert_int_equal(line, 0);
+
+	irc_cidr_tree_destroy(&tree);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(parse_accepts_networks),
+		[1] = cmocka_unit_test(match_finds_longest_prefix),
+		[2] = cmocka_unit_test(match_agrees_with_scan),
+		[3] = cmocka_unit_test(load_stops_at_malformed_line)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
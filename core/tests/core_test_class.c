@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/class.h"
+#include "core/ctx.h"
+
+static struct irc_ctx ctx;
+static struct irc_user alice;
+static struct irc_user bob;
+
+/// @brief Puts a user of this server in the class its address is in. The
+/// user has no connection, so nothing queued to it is written out.
+static void local_add(struct irc_user *const user, const char *const host)
+{
+	user->fd = -1;
+	user->registered = true;
+
+	strcpy(user->host, host);
+
+	user->cls = irc_classes_match(&ctx.classes, host);
+	user->cls->num_users++;
+}
+
+/// @brief Sends a user lines of 500 bytes until it holds at least `len`
+/// bytes, or has been evicted.
+static void fill(struct irc_user *const user, const size_t len)
+{
+	char line[501];
+
+	memset(line, 'x', sizeof(line) - 1);
+	line[sizeof(line) - 1] = '\0';
+
+	while (!user->evicted && (user->sendq.len < len)) {
+		irc_user_sendf(&ctx, user, "%.498s", line);
+	}
+}
+
+static int setup(void **state)
+{
+	(void)state;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&alice, 0, sizeof(alice));
+	memset(&bob, 0, sizeof(bob));
+
+	enum irc_conf_status_code code;
+
+	bool valid = irc_conf_class_add(&ctx.conf, "small:16K@192.0.2.0/24",
+					&code);
+	assert_true(valid);
+
+	valid = irc_conf_class_add(&ctx.conf, "v6:1M:128@2001:db8::/32",
+				   &code);
+	assert_true(valid);
+
+	valid = irc_conf_queue_budget_set(&ctx.conf, "128K", &code);
+	assert_true(valid);
+
+	irc_init(&ctx);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	irc_user_release(&ctx, &alice);
+	irc_user_release(&ctx, &bob);
+
+	// Everything queued has been accounted back.
+	assert_int_equal(ctx.classes.bytes, 0);
+
+	irc_destroy(&ctx);
+	return 0;
+}
+
+static void clients_are_put_in_first_class_matching(void **state)
+{
+	(void)state;
+
+	struct irc_class *cls = irc_classes_match(&ctx.classes, "192.0.2.77");
+	assert_string_equal(cls->conf.name, "small");
+
+	cls = irc_classes_match(&ctx.classes, "2001:db8::1");
+	assert_string_equal(cls->conf.name, "v6");
+	assert_int_equal(cls->conf.recvq_max, 128);
+
+	static const char *const others[] = { "192.0.3.1", "2001:db9::1",
+					      "198.51.100.7", "localhost" };
+
+	for (size_t i = 0; i < (sizeof(others) / sizeof(*others)); ++i) {
+		cls = irc_classes_match(&ctx.classes, others[i]);
+
+		assert_string_equal(cls->conf.name, IRC_CLASS_DEFAULT_NAME);
+		assert_int_equal(cls->conf.sendq_max,
+				 IRC_CONF_CLASS_SENDQ_DEFAULT);
+	}
+}
+
+static void exceeding_sendq_evicts(void **state)
+{
+	(void)state;
+
+	local_add(&alice, "192.0.2.1");
+	local_add(&bob, "198.51.100.7");
+
+	fill(&alice, 32 * 1024);
+
+	assert_true(alice.evicted);
+	assert_true(alice.closing);
+	assert_int_equal(alice.cls->num_evicted, 1);
+
+	// Only the error is left queued.
+	assert_int_equal(alice.sendq.num_entries, 1);
+	assert_memory_equal(alice.sendq.entries[alice.sendq.head]->data,
+			    "ERROR :Closing Link: 192.0.2.1 (SendQ exceeded)",
+			    47);
+	assert_int_equal(alice.cls->sendq_bytes, alice.sendq.len);
+
+	// Nothing more is queued.
+	irc_user_sendf(&ctx, &alice, "PING :late");
+	assert_int_equal(alice.sendq.num_entries, 1);
+
+	// Other classes are unaffected.
+	fill(&bob, 32 * 1024);
+	assert_false(bob.evicted);
+	assert_int_equal(bob.cls->sendq_bytes, bob.sendq.len);
+	assert_int_equal(ctx.classes.bytes, alice.sendq.len + bob.sendq.len);
+}
+
+static void exceeding_budget_evicts_backlogged(void **state)
+{
+	(void)state;
+
+	local_add(&alice, "198.51.100.7");
+	local_add(&bob, "198.51.100.8");
+
+	fill(&bob, 80 * 1024);
+	fill(&alice, 60 * 1024);
+
+	// Over the budget, but still keeping up.
+	assert_true(irc_classes_over_budget(&ctx.classes));
+	assert_false(alice.evicted);
+
+	// Past the backlog, the budget applies.
+	irc_user_sendf(&ctx, &bob, "PING :more");
+	assert_true(bob.evicted);
+	assert_false(irc_classes_over_budget(&ctx.classes));
+
+	fill(&alice, 96 * 1024);
+	assert_false(alice.evicted);
+}
+
+static void reconfigured_classes_keep_clients(void **state)
+{
+	(void)state;
+
+	local_add(&alice, "192.0.2.1");
+	local_add(&bob, "2001:db8::1");
+
+	fill(&alice, 4 * 1024);
+
+	struct irc_class *small = alice.cls;
+	const size_t queued = small->sendq_bytes;
+
+	// "small" is resized, "v6" dropped and "new" added.
+	struct irc_conf conf = {};
+	enum irc_conf_status_code code;
+
+	bool valid = irc_conf_class_add(&conf, "new:8K@2001:db8::/32", &code);
+	assert_true(valid);
+
+	valid = irc_conf_class_add(&conf, "small:32K@192.0.2.0/24", &code);
+	assert_true(valid);
+
+	valid = irc_classes_apply(&ctx.classes, &conf);
+	assert_true(valid);
+
+	assert_ptr_equal(alice.cls, small);
+	assert_int_equal(small->conf.sendq_max, 32 * 1024);
+	assert_int_equal(small->sendq_bytes, queued);
+	assert_int_equal(small->num_users, 1);
+
+	// Bob keeps the limits he connected under.
+	assert_false(bob.cls->active);
+	assert_string_equal(bob.cls->conf.name, "v6");
+	assert_int_equal(bob.cls->num_users, 1);
+
+	struct irc_class *cls = irc_classes_match(&ctx.classes, "2001:db8::2");
+	assert_string_equal(cls->conf.name, "new");
+	assert_ptr_not_equal(cls, bob.cls);
+
+	fill(&alice, 24 * 1024);
+	assert_false(alice.evicted);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test_setup_teardown(
+			clients_are_put_in_first_class_matching, setup,
+			teardown),
+		[1] = cmocka_unit_test_setup_teardown(exceeding_sendq_evicts,
+						      setup, teardown),
+		[2] = cmocka_unit_test_setup_teardown(
+			exceeding_budget_evicts_backlogged, setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(
+			reconfigured_classes_keep_clients, setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
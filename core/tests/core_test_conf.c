@@ -23,6 +23,10 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
@@ -141,6 +145,313 @@ static void reject_all_whitespace_port(void **state)
 	assert_int_equal(code, IRC_CONF_INVALID_PORT_RANGE);
 }
 
+static void accept_watchdog_threshold(void **state)
+{
+	(void)state;
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	const bool valid = irc_conf_watchdog_set(&conf, "250", &code);
+
+	assert_true(valid);
+	assert_int_equal(code, IRC_CONF_STATUS_OK);
+	assert_int_equal(conf.watchdog.stall_threshold_ms, 250);
+}
+
+static void reject_too_large_watchdog_threshold(void **state)
+{
+	(void)state;
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	const bool valid = irc_conf_watchdog_set(&conf, "9999999999", &code);
+
+	assert_false(valid);
+	assert_int_equal(code, IRC_CONF_OUT_OF_RANGE);
+	assert_int_equal(conf.watchdog.stall_threshold_ms, 0);
+}
+
+static void accept_tables_vmem(void **state)
+{
+	(void)state;
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	assert_int_equal(conf.tables.vmem, IRC_VMEM_HEAP);
+
+	const bool valid = irc_conf_tables_vmem_set(&conf, "hugetlb", &code);
+
+	assert_true(valid);
+	assert_int_equal(code, IRC_CONF_STATUS_OK);
+	assert_int_equal(conf.tables.vmem, IRC_VMEM_HUGETLB);
+}
+
+static void reject_unknown_tables_vmem(void **state)
+{
+	(void)state;
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	const bool valid = irc_conf_tables_vmem_set(&conf, "huge", &code);
+
+	assert_false(valid);
+	assert_int_equal(code, IRC_CONF_MALFORMED);
+	assert_int_equal(conf.tables.vmem, IRC_VMEM_HEAP);
+}
+
+static void accept_links(void **state)
+{
+	(void)state;
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	bool valid = irc_conf_link_add(&conf, "hub.example:s3cret", &code);
+
+	assert_true(valid);
+	assert_int_equal(code, IRC_CONF_STATUS_OK);
+
+	valid = irc_conf_link_add(&conf, "leaf.example:pw@::1:7000", &code);
+
+	assert_true(valid);
+	assert_int_equal(conf.links.num_entries, 2);
+	assert_string_equal(conf.links.entries[0].password, "s3cret");
+	assert_string_equal(conf.links.entries[0].addr.host, "");
+	assert_string_equal(conf.links.entries[1].name, "leaf.example");
+	assert_string_equal(conf.links.entries[1].addr.host, "::1");
+	assert_string_equal(conf.links.entries[1].addr.port, "7000");
+	assert_false(conf.links.entries[1].zip);
+
+	valid = irc_conf_link_add(&conf, "zip.example:pw@10.0.0.1:7000,zip",
+				  &code);
+
+	assert_true(valid);
+	assert_true(conf.links.entries[2].zip);
+	assert_string_equal(conf.links.entries[2].addr.port, "7000");
+
+	valid = irc_conf_link_add(&conf, "hub2.example:a,b,zip", &code);
+
+	assert_true(valid);
+	assert_true(conf.links.entries[3].zip);
+	assert_string_equal(conf.links.entries[3].password, "a,b");
+}
+
+static void reject_malformed_links(void **state)
+{
+	(void)state;
+
+	static const char *const malformed[] = {
+		"hub.example", "hub.example:", ":pw", "hub.example:pw@host",
+		"hub.example:pw@host:0", "hub example:pw",
+		"hub.example:pw@host:7000,gzip", "hub.example,zip"
+	};
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	for (size_t i = 0; i < (sizeof(malformed) / sizeof(*malformed)); ++i) {
+		const bool valid = irc_conf_link_add(&conf, malformed[i], &code);
+
+		assert_false(valid);
+		assert_int_equal(code, IRC_CONF_MALFORMED);
+	}
+	assert_int_equal(conf.links.num_entries, 0);
+}
+
+static void accept_classes(void **state)
+{
+	(void)state;
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	bool valid = irc_conf_class_add(&conf, "opers:4M:256@192.0.2.0/24",
+					&code);
+
+	assert_true(valid);
+	assert_int_equal(code, IRC_CONF_STATUS_OK);
+
+	valid = irc_conf_class_add(&conf, "users:64K", &code);
+
+	assert_true(valid);
+	assert_int_equal(conf.classes.num_entries, 2);
+
+	const struct irc_conf_class *opers = &conf.classes.entries[0];
+
+	assert_string_equal(opers->name, "opers");
+	assert_int_equal(opers->sendq_max, 4 * 1024 * 1024);
+	assert_int_equal(opers->recvq_max, 256);
+	assert_int_equal(opers->net_len, IRC_CIDR_IPV4_OFFSET + 24);
+
+	const struct irc_conf_class *users = &conf.classes.entries[1];
+
+	assert_int_equal(users->sendq_max, 64 * 1024);
+	assert_int_equal(users->recvq_max, IRC_CONF_CLASS_RECVQ_MAX);
+	assert_int_equal(users->net_len, 0);
+
+	valid = irc_conf_queue_budget_set(&conf, "1G", &code);
+
+	assert_true(valid);
+	assert_int_equal(conf.classes.budget, 1024 * 1024 * 1024);
+}
+
+static void reject_malformed_classes(void **state)
+{
+	(void)state;
+
+	static const char *const malformed[] = {
+		"users",	 "users:",	   ":64K",
+		"users:0",	 "users:64X",	   "users:2G",
+		"users:64K:513", "users:64K:",	   "users:64K@",
+		"users:K",	 "users:64K@host", "a very long name:64K"
+	};
+
+	struct irc_conf conf = {};
+
+	enum irc_conf_status_code code;
+
+	for (size_t i = 0; i < (sizeof(malformed) / sizeof(*malformed)); ++i) {
+		const bool valid =
+			irc_conf_class_add(&conf, malformed[i], &code);
+
+		assert_false(valid);
+		assert_int_equal(code, IRC_CONF_MALFORMED);
+	}
+	assert_int_equal(conf.classes.num_entries, 0);
+
+	bool valid = irc_conf_queue_budget_set(&conf, "2T", &code);
+
+	assert_false(valid);
+	assert_int_equal(code, IRC_CONF_OUT_OF_RANGE);
+
+	valid = irc_conf_queue_budget_set(&conf, "99999999999G", &code);
+
+	assert_false(valid);
+	assert_int_equal(conf.classes.budget, 0);
+}
+
+/// @brief Writes a configuration file, returning its path.
+static const char *conf_file_write(const char *const text)
+{
+	static char path[] = "/tmp/core_test_conf_XXXXXX";
+
+	strcpy(path, "/tmp/core_test_conf_XXXXXX");
+
+	const int fd = mkstemp(path);
+	assert_true(fd >= 0);
+
+	FILE *file = fdopen(fd, "w");
+	assert_non_null(file);
+
+	fputs(text, file);
+	fclose(file);
+	return path;
+}
+
+static void load_file(void **state)
+{
+	(void)state;
+
+	static const char text[] = "# A comment, then a blank line.\n"
+				   "\n"
+				   "listen 127.0.0.1:6667\n"
+				   "  listen   [::1]:6697  \n"
+				   "server_name irc.example\n"
+				   "class users:1M@192.0.2.0/24\n"
+				   "kline *@bad.example\n"
+				   "kline *@worse.example\n"
+				   "tables\tthp\n"
+				   "snapshot_file /var/lib/ircd/snapshot\n"
+				   "snapshot_interval 60\n";
+
+	const char *path = conf_file_write(text);
+
+	struct irc_conf conf = {};
+
+	size_t line = 1;
+	enum irc_conf_status_code code;
+
+	const bool valid = irc_conf_load(&conf, path, &line, &code);
+
+	assert_true(valid);
+	assert_int_equal(code, IRC_CONF_STATUS_OK);
+	assert_int_equal(line, 0);
+	assert_string_equal(conf.path, path);
+
+	assert_int_equal(conf.listeners.num_entries, 2);
+	assert_string_equal(conf.listeners.entries[0].host, "127.0.0.1");
+	assert_string_equal(conf.listeners.entries[1].host, "[::1]");
+	assert_string_equal(conf.listeners.entries[1].port, "6697");
+	assert_string_equal(conf.server_name, "irc.example");
+	assert_int_equal(conf.classes.num_entries, 1);
+	assert_int_equal(conf.klines.num_entries, 2);
+	assert_int_equal(conf.tables.vmem, IRC_VMEM_THP);
+	assert_string_equal(conf.snapshot.path, "/var/lib/ircd/snapshot");
+	assert_int_equal(conf.snapshot.interval_s, 60);
+
+	irc_conf_release(&conf);
+	assert_null(conf.klines.entries);
+
+	unlink(path);
+}
+
+static void reject_malformed_file(void **state)
+{
+	(void)state;
+
+	static const struct {
+		const char *text;
+		uint line;
+		enum irc_conf_status_code code;
+	} files[] = {
+		{ "listen 127.0.0.1:6667\nlisten\n", 2, IRC_CONF_MALFORMED },
+		{ "# ok\nport 6667\n", 2, IRC_CONF_MALFORMED },
+		{ "\n\nwatchdog 600000\n", 3, IRC_CONF_OUT_OF_RANGE },
+		{ "server_id 0aa\n", 1, IRC_CONF_MALFORMED },
+		{ "snapshot_interval 0\n", 1, IRC_CONF_OUT_OF_RANGE }
+	};
+
+	for (size_t i = 0; i < (sizeof(files) / sizeof(*files)); ++i) {
+		const char *path = conf_file_write(files[i].text);
+
+		struct irc_conf conf = {};
+
+		size_t line;
+		enum irc_conf_status_code code;
+
+		const bool valid = irc_conf_load(&conf, path, &line, &code);
+
+		assert_false(valid);
+		assert_int_equal(line, files[i].line);
+		assert_int_equal(code, files[i].code);
+
+		irc_conf_release(&conf);
+		unlink(path);
+	}
+
+	struct irc_conf conf = {};
+
+	size_t line;
+	enum irc_conf_status_code code;
+
+	const bool valid =
+		irc_conf_load(&conf, "/nonexistent/ircd.conf", &line, &code);
+
+	assert_false(valid);
+	assert_int_equal(line, 0);
+}
+
 int main(void)
 {
 	static const struct CMUnitTest tests[] = {
@@ -149,7 +460,17 @@ int main(void)
 		[2] = cmocka_unit_test(reject_neg_port_num),
 		[3] = cmocka_unit_test(reject_alpha_port),
 		[4] = cmocka_unit_test(reject_mixed_whitespace_alpha_port),
-		[5] = cmocka_unit_test(reject_all_whitespace_port)
+		[5] = cmocka_unit_test(reject_all_whitespace_port),
+		[6] = cmocka_unit_test(accept_watchdog_threshold),
+		[7] = cmocka_unit_test(reject_too_large_watchdog_threshold),
+		[8] = cmocka_unit_test(accept_links),
+		[9] = cmocka_unit_test(reject_malformed_links),
+		[10] = cmocka_unit_test(accept_tables_vmem),
+		[11] = cmocka_unit_test(reject_unknown_tables_vmem),
+		[12] = cmocka_unit_test(accept_classes),
+		[13] = cmocka_unit_test(reject_malformed_classes),
+		[14] = cmocka_unit_test(load_file),
+		[15] = cmocka_unit_test(reject_malformed_file)
 	};
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/compiler.h"
+#include "core/filter.h"
+
+// clang-format off
+
+#define RANDOM_PHRASE_NUM       (300)
+#define RANDOM_PHRASE_LEN_MAX   (6)
+#define RANDOM_TEXT_NUM         (2000)
+#define RANDOM_TEXT_LEN_MAX     (24)
+
+// clang-format on
+
+static bool match(const struct irc_filter *const filter, const char *text)
+{
+	return irc_filter_match(filter, text, strlen(text), NULL);
+}
+
+static void match_ignores_case(void **state)
+{
+	(void)state;
+
+	static const char *const phrases[] = { "he",   "she",	  "his",
+					       "hers", "Cialis Online", "" };
+
+	struct irc_filter *filter =
+		irc_filter_new(phrases, sizeof(phrases) / sizeof(*phrases));
+
+	size_t phrase = SIZE_MAX;
+
+	bool found = irc_filter_match(filter, "USHERS", 6, &phrase);
+	assert_true(found);
+	assert_true((phrase == 0) || (phrase == 1));
+
+	found = irc_filter_match(filter, "buy cIALIS oNLINE now", 21, &phrase);
+	assert_true(found);
+	assert_int_equal(phrase, 4);
+
+	assert_true(match(filter, "this"));
+	assert_false(match(filter, "hi tree? no: hx sx"));
+	assert_false(match(filter, "cialis  online"));
+
+	// The empty phrase is skipped rather than matching everything, and
+	// the text is only scanned as far as its length.
+	assert_false(match(filter, "x"));
+	assert_false(irc_filter_match(filter, "sh|e", 2, NULL));
+
+	irc_filter_free(filter);
+}
+
+static void random_phrase(char *const str, const size_t len_min,
+			  const size_t len_max)
+{
+	static const char alphabet[] = "abcdeABC ";
+
+	const size_t len = len_min + ((size_t)rand() % (len_max - len_min + 1));
+
+	for (size_t i = 0; i < len; ++i) {
+		str[i] = alphabet[(size_t)rand() % (sizeof(alphabet) - 1)];
+	}
+	str[len] = '\0';
+}
+
+/// @brief Checks whether a text contains a phrase, ignoring case, the slow
+/// way.
+IRC_ATTRIB_PURE
+static bool contains(const char *const text, const char *const phrase)
+{
+	const size_t len = strlen(phrase);
+
+	for (const char *c = text; *c != '\0'; ++c) {
+		if (!strncasecmp(c, phrase, len)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void match_agrees_with_scan(void **state)
+{
+	(void)state;
+
+	static char storage[RANDOM_PHRASE_NUM][RANDOM_PHRASE_LEN_MAX + 1];
+	static const char *phrases[RANDOM_PHRASE_NUM];
+
+	srand(39);
+
+	for (size_t i = 0; i < RANDOM_PHRASE_NUM; ++i) {
+		random_phrase(storage[i], 3, RANDOM_PHRASE_LEN_MAX);
+		phrases[i] = storage[i];
+	}
+
+	struct irc_filter *filter =
+		irc_filter_new(phrases, RANDOM_PHRASE_NUM);
+
+	size_t num_found = 0;
+
+	for (size_t i = 0; i < RANDOM_TEXT_NUM; ++i) {
+		char text[RANDOM_TEXT_LEN_MAX + 1];
+		random_phrase(text, 1, RANDOM_TEXT_LEN_MAX);
+
+		bool expected = false;
+
+		for (size_t j = 0; (j < RANDOM_PHRASE_NUM) && !expected; ++j) {
+			expected = contains(text, phrases[j]);
+		}
+
+		size_t phrase;
+		const bool found =
+			irc_filter_match(filter, text, strlen(text), &phrase);
+
+		assert_int_equal(found, expected);
+
+		if (found) {
+			assert_true(contains(text, phrases[phrase]));
+			num_found++;
+		}
+	}
+
+	// Both outcomes have to be exercised.
+	assert_true(num_found > 0);
+	assert_true(num_found < RANDOM_TEXT_NUM);
+
+	irc_filter_free(filter);
+}
+
+static void load_keeps_spaces(void **state)
+{
+	(void)state;
+
+	char path[] = "/tmp/core_test_filter_XXXXXX";
+	const int fd = mkstemp(path);
+	assert_true(fd >= 0);
+
+	FILE *file = fdopen(fd, "w");
+	fputs("# phrases\n"
+	      "\n"
+	      " spam \r\n"
+	      "free coins\n",
+	      file);
+	fclose(file);
+
+	size_t line;
+	struct irc_filter *filter = irc_filter_load(path, &line);
+
+	assert_non_null(filter);
+	assert_int_equal(filter->num_phrases, 2);
+	assert_true(match(filter, "no spam here"));
+	assert_false(match(filter, "spammers"));
+	assert_true(match(filter, "FREE COINS"));
+
+	_Atomic(struct irc_filter *) cur = NULL;
+
+	irc_filter_swap(&cur, filter);
+	assert_ptr_equal(atomic_load(&cur), filter);
+
+	file = fopen(path, "w");
+
+	for (size_t i = 0; i <= IRC_FILTER_PHRASE_LEN_MAX; ++i) {
+		fputc('x', file);
+	}
+	fputs("\n", file);
+	fclose(file);
+
+	assert_null(irc_filter_load(path, &line));
+	assert_int_equal(line, 1);
+
+	unlink(path);
+
+	assert_null(irc_filter_load(path, &line));
+	assert_int_equal(line, 0);
+
+	irc_filter_swap(&cur, NULL);
+	assert_null(atomic_load(&cur));
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(match_ignores_case),
+		[1] = cmocka_unit_test(match_agrees_with_scan),
+		[2] = cmocka_unit_test(load_keeps_spaces)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
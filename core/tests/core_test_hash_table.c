@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/hash_table.h"
+
+// clang-format off
+
+#define KEY_NUM         (1000)
+
+// clang-format on
+
+/// @brief Stands in for keys, which the tables below never dereference.
+static u8 keys[KEY_NUM];
+
+/// @brief Hashes keys by their index modulo a small number, so that they
+/// collide in runs.
+static size_t clustered_hash(const void *const key, const u8 *const secret_key)
+{
+	(void)secret_key;
+
+	return (size_t)((const u8 *)key - keys) % 7;
+}
+
+static void table_init(struct irc_ht *const ht, const irc_ht_hash_cb hash)
+{
+	const struct irc_ht_conf conf = {
+		// clang-format off
+
+		.initial_capacity	= 16,
+		.load_fact_max		= 75,
+		.hash			= hash
+
+		// clang-format on
+	};
+	irc_ht_init(ht, &conf);
+}
+
+/// @brief Checks the invariants of robin hood hashing: every entry sits
+/// exactly as far from its home slot as its probe sequence length says, and
+/// no entry is further from home than the one before it by more than a slot.
+static void invariants_check(const struct irc_ht *const ht)
+{
+	const size_t mask = ht->capacity - 1;
+	size_t num_entries = 0;
+
+	for (size_t pos = 0; pos < ht->capacity; ++pos) {
+		const struct irc_ht_entry *ent = &ht->entries[pos];
+
+		if (!ent->psl) {
+			continue;
+		}
+		num_entries++;
+
+		const size_t home = ht->conf.hash ?
+					    ht->conf.hash(ent->key,
+							  ht->secret_key) :
+					    irc_ht_hash_bytes(&ent->key,
+							      sizeof(ent->key),
+							      ht->secret_key);
+
+		assert_int_equal((pos - home) & mask, ent->psl - 1);
+
+		const struct irc_ht_entry *prev = &ht->entries[(pos - 1) & mask];
+
+		assert_true(ent->psl <= (prev->psl + 1));
+	}
+	assert_int_equal(num_entries, ht->num_entries);
+}
+
+static void add_get_replace(void **state)
+{
+	(void)state;
+
+	struct irc_ht ht;
+	table_init(&ht, NULL);
+
+	assert_null(irc_ht_get(&ht, &keys[0]));
+
+	irc_ht_add(&ht, &keys[0], &keys[1]);
+	irc_ht_add(&ht, &keys[1], &keys[2]);
+
+	assert_ptr_equal(irc_ht_get(&ht, &keys[0]), &keys[1]);
+	assert_ptr_equal(irc_ht_get(&ht, &keys[1]), &keys[2]);
+
+	// Adding a present key replaces its value.
+	irc_ht_add(&ht, &keys[0], &keys[3]);
+
+	assert_ptr_equal(irc_ht_get(&ht, &keys[0]), &keys[3]);
+	assert_int_equal(ht.num_entries, 2);
+
+	irc_ht_destroy(&ht);
+}
+
+static void grows_past_load_factor(void **state)
+{
+	(void)state;
+
+	struct irc_ht ht;
+	table_init(&ht, NULL);
+
+	for (size_t i = 0; i < KEY_NUM; ++i) {
+		irc_ht_add(&ht, &keys[i], &keys[i]);
+
+		assert_true((ht.num_entries * 100) <= (ht.capacity * 75));
+	}
+	assert_int_equal(ht.num_entries, KEY_NUM);
+	assert_int_equal(ht.capacity, 2048);
+
+	invariants_check(&ht);
+
+	for (size_t i = 0; i < KEY_NUM; ++i) {
+		assert_ptr_equal(irc_ht_get(&ht, &keys[i]), &keys[i]);
+	}
+
+	// Reserving room already there is a no-op; more room rehashes.
+	irc_ht_reserve(&ht, KEY_NUM);
+	assert_int_equal(ht.capacity, 2048);
+
+	irc_ht_reserve(&ht, 2 * KEY_NUM);
+	assert_int_equal(ht.capacity, 4096);
+
+	invariants_check(&ht);
+
+	for (size_t i = 0; i < KEY_NUM; ++i) {
+		assert_ptr_equal(irc_ht_get(&ht, &keys[i]), &keys[i]);
+	}
+	irc_ht_destroy(&ht);
+}
+
+static void colliding_keys(void **state)
+{
+	(void)state;
+
+	struct irc_ht ht;
+	table_init(&ht, &clustered_hash);
+
+	// Seven home slots for 200 keys: every probe runs long, and wraps
+	// around the end of the table once it has grown.
+	for (size_t i = 0; i < 200; ++i) {
+		irc_ht_add(&ht, &keys[i], &keys[i]);
+	}
+	invariants_check(&ht);
+
+	for (size_t i = 0; i < 200; ++i) {
+		assert_ptr_equal(irc_ht_get(&ht, &keys[i]), &keys[i]);
+	}
+	assert_null(irc_ht_get(&ht, &keys[200]));
+
+	irc_ht_destroy(&ht);
+}
+
+static void del_shifts_back(void **state)
+{
+	(void)state;
+
+	struct irc_ht ht;
+	table_init(&ht, &clustered_hash);
+
+	for (size_t i = 0; i < 200; ++i) {
+		irc_ht_add(&ht, &keys[i], &keys[i]);
+	}
+
+	assert_null(irc_ht_del(&ht, &keys[200]));
+
+	// Every third key leaves, from the middle of the runs; the keys
+	// behind each one are shifted back rather than left behind a
+	// tombstone.
+	for (size_t i = 0; i < 200; i += 3) {
+		assert_ptr_equal(irc_ht_del(&ht, &keys[i]), &keys[i]);
+		assert_null(irc_ht_del(&ht, &keys[i]));
+
+		invariants_check(&ht);
+	}
+
+	for (size_t i = 0; i < 200; ++i) {
+		if (i % 3) {
+			assert_ptr_equal(irc_ht_get(&ht, &keys[i]), &keys[i]);
+		} else {
+			assert_null(irc_ht_get(&ht, &keys[i]));
+		}
+	}
+	assert_int_equal(ht.num_entries, 200 - 67);
+
+	// The freed slots are reused.
+	for (size_t i = 0; i < 200; i += 3) {
+		irc_ht_add(&ht, &keys[i], &keys[i]);
+	}
+	assert_int_equal(ht.num_entries, 200);
+
+	invariants_check(&ht);
+	irc_ht_destroy(&ht);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(add_get_replace),
+		[1] = cmocka_unit_test(grows_past_load_factor),
+		[2] = cmocka_unit_test(colliding_keys),
+		[3] = cmocka_unit_test(del_shifts_back)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
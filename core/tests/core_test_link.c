@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#define _GNU_SOURCE
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/chan.h"
+#include "core/cmd.h"
+#include "core/ctx.h"
+#include "core/link.h"
+
+// clang-format off
+
+/// @brief Not a real socket; nothing in these tests writes to it.
+#define PEER_FD                 (1000)
+
+// clang-format on
+
+static struct irc_ctx ctx;
+static struct irc_user alice;
+static struct irc_user bob;
+static struct irc_user carol;
+
+static struct irc_link *peer;
+
+static void recv_str(const char *const str)
+{
+	irc_link_recv(&ctx, peer, str, strlen(str));
+}
+
+/// @brief Returns `true` if a line has been queued to the peer.
+static bool sent(const char *const line)
+{
+	const struct irc_buf *out = peer->out;
+	return out && memmem(out->data, out->len, line, strlen(line));
+}
+
+/// @brief Registers a user of this server, claiming its nickname at a time.
+static void local_add(struct irc_user *const user, const char *const nick,
+		      const u64 ts)
+{
+	user->fd = -1;
+	user->registered = true;
+	user->ts = ts;
+
+	strcpy(user->nick, nick);
+	strcpy(user->username, "u");
+	strcpy(user->host, "192.0.2.1");
+
+	irc_ht_add(&ctx.nicks, user->nick, user);
+	irc_cmd_user_intro(&ctx, user);
+}
+
+static int setup(void **state)
+{
+	(void)state;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&alice, 0, sizeof(alice));
+	memset(&bob, 0, sizeof(bob));
+	memset(&carol, 0, sizeof(carol));
+
+	enum irc_conf_status_code code;
+
+	const bool valid = irc_conf_link_add(&ctx.conf, "peer.test:secret",
+					     &code);
+	assert_true(valid);
+
+	irc_init(&ctx);
+
+	irc_link_accept(&ctx, PEER_FD, "198.51.100.1");
+	peer = irc_link_find(&ctx.links, PEER_FD);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	// Takes the users of the other server along.
+	irc_link_closed(&ctx, peer);
+
+	struct irc_user *users[] = { &alice, &bob, &carol };
+
+	for (size_t i = 0; i < (sizeof(users) / sizeof(*users)); ++i) {
+		irc_chan_part_all(&ctx.chans, users[i]);
+		irc_user_release(&ctx, users[i]);
+	}
+	irc_destroy(&ctx);
+	return 0;
+}
+
+static void ids_round_trip(void **state)
+{
+	(void)state;
+
+	assert_true(irc_link_sid_valid("0AA"));
+	assert_true(irc_link_sid_valid("9Z9"));
+	assert_false(irc_link_sid_valid("AAA"));
+	assert_false(irc_link_sid_valid("0a0"));
+	assert_false(irc_link_sid_valid("0AAA"));
+
+	assert_int_equal(irc_link_sid_decode("0AA"), 0);
+	assert_int_equal(irc_link_sid_decode("999"), IRC_LINK_SID_NUM - 1);
+
+	static const u64 ids[] = { 0, 1, (UINT64_C(1234) << 32) | 99999,
+				   ((u64)(IRC_LINK_SID_NUM - 1) << 32) |
+					   UINT64_C(2176782335) };
+
+	for (size_t i = 0; i < (sizeof(ids) / sizeof(*ids)); ++i) {
+		char uid[IRC_USER_UID_LEN + 1];
+		irc_link_uid_encode(ids[i], uid);
+
+		assert_int_equal(strlen(uid), IRC_USER_UID_LEN);
+
+		u64 id;
+		const bool ok = irc_link_uid_decode(uid, &id);
+		assert_true(ok);
+		assert_int_equal(id, ids[i]);
+	}
+
+	static const char *const malformed[] = { "", "AAAAAAAAA", "0AAAAAAA",
+						 "0AAAAAAAAA", "0AAAAaAAA" };
+
+	for (size_t i = 0; i < (sizeof(malformed) / sizeof(*malformed)); ++i) {
+		u64 id;
+		const bool ok = irc_link_uid_decode(malformed[i], &id);
+		assert_false(ok);
+	}
+}
+
+static void msg_parse_splits_in_place(void **state)
+{
+	(void)state;
+
+	struct irc_link_msg msg;
+
+	char line[] = ":2BB UID nick 1 900 user  host 2BBAAAAAA :Real: name";
+	bool ok = irc_link_msg_parse(line, &msg);
+
+	assert_true(ok);
+	assert_string_equal(msg.src, "2BB");
+	assert_string_equal(msg.cmd, "UID");
+	assert_int_equal(msg.num_params, 7);
+	assert_string_equal(msg.params[3], "user");
+	assert_string_equal(msg.params[4], "host");
+	assert_string_equal(msg.params[6], "Real: name");
+
+	char bare[] = "PING 2BB";
+	ok = irc_link_msg_parse(bare, &msg);
+
+	assert_true(ok);
+	assert_null(msg.src);
+	assert_int_equal(msg.num_params, 1);
+
+	char empty[] = ":2BB";
+	ok = irc_link_msg_parse(empty, &msg);
+	assert_false(ok);
+}
+
+static void handshake_establishes_link(void **state)
+{
+	(void)state;
+
+	assert_int_equal(peer->state, IRC_LINK_HANDSHAKE);
+
+	recv_str("PASS wrong TS 6 :2BB\r\nSERVER peer.test 1 :Peer\r\n");
+	assert_true(peer->closing);
+	assert_int_equal(peer->state, IRC_LINK_HANDSHAKE);
+
+	peer->closing = false;
+
+	recv_str("PASS secret TS 6 :2BB\r\nSERVER peer.test 1 :Peer\r\n");
+	assert_int_equal(peer->state, IRC_LINK_ESTABLISHED);
+	assert_false(peer->closing);
+
+	assert_ptr_equal(ctx.links.by_sid[irc_link_sid_decode("2BB")],
+			 peer->server);
+	assert_string_equal(peer->server->name, "peer.test");
+
+	// The burst of an empty server is just the end of it.
+	assert_true(sent("SERVER maven-ircd 1 :"));
+	assert_true(sent(":0AA EOB\r\n"));
+
+	// A server that is already known would make a loop.
+	recv_str(":2BB SID peer.test 2 3CC :Again\r\n");
+	assert_true(peer->closing);
+}
+
+static void nick_collisions_save_by_ts(void **state)
+{
+	(void)state;
+
+	recv_str("PASS secret TS 6 :2BB\r\nSERVER peer.test 1 :Peer\r\n");
+
+	local_add(&alice, "alice", 1000);
+	local_add(&bob, "bob", 900);
+	local_add(&carol, "carol", 1000);
+
+	// The older nickname wins, and both lose on a tie.
+	recv_str(":2BB UID alice 1 900 u h 2BBAAAAAA :A\r\n"
+		 ":2BB UID bob 1 900 u h 2BBAAAAAB :B\r\n"
+		 ":2BB UID carol 1 2000 u h 2BBAAAAAC :C\r\n");
+
+	assert_string_equal(alice.nick, alice.uid);
+	assert_string_equal(bob.nick, bob.uid);
+	assert_string_equal(carol.nick, "carol");
+
+	const struct irc_user *user = irc_ht_get(&ctx.nicks, "alice");
+	assert_non_null(user);
+	assert_string_equal(user->uid, "2BBAAAAAA");
+
+	assert_non_null(irc_ht_get(&ctx.nicks, "2BBAAAAAB"));
+	assert_non_null(irc_ht_get(&ctx.nicks, "2BBAAAAAC"));
+
+	// Every server is told, so that they all settle it alike.
+	char save[64];
+	snprintf(save, sizeof(save), ":0AA SAVE %s 100\r\n", alice.uid);
+	assert_true(sent(save));
+	assert_true(sent(":0AA SAVE 2BBAAAAAC 100\r\n"));
+
+	// Users of the other server go with it.
+	assert_int_equal(peer->server->users.num_entries, 3);
+}
+
+static void older_chan_clears_modes(void **state)
+{
+	(void)state;
+
+	recv_str("PASS secret TS 6 :2BB\r\nSERVER peer.test 1 :Peer\r\n");
+
+	local_add(&alice, "alice", 1000);
+
+	struct irc_chan *chan = irc_chan_create(&ctx.chans, "#x");
+	chan->created = 1000;
+
+	irc_chan_join(&ctx.chans, chan, &alice, IRC_MEMBER_OP);
+	irc_chan_mask_add(chan, IRC_CHAN_BANS, "evil!*@*", "alice");
+
+	recv_str(":2BB UID dave 1 900 u h 2BBAAAAAA :D\r\n"
+		 ":2BB UID erin 1 900 u h 2BBAAAAAB :E\r\n"
+		 ":2BB SJOIN 500 #x + :@2BBAAAAAA\r\n");
+
+	assert_int_equal(chan->created, 500);
+	assert_null(chan->masks[IRC_CHAN_BANS]);
+	assert_int_equal(chan->members.num_entries, 2);
+
+	const struct irc_member *member =
+		irc_chan_member_find(&ctx.chans, chan, &alice);
+	assert_int_equal(member->prefix, 0);
+
+	struct irc_user *dave = irc_links_user_find(&ctx.links, "2BBAAAAAA");
+	member = irc_chan_member_find(&ctx.chans, chan, dave);
+	assert_int_equal(member->prefix, IRC_MEMBER_OP);
+
+	// The modes of a younger channel are dropped instead.
+	recv_str(":2BB SJOIN 800 #x + :@2BBAAAAAB\r\n");
+
+	struct irc_user *erin = irc_links_user_find(&ctx.links, "2BBAAAAAB");
+	member = irc_chan_member_find(&ctx.chans, chan, erin);
+	assert_int_equal(member->prefix, 0);
+	assert_int_equal(chan->created, 500);
+	assert_int_equal(chan->num_local, 1);
+}
+
+static void malformed_uid_is_not_filed(void **state)
+{
+	(void)state;
+
+	const size_t num_users = ctx.links.users.num_entries;
+
+	// As if kept across an upgrade from a snapshot that is corrupt.
+	strcpy(alice.uid, "0AA!!!!!!");
+	local_add(&alice, "alice", 100);
+
+	assert_int_equal(ctx.links.users.num_entries, num_users);
+	assert_null(irc_links_user_find(&ctx.links, alice.uid));
+
+	// Nor is it looked for when the user goes.
+	irc_links_user_del(&ctx, &alice);
+	assert_int_equal(ctx.links.users.num_entries, num_users);
+}
+
+static void compressed_link_switches_mid_read(void **state)
+{
+	(void)state;
+
+	if (!irc_zip_supported()) {
+		skip();
+	}
+	ctx.conf.links.entries[0].zip = true;
+
+	// What the peer sends after SERVER arrives compressed, in the same
+	// read as the handshake.
+	struct irc_zip *def = irc_zip_deflater_new();
+	struct irc_sendq wire = {};
+
+	static const char burst[] = ":2BB UID dave 1 900 u h 2BBAAAAAA :D\r\n"
+				    ":2BB EOB\r\n";
+
+	irc_zip_deflate(def, burst, sizeof(burst) - 1, true, &wire);
+
+	static const char hello[] = "PASS secret TS 6 :2BB\r\n"
+				    "CAPAB :QS ZIP\r\n"
+				    "SERVER peer.test 1 :Peer\r\n";
+
+	char data[512];
+	size_t len = sizeof(hello) - 1;
+
+	memcpy(data, hello, len);
+
+	for (u32 i = 0; i < wire.num_entries; ++i) {
+		const struct irc_buf *buf =
+			wire.entries[(wire.head + i) & (wire.capacity - 1)];
+
+		assert_true((len + buf->len) <= sizeof(data));
+		memcpy(&data[len], buf->data, buf->len);
+		len += buf->len;
+	}
+	irc_sendq_clear(&wire);
+	irc_zip_free(def);
+
+	irc_link_recv(&ctx, peer, data, len);
+
+	assert_int_equal(peer->state, IRC_LINK_ESTABLISHED);
+	assert_false(peer->closing);
+	assert_non_null(peer->zip_out);
+	assert_non_null(irc_links_user_find(&ctx.links, "2BBAAAAAA"));
+
+	// The handshake went out before compression started.
+	static const char capab[] = "CAPAB :ZIP\r\nSERVER ";
+
+	const struct irc_buf *out = peer->sendq.entries[peer->sendq.head];
+	assert_non_null(memmem(out->data, out->len, capab, sizeof(capab) - 1));
+
+	// Whatever is not a compressed stream breaks the link.
+	recv_str(":2BB PING 2BB\r\n");
+	assert_true(peer->closing);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(ids_round_trip),
+		[1] = cmocka_unit_test(msg_parse_splits_in_place),
+		[2] = cmocka_unit_test_setup_teardown(
+			handshake_establishes_link, setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(
+			nick_collisions_save_by_ts, setup, teardown),
+		[4] = cmocka_unit_test_setup_teardown(older_chan_clears_modes,
+						      setup, teardown),
+		[5] = cmocka_unit_test_setup_teardown(
+			malformed_uid_is_not_filed, setup, teardown),
+		[6] = cmocka_unit_test_setup_teardown(
+			compressed_link_switches_mid_read, setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+// The floor is pinned for this file, whatever the build compiles in, so that
+// both sides of it are covered.
+#undef IRC_LOG_SEVERITY_MIN
+#define IRC_LOG_SEVERITY_MIN (3)
+
+#include "core/log.h"
+
+// Below the floor, call sites must expand to IRC_LOG_NOP, and above it to the
+// real thing. With both swapped for constants, a call site expanding to
+// anything else is not a constant expression, and fails to build.
+#pragma push_macro("IRC_LOG_NOP")
+#pragma push_macro("IRC_LOG_MSG")
+#pragma push_macro("IRC_LOG_MSG_RATELIMIT")
+
+#undef IRC_LOG_NOP
+#undef IRC_LOG_MSG
+#undef IRC_LOG_MSG_RATELIMIT
+
+// clang-format off
+
+#define IRC_LOG_NOP(logger, args...)                            (1)
+#define IRC_LOG_MSG(logger, level, args...)                     (0)
+#define IRC_LOG_MSG_RATELIMIT(logger, level, per_sec, args...)  (0)
+
+// clang-format on
+
+_Static_assert(IRC_LOG_TRACE(NULL, "x"), "trace is below the floor");
+_Static_assert(IRC_LOG_TRACE_RATELIMIT(NULL, 1, "x"),
+	       "trace is below the floor");
+_Static_assert(IRC_LOG_DBG(NULL, "x"), "debug is below the floor");
+_Static_assert(IRC_LOG_DBG_RATELIMIT(NULL, 1, "x"),
+	       "debug is below the floor");
+_Static_assert(IRC_LOG_INFO(NULL, "x"), "info is below the floor");
+_Static_assert(IRC_LOG_INFO_RATELIMIT(NULL, 1, "x"),
+	       "info is below the floor");
+_Static_assert(!IRC_LOG_WARN(NULL, "x"), "warnings are at the floor");
+_Static_assert(!IRC_LOG_WARN_RATELIMIT(NULL, 1, "x"),
+	       "warnings are at the floor");
+_Static_assert(!IRC_LOG_ERR(NULL, "x"), "errors are above the floor");
+_Static_assert(!IRC_LOG_ERR_RATELIMIT(NULL, 1, "x"),
+	       "errors are above the floor");
+_Static_assert(!IRC_LOG_FATAL(NULL, "x"), "fatal is always compiled in");
+
+#pragma pop_macro("IRC_LOG_MSG_RATELIMIT")
+#pragma pop_macro("IRC_LOG_MSG")
+#pragma pop_macro("IRC_LOG_NOP")
+
+// clang-format off
+
+#define PER_SEC         (3)
+
+// clang-format on
+
+static struct irc_log log_;
+
+static char logged[4096];
+static size_t logged_len;
+
+static void log_cb(void *const udata, const uint lvl, char *const str)
+{
+	(void)udata;
+	(void)lvl;
+
+	logged_len += (size_t)snprintf(&logged[logged_len],
+				       sizeof(logged) - logged_len, "%s\n",
+				       str);
+
+	if (logged_len >= sizeof(logged)) {
+		logged_len = sizeof(logged) - 1;
+	}
+}
+
+/// @brief Waits until the coarse clock is early in a second, so that a test
+/// does not straddle two rate limiting windows.
+static void window_wait(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	if (ts.tv_nsec < 500000000) {
+		return;
+	}
+	ts.tv_nsec = 1000000000 - ts.tv_nsec + 20000000;
+	ts.tv_sec = ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+
+	while (nanosleep(&ts, &ts)) {
+	}
+}
+
+static int setup(void **state)
+{
+	(void)state;
+
+	log_.cb = &log_cb;
+	log_.lvl = IRC_LOG_LVL_TRACE;
+	irc_log_init(&log_);
+
+	logged[0] = '\0';
+	logged_len = 0;
+
+	window_wait();
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	pthread_mutex_destroy(&log_.lock);
+	return 0;
+}
+
+static void ratelimit_counts_suppressed(void **state)
+{
+	(void)state;
+
+	struct irc_log_ratelimit rl = { 0 };
+	uint suppressed;
+
+	for (uint i = 0; i < PER_SEC; ++i) {
+		suppressed = UINT32_MAX;
+		assert_true(irc_log_ratelimit_allow(&rl, PER_SEC, &suppressed));
+		assert_int_equal(suppressed, 0);
+	}
+
+	// Nothing is reported while messages are being suppressed.
+	for (uint i = 0; i < 5; ++i) {
+		suppressed = UINT32_MAX;
+		assert_false(
+			irc_log_ratelimit_allow(&rl, PER_SEC, &suppressed));
+		assert_int_equal(suppressed, UINT32_MAX);
+	}
+	assert_int_equal(rl.num_logged, PER_SEC);
+	assert_int_equal(rl.num_suppressed, 5);
+}
+
+static void ratelimit_window_rolls_over(void **state)
+{
+	(void)state;
+
+	struct irc_log_ratelimit rl = { 0 };
+	uint suppressed;
+
+	for (uint i = 0; i < PER_SEC + 4; ++i) {
+		(void)irc_log_ratelimit_allow(&rl, PER_SEC, &suppressed);
+	}
+
+	// The next second gets a full budget again, and its first message
+	// carries the count suppressed in the previous one.
+	rl.window--;
+
+	assert_true(irc_log_ratelimit_allow(&rl, PER_SEC, &suppressed));
+	assert_int_equal(suppressed, 4);
+	assert_int_equal(rl.num_suppressed, 0);
+
+	for (uint i = 1; i < PER_SEC; ++i) {
+		assert_true(irc_log_ratelimit_allow(&rl, PER_SEC, &suppressed));
+		assert_int_equal(suppressed, 0);
+	}
+	assert_false(irc_log_ratelimit_allow(&rl, PER_SEC, &suppressed));
+
+	// A message suppressed at the end of a window is reported by the next
+	// one that gets through, however much later it comes.
+	rl.window -= 2;
+
+	assert_true(irc_log_ratelimit_allow(&rl, PER_SEC, &suppressed));
+	assert_int_equal(suppressed, 1);
+}
+
+static void ratelimit_site_logs_budget(void **state)
+{
+	(void)state;
+
+	for (int i = 0; i < 5; ++i) {
+		IRC_LOG_ERR_RATELIMIT(&log_, 2, "flood %d", i);
+	}
+	assert_string_equal(logged, "[error] flood 0\n[error] flood 1\n");
+}
+
+static void below_floor_is_not_evaluated(void **state)
+{
+	(void)state;
+
+	int calls = 0;
+
+	IRC_LOG_INFO(&log_, "%d", ++calls);
+	IRC_LOG_DBG_RATELIMIT(&log_, 1, "%d", ++calls);
+	assert_int_equal(calls, 0);
+
+	IRC_LOG_WARN(&log_, "%d", ++calls);
+	assert_int_equal(calls, 1);
+	assert_string_equal(logged, "[warn] 1\n");
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test_setup_teardown(
+			ratelimit_counts_suppressed, setup, teardown),
+		[1] = cmocka_unit_test_setup_teardown(
+			ratelimit_window_rolls_over, setup, teardown),
+		[2] = cmocka_unit_test_setup_teardown(
+			ratelimit_site_logs_budget, setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(
+			below_floor_is_not_evaluated, setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/log_bin.h"
+
+// clang-format off
+
+#define FILE_SIZE_MAX   (1024 * 1024)
+#define TEXT_LEN_MAX    (4096)
+
+// clang-format on
+
+static char dir[64];
+static char path[IRC_LOG_BIN_PATH_LEN_MAX + 1];
+static struct irc_log_bin bin;
+
+static int setup(void **state)
+{
+	(void)state;
+
+	strcpy(dir, "/tmp/core_test_log_bin.XXXXXX");
+
+	if (!mkdtemp(dir)) {
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/log", dir);
+
+	return irc_log_bin_open(&bin, path, FILE_SIZE_MAX, 1) ? 0 : -1;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	char rotated[IRC_LOG_BIN_PATH_LEN_MAX + 16];
+
+	irc_log_bin_close(&bin);
+
+	snprintf(rotated, sizeof(rotated), "%s.1", path);
+	unlink(rotated);
+	unlink(path);
+	rmdir(dir);
+
+	return 0;
+}
+
+/// @brief Checks a specification parsed from the start of a format string.
+static void spec_check(const char *const fmt, const size_t len,
+		       const uint num_stars, const enum irc_log_bin_arg arg,
+		       const enum irc_log_bin_width width)
+{
+	struct irc_log_bin_spec spec;
+
+	const char *next = irc_log_bin_fmt_next(fmt, &spec);
+
+	assert_ptr_equal(spec.start, fmt);
+	assert_int_equal(spec.len, len);
+	assert_ptr_equal(next, &fmt[len]);
+	assert_int_equal(spec.num_stars, num_stars);
+	assert_int_equal(spec.arg, arg);
+	assert_int_equal(spec.width, width);
+}
+
+static void fmt_next_parses_specs(void **state)
+{
+	(void)state;
+
+	spec_check("%d", 2, 0, IRC_LOG_BIN_ARG_INT, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%c", 2, 0, IRC_LOG_BIN_ARG_INT, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%-+ #0'12.4ld", 13, 0, IRC_LOG_BIN_ARG_INT,
+		   IRC_LOG_BIN_WIDTH_LONG);
+	spec_check("%*.*s", 5, 2, IRC_LOG_BIN_ARG_STR, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%.*s", 4, 1, IRC_LOG_BIN_ARG_STR, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%*d", 3, 1, IRC_LOG_BIN_ARG_INT, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%hhx", 4, 0, IRC_LOG_BIN_ARG_UINT, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%hu", 3, 0, IRC_LOG_BIN_ARG_UINT, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%llu", 4, 0, IRC_LOG_BIN_ARG_UINT,
+		   IRC_LOG_BIN_WIDTH_LLONG);
+	spec_check("%zu", 3, 0, IRC_LOG_BIN_ARG_UINT, IRC_LOG_BIN_WIDTH_SIZE);
+	spec_check("%jd", 3, 0, IRC_LOG_BIN_ARG_INT,
+		   IRC_LOG_BIN_WIDTH_INTMAX);
+	spec_check("%td", 3, 0, IRC_LOG_BIN_ARG_INT,
+		   IRC_LOG_BIN_WIDTH_PTRDIFF);
+	spec_check("%.3f", 4, 0, IRC_LOG_BIN_ARG_DBL, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%p", 2, 0, IRC_LOG_BIN_ARG_PTR, IRC_LOG_BIN_WIDTH_INT);
+	spec_check("%%", 2, 0, IRC_LOG_BIN_ARG_NONE, IRC_LOG_BIN_WIDTH_INT);
+
+	// A truncated specification is left as text.
+	spec_check("%5", 2, 0, IRC_LOG_BIN_ARG_NONE, IRC_LOG_BIN_WIDTH_INT);
+
+	struct irc_log_bin_spec spec;
+	const char *const fmt = "a %s b";
+
+	const char *next = irc_log_bin_fmt_next(fmt, &spec);
+
+	assert_ptr_equal(spec.start, &fmt[2]);
+	assert_null(irc_log_bin_fmt_next(next, &spec));
+}
+
+/// @brief Renders the record at an offset, checking its size on the way.
+static void rec_render(const size_t pos, const char *const fmt,
+			char *const text)
+{
+	struct irc_log_bin_rec rec;
+	memcpy(&rec, &bin.map[pos], sizeof(rec));
+
+	assert_int_equal(rec.size, bin.pos - pos);
+	assert_true((rec.size - sizeof(rec)) <= IRC_LOG_BIN_PAYLOAD_SIZE_MAX);
+
+	FILE *out = fmemopen(text, TEXT_LEN_MAX, "w");
+	assert_non_null(out);
+
+	irc_log_bin_render(out, fmt, &bin.map[pos + sizeof(rec)],
+			   rec.size - sizeof(rec));
+	fclose(out);
+}
+
+/// @brief Writes a record for a call site with the given format string.
+///
+/// @returns The offset of the record.
+IRC_ATTRIB_FMT(printf, 1, 2)
+static size_t bin_write(const char *const fmt, ...)
+{
+	const struct irc_log_site site = { __FILE__, fmt, __LINE__,
+					   IRC_LOG_LVL_INFO };
+	const size_t pos = bin.pos;
+
+	va_list args;
+
+	va_start(args, fmt);
+	irc_log_bin_write(&bin, &site, args);
+	va_end(args);
+
+	return pos;
+}
+
+/// @brief Packs a message into a record, and checks that it renders back to
+/// what printf makes of it.
+IRC_ATTRIB_FMT(printf, 1, 2)
+static void round_trip(const char *const fmt, ...)
+{
+	char want[TEXT_LEN_MAX];
+	char got[TEXT_LEN_MAX];
+
+	const struct irc_log_site site = { __FILE__, fmt, __LINE__,
+					   IRC_LOG_LVL_INFO };
+	const size_t pos = bin.pos;
+
+	va_list args;
+
+	va_start(args, fmt);
+	irc_log_bin_write(&bin, &site, args);
+	va_end(args);
+
+	va_start(args, fmt);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+	vsnprintf(want, sizeof(want), fmt, args);
+#pragma GCC diagnostic pop
+
+	va_end(args);
+
+	rec_render(pos, fmt, got);
+	assert_string_equal(got, want);
+}
+
+// The "ll" length modifier is part of what has to round trip.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlong-long"
+
+static void args_round_trip(void **state)
+{
+	(void)state;
+
+	round_trip("%d %i %5d %-5d| %+d %c %hd %hhd", -1, 2, 3, 4, 5, 'x',
+		   (short)-6, (signed char)7);
+	round_trip("%ld %lld %zd %jd %td", -1L, -2LL, (ssize_t)-3,
+		   (intmax_t)-4, (ptrdiff_t)-5);
+	round_trip("%u %o %x %X %#x %08x %lu %llu %zu %ju", 1U, 8U, 0xabU,
+		   0xcdU, 0xefU, 0x12U, 4294967296UL, 18446744073709551615ULL,
+		   (size_t)3, (uintmax_t)4);
+	round_trip("%f %.2e %g %10.3f %G", (double)1.5F, (double)-2.25F,
+		   (double)1e-10F, (double)3.14159F, (double)2e20F);
+	round_trip("%p", (void *)(uintptr_t)0x1234);
+	round_trip("%s|%10s|%-5s|%.3s|%*.*s|%*d", "a", "b", "c", "defgh", 6,
+		   2, "ijk", -4, 5);
+	round_trip("100%% of %s", "nothing");
+	round_trip("no arguments");
+}
+
+#pragma GCC diagnostic pop
+
+static void long_str_is_truncated(void **state)
+{
+	(void)state;
+
+	char str[IRC_LOG_BIN_STR_LEN_MAX + 100];
+	memset(str, 'a', sizeof(str) - 1);
+	str[sizeof(str) - 1] = '\0';
+
+	char want[TEXT_LEN_MAX];
+	char got[TEXT_LEN_MAX];
+
+	const size_t pos = bin_write("<%s>", str);
+
+	snprintf(want, sizeof(want), "<%.*s>", IRC_LOG_BIN_STR_LEN_MAX, str);
+
+	rec_render(pos, "<%s>", got);
+	assert_string_equal(got, want);
+}
+
+static void payload_is_bounded(void **state)
+{
+	(void)state;
+
+	char str[IRC_LOG_BIN_STR_LEN_MAX + 1];
+	memset(str, 'a', sizeof(str) - 1);
+	str[sizeof(str) - 1] = '\0';
+
+	// Six strings and 27 integers leave less room than the last string
+	// and its two `*` values need, but more than the string alone.
+#define S6 "%s%s%s%s%s%s"
+#define D9 "%d%d%d%d%d%d%d%d%d"
+
+	const size_t pos = bin_write(S6 D9 D9 D9 "%*.*s", str, str, str, str,
+				     str, str, 1, 2, 3, 4, 5, 6, 7, 8, 9, 1, 2,
+				     3, 4, 5, 6, 7, 8, 9, 1, 2, 3, 4, 5, 6, 7,
+				     8, 9, 8, 8, str);
+
+	char got[TEXT_LEN_MAX];
+
+	rec_render(pos, S6 D9 D9 D9 "%*.*s", got);
+
+	assert_non_null(strstr(got, "789<?>"));
+
+#undef S6
+#undef D9
+}
+
+static void short_payload_renders_unknown(void **state)
+{
+	(void)state;
+
+	const size_t pos = bin_write("%d %s", 1, "abc");
+
+	struct irc_log_bin_rec rec;
+	memcpy(&rec, &bin.map[pos], sizeof(rec));
+
+	const u8 *const payload = &bin.map[pos + sizeof(rec)];
+	char got[TEXT_LEN_MAX];
+
+	// Cut within the length of the string, then within its bytes.
+	static const size_t sizes[] = { 4, 8 + 2, 8 + 4 + 1 };
+
+	for (size_t i = 0; i < (sizeof(sizes) / sizeof(*sizes)); ++i) {
+		FILE *out = fmemopen(got, sizeof(got), "w");
+
+		irc_log_bin_render(out, "%d %s", payload, sizes[i]);
+		fclose(out);
+
+		assert_non_null(strstr(got, "<?>"));
+	}
+}
+
+static void oversized_str_renders_unknown(void **state)
+{
+	(void)state;
+
+	// No string is ever packed this long, so only a corrupt record has
+	// one. It is skipped, and the arguments after it still render.
+	static u8 payload[sizeof(u32) + 1500 + sizeof(i64)];
+
+	const u32 str_len = 1500;
+	const i64 val = 7;
+
+	memcpy(payload, &str_len, sizeof(str_len));
+	memset(&payload[sizeof(str_len)], 'a', str_len);
+	memcpy(&payload[sizeof(str_len) + str_len], &val, sizeof(val));
+
+	char got[TEXT_LEN_MAX];
+	FILE *out = fmemopen(got, sizeof(got), "w");
+
+	irc_log_bin_render(out, "<%s> %d", payload, sizeof(payload));
+	fclose(out);
+
+	assert_string_equal(got, "<<?>> 7");
+}
+
+static void failed_map_backs_off(void **state)
+{
+	(void)state;
+
+	// The directory goes away under the active file, so that the next
+	// file can not be created.
+	unlink(path);
+	rmdir(dir);
+
+	bin.pos = bin.size_max;
+	bin_write("rotates");
+
+	assert_null(bin.map);
+	assert_int_equal(bin.pos, 0);
+
+	// Not retried right away, nor rotated again.
+	mkdir(dir, 0700);
+	bin_write("dropped");
+
+	assert_null(bin.map);
+	assert_int_not_equal(access(path, F_OK), 0);
+
+	const struct timespec ts = { .tv_sec = 1, .tv_nsec = 100000000 };
+	nanosleep(&ts, NULL);
+
+	bin_write("remaps");
+
+	assert_non_null(bin.map);
+	assert_int_equal(access(path, F_OK), 0);
+
+	const size_t pos = bin_write("%s", "written");
+	char got[TEXT_LEN_MAX];
+
+	rec_render(pos, "%s", got);
+	assert_string_equal(got, "written");
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(fmt_next_parses_specs),
+		[1] = cmocka_unit_test_setup_teardown(args_round_trip, setup,
+						      teardown),
+		[2] = cmocka_unit_test_setup_teardown(long_str_is_truncated,
+						      setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(payload_is_bounded,
+						      setup, teardown),
+		[4] = cmocka_unit_test_setup_teardown(
+			short_payload_renders_unknown, setup, teardown),
+		[5] = cmocka_unit_test(oversized_str_renders_unknown),
+		[6] = cmocka_unit_test_setup_teardown(failed_map_backs_off,
+						      setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
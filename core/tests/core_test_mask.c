@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/chan.h"
+#include "core/mask.h"
+
+/// @brief The channels the ban state of members is checked in.
+static struct irc_chans chans;
+
+static int setup(void **state)
+{
+	(void)state;
+
+	irc_chans_init(&chans);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	irc_chans_destroy(&chans);
+	return 0;
+}
+
+static void assert_normalized(const char *const mask,
+			      const char *const expected)
+{
+	char out[IRC_MASK_LEN_MAX + 1];
+
+	assert_true(irc_mask_normalize(mask, out));
+	assert_string_equal(out, expected);
+}
+
+static bool match(struct irc_mask_set *const set, const char *const nick,
+		  const char *const user, const char *const host)
+{
+	const struct irc_mask_subject subject = { .nick = nick,
+						  .user = user,
+						  .host = host };
+
+	return irc_mask_set_match(set, &subject);
+}
+
+static void normalize_fills_missing_parts(void **state)
+{
+	(void)state;
+
+	assert_normalized("nick", "nick!*@*");
+	assert_normalized("host.example", "*!*@host.example");
+	assert_normalized("2001:db8::1", "*!*@2001:db8::1");
+	assert_normalized("user@host", "*!user@host");
+	assert_normalized("nick!user", "nick!user@*");
+	assert_normalized("n!u@h", "n!u@h");
+	assert_normalized("!@", "*!*@*");
+
+	char out[IRC_MASK_LEN_MAX + 1];
+
+	assert_false(irc_mask_normalize("", out));
+	assert_false(irc_mask_normalize("a b", out));
+	assert_false(irc_mask_normalize("*!toolongusername@*", out));
+}
+
+static void match_every_kind(void **state)
+{
+	(void)state;
+
+	struct irc_mask_set *set = irc_mask_set_new();
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+	static const struct {
+		const char *mask;
+		enum irc_mask_kind kind;
+	} masks[] = {
+		{ "*!*@192.0.2.1", IRC_MASK_HOST },
+		{ "*!*@*.Example.COM", IRC_MASK_HOST_SUFFIX },
+		{ "*!bad@198.51.*", IRC_MASK_HOST_PREFIX },
+		{ "Troll!*@*", IRC_MASK_NICK },
+		{ "sp?mmer*!*@*", IRC_MASK_OTHER }
+	};
+
+#pragma GCC diagnostic pop
+
+	for (size_t i = 0; i < (sizeof(masks) / sizeof(*masks)); ++i) {
+		const struct irc_mask_entry *entry =
+			irc_mask_set_add(set, masks[i].mask, "op", 0);
+
+		assert_non_null(entry);
+		assert_int_equal(entry->kind, masks[i].kind);
+	}
+	assert_null(irc_mask_set_add(set, "*!*@192.0.2.1", "op", 0));
+
+	assert_true(match(set, "a", "b", "192.0.2.1"));
+	assert_false(match(set, "a", "b", "192.0.2.10"));
+
+	assert_true(match(set, "a", "b", "host.example.com"));
+	assert_true(match(set, "a", "b", "HOST.EXAMPLE.COM"));
+	assert_false(match(set, "a", "b", "example.com"));
+
+	assert_true(match(set, "a", "bad", "198.51.100.7"));
+	assert_false(match(set, "a", "good", "198.51.100.7"));
+
+	assert_true(match(set, "troll", "b", "203.0.113.1"));
+	assert_true(match(set, "TROLL", "b", "203.0.113.1"));
+	assert_false(match(set, "trolls", "b", "203.0.113.1"));
+
+	assert_true(match(set, "spammer42", "b", "203.0.113.1"));
+	assert_false(match(set, "spamer", "b", "203.0.113.1"));
+
+	assert_true(irc_mask_set_del(set, "*!*@*.Example.COM"));
+	assert_false(irc_mask_set_del(set, "*!*@*.Example.COM"));
+	assert_false(match(set, "a", "b", "host.example.com"));
+
+	irc_mask_set_free(set);
+}
+
+static void del_keeps_masks_sharing_a_key(void **state)
+{
+	(void)state;
+
+	struct irc_mask_set *set = irc_mask_set_new();
+
+	irc_mask_set_add(set, "a!*@192.0.2.1", "op", 0);
+	irc_mask_set_add(set, "b!*@192.0.2.1", "op", 0);
+	irc_mask_set_add(set, "*!c@*.example", "op", 0);
+	irc_mask_set_add(set, "*!d@*.example", "op", 0);
+
+	assert_true(match(set, "a", "x", "192.0.2.1"));
+	assert_true(match(set, "b", "x", "192.0.2.1"));
+	assert_false(match(set, "c", "x", "192.0.2.1"));
+
+	// Whichever mask heads the chain of the key goes first.
+	assert_true(irc_mask_set_del(set, "b!*@192.0.2.1"));
+	assert_true(irc_mask_set_del(set, "*!d@*.example"));
+
+	assert_true(match(set, "a", "x", "192.0.2.1"));
+	assert_false(match(set, "b", "x", "192.0.2.1"));
+	assert_true(match(set, "x", "c", "h.example"));
+	assert_false(match(set, "x", "d", "h.example"));
+
+	assert_true(irc_mask_set_del(set, "a!*@192.0.2.1"));
+	assert_true(irc_mask_set_del(set, "*!c@*.example"));
+
+	assert_int_equal(set->num_entries, 0);
+	assert_false(match(set, "a", "x", "192.0.2.1"));
+
+	irc_mask_set_free(set);
+}
+
+static void member_ban_state_follows_masks(void **state)
+{
+	(void)state;
+
+	struct irc_user user = { .nick = "nick",
+				 .username = "user",
+				 .host = "192.0.2.1" };
+
+	struct irc_chan *chan = irc_chan_create(&chans, "#bans");
+	struct irc_member *member = irc_chan_join(&chans, chan, &user, 0);
+
+	assert_false(irc_member_banned(member));
+
+	assert_non_null(irc_chan_mask_add(chan, IRC_CHAN_BANS,
+					  "*!*@192.0.2.*", "op"));
+	assert_true(irc_member_banned(member));
+
+	assert_non_null(irc_chan_mask_add(chan, IRC_CHAN_EXCEPTS,
+					  "nick!*@*", "op"));
+	assert_false(irc_member_banned(member));
+
+	// A new nickname is only taken into account once the cached state is
+	// invalidated.
+	strcpy(user.nick, "other");
+	assert_false(irc_member_banned(member));
+
+	irc_member_bans_invalidate(member);
+	assert_true(irc_member_banned(member));
+
+	assert_true(irc_chan_mask_del(chan, IRC_CHAN_BANS, "*!*@192.0.2.*"));
+	assert_false(irc_member_banned(member));
+	assert_null(chan->masks[IRC_CHAN_BANS]);
+
+	irc_chan_part_all(&chans, &user);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(normalize_fills_missing_parts),
+		[1] = cmocka_unit_test(match_every_kind),
+		[2] = cmocka_unit_test(del_keeps_masks_sharing_a_key),
+		[3] = cmocka_unit_test_setup_teardown(
+			member_ban_state_follows_masks, setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/metrics.h"
+
+static void hist_bucket_is_log2(void **state)
+{
+	(void)state;
+
+	assert_int_equal(irc_metrics_hist_bucket(0), 0);
+	assert_int_equal(irc_metrics_hist_bucket(1), 1);
+	assert_int_equal(irc_metrics_hist_bucket(2), 2);
+	assert_int_equal(irc_metrics_hist_bucket(3), 2);
+	assert_int_equal(irc_metrics_hist_bucket(4), 3);
+	assert_int_equal(irc_metrics_hist_bucket(UINT64_MAX),
+			 IRC_METRICS_HIST_BUCKET_NUM - 1);
+}
+
+static void read_merges_shards(void **state)
+{
+	(void)state;
+
+	struct irc_metrics *const m = calloc(1, sizeof(*m));
+	assert_non_null(m);
+
+	irc_metrics_shard_idx = 0;
+	IRC_METRIC_ADD(m, IRC_METRIC_BYTES_IN, 100);
+	IRC_METRIC_GAUGE_ADD(m, IRC_METRIC_CLIENTS, 2);
+	irc_metrics_hist_record(m, IRC_METRIC_HIST_POLL_BATCH, 4);
+
+	irc_metrics_shard_idx = 3;
+	IRC_METRIC_ADD(m, IRC_METRIC_BYTES_IN, 23);
+	IRC_METRIC_GAUGE_ADD(m, IRC_METRIC_CLIENTS, -1);
+	irc_metrics_hist_record(m, IRC_METRIC_HIST_POLL_BATCH, 5);
+
+	irc_metrics_shard_idx = 0;
+
+	struct irc_metrics_snapshot snap;
+	irc_metrics_read(m, &snap);
+
+	assert_int_equal(snap.counters[IRC_METRIC_BYTES_IN], 123);
+	assert_int_equal(snap.gauges[IRC_METRIC_CLIENTS], 1);
+
+	const struct irc_metrics_hist *const h =
+		&snap.hists[IRC_METRIC_HIST_POLL_BATCH];
+
+	assert_int_equal(h->count, 2);
+	assert_int_equal(h->sum, 9);
+	assert_int_equal(h->buckets[3], 2);
+
+	free(m);
+}
+
+static void collect_cb(void *const udata,
+		       struct irc_metrics_snapshot *const snap)
+{
+	snap->gauges[IRC_METRIC_USERS_HT_ENTRIES] = *(const i64 *)udata;
+}
+
+static void emit_cb(void *const udata, const char *const line,
+		    const size_t len)
+{
+	bool *const found = udata;
+
+	static const char want[] = "maven_ircd_users_table_entries 42";
+
+	if ((len == (sizeof(want) - 1)) && !memcmp(line, want, len))
+		*found = true;
+}
+
+static void prom_renders_collected_gauge(void **state)
+{
+	(void)state;
+
+	struct irc_metrics *const m = calloc(1, sizeof(*m));
+	assert_non_null(m);
+
+	i64 entries = 42;
+
+	m->collect = collect_cb;
+	m->udata = &entries;
+
+	struct irc_metrics_snapshot snap;
+	irc_metrics_read(m, &snap);
+
+	bool found = false;
+	irc_metrics_render_prom(&snap, emit_cb, &found);
+
+	assert_true(found);
+	free(m);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(hist_bucket_is_log2),
+		[1] = cmocka_unit_test(read_merges_shards),
+		[2] = cmocka_unit_test(prom_renders_collected_gauge)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
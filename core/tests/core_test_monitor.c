@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/monitor.h"
+
+// clang-format off
+
+#define RANDOM_USER_NUM         (50)
+#define RANDOM_NICK_NUM         (300)
+#define RANDOM_OP_NUM           (20000)
+
+// clang-format on
+
+/// @brief Checks that every link of a user is where its nickname expects it.
+static void assert_links(struct irc_ht *const monitors,
+			 const struct irc_user *const user)
+{
+	for (u32 i = 0; i < user->monitor.num_entries; ++i) {
+		struct irc_monitor_link *link = &user->monitor.entries[i];
+
+		assert_ptr_equal(link->user, user);
+		assert_ptr_equal(irc_monitor_find(monitors, link->target->nick),
+				 link->target);
+		assert_true(link->target_idx < link->target->num_watchers);
+		assert_ptr_equal(link->target->watchers[link->target_idx],
+				 link);
+	}
+}
+
+static void add_del_follow_case_mapping(void **state)
+{
+	(void)state;
+
+	struct irc_ht monitors;
+	irc_monitors_init(&monitors);
+
+	struct irc_user alice = {};
+	struct irc_user bob = {};
+
+	enum irc_monitor_add_result res =
+		irc_monitor_add(&monitors, &alice, "Carol[away]");
+	assert_int_equal(res, IRC_MONITOR_ADDED);
+
+	res = irc_monitor_add(&monitors, &alice, "carol{AWAY}");
+	assert_int_equal(res, IRC_MONITOR_PRESENT);
+
+	res = irc_monitor_add(&monitors, &bob, "CAROL{away}");
+	assert_int_equal(res, IRC_MONITOR_ADDED);
+
+	const struct irc_monitor *carol =
+		irc_monitor_find(&monitors, "carol[away]");
+	assert_non_null(carol);
+	assert_string_equal(carol->nick, "Carol[away]");
+	assert_int_equal(carol->num_watchers, 2);
+
+	bool found = irc_monitor_del(&monitors, &alice, "dave");
+	assert_false(found);
+
+	found = irc_monitor_del(&monitors, &alice, "carol[away]");
+	assert_true(found);
+	assert_int_equal(carol->num_watchers, 1);
+	assert_ptr_equal(carol->watchers[0]->user, &bob);
+
+	// The entry goes with its last watcher.
+	irc_monitor_clear(&monitors, &bob);
+	assert_null(irc_monitor_find(&monitors, "carol[away]"));
+	assert_int_equal(monitors.num_entries, 0);
+	assert_int_equal(bob.monitor.num_entries, 0);
+
+	irc_monitor_clear(&monitors, &alice);
+	irc_ht_destroy(&monitors);
+}
+
+static void add_stops_at_limit(void **state)
+{
+	(void)state;
+
+	struct irc_ht monitors;
+	irc_monitors_init(&monitors);
+
+	struct irc_user user = {};
+	char nick[16];
+
+	for (int i = 0; i < IRC_MONITOR_NUM_MAX; ++i) {
+		snprintf(nick, sizeof(nick), "nick%d", i);
+
+		const enum irc_monitor_add_result res =
+			irc_monitor_add(&monitors, &user, nick);
+		assert_int_equal(res, IRC_MONITOR_ADDED);
+	}
+
+	enum irc_monitor_add_result res =
+		irc_monitor_add(&monitors, &user, "another");
+	assert_int_equal(res, IRC_MONITOR_FULL);
+
+	// Nicknames already on the list are still recognized.
+	res = irc_monitor_add(&monitors, &user, "NICK7");
+	assert_int_equal(res, IRC_MONITOR_PRESENT);
+
+	assert_links(&monitors, &user);
+	assert_int_equal(monitors.num_entries, IRC_MONITOR_NUM_MAX);
+
+	irc_monitor_clear(&monitors, &user);
+	assert_int_equal(monitors.num_entries, 0);
+	irc_ht_destroy(&monitors);
+}
+
+static void links_survive_random_changes(void **state)
+{
+	(void)state;
+
+	struct irc_ht monitors;
+	irc_monitors_init(&monitors);
+
+	static struct irc_user users[RANDOM_USER_NUM];
+	static bool watching[RANDOM_USER_NUM][RANDOM_NICK_NUM];
+
+	char nick[16];
+
+	srand(40);
+
+	for (size_t op = 0; op < RANDOM_OP_NUM; ++op) {
+		const size_t u = (size_t)rand() % RANDOM_USER_NUM;
+		const size_t n = (size_t)rand() % RANDOM_NICK_NUM;
+
+		snprintf(nick, sizeof(nick), "nick%zu", n);
+
+		const int kind = rand() % 100;
+
+		if (kind == 0) {
+			irc_monitor_clear(&monitors, &users[u]);
+
+			for (size_t i = 0; i < RANDOM_NICK_NUM; ++i) {
+				watching[u][i] = false;
+			}
+		} else if (kind < 60) {
+			const enum irc_monitor_add_result res =
+				irc_monitor_add(&monitors, &users[u], nick);
+
+			if (res == IRC_MONITOR_ADDED) {
+				assert_false(watching[u][n]);
+				watching[u][n] = true;
+			} else if (res == IRC_MONITOR_PRESENT) {
+				assert_true(watching[u][n]);
+			}
+		} else {
+			const bool found =
+				irc_monitor_del(&monitors, &users[u], nick);
+			assert_int_equal(found, watching[u][n]);
+			watching[u][n] = false;
+		}
+	}
+
+	for (size_t n = 0; n < RANDOM_NICK_NUM; ++n) {
+		snprintf(nick, sizeof(nick), "nick%zu", n);
+
+		u32 num_watchers = 0;
+
+		for (size_t u = 0; u < RANDOM_USER_NUM; ++u) {
+			num_watchers += watching[u][n];
+		}
+
+		const struct irc_monitor *target =
+			irc_monitor_find(&monitors, nick);
+
+		if (!num_watchers) {
+			assert_null(target);
+			continue;
+		}
+		assert_non_null(target);
+		assert_int_equal(target->num_watchers, num_watchers);
+	}
+
+	for (size_t u = 0; u < RANDOM_USER_NUM; ++u) {
+		assert_links(&monitors, &users[u]);
+		irc_monitor_clear(&monitors, &users[u]);
+	}
+	assert_int_equal(monitors.num_entries, 0);
+
+	irc_ht_destroy(&monitors);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(add_del_follow_case_mapping),
+		[1] = cmocka_unit_test(add_stops_at_limit),
+		[2] = cmocka_unit_test(links_survive_random_changes)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/buf.h"
+#include "core/pool.h"
+
+/// @brief Skips tests of the pools themselves when sanitizer builds pass
+/// allocations through to the system allocator.
+static void skip_if_passthrough(void)
+{
+	if (irc_pool_size(1) == 1) {
+		skip();
+	}
+}
+
+static void sizes_round_to_classes(void **state)
+{
+	(void)state;
+	skip_if_passthrough();
+
+	size_t prev = 0;
+
+	for (size_t size = 1; size <= IRC_POOL_SIZE_MAX; ++size) {
+		const size_t rounded = irc_pool_size(size);
+
+		assert_true(rounded >= size);
+		assert_true(rounded >= prev);
+		assert_int_equal(rounded % 16, 0);
+
+		// Past the smallest classes, at most a fifth is wasted.
+		if (size > 128) {
+			assert_true((rounded - size) * 5 <= rounded);
+		}
+		prev = rounded;
+	}
+	assert_int_equal(irc_pool_size(IRC_POOL_SIZE_MAX), IRC_POOL_SIZE_MAX);
+	assert_int_equal(irc_pool_size(IRC_POOL_SIZE_MAX + 1),
+			 IRC_POOL_SIZE_MAX + 1);
+}
+
+static void freed_objects_are_reused(void **state)
+{
+	(void)state;
+	skip_if_passthrough();
+
+	void *first = irc_pool_alloc(IRC_POOL_USERS, 200);
+	memset(first, 'x', 200);
+	irc_pool_free(IRC_POOL_USERS, first, 200);
+
+	// Any size of the same class gets the object back.
+	void *second = irc_pool_alloc(IRC_POOL_MEMBERS, irc_pool_size(200));
+	assert_ptr_equal(second, first);
+	irc_pool_free(IRC_POOL_MEMBERS, second, irc_pool_size(200));
+
+	char *zeroed = irc_pool_calloc(IRC_POOL_USERS, 200);
+	assert_ptr_equal(zeroed, first);
+	for (size_t i = 0; i < 200; ++i) {
+		assert_int_equal(zeroed[i], 0);
+	}
+	irc_pool_free(IRC_POOL_USERS, zeroed, 200);
+}
+
+static void subsystems_are_charged(void **state)
+{
+	(void)state;
+
+	struct irc_pool_sys_stats before;
+	irc_pool_sys_stats(IRC_POOL_FANOUTS, &before);
+
+	void *objs[100];
+	for (size_t i = 0; i < (sizeof(objs) / sizeof(*objs)); ++i) {
+		objs[i] = irc_pool_alloc(IRC_POOL_FANOUTS, 40);
+	}
+	void *big = irc_pool_alloc(IRC_POOL_FANOUTS, IRC_POOL_SIZE_MAX * 4);
+	memset(big, 'b', IRC_POOL_SIZE_MAX * 4);
+
+	struct irc_pool_sys_stats during;
+	irc_pool_sys_stats(IRC_POOL_FANOUTS, &during);
+
+	assert_int_equal(during.num_objs - before.num_objs, 101);
+	assert_int_equal(during.num_bytes - before.num_bytes,
+			 (100 * irc_pool_size(40)) + (IRC_POOL_SIZE_MAX * 4));
+
+	for (size_t i = 0; i < (sizeof(objs) / sizeof(*objs)); ++i) {
+		irc_pool_free(IRC_POOL_FANOUTS, objs[i], 40);
+	}
+	irc_pool_free(IRC_POOL_FANOUTS, big, IRC_POOL_SIZE_MAX * 4);
+
+	struct irc_pool_sys_stats after;
+	irc_pool_sys_stats(IRC_POOL_FANOUTS, &after);
+
+	assert_int_equal(after.num_objs, before.num_objs);
+	assert_int_equal(after.num_bytes, before.num_bytes);
+}
+
+static void *free_all(void *const udata)
+{
+	void **objs = udata;
+
+	for (size_t i = 0; i < 1000; ++i) {
+		irc_pool_free(IRC_POOL_SENDQS, objs[i], 64);
+	}
+	irc_pool_thread_exit();
+
+	return NULL;
+}
+
+static void objects_move_between_threads(void **state)
+{
+	(void)state;
+
+	static void *objs[1000];
+	for (size_t i = 0; i < (sizeof(objs) / sizeof(*objs)); ++i) {
+		objs[i] = irc_pool_alloc(IRC_POOL_SENDQS, 64);
+		memset(objs[i], (int)i, 64);
+	}
+
+	pthread_t thread;
+	assert_int_equal(pthread_create(&thread, NULL, &free_all, objs), 0);
+	assert_int_equal(pthread_join(thread, NULL), 0);
+
+	struct irc_pool_sys_stats stats;
+	irc_pool_sys_stats(IRC_POOL_SENDQS, &stats);
+	assert_int_equal(stats.num_objs, 0);
+
+	// What the other thread freed is available to this one.
+	for (size_t i = 0; i < (sizeof(objs) / sizeof(*objs)); ++i) {
+		objs[i] = irc_pool_alloc(IRC_POOL_SENDQS, 64);
+	}
+	for (size_t i = 0; i < (sizeof(objs) / sizeof(*objs)); ++i) {
+		irc_pool_free(IRC_POOL_SENDQS, objs[i], 64);
+	}
+}
+
+static void bufs_shrink_to_fit(void **state)
+{
+	(void)state;
+	skip_if_passthrough();
+
+	struct irc_buf *buf = irc_buf_new(2048);
+	memcpy(buf->data, "PING :x\r\n", 9);
+	buf->len = 9;
+
+	buf = irc_buf_shrink(buf);
+	assert_int_equal(buf->len, 9);
+	assert_true(buf->size < 2048);
+	assert_memory_equal(buf->data, "PING :x\r\n", 9);
+
+	// Shrinking what is already small enough is free.
+	struct irc_buf *same = irc_buf_shrink(buf);
+	assert_ptr_equal(same, buf);
+
+	irc_buf_unref(same);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(sizes_round_to_classes),
+		[1] = cmocka_unit_test(freed_objects_are_reused),
+		[2] = cmocka_unit_test(subsystems_are_charged),
+		[3] = cmocka_unit_test(objects_move_between_threads),
+		[4] = cmocka_unit_test(bufs_shrink_to_fit)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
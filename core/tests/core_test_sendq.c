@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/buf.h"
+#include "core/metrics.h"
+#include "core/net.h"
+#include "core/prof.h"
+#include "core/sendq.h"
+
+#define LINE_NUM (16384)
+
+static void buf_fmt_terminates_line(void **state)
+{
+	(void)state;
+
+	struct irc_buf *buf = irc_buf_fmt(NULL, "PING %s", "x");
+
+	assert_int_equal(buf->refs, 1);
+	assert_int_equal(buf->len, 8);
+	assert_memory_equal(buf->data, "PING x\r\n", 8);
+
+	irc_buf_unref(buf);
+
+	buf = irc_buf_fmt("time=now", "PING");
+
+	assert_int_equal(buf->len, 16);
+	assert_memory_equal(buf->data, "@time=now PING\r\n", 16);
+
+	irc_buf_unref(buf);
+}
+
+static void buf_fmt_truncates_long_line(void **state)
+{
+	(void)state;
+
+	char text[IRC_BUF_LINE_LEN_MAX * 2];
+
+	memset(text, 'x', sizeof(text) - 1);
+	text[sizeof(text) - 1] = '\0';
+
+	struct irc_buf *buf = irc_buf_fmt(NULL, "%s", text);
+
+	assert_int_equal(buf->len, IRC_BUF_LINE_LEN_MAX);
+	assert_memory_equal(&buf->data[IRC_BUF_LINE_LEN_MAX - 2], "\r\n", 2);
+
+	irc_buf_unref(buf);
+}
+
+/// @brief Writes a send queue out to a socket whose buffer fills up long
+/// before the queue is empty, and checks that what comes out on the other end
+/// is every line, in order, exactly once.
+static void sendq_flush_resumes_after_block(void **state)
+{
+	(void)state;
+
+	struct irc_metrics *const metrics = calloc(1, sizeof(*metrics));
+	assert_non_null(metrics);
+
+	struct irc_prof prof = { .metrics = metrics };
+	struct irc_net net = { .metrics = metrics, .prof = &prof };
+
+	int fds[2];
+	assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	assert_int_equal(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+
+	const int sndbuf = 4096;
+	assert_int_equal(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf,
+				    sizeof(sndbuf)),
+			 0);
+
+	// A single buffer shared by every other entry, like a broadcast.
+	struct irc_buf *shared = irc_buf_fmt(NULL, "shared");
+	struct irc_sendq sendq = {};
+
+	for (uint i = 0; i < LINE_NUM; ++i) {
+		irc_sendq_push(&sendq, (i % 2) ? irc_buf_ref(shared)
+					       : irc_buf_fmt(NULL, "%06u", i));
+	}
+
+	assert_int_equal(shared->refs, 1 + (LINE_NUM / 2));
+
+	enum irc_sendq_status status = irc_sendq_flush(&sendq, &net, fds[0]);
+	assert_int_equal(status, IRC_SENDQ_BLOCKED);
+
+	const size_t total = (LINE_NUM / 2) * (8 + 8);
+	char *const out = malloc(total);
+	assert_non_null(out);
+
+	size_t out_len = 0;
+
+	while (out_len < total) {
+		const ssize_t cnt = read(fds[1], &out[out_len], total - out_len);
+
+		assert_true(cnt > 0);
+		out_len += (size_t)cnt;
+
+		if (sendq.num_entries) {
+			status = irc_sendq_flush(&sendq, &net, fds[0]);
+			assert_int_not_equal(status, IRC_SENDQ_ERR);
+		}
+	}
+
+	assert_int_equal(sendq.num_entries, 0);
+	assert_int_equal(sendq.len, 0);
+	assert_int_equal(shared->refs, 1);
+
+	for (uint i = 0; i < LINE_NUM; i += 2) {
+		char want[17];
+
+		snprintf(want, sizeof(want), "%06u\r\nshared\r\n", i);
+		assert_memory_equal(&out[(i / 2) * 16], want, 16);
+	}
+
+	irc_buf_unref(shared);
+	irc_sendq_clear(&sendq);
+
+	free(out);
+	free(metrics);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void sendq_flush_frees_storage(void **state)
+{
+	(void)state;
+
+	struct irc_metrics *const metrics = calloc(1, sizeof(*metrics));
+	assert_non_null(metrics);
+
+	struct irc_prof prof = { .metrics = metrics };
+	struct irc_net net = { .metrics = metrics, .prof = &prof };
+
+	int fds[2];
+	assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	struct irc_sendq sendq = {};
+
+	// An idle connection holds no storage once its queue is written out,
+	// and gets it back with the next line.
+	for (uint round = 0; round < 2; ++round) {
+		for (uint i = 0; i < 3; ++i) {
+			irc_sendq_push(&sendq, irc_buf_fmt(NULL, "%06u", i));
+		}
+		assert_non_null(sendq.entries);
+
+		const enum irc_sendq_status status =
+			irc_sendq_flush(&sendq, &net, fds[0]);
+
+		assert_int_equal(status, IRC_SENDQ_EMPTY);
+		assert_null(sendq.entries);
+		assert_int_equal(sendq.capacity, 0);
+
+		char out[3 * 8];
+		assert_int_equal(read(fds[1], out, sizeof(out)), sizeof(out));
+		assert_memory_equal(&out[16], "000002\r\n", 8);
+	}
+
+	free(metrics);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void sendq_clear_drops_references(void **state)
+{
+	(void)state;
+
+	struct irc_buf *shared = irc_buf_fmt(NULL, "shared");
+	struct irc_sendq sendq = {};
+
+	// Enough to wrap around after growing.
+	for (uint i = 0; i < 20; ++i) {
+		irc_sendq_push(&sendq, irc_buf_ref(shared));
+	}
+
+	assert_int_equal(sendq.num_entries, 20);
+	assert_int_equal(sendq.len, 20 * 8);
+
+	irc_sendq_clear(&sendq);
+
+	assert_int_equal(shared->refs, 1);
+	assert_int_equal(sendq.num_entries, 0);
+	assert_null(sendq.entries);
+
+	irc_buf_unref(shared);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(buf_fmt_terminates_line),
+		[1] = cmocka_unit_test(buf_fmt_truncates_long_line),
+		[2] = cmocka_unit_test(sendq_flush_resumes_after_block),
+		[3] = cmocka_unit_test(sendq_flush_frees_storage),
+		[4] = cmocka_unit_test(sendq_clear_drops_references)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/chan.h"
+#include "core/mask.h"
+#include "core/snapshot.h"
+
+/// @brief The channels a snapshot is written from, and the ones it is restored
+/// into.
+static struct irc_chans chans;
+static struct irc_chans next;
+
+static int setup(void **state)
+{
+	(void)state;
+
+	irc_chans_init(&chans);
+	irc_chans_init(&next);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	irc_chans_destroy(&chans);
+	irc_chans_destroy(&next);
+	return 0;
+}
+
+/// @brief Holds a snapshot file in a directory of its own.
+struct tmp_file {
+	char dir[32];
+	char path[48];
+};
+
+static void tmp_file_make(struct tmp_file *const tmp)
+{
+	strcpy(tmp->dir, "/tmp/core_test_snapshot_XXXXXX");
+	assert_non_null(mkdtemp(tmp->dir));
+
+	snprintf(tmp->path, sizeof(tmp->path), "%s/snap", tmp->dir);
+}
+
+static void tmp_file_remove(struct tmp_file *const tmp)
+{
+	unlink(tmp->path);
+	rmdir(tmp->dir);
+}
+
+static void mask_add(struct irc_chan *const chan,
+		     const enum irc_chan_masks list, const char *const mask,
+		     const char *const setter, const u64 set_at)
+{
+	if (!chan->masks[list]) {
+		chan->masks[list] = irc_mask_set_new();
+	}
+	assert_non_null(
+		irc_mask_set_add(chan->masks[list], mask, setter, set_at));
+}
+
+static void write_and_open(const struct irc_snapshot *const prev,
+			   struct irc_chans *const cur,
+			   const struct tmp_file *const tmp,
+			   struct irc_snapshot *const snap)
+{
+	assert_true(irc_snapshot_write(prev, cur, tmp->path));
+	assert_true(irc_snapshot_open(snap, tmp->path));
+}
+
+static void restore_brings_back_masks(void **state)
+{
+	(void)state;
+
+	struct tmp_file tmp;
+	tmp_file_make(&tmp);
+
+	struct irc_chan *chan = irc_chan_create(&chans, "#Foo");
+	chan->created = 1234;
+
+	mask_add(chan, IRC_CHAN_BANS, "bad!*@*", "alice", 42);
+	mask_add(chan, IRC_CHAN_BANS, "*!*@*.example", "bob", 43);
+	mask_add(chan, IRC_CHAN_EXCEPTS, "bad!*@good.example", "alice", 44);
+
+	const struct irc_snapshot none = {};
+	struct irc_snapshot snap = {};
+
+	write_and_open(&none, &chans, &tmp, &snap);
+	assert_int_equal(snap.hdr->num_chans, 1);
+
+	assert_null(irc_snapshot_restore(&snap, &next, "#bar"));
+	assert_non_null(irc_snapshot_find(&snap, "#fOO"));
+
+	chan = irc_snapshot_restore(&snap, &next, "#FOO");
+	assert_non_null(chan);
+	assert_ptr_equal(irc_chan_find(&next, "#foo"), chan);
+
+	// The name keeps the case it was created with.
+	assert_string_equal(chan->name, "#Foo");
+	assert_int_equal(chan->created, 1234);
+
+	assert_int_equal(chan->masks[IRC_CHAN_BANS]->num_entries, 2);
+	assert_int_equal(chan->masks[IRC_CHAN_EXCEPTS]->num_entries, 1);
+
+	const struct irc_mask_entry *entry =
+		chan->masks[IRC_CHAN_EXCEPTS]->entries[0];
+
+	assert_string_equal(entry->text, "bad!*@good.example");
+	assert_string_equal(entry->setter, "alice");
+	assert_int_equal(entry->set_at, 44);
+
+	const struct irc_mask_subject banned = { "bad", "u", "evil.example" };
+	const struct irc_mask_subject excepted = { "bad", "u", "good.example" };
+
+	assert_true(irc_mask_set_match(chan->masks[IRC_CHAN_BANS], &banned));
+	assert_true(
+		irc_mask_set_match(chan->masks[IRC_CHAN_EXCEPTS], &excepted));
+
+	// A channel is only restored once.
+	assert_null(irc_snapshot_find(&snap, "#foo"));
+
+	irc_snapshot_close(&snap);
+	tmp_file_remove(&tmp);
+}
+
+static void unrestore_leaves_record(void **state)
+{
+	(void)state;
+
+	struct tmp_file tmp;
+	tmp_file_make(&tmp);
+
+	irc_chan_create(&chans, "#foo");
+
+	const struct irc_snapshot none = {};
+	struct irc_snapshot snap = {};
+
+	write_and_open(&none, &chans, &tmp, &snap);
+
+	struct irc_chan *chan = irc_snapshot_restore(&snap, &next, "#foo");
+	assert_non_null(chan);
+
+	irc_snapshot_unrestore(&snap, &next, chan);
+	assert_null(irc_chan_find(&next, "#foo"));
+	assert_non_null(irc_snapshot_find(&snap, "#foo"));
+	assert_non_null(irc_snapshot_restore(&snap, &next, "#foo"));
+
+	irc_snapshot_close(&snap);
+	tmp_file_remove(&tmp);
+}
+
+static void next_snapshot_carries_unrestored(void **state)
+{
+	(void)state;
+
+	struct tmp_file tmp;
+	tmp_file_make(&tmp);
+
+	static const char *const names[] = { "#a", "#b", "#c" };
+
+	for (size_t i = 0; i < (sizeof(names) / sizeof(*names)); ++i) {
+		struct irc_chan *chan = irc_chan_create(&chans, names[i]);
+		mask_add(chan, IRC_CHAN_BANS, "x!*@*", "alice", 1);
+	}
+
+	const struct irc_snapshot none = {};
+	struct irc_snapshot snap = {};
+
+	write_and_open(&none, &chans, &tmp, &snap);
+
+	// #a lives on with another mask, #b is never joined, and #c dies
+	// once restored; #d is new.
+	struct irc_chan *a = irc_snapshot_restore(&snap, &next, "#a");
+	mask_add(a, IRC_CHAN_BANS, "y!*@*", "bob", 2);
+
+	irc_chan_destroy(&next, irc_snapshot_restore(&snap, &next, "#c"));
+	irc_chan_create(&next, "#d");
+
+	struct irc_snapshot after = {};
+
+	write_and_open(&snap, &next, &tmp, &after);
+	assert_int_equal(after.hdr->num_chans, 3);
+
+	const struct irc_snapshot_chan *rec = irc_snapshot_find(&after, "#a");
+	assert_non_null(rec);
+	assert_int_equal(rec->num_masks[IRC_CHAN_BANS], 2);
+
+	rec = irc_snapshot_find(&after, "#b");
+	assert_non_null(rec);
+	assert_int_equal(rec->num_masks[IRC_CHAN_BANS], 1);
+
+	assert_null(irc_snapshot_find(&after, "#c"));
+	assert_non_null(irc_snapshot_find(&after, "#d"));
+
+	irc_snapshot_close(&after);
+	irc_snapshot_close(&snap);
+	tmp_file_remove(&tmp);
+}
+
+static void damaged_masks_are_dropped(void **state)
+{
+	(void)state;
+
+	struct tmp_file tmp;
+	tmp_file_make(&tmp);
+
+	struct irc_chan *chan = irc_chan_create(&chans, "#foo");
+	mask_add(chan, IRC_CHAN_BANS, "bad!*@*", "alice", 1);
+	mask_add(chan, IRC_CHAN_BANS, "worse!*@*", "alice", 1);
+
+	const struct irc_snapshot none = {};
+	assert_true(irc_snapshot_write(&none, &chans, tmp.path));
+
+	// A space makes a mask malformed.
+	FILE *file = fopen(tmp.path, "r+b");
+	assert_non_null(file);
+
+	char buf[4096];
+	const size_t len = fread(buf, 1, sizeof(buf), file);
+	size_t pos = 0;
+
+	while (((pos + 6) <= len) && memcmp(&buf[pos], "worse!", 6)) {
+		++pos;
+	}
+	assert_true((pos + 6) <= len);
+
+	fseek(file, (long)pos, SEEK_SET);
+	fputc(' ', file);
+	fclose(file);
+
+	struct irc_snapshot snap = {};
+	assert_true(irc_snapshot_open(&snap, tmp.path));
+
+	chan = irc_snapshot_restore(&snap, &next, "#foo");
+	assert_non_null(chan);
+	assert_int_equal(chan->masks[IRC_CHAN_BANS]->num_entries, 1);
+	assert_string_equal(chan->masks[IRC_CHAN_BANS]->entries[0]->text,
+			    "bad!*@*");
+
+	irc_snapshot_close(&snap);
+	tmp_file_remove(&tmp);
+}
+
+static void reject_other_files(void **state)
+{
+	(void)state;
+
+	struct tmp_file tmp;
+	tmp_file_make(&tmp);
+
+	struct irc_snapshot snap = {};
+
+	assert_false(irc_snapshot_open(&snap, tmp.path));
+	assert_int_equal(errno, ENOENT);
+
+	irc_chan_create(&chans, "#foo");
+
+	const struct irc_snapshot none = {};
+	assert_true(irc_snapshot_write(&none, &chans, tmp.path));
+
+	// Cut short, as if the disk had filled up.
+	FILE *file = fopen(tmp.path, "r+b");
+	assert_non_null(file);
+	assert_int_equal(ftruncate(fileno(file), 200), 0);
+	fclose(file);
+
+	assert_false(irc_snapshot_open(&snap, tmp.path));
+	assert_int_equal(errno, EINVAL);
+
+	file = fopen(tmp.path, "w");
+	assert_non_null(file);
+	fputs("#foo 1234 +b bad!*@*\n", file);
+	fclose(file);
+
+	assert_false(irc_snapshot_open(&snap, tmp.path));
+	assert_int_equal(errno, EINVAL);
+	assert_null(snap.hdr);
+	assert_null(irc_snapshot_find(&snap, "#foo"));
+
+	tmp_file_remove(&tmp);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test_setup_teardown(restore_brings_back_masks,
+						      setup, teardown),
+		[1] = cmocka_unit_test_setup_teardown(unrestore_leaves_record,
+						      setup, teardown),
+		[2] = cmocka_unit_test_setup_teardown(
+			next_snapshot_carries_unrestored, setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(damaged_masks_are_dropped,
+						      setup, teardown),
+		[4] = cmocka_unit_test_setup_teardown(reject_other_files, setup,
+						      teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <link.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/util.h"
+
+// clang-format off
+
+/// The type of the notes describing USDT probes.
+#define NT_STAPSDT      (3)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A probe, as listed in trace.h.
+struct probe {
+	const char *name;
+	size_t num_args;
+	bool found;
+};
+
+#pragma GCC diagnostic pop
+
+static struct probe probes[] = {
+	{ "net_accept", 2, false },	 { "net_read", 2, false },
+	{ "net_send", 3, false },	 { "msg_parse_start", 2, false },
+	{ "msg_parse_done", 2, false },	 { "event_pub_start", 1, false },
+	{ "event_pub_done", 1, false },	 { "ht_resize", 3, false },
+};
+
+static char *elf;
+static size_t elf_size;
+
+/// @brief Returns the number of arguments of a probe, from the operands
+/// recorded in its note, e.g. `-4@%eax 8@%rdx`.
+static size_t args_count(const char *args)
+{
+	size_t num = 0;
+
+	while (*args) {
+		args += strspn(args, " ");
+
+		if (*args) {
+			++num;
+			args += strcspn(args, " ");
+		}
+	}
+	return num;
+}
+
+/// @brief Returns the section of the server binary with the given name, or
+/// `NULL`.
+static const ElfW(Shdr) *section_find(const char *const name)
+{
+	const ElfW(Ehdr) *const ehdr = (const ElfW(Ehdr) *)elf;
+	const ElfW(Shdr) *const shdrs = (const ElfW(Shdr) *)&elf[ehdr->e_shoff];
+	const char *const names = &elf[shdrs[ehdr->e_shstrndx].sh_offset];
+
+	for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+		if (!strcmp(&names[shdrs[i].sh_name], name)) {
+			return &shdrs[i];
+		}
+	}
+	return NULL;
+}
+
+static int setup(void **state)
+{
+	(void)state;
+
+	FILE *const file = fopen(IRC_TEST_SERVER_BIN, "rb");
+
+	if (!file) {
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	elf_size = (size_t)ftell(file);
+	rewind(file);
+
+	elf = irc_malloc(elf_size);
+
+	const size_t read = fread(elf, 1, elf_size, file);
+	fclose(file);
+
+	return (read == elf_size) ? 0 : -1;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	free(elf);
+	return 0;
+}
+
+/// @brief Checks every note of a probe of the server, and marks it as found.
+static void probes_check(void)
+{
+	const ElfW(Shdr) *const shdr = section_find(".note.stapsdt");
+	assert_non_null(shdr);
+	assert_true(shdr->sh_offset + shdr->sh_size <= elf_size);
+
+	size_t pos = shdr->sh_offset;
+	const size_t end = pos + shdr->sh_size;
+
+	while (pos < end) {
+		const ElfW(Nhdr) *const nhdr = (const ElfW(Nhdr) *)&elf[pos];
+		pos += sizeof(*nhdr);
+
+		const char *const owner = &elf[pos];
+		pos += (nhdr->n_namesz + 3) & ~(size_t)3;
+
+		// The location, base and semaphore of the probe come before
+		// its names.
+		const char *const provider =
+			&elf[pos + (3 * sizeof(ElfW(Addr)))];
+		pos += (nhdr->n_descsz + 3) & ~(size_t)3;
+
+		assert_int_equal(nhdr->n_type, NT_STAPSDT);
+		assert_string_equal(owner, "stapsdt");
+
+		if (strcmp(provider, "maven_ircd")) {
+			continue;
+		}
+		const char *const name = provider + strlen(provider) + 1;
+		const char *const args = name + strlen(name) + 1;
+
+		struct probe *probe = NULL;
+
+		for (size_t i = 0; i < (sizeof(probes) / sizeof(*probes));
+		     ++i) {
+			if (!strcmp(probes[i].name, name)) {
+				probe = &probes[i];
+			}
+		}
+
+		// Every probe of the server must be documented.
+		assert_non_null(probe);
+		assert_int_equal(args_count(args), probe->num_args);
+		probe->found = true;
+	}
+}
+
+static void probes_are_built_in(void **state)
+{
+	(void)state;
+
+	probes_check();
+
+	for (size_t i = 0; i < (sizeof(probes) / sizeof(*probes)); ++i) {
+		assert_true(probes[i].found);
+	}
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test_setup_teardown(probes_are_built_in,
+						      setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
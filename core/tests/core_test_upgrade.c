@@ -0,0 +1,415 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/chan.h"
+#include "core/ctx.h"
+#include "core/link.h"
+#include "core/net.h"
+#include "core/pool.h"
+#include "core/upgrade.h"
+#include "core/user.h"
+
+#define USER_NUM (3)
+
+/// @brief The server handing itself over, and the one taking over.
+static struct irc_ctx prev;
+static struct irc_ctx next;
+
+/// @brief The client ends of the connections of the users.
+static int peers[USER_NUM];
+
+/// @brief Connects a registered user to @ref prev.
+static struct irc_user *user_add(const size_t idx, const char *const nick)
+{
+	int socks[2];
+	assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+				    socks),
+			 0);
+	peers[idx] = socks[0];
+
+	struct irc_user *user =
+		irc_pool_calloc(IRC_POOL_USERS, sizeof(struct irc_user));
+
+	user->fd = socks[1];
+	user->registered = true;
+	user->ts = 1000 + idx;
+
+	strcpy(user->nick, nick);
+	strcpy(user->username, "u");
+	strcpy(user->host, "192.0.2.1");
+	strcpy(user->realname, "Real Name");
+
+	user->cls = irc_classes_match(&prev.classes, user->host);
+	user->cls->num_users++;
+
+	irc_ht_add(&prev.users, (void *)(uintptr_t)user->fd, user);
+	irc_ht_add(&prev.nicks, user->nick, user);
+	irc_links_user_add(&prev, user);
+	return user;
+}
+
+/// @brief Hands @ref prev over to @ref next from another process, as an
+/// upgrade does, and checks that both agree on the outcome.
+///
+/// @returns `true` if @ref next took over.
+static bool handover(void)
+{
+	int socks[2];
+	assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+				    socks),
+			 0);
+
+	const pid_t pid = fork();
+	assert_true(pid >= 0);
+
+	if (!pid) {
+		close(socks[1]);
+		_exit(irc_upgrade_send(&prev, socks[0]) ? EXIT_SUCCESS
+							 : EXIT_FAILURE);
+	}
+	close(socks[0]);
+
+	// Closing its end has the other process give up waiting.
+	const bool ok = irc_upgrade_recv(&next, socks[1]);
+	close(socks[1]);
+
+	int status;
+
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status) == EXIT_SUCCESS, ok);
+	return ok;
+}
+
+/// @brief Captures what @ref prev sends, which must not pass any descriptor,
+/// and acknowledges it.
+///
+/// @returns The length of the snapshot.
+static size_t capture(u8 *const data, const size_t size)
+{
+	int socks[2];
+	assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+				    socks),
+			 0);
+
+	const pid_t pid = fork();
+	assert_true(pid >= 0);
+
+	if (!pid) {
+		close(socks[1]);
+		_exit(irc_upgrade_send(&prev, socks[0]) ? EXIT_SUCCESS
+							 : EXIT_FAILURE);
+	}
+	close(socks[0]);
+
+	u64 len = 0;
+
+	assert_int_equal(recv(socks[1], &len, sizeof(len), MSG_WAITALL),
+			 sizeof(len));
+	assert_true(len <= size);
+	assert_int_equal(recv(socks[1], data, len, MSG_WAITALL), (ssize_t)len);
+
+	const u8 ack = 1;
+
+	assert_int_equal(send(socks[1], &ack, sizeof(ack), MSG_NOSIGNAL),
+			 sizeof(ack));
+	close(socks[1]);
+
+	int status;
+
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), EXIT_SUCCESS);
+	return (size_t)len;
+}
+
+/// @brief Has @ref next take over a snapshot said to be `claimed` bytes long,
+/// of which only `len` are sent.
+static bool replay(const u8 *const data, const size_t len, const u64 claimed)
+{
+	int socks[2];
+	assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+				    socks),
+			 0);
+
+	assert_int_equal(send(socks[0], &claimed, sizeof(claimed), 0),
+			 sizeof(claimed));
+	assert_int_equal(send(socks[0], data, len, 0), (ssize_t)len);
+
+	// The acknowledgement still has somewhere to go.
+	shutdown(socks[0], SHUT_WR);
+
+	const bool ok = irc_upgrade_recv(&next, socks[1]);
+
+	close(socks[0]);
+	close(socks[1]);
+	return ok;
+}
+
+/// @brief Closes the descriptors a context holds; destroying it does not.
+static void fds_close(struct irc_ctx *const ctx)
+{
+	for (size_t i = 0; i < ctx->users.capacity; ++i) {
+		const struct irc_ht_entry *entry = &ctx->users.entries[i];
+
+		if (entry->psl) {
+			close(((const struct irc_user *)entry->val)->fd);
+		}
+	}
+
+	for (size_t i = 0; i < ctx->net.listeners.num_entries; ++i) {
+		close(ctx->net.listeners.entries[i].fd);
+	}
+}
+
+static int group_setup(void **state)
+{
+	(void)state;
+
+	// Taking over registers the descriptors with the event loop.
+	return irc_net_platform_init(&next.net) ? 0 : -1;
+}
+
+static int setup(void **state)
+{
+	(void)state;
+
+	memset(&prev, 0, sizeof(prev));
+	memset(&next, 0, sizeof(next));
+
+	irc_init(&prev);
+	irc_init(&next);
+
+	for (size_t i = 0; i < USER_NUM; ++i) {
+		peers[i] = -1;
+	}
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	for (size_t i = 0; i < USER_NUM; ++i) {
+		if (peers[i] >= 0) {
+			close(peers[i]);
+		}
+	}
+	fds_close(&prev);
+	fds_close(&next);
+
+	irc_destroy(&prev);
+	irc_destroy(&next);
+	return 0;
+}
+
+static void state_round_trips(void **state)
+{
+	(void)state;
+
+	const int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	assert_true(listener >= 0);
+
+	prev.net.listeners.entries[0] = (struct irc_net_listener){
+		.fd = listener,
+		.type = IRC_NET_LISTENER_CLIENT,
+		.addr = { .host = "127.0.0.1", .port = "6667" }
+	};
+	prev.net.listeners.num_entries = 1;
+
+	struct irc_user *alice = user_add(0, "alice");
+	struct irc_user *bob = user_add(1, "bob");
+	struct irc_user *carol = user_add(2, "carol");
+
+	irc_user_away_set(bob, "gone", 4);
+
+	struct irc_chan *chan = irc_chan_create(&prev.chans, "#Test");
+	chan->created = 1234;
+
+	irc_chan_join(&prev.chans, chan, alice, IRC_MEMBER_OP);
+	irc_chan_join(&prev.chans, chan, bob, IRC_MEMBER_VOICE);
+	assert_non_null(
+		irc_chan_mask_add(chan, IRC_CHAN_BANS, "bad!*@*", "alice"));
+
+	irc_chan_join(&prev.chans, irc_chan_create(&prev.chans, "#other"),
+		      carol, 0);
+
+	// Queued, but not written before the hand over.
+	irc_user_sendf(&prev, alice, "NOTICE alice :pending");
+	assert_true(alice->sendq.len > 0);
+
+	assert_true(handover());
+
+	assert_int_equal(next.net.listeners.num_entries, 1);
+	assert_int_equal(next.net.listeners.entries[0].type,
+			 IRC_NET_LISTENER_CLIENT);
+	assert_string_equal(next.net.listeners.entries[0].addr.port, "6667");
+
+	assert_int_equal(next.users.num_entries, USER_NUM);
+	assert_int_equal(next.links.next_uid, prev.links.next_uid);
+
+	struct irc_user *a = irc_ht_get(&next.nicks, "ALICE");
+	struct irc_user *b = irc_ht_get(&next.nicks, "bob");
+	struct irc_user *c = irc_ht_get(&next.nicks, "carol");
+
+	assert_non_null(a);
+	assert_non_null(b);
+	assert_non_null(c);
+	assert_ptr_equal(irc_ht_get(&next.users, (void *)(uintptr_t)a->fd), a);
+
+	assert_true(a->registered);
+	assert_int_equal(a->ts, alice->ts);
+	assert_string_equal(a->username, "u");
+	assert_string_equal(a->host, "192.0.2.1");
+	assert_string_equal(a->realname, "Real Name");
+	assert_string_equal(a->uid, alice->uid);
+	assert_ptr_equal(irc_links_user_find(&next.links, a->uid), a);
+	assert_string_equal(b->away, "gone");
+
+	chan = irc_chan_find(&next.chans, "#test");
+	assert_non_null(chan);
+	assert_string_equal(chan->name, "#Test");
+	assert_int_equal(chan->created, 1234);
+	assert_int_equal(chan->members.num_entries, 2);
+
+	assert_int_equal(irc_chan_member_find(&next.chans, chan, a)->prefix,
+			 IRC_MEMBER_OP);
+	assert_int_equal(irc_chan_member_find(&next.chans, chan, b)->prefix,
+			 IRC_MEMBER_VOICE);
+	assert_null(irc_chan_member_find(&next.chans, chan, c));
+
+	assert_int_equal(chan->masks[IRC_CHAN_BANS]->num_entries, 1);
+	assert_string_equal(chan->masks[IRC_CHAN_BANS]->entries[0]->setter,
+			    "alice");
+
+	chan = irc_chan_find(&next.chans, "#other");
+	assert_non_null(chan);
+	assert_non_null(irc_chan_member_find(&next.chans, chan, c));
+
+	// What was pending is written by the new server, to the same client.
+	assert_int_equal(a->sendq.len, alice->sendq.len);
+	assert_int_equal(b->sendq.len, 0);
+
+	irc_users_flush(&next);
+	assert_int_equal(a->sendq.len, 0);
+
+	char buf[64] = {};
+	const ssize_t cnt = recv(peers[0], buf, sizeof(buf) - 1, 0);
+
+	assert_int_equal(cnt, (ssize_t)alice->sendq.len);
+	assert_string_equal(buf, "NOTICE alice :pending\r\n");
+}
+
+static void bad_uid_is_rejected(void **state)
+{
+	(void)state;
+
+	struct irc_user *alice = user_add(0, "alice");
+
+	// Filed under a good one here, but carried over under this.
+	strcpy(alice->uid, "0AA!!!!!!");
+
+	assert_false(handover());
+	assert_int_equal(next.users.num_entries, 0);
+	assert_int_equal(next.links.users.num_entries, 0);
+	assert_null(irc_ht_get(&next.nicks, "alice"));
+}
+
+static void taken_uid_is_rejected(void **state)
+{
+	(void)state;
+
+	const struct irc_user *alice = user_add(0, "alice");
+	struct irc_user *bob = user_add(1, "bob");
+
+	strcpy(bob->uid, alice->uid);
+
+	assert_false(handover());
+	assert_true(next.users.num_entries < 2);
+	assert_true(next.links.users.num_entries < 2);
+}
+
+static void corrupt_snapshot_is_rejected(void **state)
+{
+	(void)state;
+
+	// Without clients or listeners, no descriptor is passed along.
+	u8 data[256];
+	const size_t len = capture(data, sizeof(data) - 1);
+
+	assert_true(replay(data, len, len));
+
+	// Cut short, whether or not the length sent says so.
+	for (size_t i = 0; i < len; ++i) {
+		assert_false(replay(data, i, len));
+		assert_false(replay(data, i, i));
+	}
+
+	// With trailing bytes.
+	data[len] = 0;
+	assert_false(replay(data, len + 1, len + 1));
+
+	// Of another kind or version.
+	for (size_t i = 0; i < 8; i += 4) {
+		data[i] ^= 0x5a;
+		assert_false(replay(data, len, len));
+		data[i] ^= 0x5a;
+	}
+
+	// More than is ever taken over.
+	assert_false(replay(data, len, UINT64_MAX));
+
+	assert_true(replay(data, len, len));
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test_setup_teardown(state_round_trips, setup,
+						      teardown),
+		[1] = cmocka_unit_test_setup_teardown(bad_uid_is_rejected,
+						      setup, teardown),
+		[2] = cmocka_unit_test_setup_teardown(taken_uid_is_rejected,
+						      setup, teardown),
+		[3] = cmocka_unit_test_setup_teardown(
+			corrupt_snapshot_is_rejected, setup, teardown)
+	};
+	return cmocka_run_group_tests(tests, group_setup, NULL);
+}
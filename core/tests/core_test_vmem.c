@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/hash_table.h"
+#include "core/vmem.h"
+
+static void small_arrays_stay_on_heap(void **state)
+{
+	(void)state;
+
+	struct irc_vmem vm;
+	irc_vmem_alloc(&vm, 4096, IRC_VMEM_HUGETLB);
+
+	assert_int_equal(vm.mode, IRC_VMEM_HEAP);
+	assert_int_equal(vm.len, 0);
+
+	irc_vmem_free(&vm);
+	assert_null(vm.ptr);
+}
+
+static void large_arrays_are_mapped(void **state)
+{
+	(void)state;
+
+	static const enum irc_vmem_mode modes[] = { IRC_VMEM_PAGES,
+						    IRC_VMEM_THP,
+						    IRC_VMEM_HUGETLB };
+	const size_t size = IRC_VMEM_MAP_MIN + 1;
+
+	for (size_t i = 0; i < (sizeof(modes) / sizeof(*modes)); ++i) {
+		struct irc_vmem vm;
+		irc_vmem_alloc(&vm, size, modes[i]);
+
+		assert_true(vm.len >= size);
+
+		// Without a reserved pool, huge pages are only asked for.
+		if (modes[i] == IRC_VMEM_HUGETLB) {
+			assert_true((vm.mode == IRC_VMEM_HUGETLB) ||
+				    (vm.mode == IRC_VMEM_THP));
+		} else {
+			assert_int_equal(vm.mode, modes[i]);
+		}
+
+		if (vm.mode != IRC_VMEM_PAGES) {
+			assert_int_equal((uintptr_t)vm.ptr %
+						 IRC_VMEM_HUGE_PAGE_SIZE,
+					 0);
+		}
+
+		const u8 *bytes = vm.ptr;
+
+		for (size_t j = 0; j < size; j += 4096) {
+			assert_int_equal(bytes[j], 0);
+		}
+		memset(vm.ptr, 'x', size);
+
+		irc_vmem_free(&vm);
+		assert_null(vm.ptr);
+		assert_int_equal(vm.len, 0);
+	}
+}
+
+static void modes_round_trip(void **state)
+{
+	(void)state;
+
+	for (u32 i = 0; i < IRC_VMEM_MODE_NUM; ++i) {
+		enum irc_vmem_mode mode;
+
+		assert_true(irc_vmem_mode_parse(irc_vmem_mode_name(i), &mode));
+		assert_int_equal(mode, i);
+	}
+
+	enum irc_vmem_mode mode = IRC_VMEM_THP;
+
+	assert_false(irc_vmem_mode_parse("2M", &mode));
+	assert_int_equal(mode, IRC_VMEM_THP);
+}
+
+static void tables_move_onto_huge_pages(void **state)
+{
+	(void)state;
+
+	const struct irc_ht_conf conf = {
+		// clang-format off
+
+		.initial_capacity	= 64,
+		.load_fact_max		= 75,
+		.vmem			= IRC_VMEM_THP
+
+		// clang-format on
+	};
+
+	struct irc_ht ht;
+	irc_ht_init(&ht, &conf);
+
+	assert_int_equal(ht.mem.mode, IRC_VMEM_HEAP);
+
+	// Enough to outgrow the heap.
+	const size_t num = IRC_VMEM_MAP_MIN / sizeof(struct irc_ht_entry);
+
+	for (size_t i = 1; i <= num; ++i) {
+		irc_ht_add(&ht, (void *)(uintptr_t)i, (void *)(uintptr_t)i);
+	}
+
+	assert_int_equal(ht.mem.mode, IRC_VMEM_THP);
+
+	for (size_t i = 1; i <= num; ++i) {
+		assert_ptr_equal(irc_ht_get(&ht, (void *)(uintptr_t)i),
+				 (void *)(uintptr_t)i);
+	}
+
+	irc_ht_destroy(&ht);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(small_arrays_stay_on_heap),
+		[1] = cmocka_unit_test(large_arrays_are_mapped),
+		[2] = cmocka_unit_test(modes_round_trip),
+		[3] = cmocka_unit_test(tables_move_onto_huge_pages)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
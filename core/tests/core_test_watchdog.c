@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/metrics.h"
+#include "core/prof.h"
+#include "core/watchdog.h"
+
+// clang-format off
+
+#define THRESHOLD_MS    (20)
+#define STALL_MS        (200)
+
+// clang-format on
+
+static struct irc_log log_;
+static struct irc_metrics *metrics;
+static struct irc_prof prof;
+static struct irc_watchdog wd;
+
+static char logged[16384];
+static size_t logged_len;
+
+static void log_cb(void *const udata, const uint lvl, char *const str)
+{
+	(void)udata;
+	(void)lvl;
+
+	logged_len += (size_t)snprintf(&logged[logged_len],
+				       sizeof(logged) - logged_len, "%s\n",
+				       str);
+
+	if (logged_len >= sizeof(logged)) {
+		logged_len = sizeof(logged) - 1;
+	}
+}
+
+/// @brief Sleeps through the signals the watchdog interrupts the thread with.
+static void sleep_ms(const uint ms)
+{
+	struct timespec ts = { .tv_sec = ms / 1000,
+			       .tv_nsec = (long)(ms % 1000) * 1000000 };
+
+	while (nanosleep(&ts, &ts)) {
+	}
+}
+
+/// @brief Runs an iteration that stalls in a phase.
+static void iter_stall(const enum irc_prof_phase phase)
+{
+	irc_prof_iter_begin(&prof);
+	irc_prof_enter(&prof, phase);
+	sleep_ms(STALL_MS);
+	irc_prof_iter_end(&prof);
+}
+
+static int setup(void **state)
+{
+	(void)state;
+
+	metrics = calloc(1, sizeof(*metrics));
+
+	log_.cb = &log_cb;
+	log_.lvl = IRC_LOG_LVL_TRACE;
+	irc_log_init(&log_);
+
+	prof.metrics = metrics;
+
+	return irc_watchdog_start(&wd, &prof, &log_, THRESHOLD_MS) ? 0 : -1;
+}
+
+static void stall_is_reported(void **state)
+{
+	(void)state;
+
+	iter_stall(IRC_PROF_PHASE_DISPATCH);
+
+	// Leaves the watchdog the time to log the backtrace.
+	sleep_ms(STALL_MS);
+
+	pthread_mutex_lock(&log_.lock);
+
+	assert_non_null(strstr(logged, "stalled for"));
+	assert_non_null(strstr(logged, "in phase dispatch"));
+
+	// Reported once, however many times it was checked.
+	assert_null(strstr(strstr(logged, "stalled for") + 1, "stalled for"));
+
+	pthread_mutex_unlock(&log_.lock);
+
+	struct irc_metrics_snapshot *snap = malloc(sizeof(*snap));
+	irc_metrics_read(metrics, snap);
+
+	const struct irc_metrics_hist *dispatch =
+		&snap->hists[IRC_METRIC_HIST_LOOP_PHASE +
+			     IRC_PROF_PHASE_DISPATCH];
+	const struct irc_metrics_hist *busy =
+		&snap->hists[IRC_METRIC_HIST_LOOP_BUSY];
+
+	assert_int_equal(dispatch->count, 1);
+	assert_in_range(dispatch->sum, (u64)STALL_MS * 1000000, UINT64_MAX);
+	assert_int_equal(dispatch->buckets[irc_metrics_hist_bucket(
+				 dispatch->sum)],
+			 1);
+
+	assert_int_equal(busy->count, 1);
+	assert_in_range(busy->sum, dispatch->sum, UINT64_MAX);
+
+	// Not entered in the iteration, so not recorded.
+	assert_int_equal(snap->hists[IRC_METRIC_HIST_LOOP_PHASE +
+				     IRC_PROF_PHASE_FLUSH]
+				 .count,
+			 0);
+	free(snap);
+}
+
+static void poll_after_timers_is_not_busy(void **state)
+{
+	(void)state;
+
+	struct irc_metrics_snapshot *before = malloc(sizeof(*before));
+	struct irc_metrics_snapshot *after = malloc(sizeof(*after));
+
+	irc_metrics_read(metrics, before);
+
+	logged_len = 0;
+	logged[0] = '\0';
+
+	// The timers run before polling, which takes long but is not busy.
+	irc_prof_iter_begin(&prof);
+	irc_prof_enter(&prof, IRC_PROF_PHASE_TIMERS);
+	irc_prof_enter(&prof, IRC_PROF_PHASE_POLL);
+
+	assert_int_equal(atomic_load(&prof.busy_since), 0);
+	sleep_ms(STALL_MS);
+
+	irc_prof_enter(&prof, IRC_PROF_PHASE_READ);
+	assert_int_not_equal(atomic_load(&prof.busy_since), 0);
+	irc_prof_iter_end(&prof);
+
+	sleep_ms(THRESHOLD_MS * 2);
+
+	pthread_mutex_lock(&log_.lock);
+	assert_null(strstr(logged, "stalled for"));
+	pthread_mutex_unlock(&log_.lock);
+
+	irc_metrics_read(metrics, after);
+
+	const uint timers = IRC_METRIC_HIST_LOOP_PHASE + IRC_PROF_PHASE_TIMERS;
+	const uint busy = IRC_METRIC_HIST_LOOP_BUSY;
+
+	assert_int_equal(after->hists[timers].count,
+			 before->hists[timers].count + 1);
+	assert_int_equal(after->hists[busy].count,
+			 before->hists[busy].count + 1);
+	assert_true((after->hists[busy].sum - before->hists[busy].sum) <
+		    (u64)THRESHOLD_MS * 1000000);
+
+	free(before);
+	free(after);
+}
+
+static void stall_in_log_goes_to_stderr(void **state)
+{
+	(void)state;
+
+	FILE *const out = tmpfile();
+	assert_non_null(out);
+
+	fflush(stderr);
+
+	const int saved = dup(STDERR_FILENO);
+	dup2(fileno(out), STDERR_FILENO);
+
+	// The I/O thread stalls in a sink, holding the lock of the log.
+	logged_len = 0;
+	logged[0] = '\0';
+
+	pthread_mutex_lock(&log_.lock);
+	iter_stall(IRC_PROF_PHASE_FLUSH);
+	sleep_ms(STALL_MS);
+	pthread_mutex_unlock(&log_.lock);
+
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+
+	char buf[16384];
+
+	rewind(out);
+
+	const size_t len = fread(buf, 1, sizeof(buf) - 1, out);
+	buf[len] = '\0';
+	fclose(out);
+
+	assert_non_null(strstr(buf, "in phase flush"));
+	assert_null(strstr(logged, "stalled for"));
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(stall_is_reported),
+		[1] = cmocka_unit_test(poll_after_timers_is_not_busy),
+		[2] = cmocka_unit_test(stall_in_log_goes_to_stderr)
+	};
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include "cmocka.h"
+
+#pragma GCC diagnostic pop
+
+#include "core/buf.h"
+#include "core/sendq.h"
+#include "core/zip.h"
+
+// clang-format off
+
+/// @brief The number of lines compressed; enough to fill several buffers.
+#define LINE_NUM                (20000)
+
+// clang-format on
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief Collects decompressed output.
+struct sink {
+	char *data;
+	size_t len;
+};
+
+#pragma GCC diagnostic pop
+
+static void sink_out(void *const udata, const char *const data,
+		     const size_t len)
+{
+	struct sink *sink = udata;
+
+	assert_true(len <= IRC_ZIP_BUF_SIZE);
+
+	sink->data = realloc(sink->data, sink->len + len);
+	memcpy(&sink->data[sink->len], data, len);
+	sink->len += len;
+}
+
+/// @brief Moves the contents of a send queue into a single allocation.
+static char *sendq_take(struct irc_sendq *const sendq, size_t *const len)
+{
+	char *data = malloc(sendq->len);
+
+	*len = 0;
+
+	for (u32 i = 0; i < sendq->num_entries; ++i) {
+		const struct irc_buf *buf =
+			sendq->entries[(sendq->head + i) &
+				       (sendq->capacity - 1)];
+
+		memcpy(&data[*len], buf->data, buf->len);
+		*len += buf->len;
+	}
+	assert_int_equal(*len, sendq->len);
+
+	irc_sendq_clear(sendq);
+	return data;
+}
+
+static void lines_round_trip(void **state)
+{
+	(void)state;
+
+	if (!irc_zip_supported()) {
+		skip();
+	}
+	struct irc_zip *def = irc_zip_deflater_new();
+	struct irc_zip *inf = irc_zip_inflater_new();
+	struct irc_sendq sendq = {};
+
+	assert_non_null(def);
+	assert_non_null(inf);
+
+	char *plain = malloc(LINE_NUM * 64);
+	size_t plain_len = 0;
+
+	for (u32 i = 0; i < LINE_NUM; ++i) {
+		char *line = &plain[plain_len];
+		const int len = sprintf(line,
+					":1AA UID n%u 1 900 u h 1AA%06u :R\r\n",
+					i, i);
+
+		plain_len += (size_t)len;
+		irc_zip_deflate(def, line, (size_t)len, false, &sendq);
+	}
+
+	// Nothing is held back once flushed, and flushing again is a no-op.
+	irc_zip_deflate(def, NULL, 0, true, &sendq);
+
+	const size_t queued = sendq.len;
+
+	irc_zip_deflate(def, NULL, 0, true, &sendq);
+	assert_int_equal(sendq.len, queued);
+
+	size_t wire_len;
+	char *wire = sendq_take(&sendq, &wire_len);
+
+	const struct irc_zip_stats *stats = irc_zip_stats(def);
+
+	assert_int_equal(stats->plain_bytes, plain_len);
+	assert_int_equal(stats->wire_bytes, wire_len);
+	assert_true((wire_len * 5) < plain_len);
+
+	// Arbitrary splits of the stream decompress all the same.
+	struct sink sink = {};
+	size_t off = 0;
+
+	for (size_t step = 1; off < wire_len; step = (step * 7) % 1999 + 1) {
+		const size_t len =
+			((wire_len - off) < step) ? (wire_len - off) : step;
+
+		const bool ok = irc_zip_inflate(inf, &wire[off], len,
+						&sink_out, &sink);
+		assert_true(ok);
+
+		off += len;
+	}
+	assert_int_equal(sink.len, plain_len);
+	assert_memory_equal(sink.data, plain, plain_len);
+
+	stats = irc_zip_stats(inf);
+
+	assert_int_equal(stats->plain_bytes, plain_len);
+	assert_int_equal(stats->wire_bytes, wire_len);
+
+	free(sink.data);
+	free(wire);
+	free(plain);
+	irc_zip_free(def);
+	irc_zip_free(inf);
+}
+
+static void flush_delivers_everything(void **state)
+{
+	(void)state;
+
+	if (!irc_zip_supported()) {
+		skip();
+	}
+	struct irc_zip *def = irc_zip_deflater_new();
+	struct irc_zip *inf = irc_zip_inflater_new();
+	struct irc_sendq sendq = {};
+	struct sink sink = {};
+
+	static const char *const lines[] = { "PING 1AA\r\n", "PONG 1AA\r\n",
+					     ":1AA EOB\r\n" };
+
+	// Each flush makes what was sent up to it readable by itself.
+	for (size_t i = 0; i < (sizeof(lines) / sizeof(*lines)); ++i) {
+		irc_zip_deflate(def, lines[i], strlen(lines[i]), false, &sendq);
+		assert_int_equal(sendq.len, 0);
+
+		irc_zip_deflate(def, NULL, 0, true, &sendq);
+		assert_true(sendq.len > 0);
+
+		size_t wire_len;
+		char *wire = sendq_take(&sendq, &wire_len);
+
+		const size_t before = sink.len;
+		const bool ok =
+			irc_zip_inflate(inf, wire, wire_len, &sink_out, &sink);
+
+		assert_true(ok);
+		assert_int_equal(sink.len - before, strlen(lines[i]));
+		assert_memory_equal(&sink.data[before], lines[i],
+				    strlen(lines[i]));
+		free(wire);
+	}
+	free(sink.data);
+	irc_zip_free(def);
+	irc_zip_free(inf);
+}
+
+static void reject_corrupt_stream(void **state)
+{
+	(void)state;
+
+	if (!irc_zip_supported()) {
+		skip();
+	}
+	struct irc_zip *inf = irc_zip_inflater_new();
+	struct sink sink = {};
+
+	static const char garbage[] = "PASS secret TS 6 :2BB\r\n";
+
+	const bool ok = irc_zip_inflate(inf, garbage, sizeof(garbage) - 1,
+					&sink_out, &sink);
+	assert_false(ok);
+	assert_int_equal(sink.len, 0);
+
+	irc_zip_free(inf);
+}
+
+int main(void)
+{
+	static const struct CMUnitTest tests[] = {
+		[0] = cmocka_unit_test(lines_round_trip),
+		[1] = cmocka_unit_test(flush_delivers_everything),
+		[2] = cmocka_unit_test(reject_corrupt_stream)
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright 2024 dgz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// @file main.c Renders binary log files written by @ref irc_log_bin back to
+/// text.
+///
+/// Usage: `irc-logdecode FILE...`
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/log.h"
+#include "core/log_bin.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+/// @brief A call site as read back from the table of a log file.
+struct site {
+	const char *file;
+	const char *fmt;
+	u32 file_len;
+	u32 fmt_len;
+	u32 line;
+	u32 lvl;
+};
+
+#pragma GCC diagnostic pop
+
+static const char *const lvl_str[] = {
+	// clang-format off
+
+	[IRC_LOG_LVL_INFO]	= "info",
+	[IRC_LOG_LVL_WARN]	= "warn",
+	[IRC_LOG_LVL_ERR]	= "error",
+	[IRC_LOG_LVL_DBG]	= "debug",
+	[IRC_LOG_LVL_TRACE]	= "trace",
+	[IRC_LOG_LVL_FATAL]	= "fatal"
+
+	// clang-format on
+};
+
+static void rec_render(const struct site *const site,
+		       const struct irc_log_bin_rec *const rec,
+		       const u8 *const payload)
+{
+	const time_t secs = (time_t)(rec->ts / 1000000000);
+	struct tm tm;
+	char ts[32];
+
+	gmtime_r(&secs, &tm);
+	strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+
+	const char *lvl = ((site->lvl < (sizeof(lvl_str) / sizeof(*lvl_str))) &&
+			   lvl_str[site->lvl]) ?
+				  lvl_str[site->lvl] :
+				  "?";
+
+	printf("%s.%09" PRIu64 " [%s] %.*s:%" PRIu32 ": ", ts,
+	       rec->ts % 1000000000, lvl, (int)site->file_len, site->file,
+	       site->line);
+
+	// The format string stored in the file is not NUL terminated.
+	char fmt[1024];
+	const size_t fmt_len = (site->fmt_len < sizeof(fmt)) ?
+				       site->fmt_len :
+				       (sizeof(fmt) - 1);
+
+	memcpy(fmt, site->fmt, fmt_len);
+	fmt[fmt_len] = '\0';
+
+	irc_log_bin_render(stdout, fmt, payload, rec->size - sizeof(*rec));
+	putchar('\n');
+}
+
+static bool file_decode(const char *const path)
+{
+	const int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		fprintf(stderr, "irc-logdecode: unable to open %s\n", path);
+		return false;
+	}
+
+	struct stat st;
+
+	if ((fstat(fd, &st) < 0) ||
+	    ((size_t)st.st_size < sizeof(struct irc_log_bin_hdr))) {
+		fprintf(stderr, "irc-logdecode: %s is not a binary log\n",
+			path);
+		close(fd);
+		return false;
+	}
+
+	const size_t size = (size_t)st.st_size;
+	const u8 *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "irc-logdecode: unable to map %s\n", path);
+		return false;
+	}
+
+	struct irc_log_bin_hdr hdr;
+	memcpy(&hdr, map, sizeof(hdr));
+
+	if (memcmp(hdr.magic, IRC_LOG_BIN_MAGIC, sizeof(IRC_LOG_BIN_MAGIC)) ||
+	    (hdr.version != IRC_LOG_BIN_VERSION) ||
+	    (hdr.site_tbl_size > (size - sizeof(hdr))) ||
+	    (hdr.num_sites >
+	     (hdr.site_tbl_size / sizeof(struct irc_log_bin_site)))) {
+		fprintf(stderr, "irc-logdecode: %s is not a binary log\n",
+			path);
+		munmap((void *)(uintptr_t)map, size);
+		return false;
+	}
+
+	struct site *sites = calloc(hdr.num_sites + 1, sizeof(*sites));
+	const size_t tbl_end = sizeof(hdr) + hdr.site_tbl_size;
+	size_t pos = sizeof(hdr);
+	u32 num_sites = 0;
+
+	for (; num_sites < hdr.num_sites; ++num_sites) {
+		struct irc_log_bin_site ent;
+
+		// Every entry has to lie within the table, or the file is
+		// truncated or corrupt.
+		if ((tbl_end - pos) < sizeof(ent)) {
+			break;
+		}
+		memcpy(&ent, &map[pos], sizeof(ent));
+		pos += sizeof(ent);
+
+		if (((u64)ent.file_len + ent.fmt_len) > (tbl_end - pos)) {
+			break;
+		}
+
+		sites[num_sites] = (struct site){
+			.file = (const char *)&map[pos],
+			.file_len = ent.file_len,
+			.fmt = (const char *)&map[pos + ent.file_len],
+			.fmt_len = ent.fmt_len,
+			.line = ent.line,
+			.lvl = ent.lvl
+		};
+
+		pos += ent.file_len + ent.fmt_len;
+	}
+
+	if ((num_sites != hdr.num_sites) || (pos != tbl_end)) {
+		fprintf(stderr,
+			"irc-logdecode: %s has a corrupt site table\n", path);
+		free(sites);
+		munmap((void *)(uintptr_t)map, size);
+		return false;
+	}
+
+	while ((pos + sizeof(struct irc_log_bin_rec)) <= size) {
+		struct irc_log_bin_rec rec;
+		memcpy(&rec, &map[pos], sizeof(rec));
+
+		// A zero size marks the end of a log that was not closed
+		// cleanly.
+		if ((rec.size < sizeof(rec)) || (rec.size > (size - pos))) {
+			break;
+		}
+
+		if (rec.site_id < hdr.num_sites) {
+			rec_render(&sites[rec.site_id], &rec,
+				   &map[pos + sizeof(rec)]);
+		} else {
+			printf("<unknown call site %" PRIu32 ">\n",
+			       rec.site_id);
+		}
+		pos += rec.size;
+	}
+
+	free(sites);
+	munmap((void *)(uintptr_t)map, size);
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s FILE...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int ret = EXIT_SUCCESS;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!file_decode(argv[i])) {
+			ret = EXIT_FAILURE;
+		}
+	}
+	return ret;
+}